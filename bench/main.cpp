@@ -0,0 +1,611 @@
+// instruments-bench - fixed-input microbenchmarks for the codecs on the
+// receive and send paths (DTX, NSKeyedArchiver, primitive dictionaries,
+// LZ4 / bv4, sysmontap and activity trace decoding, RemoteXPC, HTTP/2).
+//
+// Each case runs for at least --min-time ms and reports time per operation,
+// throughput over its input bytes and heap allocations per operation
+// (counted by the global operator new below).
+//
+// The DTXConnection/replay cases run a whole connection end to end: a
+// recorded device connection (DTXReplay) is played back as fast as
+// possible through the receive loop, decoding and dispatch up to the
+// message handler; one operation is one replay of the capture.
+//
+// Usage:
+//   instruments-bench [--filter <substring>] [--min-time <ms>] [--corpus <dir>]
+//
+// --corpus adds a DTXMessage::Decode case per *.dtx file in dir (one raw
+// single-fragment DTX message as received, header included) and a
+// DTXConnection/replay case per *.dtxcap capture
+// (DeviceConnection::SetCaptureDirectory()), so captured traffic can be
+// measured next to the built-in inputs.
+
+#include "../include/instruments/dtx_connection.h"
+#include "../include/instruments/dtx_message.h"
+#include "../src/connection/http2_framer.h"
+#include "../src/connection/xpc_message.h"
+#include "../src/dtx/dtx_capture.h"
+#include "../src/dtx/dtx_primitive_dict.h"
+#include "../src/nskeyedarchiver/nsobject.h"
+#include "../src/nskeyedarchiver/nskeyedarchiver.h"
+#include "../src/nskeyedarchiver/nskeyedunarchiver.h"
+#include "../src/services/log_stream_decoder.h"
+#include "../src/services/sysmontap_decoder.h"
+#include "../src/util/log.h"
+#include "../src/util/lz4.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace instruments;
+
+// --- Allocation counting ---
+
+// GCC flags free() on memory from the operator new defined here
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static std::atomic<uint64_t> g_allocations{0};
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+// --- Harness ---
+
+struct BenchCase {
+    std::string name;
+    size_t bytes = 0;               // input bytes per operation
+    std::function<size_t()> run;    // returns a value derived from the output
+};
+
+static volatile size_t g_sink = 0;
+
+static void RunCase(const BenchCase& bench, double minTimeMs) {
+    using Clock = std::chrono::steady_clock;
+
+    // Warm up caches, pools and scratch buffers
+    for (int i = 0; i < 3; i++) g_sink = g_sink + bench.run();
+
+    uint64_t iterations = 1;
+    for (;;) {
+        const uint64_t allocsBefore = g_allocations.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; i++) g_sink = g_sink + bench.run();
+        const double elapsedNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        const uint64_t allocs = g_allocations.load(std::memory_order_relaxed) - allocsBefore;
+
+        if (elapsedNs >= minTimeMs * 1e6 || iterations >= (1ull << 40)) {
+            const double nsPerOp = elapsedNs / static_cast<double>(iterations);
+            const double mbPerSec = bench.bytes > 0
+                ? static_cast<double>(bench.bytes) / nsPerOp * 1e9 / (1024.0 * 1024.0) : 0.0;
+            std::printf("%-44s %10zu %12.1f %10.1f %10.2f\n", bench.name.c_str(), bench.bytes,
+                        nsPerOp, mbPerSec,
+                        static_cast<double>(allocs) / static_cast<double>(iterations));
+            return;
+        }
+        // Aim just past the minimum time on the next round
+        const double scale = elapsedNs > 0 ? (minTimeMs * 1e6 * 1.2) / elapsedNs : 100.0;
+        iterations = static_cast<uint64_t>(static_cast<double>(iterations) *
+                                           (scale < 100.0 ? (scale > 2.0 ? scale : 2.0) : 100.0));
+    }
+}
+
+// --- Inputs ---
+//
+// Built once at startup with fixed contents, shaped like device traffic:
+// sysmontap samples with N process rows, a runningProcesses-style array,
+// DTX method calls with auxiliary arguments, RSD service discovery replies.
+
+static const std::vector<std::string> kProcessAttributes = {
+    "pid", "name", "cpuUsage", "physFootprint",
+    "memAnon", "memVirtualSize",
+    "diskBytesRead", "diskBytesWritten", "threadCount"
+};
+
+static NSObject MakeSysmontapSample(int processCount) {
+    NSObject::DictType processes;
+    for (int i = 0; i < processCount; i++) {
+        const int64_t pid = 100 + i * 7;
+        NSObject::ArrayType row;
+        row.push_back(NSObject(pid));
+        row.push_back(NSObject("process-" + std::to_string(i)));
+        row.push_back(NSObject(0.5 * (i % 13)));
+        row.push_back(NSObject(static_cast<int64_t>(1048576) * (1 + i % 40)));
+        row.push_back(NSObject(static_cast<int64_t>(524288) * (1 + i % 17)));
+        row.push_back(NSObject(static_cast<int64_t>(4294967296) + i * 4096));
+        row.push_back(NSObject(static_cast<int64_t>(i) * 8192));
+        row.push_back(NSObject(static_cast<int64_t>(i) * 4096));
+        row.push_back(NSObject(static_cast<int64_t>(1 + i % 24)));
+        processes[std::to_string(pid)] = NSObject(std::move(row));
+    }
+
+    NSObject::DictType cpu;
+    cpu["CPU_TotalLoad"] = NSObject(37.5);
+    cpu["CPU_UserLoad"] = NSObject(25.0);
+    cpu["CPU_SystemLoad"] = NSObject(12.5);
+
+    NSObject::ArrayType system;
+    for (int i = 0; i < 12; i++) system.push_back(NSObject(static_cast<int64_t>(i) * 1000));
+
+    NSObject::DictType sample;
+    sample["Processes"] = NSObject(std::move(processes));
+    sample["System"] = NSObject(std::move(system));
+    sample["SystemCPUUsage"] = NSObject(std::move(cpu));
+    sample["CPUCount"] = NSObject(static_cast<int64_t>(6));
+    sample["EnabledCPUs"] = NSObject(static_cast<int64_t>(6));
+    sample["EndMachAbsTime"] = NSObject(static_cast<uint64_t>(123456789012ull));
+    sample["Type"] = NSObject(static_cast<int64_t>(7));
+
+    NSObject::ArrayType payload;
+    payload.push_back(NSObject(std::move(sample)));
+    return NSObject(std::move(payload));
+}
+
+static NSObject MakeProcessList(int processCount) {
+    NSObject::ArrayType list;
+    for (int i = 0; i < processCount; i++) {
+        NSObject::DictType process;
+        process["pid"] = NSObject(static_cast<int64_t>(100 + i * 7));
+        process["name"] = NSObject("process-" + std::to_string(i));
+        process["realAppName"] = NSObject("/private/var/containers/Bundle/Application/App" +
+                                          std::to_string(i) + ".app/App");
+        process["isApplication"] = NSObject(i % 5 == 0);
+        process["bundleIdentifier"] = NSObject("com.example.app" + std::to_string(i));
+        process["startDate"] = NSObject(7.1e8 + i);
+        list.push_back(NSObject(std::move(process)));
+    }
+    return NSObject(std::move(list));
+}
+
+static std::vector<NSObject> MakeAuxiliary() {
+    NSObject::DictType config;
+    config["ur"] = NSObject(static_cast<int64_t>(1000));
+    config["bm"] = NSObject(static_cast<int64_t>(0));
+    config["cpuUsage"] = NSObject(true);
+    config["sampleInterval"] = NSObject(static_cast<int64_t>(1000000000));
+    NSObject::ArrayType attrs;
+    for (const auto& a : kProcessAttributes) attrs.push_back(NSObject(a));
+    config["procAttrs"] = NSObject(std::move(attrs));
+
+    std::vector<NSObject> aux;
+    aux.push_back(NSObject(std::move(config)));
+    aux.push_back(NSObject(static_cast<int64_t>(1234)));
+    aux.push_back(NSObject("com.example.app"));
+    return aux;
+}
+
+// Raw received form of msg: header + payload section, one fragment
+static std::vector<uint8_t> WireOf(const DTXMessage& msg) {
+    std::vector<uint8_t> wire;
+    for (const auto& fragment : msg.Encode()) wire.insert(wire.end(), fragment.begin(), fragment.end());
+    return wire;
+}
+
+static void PutLE32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+// Rewrap an uncompressed wire message as a 0x0707 message whose body is a
+// sysmontap-style "bv4" container of 64 KB LZ4 chunks
+static std::vector<uint8_t> MakeBV4Wire(const std::vector<uint8_t>& wire) {
+    const size_t sectionLen = wire.size() - DTXProtocol::HeaderLength;
+    const uint8_t* section = wire.data() + DTXProtocol::HeaderLength;
+    uint32_t origType = 0;
+    std::memcpy(&origType, section, 4);
+
+    std::vector<uint8_t> container;
+    std::vector<uint8_t> block;
+    for (size_t off = 0; off < sectionLen; off += 65536) {
+        const size_t chunk = std::min<size_t>(65536, sectionLen - off);
+        block.resize(LZ4::CompressBound(chunk));
+        size_t compressed = 0;
+        LZ4::Compress(section + off, chunk, block.data(), block.size(), compressed);
+        if (off > 0) {
+            const char tag[] = {'b', 'v', '4', '1'};
+            container.insert(container.end(), tag, tag + 4);
+        }
+        PutLE32(container, static_cast<uint32_t>(chunk));
+        PutLE32(container, static_cast<uint32_t>(compressed));
+        container.insert(container.end(), block.begin(), block.begin() + compressed);
+    }
+    const char end[] = {'b', 'v', '4', '$'};
+    container.insert(container.end(), end, end + 4);
+
+    std::vector<uint8_t> body;
+    PutLE32(body, static_cast<uint32_t>(DTXMessageType::LZ4Compressed));
+    PutLE32(body, 0);
+    PutLE32(body, static_cast<uint32_t>(8 + container.size()));
+    PutLE32(body, 0);
+    PutLE32(body, origType);
+    PutLE32(body, static_cast<uint32_t>(sectionLen));
+    body.insert(body.end(), container.begin(), container.end());
+
+    std::vector<uint8_t> out(wire.begin(), wire.begin() + DTXProtocol::HeaderLength);
+    const uint32_t messageLength = static_cast<uint32_t>(body.size());
+    std::memcpy(out.data() + 12, &messageLength, 4);
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+}
+
+static BenchCase DecodeDTXCase(std::string name, std::vector<uint8_t> wire) {
+    const size_t bytes = wire.size();
+    return {std::move(name), bytes, [wire = std::move(wire)]() -> size_t {
+        DTXMessageHeader header;
+        if (!DTXMessage::ParseHeader(wire.data(), wire.size(), header)) return 0;
+        auto msg = DTXMessage::Decode(header, wire.data() + DTXProtocol::HeaderLength,
+                                      wire.size() - DTXProtocol::HeaderLength);
+        return msg ? msg->RawPayload().size() + msg->RawAuxiliary().size() : 0;
+    }};
+}
+
+// A sysmontap session as recorded: the capabilities exchange, then one
+// sample per second on the device side
+static std::shared_ptr<DTXCapture> MakeSysmontapCapture(int samples) {
+    auto capture = std::make_shared<DTXCapture>();
+    capture->info.service = "instruments";
+    auto add = [&](DTXCaptureDirection direction, uint64_t timestampUs, const DTXMessage& msg) {
+        DTXCaptureRecord record;
+        record.direction = direction;
+        record.timestampUs = timestampUs;
+        record.data = WireOf(msg);
+        capture->records.push_back(std::move(record));
+    };
+
+    NSObject::DictType caps;
+    caps["com.apple.private.DTXBlockCompression"] = NSObject(static_cast<uint64_t>(2));
+    caps["com.apple.private.DTXConnection"] = NSObject(static_cast<uint64_t>(1));
+    auto handshake = DTXMessage::CreateWithSelector("_notifyOfPublishedCapabilities:");
+    handshake->AppendAuxiliary(NSObject(std::move(caps)));
+    add(DTXCaptureDirection::Sent, 0, *handshake);
+    add(DTXCaptureDirection::Received, 2000, *handshake);
+
+    auto sample = DTXMessage::Create();
+    sample->SetPayload(MakeSysmontapSample(40));
+    sample->SetMessageType(DTXMessageType::MethodInvocation);
+    sample->SetChannelCode(static_cast<uint32_t>(-1));
+    for (int i = 0; i < samples; i++) {
+        sample->SetIdentifier(static_cast<uint32_t>(i + 1));
+        add(DTXCaptureDirection::Received, 1000000ull * (i + 1), *sample);
+    }
+    return capture;
+}
+
+static BenchCase ReplayCase(std::string name, std::shared_ptr<const DTXCapture> capture) {
+    size_t bytes = 0;
+    size_t frames = 0;
+    for (const auto& record : capture->records) {
+        if (record.direction != DTXCaptureDirection::Received) continue;
+        bytes += record.data.size();
+        frames++;
+    }
+    name += " (" + std::to_string(frames) + " frames)";
+    return {std::move(name), bytes, [capture]() -> size_t {
+        DTXReplayOptions options;
+        options.speed = 0;
+        options.followClient = false;
+        auto conn = DTXConnection::CreateFromReplay(std::make_shared<DTXReplay>(capture, options));
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool closed = false;
+        size_t messages = 0;
+        conn->SetGlobalMessageHandler([&](std::shared_ptr<DTXMessage>) { messages++; });
+        conn->SetCloseHandler([&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            cv.notify_all();
+        });
+        if (conn->Connect() != Error::Success) return 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return closed; });
+        }
+        conn->Disconnect();
+        return messages;
+    }};
+}
+
+// One payload in LogStreamDecoder's (unverified) packed layout: a pid name
+// record and `records` log records
+static std::vector<uint8_t> MakeActivityTracePayload(int records) {
+    std::vector<uint8_t> out;
+    auto put = [&out](const void* p, size_t n) {
+        out.insert(out.end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + n);
+    };
+    auto record = [&](uint8_t kind, uint8_t type, uint32_t pid,
+                      std::initializer_list<std::pair<uint8_t, std::string>> fields) {
+        std::vector<uint8_t> body;
+        std::swap(body, out);
+        const uint16_t count = static_cast<uint16_t>(fields.size());
+        const uint64_t machTime = 123456789, tid = 4242;
+        out.push_back(kind);
+        out.push_back(type);
+        put(&count, 2);
+        put(&machTime, 8);
+        put(&pid, 4);
+        put(&tid, 8);
+        for (const auto& [tag, text] : fields) {
+            const uint16_t size = static_cast<uint16_t>(text.size());
+            out.push_back(tag);
+            out.push_back(0);
+            put(&size, 2);
+            put(text.data(), text.size());
+        }
+        std::swap(body, out);
+        const uint32_t length = static_cast<uint32_t>(body.size());
+        put(&length, 4);
+        put(body.data(), body.size());
+    };
+    record(2, 0, 321, {{1, "SpringBoard"}});
+    for (int i = 0; i < records; i++) {
+        record(0, i % 10 == 0 ? 0x10 : 0x00, 321,
+               {{2, "com.apple.UIKit"}, {3, "EventDispatch"},
+                {4, "Sending event to window " + std::to_string(i) + " with phase began"}});
+    }
+    return out;
+}
+
+static std::vector<BenchCase> BuildCases() {
+    std::vector<BenchCase> cases;
+
+    // NSKeyedArchiver / NSKeyedUnarchiver / sysmontap
+    for (int processCount : {40, 400}) {
+        const std::string suffix = "/" + std::to_string(processCount) + "procs";
+        const NSObject sample = MakeSysmontapSample(processCount);
+        const std::vector<uint8_t> archive = NSKeyedArchiver::Archive(sample);
+
+        cases.push_back({"NSKeyedArchiver::Archive/sysmontap" + suffix, archive.size(),
+            [sample]() { return NSKeyedArchiver::Archive(sample).size(); }});
+        cases.push_back({"NSKeyedUnarchiver::Unarchive/sysmontap" + suffix, archive.size(),
+            [archive]() { return NSKeyedUnarchiver::Unarchive(archive).Size(); }});
+        cases.push_back({"SysmontapDecoder/sysmontap" + suffix, archive.size(),
+            [archive]() -> size_t {
+                static SysmontapLayout layout = []() {
+                    SysmontapLayout l;
+                    l.rows.Compile(kProcessAttributes);
+                    return l;
+                }();
+                SysmontapDecoder decoder(layout);
+                if (!NSKeyedUnarchiver::Visit(archive.data(), archive.size(), decoder)) return 0;
+                SysmontapSample out;
+                decoder.Finish(out);
+                return out.processes.size();
+            }});
+    }
+    {
+        const NSObject list = MakeProcessList(300);
+        const std::vector<uint8_t> archive = NSKeyedArchiver::Archive(list);
+        cases.push_back({"NSKeyedArchiver::Archive/runningProcesses", archive.size(),
+            [list]() { return NSKeyedArchiver::Archive(list).size(); }});
+        cases.push_back({"NSKeyedUnarchiver::Unarchive/runningProcesses", archive.size(),
+            [archive]() { return NSKeyedUnarchiver::Unarchive(archive).Size(); }});
+    }
+
+    // DTXPrimitiveDict (method arguments)
+    {
+        const std::vector<NSObject> aux = MakeAuxiliary();
+        const std::vector<uint8_t> encoded = DTXPrimitiveDict::Encode(aux);
+        cases.push_back({"DTXPrimitiveDict::Encode/methodArgs", encoded.size(),
+            [aux]() { return DTXPrimitiveDict::Encode(aux).size(); }});
+        cases.push_back({"DTXPrimitiveDict::Decode/methodArgs", encoded.size(),
+            [encoded]() { return DTXPrimitiveDict::Decode(encoded).size(); }});
+    }
+
+    // DTXMessage encode / decode: a method call, a sysmontap sample as
+    // sent, LZ4-compressed (0x0707) and in a bv4 container
+    {
+        auto call = DTXMessage::CreateWithSelector("setConfig:");
+        for (const auto& arg : MakeAuxiliary()) call->AppendAuxiliary(arg);
+        call->SetChannelCode(3);
+        call->SetIdentifier(42);
+        call->SetExpectsReply(true);
+        const std::vector<uint8_t> callWire = WireOf(*call);
+        cases.push_back({"DTXMessage::Encode/methodCall", callWire.size(),
+            [call]() { return call->Encode().size(); }});
+        cases.push_back(DecodeDTXCase("DTXMessage::Decode/methodCall", callWire));
+
+        auto sample = DTXMessage::Create();
+        sample->SetPayload(MakeSysmontapSample(400));
+        sample->SetMessageType(DTXMessageType::MethodInvocation);
+        sample->SetChannelCode(5);
+        sample->SetIdentifier(7);
+        const std::vector<uint8_t> sampleWire = WireOf(*sample);
+        cases.push_back({"DTXMessage::Encode/sysmontap", sampleWire.size(),
+            [sample]() { return sample->Encode().size(); }});
+        cases.push_back(DecodeDTXCase("DTXMessage::Decode/sysmontap", sampleWire));
+        cases.push_back(DecodeDTXCase("DTXMessage::Decode/bv4", MakeBV4Wire(sampleWire)));
+
+        auto compressed = DTXMessage::Create();
+        compressed->SetPayload(MakeSysmontapSample(400));
+        compressed->SetMessageType(DTXMessageType::MethodInvocation);
+        compressed->SetChannelCode(5);
+        if (compressed->Compress(0)) {
+            cases.push_back(DecodeDTXCase("DTXMessage::Decode/lz4", WireOf(*compressed)));
+        }
+
+        // LZ4 on its own
+        const size_t sectionLen = sampleWire.size() - DTXProtocol::HeaderLength;
+        std::vector<uint8_t> block(LZ4::CompressBound(sectionLen));
+        size_t blockLen = 0;
+        LZ4::Compress(sampleWire.data() + DTXProtocol::HeaderLength, sectionLen,
+                      block.data(), block.size(), blockLen);
+        block.resize(blockLen);
+        cases.push_back({"LZ4::Decompress/sysmontap", sectionLen,
+            [block, sectionLen]() {
+                static std::vector<uint8_t> out(sectionLen);
+                size_t outSize = 0;
+                LZ4::Decompress(block.data(), block.size(), out.data(), out.size(), outSize);
+                return outSize;
+            }});
+        cases.push_back({"LZ4::Compress/sysmontap", sectionLen,
+            [sampleWire, sectionLen]() {
+                static std::vector<uint8_t> out(LZ4::CompressBound(sectionLen));
+                size_t outSize = 0;
+                LZ4::Compress(sampleWire.data() + DTXProtocol::HeaderLength, sectionLen,
+                              out.data(), out.size(), outSize);
+                return outSize;
+            }});
+    }
+
+    // RemoteXPC: an RSD service discovery reply
+    {
+        NSObject::DictType services;
+        for (int i = 0; i < 120; i++) {
+            NSObject::DictType properties;
+            properties["UsesRemoteXPC"] = NSObject(i % 3 == 0);
+            NSObject::DictType entry;
+            entry["Port"] = NSObject(std::to_string(49152 + i));
+            entry["Properties"] = NSObject(std::move(properties));
+            services["com.apple.service" + std::to_string(i)] = NSObject(std::move(entry));
+        }
+        NSObject::DictType properties;
+        properties["UniqueDeviceID"] = NSObject("00008110-000A1B2C3D4E5F60");
+        NSObject::DictType body;
+        body["MessageType"] = NSObject("Handshake");
+        body["Properties"] = NSObject(std::move(properties));
+        body["Services"] = NSObject(std::move(services));
+
+        XPCMessage message;
+        message.flags = XPCFlags::AlwaysSet;
+        message.body = NSObject(std::move(body));
+        const std::vector<uint8_t> encoded = message.Encode();
+
+        cases.push_back({"XPCMessage::EncodeTo/handshake", encoded.size(),
+            [message]() {
+                static std::vector<uint8_t> out;
+                out.clear();
+                message.EncodeTo(out);
+                return out.size();
+            }});
+        cases.push_back({"XPCMessage::Decode/handshake", encoded.size(),
+            [encoded]() {
+                XPCMessage decoded;
+                return XPCMessage::Decode(encoded, decoded) ? decoded.body.Size() : 0;
+            }});
+        cases.push_back({"XPCMessage::Decode(view)/handshake", encoded.size(),
+            [encoded]() -> size_t {
+                XPCMessageView view;
+                if (!XPCMessage::Decode(encoded.data(), encoded.size(), view)) return 0;
+                // The service -> port map, as the RSD handshake reads it
+                size_t ports = 0;
+                for (const XPCEntry& service : view.body["Services"].Items()) {
+                    ports += service.value["Port"].AsString().size();
+                }
+                return ports;
+            }});
+
+        // HTTP/2: the reply split into 16 KB DATA frames, decoded in place
+        std::vector<uint8_t> frames;
+        for (size_t off = 0; off < encoded.size(); off += 16384) {
+            const size_t chunk = std::min<size_t>(16384, encoded.size() - off);
+            auto frame = Http2Framer::MakeDataFrame(1, encoded.data() + off, chunk, false);
+            frames.insert(frames.end(), frame.begin(), frame.end());
+        }
+        cases.push_back({"Http2Framer::DecodeFrame/data", frames.size(),
+            [frames]() {
+                size_t pos = 0, payload = 0;
+                H2FrameView view;
+                while (size_t consumed = Http2Framer::DecodeFrame(frames.data() + pos,
+                                                                  frames.size() - pos, view)) {
+                    payload += view.payloadSize;
+                    pos += consumed;
+                }
+                return payload;
+            }});
+        cases.push_back({"H2FrameWriter/headers+data", encoded.size(),
+            [encoded]() {
+                static H2FrameWriter out;
+                out.Clear();
+                out.Headers(1, {}, false).Data(1, encoded.data(), encoded.size(), false);
+                return out.Size();
+            }});
+    }
+
+    // Experimental activitytracetap decoder on its own assumed layout
+    {
+        const std::vector<uint8_t> payload = MakeActivityTracePayload(500);
+        cases.push_back({"LogStreamDecoder/500records", payload.size(),
+            [payload]() {
+                static LogStreamDecoder decoder;
+                static std::vector<LogRecordView> records;
+                decoder.Decode(payload.data(), payload.size(), records);
+                return records.size();
+            }});
+    }
+
+    // End to end: a recorded sysmontap session through DTXConnection
+    cases.push_back(ReplayCase("DTXConnection/replay/sysmontap", MakeSysmontapCapture(200)));
+
+    return cases;
+}
+
+static void AddCorpus(const std::string& dir, std::vector<BenchCase>& cases) {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().extension() == ".dtxcap") {
+            auto capture = std::make_shared<DTXCapture>();
+            if (DTXCapture::Load(entry.path().string(), *capture)) {
+                cases.push_back(ReplayCase("DTXConnection/replay/" + entry.path().filename().string(),
+                                           std::move(capture)));
+            }
+            continue;
+        }
+        if (entry.path().extension() != ".dtx") continue;
+        std::ifstream in(entry.path(), std::ios::binary);
+        std::vector<uint8_t> wire((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (wire.size() < DTXProtocol::HeaderLength) continue;
+        cases.push_back(DecodeDTXCase("DTXMessage::Decode/" + entry.path().filename().string(),
+                                      std::move(wire)));
+    }
+    if (ec) std::fprintf(stderr, "Cannot read corpus directory %s\n", dir.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string corpus;
+    double minTimeMs = 200.0;
+    for (int i = 1; i < argc; i++) {
+        const std::string opt = argv[i];
+        if (opt == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (opt == "--min-time" && i + 1 < argc) {
+            minTimeMs = std::atof(argv[++i]);
+        } else if (opt == "--corpus" && i + 1 < argc) {
+            corpus = argv[++i];
+        } else {
+            std::fprintf(stderr,
+                "Usage: %s [--filter <substring>] [--min-time <ms>] [--corpus <dir>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Log::SetLevel(LogLevel::Error);
+    std::vector<BenchCase> cases = BuildCases();
+    if (!corpus.empty()) AddCorpus(corpus, cases);
+
+    std::printf("%-44s %10s %12s %10s %10s\n", "case", "bytes", "ns/op", "MB/s", "allocs/op");
+    for (const auto& bench : cases) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) continue;
+        RunCase(bench, minTimeMs);
+    }
+    return 0;
+}
@@ -3,14 +3,62 @@
 
 #include "types.h"
 #include "dtx_connection.h"
+#include "dtx_reactor.h"
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
+#include <chrono>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace instruments {
 
+class AppServiceClient;
+class InstrumentConnectionPool;
+class RSDProvider;
+struct XPCPipe;
+
+// Instruments connection pool settings (DeviceConnection::SetInstrumentPool())
+struct InstrumentPoolConfig {
+    size_t maxConnections = 1;              // another is opened only while all are leased
+    uint32_t idleTimeoutMs = 0;             // keep released connections warm (0 = close on release)
+    uint32_t healthCheckIntervalMs = 5000;  // ping an idle connection unchecked this long before reuse
+    int healthCheckTimeoutMs = 3000;
+};
+
+// Instruments connection pool counters
+struct InstrumentPoolStats {
+    uint64_t hits = 0;                  // leases served by an open connection
+    uint64_t misses = 0;                // leases that had to open one
+    uint64_t healthCheckFailures = 0;   // idle connections dropped after a failed ping
+    uint64_t idleClosed = 0;            // connections closed after being released
+    size_t open = 0;                    // connections in the pool
+    size_t leased = 0;                  // of those, currently leased
+};
+
+// iOS 17+ USB bring-up strategies (how RSD services were reached)
+enum class BringUpStrategy {
+    None,           // not RSD over USB, or every strategy failed
+    UsbRSD,         // RSD port via usbmuxd forwarding
+    CDTunnel,       // CoreDeviceProxy tunnel (iOS 17.4+)
+    UsbQUIC,        // QUIC lockdown tunnel (iOS 17.0-17.3)
+    NetworkRSD,     // usbmuxd NETWORK device on USB-NCM (iOS 18+)
+    DirectNCM,      // direct IPv6 TCP on the USB-NCM interface (iOS 18+)
+};
+
+// Process-wide bring-up settings (DeviceConnection::SetBringUpOptions())
+struct BringUpOptions {
+    // Race the strategies ("happy eyeballs") instead of trying them in turn:
+    // each starts staggerMs after the previous one (or as soon as all
+    // running ones failed) and the first to complete RSD wins
+    bool parallel = false;
+    uint32_t staggerMs = 250;
+};
+
 // DeviceConnection - abstracts the connection to an iOS device regardless
 // of the iOS version or transport type (USB, network, tunnel).
 //
@@ -44,6 +92,16 @@ public:
         uint16_t rsdPort = 58783,
         const std::string& iosVersion = "17.0");
 
+    // Factory: play back the captures in dir (SetCaptureDirectory()) in
+    // place of a device, for benchmarks and tests without hardware. Each
+    // DTX connection the services open takes the next unused capture of
+    // its service, in recording order; its replies follow the requests
+    // sent on it at the recorded delays divided by speed (0 = no delay).
+    // Protocol and iOS version come from the captures. Returns nullptr if
+    // dir holds no capture.
+    static std::shared_ptr<DeviceConnection> FromCapture(const std::string& dir,
+                                                         double speed = 1.0);
+
     // Get the underlying idevice_t handle
     idevice_t GetDevice() const { return m_device; }
 
@@ -53,9 +111,49 @@ public:
     // Get device info (lazy-loaded)
     DeviceInfo GetDeviceInfo();
 
+    // Serve DTX connections created from now on from a shared reactor
+    // instead of one receive thread each (nullptr restores the default)
+    void SetReactor(std::shared_ptr<DTXReactor> reactor) { m_reactor = std::move(reactor); }
+
+    // LZ4-compress outgoing messages of at least bytes on DTX connections
+    // created from now on (see DTXConnection::SetCompressionThreshold; 0 = off)
+    void SetCompressionThreshold(size_t bytes) { m_compressionThreshold = bytes; }
+
+    // Receive-side memory limits for DTX connections created from now on
+    // (see DTXMemoryBudget)
+    void SetMemoryBudget(const DTXMemoryBudget& budget) { m_memoryBudget = budget; }
+
+    // Handshake / request timeouts for DTX connections created from now on
+    // (see DTXTimeoutPolicy)
+    void SetTimeoutPolicy(const DTXTimeoutPolicy& policy) { m_timeoutPolicy = policy; }
+
+    // Record each DTX connection created from now on, every frame with its
+    // timestamp, to <dir>/<n>-<service>.dtxcap for FromCapture()
+    // ("" stops recording). dir must exist.
+    void SetCaptureDirectory(const std::string& dir);
+
     // Create a DTX connection to the instruments service
     std::unique_ptr<DTXConnection> CreateInstrumentConnection();
 
+    // Instruments connection shared by all services of this device, so
+    // they open channels on one socket and handshake once. Leased from a
+    // pool (see SetInstrumentPool()): created on first use (and again after
+    // it dropped), closed when the last holder releases it unless a
+    // keep-alive is configured. Holders close their channels with
+    // DTXConnection::CloseChannel() instead of disconnecting.
+    std::shared_ptr<DTXConnection> SharedInstrumentConnection();
+
+    // Configure the instruments connection pool. With idleTimeoutMs > 0,
+    // released connections stay handshaked so short RPCs skip setup.
+    void SetInstrumentPool(const InstrumentPoolConfig& config);
+    InstrumentPoolStats GetInstrumentPoolStats() const;
+
+    // iOS 17+: long-lived CoreDevice appservice connection shared by all
+    // process control requests of this device (one request RTT each).
+    // Connected on first use and again after it dropped; nullptr when the
+    // device has no appservice or it cannot be reached (retried after 30 s).
+    std::shared_ptr<AppServiceClient> SharedAppServiceClient();
+
     // Create a DTX connection to a specific service
     std::unique_ptr<DTXConnection> CreateServiceConnection(const std::string& serviceName);
 
@@ -79,28 +177,99 @@ public:
     // Check if this connection uses USB RSD (iOS 17+ via usbmuxd, no external tunnel)
     bool IsUsbRsd() const { return m_isUsbRsd; }
 
+    // Check if device TCP ports are reached through a tunnel or USB-NCM
+    // address (iOS 17+ CDTunnel / USB QUIC, FromTunnel(), direct NCM)
+    // rather than through usbmuxd's idevice_connect()
+    bool HasTunnelRoute() const;
+
+    // Connect to a device TCP port through that route. Returns a connected
+    // OS socket (caller closes it) or -1.
+    int ConnectTunnelPort(uint16_t port);
+
+    // Connect to a device TCP port for in-process reads: a tunnel stream on
+    // a userspace tunnel (no socket bridge), an OS socket on the other
+    // tunnel routes, else usbmuxd. false if the port cannot be reached.
+    bool ConnectDevicePort(uint16_t port, XPCPipe& outPipe);
+
+    // Userspace tunnel only (CDTunnel / USB QUIC): connect to a device TCP
+    // port and let the tunnel's forwarding loop copy between it and
+    // socketFd. Takes ownership of socketFd unless it returns
+    // Error::NotSupported (no userspace tunnel).
+    Error BridgeTunnelPort(int socketFd, uint16_t port);
+
+    // Strategy that brought up this iOS 17+ USB device (None otherwise)
+    BringUpStrategy GetBringUpStrategy() const { return m_bringUpStrategy; }
+
+    // Configure how FromUDID/FromDevice bring up iOS 17+ USB devices. The
+    // winning strategy is remembered per UDID either way, and reconnects
+    // try it first.
+    static void SetBringUpOptions(const BringUpOptions& options);
+
+    // Persist discovered RSD service ports to path, keyed by UDID and boot
+    // session, so new DeviceConnections (also in later processes) skip the
+    // RSD handshake. The cache is process-wide and in memory by default.
+    // A cached map is refreshed when the instruments service does not
+    // answer on its port.
+    static void SetRSDCachePath(const std::string& path);
+
 private:
     DeviceConnection();
 
-    // Try USB RSD service discovery on iOS 17+ devices.
+    // Reach RSD services of an iOS 17+ USB device, trying the strategies
+    // for its version in order or racing them (see BringUpOptions).
     // Called internally by FromUDID/FromDevice after protocol detection.
-    void TryUsbRSD();
+    void BringUpRSD();
+    // Run one strategy on this object; on success it has set the service
+    // map and transport fields
+    bool RunStrategy(BringUpStrategy strategy);
+    // Race strategies on probe objects and adopt the first that completes
+    BringUpStrategy RaceBringUp(const std::vector<BringUpStrategy>& order, uint32_t staggerMs);
+    // Take over the transport state a winning probe discovered
+    void AdoptBringUp(DeviceConnection& probe);
 
-    // Try USB CoreDevice QUIC tunnel (iOS 17.x only; iOS 18+ uses TryNetworkRSD).
-    void TryUsbQUIC();
+    // Try USB RSD service discovery on iOS 17+ devices.
+    bool TryUsbRSD();
+
+    // Try the CDTunnel (CoreDeviceProxy) — iOS 17.4+, iOS 18+/26+.
+    bool TryCDTunnel();
+
+    // Try USB CoreDevice QUIC tunnel (iOS 17.0-17.3 only; iOS 18+ uses TryNetworkRSD).
+    bool TryUsbQUIC();
 
     // Try RSD via USB-NCM network path for iOS 18+/26+.
     // Apple's usbmuxd (from iTunes/Apple Devices) registers iOS 18+ USB devices
     // with their USB-NCM IPv6 address. idevice_new_with_options(PREFER_NETWORK)
     // returns a NETWORK-type device for which idevice_connect() uses direct TCP,
     // bypassing the usbmuxd TCP port-forwarding that fails on iOS 18+.
-    void TryNetworkRSD();
+    bool TryNetworkRSD();
 
     // Try iOS 18+/26+ direct USB-NCM TCP connection without admin privileges.
     // Enumerates host network adapters to find the Apple USB-NCM virtual interface,
     // reads the NDP neighbor table to find the device's link-local IPv6 address,
     // then connects directly via TCP to port 58783 — same as go-ios, no libusb needed.
-    void TryDirectNCMConnection();
+    bool TryDirectNCMConnection();
+
+    // RSD handshake over the transport strategy has set up
+    Error HandshakeRSD(BringUpStrategy strategy, RSDProvider& rsd);
+    // Fill m_rsdServices for strategy from the cache, or by a handshake
+    // whose result is cached
+    Error DiscoverRSDServices(BringUpStrategy strategy, bool useCache = true);
+    // Drop the cached map and handshake again (m_bringUpStrategy)
+    Error RefreshRSDServices();
+
+    // CreateInstrumentConnection() without the stale-cache retry
+    std::unique_ptr<DTXConnection> ConnectInstrumentService();
+
+    // Run connect (which reads m_rsdServices) under m_rsdMutex; if it fails
+    // on a cached map, refresh the map and run it once more
+    bool ConnectRSDService(const char* service, const std::function<bool()>& connect);
+
+    // Attach m_reactor (if any) and the capture (if recording), then start
+    // a freshly created DTX connection
+    Error ConnectDTX(DTXConnection& conn, const std::string& service = "instruments");
+
+    // FromCapture(): connection on the next unused capture of service
+    std::unique_ptr<DTXConnection> ReplayConnection(const std::string& service);
 
     idevice_t m_device = nullptr;
     bool m_ownsDevice = false;
@@ -111,15 +280,52 @@ private:
     DeviceInfo m_deviceInfo;
     bool m_deviceInfoLoaded = false;
 
+    // Optional shared I/O threads for created DTX connections
+    std::shared_ptr<DTXReactor> m_reactor;
+
+    // Outgoing DTX compression threshold for created connections (0 = off)
+    size_t m_compressionThreshold = 0;
+
+    // Receive-side limits and timeouts for created connections
+    DTXMemoryBudget m_memoryBudget;
+    DTXTimeoutPolicy m_timeoutPolicy;
+
+    // Capture recording (SetCaptureDirectory()) and playback (FromCapture()):
+    // captures not yet replayed as (service, path), in recording order
+    std::mutex m_captureMutex;
+    std::string m_captureDir;
+    uint32_t m_captureCount = 0;
+    bool m_isReplay = false;
+    double m_replaySpeed = 1.0;
+    std::vector<std::pair<std::string, std::string>> m_replayQueue;
+
+    // How RSD was reached; losing strategies of a race finish on these
+    // threads (joined before the device handles are freed)
+    BringUpStrategy m_bringUpStrategy = BringUpStrategy::None;
+    std::vector<std::thread> m_bringUpThreads;
+
+    // Pooled instruments connections (see SharedInstrumentConnection()),
+    // created on first use
+    std::unique_ptr<InstrumentConnectionPool> m_instrumentPool;
+    InstrumentPoolConfig m_instrumentPoolConfig;
+    mutable std::mutex m_instrumentPoolMutex;
+
+    // CoreDevice appservice client (see SharedAppServiceClient())
+    std::shared_ptr<AppServiceClient> m_appService;
+    std::chrono::steady_clock::time_point m_appServiceRetryAt;
+    std::mutex m_appServiceMutex;
+
     // Tunnel connection info (set by FromTunnel())
     std::string m_tunnelAddress;
     uint16_t m_tunnelRsdPort = 0;
     bool m_isTunnel = false;
 
     // RSD-discovered service port map: service name → TCP port
-    // Populated by FromTunnel() (via RSDProvider::ConnectDirect) or
-    // by TryUsbRSD() (via RSDProvider::ConnectViaIDevice) for iOS 17+ USB devices.
+    // Populated by FromTunnel() (via RSDProvider::ConnectDirect) or by the
+    // bring-up strategies (DiscoverRSDServices()) for iOS 17+ USB devices.
     std::map<std::string, uint16_t> m_rsdServices;
+    bool m_rsdFromCache = false;    // m_rsdServices came from RSDServiceCache
+    std::mutex m_rsdMutex;          // ConnectRSDService() may refresh the map
 
     // true when RSD was discovered via USB (idevice_connect), not an external tunnel.
     // CreateInstrumentConnection() uses idevice_connect to reach the service port.
@@ -4,8 +4,11 @@
 #include "dtx_message.h"
 #include "types.h"
 #include <atomic>
-#include <condition_variable>
+#include <chrono>
+#include <coroutine>
+#include <exception>
 #include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -14,6 +17,16 @@
 namespace instruments {
 
 class DTXConnection;
+class DTXCall;
+class DTXDispatchQueue;
+class MetricsHistogram;
+
+// What a full handler queue does with a new message (see SetDispatchQueue)
+enum class DTXOverflowPolicy {
+    DropOldest,     // discard the oldest queued message
+    Block,          // wait for room (backpressure on the receive thread)
+    Coalesce,       // the new message replaces the newest queued one
+};
 
 // DTXChannel - represents a named channel within a DTX connection.
 // Channels are created via DTXConnection::MakeChannelWithIdentifier().
@@ -21,24 +34,59 @@ class DTXConnection;
 class DTXChannel : public std::enable_shared_from_this<DTXChannel> {
 public:
     using MessageHandler = std::function<void(std::shared_ptr<DTXMessage>)>;
+    // Completion for an asynchronous request; reply is nullptr on timeout,
+    // send failure or cancellation
+    using ReplyHandler = std::function<void(std::shared_ptr<DTXMessage> reply)>;
 
     DTXChannel(DTXConnection* connection, const std::string& identifier, int32_t channelCode);
     ~DTXChannel();
 
+    // Request timeouts default to the connection's DTXTimeoutPolicy
+    // (DTXConnection::SetTimeoutPolicy); pass a value >= 0 to override it.
+
     // Synchronous method call - sends message and blocks until response
     std::shared_ptr<DTXMessage> SendMessageSync(
         std::shared_ptr<DTXMessage> message,
-        int timeoutMs = DTXProtocol::DefaultTimeoutMs);
+        int timeoutMs = DTXProtocol::PolicyTimeoutMs);
 
     // Asynchronous method call - fire-and-forget
     void SendMessageAsync(std::shared_ptr<DTXMessage> message);
 
+    // Asynchronous method call with reply. Any number of requests can be in
+    // flight; replies are matched by identifier. onReply runs on the thread
+    // that dispatches the reply (it must not block on SendMessageSync()).
+    // Expired requests complete with nullptr lazily: the next time the
+    // channel sends or receives, or when it is cancelled.
+    void SendMessageAsync(std::shared_ptr<DTXMessage> message, ReplyHandler onReply,
+                          int timeoutMs = DTXProtocol::PolicyTimeoutMs);
+
+    // Asynchronous method call with reply as a future (nullptr on failure).
+    // Expiry is lazy (see above), so bound blocking waits with wait_for().
+    // Pipelining:
+    //   auto a = channel->SendMessageFuture(msgA);
+    //   auto b = channel->SendMessageFuture(msgB);
+    //   a.wait_for(timeout); b.wait_for(timeout);   // ~one round trip
+    std::future<std::shared_ptr<DTXMessage>> SendMessageFuture(
+        std::shared_ptr<DTXMessage> message,
+        int timeoutMs = DTXProtocol::PolicyTimeoutMs);
+
+    // Awaitable method call for C++20 coroutines (see DTXCall):
+    //   auto reply = co_await channel->Call(msg);
+    DTXCall Call(std::shared_ptr<DTXMessage> message,
+                 int timeoutMs = DTXProtocol::PolicyTimeoutMs);
+
     // Register handler for unsolicited incoming messages (streaming data)
     void SetMessageHandler(MessageHandler handler);
 
     // Register handler for specific method names
     void SetMethodHandler(const std::string& methodName, MessageHandler handler);
 
+    // Run this channel's handlers on a dedicated worker fed by a bounded
+    // queue instead of on the receive thread, so a slow handler does not
+    // stall other channels. Replies to requests are still matched on the
+    // receive thread. capacity 0 restores inline dispatch.
+    void SetDispatchQueue(size_t capacity, DTXOverflowPolicy policy = DTXOverflowPolicy::DropOldest);
+
     // Cancel channel (stops waiting, closes)
     void Cancel();
 
@@ -54,33 +102,104 @@ public:
     // Called by DTXConnection when a message arrives for this channel
     void DispatchMessage(std::shared_ptr<DTXMessage> message);
 
+    // Called by DTXConnection when the device closed the connection:
+    // pending requests complete with nullptr now instead of at their deadline
+    void FailPendingReplies();
+
 private:
+    using Clock = std::chrono::steady_clock;
+
     // Get next message identifier for this channel
     uint32_t NextIdentifier();
 
+    // Register a reply for message (identifier already set) and send it;
+    // onReply(nullptr) is called if the send fails
+    void SendRequest(std::shared_ptr<DTXMessage> message, ReplyHandler onReply, int timeoutMs);
+
+    // Complete requests whose deadline has passed with nullptr
+    void ExpirePendingReplies();
+
+    // Run the method / message handler for a message
+    void DeliverMessage(std::shared_ptr<DTXMessage> message);
+
+    // Call handler, timing a sample of calls into m_handlerTime
+    void RunHandler(const MessageHandler& handler, const std::shared_ptr<DTXMessage>& message);
+
     DTXConnection* m_connection;
     std::string m_identifier;
     int32_t m_channelCode;
     std::atomic<uint32_t> m_nextIdentifier{1};
     std::atomic<bool> m_cancelled{false};
+    MetricsHistogram* m_handlerTime;    // Metrics: handler run time of this channel
+    const std::string m_traceDevice;    // Trace row of the request spans
 
     // Message handler for streaming/unsolicited messages
     MessageHandler m_messageHandler;
+    std::shared_ptr<DTXDispatchQueue> m_dispatchQueue;  // optional (m_handlerMutex)
     std::mutex m_handlerMutex;
 
-    // Method-specific handlers
-    std::map<std::string, MessageHandler> m_methodHandlers;
+    // Method-specific handlers (transparent comparator: looked up by SelectorView())
+    std::map<std::string, MessageHandler, std::less<>> m_methodHandlers;
     std::mutex m_methodHandlerMutex;
 
-    // Response waiters for synchronous calls
-    struct ResponseWaiter {
-        std::mutex mutex;
-        std::condition_variable cv;
-        std::shared_ptr<DTXMessage> response;
-        bool ready = false;
+    // Requests awaiting a reply, keyed by message identifier
+    struct PendingReply {
+        ReplyHandler handler;
+        Clock::time_point deadline;
+        Clock::time_point sent;
+        MetricsHistogram* rtt;          // Metrics: round trips of the selector
+        std::string traceName;          // selector while tracing, else empty
+    };
+    std::map<uint32_t, PendingReply> m_pendingReplies;
+    std::mutex m_pendingMutex;
+    // Earliest pending deadline (Clock ticks), checked without the lock
+    std::atomic<Clock::rep> m_nextExpiry{Clock::time_point::max().time_since_epoch().count()};
+};
+
+// DTXCall - awaitable returned by DTXChannel::Call(). co_await yields the
+// reply (nullptr on timeout, send failure or cancellation). The coroutine
+// resumes on the thread that dispatches the reply - the connection's reactor
+// thread, or its receive thread - so many control flows can share a few
+// threads; it continues inline if the call completes before suspending.
+// Timeouts are lazy, as for SendMessageAsync().
+class DTXCall {
+public:
+    DTXCall(std::shared_ptr<DTXChannel> channel, std::shared_ptr<DTXMessage> message, int timeoutMs);
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    std::shared_ptr<DTXMessage> await_resume() { return std::move(m_state->reply); }
+
+private:
+    struct State {
+        std::coroutine_handle<> handle;
+        std::shared_ptr<DTXMessage> reply;
+        std::atomic<bool> done{false};  // set by whichever of reply / suspend comes first
+    };
+
+    std::shared_ptr<DTXChannel> m_channel;
+    std::shared_ptr<DTXMessage> m_message;
+    int m_timeoutMs;
+    std::shared_ptr<State> m_state;
+};
+
+// DTXTask - fire-and-forget coroutine type for driving DTX control flows.
+// Starts running immediately and frees itself when it finishes. Exceptions
+// are not propagated (the library does not throw across its API).
+//
+// Usage:
+//   DTXTask Probe(std::shared_ptr<DTXChannel> channel) {
+//       auto reply = co_await channel->Call(DTXMessage::CreateWithSelector("driverNames"));
+//       ...
+//   }
+struct DTXTask {
+    struct promise_type {
+        DTXTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
     };
-    std::map<uint32_t, std::shared_ptr<ResponseWaiter>> m_waiters;
-    std::mutex m_waitersMutex;
 };
 
 } // namespace instruments
@@ -3,8 +3,10 @@
 
 #include "dtx_channel.h"
 #include "dtx_message.h"
+#include "metrics.h"
 #include "types.h"
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
@@ -13,6 +15,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
@@ -26,6 +29,47 @@ namespace instruments {
 
 class DTXTransport;
 class DTXFragmentDecoder;
+class DTXMessagePool;
+class DTXReactor;
+class DTXDispatchQueue;
+class TunnelStream;
+class DTXCaptureWriter;
+class DTXReplay;
+class DTXQueueBudget;
+struct DTXFrame;
+
+// Memory one connection may hold on the receive side (0 = unlimited).
+// A message over maxMessageBytes, or a fragmented message that would
+// exceed the fragment limits, is refused: oversize frames close the
+// connection, fragmented messages are dropped. While the handler queues
+// (SetDispatchQueue) hold maxQueuedMessages or maxQueuedBytes the
+// connection stops reading, so the device is throttled by TCP flow
+// control instead of the host buffering its output.
+struct DTXMemoryBudget {
+    size_t maxMessageBytes = 64 * 1024 * 1024;      // one message, header excluded
+    size_t maxFragmentBytes = 64 * 1024 * 1024;     // partially reassembled messages
+    size_t maxFragmentedMessages = 256;             // messages in reassembly at once
+    size_t maxQueuedMessages = 0;                   // across all handler queues
+    size_t maxQueuedBytes = 0;                      // across all handler queues
+};
+
+// How long one connection waits for the device. Requests sent with the
+// default timeout (DTXProtocol::PolicyTimeoutMs) wait requestTimeoutMs,
+// or, when adaptive, rttMultiplier times the smoothed round trip of the
+// connection's replies (EWMA, 1/8 weight per reply; the handshake is the
+// first sample) within [minTimeoutMs, requestTimeoutMs]. Calls that make
+// the device do real work (launching an app, starting a test) should pass
+// an explicit timeout; the library's own do (channel requests wait
+// requestTimeoutMs, process control has fixed timeouts). A connection
+// the device closes fails its pending requests and handshake at once
+// instead of at their deadline.
+struct DTXTimeoutPolicy {
+    int handshakeTimeoutMs = 5000;
+    int requestTimeoutMs = DTXProtocol::DefaultTimeoutMs;
+    bool adaptive = false;
+    double rttMultiplier = 8.0;
+    int minTimeoutMs = 200;
+};
 
 // DTXConnection - manages a DTX protocol connection to an iOS device.
 // Handles channel management, message routing, and the receive loop.
@@ -59,12 +103,51 @@ public:
     // Used for iOS 17+ USB QUIC tunnel connections (CreateTunnelSocket).
     static std::unique_ptr<DTXConnection> CreateFromFd(int socketFd);
 
+    // Create on an in-process tunnel stream (QUICTunnel::CreateTunnelStream()).
+    // Used for iOS 17+ userspace tunnel connections without a socket pair.
+    static std::unique_ptr<DTXConnection> CreateFromStream(std::shared_ptr<TunnelStream> stream);
+
+    // Create on a recorded connection played back in place of a device
+    // (DTXReplay, src/dtx/dtx_capture.h). Receives on its own thread.
+    static std::unique_ptr<DTXConnection> CreateFromReplay(std::shared_ptr<DTXReplay> replay);
+
     ~DTXConnection();
 
     // Non-copyable
     DTXConnection(const DTXConnection&) = delete;
     DTXConnection& operator=(const DTXConnection&) = delete;
 
+    // Serve this connection from a shared DTXReactor instead of a dedicated
+    // receive thread. Must be called before Connect(); ignored if the
+    // transport cannot be polled (full SSL), which keeps its own thread.
+    void SetReactor(std::shared_ptr<DTXReactor> reactor) { m_reactor = std::move(reactor); }
+
+    // Compress outgoing messages whose payload section is at least bytes
+    // long (LZ4Compressed, 0x0707), once the device has published
+    // com.apple.private.DTXBlockCompression. 0 (the default) disables it.
+    void SetCompressionThreshold(size_t bytes) { m_compressionThreshold.store(bytes); }
+
+    // Handshake and default request timeouts (see DTXTimeoutPolicy).
+    // Must be called before Connect().
+    void SetTimeoutPolicy(const DTXTimeoutPolicy& policy) { m_timeoutPolicy = policy; }
+
+    // Timeout for a request: timeoutMs if >= 0, else from the policy
+    int RequestTimeoutMs(int timeoutMs = DTXProtocol::PolicyTimeoutMs) const;
+
+    // Smoothed reply round trip in microseconds (0 before the first reply)
+    int64_t SmoothedRttUs() const { return m_srttUs.load(std::memory_order_relaxed); }
+
+    // Limit receive-side memory. Must be called before Connect() and before
+    // any handler queue is set up; queues created earlier are not counted.
+    void SetMemoryBudget(const DTXMemoryBudget& budget);
+
+    // Record every frame of this connection, both directions, to capture.
+    // Must be called before Connect() so the handshake is recorded too.
+    void SetCapture(std::shared_ptr<DTXCaptureWriter> capture);
+
+    // Bytes and frames this connection has exchanged (see also Metrics)
+    TransportCounters GetTransportStats() const;
+
     // Start the connection (begins the receive loop)
     Error Connect();
 
@@ -75,6 +158,12 @@ public:
     // Get the global channel (channel code 0)
     std::shared_ptr<DTXChannel> GlobalChannel();
 
+    // Close one channel and keep the connection: cancels it, unregisters
+    // it, asks the device to release its side (_channelCanceled:) and waits
+    // for a handler of the channel still running on the receive path
+    // (unless called from that handler). Use this on shared connections.
+    void CloseChannel(const std::shared_ptr<DTXChannel>& channel);
+
     // Close the connection
     void Disconnect();
 
@@ -85,22 +174,57 @@ public:
     void SetGlobalMessageHandler(DTXChannel::MessageHandler handler);
     // Add an additional handler for messages on unregistered channels
     void AddGlobalMessageHandler(DTXChannel::MessageHandler handler);
+    // Run the global handlers on a worker behind a bounded queue instead of
+    // the receive thread (see DTXChannel::SetDispatchQueue; 0 = inline)
+    void SetGlobalDispatchQueue(size_t capacity,
+                                DTXOverflowPolicy policy = DTXOverflowPolicy::DropOldest);
+
+    // Called once, on the receive path, when the device closes the
+    // connection (not on Disconnect()). Runs at once if it already did.
+    void SetCloseHandler(std::function<void()> handler);
 
     // Send a message via the transport (called by DTXChannel)
     Error SendMessage(std::shared_ptr<DTXMessage> message);
 
+    // Fold one observed reply round trip into SmoothedRttUs() (called by DTXChannel)
+    void RecordRtt(std::chrono::steady_clock::duration rtt);
+
 private:
     explicit DTXConnection(std::unique_ptr<DTXTransport> transport);
 
     // Perform DTX protocol handshake (send client capabilities)
     Error PerformHandshake();
 
+    friend class DTXReactor;
+    friend class DTXChannel;    // handler queues share m_queueBudget
+
     // Receive loop running on background thread
     void ReceiveLoop();
 
+    // Reactor callback: the descriptor is readable. Reads what is available
+    // and dispatches every complete frame. Returns false once closed.
+    bool OnReadable();
+
+    // Reactor callback: reading resumed after the queue budget paused it.
+    // Dispatches frames still buffered. Returns false once closed.
+    bool OnResumed();
+
+    // Dispatch buffered frames until none is left or the queue budget
+    // pauses the connection
+    void DispatchBuffered();
+
+    // Reassemble/decode one received frame and dispatch it
+    void HandleFrame(const DTXFrame& frame);
+
     // Dispatch a received message to the appropriate channel
     void DispatchMessage(std::shared_ptr<DTXMessage> message);
 
+    // Run the global handler for a message on an unregistered channel
+    void DeliverGlobalMessage(std::shared_ptr<DTXMessage> message);
+
+    // Remote closure: m_connected was just cleared by the receive path
+    void NotifyClosed();
+
     // Send an ACK for a received message
     void SendAck(uint32_t identifier, uint32_t channelCode, uint32_t conversationIndex);
 
@@ -108,22 +232,70 @@ private:
     std::atomic<bool> m_connected{false};
     std::thread m_receiveThread;
 
-    // Channel management
-    std::map<int32_t, std::shared_ptr<DTXChannel>> m_channels;
+    // Shared I/O threads (optional); m_onReactor once registered
+    std::shared_ptr<DTXReactor> m_reactor;
+    bool m_onReactor = false;
+
+    // Channel management. Channels are kept in immutable snapshots sorted
+    // by channel code: writers copy the current table and publish a new one
+    // under m_channelsMutex, the receive path (the only lock-free reader)
+    // reads m_channelTable without locking and announces the snapshot it is
+    // reading in m_readHazard. Writers free retired snapshots other than
+    // that one, so a long-lived connection does not accumulate them.
+    struct ChannelTable {
+        std::vector<std::pair<int32_t, std::shared_ptr<DTXChannel>>> channels;  // sorted by code
+    };
+    std::atomic<const ChannelTable*> m_channelTable{nullptr};
+    std::atomic<const ChannelTable*> m_readHazard{nullptr};
+    std::vector<std::unique_ptr<const ChannelTable>> m_channelTables;  // live snapshots (m_channelsMutex)
     std::mutex m_channelsMutex;
     std::atomic<int32_t> m_nextChannelCode{1};
 
+    // Channel registered for code in table (nullptr if none)
+    static std::shared_ptr<DTXChannel> Lookup(const ChannelTable* table, int32_t code);
+    // Lock-free lookup for the receive path (nullptr if not registered)
+    std::shared_ptr<DTXChannel> FindChannel(int32_t code);
+    // Publish a table with code set to channel (nullptr removes it);
+    // m_channelsMutex must be held
+    void SetChannelLocked(int32_t code, std::shared_ptr<DTXChannel> channel);
+
+    // Channel whose DispatchMessage() the receive path is running
+    // (CloseChannel() waits on m_dispatchCV for it to change)
+    std::atomic<const DTXChannel*> m_dispatchChannel{nullptr};
+    std::mutex m_dispatchMutex;
+    std::condition_variable m_dispatchCV;
+
     // Fragment assembly
     std::unique_ptr<DTXFragmentDecoder> m_fragmentDecoder;
 
+    // Handler queue budget (nullptr = unlimited)
+    std::shared_ptr<DTXQueueBudget> m_queueBudget;
+
+    // Recycled memory for received messages
+    std::shared_ptr<DTXMessagePool> m_messagePool;
+
     // Global message handler
     DTXChannel::MessageHandler m_globalHandler;
+    std::shared_ptr<DTXDispatchQueue> m_globalQueue;  // optional (m_globalHandlerMutex)
     std::mutex m_globalHandlerMutex;
+    std::function<void()> m_closeHandler;                 // m_globalHandlerMutex
+    bool m_remoteClosed = false;                          // m_globalHandlerMutex
 
     // Handshake synchronization
     std::mutex m_handshakeMutex;
     std::condition_variable m_handshakeCV;
     std::atomic<bool> m_handshakeReceived{false};
+
+    // Timeouts (see SetTimeoutPolicy)
+    DTXTimeoutPolicy m_timeoutPolicy;
+    std::atomic<int64_t> m_srttUs{0};
+
+    // Outgoing compression (see SetCompressionThreshold)
+    std::atomic<size_t> m_compressionThreshold{0};
+
+    // Trace row (device) this connection was created under
+    const std::string m_traceDevice;
+    std::atomic<bool> m_peerCompression{false};
 };
 
 } // namespace instruments
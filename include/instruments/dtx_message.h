@@ -5,11 +5,15 @@
 #include "../../src/nskeyedarchiver/nsobject.h"
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace instruments {
 
+class DTXMessagePool;
+
 // DTX message type codes
 enum class DTXMessageType : uint32_t {
     Ack = 0x0,
@@ -41,14 +45,106 @@ struct DTXPayloadHeader {
     uint32_t flags = 0;
 };
 
+// Wire form of an encoded message as scatter-gather segments. The DTX,
+// payload and auxiliary headers are written into `headers`; the auxiliary
+// and payload segments point into the message, which must outlive them.
+struct DTXWireSegments {
+    struct Segment {
+        const uint8_t* data = nullptr;
+        size_t length = 0;
+    };
+    static constexpr size_t MaxSegments = 3;   // headers, auxiliary, payload
+
+    uint8_t headers[DTXProtocol::HeaderLength + 2 * DTXProtocol::PayloadHeaderLength];
+    Segment segments[MaxSegments];
+    size_t count = 0;
+
+    size_t TotalLength() const {
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) total += segments[i].length;
+        return total;
+    }
+};
+
+// One auxiliary argument as it sits in the message (a PrimitiveDictionary
+// entry). data/length are the value bytes: little-endian integers for
+// 0x03/0x06, an NSKeyedArchiver bplist for 0x01/0x02. Points into the
+// message, which must outlive it.
+struct DTXAuxEntry {
+    uint32_t type = 0;
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+
+    bool IsNull() const { return type == 0x0A || (IsArchived() && length == 0); }
+    bool IsUInt32() const { return type == 0x03; }
+    bool IsInt64() const { return type == 0x06; }
+    bool IsArchived() const { return type == 0x01 || type == 0x02; }
+
+    // Integer entries (0 for other types)
+    uint32_t AsUInt32() const;
+    uint64_t AsUInt64() const;
+
+    // Decode into an NSObject; archived entries are unarchived here, on
+    // every call
+    NSObject Object() const;
+};
+
+// Auxiliary section read in place: entries are parsed while iterating,
+// nothing is decoded until an entry's Object() is asked for. Valid while
+// the message is alive and unmodified.
+class DTXAuxView {
+public:
+    class Iterator {
+    public:
+        const DTXAuxEntry& operator*() const { return m_entry; }
+        const DTXAuxEntry* operator->() const { return &m_entry; }
+        Iterator& operator++() { Advance(); return *this; }
+        bool operator==(const Iterator& other) const { return m_offset == other.m_offset; }
+        bool operator!=(const Iterator& other) const { return m_offset != other.m_offset; }
+
+    private:
+        friend class DTXAuxView;
+        Iterator(const uint8_t* data, size_t length, size_t offset)
+            : m_data(data), m_length(length), m_next(offset), m_offset(offset) { Advance(); }
+        void Advance();
+
+        const uint8_t* m_data;
+        size_t m_length;
+        size_t m_next;     // start of the entry after m_entry
+        size_t m_offset;   // start of m_entry; m_length once past the end
+        DTXAuxEntry m_entry;
+    };
+
+    DTXAuxView() = default;
+    DTXAuxView(const uint8_t* data, size_t length) : m_data(data), m_length(length) {}
+
+    Iterator begin() const { return Iterator(m_data, m_length, 0); }
+    Iterator end() const { return Iterator(m_data, m_length, m_length); }
+    bool empty() const { return m_length == 0; }
+
+    // Entry count and indexed access (each a pass over the entries)
+    size_t size() const;
+    bool At(size_t index, DTXAuxEntry& out) const;
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_length = 0;
+};
+
 // DTX message - represents a complete DTX protocol message
 class DTXMessage {
 public:
     DTXMessage();
+    ~DTXMessage();
 
     // Factory methods
     static std::shared_ptr<DTXMessage> Create();
     static std::shared_ptr<DTXMessage> CreateWithSelector(const std::string& selector);
+    // As CreateWithSelector(), with the selector's archive supplied by the
+    // caller (NSKeyedArchiver::ArchiveSelector() bytes, e.g. held by a
+    // DTXMethod) so no selector cache lookup is needed
+    static std::shared_ptr<DTXMessage> CreateWithArchivedSelector(std::string_view selector,
+                                                                  const std::vector<uint8_t>& archived);
     static std::shared_ptr<DTXMessage> CreateAck(uint32_t identifier, uint32_t channelCode, uint32_t conversationIndex);
 
     // Header fields
@@ -74,27 +170,57 @@ public:
         m_payloadHeader.messageType = static_cast<uint32_t>(type);
     }
 
-    // Payload - the selector or return value (NSKeyedArchiver encoded)
+    // Payload - the selector or return value (NSKeyedArchiver encoded).
+    // Decoded on first use and cached; the returned object is shared by all
+    // callers and must not be modified.
     void SetPayload(const NSObject& obj);
     std::shared_ptr<NSObject> PayloadObject() const;
     const std::vector<uint8_t>& RawPayload() const { return m_payload; }
 
-    // Selector convenience
-    std::string Selector() const;
+    // Selector convenience. SelectorView() reads the archived NSString
+    // straight out of the bplist (no NSObject tree) and caches it; the view
+    // stays valid until SetPayload() or the message is destroyed.
+    std::string_view SelectorView() const;
+    std::string Selector() const { return std::string(SelectorView()); }
 
-    // Auxiliary data - method arguments
+    // Auxiliary data - method arguments. AppendAuxiliary() encodes the
+    // value straight onto the wire buffer. Auxiliary() reads the arguments
+    // in place; AuxiliaryObjects() decodes all of them once and caches the
+    // result (valid until AppendAuxiliary() or the message is destroyed).
     void AppendAuxiliary(const NSObject& value);
-    std::vector<NSObject> AuxiliaryObjects() const;
+
+    // Typed arguments: the same entries AppendAuxiliary(NSObject(value))
+    // writes, encoded without building an NSObject (see DTXMethod)
+    void AppendAuxiliaryInt32(int32_t value);
+    void AppendAuxiliaryInt64(int64_t value);
+    void AppendAuxiliaryUInt64(uint64_t value);
+    void AppendAuxiliaryBool(bool value);
+    void AppendAuxiliaryReal(double value);
+    void AppendAuxiliaryString(std::string_view value);
+    DTXAuxView Auxiliary() const { return DTXAuxView(m_auxiliary.data(), m_auxiliary.size()); }
+    const std::vector<NSObject>& AuxiliaryObjects() const;
     const std::vector<uint8_t>& RawAuxiliary() const { return m_auxiliary; }
 
     // Encoding/Decoding
     // Encode to wire format (may produce multiple fragments)
     std::vector<std::vector<uint8_t>> Encode() const;
 
+    // Encode without copying aux/payload (see DTXWireSegments)
+    void EncodeSegments(DTXWireSegments& out) const;
+
+    // Send as an LZ4Compressed (0x0707) message: when the payload section
+    // (payload header + auxiliary + payload) is at least threshold bytes
+    // and LZ4 makes it smaller, keep the compressed form for encoding.
+    // Undone by SetPayload()/AppendAuxiliary(). Returns IsCompressed().
+    bool Compress(size_t threshold);
+    bool IsCompressed() const { return !m_compressed.empty(); }
+
     // Decode from wire data (after fragment reassembly)
-    // data should contain payload header + payload + auxiliary
+    // data should contain payload header + payload + auxiliary.
+    // With a pool, the message and its buffers are recycled through it.
     static std::shared_ptr<DTXMessage> Decode(const DTXMessageHeader& header,
-                                              const uint8_t* data, size_t length);
+                                              const uint8_t* data, size_t length,
+                                              const std::shared_ptr<DTXMessagePool>& pool = nullptr);
 
     // Parse just the header from raw bytes
     static bool ParseHeader(const uint8_t* data, size_t length, DTXMessageHeader& outHeader);
@@ -103,12 +229,31 @@ public:
     std::string Dump() const;
 
 private:
+    friend class DTXMessagePool;
+
     DTXMessageHeader m_header;
     DTXPayloadHeader m_payloadHeader;
 
     std::vector<uint8_t> m_payload;     // NSKeyedArchiver-encoded payload
     std::vector<uint8_t> m_auxiliary;   // PrimitiveDictionary-encoded auxiliary
-    std::vector<NSObject> m_auxItems;   // Decoded auxiliary items (for encoding)
+    // Compressed wire body: original type, uncompressed size, LZ4 block
+    std::vector<uint8_t> m_compressed;
+
+    // Drop the compressed form and decoded arguments after an append
+    void AuxiliaryChanged();
+
+    // Lazily decoded payload / selector / auxiliary (guarded by m_decodeMutex)
+    std::shared_ptr<NSObject> DecodePayloadLocked() const;
+    mutable std::mutex m_decodeMutex;
+    mutable std::shared_ptr<NSObject> m_payloadObject;
+    mutable std::string m_selector;
+    mutable std::vector<NSObject> m_auxObjects;
+    mutable bool m_payloadDecoded = false;
+    mutable bool m_selectorDecoded = false;
+    mutable bool m_auxDecoded = false;
+
+    // Pool that receives the payload/auxiliary buffers on destruction
+    std::shared_ptr<DTXMessagePool> m_pool;
 };
 
 } // namespace instruments
@@ -0,0 +1,263 @@
+#ifndef INSTRUMENTS_DTX_METHOD_H
+#define INSTRUMENTS_DTX_METHOD_H
+
+#include "dtx_message.h"
+#include "../../src/nskeyedarchiver/nskeyedarchiver.h"
+#include "../../src/nskeyedarchiver/nskeyedunarchiver.h"
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace instruments {
+
+// DTXSelectorName - a selector string usable as a template argument
+template <size_t N>
+struct DTXSelectorName {
+    char value[N] = {};
+
+    constexpr DTXSelectorName(const char (&selector)[N]) {
+        for (size_t i = 0; i < N; i++) value[i] = selector[i];
+    }
+
+    constexpr std::string_view View() const { return std::string_view(value, N - 1); }
+
+    // Objective-C selectors take one argument per ':'
+    constexpr size_t ArgumentCount() const {
+        size_t count = 0;
+        for (size_t i = 0; i + 1 < N; i++) count += value[i] == ':';
+        return count;
+    }
+};
+
+// DTXArg<T> - writes an argument of type T as one auxiliary entry. The
+// bytes are the ones AppendAuxiliary(NSObject(value)) would write. Types
+// without a specialization do not compile; NSObject covers the rest.
+template <typename T>
+struct DTXArg;
+
+template <>
+struct DTXArg<bool> {
+    static void Append(DTXMessage& msg, bool value) { msg.AppendAuxiliaryBool(value); }
+};
+
+template <>
+struct DTXArg<int32_t> {
+    static void Append(DTXMessage& msg, int32_t value) { msg.AppendAuxiliaryInt32(value); }
+};
+
+template <>
+struct DTXArg<int64_t> {
+    static void Append(DTXMessage& msg, int64_t value) { msg.AppendAuxiliaryInt64(value); }
+};
+
+template <>
+struct DTXArg<uint64_t> {
+    static void Append(DTXMessage& msg, uint64_t value) { msg.AppendAuxiliaryUInt64(value); }
+};
+
+template <>
+struct DTXArg<float> {
+    static void Append(DTXMessage& msg, float value) { msg.AppendAuxiliaryReal(value); }
+};
+
+template <>
+struct DTXArg<double> {
+    static void Append(DTXMessage& msg, double value) { msg.AppendAuxiliaryReal(value); }
+};
+
+template <>
+struct DTXArg<std::string> {
+    static void Append(DTXMessage& msg, std::string_view value) { msg.AppendAuxiliaryString(value); }
+};
+
+template <>
+struct DTXArg<NSObject> {
+    static void Append(DTXMessage& msg, const NSObject& value) { msg.AppendAuxiliary(value); }
+};
+
+// DTXMethod - compile-time binding of a selector and its argument types.
+// The argument count is checked against the selector, each argument is
+// encoded by its DTXArg without an intermediate NSObject, and the archived
+// selector is built once per method rather than looked up per message.
+//
+// Usage:
+//   using SetSamplingRate = DTXMethod<"setSamplingRate:", float>;
+//   channel->SendMessageAsync(SetSamplingRate::Make(10.0f));
+template <DTXSelectorName Selector, typename... Args>
+class DTXMethod {
+public:
+    static_assert(Selector.ArgumentCount() == sizeof...(Args),
+                  "DTXMethod: argument types do not match the selector's arguments");
+
+    static constexpr std::string_view Name() { return Selector.View(); }
+
+    static std::shared_ptr<DTXMessage> Make(const Args&... args) {
+        auto msg = DTXMessage::CreateWithArchivedSelector(Selector.View(), ArchivedSelector());
+        (DTXArg<Args>::Append(*msg, args), ...);
+        return msg;
+    }
+
+private:
+    static const std::vector<uint8_t>& ArchivedSelector() {
+        static const std::vector<uint8_t> archived = [] {
+            std::vector<uint8_t> out;
+            NSKeyedArchiver::ArchiveSelector(Selector.View(), out);
+            return out;
+        }();
+        return archived;
+    }
+};
+
+// DTXScalarVisitor - NSKeyedVisitor that keeps a scalar root value;
+// containers are skipped
+class DTXScalarVisitor : public NSKeyedVisitor {
+public:
+    enum class Kind { None, Bool, Int, UInt, Real, String };
+
+    void Bool(bool value) override { Set(Kind::Bool, value ? 1.0 : 0.0); m_int = value; }
+    void Int(int64_t value) override { Set(Kind::Int, static_cast<double>(value)); m_int = value; }
+    void UInt(uint64_t value) override {
+        Set(Kind::UInt, static_cast<double>(value));
+        m_int = static_cast<int64_t>(value);
+    }
+    void Real(double value) override { Set(Kind::Real, value); m_int = static_cast<int64_t>(value); }
+    void String(std::string_view value) override {
+        m_kind = Kind::String;
+        m_string.assign(value);
+    }
+    bool BeginArray(size_t, bool) override { return false; }
+    bool BeginDict(size_t) override { return false; }
+
+    Kind GetKind() const { return m_kind; }
+    bool IsNumber() const { return m_kind != Kind::None && m_kind != Kind::String; }
+    double AsDouble() const { return m_real; }
+    int64_t AsInt() const { return m_int; }
+    const std::string& AsString() const { return m_string; }
+
+private:
+    void Set(Kind kind, double real) {
+        m_kind = kind;
+        m_real = real;
+    }
+
+    Kind m_kind = Kind::None;
+    double m_real = 0;
+    int64_t m_int = 0;
+    std::string m_string;
+};
+
+// Decode a reply whose payload is a single number, bool or string into out,
+// straight from the archive (no NSObject tree). Numbers convert between
+// integer and real as NSObject::ToNumber() would. False if the payload is
+// missing or of another shape.
+template <typename T>
+bool DTXDecodeReply(const DTXMessage& reply, T& out) {
+    static_assert(std::is_arithmetic_v<T> || std::is_same_v<T, std::string>,
+                  "DTXDecodeReply: use DTXDecodeFields for dictionary replies");
+    const std::vector<uint8_t>& raw = reply.RawPayload();
+    DTXScalarVisitor visitor;
+    if (raw.empty() || !NSKeyedUnarchiver::Visit(raw.data(), raw.size(), visitor)) return false;
+
+    if constexpr (std::is_same_v<T, std::string>) {
+        if (visitor.GetKind() != DTXScalarVisitor::Kind::String) return false;
+        out = visitor.AsString();
+    } else if constexpr (std::is_floating_point_v<T>) {
+        if (!visitor.IsNumber()) return false;
+        out = static_cast<T>(visitor.AsDouble());
+    } else {
+        if (!visitor.IsNumber()) return false;
+        out = static_cast<T>(visitor.AsInt());
+    }
+    return true;
+}
+
+// DTXField - one numeric entry of a dictionary reply and where it goes in
+// T. A field with an empty key receives the value of a reply that is a
+// bare number instead of a dictionary.
+template <typename T>
+struct DTXField {
+    std::string_view key;
+    void (*set)(T& out, double value);
+};
+
+// Decode the numeric top-level entries of a dictionary reply into out
+// through a field table, straight from the archive. Entries not in the
+// table, and nested containers, are skipped; entries are applied in
+// payload order. Returns the number of fields set (0 if the payload is
+// missing or not a plist).
+template <typename T>
+size_t DTXDecodeFields(const DTXMessage& reply, T& out, std::initializer_list<DTXField<T>> fields) {
+    class FieldVisitor : public NSKeyedVisitor {
+    public:
+        FieldVisitor(T& out, std::initializer_list<DTXField<T>> fields)
+            : m_out(out), m_fields(fields) {}
+
+        void Bool(bool value) override { Number(value ? 1.0 : 0.0); }
+        void Int(int64_t value) override { Number(static_cast<double>(value)); }
+        void UInt(uint64_t value) override { Number(static_cast<double>(value)); }
+        void Real(double value) override { Number(value); }
+        void Null() override { m_field = nullptr; }
+        void String(std::string_view) override { m_field = nullptr; }
+        void Data(const uint8_t*, size_t) override { m_field = nullptr; }
+
+        bool BeginArray(size_t, bool) override {
+            m_field = nullptr;
+            return false;
+        }
+        bool BeginDict(size_t) override {
+            m_field = nullptr;
+            if (m_depth > 0) return false;
+            m_depth++;
+            return true;
+        }
+        void EndDict() override { m_depth--; }
+
+        void Key(std::string_view key) override {
+            m_field = nullptr;
+            for (const auto& field : m_fields) {
+                if (!field.key.empty() && field.key == key) {
+                    m_field = &field;
+                    break;
+                }
+            }
+        }
+
+        size_t Count() const { return m_count; }
+
+    private:
+        void Number(double value) {
+            const DTXField<T>* field = m_field;
+            m_field = nullptr;
+            if (m_depth == 0) {
+                // Bare number reply
+                for (const auto& f : m_fields) {
+                    if (f.key.empty()) field = &f;
+                }
+            }
+            if (!field) return;
+            field->set(m_out, value);
+            m_count++;
+        }
+
+        T& m_out;
+        std::initializer_list<DTXField<T>> m_fields;
+        const DTXField<T>* m_field = nullptr;   // field of the current key
+        size_t m_count = 0;
+        int m_depth = 0;
+    };
+
+    const std::vector<uint8_t>& raw = reply.RawPayload();
+    if (raw.empty()) return 0;
+    FieldVisitor visitor(out, fields);
+    if (!NSKeyedUnarchiver::Visit(raw.data(), raw.size(), visitor)) return 0;
+    return visitor.Count();
+}
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_DTX_METHOD_H
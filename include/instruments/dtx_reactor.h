@@ -0,0 +1,101 @@
+#ifndef INSTRUMENTS_DTX_REACTOR_H
+#define INSTRUMENTS_DTX_REACTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace instruments {
+
+class DTXConnection;
+
+// DTXReactor - a small pool of I/O threads shared by many DTXConnections.
+//
+// By default every DTXConnection runs its own receive thread. A connection
+// given a reactor before Connect() (DTXConnection::SetReactor() or
+// DeviceConnection::SetReactor()) instead registers its descriptor with one
+// of the reactor's threads, which waits for readiness on all of its
+// connections at once and runs the receive/dispatch path when data arrives.
+//
+// Only transports with a pollable descriptor can be shared: raw TCP/tunnel
+// sockets and plain (non-SSL) idevice connections. Full-SSL connections
+// (iOS 14-16) buffer decrypted bytes the socket cannot report, so they keep
+// their dedicated receive thread.
+//
+// Message handlers run on the reactor thread. A handler must not block on
+// SendMessageSync() to a connection served by the same reactor thread.
+// A connection over its queue budget (DTXMemoryBudget) is left out of the
+// poll set until its handler queues drain.
+//
+// Usage:
+//   auto reactor = DTXReactor::Create();
+//   device->SetReactor(reactor);
+//   // ... every connection created by device now shares reactor threads
+class DTXReactor {
+public:
+    // threadCount 0 = one per hardware thread, capped at 4
+    static std::shared_ptr<DTXReactor> Create(size_t threadCount = 0);
+
+    ~DTXReactor();
+
+    // Non-copyable
+    DTXReactor(const DTXReactor&) = delete;
+    DTXReactor& operator=(const DTXReactor&) = delete;
+
+    size_t ThreadCount() const { return m_workers.size(); }
+
+    // Number of connections currently registered across all threads
+    size_t ConnectionCount() const;
+
+private:
+    friend class DTXConnection;
+
+    // One I/O thread and the connections it polls
+    struct Worker {
+        std::thread thread;
+        mutable std::mutex mutex;
+        std::condition_variable idleCv;
+        std::map<DTXConnection*, int> connections;  // connection -> fd
+        std::set<DTXConnection*> paused;            // registered, not polled
+        std::vector<DTXConnection*> resumed;        // to drain buffered frames
+        DTXConnection* dispatching = nullptr;
+        bool dirty = true;
+        int wakeFd = -1;  // loopback UDP socket connected to itself
+    };
+
+    DTXReactor() = default;
+
+    // Called by DTXConnection::Connect(); false if the reactor cannot
+    // take the connection (caller falls back to its own thread)
+    bool Register(DTXConnection* conn, int fd);
+
+    // Called by DTXConnection::Disconnect(). Once this returns the reactor
+    // will not touch conn again. Safe to call from a handler.
+    void Unregister(DTXConnection* conn);
+
+    // Stop / restart polling a registered connection (queue budget
+    // backpressure). Resume() may be called from any thread; the worker
+    // then dispatches what the connection still has buffered.
+    void Pause(DTXConnection* conn);
+    void Resume(DTXConnection* conn);
+
+    // Run one connection callback as the worker's current dispatch;
+    // unregisters the connection when it returns false
+    void Dispatch(Worker& worker, DTXConnection* conn, bool resumed);
+
+    void Run(Worker& worker);
+    void Wake(Worker& worker);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_running{false};
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_DTX_REACTOR_H
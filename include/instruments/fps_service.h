@@ -8,6 +8,23 @@
 
 namespace instruments {
 
+// FPS monitoring configuration
+struct FPSConfig {
+    uint32_t sampleIntervalMs = 1000;   // device sampling interval
+    // Coalesce the samples of each window into one FPSData (mean fps/GPU,
+    // fpsMin/fpsMax, samples) so the callback runs once per window.
+    // 0 = one callback per device sample.
+    uint32_t windowMs = 0;
+    // Sample every adaptiveIntervalMs while frames drop: the device switches
+    // to the faster rate when a sample is below adaptiveBelowFps and back to
+    // sampleIntervalMs once no sample has been for adaptiveHoldMs. Samples of
+    // 0 fps (nothing rendered) do not count as drops.
+    bool adaptive = false;
+    double adaptiveBelowFps = 50.0;
+    uint32_t adaptiveIntervalMs = 100;
+    uint32_t adaptiveHoldMs = 5000;
+};
+
 // FPSService - monitors GPU frame rate and utilization using the
 // graphics.opengl DTX service.
 //
@@ -16,28 +33,55 @@ namespace instruments {
 //   fps.Start(1000, [](const FPSData& d) { printf("FPS: %.0f\n", d.fps); });
 //   // ... later ...
 //   fps.Stop();
+//
+//   // Fine-grained only while frames drop, reported every 5 s
+//   FPSConfig config;
+//   config.windowMs = 5000;
+//   config.adaptive = true;
+//   fps.Start(config, [](const FPSData& d) { printf("%.0f-%.0f\n", d.fpsMin, d.fpsMax); });
 class FPSService {
 public:
     explicit FPSService(std::shared_ptr<DeviceConnection> connection);
     ~FPSService();
 
-    // Start FPS monitoring
+    // Start FPS monitoring; callback runs on the receive thread
     // sampleIntervalMs: how often to sample (in milliseconds)
     Error Start(uint32_t sampleIntervalMs,
                 FPSCallback callback,
                 ErrorCallback errorCb = nullptr);
+    Error Start(const FPSConfig& config,
+                FPSCallback callback,
+                ErrorCallback errorCb = nullptr);
 
-    // Stop monitoring
+    // Stop monitoring; a partly filled window is delivered first
     void Stop();
 
     // Check if monitoring is active
     bool IsRunning() const { return m_running.load(); }
 
+    // Interval the device currently samples at (changes in adaptive mode)
+    uint32_t SamplingIntervalMs() const { return m_intervalMs.load(); }
+
 private:
+    // Per-sample processing on the receive thread
+    void OnSample(FPSData sample);
+    void Adapt(const FPSData& sample);
+    void SetSamplingInterval(uint32_t intervalMs);
+    void FlushWindow();
+
     std::shared_ptr<DeviceConnection> m_connection;
-    std::unique_ptr<DTXConnection> m_dtxConnection;
+    std::shared_ptr<DTXConnection> m_dtxConnection;  // shared per device
     std::shared_ptr<DTXChannel> m_channel;
     std::atomic<bool> m_running{false};
+    std::atomic<uint32_t> m_intervalMs{0};
+
+    // Receive thread only (and Stop() once the channel is closed)
+    FPSConfig m_config;
+    FPSCallback m_callback;
+    FPSData m_window;               // samples = 0 while empty
+    uint64_t m_windowStartUs = 0;
+    bool m_boosted = false;
+    uint64_t m_lastDropUs = 0;
 };
 
 } // namespace instruments
@@ -8,14 +8,25 @@
 #include "device_connection.h"
 #include "tunnel_manager.h"
 #include "dtx_connection.h"
+#include "dtx_reactor.h"
 #include "dtx_channel.h"
 #include "dtx_message.h"
+#include "dtx_method.h"
+#include "metrics.h"
+#include "trace.h"
 #include "process_service.h"
 #include "performance_service.h"
+#include "perf_log.h"
 #include "fps_service.h"
+#include "screenshot_service.h"
+#include "log_stream_service.h"
 #include "xctest_service.h"
+#include "xctest_scheduler.h"
+#include "xctest_session.h"
 #include "wda_service.h"
 #include "port_forwarder.h"
+#include "monitor_fleet.h"
+#include "sample_aggregator.h"
 
 namespace instruments {
 
@@ -65,6 +76,8 @@ public:
     ProcessService& Process();
     PerformanceService& Performance();
     FPSService& FPS();
+    ScreenshotService& Screenshot();
+    LogStreamService& LogStream();
     XCTestService& XCTest();
     WDAService& WDA();
     PortForwarder& Ports();
@@ -78,6 +91,15 @@ public:
     // Set log level for the library
     static void SetLogLevel(LogLevel level);
 
+    // Library-wide transport, dispatch and tunnel metrics (see Metrics)
+    static MetricsSnapshot GetStats() { return Metrics::Snapshot(); }
+    static void ResetStats() { Metrics::Reset(); }
+
+    // Report a snapshot every intervalMs on a background thread (nullptr stops)
+    static void SetStatsCallback(uint32_t intervalMs, MetricsCallback cb) {
+        Metrics::SetSnapshotCallback(intervalMs, std::move(cb));
+    }
+
 private:
     explicit Instruments(std::shared_ptr<DeviceConnection> connection);
 
@@ -87,6 +109,8 @@ private:
     std::unique_ptr<ProcessService> m_process;
     std::unique_ptr<PerformanceService> m_performance;
     std::unique_ptr<FPSService> m_fps;
+    std::unique_ptr<ScreenshotService> m_screenshot;
+    std::unique_ptr<LogStreamService> m_logStream;
     std::unique_ptr<XCTestService> m_xctest;
     std::unique_ptr<WDAService> m_wda;
     std::unique_ptr<PortForwarder> m_ports;
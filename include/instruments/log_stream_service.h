@@ -0,0 +1,94 @@
+#ifndef INSTRUMENTS_LOG_STREAM_SERVICE_H
+#define INSTRUMENTS_LOG_STREAM_SERVICE_H
+
+#include "device_connection.h"
+#include "types.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace instruments {
+
+// Log stream configuration
+struct LogStreamConfig {
+    // NSPredicate over the device's log records (e.g. `subsystem == "com.example"`),
+    // evaluated on the device so filtered entries never cross the wire.
+    // Empty = every os_log message type.
+    std::string predicate;
+    int64_t pid = -1;               // only this process (-1 = all)
+    bool signposts = false;         // include os_signpost records
+    // Entries buffered between the receive thread and the callback. When the
+    // callback falls behind, the oldest buffered entries are dropped.
+    size_t bufferEntries = 16384;
+    // EXPERIMENTAL: decode data messages with LogStreamDecoder. Its record
+    // layout has not been checked against captured activitytracetap
+    // traffic and is not known to be the device's wire format. Off, data
+    // messages are only counted (LogStreamStats::undecoded) and no entries
+    // are delivered.
+    bool experimentalDecoder = false;
+};
+
+// Log stream counters since Start()
+struct LogStreamStats {
+    uint64_t received = 0;          // entries decoded
+    uint64_t delivered = 0;         // entries passed to the callback
+    uint64_t dropped = 0;           // overwritten while buffered
+    uint64_t malformed = 0;         // records that failed to decode
+    uint64_t undecoded = 0;         // data messages left undecoded (experimentalDecoder off)
+    size_t buffered = 0;            // waiting for the callback now
+};
+
+// LogStreamService - device log (os_log / os_signpost) streaming via the
+// activitytracetap service.
+//
+// The tap is configured and started (predicate filtered on the device), but
+// decoding its data messages is experimental: the library has no decoder
+// verified against the real wire format yet, so by default messages are
+// only counted. With LogStreamConfig::experimentalDecoder, records are
+// decoded on the receive thread straight from the message payload into a
+// fixed ring of reusable entries; a consumer thread hands them to the
+// callback in batches. A slow callback costs dropped entries (see
+// Stats()), never receive-thread stalls. Record the channel with
+// DeviceConnection::SetCaptureDirectory() to collect traffic for a decoder.
+//
+// Usage:
+//   LogStreamConfig config;
+//   config.predicate = "subsystem == \"com.apple.UIKit\"";
+//   logs.Start(config, [](const LogEntry& e) { printf("%s\n", e.message.c_str()); });
+//   // ... later ...
+//   logs.Stop();
+class LogStreamService {
+public:
+    explicit LogStreamService(std::shared_ptr<DeviceConnection> connection);
+    ~LogStreamService();
+
+    // Non-copyable
+    LogStreamService(const LogStreamService&) = delete;
+    LogStreamService& operator=(const LogStreamService&) = delete;
+
+    // Start streaming; callback runs on the service's consumer thread
+    Error Start(const LogStreamConfig& config,
+                LogEntryCallback callback,
+                ErrorCallback errorCb = nullptr);
+
+    // Stop streaming; buffered entries are discarded. Not from the callback.
+    void Stop();
+
+    bool IsRunning() const { return m_running.load(); }
+
+    LogStreamStats Stats() const;
+
+private:
+    struct State;
+
+    std::shared_ptr<DeviceConnection> m_connection;
+    std::shared_ptr<DTXConnection> m_dtxConnection;  // shared per device
+    std::shared_ptr<DTXChannel> m_channel;
+    std::shared_ptr<State> m_state;
+    std::thread m_consumer;
+    std::atomic<bool> m_running{false};
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_LOG_STREAM_SERVICE_H
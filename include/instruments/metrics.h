@@ -0,0 +1,98 @@
+#ifndef INSTRUMENTS_METRICS_H
+#define INSTRUMENTS_METRICS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace instruments {
+
+// Latency distribution in power-of-two microsecond buckets: bucket 0 holds
+// samples under 1 us, bucket i those in [2^(i-1), 2^i) us, the last one
+// everything above
+struct LatencyHistogram {
+    static constexpr size_t BucketCount = 32;
+
+    std::array<uint64_t, BucketCount> buckets{};
+    uint64_t count = 0;
+    uint64_t totalUs = 0;
+    uint64_t maxUs = 0;
+
+    double MeanUs() const { return count ? static_cast<double>(totalUs) / count : 0.0; }
+
+    // Upper bound of the bucket holding the p-th percentile (0-100)
+    uint64_t PercentileUs(double p) const;
+};
+
+// Bytes and DTX frames through the transports (header included)
+struct TransportCounters {
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t framesIn = 0;
+    uint64_t framesOut = 0;
+};
+
+// One handler queue (DTXChannel::SetDispatchQueue / SetGlobalDispatchQueue)
+struct DispatchQueueStats {
+    std::string name;           // channel identifier
+    size_t depth = 0;           // messages waiting now
+    size_t capacity = 0;
+    uint64_t dropped = 0;       // discarded by the overflow policy
+};
+
+// IPv6 packets between the device and the userspace tunnel's TCP/IP stack
+struct TunnelCounters {
+    uint64_t packetsIn = 0;     // from the device
+    uint64_t packetsOut = 0;    // to the device
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t dropsIn = 0;       // no receive buffer (TCP resends)
+    uint64_t dropsOut = 0;      // output ring full (TCP resends)
+};
+
+// Process-wide library metrics since start (or the last Metrics::Reset())
+struct MetricsSnapshot {
+    uint64_t uptimeMs = 0;                      // since the counters started
+
+    TransportCounters dtx;                      // all DTX connections
+    uint64_t fragmentsIn = 0;                   // fragments of multi-fragment messages
+    uint64_t messagesReassembled = 0;
+    uint64_t lz4Messages = 0;                   // compressed messages decoded
+    uint64_t lz4BytesIn = 0;                    // compressed bytes
+    uint64_t lz4BytesOut = 0;                   // decompressed bytes
+
+    // Decode and handler times are sampled (one message in 8 per thread);
+    // every request's round trip is recorded
+    LatencyHistogram decode;                    // DTXMessage::Decode per message
+    std::map<std::string, LatencyHistogram> rtt;        // request to reply, by selector
+    std::map<std::string, LatencyHistogram> handlers;   // handler run time, by channel
+    std::vector<DispatchQueueStats> queues;     // live handler queues
+
+    TunnelCounters tunnel;
+};
+
+using MetricsCallback = std::function<void(const MetricsSnapshot&)>;
+
+// Metrics - counters and latency histograms kept by the DTX and tunnel
+// layers (Instruments::GetStats() forwards here). Hot paths only do
+// relaxed atomic adds; a snapshot reads them without stopping traffic, so
+// related counters may be a few events apart.
+class Metrics {
+public:
+    static MetricsSnapshot Snapshot();
+
+    // Zero counters and histograms (queue depths are live values)
+    static void Reset();
+
+    // Call cb with a snapshot every intervalMs on a background thread
+    // (nullptr or 0 stops it)
+    static void SetSnapshotCallback(uint32_t intervalMs, MetricsCallback cb);
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_METRICS_H
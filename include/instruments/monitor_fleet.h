@@ -0,0 +1,150 @@
+#ifndef INSTRUMENTS_MONITOR_FLEET_H
+#define INSTRUMENTS_MONITOR_FLEET_H
+
+#include "device_connection.h"
+#include "dtx_reactor.h"
+#include "fps_service.h"
+#include "performance_service.h"
+#include "types.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace instruments {
+
+// Settings shared by every device of a MonitorFleet
+struct FleetConfig {
+    bool performance = true;
+    PerfConfig perf;
+    bool fps = false;
+    FPSConfig fpsConfig;                // coalescing window / adaptive sampling
+
+    size_t ioThreads = 0;               // shared DTXReactor threads (0 = its default)
+    size_t setupThreads = 4;            // devices connected and started concurrently
+    uint32_t batchIntervalMs = 200;     // the sink runs at most this often
+    size_t maxPendingSamples = 100000;  // samples past this are dropped until the sink catches up
+    uint32_t stallTimeoutMs = 10000;    // running device without samples this long reports Stalled
+    DTXMemoryBudget memoryBudget;       // receive-side limits per device connection
+    DTXTimeoutPolicy timeoutPolicy;     // handshake / request timeouts per device connection
+};
+
+// One sample from one device of the fleet
+struct FleetSample {
+    enum class Kind { System, Processes, FPS };
+
+    size_t device = 0;                      // index returned by AddDevice()
+    Kind kind = Kind::System;
+    uint64_t hostTimeUs = 0;                // host wall clock at receipt
+    SystemMetrics system;                   // Kind::System
+    std::vector<ProcessMetrics> processes;  // Kind::Processes
+    FPSData fps;                            // Kind::FPS
+};
+
+// Receives every sample gathered since the previous call; the batch may be
+// moved from
+using FleetSink = std::function<void(std::vector<FleetSample>& batch)>;
+
+enum class FleetDeviceState { Pending, Connecting, Running, Stalled, Failed, Stopped };
+
+struct FleetDeviceHealth {
+    std::string udid;
+    FleetDeviceState state = FleetDeviceState::Pending;
+    uint64_t samples = 0;
+    uint64_t dropped = 0;           // lost to maxPendingSamples
+    uint64_t errors = 0;
+    uint64_t lastSampleUs = 0;      // host wall clock, 0 = none yet
+    std::string lastError;
+};
+
+// MonitorFleet - runs perf/FPS monitoring on many devices with fixed host
+// resources. Every device's DTX connections are served by one shared
+// DTXReactor, so receiving and decoding (the service handlers) run on its
+// few threads rather than on one thread per connection; devices are
+// brought up by a small setup pool; samples are queued and handed to one
+// sink in batches from a single delivery thread. Host CPU then follows the
+// total sample rate, not devices x services.
+//
+// Full-SSL connections (iOS 14-16) cannot be polled and keep their own
+// receive thread (see DTXReactor).
+//
+// Usage:
+//   FleetConfig config;
+//   config.fps = true;
+//   MonitorFleet fleet(config, [](std::vector<FleetSample>& batch) { ... });
+//   for (const auto& udid : udids) fleet.AddDevice(udid);
+//   fleet.Start();
+//   // ... fleet.Health() ...
+//   fleet.Stop();
+class MonitorFleet {
+public:
+    MonitorFleet(FleetConfig config, FleetSink sink);
+    ~MonitorFleet();
+
+    // Non-copyable
+    MonitorFleet(const MonitorFleet&) = delete;
+    MonitorFleet& operator=(const MonitorFleet&) = delete;
+
+    // Add a device by UDID, or with a connection the caller already made.
+    // Returns its index. Devices added while running are brought up at once.
+    size_t AddDevice(const std::string& udid);
+    size_t AddDevice(std::shared_ptr<DeviceConnection> connection);
+
+    // Stop monitoring one device (its index is not reused)
+    void RemoveDevice(size_t device);
+
+    // Stop and bring up a device again (e.g. after Failed / Stalled)
+    void RestartDevice(size_t device);
+
+    Error Start();
+    void Stop();
+    bool IsRunning() const { return m_running.load(); }
+
+    size_t DeviceCount() const;
+    FleetDeviceHealth Health(size_t device) const;
+    std::vector<FleetDeviceHealth> Health() const;
+
+private:
+    struct Device;
+
+    size_t Add(std::shared_ptr<Device> device);
+    void Enqueue(size_t device);
+    void SetupLoop();
+    void SetupDevice(Device& device);
+    void StopDevice(Device& device);
+    void Push(Device& device, FleetSample&& sample);
+    void Fail(Device& device, const std::string& message);
+    void DeliveryLoop();
+    std::shared_ptr<Device> Get(size_t device) const;
+    FleetDeviceHealth HealthOf(const Device& device, uint64_t nowUs) const;
+
+    FleetConfig m_config;
+    FleetSink m_sink;
+    std::shared_ptr<DTXReactor> m_reactor;
+    std::atomic<bool> m_running{false};
+
+    mutable std::mutex m_devicesMutex;
+    std::vector<std::shared_ptr<Device>> m_devices;
+
+    // Setup pool
+    std::mutex m_setupMutex;
+    std::condition_variable m_setupCv;
+    std::deque<size_t> m_setupQueue;
+    std::vector<std::thread> m_setupThreads;
+
+    // Delivery
+    std::mutex m_pendingMutex;
+    std::condition_variable m_pendingCv;
+    std::vector<FleetSample> m_pending;
+    bool m_deliveryStopping = false;
+    std::thread m_deliveryThread;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_MONITOR_FLEET_H
@@ -0,0 +1,143 @@
+#ifndef INSTRUMENTS_PERF_LOG_H
+#define INSTRUMENTS_PERF_LOG_H
+
+#include "types.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace instruments {
+
+// One recorded sysmontap sample
+struct PerfLogSample {
+    uint64_t timestampUs = 0;       // host wall clock (microseconds since epoch)
+    bool hasSystem = false;
+    SystemMetrics system;
+    std::vector<ProcessMetrics> processes;
+};
+
+struct PerfLogOptions {
+    uint32_t samplesPerBlock = 600;         // samples per independently decodable block
+    size_t writeBufferBytes = 1024 * 1024;  // bytes gathered before each file write
+    size_t maxQueuedSamples = 4096;         // samples beyond this are dropped
+    bool compress = true;                   // LZ4 over each block's columns
+};
+
+// PerfLogWriter - appends samples to a columnar binary log.
+//
+// The file is a header followed by blocks of up to samplesPerBlock samples.
+// Inside a block every attribute is its own column: timestamps and system
+// counters are delta coded against the previous sample, process counters
+// against the same pid's previous row, all as zigzag varints; process names
+// go to a per-block string table. Idle processes then encode as runs of
+// zero bytes, which the optional LZ4 pass collapses. CPU loads are stored
+// in hundredths of a percent.
+//
+// Append() only queues the sample; encoding and writing happen on a
+// background thread. A block cut short by a crash is ignored on read.
+//
+// Usage:
+//   PerfLogWriter writer;
+//   writer.Open("perf.bin");
+//   writer.Append(std::move(sample));
+//   writer.Close();
+class PerfLogWriter {
+public:
+    PerfLogWriter();
+    ~PerfLogWriter();
+
+    PerfLogWriter(const PerfLogWriter&) = delete;
+    PerfLogWriter& operator=(const PerfLogWriter&) = delete;
+
+    // Create (truncate) path and start the writer thread
+    Error Open(const std::string& path, const PerfLogOptions& options = {});
+
+    // Queue a sample; safe from any thread
+    void Append(PerfLogSample sample);
+
+    // Write everything queued, then close the file
+    void Close();
+
+    bool IsOpen() const { return m_file != nullptr; }
+    uint64_t SamplesWritten() const { return m_samplesWritten.load(); }
+    uint64_t SamplesDropped() const { return m_samplesDropped.load(); }
+
+private:
+    void WriterLoop();
+    void EncodeSample(const PerfLogSample& sample);
+    void FlushBlock();
+    void FlushFile();
+
+    PerfLogOptions m_options;
+    std::FILE* m_file = nullptr;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<PerfLogSample> m_queue;
+    bool m_closing = false;
+
+    // Writer thread state
+    struct Block;
+    std::unique_ptr<Block> m_block;
+    std::vector<uint8_t> m_out;     // encoded blocks awaiting a file write
+
+    std::atomic<uint64_t> m_samplesWritten{0};
+    std::atomic<uint64_t> m_samplesDropped{0};
+};
+
+// PerfLogReader - memory-maps a log written by PerfLogWriter. Blocks are
+// indexed on Open() and decoded on demand.
+//
+// Usage:
+//   PerfLogReader reader;
+//   if (reader.Open("perf.bin") == Error::Success) {
+//       reader.ForEach([](const PerfLogSample& s) { ... });
+//   }
+class PerfLogReader {
+public:
+    PerfLogReader() = default;
+    ~PerfLogReader();
+
+    PerfLogReader(const PerfLogReader&) = delete;
+    PerfLogReader& operator=(const PerfLogReader&) = delete;
+
+    Error Open(const std::string& path);
+    void Close();
+
+    size_t BlockCount() const { return m_blocks.size(); }
+    size_t SampleCount() const { return m_sampleCount; }
+
+    // Decode block index into out (replacing its contents)
+    Error ReadBlock(size_t index, std::vector<PerfLogSample>& out) const;
+
+    // Visit every sample in file order; return false from the callback to stop
+    Error ForEach(const std::function<bool(const PerfLogSample&)>& callback) const;
+
+private:
+    struct BlockRef {
+        size_t offset;          // of the block payload
+        uint32_t storedSize;
+        uint32_t rawSize;
+        uint32_t sampleCount;
+        uint32_t flags;
+    };
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    void* m_mapping = nullptr;  // platform mapping handle
+    std::vector<BlockRef> m_blocks;
+    size_t m_sampleCount = 0;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_PERF_LOG_H
@@ -2,20 +2,34 @@
 #define INSTRUMENTS_PERFORMANCE_SERVICE_H
 
 #include "device_connection.h"
+#include "perf_log.h"
 #include "types.h"
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace instruments {
 
+struct SysmontapLayout;
+struct SysmontapSample;
+
 // Configuration for performance monitoring
 struct PerfConfig {
     uint32_t sampleIntervalMs = 1000;          // Sampling interval in ms
     std::vector<std::string> systemAttributes;  // Auto-populated if empty
     std::vector<std::string> processAttributes; // Auto-populated if empty
+    // Auto-populate with every attribute the device offers (two extra round
+    // trips, larger samples) instead of only those that fill
+    // SystemMetrics / ProcessMetrics
+    bool allAttributes = false;
+    // Only report these processes (both empty = all). Bundle ids are
+    // resolved to pids once, in Start(); apps launched later are not added.
+    std::vector<int64_t> pids;
+    std::vector<std::string> bundleIds;
     uint32_t bm = 3;                           // Sysmontap bitmask (3 = system + process)
+    double deltaCpuEpsilon = 0.0;              // StartDelta(): cpuUsage moves up to this are not changes
 };
 
 // PerformanceService - monitors system and per-process performance metrics
@@ -28,6 +42,11 @@ struct PerfConfig {
 //       [](const vector<ProcessMetrics>& p) { ... });
 //   // ... later ...
 //   perf.Stop();
+//
+// Samples can also be recorded to a columnar log (see PerfLogWriter), with
+// or without callbacks:
+//   perf.StartRecording("perf.bin");
+//   perf.Start(config, nullptr);
 class PerformanceService {
 public:
     explicit PerformanceService(std::shared_ptr<DeviceConnection> connection);
@@ -45,23 +64,45 @@ public:
                 ProcessPerfCallback processCb = nullptr,
                 ErrorCallback errorCb = nullptr);
 
+    // Start monitoring, delivering process rows as changes against the
+    // previous sample (added / changed / removed pids) instead of the full
+    // list. deltaCb is not called for samples without changes.
+    Error StartDelta(const PerfConfig& config,
+                     SystemPerfCallback systemCb,
+                     ProcessDeltaCallback deltaCb,
+                     ErrorCallback errorCb = nullptr);
+
     // Stop monitoring
     void Stop();
 
     // Check if monitoring is active
     bool IsRunning() const { return m_running.load(); }
 
+    // Append every sample to a log at path. Independent of Start()/Stop();
+    // may begin before or during monitoring.
+    Error StartRecording(const std::string& path, const PerfLogOptions& options = {});
+
+    // Write out queued samples and close the log
+    void StopRecording();
+
+    bool IsRecording() const;
+
 private:
     Error GetAttributes(const std::string& selector, std::vector<std::string>& outAttrs);
-    void ParseSysmontapMessage(const NSObject& data,
+    void ResolveBundlePids(const std::vector<std::string>& bundleIds, std::vector<int64_t>& pids);
+    void ParseSysmontapMessage(const DTXMessage& msg,
                                 SystemPerfCallback systemCb,
                                 ProcessPerfCallback processCb);
+    void DeliverProcesses(const SysmontapSample& sample, const ProcessPerfCallback& processCb);
 
     std::shared_ptr<DeviceConnection> m_connection;
-    std::unique_ptr<DTXConnection> m_dtxConnection;
+    std::shared_ptr<DTXConnection> m_dtxConnection;  // shared per device
     std::shared_ptr<DTXChannel> m_channel;
     std::atomic<bool> m_running{false};
-    std::vector<std::string> m_processAttributes;
+    std::unique_ptr<SysmontapLayout> m_layout;  // compiled process attribute order
+
+    mutable std::mutex m_recorderMutex;
+    std::shared_ptr<PerfLogWriter> m_recorder;
 };
 
 } // namespace instruments
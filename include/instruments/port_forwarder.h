@@ -4,6 +4,9 @@
 #include "device_connection.h"
 #include "types.h"
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -13,7 +16,14 @@
 namespace instruments {
 
 // PortForwarder - forwards TCP ports from the host to the iOS device.
-// Uses usbmuxd to establish connections to device ports.
+// Uses usbmuxd to establish connections to device ports, or, for iOS 17+
+// devices reached through a tunnel (CDTunnel / USB QUIC, FromTunnel(),
+// USB-NCM), connects to the device's address on that route. Connections
+// on a userspace tunnel are copied by the tunnel's own forwarding loop.
+//
+// One event loop thread multiplexes every listening socket and forwarded
+// connection with poll()/WSAPoll(); a second thread makes the (blocking)
+// usbmuxd connects. The thread count does not grow with connections.
 //
 // Usage:
 //   auto fwd = PortForwarder(connection);
@@ -45,24 +55,71 @@ public:
     std::map<uint16_t, uint16_t> GetForwardedPorts() const;
 
 private:
-    struct ForwardEntry {
-        uint16_t hostPort = 0;
-        uint16_t devicePort = 0;
-        std::atomic<bool> running{false};
-        std::thread acceptThread;
 #ifdef _WIN32
-        uintptr_t listenSocket = ~static_cast<uintptr_t>(0);
+    using SocketHandle = uintptr_t;
 #else
-        int listenSocket = -1;
+    using SocketHandle = int;
 #endif
+
+    // Listening socket (event loop thread)
+    struct ForwardEntry {
+        uint16_t hostPort = 0;
+        uint16_t devicePort = 0;
+        SocketHandle listenSocket = static_cast<SocketHandle>(-1);
+    };
+
+    // Accepted client waiting for its usbmuxd connection
+    struct PendingConnect {
+        SocketHandle clientSocket;
+        uint16_t hostPort;
+        uint16_t devicePort;
     };
 
-    void AcceptLoop(ForwardEntry* entry);
-    void RelayConnection(int clientFd, uint16_t devicePort);
+    struct Relay;   // one forwarded connection (event loop thread)
+
+    // Start the threads if they are not running (m_mutex held)
+    void StartLoop();
+    // Stop the threads and close every socket (m_mutex held)
+    void StopLoop();
+
+    void EventLoop();
+    void ConnectLoop();
+    // Connect thread: open the device side of pending (a relay, or nullptr
+    // when the client was closed or handed to a userspace tunnel)
+    std::unique_ptr<Relay> ConnectUsbmux(const PendingConnect& pending);
+    std::unique_ptr<Relay> ConnectTunnel(const PendingConnect& pending);
+
+    // Run fn on the event loop (SubmitToLoop) or run it and wait (RunOnLoop)
+    void SubmitToLoop(std::function<void()> fn);
+    void RunOnLoop(std::function<void()> fn);
+    void DrainTasks();
+    void Wake();
+
+    void AcceptClients(const ForwardEntry& entry);
+    void CloseRelays(uint16_t hostPort);   // 0: all
+    void CloseListeners();
 
     std::shared_ptr<DeviceConnection> m_connection;
-    std::vector<std::unique_ptr<ForwardEntry>> m_entries;
+
+    // Public API state; also serializes StartLoop()/StopLoop()
+    std::map<uint16_t, uint16_t> m_ports;   // host -> device
     mutable std::mutex m_mutex;
+
+    std::atomic<bool> m_running{false};
+    std::thread m_loopThread;
+    std::thread m_connectThread;
+    int m_wakeFd = -1;   // loopback UDP socket connected to itself
+
+    std::mutex m_taskMutex;
+    std::vector<std::function<void()>> m_tasks;
+
+    std::mutex m_connectMutex;
+    std::condition_variable m_connectCv;
+    std::deque<PendingConnect> m_connectQueue;
+
+    // Event loop thread only
+    std::vector<ForwardEntry> m_listeners;
+    std::vector<std::unique_ptr<Relay>> m_relays;
 };
 
 } // namespace instruments
@@ -3,17 +3,57 @@
 
 #include "device_connection.h"
 #include "types.h"
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace instruments {
 
+// One launch or kill for ProcessService::RunBatch()
+struct ProcessOp {
+    enum class Kind { Launch, Kill };
+
+    Kind kind = Kind::Launch;
+    std::string bundleId;                     // Launch
+    std::map<std::string, std::string> env;   // Launch
+    std::vector<std::string> args;            // Launch
+    bool killExisting = true;                 // Launch
+    int64_t pid = 0;                          // Kill
+
+    static ProcessOp Launch(std::string bundleId, bool killExisting = true) {
+        ProcessOp op;
+        op.bundleId = std::move(bundleId);
+        op.killExisting = killExisting;
+        return op;
+    }
+    static ProcessOp Kill(int64_t pid) {
+        ProcessOp op;
+        op.kind = Kind::Kill;
+        op.pid = pid;
+        return op;
+    }
+};
+
+struct ProcessOpResult {
+    Error error = Error::Success;
+    int64_t pid = 0;        // launched pid (Launch) or the killed pid (Kill)
+};
+
 // ProcessService - manages process operations on iOS devices.
 // Uses DTX deviceinfo channel for listing and processcontrol for launch/kill.
 //
 // For iOS 17+, also supports AppService XPC protocol for process operations.
+//
+// With StartProcessCache(), a process table is kept current in the
+// background so pid / bundle id lookups skip the device round trip:
+//   process.StartProcessCache();
+//   ProcessInfo info;
+//   if (process.FindProcessByBundleId("com.example.app", info)) process.KillProcess(info.pid);
 class ProcessService {
 public:
     explicit ProcessService(std::shared_ptr<DeviceConnection> connection);
@@ -36,10 +76,61 @@ public:
     // Kill a process by PID
     Error KillProcess(int64_t pid);
 
+    // Run launches and kills on one processcontrol channel. All requests are
+    // sent before the first reply is awaited, so the batch costs about one
+    // round trip instead of one connection each. results[i] belongs to
+    // ops[i]; the return value only reports failures affecting every item.
+    Error RunBatch(const std::vector<ProcessOp>& ops,
+                   std::vector<ProcessOpResult>& results,
+                   int timeoutMs = 10000);
+
     // Disable memory limit for a process
     Error DisableMemoryLimit(int64_t pid);
 
+    // Keep a process table current: runningProcesses is re-read on the
+    // shared instruments connection every refreshIntervalMs, as soon as the
+    // device reports an app state change (mobilenotifications), and after
+    // launches and kills made through this service, which also update the
+    // table directly. The first refresh happens before this returns.
+    Error StartProcessCache(uint32_t refreshIntervalMs = 5000);
+    void StopProcessCache();
+    bool IsProcessCacheRunning() const;
+
+    // Look up a running process; false if there is none. O(1) from the
+    // cache while it runs, otherwise one GetProcessList() call.
+    bool FindProcess(int64_t pid, ProcessInfo& out);
+    bool FindProcessByBundleId(const std::string& bundleId, ProcessInfo& out);
+
 private:
+    // Process table behind StartProcessCache()
+    struct Cache {
+        struct Entry {
+            ProcessInfo info;
+            uint64_t seen = 0;      // last refresh that listed the pid
+        };
+
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        std::unordered_map<int64_t, Entry> byPid;
+        std::unordered_map<std::string, int64_t> byBundleId;   // most recent pid
+        uint64_t generation = 0;
+        bool running = false;
+        bool refreshNow = false;
+        uint32_t intervalMs = 0;
+        std::thread thread;
+        std::shared_ptr<DTXConnection> dtxConnection;           // notifications
+        std::shared_ptr<DTXChannel> notifications;
+
+        // Merge a full listing into the table (entries are updated in place)
+        void Apply(std::vector<ProcessInfo>& processes);
+        void Insert(const ProcessInfo& info);
+        void Erase(int64_t pid);
+    };
+
+    void CacheLoop();
+    void RequestCacheRefresh();
+    void SubscribeAppStateNotifications();
+
     // DTX-based implementations (iOS < 17)
     Error GetProcessListDTX(std::vector<ProcessInfo>& outProcesses);
     Error LaunchAppDTX(const std::string& bundleId,
@@ -47,8 +138,13 @@ private:
                        const std::vector<std::string>& args,
                        bool killExisting, int64_t& outPid);
     Error KillProcessDTX(int64_t pid);
+    Error RunBatchDTX(const std::vector<ProcessOp>& ops,
+                      std::vector<ProcessOpResult>& results,
+                      int timeoutMs);
 
-    // XPC-based implementations (iOS 17+)
+    // iOS 17+ implementations: launch and kill over the device's shared
+    // appservice connection, DTX when it is unavailable or the request
+    // fails (dropped, timed out or refused)
     Error GetProcessListXPC(std::vector<ProcessInfo>& outProcesses);
     Error LaunchAppXPC(const std::string& bundleId,
                        const std::map<std::string, std::string>& env,
@@ -57,6 +153,7 @@ private:
     Error KillProcessXPC(int64_t pid);
 
     std::shared_ptr<DeviceConnection> m_connection;
+    Cache m_cache;
 };
 
 } // namespace instruments
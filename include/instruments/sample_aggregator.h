@@ -0,0 +1,97 @@
+#ifndef INSTRUMENTS_SAMPLE_AGGREGATOR_H
+#define INSTRUMENTS_SAMPLE_AGGREGATOR_H
+
+#include "types.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace instruments {
+
+// A process list and the time it arrived
+struct ProcessSample {
+    uint64_t timestampUs = 0;
+    std::vector<ProcessMetrics> processes;
+};
+
+// Every sample whose timestamp falls in [startUs, endUs) (HostMonotonicUs),
+// each stream in arrival order
+struct SampleWindow {
+    uint64_t startUs = 0;
+    uint64_t endUs = 0;
+    std::vector<FPSData> fps;
+    std::vector<SystemMetrics> system;
+    std::vector<ProcessSample> processes;
+
+    bool Empty() const { return fps.empty() && system.empty() && processes.empty(); }
+};
+
+// The window may be moved from
+using SampleWindowCallback = std::function<void(SampleWindow& window)>;
+
+// SampleAggregator - joins FPS, system and process streams into fixed time
+// windows and delivers each window in one callback, from one thread.
+// Samples are placed by their own timestamp (stamped on receipt by
+// FPSService / PerformanceService), not by when they reach the aggregator,
+// and a window is closed latenessMs after its end so samples still in a
+// receive thread's hands make it in. Feeding takes one short lock.
+//
+// Usage:
+//   SampleAggregator agg(1000, [](SampleWindow& w) { ... });
+//   agg.Start();
+//   inst->FPS().Start(100, agg.FPSSink());
+//   inst->Performance().Start(config, agg.SystemSink(), agg.ProcessSink());
+//   // ... later: stop the services, then
+//   agg.Stop();   // delivers the remaining windows
+class SampleAggregator {
+public:
+    SampleAggregator(uint32_t windowMs, SampleWindowCallback callback,
+                     uint32_t latenessMs = 100, bool deliverEmpty = false);
+    ~SampleAggregator();
+
+    // Non-copyable
+    SampleAggregator(const SampleAggregator&) = delete;
+    SampleAggregator& operator=(const SampleAggregator&) = delete;
+
+    void Start();
+    void Stop();
+
+    // Samples without a timestamp are stamped on arrival
+    void Add(const FPSData& data);
+    void Add(const SystemMetrics& metrics);
+    void Add(const std::vector<ProcessMetrics>& processes, uint64_t timestampUs = 0);
+
+    // Callbacks feeding this aggregator (it must outlive the services using them)
+    FPSCallback FPSSink();
+    SystemPerfCallback SystemSink();
+    ProcessPerfCallback ProcessSink();
+
+    // Samples older than the oldest open window (arrived too late)
+    uint64_t LateSamples() const;
+
+private:
+    SampleWindow* WindowFor(uint64_t timestampUs);
+    void Run();
+    void DeliverUpTo(uint64_t endUs);
+
+    const uint64_t m_windowUs;
+    const uint64_t m_latenessUs;
+    const bool m_deliverEmpty;
+    SampleWindowCallback m_callback;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<uint64_t, SampleWindow> m_windows;  // window index -> samples
+    uint64_t m_nextWindow = 0;                   // first index not yet delivered
+    uint64_t m_lateSamples = 0;
+    bool m_running = false;
+    std::thread m_thread;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_SAMPLE_AGGREGATOR_H
@@ -0,0 +1,77 @@
+#ifndef INSTRUMENTS_SCREENSHOT_SERVICE_H
+#define INSTRUMENTS_SCREENSHOT_SERVICE_H
+
+#include "device_connection.h"
+#include "types.h"
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace instruments {
+
+// Screenshot rates since the last Start() (or the service's creation)
+struct ScreenshotStats {
+    uint64_t frames = 0;            // delivered
+    uint64_t failures = 0;          // timed out or undecodable
+    uint64_t bytes = 0;             // image bytes delivered
+    double achievedFps = 0.0;       // frames / elapsed
+    double meanLatencyMs = 0.0;     // request to reply
+};
+
+// ScreenshotService - screen captures over the instruments screenshot
+// service (takeScreenshot). The channel is opened on the device's shared
+// instruments connection at the first capture and kept until Close(), so
+// repeated captures cost one round trip each.
+//
+// Usage:
+//   ScreenshotFrame frame;
+//   if (shots.Capture(frame) == Error::Success) save(frame.data, frame.size);
+//
+//   shots.Start(10.0, [](const ScreenshotFrame& f) { ... });   // ~10 fps
+//   // ... later ...
+//   shots.Stop();
+class ScreenshotService {
+public:
+    explicit ScreenshotService(std::shared_ptr<DeviceConnection> connection);
+    ~ScreenshotService();
+
+    // Non-copyable
+    ScreenshotService(const ScreenshotService&) = delete;
+    ScreenshotService& operator=(const ScreenshotService&) = delete;
+
+    // Take one screenshot (blocking)
+    Error Capture(ScreenshotFrame& outFrame, int timeoutMs = 5000);
+
+    // Capture repeatedly at targetFps (0 = as fast as the device answers)
+    // until Stop(). Two requests are kept in flight, so the rate is not
+    // capped by the round trip. Frames arrive in order on the connection's
+    // receive thread.
+    Error Start(double targetFps, ScreenshotCallback callback, ErrorCallback errorCb = nullptr);
+
+    // Stop capturing; waits for requests in flight. Not from the callback.
+    void Stop();
+
+    bool IsRunning() const;
+
+    ScreenshotStats Stats() const;
+
+    // Stop and release the channel
+    void Close();
+
+private:
+    struct State;
+
+    // Open the channel if needed (m_mutex held)
+    Error EnsureChannelLocked();
+
+    std::shared_ptr<DeviceConnection> m_connection;
+    mutable std::mutex m_mutex;
+    std::shared_ptr<DTXConnection> m_dtxConnection;  // shared per device
+    std::shared_ptr<DTXChannel> m_channel;
+    std::shared_ptr<State> m_state;
+    std::thread m_worker;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_SCREENSHOT_SERVICE_H
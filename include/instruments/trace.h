@@ -0,0 +1,43 @@
+#ifndef INSTRUMENTS_TRACE_H
+#define INSTRUMENTS_TRACE_H
+
+#include <cstddef>
+#include <string>
+
+namespace instruments {
+
+// Trace - optional timeline of connection bring-up and DTX traffic:
+// bring-up strategies (USB RSD, CDTunnel, QUIC, ...), the CDTunnel / QUIC
+// and RSD handshakes, StartService, SSL, the DTX capability handshake,
+// channel requests and every request/reply pair. Off by default; while
+// off a span costs one relaxed atomic load.
+//
+// The export is Chrome trace-event JSON, which chrome://tracing and the
+// Perfetto UI (ui.perfetto.dev) both open. Spans of a device's bring-up,
+// service connections and DTX traffic are grouped under one process row
+// per device (UDID, or tunnel address); the bring-up spans carry the iOS
+// version.
+class Trace {
+public:
+    // Clear and start recording; events past maxEvents are dropped
+    static void Start(size_t maxEvents = 1000000);
+
+    // Stop recording (events are kept for export)
+    static void Stop();
+
+    static bool IsRecording();
+
+    // Events recorded and dropped since Start()
+    static size_t EventCount();
+    static size_t DroppedCount();
+
+    // {"traceEvents": [...]} with timestamps in microseconds since Start()
+    static std::string ToChromeJson();
+
+    // Write ToChromeJson() to path; false if it cannot be written
+    static bool WriteChromeJson(const std::string& path);
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_TRACE_H
@@ -3,9 +3,13 @@
 
 #include "types.h"
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <vector>
@@ -34,7 +38,9 @@ public:
     TunnelManager();
     ~TunnelManager();
 
-    // Start a tunnel for a specific device
+    // Start a tunnel for a specific device. NotSupported if its iOS version
+    // is below 17; ConnectionFailed if the version cannot be read yet
+    // (locked or untrusted device)
     Error StartTunnel(const std::string& udid, TunnelInfo& outInfo);
 
     // Register an externally-created tunnel
@@ -44,7 +50,11 @@ public:
     // Stop a tunnel for a device
     void StopTunnel(const std::string& udid);
 
-    // Auto-tunnel: periodically discover devices and create tunnels
+    // Auto-tunnel: create tunnels for USB devices as usbmuxd reports them
+    // (already attached ones first). Devices come up in parallel on a
+    // bounded worker pool; failed attempts are retried with per-device
+    // exponential backoff until the device is unplugged, which also stops
+    // its auto-started tunnel.
     Error StartAutoTunnel();
     void StopAutoTunnel();
     bool IsAutoTunnelRunning() const { return m_autoTunnelRunning.load(); }
@@ -64,13 +74,37 @@ public:
     bool IsUserspaceTUN() const { return m_useUserspaceTUN; }
 
 private:
-    void AutoTunnelLoop();
+    friend struct TunnelManagerEvents;   // usbmuxd event callback
+
+    // Bring-up without m_tunnels bookkeeping (StartTunnel() serializes
+    // per device, not across devices)
+    Error BringUpTunnel(const std::string& udid, TunnelInfo& outInfo);
+
+    // One device waiting for (another) auto-tunnel attempt
+    struct AutoTunnelJob {
+        std::string udid;
+        std::chrono::steady_clock::time_point due;
+        int attempts = 0;
+    };
+    static constexpr int AutoTunnelWorkers = 8;
+
+    void OnDeviceAdded(const std::string& udid);
+    void OnDeviceRemoved(const std::string& udid);
+    void AutoTunnelWorker();
 
     mutable std::mutex m_mutex;
     std::map<std::string, TunnelInfo> m_tunnels;
+    std::set<std::string> m_starting;     // StartTunnel() in progress
+    std::condition_variable m_startCv;
 
     std::atomic<bool> m_autoTunnelRunning{false};
-    std::thread m_autoTunnelThread;
+    void* m_eventSubscription = nullptr;  // idevice_subscription_context_t
+    std::vector<std::thread> m_autoWorkers;
+    std::mutex m_autoMutex;
+    std::condition_variable m_autoCv;
+    std::deque<AutoTunnelJob> m_autoJobs;
+    std::set<std::string> m_autoDevices;  // attached: queued, retrying or in progress
+    std::set<std::string> m_autoStarted;  // tunnels the auto-tunnel created
     bool m_useUserspaceTUN = false;
 };
 
@@ -1,14 +1,23 @@
 #ifndef INSTRUMENTS_TYPES_H
 #define INSTRUMENTS_TYPES_H
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace instruments {
 
+// Host monotonic clock (steady_clock) in microseconds: the time base of
+// sample timestamps (SystemMetrics, FPSData, SampleAggregator windows)
+inline uint64_t HostMonotonicUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
 // Error codes returned by all public API methods
 enum class Error {
     Success = 0,
@@ -67,6 +76,10 @@ struct SystemMetrics {
     uint64_t netBytesOut = 0;
     uint64_t netPacketsIn = 0;
     uint64_t netPacketsOut = 0;
+    // When the sample arrived (HostMonotonicUs); the process list of the
+    // same sysmontap message is delivered right after with the same time
+    uint64_t timestampUs = 0;
+    uint64_t deviceTime = 0;        // sysmontap EndMachAbsTime (mach ticks), 0 if absent
 };
 
 // Per-process performance metrics from sysmontap
@@ -82,10 +95,66 @@ struct ProcessMetrics {
     uint64_t threads = 0;
 };
 
+// Process rows that changed since the previous sysmontap sample
+// (PerformanceService::StartDelta). A pid is reported in added the first
+// time it is seen, with its name; changed rows leave name empty, since it
+// is the one from when the pid was added. A pid whose name changes (exec)
+// is reported as added again.
+struct ProcessDelta {
+    std::vector<ProcessMetrics> added;
+    std::vector<ProcessMetrics> changed;
+    std::vector<int64_t> removed;       // pids missing from this sample
+
+    bool Empty() const { return added.empty() && changed.empty() && removed.empty(); }
+};
+
 // FPS monitoring data from graphics.opengl
 struct FPSData {
-    double fps = 0.0;
-    double gpuUtilization = 0.0;
+    double fps = 0.0;               // mean over the samples
+    double gpuUtilization = 0.0;    // mean over the samples
+    uint64_t timestampUs = 0;       // when the (last) sample arrived (HostMonotonicUs)
+    uint64_t deviceTime = 0;        // XRVideoCardRunTimeStamp (device µs), 0 if absent
+    double fpsMin = 0.0;
+    double fpsMax = 0.0;
+    uint32_t samples = 1;           // device samples coalesced into this one
+};
+
+// os_log message type (OSLogType values)
+enum class OSLogType : uint8_t {
+    Default = 0x00,
+    Info = 0x01,
+    Debug = 0x02,
+    Error = 0x10,
+    Fault = 0x11,
+};
+
+// One device log entry from the activitytracetap service
+struct LogEntry {
+    uint64_t timestampUs = 0;       // when the record arrived (HostMonotonicUs)
+    uint64_t deviceTimeNs = 0;      // device mach continuous time, in ns
+    int64_t pid = 0;
+    uint64_t tid = 0;
+    OSLogType type = OSLogType::Default;
+    bool signpost = false;          // os_signpost record rather than os_log
+    std::string process;
+    std::string subsystem;
+    std::string category;
+    std::string message;
+};
+
+// One screenshot from the screenshot service. data views the image
+// inside the received DTX message, which owner keeps alive: copy the bytes
+// (or hold the frame) to use them after the callback returns.
+struct ScreenshotFrame {
+    enum class Format { Unknown, PNG, JPEG };
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    Format format = Format::Unknown;
+    uint64_t index = 0;             // capture sequence number since Start()
+    uint64_t timestampUs = 0;       // when the reply arrived (HostMonotonicUs)
+    uint64_t latencyUs = 0;         // request to reply
+    std::shared_ptr<const void> owner;
 };
 
 // XCTest result for individual test case
@@ -112,8 +181,11 @@ struct TunnelInfo {
 
 // Callback types
 using FPSCallback = std::function<void(const FPSData&)>;
+using ScreenshotCallback = std::function<void(const ScreenshotFrame&)>;
+using LogEntryCallback = std::function<void(const LogEntry&)>;
 using SystemPerfCallback = std::function<void(const SystemMetrics&)>;
 using ProcessPerfCallback = std::function<void(const std::vector<ProcessMetrics>&)>;
+using ProcessDeltaCallback = std::function<void(const ProcessDelta&)>;
 using XCTestCallback = std::function<void(const TestResult&)>;
 using LogCallback = std::function<void(const std::string&)>;
 using ErrorCallback = std::function<void(Error, const std::string&)>;
@@ -151,6 +223,8 @@ namespace DTXProtocol {
     constexpr uint32_t HeaderLength = 32;
     constexpr uint32_t PayloadHeaderLength = 16;
     constexpr int DefaultTimeoutMs = 5000;
+    // Timeout argument meaning "the connection's DTXTimeoutPolicy"
+    constexpr int PolicyTimeoutMs = -1;
 }
 
 // Log level for library-wide logging
@@ -6,8 +6,11 @@
 #include "xctest_service.h"
 #include "types.h"
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -23,10 +26,23 @@ struct WDAConfig {
     uint16_t mjpegPort = 9100;          // Host port for MJPEG stream
     uint16_t deviceWdaPort = 8100;      // Device port for WDA HTTP server
     uint16_t deviceMjpegPort = 9100;    // Device port for MJPEG stream
+    bool forwardMjpeg = true;           // false when only StartMJPEGStream() reads it
     std::map<std::string, std::string> env;
     std::vector<std::string> args;
 };
 
+// One JPEG of the WDA MJPEG stream. data points into the reader's buffer and
+// is valid only during the callback.
+struct MJPEGFrame {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    uint64_t sequence = 0;          // frames received so far, this one included
+    uint64_t dropped = 0;           // frames replaced before delivery so far (latestOnly)
+    uint64_t timestampUs = 0;       // when the frame was complete (HostMonotonicUs)
+};
+
+using MJPEGFrameCallback = std::function<void(const MJPEGFrame& frame)>;
+
 // WDAService - runs WebDriverAgent on an iOS device with port forwarding.
 //
 // WDA is essentially a UI test bundle (XCTest) that runs a built-in HTTP
@@ -36,6 +52,12 @@ struct WDAConfig {
 // 3. Forwards MJPEG streaming port (default 9100)
 // 4. Streams WDA logs via callback
 //
+// StartMJPEGStream() reads the MJPEG port on the device itself instead of
+// through the host forward, so frames skip the relay and loopback hop: the
+// multipart stream is split in the receive buffer and each JPEG handed over
+// in place. With latestOnly a slow consumer gets the newest frame, not a
+// queue of old ones.
+//
 // Usage:
 //   WDAConfig config;
 //   config.bundleId = "com.facebook.WebDriverAgentRunner.xctrunner";
@@ -69,7 +91,19 @@ public:
     uint16_t GetWDAPort() const { return m_actualWdaPort; }
     uint16_t GetMJPEGPort() const { return m_actualMjpegPort; }
 
+    // Read the device's MJPEG port directly and call frameCb per JPEG. The
+    // reader reconnects until StopMJPEGStream() (WDA may still be starting).
+    // latestOnly: frameCb runs on its own thread and a frame arriving while
+    // it is busy replaces the waiting one; otherwise frameCb runs on the
+    // reader thread and a slow callback slows the stream down.
+    Error StartMJPEGStream(MJPEGFrameCallback frameCb, bool latestOnly = true);
+    void StopMJPEGStream();
+
 private:
+    void MJPEGReadLoop();
+    void MJPEGDeliverLoop();
+    void DeliverMJPEGFrame(const uint8_t* data, size_t size);
+
     std::shared_ptr<DeviceConnection> m_connection;
     std::unique_ptr<XCTestService> m_xctest;
     std::unique_ptr<PortForwarder> m_portForwarder;
@@ -78,6 +112,21 @@ private:
     std::atomic<bool> m_stopping{false};
     uint16_t m_actualWdaPort = 0;
     uint16_t m_actualMjpegPort = 0;
+    uint16_t m_deviceMjpegPort = 9100;
+
+    // MJPEG consumer
+    MJPEGFrameCallback m_frameCb;
+    bool m_latestOnly = true;
+    std::thread m_mjpegReader;
+    std::thread m_mjpegDelivery;
+    std::atomic<bool> m_mjpegStopping{false};
+    std::mutex m_frameMutex;
+    std::condition_variable m_frameCv;
+    std::vector<uint8_t> m_latestFrame;     // waiting for delivery (latestOnly)
+    bool m_frameReady = false;
+    uint64_t m_frameSequence = 0;
+    uint64_t m_framesDropped = 0;
+    uint64_t m_frameTimestampUs = 0;
 };
 
 } // namespace instruments
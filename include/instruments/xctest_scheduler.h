@@ -0,0 +1,113 @@
+#ifndef INSTRUMENTS_XCTEST_SCHEDULER_H
+#define INSTRUMENTS_XCTEST_SCHEDULER_H
+
+#include "device_connection.h"
+#include "types.h"
+#include "xctest_service.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace instruments {
+
+class XCTestSession;
+
+struct XCTestShardConfig {
+    XCTestConfig test;              // testsToRun is ignored; Run() takes the suite
+    size_t testsPerUnit = 0;        // tests per work unit (0 = about 4 units per device)
+    int maxAttempts = 2;            // runs of a unit before its tests are given up
+};
+
+// One device of the scheduler after Run()
+struct XCTestShardReport {
+    std::string udid;
+    size_t units = 0;               // units completed
+    size_t tests = 0;               // results received
+    size_t stolen = 0;              // units taken from another device's queue
+    Error error = Error::Success;   // why the device dropped out, if it did
+};
+
+// Results from every device, one at a time
+using XCTestShardCallback = std::function<void(size_t device, const TestResult& result)>;
+
+// XCTestScheduler - runs one suite across several devices. The suite is cut
+// into small units dealt round-robin onto per-device queues; each device
+// runs its own queue front to back on one XCTestSession and, once it is
+// empty, steals from the back of the longest other queue. Wall-clock time
+// then follows total work / devices instead of the slowest device's share.
+//
+// When a batch fails (runner launch, lost connection) the tests of its unit
+// that reported no result go back on a queue, at most maxAttempts runs in
+// all; a "Class" entry cut short runs again in full. The device reopens its
+// session once and drops out if that fails, its queue left to the others.
+//
+// Usage:
+//   XCTestShardConfig config;
+//   config.test.testRunnerBundleId = "com.example.UITests.xctrunner";
+//   XCTestScheduler scheduler({conn1, conn2, conn3}, config);
+//   scheduler.Run(tests, [](size_t device, const TestResult& r) { ... });
+class XCTestScheduler {
+public:
+    XCTestScheduler(std::vector<std::shared_ptr<DeviceConnection>> devices,
+                    XCTestShardConfig config);
+    virtual ~XCTestScheduler();
+
+    // Non-copyable
+    XCTestScheduler(const XCTestScheduler&) = delete;
+    XCTestScheduler& operator=(const XCTestScheduler&) = delete;
+
+    // Run every test ("Class" or "Class/method") and block until done.
+    // Returns Cancelled after Stop(), ConnectionFailed if no device could
+    // run, and Success otherwise (see Report() for tests given up on).
+    Error Run(const std::vector<std::string>& tests,
+              XCTestShardCallback resultCb,
+              LogCallback logCb = nullptr);
+
+    // Cancel the batches in progress and hand out no more work
+    void Stop();
+
+    // Per device, valid after Run()
+    std::vector<XCTestShardReport> Report() const;
+
+    // Tests that got no result: their batch failed maxAttempts times, or
+    // they were still queued when every device dropped out or Stop() ran
+    std::vector<std::string> Abandoned() const;
+
+protected:
+    // Session a device's worker runs its units on (nullptr if the device
+    // is missing). Tests override it with a stand-in session.
+    virtual std::shared_ptr<XCTestSession> CreateSession(size_t device);
+
+private:
+    struct Unit {
+        std::vector<std::string> tests;
+        int attempts = 0;
+    };
+
+    void Worker(size_t device);
+    bool Take(size_t device, Unit& unit);
+    void Requeue(size_t device, Unit&& unit);
+
+    std::vector<std::shared_ptr<DeviceConnection>> m_devices;
+    XCTestShardConfig m_config;
+    XCTestShardCallback m_resultCb;
+    LogCallback m_logCb;
+    std::atomic<bool> m_stopping{false};
+
+    // Queues, reports and the abandoned list
+    mutable std::mutex m_mutex;
+    std::vector<std::deque<Unit>> m_queues;
+    std::vector<XCTestShardReport> m_reports;
+    std::vector<std::shared_ptr<XCTestSession>> m_sessions;  // for Stop()
+    std::vector<std::string> m_abandoned;
+
+    std::mutex m_resultMutex;   // serializes m_resultCb
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_XCTEST_SCHEDULER_H
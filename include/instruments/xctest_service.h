@@ -4,13 +4,18 @@
 #include "device_connection.h"
 #include "types.h"
 #include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace instruments {
 
+class XCTestSession;
+
 // XCTest configuration
 struct XCTestConfig {
     std::string bundleId;               // App under test bundle ID
@@ -22,6 +27,9 @@ struct XCTestConfig {
     std::vector<std::string> testsToSkip;
 };
 
+// End of a RunAsync() run: its outcome and every collected result
+using XCTestDoneCallback = std::function<void(Error error, const std::vector<TestResult>& results)>;
+
 // XCTestService - runs XCTest bundles on iOS devices.
 //
 // The test execution flow:
@@ -35,6 +43,9 @@ struct XCTestConfig {
 // 8. Stop when tests complete or explicitly stopped
 //
 // For iOS 17+, uses tunnel connection and AppService for launching.
+//
+// Each run opens and closes its own XCTestSession; keep one open to run
+// several batches back to back.
 class XCTestService {
 public:
     explicit XCTestService(std::shared_ptr<DeviceConnection> connection);
@@ -46,7 +57,17 @@ public:
               LogCallback logCb = nullptr,
               ErrorCallback errorCb = nullptr);
 
-    // Stop test execution
+    // Run tests on a background thread and return at once. doneCb runs on
+    // that thread as soon as the test plan finishes (or the run fails or is
+    // stopped); it may start the next RunAsync().
+    Error RunAsync(const XCTestConfig& config,
+                   XCTestCallback resultCb,
+                   XCTestDoneCallback doneCb,
+                   LogCallback logCb = nullptr,
+                   ErrorCallback errorCb = nullptr);
+
+    // Stop test execution. Waits for a RunAsync() run to tear down; a Run()
+    // blocked on another thread is woken and tears down itself.
     void Stop();
 
     // Check if tests are running
@@ -56,14 +77,17 @@ private:
     Error RunWithDTX(const XCTestConfig& config,
                      XCTestCallback resultCb,
                      LogCallback logCb,
-                     ErrorCallback errorCb);
+                     ErrorCallback errorCb,
+                     std::vector<TestResult>* results);
 
     std::shared_ptr<DeviceConnection> m_connection;
-    std::unique_ptr<DTXConnection> m_dtxConnection;
-    std::unique_ptr<DTXConnection> m_dtxConnection2;
     std::atomic<bool> m_running{false};
     std::atomic<bool> m_stopping{false};
-    int64_t m_testRunnerPid = 0;
+
+    // Session of the run in progress (Stop() cancels it)
+    std::mutex m_sessionMutex;
+    std::shared_ptr<XCTestSession> m_session;
+    std::thread m_runThread;    // RunAsync()
 };
 
 } // namespace instruments
@@ -0,0 +1,101 @@
+#ifndef INSTRUMENTS_XCTEST_SESSION_H
+#define INSTRUMENTS_XCTEST_SESSION_H
+
+#include "device_connection.h"
+#include "dtx_channel.h"
+#include "dtx_connection.h"
+#include "process_service.h"
+#include "types.h"
+#include "xctest_service.h"
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace instruments {
+
+class XCTestProxy;
+
+// XCTestSession - one testmanagerd control session reused for a sequence of
+// test batches. Open() pays for the setup once: both testmanagerd
+// connections, the IDE proxy channels and the control-session handshake.
+// Each Run() then only launches the runner for its batch, authorizes it and
+// starts the plan.
+//
+// The runner is relaunched per batch because it exits when its test plan
+// finishes; the launch goes over the device's pooled instruments connection.
+//
+// Usage:
+//   XCTestSession session(connection);
+//   session.Open(config);
+//   for (const auto& shard : shards) session.Run(shard, onResult);
+//   session.Close();
+//
+// Run() calls must not overlap. Cancel() may be called from any thread.
+// Open/Run/Cancel/Close are virtual so XCTestScheduler can be driven by a
+// stand-in session (XCTestScheduler::CreateSession()).
+class XCTestSession {
+public:
+    explicit XCTestSession(std::shared_ptr<DeviceConnection> connection);
+    virtual ~XCTestSession();
+
+    // Non-copyable
+    XCTestSession(const XCTestSession&) = delete;
+    XCTestSession& operator=(const XCTestSession&) = delete;
+
+    // Connect and start the control session. config.testsToRun is the
+    // default batch for Run() calls that pass none.
+    virtual Error Open(const XCTestConfig& config,
+                       LogCallback logCb = nullptr,
+                       ErrorCallback errorCb = nullptr);
+
+    // Run one batch and block until its test plan finishes. Empty
+    // testsToRun = the config's list. Success only if the plan finished.
+    // Returns ConnectionFailed once testmanagerd has dropped the session,
+    // before or during the batch (reopen it), Cancelled after Cancel();
+    // results then holds the tests that reported before that.
+    virtual Error Run(const std::vector<std::string>& testsToRun,
+                      XCTestCallback resultCb,
+                      std::vector<TestResult>* results = nullptr);
+
+    // Wake a Run() in progress (it returns Cancelled with the results so
+    // far) and refuse further batches until the session is reopened
+    virtual void Cancel();
+
+    // Kill the runner and close the connections
+    virtual void Close();
+
+    bool IsOpen() const { return m_dtxConnection && m_dtxConnection->IsConnected(); }
+
+    // Batches whose test plan finished since Open()
+    size_t RunCount() const { return m_runs; }
+
+private:
+    void Dispatch(std::shared_ptr<DTXMessage> message);
+
+    std::shared_ptr<DeviceConnection> m_connection;
+    XCTestConfig m_config;
+    LogCallback m_logCb;
+    ErrorCallback m_errorCb;
+
+    std::unique_ptr<DTXConnection> m_dtxConnection;
+    std::unique_ptr<DTXConnection> m_dtxConnection2;
+    std::shared_ptr<DTXChannel> m_proxyChannel;
+    std::shared_ptr<DTXChannel> m_daemonChannel;
+    std::future<std::shared_ptr<DTXMessage>> m_initReply;   // collected by the first Run()
+    std::unique_ptr<ProcessService> m_process;
+    int64_t m_runnerPid = 0;
+    size_t m_runs = 0;
+
+    // Proxy of the batch in progress. m_dispatchMutex is held while a
+    // message is handed to it, so Run() can retire it safely.
+    std::mutex m_dispatchMutex;
+    std::mutex m_mutex;
+    std::shared_ptr<XCTestProxy> m_proxy;   // m_mutex
+    bool m_cancelled = false;               // m_mutex
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_XCTEST_SESSION_H
@@ -0,0 +1,305 @@
+#include "appservice_client.h"
+#include "../util/log.h"
+#include <algorithm>
+#include <chrono>
+
+namespace instruments {
+
+static const char* TAG = "AppServiceClient";
+
+// Connection and stream windows are topped up once this much DATA has been
+// consumed on them
+static constexpr size_t kWindowUpdateThreshold = 256 * 1024;
+static constexpr uint32_t kInitialWindowIncrement = 1048576;
+
+// Ids of requests that timed out, remembered so their late replies are
+// dropped instead of being taken for another request's
+static constexpr size_t kMaxAbandonedIds = 64;
+
+std::string AppServiceReply::ErrorDescription() const {
+    if (!error.IsValid()) return {};
+    std::string description(error["NSLocalizedDescription"].AsString());
+    if (description.empty()) {
+        description = std::string(error["domain"].AsString()) + " " +
+                      std::to_string(error["code"].AsInt64());
+    }
+    return description;
+}
+
+AppServiceClient::AppServiceClient(XPCPipe pipe)
+    : m_pipe(std::move(pipe))
+{
+}
+
+AppServiceClient::~AppServiceClient() {
+    Close();
+}
+
+Error AppServiceClient::Start(int timeoutMs) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    auto remainingMs = [&]() -> int {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    };
+
+    // HTTP/2 preface + connection window in one write, then the server's
+    // SETTINGS
+    H2FrameWriter out;
+    out.Preface().WindowUpdate(0, kInitialWindowIncrement);
+    if (!Send(out.Buffer())) return Error::ConnectionFailed;
+
+    while (!m_gotSettings) {
+        if (remainingMs() == 0) {
+            INST_LOG_ERROR(TAG, "Timeout waiting for server SETTINGS");
+            return Error::Timeout;
+        }
+        if (!Pump(remainingMs())) return Error::ConnectionFailed;
+    }
+
+    // RemoteXPC stream initialization, same as the RSD handshake
+    const NSObject emptyDict = NSObject::MakeDict({});
+    bool streamOpen[2] = {false, false};
+    for (const XPCInitStep& step : kXPCInitSteps) {
+        bool& open = streamOpen[step.streamId == 1 ? 0 : 1];
+        size_t before = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            before = m_setupReplies[step.streamId];
+        }
+        if (!SendXpc(step.streamId, !open, step.flags,
+                     step.emptyDictBody ? emptyDict : NSObject::Null(), 0)) {
+            return Error::ConnectionFailed;
+        }
+        open = true;
+
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_setupReplies[step.streamId] > before) break;
+            }
+            if (remainingMs() == 0) {
+                INST_LOG_ERROR(TAG, "Timeout in XPC stream initialization (stream %u)", step.streamId);
+                return Error::Timeout;
+            }
+            if (!Pump(remainingMs())) return Error::ConnectionFailed;
+        }
+    }
+
+    m_connected.store(true);
+    m_reader = std::thread([this]() { ReadLoop(); });
+    INST_LOG_INFO(TAG, "Connected to %s", ServiceName);
+    return Error::Success;
+}
+
+Error AppServiceClient::Invoke(const std::string& featureIdentifier, const NSObject& input,
+                               AppServiceReply& reply, int timeoutMs) {
+    reply = AppServiceReply{};
+    if (!m_connected.load()) return Error::ConnectionFailed;
+
+    XPCServiceRequest request;
+    request.featureIdentifier = featureIdentifier;
+    request.payload = input;
+
+    // A new HTTP/2 stream would need its own XPC initialization: requests
+    // go on the root stream Start() initialized
+    uint64_t messageId = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        messageId = m_nextMessageId++;
+        m_pending[messageId].streamId = RequestStream;
+    }
+
+    if (!SendXpc(RequestStream, false, XPCFlags::AlwaysSet | XPCFlags::Data | XPCFlags::WantingReply,
+                 request.ToBody(), messageId)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.erase(messageId);
+        return Error::ConnectionFailed;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const bool answered = m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() {
+            return m_pending[messageId].done || !m_connected.load();
+        });
+        Pending& pending = m_pending[messageId];
+        const bool done = pending.done;
+        reply.wire = std::move(pending.wire);
+        m_pending.erase(messageId);
+        if (!done) {
+            if (!answered) {
+                m_abandoned.push_back(messageId);
+                if (m_abandoned.size() > kMaxAbandonedIds) m_abandoned.pop_front();
+                INST_LOG_WARN(TAG, "%s: no reply within %d ms", featureIdentifier.c_str(), timeoutMs);
+                return Error::Timeout;
+            }
+            return Error::ConnectionFailed;
+        }
+    }
+
+    // The reply is read in place: only the fields asked for are decoded
+    XPCMessageView view;
+    if (!XPCMessage::Decode(reply.wire.data(), reply.wire.size(), view)) return Error::ProtocolError;
+    reply.output = view.body["CoreDevice.output"];
+    reply.error = view.body["CoreDevice.error"];
+    if (reply.error.IsValid()) {
+        INST_LOG_WARN(TAG, "%s failed: %s", featureIdentifier.c_str(), reply.ErrorDescription().c_str());
+        return Error::ProtocolError;
+    }
+    return Error::Success;
+}
+
+void AppServiceClient::Close() {
+    m_stopping.store(true);
+    if (m_reader.joinable()) {
+        if (m_reader.get_id() == std::this_thread::get_id()) {
+            m_reader.detach();
+        } else {
+            m_reader.join();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connected.store(false);
+    }
+    m_cv.notify_all();
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (m_pipe.close) {
+        m_pipe.close();
+        m_pipe.close = nullptr;
+    }
+}
+
+bool AppServiceClient::Send(const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_pipe.close && m_pipe.send(data);
+}
+
+// HEADERS (when the stream is new) and the DATA frame in one write, the
+// message encoded straight into the frame
+bool AppServiceClient::SendXpc(uint32_t streamId, bool openStream, uint32_t flags,
+                               const NSObject& body, uint64_t messageId) {
+    XPCMessage msg;
+    msg.flags = flags;
+    msg.messageId = messageId;
+    msg.body = body;
+
+    H2FrameWriter out;
+    if (openStream) out.Headers(streamId, {}, false);
+    const size_t frame = out.BeginData(streamId);
+    msg.EncodeTo(out.Buffer());
+    out.EndFrame(frame);
+    return Send(out.Buffer());
+}
+
+bool AppServiceClient::Pump(int timeoutMs) {
+    uint8_t* tail = m_recvBuf.Tail();
+    const int n = m_pipe.read(tail, m_recvBuf.TailSize(), timeoutMs);
+    if (n < 0) return false;
+    m_recvBuf.end += static_cast<size_t>(n);
+
+    m_replies.Clear();
+    bool goAway = false;
+    while (m_recvBuf.UnparsedSize() > 0) {
+        H2FrameView frame;
+        const size_t consumed = Http2Framer::DecodeFrame(m_recvBuf.Unparsed(),
+                                                         m_recvBuf.UnparsedSize(), frame);
+        if (consumed == 0) break;
+
+        if (frame.type == H2FrameType::Settings && !(frame.flags & H2Flags::Ack)) {
+            m_replies.Settings(true);
+            m_gotSettings = true;
+        } else if (frame.type == H2FrameType::Data) {
+            // Flow control counts the whole payload, padding included
+            m_unacked[0] += consumed - 9;
+            if (frame.payloadSize > 0) {
+                const uint32_t streamId = frame.streamId;
+                m_streams[streamId].Append(frame.payload, frame.payloadSize,
+                    [this, streamId](const uint8_t* data, size_t length) {
+                        XPCMessageView view;
+                        if (!XPCMessage::Decode(data, length, view)) return false;
+                        OnMessage(data, length, view.messageId, streamId);
+                        return true;
+                    });
+            }
+            if (frame.flags & H2Flags::EndStream) {
+                m_streams.erase(frame.streamId);
+                m_unacked.erase(frame.streamId);
+            } else {
+                m_unacked[frame.streamId] += consumed - 9;
+            }
+        } else if (frame.type == H2FrameType::GoAway) {
+            INST_LOG_WARN(TAG, "Server sent GOAWAY");
+            goAway = true;
+        }
+        m_recvBuf.Consume(consumed);
+    }
+
+    // Reopen the windows the reply bytes used up
+    for (auto& [streamId, bytes] : m_unacked) {
+        if (bytes >= kWindowUpdateThreshold) {
+            m_replies.WindowUpdate(streamId, static_cast<uint32_t>(bytes));
+            bytes = 0;
+        }
+    }
+    if (!m_replies.Empty()) Send(m_replies.Buffer());
+    return !goAway;
+}
+
+void AppServiceClient::OnMessage(const uint8_t* data, size_t length,
+                                 uint64_t messageId, uint32_t streamId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // A reply with an id belongs to that request only: a late one for a
+    // request that timed out is dropped, other unknown ids are unsolicited.
+    // Without an id it goes to the oldest request waiting on this stream
+    // (m_pending is ordered by id, i.e. by send order).
+    auto match = m_pending.end();
+    if (messageId != 0) {
+        auto abandoned = std::find(m_abandoned.begin(), m_abandoned.end(), messageId);
+        if (abandoned != m_abandoned.end()) {
+            m_abandoned.erase(abandoned);
+            INST_LOG_DEBUG(TAG, "Late reply to timed-out request %llu dropped",
+                           static_cast<unsigned long long>(messageId));
+            return;
+        }
+        match = m_pending.find(messageId);
+        if (match != m_pending.end() && match->second.done) match = m_pending.end();
+    } else {
+        for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+            if (it->second.streamId == streamId && !it->second.done) {
+                match = it;
+                break;
+            }
+        }
+    }
+
+    if (match == m_pending.end()) {
+        m_setupReplies[streamId]++;
+        if (m_connected.load()) {
+            INST_LOG_DEBUG(TAG, "Unsolicited XPC message on stream %u (id %llu)",
+                           streamId, static_cast<unsigned long long>(messageId));
+        }
+        return;
+    }
+    match->second.wire.assign(data, data + length);
+    match->second.done = true;
+    m_cv.notify_all();
+}
+
+void AppServiceClient::ReadLoop() {
+    while (!m_stopping.load()) {
+        if (!Pump(500)) {
+            INST_LOG_WARN(TAG, "Connection to %s closed", ServiceName);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_connected.store(false);
+            }
+            m_cv.notify_all();
+            return;
+        }
+    }
+}
+
+} // namespace instruments
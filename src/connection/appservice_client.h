@@ -0,0 +1,121 @@
+#ifndef INSTRUMENTS_APPSERVICE_CLIENT_H
+#define INSTRUMENTS_APPSERVICE_CLIENT_H
+
+#include "../../include/instruments/types.h"
+#include "http2_framer.h"
+#include "rsd_provider.h"
+#include "xpc_message.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace instruments {
+
+// CoreDevice reply as received. output and error point into wire, which
+// moves with the reply (the object is move-only).
+struct AppServiceReply {
+    std::vector<uint8_t> wire;
+    XPCValue output;            // CoreDevice.output
+    XPCValue error;             // CoreDevice.error (invalid if none)
+
+    AppServiceReply() = default;
+    AppServiceReply(AppServiceReply&&) = default;
+    AppServiceReply& operator=(AppServiceReply&&) = default;
+    AppServiceReply(const AppServiceReply&) = delete;
+    AppServiceReply& operator=(const AppServiceReply&) = delete;
+
+    // CoreDevice.error's description, or "" on success
+    std::string ErrorDescription() const;
+};
+
+// AppServiceClient - long-lived RemoteXPC connection to
+// com.apple.coredevice.appservice (DeviceConnection::SharedAppServiceClient()).
+// The HTTP/2 preface, SETTINGS exchange and XPC stream initialization are
+// paid once in Start(); every Invoke() after that is one message on the
+// initialized root stream (1), as go-ios sends its appservice requests.
+// Requests from several threads can be in flight together: a reply is
+// matched by message id; only a reply without one goes to the oldest
+// request still waiting (the stream answers in order). Late replies to
+// requests that timed out are dropped.
+//
+// One reader thread owns the receive side: it decodes frames in place,
+// reassembles XPC messages per stream and hands each reply's bytes to the
+// waiting caller. Flow-control windows are reopened as DATA is consumed.
+class AppServiceClient {
+public:
+    static constexpr const char* ServiceName = "com.apple.coredevice.appservice";
+
+    // RemoteXPC root stream, opened by Start(); carries every request
+    static constexpr uint32_t RequestStream = 1;
+
+    explicit AppServiceClient(XPCPipe pipe);
+    ~AppServiceClient();
+
+    // Non-copyable
+    AppServiceClient(const AppServiceClient&) = delete;
+    AppServiceClient& operator=(const AppServiceClient&) = delete;
+
+    // HTTP/2 + RemoteXPC setup, then start the reader thread
+    Error Start(int timeoutMs = 10000);
+
+    // Send one CoreDevice feature request and wait for its reply.
+    // Returns Timeout, ConnectionFailed once the connection dropped, or
+    // ProtocolError if the reply carries a CoreDevice error (reply still
+    // filled in).
+    Error Invoke(const std::string& featureIdentifier, const NSObject& input,
+                 AppServiceReply& reply, int timeoutMs = 10000);
+
+    // Stop the reader, fail pending requests and close the pipe
+    void Close();
+
+    bool IsConnected() const { return m_connected.load(); }
+
+private:
+    struct Pending {
+        uint32_t streamId = 0;
+        bool done = false;
+        std::vector<uint8_t> wire;
+    };
+
+    // Read once, handle every complete frame; false once the pipe closed
+    bool Pump(int timeoutMs);
+    void OnMessage(const uint8_t* data, size_t length, uint64_t messageId, uint32_t streamId);
+    bool Send(const std::vector<uint8_t>& data);
+    bool SendXpc(uint32_t streamId, bool openStream, uint32_t flags,
+                 const NSObject& body, uint64_t messageId);
+    void ReadLoop();
+
+    XPCPipe m_pipe;
+    std::thread m_reader;
+    std::atomic<bool> m_connected{false};
+    std::atomic<bool> m_stopping{false};
+
+    std::mutex m_sendMutex;             // one writer on the pipe at a time
+
+    // Receive side: Start() on the caller's thread, then ReadLoop() only
+    H2ReceiveBuffer m_recvBuf;
+    H2FrameWriter m_replies;            // SETTINGS acks + WINDOW_UPDATEs of one read
+    std::map<uint32_t, XPCStreamDecoder> m_streams;
+    std::map<uint32_t, size_t> m_unacked;   // DATA bytes to return per stream (0 = connection)
+    bool m_gotSettings = false;
+
+    // Requests in flight by message id, and replies seen per stream during
+    // Start()
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<uint64_t, Pending> m_pending;
+    std::map<uint32_t, size_t> m_setupReplies;
+    std::deque<uint64_t> m_abandoned;   // ids of requests that timed out (newest last)
+    uint64_t m_nextMessageId = 1;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_APPSERVICE_CLIENT_H
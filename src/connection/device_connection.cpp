@@ -1,10 +1,19 @@
 #include "../../include/instruments/device_connection.h"
+#include "appservice_client.h"
+#include "instrument_pool.h"
 #include "service_connector.h"
+#include "rsd_cache.h"
 #include "rsd_provider.h"
 #include "tunnel_quic.h"
+#include "../dtx/dtx_capture.h"
 #include "../util/log.h"
+#include "../util/trace.h"
+#include <algorithm>
 #include <array>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
 #include <sstream>
 #include <thread>
 #include <vector>
@@ -82,32 +91,221 @@ static bool TryFindInstrumentServicePort(const std::map<std::string, uint16_t>&
 
 DeviceConnection::DeviceConnection() = default;
 
-void DeviceConnection::TryUsbRSD() {
+// Bring-up settings and the strategy that last worked, by UDID
+static std::mutex s_bringUpMutex;
+static BringUpOptions s_bringUpOptions;
+static std::map<std::string, BringUpStrategy> s_bringUpWinners;
+
+static const char* BringUpStrategyName(BringUpStrategy strategy) {
+    switch (strategy) {
+        case BringUpStrategy::None:       return "none";
+        case BringUpStrategy::UsbRSD:     return "USB RSD";
+        case BringUpStrategy::CDTunnel:   return "CDTunnel";
+        case BringUpStrategy::UsbQUIC:    return "USB QUIC";
+        case BringUpStrategy::NetworkRSD: return "USB-NCM network RSD";
+        case BringUpStrategy::DirectNCM:  return "direct USB-NCM";
+    }
+    return "unknown";
+}
+
+static std::string DeviceUDID(idevice_t device) {
+    char* udid = nullptr;
+    if (idevice_get_udid(device, &udid) != IDEVICE_E_SUCCESS || !udid) return {};
+    std::string result(udid);
+    free(udid);
+    return result;
+}
+
+// Trace row of a connection's spans: the UDID, or the tunnel address
+// ("" while tracing is off)
+static std::string TraceDevice(idevice_t device, const std::string& tunnelAddress) {
+    if (!trace::Enabled()) return {};
+    return device ? DeviceUDID(device) : tunnelAddress;
+}
+
+void DeviceConnection::SetBringUpOptions(const BringUpOptions& options) {
+    std::lock_guard<std::mutex> lock(s_bringUpMutex);
+    s_bringUpOptions = options;
+}
+
+void DeviceConnection::BringUpRSD() {
+    if (m_protocol != IOSProtocol::RSD || !m_device) return;
+
+    int major = 0, minor = 0, patch = 0;
+    ServiceConnector::ParseVersion(m_iosVersion, major, minor, patch);
+
+    // Preference order. CDTunnel is the primary path on 17.4+; iOS 18+ falls
+    // back to USB-NCM, iOS 17.0-17.3 to QUIC over lockdown.
+    std::vector<BringUpStrategy> order = {BringUpStrategy::UsbRSD};
+#ifdef INSTRUMENTS_HAS_QUIC
+    order.push_back(BringUpStrategy::CDTunnel);
+    if (major > 17) {
+        order.push_back(BringUpStrategy::NetworkRSD);
+        order.push_back(BringUpStrategy::DirectNCM);
+    } else {
+        order.push_back(BringUpStrategy::UsbQUIC);
+    }
+#endif
+
+    const std::string udid = DeviceUDID(m_device);
+    BringUpOptions options;
+    BringUpStrategy remembered = BringUpStrategy::None;
+    {
+        std::lock_guard<std::mutex> lock(s_bringUpMutex);
+        options = s_bringUpOptions;
+        auto it = s_bringUpWinners.find(udid);
+        if (it != s_bringUpWinners.end()) remembered = it->second;
+    }
+
+    // Reconnect: go straight to the strategy that worked last time
+    BringUpStrategy winner = BringUpStrategy::None;
+    auto rememberedIt = std::find(order.begin(), order.end(), remembered);
+    if (rememberedIt != order.end()) {
+        INST_LOG_INFO(TAG, "iOS %s: trying last successful bring-up (%s) first",
+                     m_iosVersion.c_str(), BringUpStrategyName(remembered));
+        order.erase(rememberedIt);
+        if (RunStrategy(remembered)) winner = remembered;
+    }
+
+    if (winner == BringUpStrategy::None) {
+        if (options.parallel && order.size() > 1) {
+            winner = RaceBringUp(order, options.staggerMs);
+        } else {
+            for (BringUpStrategy strategy : order) {
+                if (RunStrategy(strategy)) {
+                    winner = strategy;
+                    break;
+                }
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(s_bringUpMutex);
+        if (winner != BringUpStrategy::None) {
+            s_bringUpWinners[udid] = winner;
+        } else {
+            s_bringUpWinners.erase(udid);
+        }
+    }
+    m_bringUpStrategy = winner;
+    if (winner != BringUpStrategy::None) {
+        INST_LOG_INFO(TAG, "iOS %s: brought up via %s", m_iosVersion.c_str(), BringUpStrategyName(winner));
+        return;
+    }
+
+#ifdef INSTRUMENTS_HAS_QUIC
+    if (major > 17) {
+        INST_LOG_WARN(TAG, "iOS %s: automatic USB tunnel failed. "
+                     "CDTunnel requires the device to be trusted (unlocked/paired). "
+                     "On Windows, install 'Apple Devices' from the Microsoft Store for USB-NCM. "
+                     "Alternatively, use an external CoreDevice tunnel:\n"
+                     "  go-ios:          ios tunnel start --userspace --udid=<UDID>\n"
+                     "  pymobiledevice3: python3 -m pymobiledevice3 remote start-tunnel\n"
+                     "Then call Instruments::CreateFromTunnel(address, port, \"%s\").",
+                     m_iosVersion.c_str(), m_iosVersion.c_str());
+    }
+#else
+    INST_LOG_WARN(TAG, "TryUsbQUIC: INSTRUMENTS_HAS_QUIC not enabled — "
+                 "cannot use USB CoreDevice tunnel (CDTunnel or QUIC). "
+                 "Use an external CoreDevice tunnel instead.");
+#endif
+}
+
+bool DeviceConnection::RunStrategy(BringUpStrategy strategy) {
+    TraceSpan span("connect", BringUpStrategyName(strategy), m_iosVersion);
+    switch (strategy) {
+        case BringUpStrategy::UsbRSD:     return TryUsbRSD();
+        case BringUpStrategy::CDTunnel:   return TryCDTunnel();
+        case BringUpStrategy::UsbQUIC:    return TryUsbQUIC();
+        case BringUpStrategy::NetworkRSD: return TryNetworkRSD();
+        case BringUpStrategy::DirectNCM:  return TryDirectNCMConnection();
+        case BringUpStrategy::None:       break;
+    }
+    return false;
+}
+
+BringUpStrategy DeviceConnection::RaceBringUp(const std::vector<BringUpStrategy>& order,
+                                              uint32_t staggerMs) {
+    struct Race {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t finished = 0;
+        int winner = -1;
+    };
+    auto race = std::make_shared<Race>();
+
+    // Each strategy runs on its own probe (sharing m_device) so losers
+    // never touch this object. The blocking connects inside a strategy
+    // cannot be interrupted: once there is a winner no further strategies
+    // start, and the running ones finish in the background and are dropped.
+    std::vector<std::shared_ptr<DeviceConnection>> probes;
+    std::unique_lock<std::mutex> lock(race->mutex);
+    for (size_t i = 0; i < order.size() && race->winner < 0; i++) {
+        auto probe = std::shared_ptr<DeviceConnection>(new DeviceConnection());
+        probe->m_device = m_device;
+        probe->m_iosVersion = m_iosVersion;
+        probe->m_protocol = m_protocol;
+        probes.push_back(probe);
+
+        INST_LOG_DEBUG(TAG, "Bring-up race: starting %s", BringUpStrategyName(order[i]));
+        m_bringUpThreads.emplace_back([race, probe, strategy = order[i], i,
+                                       traceDevice = TraceDeviceScope::Current()]() {
+            TraceDeviceScope traceScope(traceDevice);
+            const bool ok = probe->RunStrategy(strategy);
+            std::lock_guard<std::mutex> raceLock(race->mutex);
+            race->finished++;
+            if (ok && race->winner < 0) race->winner = static_cast<int>(i);
+            race->cv.notify_all();
+        });
+
+        // Head start for the running attempts; move on early if all failed
+        race->cv.wait_for(lock, std::chrono::milliseconds(staggerMs), [&]() {
+            return race->winner >= 0 || race->finished == probes.size();
+        });
+    }
+    race->cv.wait(lock, [&]() { return race->winner >= 0 || race->finished == probes.size(); });
+    if (race->winner < 0) return BringUpStrategy::None;
+
+    AdoptBringUp(*probes[race->winner]);
+    return order[race->winner];
+}
+
+void DeviceConnection::AdoptBringUp(DeviceConnection& probe) {
+    m_rsdServices = std::move(probe.m_rsdServices);
+    m_rsdFromCache = probe.m_rsdFromCache;
+    m_isTunnel = probe.m_isTunnel;
+    m_isUsbRsd = probe.m_isUsbRsd;
+    m_tunnelAddress = std::move(probe.m_tunnelAddress);
+    m_tunnelRsdPort = probe.m_tunnelRsdPort;
+    m_quicTunnel = std::move(probe.m_quicTunnel);
+    m_isUsbQuic = probe.m_isUsbQuic;
+    m_isDirectNCM = probe.m_isDirectNCM;
+    m_ncmAddress = std::move(probe.m_ncmAddress);
+    m_ncmScopeId = probe.m_ncmScopeId;
+    m_networkDevice = probe.m_networkDevice;
+    probe.m_networkDevice = nullptr;
+}
+
+bool DeviceConnection::TryUsbRSD() {
     // Attempt USB RSD for iOS 17+ devices: connect to RSD port 58783 via usbmuxd.
     // NOTE: This works only if the device exposes port 58783 via usbmuxd TCP forwarding.
     // In practice this succeeds only on some early iOS 17.x builds; iOS 18+ (iOS 26+)
     // devices refuse the connection (CONNREFUSED). Most iOS 17+ USB devices require an
     // external CoreDevice QUIC tunnel — use go-ios `ios tunnel start` or
     // pymobiledevice3 `remote start-tunnel`, then call Instruments::CreateFromTunnel().
-    if (m_protocol != IOSProtocol::RSD || !m_device) return;
-
-    RSDProvider rsd;
-    Error err = rsd.ConnectViaIDevice(m_device);
+    Error err = DiscoverRSDServices(BringUpStrategy::UsbRSD);
     if (err != Error::Success) {
         INST_LOG_WARN(TAG, "iOS 17+ USB RSD via usbmuxd failed (%s) — "
-                     "this is expected on iOS 18+ (iOS 26+). "
-                     "Attempting USB CoreDevice QUIC tunnel...",
+                     "this is expected on iOS 18+ (iOS 26+).",
                      ErrorToString(err));
-        TryUsbQUIC();
-        return;
+        return false;
     }
 
-    for (const auto& [name, entry] : rsd.GetServices()) {
-        m_rsdServices[name] = entry.port;
-    }
     m_isUsbRsd = true;
     m_isTunnel = true;  // reuse the tunnel path in CreateInstrumentConnection
     INST_LOG_INFO(TAG, "iOS 17+ USB RSD: %zu services discovered", m_rsdServices.size());
+    return true;
 }
 
 // ---------- Direct USB-NCM IPv6 helpers ----------
@@ -376,107 +574,124 @@ static std::vector<NCMCandidate> DiscoverAppleNCMCandidates() {
     return result;
 }
 
-void DeviceConnection::TryUsbQUIC() {
-#ifdef INSTRUMENTS_HAS_QUIC
-    // Helper: try CDTunnel via CoreDeviceProxy, do RSD handshake, populate services.
-    // Defined as a lambda to keep it scoped and avoid unused-function warnings without QUIC.
-    auto tryCDTunnelAndRSD = [](QUICTunnel& tunnel, idevice_t device,
-                                std::map<std::string, uint16_t>& servicesOut,
-                                std::string& serverAddrOut, uint16_t& rsdPortOut) -> bool {
-        Error err = tunnel.ConnectViaCoreDeviceProxy(device);
-        if (err != Error::Success) return false;
-
-        int rsdFd = tunnel.CreateTunnelSocket(tunnel.ServerAddress(), tunnel.ServerRSDPort());
-        if (rsdFd < 0) {
-            INST_LOG_ERROR("DeviceConnection", "CDTunnel: CreateTunnelSocket for RSD failed");
-            return false;
-        }
-
-        RSDProvider rsd;
-        Error rsdErr = rsd.ConnectViaFd(rsdFd);
+static void CloseSocketFd(int fd) {
 #ifdef _WIN32
-        closesocket(static_cast<SOCKET>(rsdFd));
+    closesocket(static_cast<SOCKET>(fd));
 #else
-        ::close(rsdFd);
+    ::close(fd);
 #endif
+}
 
-        if (rsdErr != Error::Success || rsd.GetServices().empty()) {
-            if (rsdErr == Error::Success) {
-                INST_LOG_WARN("DeviceConnection", "CDTunnel: RSD handshake returned no services");
-            } else {
-                INST_LOG_WARN("DeviceConnection", "CDTunnel: RSD handshake failed: %s",
-                             ErrorToString(rsdErr));
+Error DeviceConnection::HandshakeRSD(BringUpStrategy strategy, RSDProvider& rsd) {
+    switch (strategy) {
+        case BringUpStrategy::UsbRSD:
+            return rsd.ConnectViaIDevice(m_device);
+        case BringUpStrategy::NetworkRSD:
+            return rsd.ConnectViaIDevice(m_networkDevice);
+        case BringUpStrategy::CDTunnel:
+        case BringUpStrategy::UsbQUIC: {
+#ifdef INSTRUMENTS_HAS_QUIC
+            auto* qt = static_cast<QUICTunnel*>(m_quicTunnel.get());
+            auto stream = qt ? qt->CreateTunnelStream(m_tunnelAddress, m_tunnelRsdPort) : nullptr;
+            if (!stream) {
+                INST_LOG_ERROR(TAG, "%s: CreateTunnelStream for RSD failed", BringUpStrategyName(strategy));
+                return Error::ConnectionFailed;
             }
-            return false;
+            Error err = rsd.ConnectViaStream(stream);
+            stream->Close();
+            return err;
+#else
+            return Error::NotSupported;
+#endif
         }
-
-        for (const auto& [name, entry] : rsd.GetServices()) {
-            servicesOut[name] = entry.port;
+        case BringUpStrategy::DirectNCM: {
+            int fd = ConnectIPv6WithTimeout(m_ncmAddress, m_ncmScopeId, RSDProvider::DefaultPort, 500);
+            if (fd < 0) return Error::ConnectionFailed;
+            Error err = rsd.ConnectViaFd(fd);
+            CloseSocketFd(fd);
+            return err;
         }
-        serverAddrOut = tunnel.ServerAddress();
-        rsdPortOut = tunnel.ServerRSDPort();
-        return true;
-    };
+        case BringUpStrategy::None:
+            break;
+    }
+    return Error::NotSupported;
+}
 
-    if (m_protocol != IOSProtocol::RSD || !m_device) return;
+Error DeviceConnection::DiscoverRSDServices(BringUpStrategy strategy, bool useCache) {
+    const std::string udid = DeviceUDID(m_device);
+    if (useCache && RSDServiceCache::Instance().Lookup(udid, strategy, m_rsdServices)) {
+        m_rsdFromCache = true;
+        INST_LOG_INFO(TAG, "%s: using %zu cached RSD services (handshake skipped)",
+                     BringUpStrategyName(strategy), m_rsdServices.size());
+        return Error::Success;
+    }
 
-    int major = 0, minor = 0, patch = 0;
-    ServiceConnector::ParseVersion(m_iosVersion, major, minor, patch);
+    RSDProvider rsd;
+    Error err = HandshakeRSD(strategy, rsd);
+    if (err != Error::Success) return err;
+    if (rsd.GetServices().empty()) {
+        INST_LOG_WARN(TAG, "%s: RSD handshake returned no services", BringUpStrategyName(strategy));
+        return Error::ProtocolError;
+    }
 
-    // Phase 0: Try CDTunnel (CoreDeviceProxy) — works on iOS 17.4+, iOS 18+/26+.
-    // Uses standard lockdownd + simple TCP protocol (no QUIC, no admin, no NCM driver).
-    // This is the preferred path and works with iTunes-only (no Apple Devices app).
-    {
-        INST_LOG_INFO(TAG, "iOS %s: trying CDTunnel (com.apple.internal.devicecompute.CoreDeviceProxy)...",
-                     m_iosVersion.c_str());
-        auto cdTunnel = std::make_shared<QUICTunnel>();
-        std::map<std::string, uint16_t> services;
-        std::string serverAddr;
-        uint16_t rsdPort = 0;
-        if (tryCDTunnelAndRSD(*cdTunnel, m_device, services, serverAddr, rsdPort)) {
-            m_quicTunnel = cdTunnel;
-            m_tunnelAddress = serverAddr;
-            m_tunnelRsdPort = rsdPort;
-            m_isTunnel = true;
-            m_isUsbQuic = true;
-            m_rsdServices = std::move(services);
-            INST_LOG_INFO(TAG, "iOS %s CDTunnel active: %zu services discovered",
-                         m_iosVersion.c_str(), m_rsdServices.size());
-            return;
-        }
-        INST_LOG_DEBUG(TAG, "CDTunnel unavailable on iOS %s — trying other methods...",
-                      m_iosVersion.c_str());
+    m_rsdServices.clear();
+    for (const auto& [name, entry] : rsd.GetServices()) {
+        m_rsdServices[name] = entry.port;
     }
+    m_rsdFromCache = false;
+    RSDServiceCache::Instance().Store(udid, strategy, rsd.GetBootSessionUUID(), m_rsdServices);
+    return Error::Success;
+}
 
-    if (major > 17) {
-        // iOS 18+/26+: CDTunnel should have worked; if it didn't, try USB-NCM approaches.
-        // (CDTunnel is not available if device is not yet trusted, or service is absent.)
+Error DeviceConnection::RefreshRSDServices() {
+    RSDServiceCache::Instance().Invalidate(DeviceUDID(m_device), m_bringUpStrategy);
+    return DiscoverRSDServices(m_bringUpStrategy, false);
+}
 
-        // Phase 1: USB-NCM via Apple's usbmuxd PREFER_NETWORK — requires Apple Devices app.
-        INST_LOG_INFO(TAG, "iOS %s: trying USB-NCM network path (Apple usbmuxd)...",
-                     m_iosVersion.c_str());
-        TryNetworkRSD();
-        if (m_isUsbRsd) return;
+void DeviceConnection::SetRSDCachePath(const std::string& path) {
+    RSDServiceCache::Instance().SetPath(path);
+}
 
-        // Phase 2: Direct USB-NCM IPv6 — enumerate host adapters, find Apple NCM interface.
-        TryDirectNCMConnection();
-        if (m_isDirectNCM) return;
+bool DeviceConnection::TryCDTunnel() {
+#ifdef INSTRUMENTS_HAS_QUIC
+    // CDTunnel (CoreDeviceProxy) — works on iOS 17.4+, iOS 18+/26+.
+    // Uses standard lockdownd + simple TCP protocol (no QUIC, no admin, no NCM driver).
+    // This is the preferred path and works with iTunes-only (no Apple Devices app).
+    INST_LOG_INFO(TAG, "iOS %s: trying CDTunnel (com.apple.internal.devicecompute.CoreDeviceProxy)...",
+                 m_iosVersion.c_str());
+    auto tunnel = std::make_shared<QUICTunnel>();
+    Error err = tunnel->ConnectViaCoreDeviceProxy(m_device);
+    if (err != Error::Success) {
+        INST_LOG_DEBUG(TAG, "CDTunnel unavailable on iOS %s", m_iosVersion.c_str());
+        return false;
+    }
 
-        // Phase 3: Nothing worked.
-        INST_LOG_WARN(TAG, "iOS %s: automatic USB tunnel failed. "
-                     "CDTunnel requires the device to be trusted (unlocked/paired). "
-                     "On Windows, install 'Apple Devices' from the Microsoft Store for USB-NCM. "
-                     "Alternatively, use an external CoreDevice tunnel:\n"
-                     "  go-ios:          ios tunnel start --userspace --udid=<UDID>\n"
-                     "  pymobiledevice3: python3 -m pymobiledevice3 remote start-tunnel\n"
-                     "Then call Instruments::CreateFromTunnel(address, port, \"%s\").",
-                     m_iosVersion.c_str(), m_iosVersion.c_str());
-        return;
+    m_quicTunnel = tunnel;
+    m_tunnelAddress = tunnel->ServerAddress();
+    m_tunnelRsdPort = tunnel->ServerRSDPort();
+    Error rsdErr = DiscoverRSDServices(BringUpStrategy::CDTunnel);
+    if (rsdErr != Error::Success) {
+        INST_LOG_WARN(TAG, "CDTunnel: RSD handshake failed: %s", ErrorToString(rsdErr));
+        m_quicTunnel.reset();
+        m_tunnelAddress.clear();
+        m_tunnelRsdPort = 0;
+        return false;
     }
 
-    // iOS 17.0-17.3: CDTunnel not available — fall back to QUIC over lockdown stream.
-    INST_LOG_INFO(TAG, "iOS %s: CDTunnel unavailable — trying QUIC lockdown tunnel...",
-                 m_iosVersion.c_str());
+    m_isTunnel = true;
+    m_isUsbQuic = true;
+    INST_LOG_INFO(TAG, "iOS %s CDTunnel active: %zu services discovered",
+                 m_iosVersion.c_str(), m_rsdServices.size());
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool DeviceConnection::TryUsbQUIC() {
+#ifdef INSTRUMENTS_HAS_QUIC
+    // iOS 17.0-17.3: CDTunnel not available — QUIC over lockdown stream.
+    INST_LOG_INFO(TAG, "iOS %s: trying QUIC lockdown tunnel...", m_iosVersion.c_str());
 
     auto quicTunnel = std::make_shared<QUICTunnel>();
     Error err = quicTunnel->ConnectViaUSB(m_device);
@@ -487,60 +702,43 @@ void DeviceConnection::TryUsbQUIC() {
                      "pymobiledevice3: `python3 -m pymobiledevice3 remote start-tunnel`. "
                      "Then call Instruments::CreateFromTunnel(address, port, iosVersion).",
                      ErrorToString(err));
-        return;
-    }
-
-    int rsdFd = quicTunnel->CreateTunnelSocket(
-        quicTunnel->ServerAddress(), quicTunnel->ServerRSDPort());
-    if (rsdFd < 0) {
-        INST_LOG_ERROR(TAG, "TryUsbQUIC: CreateTunnelSocket for RSD failed");
-        return;
-    }
-
-    RSDProvider rsd;
-    Error rsdErr = rsd.ConnectViaFd(rsdFd);
-#ifdef _WIN32
-    closesocket(static_cast<SOCKET>(rsdFd));
-#else
-    ::close(rsdFd);
-#endif
-
-    if (rsdErr != Error::Success || rsd.GetServices().empty()) {
-        INST_LOG_WARN(TAG, "TryUsbQUIC: RSD via USB QUIC failed: %s", ErrorToString(rsdErr));
-        return;
+        return false;
     }
 
     m_quicTunnel = quicTunnel;
     m_tunnelAddress = quicTunnel->ServerAddress();
     m_tunnelRsdPort = quicTunnel->ServerRSDPort();
-    m_isTunnel = true;
-    m_isUsbQuic = true;
-
-    for (const auto& [name, entry] : rsd.GetServices()) {
-        m_rsdServices[name] = entry.port;
+    Error rsdErr = DiscoverRSDServices(BringUpStrategy::UsbQUIC);
+    if (rsdErr != Error::Success) {
+        INST_LOG_WARN(TAG, "TryUsbQUIC: RSD via USB QUIC failed: %s", ErrorToString(rsdErr));
+        m_quicTunnel.reset();
+        m_tunnelAddress.clear();
+        m_tunnelRsdPort = 0;
+        return false;
     }
 
+    m_isTunnel = true;
+    m_isUsbQuic = true;
     INST_LOG_INFO(TAG, "iOS %s USB QUIC tunnel active: %zu services discovered",
                  m_iosVersion.c_str(), m_rsdServices.size());
+    return true;
 #else
-    INST_LOG_WARN(TAG, "TryUsbQUIC: INSTRUMENTS_HAS_QUIC not enabled — "
-                 "cannot use USB CoreDevice tunnel (CDTunnel or QUIC). "
-                 "Use an external CoreDevice tunnel instead.");
+    return false;
 #endif
 }
 
-void DeviceConnection::TryNetworkRSD() {
+bool DeviceConnection::TryNetworkRSD() {
     // iOS 18+/26+: Apple's usbmuxd (from iTunes / Apple Devices app) registers
     // iOS 18+ USB-connected devices with their USB-NCM IPv6 link-local address.
     // idevice_new_with_options(..., PREFER_NETWORK) returns a NETWORK-type idevice_t,
     // and idevice_connect() on that device uses direct TCP — bypassing the usbmuxd
     // port-forwarding that returns CONNREFUSED for port 58783 on iOS 18+.
-    if (!m_device) return;
+    if (!m_device) return false;
 
     char* udidStr = nullptr;
     if (idevice_get_udid(m_device, &udidStr) != IDEVICE_E_SUCCESS || !udidStr) {
         INST_LOG_DEBUG(TAG, "TryNetworkRSD: idevice_get_udid failed");
-        return;
+        return false;
     }
 
     idevice_t netDevice = nullptr;
@@ -552,79 +750,82 @@ void DeviceConnection::TryNetworkRSD() {
     if (ierr != IDEVICE_E_SUCCESS || !netDevice) {
         INST_LOG_DEBUG(TAG, "TryNetworkRSD: no network device found for this UDID via usbmuxd "
                       "(usbmuxd may not expose USB-NCM IPv6 for iOS 18+ on this system)");
-        return;
+        return false;
     }
 
-    RSDProvider rsd;
-    Error err = rsd.ConnectViaIDevice(netDevice);
+    m_networkDevice = netDevice;
+    Error err = DiscoverRSDServices(BringUpStrategy::NetworkRSD);
     if (err != Error::Success) {
-        idevice_free(netDevice);
+        idevice_free(m_networkDevice);
+        m_networkDevice = nullptr;
         INST_LOG_DEBUG(TAG, "TryNetworkRSD: RSD via network device failed: %s", ErrorToString(err));
-        return;
+        return false;
     }
 
-    m_networkDevice = netDevice;
     m_isUsbRsd = true;
     m_isTunnel = true;
-    for (const auto& [name, entry] : rsd.GetServices()) {
-        m_rsdServices[name] = entry.port;
-    }
     INST_LOG_INFO(TAG, "iOS 18+ USB-NCM network RSD: %zu services discovered",
                  m_rsdServices.size());
+    return true;
 }
 
-void DeviceConnection::TryDirectNCMConnection() {
+bool DeviceConnection::TryDirectNCMConnection() {
     // iOS 18+/26+: find device's link-local IPv6 on USB-NCM adapter, connect via TCP.
     // Works without admin — uses host OS network adapter APIs (no libusb).
-    if (m_protocol != IOSProtocol::RSD) return;
+    if (m_protocol != IOSProtocol::RSD) return false;
 
     INST_LOG_INFO(TAG, "iOS %s: trying direct USB-NCM IPv6 discovery...", m_iosVersion.c_str());
 
     auto candidates = DiscoverAppleNCMCandidates();
     if (candidates.empty()) {
         INST_LOG_DEBUG(TAG, "TryDirectNCMConnection: no Apple USB-NCM adapters or neighbors found");
-        return;
+        return false;
     }
 
     for (auto& c : candidates) {
         INST_LOG_DEBUG(TAG, "TryDirectNCMConnection: trying [%s]:58783 (scope=%u)",
                       c.ipv6.c_str(), c.scopeId);
 
+        // Answering on the RSD port identifies the device even when the
+        // service map itself comes from the cache
         int fd = ConnectIPv6WithTimeout(c.ipv6, c.scopeId, 58783, 500);
         if (fd < 0) {
             INST_LOG_DEBUG(TAG, "TryDirectNCMConnection: connect to [%s]:58783 failed",
                           c.ipv6.c_str());
             continue;
         }
+        CloseSocketFd(fd);
 
-        RSDProvider rsd;
-        Error err = rsd.ConnectViaFd(fd);
-#ifdef _WIN32
-        closesocket(static_cast<SOCKET>(fd));
-#else
-        ::close(fd);
-#endif
-        if (err != Error::Success || rsd.GetServices().empty()) {
+        m_ncmAddress = c.ipv6;
+        m_ncmScopeId = c.scopeId;
+        Error err = DiscoverRSDServices(BringUpStrategy::DirectNCM);
+        if (err != Error::Success) {
             INST_LOG_DEBUG(TAG, "TryDirectNCMConnection: RSD at [%s] failed: %s",
                           c.ipv6.c_str(), ErrorToString(err));
             continue;
         }
 
         INST_LOG_INFO(TAG, "iOS %s direct USB-NCM: %zu services at [%s]",
-                     m_iosVersion.c_str(), rsd.GetServices().size(), c.ipv6.c_str());
-        m_ncmAddress  = c.ipv6;
-        m_ncmScopeId  = c.scopeId;
+                     m_iosVersion.c_str(), m_rsdServices.size(), c.ipv6.c_str());
         m_isDirectNCM = true;
         m_isTunnel    = true;
-        for (const auto& [name, entry] : rsd.GetServices()) {
-            m_rsdServices[name] = entry.port;
-        }
-        return;
+        return true;
     }
+    m_ncmAddress.clear();
+    m_ncmScopeId = 0;
     INST_LOG_DEBUG(TAG, "TryDirectNCMConnection: no device responded on port 58783");
+    return false;
 }
 
 DeviceConnection::~DeviceConnection() {
+    // Pooled connections and bring-up probes use the device handles freed below
+    m_instrumentPool.reset();
+    if (m_appService) m_appService->Close();
+    m_appService.reset();
+    for (auto& thread : m_bringUpThreads) {
+        if (thread.joinable()) thread.join();
+    }
+
     if (m_lockdown && m_ownsLockdown) {
         lockdownd_client_free(m_lockdown);
         m_lockdown = nullptr;
@@ -640,6 +841,8 @@ DeviceConnection::~DeviceConnection() {
 }
 
 std::shared_ptr<DeviceConnection> DeviceConnection::FromUDID(const std::string& udid) {
+    TraceDeviceScope traceScope(trace::Enabled() ? udid : std::string());
+    TraceSpan span("connect", "FromUDID");
     auto conn = std::shared_ptr<DeviceConnection>(new DeviceConnection());
 
     idevice_error_t err = idevice_new_with_options(
@@ -655,7 +858,8 @@ std::shared_ptr<DeviceConnection> DeviceConnection::FromUDID(const std::string&
     conn->m_ownsDevice = true;
     conn->m_iosVersion = ServiceConnector::GetIOSVersion(conn->m_device);
     conn->m_protocol = ServiceConnector::DetectProtocol(conn->m_device);
-    conn->TryUsbRSD();
+    span.SetDetail(conn->m_iosVersion);
+    conn->BringUpRSD();
 
     INST_LOG_INFO(TAG, "Connected to %s (iOS %s, protocol=%d, usbRsd=%d)",
                  udid.c_str(), conn->m_iosVersion.c_str(),
@@ -667,12 +871,15 @@ std::shared_ptr<DeviceConnection> DeviceConnection::FromUDID(const std::string&
 std::shared_ptr<DeviceConnection> DeviceConnection::FromDevice(idevice_t device) {
     if (!device) return nullptr;
 
+    TraceDeviceScope traceScope(TraceDevice(device, {}));
+    TraceSpan span("connect", "FromDevice");
     auto conn = std::shared_ptr<DeviceConnection>(new DeviceConnection());
     conn->m_device = device;
     conn->m_ownsDevice = false;
     conn->m_iosVersion = ServiceConnector::GetIOSVersion(device);
     conn->m_protocol = ServiceConnector::DetectProtocol(device);
-    conn->TryUsbRSD();
+    span.SetDetail(conn->m_iosVersion);
+    conn->BringUpRSD();
 
     INST_LOG_INFO(TAG, "Using existing device (iOS %s, protocol=%d, usbRsd=%d)",
                  conn->m_iosVersion.c_str(), static_cast<int>(conn->m_protocol),
@@ -684,6 +891,8 @@ std::shared_ptr<DeviceConnection> DeviceConnection::FromDevice(idevice_t device)
 std::shared_ptr<DeviceConnection> DeviceConnection::FromDevice(idevice_t device, lockdownd_client_t lockdown) {
     if (!device) return nullptr;
 
+    TraceDeviceScope traceScope(TraceDevice(device, {}));
+    TraceSpan span("connect", "FromDevice");
     auto conn = std::shared_ptr<DeviceConnection>(new DeviceConnection());
     conn->m_device = device;
     conn->m_ownsDevice = false;
@@ -691,7 +900,8 @@ std::shared_ptr<DeviceConnection> DeviceConnection::FromDevice(idevice_t device,
     conn->m_ownsLockdown = false;
     conn->m_iosVersion = ServiceConnector::GetIOSVersion(device, lockdown);
     conn->m_protocol = ServiceConnector::DetectProtocol(device, lockdown);
-    conn->TryUsbRSD();
+    span.SetDetail(conn->m_iosVersion);
+    conn->BringUpRSD();
 
     INST_LOG_INFO(TAG, "Using existing device with lockdown (iOS %s, protocol=%d, usbRsd=%d)",
                  conn->m_iosVersion.c_str(), static_cast<int>(conn->m_protocol),
@@ -708,6 +918,8 @@ std::shared_ptr<DeviceConnection> DeviceConnection::FromTunnel(
         return nullptr;
     }
 
+    TraceDeviceScope traceScope(TraceDevice(nullptr, address));
+    TraceSpan span("connect", "FromTunnel", iosVersion);
     auto conn = std::shared_ptr<DeviceConnection>(new DeviceConnection());
     conn->m_tunnelAddress = address;
     conn->m_tunnelRsdPort = rsdPort;
@@ -792,7 +1004,180 @@ DeviceInfo DeviceConnection::GetDeviceInfo() {
     return m_deviceInfo;
 }
 
+Error DeviceConnection::ConnectDTX(DTXConnection& conn, const std::string& service) {
+    if (m_reactor) {
+        conn.SetReactor(m_reactor);
+    }
+    conn.SetCompressionThreshold(m_compressionThreshold);
+    conn.SetMemoryBudget(m_memoryBudget);
+    conn.SetTimeoutPolicy(m_timeoutPolicy);
+
+    std::string capturePath;
+    {
+        std::lock_guard<std::mutex> lock(m_captureMutex);
+        if (!m_captureDir.empty()) {
+            char prefix[16];
+            std::snprintf(prefix, sizeof(prefix), "%04u-", m_captureCount++);
+            capturePath = (std::filesystem::path(m_captureDir) /
+                           (prefix + service + ".dtxcap")).string();
+        }
+    }
+    if (!capturePath.empty()) {
+        DTXCaptureInfo info;
+        info.protocol = m_protocol;
+        info.iosVersion = m_iosVersion;
+        info.service = service;
+        conn.SetCapture(DTXCaptureWriter::Open(capturePath, info));
+    }
+    return conn.Connect();
+}
+
+void DeviceConnection::SetCaptureDirectory(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(m_captureMutex);
+    m_captureDir = dir;
+}
+
+std::shared_ptr<DeviceConnection> DeviceConnection::FromCapture(const std::string& dir, double speed) {
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().extension() == ".dtxcap") paths.push_back(entry.path().string());
+    }
+    // File names start with the recording sequence number
+    std::sort(paths.begin(), paths.end());
+
+    auto conn = std::shared_ptr<DeviceConnection>(new DeviceConnection());
+    for (const auto& path : paths) {
+        DTXCaptureInfo info;
+        if (!DTXCapture::ReadInfo(path, info)) continue;
+        if (conn->m_replayQueue.empty()) {
+            conn->m_protocol = info.protocol;
+            conn->m_iosVersion = info.iosVersion;
+        }
+        conn->m_replayQueue.emplace_back(info.service, path);
+    }
+    if (conn->m_replayQueue.empty()) {
+        INST_LOG_ERROR(TAG, "No DTX captures in %s", dir.c_str());
+        return nullptr;
+    }
+    conn->m_isReplay = true;
+    conn->m_replaySpeed = speed;
+    INST_LOG_INFO(TAG, "Replaying %zu captures from %s (iOS %s)",
+                  conn->m_replayQueue.size(), dir.c_str(), conn->m_iosVersion.c_str());
+    return conn;
+}
+
+std::unique_ptr<DTXConnection> DeviceConnection::ReplayConnection(const std::string& service) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(m_captureMutex);
+        auto it = std::find_if(m_replayQueue.begin(), m_replayQueue.end(),
+            [&](const auto& entry) { return entry.first == service; });
+        if (it == m_replayQueue.end()) {
+            INST_LOG_ERROR(TAG, "No capture of %s left to replay", service.c_str());
+            return nullptr;
+        }
+        path = it->second;
+        m_replayQueue.erase(it);
+    }
+
+    auto capture = std::make_shared<DTXCapture>();
+    if (!DTXCapture::Load(path, *capture)) return nullptr;
+    DTXReplayOptions options;
+    options.speed = m_replaySpeed;
+    auto conn = DTXConnection::CreateFromReplay(std::make_shared<DTXReplay>(std::move(capture), options));
+    if (!conn || ConnectDTX(*conn, service) != Error::Success) return nullptr;
+    return conn;
+}
+
+std::shared_ptr<DTXConnection> DeviceConnection::SharedInstrumentConnection() {
+    InstrumentConnectionPool* pool = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_instrumentPoolMutex);
+        if (!m_instrumentPool) {
+            m_instrumentPool = std::make_unique<InstrumentConnectionPool>(
+                [this]() { return CreateInstrumentConnection(); }, m_instrumentPoolConfig);
+        }
+        pool = m_instrumentPool.get();
+    }
+    return pool->Acquire();
+}
+
+std::shared_ptr<AppServiceClient> DeviceConnection::SharedAppServiceClient() {
+    if (!IsRSD()) return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_appServiceMutex);
+    if (m_appService && m_appService->IsConnected()) return m_appService;
+    if (m_appService) {
+        INST_LOG_INFO(TAG, "AppService connection dropped, reconnecting");
+        m_appService->Close();
+        m_appService.reset();
+    }
+    // A failed connect is not retried on every request
+    if (std::chrono::steady_clock::now() < m_appServiceRetryAt) return nullptr;
+    m_appServiceRetryAt = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+    std::shared_ptr<AppServiceClient> client;
+    ConnectRSDService(AppServiceClient::ServiceName, [&]() {
+        auto it = m_rsdServices.find(AppServiceClient::ServiceName);
+        if (it == m_rsdServices.end()) {
+            INST_LOG_DEBUG(TAG, "%s not in the RSD service map", AppServiceClient::ServiceName);
+            return false;
+        }
+        const uint16_t port = it->second;
+
+        XPCPipe pipe;
+        if (!ConnectDevicePort(port, pipe)) {
+            INST_LOG_WARN(TAG, "Could not connect to %s (port %u)", AppServiceClient::ServiceName, port);
+            return false;
+        }
+        auto candidate = std::make_shared<AppServiceClient>(std::move(pipe));
+        Error err = candidate->Start();
+        if (err != Error::Success) {
+            INST_LOG_WARN(TAG, "%s setup failed: %s", AppServiceClient::ServiceName, ErrorToString(err));
+            return false;
+        }
+        client = std::move(candidate);
+        return true;
+    });
+    if (!client) return nullptr;
+    m_appService = client;
+    m_appServiceRetryAt = {};
+    return client;
+}
+
+void DeviceConnection::SetInstrumentPool(const InstrumentPoolConfig& config) {
+    std::lock_guard<std::mutex> lock(m_instrumentPoolMutex);
+    m_instrumentPoolConfig = config;
+    if (m_instrumentPool) m_instrumentPool->Configure(config);
+}
+
+InstrumentPoolStats DeviceConnection::GetInstrumentPoolStats() const {
+    std::lock_guard<std::mutex> lock(m_instrumentPoolMutex);
+    return m_instrumentPool ? m_instrumentPool->Stats() : InstrumentPoolStats{};
+}
+
 std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
+    if (m_isReplay) return ReplayConnection("instruments");
+
+    TraceDeviceScope traceScope(TraceDevice(m_device, m_tunnelAddress));
+    TraceSpan span("service", "CreateInstrumentConnection");
+
+    std::unique_ptr<DTXConnection> conn;
+    ConnectRSDService("Instruments service", [&]() {
+        conn = ConnectInstrumentService();
+        return conn != nullptr;
+    });
+    return conn;
+}
+
+bool DeviceConnection::ConnectRSDService(const char* service, const std::function<bool()>& connect) {
+    std::lock_guard<std::mutex> lock(m_rsdMutex);
+    return ConnectWithRSDRefresh(service, m_rsdFromCache, connect,
+                                 [this]() { return RefreshRSDServices(); });
+}
+
+std::unique_ptr<DTXConnection> DeviceConnection::ConnectInstrumentService() {
     // iOS 18+ USB QUIC tunnel path
     if (m_isTunnel && m_isUsbQuic && m_quicTunnel) {
 #ifdef INSTRUMENTS_HAS_QUIC
@@ -809,19 +1194,24 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
         INST_LOG_INFO(TAG, "CreateInstrumentConnection (USB QUIC): using service '%s' at [%s]:%u",
                      resolvedServiceName.c_str(), m_tunnelAddress.c_str(), servicePort);
 
-        int fd = qt->CreateTunnelSocket(m_tunnelAddress, servicePort);
-        if (fd < 0) {
-            INST_LOG_ERROR(TAG, "CreateInstrumentConnection (USB QUIC): CreateTunnelSocket failed");
-            return nullptr;
+        // In-process stream first; the socket pair bridge is the fallback
+        std::unique_ptr<DTXConnection> conn;
+        if (auto stream = qt->CreateTunnelStream(m_tunnelAddress, servicePort)) {
+            conn = DTXConnection::CreateFromStream(std::move(stream));
+        } else {
+            int fd = qt->CreateTunnelSocket(m_tunnelAddress, servicePort);
+            if (fd < 0) {
+                INST_LOG_ERROR(TAG, "CreateInstrumentConnection (USB QUIC): CreateTunnelSocket failed");
+                return nullptr;
+            }
+            conn = DTXConnection::CreateFromFd(fd);
         }
-
-        auto conn = DTXConnection::CreateFromFd(fd);
         if (!conn) {
             INST_LOG_ERROR(TAG, "CreateInstrumentConnection (USB QUIC): failed to create DTX connection");
             return nullptr;
         }
 
-        Error connectErr = conn->Connect();
+        Error connectErr = ConnectDTX(*conn);
         if (connectErr != Error::Success) {
             INST_LOG_ERROR(TAG, "CreateInstrumentConnection (USB QUIC): DTX handshake failed: %s",
                           ErrorToString(connectErr));
@@ -861,7 +1251,7 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
             INST_LOG_ERROR(TAG, "CreateInstrumentConnection (direct NCM): CreateFromFd failed");
             return nullptr;
         }
-        Error connectErr = conn->Connect();
+        Error connectErr = ConnectDTX(*conn);
         if (connectErr != Error::Success) {
             INST_LOG_ERROR(TAG, "CreateInstrumentConnection (direct NCM): DTX handshake failed: %s",
                           ErrorToString(connectErr));
@@ -903,7 +1293,7 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
             return nullptr;
         }
 
-        Error connectErr = dtx->Connect();
+        Error connectErr = ConnectDTX(*dtx);
         if (connectErr != Error::Success) {
             INST_LOG_ERROR(TAG, "CreateInstrumentConnection (USB RSD): DTX handshake failed: %s",
                           ErrorToString(connectErr));
@@ -932,7 +1322,7 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
             return nullptr;
         }
 
-        Error connectErr = conn->Connect();
+        Error connectErr = ConnectDTX(*conn);
         if (connectErr != Error::Success) {
             INST_LOG_ERROR(TAG, "CreateInstrumentConnection (tunnel): DTX handshake failed: %s",
                           ErrorToString(connectErr));
@@ -980,7 +1370,7 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
         return nullptr;
     }
 
-    Error connectErr = conn->Connect();
+    Error connectErr = ConnectDTX(*conn);
     if (connectErr != Error::Success) {
         INST_LOG_ERROR(TAG, "Failed to connect DTX: %s", ErrorToString(connectErr));
         return nullptr;
@@ -990,6 +1380,10 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateInstrumentConnection() {
 }
 
 std::unique_ptr<DTXConnection> DeviceConnection::CreateServiceConnection(const std::string& serviceName) {
+    if (m_isReplay) return ReplayConnection(serviceName);
+
+    TraceDeviceScope traceScope(TraceDevice(m_device, m_tunnelAddress));
+    TraceSpan span("service", "CreateServiceConnection", serviceName);
     lockdownd_service_descriptor_t service = nullptr;
     Error err = ServiceConnector::StartService(m_device, serviceName, &service, m_lockdown);
     if (err != Error::Success || !service) {
@@ -1002,7 +1396,7 @@ std::unique_ptr<DTXConnection> DeviceConnection::CreateServiceConnection(const s
 
     if (!conn) return nullptr;
 
-    Error connectErr = conn->Connect();
+    Error connectErr = ConnectDTX(*conn, serviceName);
     if (connectErr != Error::Success) return nullptr;
 
     return conn;
@@ -1013,4 +1407,59 @@ Error DeviceConnection::StartService(const std::string& serviceId,
     return ServiceConnector::StartService(m_device, serviceId, outService, m_lockdown);
 }
 
+bool DeviceConnection::HasTunnelRoute() const {
+    // USB RSD goes through idevice_connect() like the other usbmuxd paths
+    if (m_isUsbQuic && m_quicTunnel) return true;
+    if (m_isDirectNCM) return true;
+    return m_isTunnel && !m_isUsbRsd && !m_tunnelAddress.empty();
+}
+
+int DeviceConnection::ConnectTunnelPort(uint16_t port) {
+    if (m_isUsbQuic && m_quicTunnel) {
+        auto* qt = static_cast<QUICTunnel*>(m_quicTunnel.get());
+        return qt->CreateTunnelSocket(m_tunnelAddress, port);
+    }
+    if (m_isDirectNCM) {
+        return ConnectIPv6WithTimeout(m_ncmAddress, m_ncmScopeId, port, 3000);
+    }
+    if (m_isTunnel && !m_isUsbRsd && !m_tunnelAddress.empty()) {
+        // External tunnel: the OS routes the device's tunnel IPv6 address
+        return ConnectIPv6WithTimeout(m_tunnelAddress, 0, port, 3000);
+    }
+    return -1;
+}
+
+bool DeviceConnection::ConnectDevicePort(uint16_t port, XPCPipe& outPipe) {
+    outPipe = XPCPipe{};
+#ifdef INSTRUMENTS_HAS_QUIC
+    if (m_isUsbQuic && m_quicTunnel) {
+        auto* qt = static_cast<QUICTunnel*>(m_quicTunnel.get());
+        auto stream = qt->CreateTunnelStream(m_tunnelAddress, port);
+        if (!stream) return false;
+        outPipe = XPCPipe::FromStream(std::move(stream), true);
+        return true;
+    }
+#endif
+    if (HasTunnelRoute()) {
+        const int fd = ConnectTunnelPort(port);
+        if (fd < 0) return false;
+        outPipe = XPCPipe::FromSocket(fd, true);
+        return true;
+    }
+
+    idevice_t connDevice = m_networkDevice ? m_networkDevice : m_device;
+    idevice_connection_t conn = nullptr;
+    if (!connDevice || idevice_connect(connDevice, port, &conn) != IDEVICE_E_SUCCESS || !conn) {
+        return false;
+    }
+    outPipe = XPCPipe::FromIDevice(conn, true);
+    return true;
+}
+
+Error DeviceConnection::BridgeTunnelPort(int socketFd, uint16_t port) {
+    if (!m_isUsbQuic || !m_quicTunnel) return Error::NotSupported;
+    auto* qt = static_cast<QUICTunnel*>(m_quicTunnel.get());
+    return qt->BridgeSocket(socketFd, m_tunnelAddress, port) ? Error::Success : Error::ConnectionFailed;
+}
+
 } // namespace instruments
@@ -52,7 +52,7 @@ std::vector<uint8_t> Http2Framer::EncodeFrame(const H2Frame& frame) {
     return result;
 }
 
-size_t Http2Framer::DecodeFrame(const uint8_t* data, size_t length, H2Frame& outFrame) {
+size_t Http2Framer::DecodeFrame(const uint8_t* data, size_t length, H2FrameView& outFrame) {
     if (length < 9) return 0; // Not enough for frame header
 
     uint32_t payloadLen = ReadUint24(data);
@@ -63,9 +63,8 @@ size_t Http2Framer::DecodeFrame(const uint8_t* data, size_t length, H2Frame& out
     outFrame.type = data[3];
     outFrame.flags = data[4];
     outFrame.streamId = ReadUint32(data + 5) & 0x7FFFFFFF;
-
-    outFrame.payload.clear();
-    const uint8_t* payloadStart = data + 9;
+    outFrame.payload = data + 9;
+    outFrame.payloadSize = payloadLen;
 
     // Normalize frame payload by stripping optional HTTP/2 padding fields so
     // upper layers (RemoteXPC) always see raw message bytes.
@@ -74,101 +73,149 @@ size_t Http2Framer::DecodeFrame(const uint8_t* data, size_t length, H2Frame& out
         if (payloadLen < 1) {
             return 0;
         }
-        uint8_t padLen = payloadStart[0];
+        uint8_t padLen = outFrame.payload[0];
         if (static_cast<uint32_t>(padLen) + 1 > payloadLen) {
             return 0;
         }
-        const uint32_t contentLen = payloadLen - 1 - static_cast<uint32_t>(padLen);
-        outFrame.payload.assign(payloadStart + 1, payloadStart + 1 + contentLen);
-    } else if (payloadLen > 0) {
-        outFrame.payload.assign(payloadStart, payloadStart + payloadLen);
+        outFrame.payload += 1;
+        outFrame.payloadSize = payloadLen - 1 - static_cast<uint32_t>(padLen);
     }
 
     return totalLen;
 }
 
-std::vector<uint8_t> Http2Framer::MakeConnectionPreface() {
-    // Client magic + initial SETTINGS frame
-    std::vector<uint8_t> preface;
-    preface.insert(preface.end(), ClientMagic, ClientMagic + ClientMagicLen);
-
-    auto settings = MakeSettingsFrame(false);
-    preface.insert(preface.end(), settings.begin(), settings.end());
+size_t Http2Framer::DecodeFrame(const uint8_t* data, size_t length, H2Frame& outFrame) {
+    H2FrameView view;
+    const size_t consumed = DecodeFrame(data, length, view);
+    if (consumed == 0) return 0;
+
+    outFrame.type = view.type;
+    outFrame.flags = view.flags;
+    outFrame.streamId = view.streamId;
+    outFrame.payload.assign(view.payload, view.payload + view.payloadSize);
+    return consumed;
+}
 
-    return preface;
+std::vector<uint8_t> Http2Framer::MakeConnectionPreface() {
+    return std::move(H2FrameWriter().Preface().Buffer());
 }
 
 std::vector<uint8_t> Http2Framer::MakeSettingsFrame(bool ack) {
-    H2Frame frame;
-    frame.type = H2FrameType::Settings;
-    frame.flags = ack ? H2Flags::Ack : 0;
-    frame.streamId = 0;
-
-    if (!ack) {
-        // Send default settings:
-        // SETTINGS_MAX_CONCURRENT_STREAMS (0x3) = 100
-        // SETTINGS_INITIAL_WINDOW_SIZE (0x4) = 1048576
-        // SETTINGS_ENABLE_PUSH (0x2) = 0
-        uint8_t settings[] = {
-            0x00, 0x03, 0x00, 0x00, 0x00, 0x64, // MAX_CONCURRENT_STREAMS = 100
-            0x00, 0x04, 0x00, 0x10, 0x00, 0x00, // INITIAL_WINDOW_SIZE = 1048576
-            0x00, 0x02, 0x00, 0x00, 0x00, 0x00, // ENABLE_PUSH = 0
-        };
-        frame.payload.assign(settings, settings + sizeof(settings));
-    }
-
-    return EncodeFrame(frame);
+    return std::move(H2FrameWriter().Settings(ack).Buffer());
 }
 
 std::vector<uint8_t> Http2Framer::MakeWindowUpdateFrame(uint32_t streamId, uint32_t increment) {
-    H2Frame frame;
-    frame.type = H2FrameType::WindowUpdate;
-    frame.streamId = streamId;
-    frame.payload.resize(4);
-    WriteUint32(frame.payload.data(), increment & 0x7FFFFFFF);
-    return EncodeFrame(frame);
+    return std::move(H2FrameWriter().WindowUpdate(streamId, increment).Buffer());
 }
 
 std::vector<uint8_t> Http2Framer::MakeDataFrame(uint32_t streamId,
                                                   const uint8_t* data, size_t length,
                                                   bool endStream) {
-    H2Frame frame;
-    frame.type = H2FrameType::Data;
-    frame.flags = endStream ? H2Flags::EndStream : 0;
-    frame.streamId = streamId;
-    if (data && length > 0) {
-        frame.payload.assign(data, data + length);
-    }
-    return EncodeFrame(frame);
+    return std::move(H2FrameWriter().Data(streamId, data, length, endStream).Buffer());
 }
 
 std::vector<uint8_t> Http2Framer::MakeHeadersFrame(uint32_t streamId,
                                                      const std::vector<std::pair<std::string, std::string>>& headers,
                                                      bool endStream) {
+    return std::move(H2FrameWriter().Headers(streamId, headers, endStream).Buffer());
+}
+
+// --- H2FrameWriter ---
+
+uint8_t* H2FrameWriter::Append(uint8_t type, uint8_t flags, uint32_t streamId,
+                               size_t payloadLength) {
+    const size_t offset = m_buffer.size();
+    m_buffer.resize(offset + 9 + payloadLength);
+    uint8_t* header = m_buffer.data() + offset;
+
+    // Length (24 bits), type, flags, stream ID (31 bits, R bit always 0)
+    WriteUint24(header, static_cast<uint32_t>(payloadLength));
+    header[3] = type;
+    header[4] = flags;
+    WriteUint32(header + 5, streamId & 0x7FFFFFFF);
+    return header + 9;
+}
+
+H2FrameWriter& H2FrameWriter::Preface() {
+    // Client magic + initial SETTINGS frame
+    m_buffer.insert(m_buffer.end(), Http2Framer::ClientMagic,
+                    Http2Framer::ClientMagic + Http2Framer::ClientMagicLen);
+    return Settings(false);
+}
+
+H2FrameWriter& H2FrameWriter::Settings(bool ack) {
+    if (ack) {
+        Append(H2FrameType::Settings, H2Flags::Ack, 0, 0);
+        return *this;
+    }
+
+    // Send default settings:
+    // SETTINGS_MAX_CONCURRENT_STREAMS (0x3) = 100
+    // SETTINGS_INITIAL_WINDOW_SIZE (0x4) = 1048576
+    // SETTINGS_ENABLE_PUSH (0x2) = 0
+    static const uint8_t settings[] = {
+        0x00, 0x03, 0x00, 0x00, 0x00, 0x64, // MAX_CONCURRENT_STREAMS = 100
+        0x00, 0x04, 0x00, 0x10, 0x00, 0x00, // INITIAL_WINDOW_SIZE = 1048576
+        0x00, 0x02, 0x00, 0x00, 0x00, 0x00, // ENABLE_PUSH = 0
+    };
+    std::memcpy(Append(H2FrameType::Settings, 0, 0, sizeof(settings)), settings, sizeof(settings));
+    return *this;
+}
+
+H2FrameWriter& H2FrameWriter::WindowUpdate(uint32_t streamId, uint32_t increment) {
+    WriteUint32(Append(H2FrameType::WindowUpdate, 0, streamId, 4), increment & 0x7FFFFFFF);
+    return *this;
+}
+
+H2FrameWriter& H2FrameWriter::Data(uint32_t streamId, const uint8_t* data, size_t length,
+                                   bool endStream) {
+    if (!data) length = 0;
+    uint8_t* payload = Append(H2FrameType::Data, endStream ? H2Flags::EndStream : 0,
+                              streamId, length);
+    if (length > 0) std::memcpy(payload, data, length);
+    return *this;
+}
+
+size_t H2FrameWriter::BeginData(uint32_t streamId, bool endStream) {
+    const size_t frameStart = m_buffer.size();
+    Append(H2FrameType::Data, endStream ? H2Flags::EndStream : 0, streamId, 0);
+    return frameStart;
+}
+
+void H2FrameWriter::EndFrame(size_t frameStart) {
+    WriteUint24(m_buffer.data() + frameStart,
+                static_cast<uint32_t>(m_buffer.size() - frameStart - 9));
+}
+
+H2FrameWriter& H2FrameWriter::Headers(uint32_t streamId,
+                                      const std::vector<std::pair<std::string, std::string>>& headers,
+                                      bool endStream) {
     // Minimal HPACK encoding - we use literal header field without indexing
     // (RFC 7541 Section 6.2.1): 0000xxxx pattern
     // For RSD, we only need a few simple headers, so no need for Huffman or indexing.
-    std::vector<uint8_t> hpackData;
+    size_t hpackLength = 0;
+    for (const auto& [name, value] : headers) {
+        hpackLength += 3 + name.size() + value.size();
+    }
 
+    uint8_t* out = Append(H2FrameType::Headers,
+                          H2Flags::EndHeaders | (endStream ? H2Flags::EndStream : 0),
+                          streamId, hpackLength);
     for (const auto& [name, value] : headers) {
         // Literal Header Field without Indexing - New Name (0x00)
-        hpackData.push_back(0x00);
+        *out++ = 0x00;
 
         // Name length + name
-        hpackData.push_back(static_cast<uint8_t>(name.size()));
-        hpackData.insert(hpackData.end(), name.begin(), name.end());
+        *out++ = static_cast<uint8_t>(name.size());
+        std::memcpy(out, name.data(), name.size());
+        out += name.size();
 
         // Value length + value
-        hpackData.push_back(static_cast<uint8_t>(value.size()));
-        hpackData.insert(hpackData.end(), value.begin(), value.end());
+        *out++ = static_cast<uint8_t>(value.size());
+        std::memcpy(out, value.data(), value.size());
+        out += value.size();
     }
-
-    H2Frame frame;
-    frame.type = H2FrameType::Headers;
-    frame.flags = H2Flags::EndHeaders | (endStream ? H2Flags::EndStream : 0);
-    frame.streamId = streamId;
-    frame.payload = std::move(hpackData);
-    return EncodeFrame(frame);
+    return *this;
 }
 
 } // namespace instruments
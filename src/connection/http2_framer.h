@@ -2,7 +2,9 @@
 #define INSTRUMENTS_HTTP2_FRAMER_H
 
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace instruments {
@@ -44,6 +46,78 @@ struct H2Frame {
     std::vector<uint8_t> payload;
 };
 
+// A decoded frame whose payload points into the buffer it was decoded
+// from (valid while that buffer is unchanged)
+struct H2FrameView {
+    uint8_t type = 0;
+    uint8_t flags = 0;
+    uint32_t streamId = 0;
+    const uint8_t* payload = nullptr;
+    size_t payloadSize = 0;
+};
+
+// H2FrameWriter - encodes frames back to back into one buffer, so a
+// request (HEADERS + DATA, SETTINGS ACK + WINDOW_UPDATE, ...) goes out in a
+// single send. Payloads are copied once, straight into place.
+class H2FrameWriter {
+public:
+    H2FrameWriter& Preface();
+    H2FrameWriter& Settings(bool ack = false);
+    H2FrameWriter& WindowUpdate(uint32_t streamId, uint32_t increment);
+    H2FrameWriter& Data(uint32_t streamId, const uint8_t* data, size_t length,
+                        bool endStream = false);
+    H2FrameWriter& Headers(uint32_t streamId,
+                           const std::vector<std::pair<std::string, std::string>>& headers,
+                           bool endStream = false);
+
+    // Open a DATA frame whose payload the caller appends to Buffer() (e.g.
+    // XPCMessage::EncodeTo); EndFrame() then fills in its length
+    size_t BeginData(uint32_t streamId, bool endStream = false);
+    void EndFrame(size_t frameStart);
+
+    const std::vector<uint8_t>& Buffer() const { return m_buffer; }
+    std::vector<uint8_t>& Buffer() { return m_buffer; }
+    bool Empty() const { return m_buffer.empty(); }
+    size_t Size() const { return m_buffer.size(); }
+    void Clear() { m_buffer.clear(); }   // keeps the capacity
+
+private:
+    // Append a frame header and return where its payloadLength bytes go
+    uint8_t* Append(uint8_t type, uint8_t flags, uint32_t streamId, size_t payloadLength);
+
+    std::vector<uint8_t> m_buffer;
+};
+
+// Receive buffer parsed in place: reads land in the free tail and frames are
+// decoded where they are (DecodeFrame into an H2FrameView); the unparsed
+// rest moves to the front only when the tail runs short
+struct H2ReceiveBuffer {
+    static constexpr size_t kReadChunk = 16 * 1024;
+
+    std::vector<uint8_t> data = std::vector<uint8_t>(4 * kReadChunk);
+    size_t start = 0;   // first unparsed byte
+    size_t end = 0;     // one past the last received byte
+
+    const uint8_t* Unparsed() const { return data.data() + start; }
+    size_t UnparsedSize() const { return end - start; }
+    void Consume(size_t n) {
+        start += n;
+        if (start == end) start = end = 0;
+    }
+    uint8_t* Tail() {
+        if (data.size() - end < kReadChunk) {
+            if (start > 0) {
+                std::memmove(data.data(), data.data() + start, end - start);
+                end -= start;
+                start = 0;
+            }
+            if (data.size() - end < kReadChunk) data.resize(end + kReadChunk);
+        }
+        return data.data() + end;
+    }
+    size_t TailSize() const { return data.size() - end; }
+};
+
 class Http2Framer {
 public:
     // HTTP/2 connection preface (client magic + SETTINGS)
@@ -52,7 +126,8 @@ public:
     // Encode a frame to wire format
     static std::vector<uint8_t> EncodeFrame(const H2Frame& frame);
 
-    // Encode specific frame types
+    // Encode specific frame types (one frame per buffer; see H2FrameWriter
+    // to put several in one)
     static std::vector<uint8_t> MakeSettingsFrame(bool ack = false);
     static std::vector<uint8_t> MakeWindowUpdateFrame(uint32_t streamId, uint32_t increment);
     static std::vector<uint8_t> MakeDataFrame(uint32_t streamId,
@@ -66,6 +141,9 @@ public:
     // Returns number of bytes consumed, 0 if not enough data.
     static size_t DecodeFrame(const uint8_t* data, size_t length, H2Frame& outFrame);
 
+    // Same without copying: the payload (padding stripped) points into data
+    static size_t DecodeFrame(const uint8_t* data, size_t length, H2FrameView& outFrame);
+
     // Connection preface magic string (24 bytes)
     static constexpr const char* ClientMagic = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
     static constexpr size_t ClientMagicLen = 24;
@@ -0,0 +1,199 @@
+#include "instrument_pool.h"
+#include "../util/log.h"
+#include <algorithm>
+
+namespace instruments {
+
+static const char* TAG = "InstrumentPool";
+
+InstrumentConnectionPool::InstrumentConnectionPool(Factory factory, const InstrumentPoolConfig& config)
+    : m_factory(std::move(factory))
+    , m_state(std::make_shared<State>())
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->config = config;
+    StartReaperLocked();
+}
+
+InstrumentConnectionPool::~InstrumentConnectionPool() {
+    std::vector<std::shared_ptr<Entry>> entries;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->stopping = true;
+        // Leased entries are kept alive by their leases
+        entries.swap(m_state->entries);
+    }
+    m_state->cv.notify_all();
+    if (m_reaper.joinable()) m_reaper.join();
+    // Idle connections disconnect here, outside the lock
+}
+
+std::shared_ptr<DTXConnection> InstrumentConnectionPool::Acquire() {
+    std::lock_guard<std::mutex> acquireLock(m_acquireMutex);
+    State& st = *m_state;
+
+    for (;;) {
+        std::vector<std::shared_ptr<Entry>> expired;   // destroyed outside the lock
+        std::shared_ptr<Entry> entry;
+        int pingTimeoutMs = 0;
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            const auto now = Clock::now();
+            CollectExpiredLocked(st, now, expired);
+
+            // Least-leased connection; open another only if all are busy
+            for (const auto& candidate : st.entries) {
+                if (!entry || candidate->leases < entry->leases) entry = candidate;
+            }
+            const size_t maxConnections = std::max<size_t>(st.config.maxConnections, 1);
+            if (entry && entry->leases > 0 && st.entries.size() < maxConnections) {
+                entry.reset();
+            }
+            if (!entry) break;
+
+            const bool check = entry->leases == 0 &&
+                now - entry->lastChecked >= std::chrono::milliseconds(st.config.healthCheckIntervalMs);
+            entry->leases++;   // keeps the reaper away while we ping
+            if (!check) {
+                st.stats.hits++;
+                return MakeLease(entry);
+            }
+            pingTimeoutMs = st.config.healthCheckTimeoutMs;
+        }
+
+        const bool alive = Ping(*entry, pingTimeoutMs);
+        std::lock_guard<std::mutex> lock(st.mutex);
+        if (alive) {
+            entry->lastChecked = Clock::now();
+            st.stats.hits++;
+            return MakeLease(entry);
+        }
+        INST_LOG_WARN(TAG, "Idle instruments connection failed its health check, dropping it");
+        st.stats.healthCheckFailures++;
+        entry->leases--;
+        st.entries.erase(std::remove(st.entries.begin(), st.entries.end(), entry), st.entries.end());
+        expired.push_back(std::move(entry));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.stats.misses++;
+    }
+    std::shared_ptr<DTXConnection> conn = m_factory();
+    if (!conn) return nullptr;
+
+    auto entry = std::make_shared<Entry>();
+    entry->conn = std::move(conn);
+    entry->leases = 1;
+    entry->lastUsed = entry->lastChecked = Clock::now();
+
+    std::lock_guard<std::mutex> lock(st.mutex);
+    st.entries.push_back(entry);
+    INST_LOG_DEBUG(TAG, "Opened instruments connection (%zu in pool)", st.entries.size());
+    return MakeLease(entry);
+}
+
+void InstrumentConnectionPool::Configure(const InstrumentPoolConfig& config) {
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->config = config;
+        StartReaperLocked();
+    }
+    m_state->cv.notify_all();
+}
+
+InstrumentPoolStats InstrumentConnectionPool::Stats() const {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    InstrumentPoolStats stats = m_state->stats;
+    stats.open = m_state->entries.size();
+    stats.leased = static_cast<size_t>(std::count_if(m_state->entries.begin(), m_state->entries.end(),
+        [](const std::shared_ptr<Entry>& entry) { return entry->leases > 0; }));
+    return stats;
+}
+
+std::shared_ptr<DTXConnection> InstrumentConnectionPool::MakeLease(const std::shared_ptr<Entry>& entry) {
+    // Aliases the pooled connection; the deleter only returns the lease. The
+    // entry (and so the connection) stays alive while any lease exists.
+    std::weak_ptr<State> weakState = m_state;
+    return std::shared_ptr<DTXConnection>(entry->conn.get(),
+        [weakState, entry](DTXConnection*) { Release(weakState, entry); });
+}
+
+void InstrumentConnectionPool::Release(const std::weak_ptr<State>& weakState,
+                                       const std::shared_ptr<Entry>& entry) {
+    auto state = weakState.lock();
+    if (!state) return;
+
+    std::vector<std::shared_ptr<Entry>> expired;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (entry->leases > 0) entry->leases--;
+        entry->lastUsed = Clock::now();
+        // Closes it right away without a keep-alive (or once it dropped)
+        CollectExpiredLocked(*state, entry->lastUsed, expired);
+    }
+    state->cv.notify_all();
+}
+
+bool InstrumentConnectionPool::Ping(Entry& entry, int timeoutMs) {
+    if (!entry.conn->IsConnected()) return false;
+    if (!entry.pingChannel) {
+        // Opening the channel is itself a round trip
+        entry.pingChannel = entry.conn->MakeChannelWithIdentifier(ChannelId::DeviceInfo);
+        return entry.pingChannel != nullptr;
+    }
+    auto reply = entry.pingChannel->SendMessageSync(
+        DTXMessage::CreateWithSelector("machTimeInfo"), timeoutMs);
+    return reply != nullptr;
+}
+
+void InstrumentConnectionPool::CollectExpiredLocked(State& st, Clock::time_point now,
+                                                    std::vector<std::shared_ptr<Entry>>& out) {
+    const auto idleTimeout = std::chrono::milliseconds(st.config.idleTimeoutMs);
+    auto it = std::remove_if(st.entries.begin(), st.entries.end(), [&](const std::shared_ptr<Entry>& entry) {
+        if (!entry->conn->IsConnected()) return true;
+        return entry->leases == 0 && now - entry->lastUsed >= idleTimeout;
+    });
+    for (auto e = it; e != st.entries.end(); ++e) {
+        if ((*e)->conn->IsConnected()) st.stats.idleClosed++;
+        out.push_back(std::move(*e));
+    }
+    st.entries.erase(it, st.entries.end());
+}
+
+void InstrumentConnectionPool::StartReaperLocked() {
+    if (m_state->config.idleTimeoutMs > 0 && !m_reaper.joinable()) {
+        m_reaper = std::thread(&InstrumentConnectionPool::ReapLoop, m_state);
+    }
+}
+
+void InstrumentConnectionPool::ReapLoop(std::shared_ptr<State> state) {
+    State& st = *state;
+    std::unique_lock<std::mutex> lock(st.mutex);
+    while (!st.stopping) {
+        std::vector<std::shared_ptr<Entry>> expired;
+        CollectExpiredLocked(st, Clock::now(), expired);
+        if (!expired.empty()) {
+            INST_LOG_DEBUG(TAG, "Closing %zu idle instruments connection(s)", expired.size());
+            lock.unlock();
+            expired.clear();    // disconnects
+            lock.lock();
+            continue;
+        }
+
+        // Sleep until the next idle connection times out
+        auto next = Clock::time_point::max();
+        for (const auto& entry : st.entries) {
+            if (entry->leases == 0) {
+                next = std::min(next, entry->lastUsed + std::chrono::milliseconds(st.config.idleTimeoutMs));
+            }
+        }
+        if (next == Clock::time_point::max()) {
+            st.cv.wait(lock);
+        } else {
+            st.cv.wait_until(lock, next);
+        }
+    }
+}
+
+} // namespace instruments
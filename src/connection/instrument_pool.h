@@ -0,0 +1,86 @@
+#ifndef INSTRUMENTS_INSTRUMENT_POOL_H
+#define INSTRUMENTS_INSTRUMENT_POOL_H
+
+#include "../../include/instruments/device_connection.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace instruments {
+
+// InstrumentConnectionPool - handshaked instruments DTXConnections of one
+// device, handed out as leases (DeviceConnection::SharedInstrumentConnection()).
+//
+// A lease is a shared_ptr<DTXConnection>; several callers may hold leases
+// on the same connection at once (each on its own channels). A new
+// connection is only created when every pooled one is leased and the pool
+// is below maxConnections. Released connections stay open for
+// idleTimeoutMs (closed by a reaper thread that only exists while a
+// timeout is configured), and a connection that sat idle is pinged before
+// it is reused.
+class InstrumentConnectionPool {
+public:
+    using Factory = std::function<std::unique_ptr<DTXConnection>()>;
+
+    InstrumentConnectionPool(Factory factory, const InstrumentPoolConfig& config);
+    // Closes idle connections; leased ones close when their last lease is released
+    ~InstrumentConnectionPool();
+
+    // Non-copyable
+    InstrumentConnectionPool(const InstrumentConnectionPool&) = delete;
+    InstrumentConnectionPool& operator=(const InstrumentConnectionPool&) = delete;
+
+    // Lease a connection (nullptr if none could be created)
+    std::shared_ptr<DTXConnection> Acquire();
+
+    void Configure(const InstrumentPoolConfig& config);
+    InstrumentPoolStats Stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::shared_ptr<DTXConnection> conn;
+        std::shared_ptr<DTXChannel> pingChannel;    // deviceinfo, opened by the first ping
+        size_t leases = 0;
+        Clock::time_point lastUsed;                 // last lease released
+        Clock::time_point lastChecked;              // last proof of liveness
+    };
+
+    // Shared with leases and the reaper so both may outlive the pool
+    struct State {
+        InstrumentPoolConfig config;
+        InstrumentPoolStats stats;
+        std::vector<std::shared_ptr<Entry>> entries;
+        mutable std::mutex mutex;
+        std::condition_variable cv;     // reaper: entry went idle / config / stopping
+        bool stopping = false;
+    };
+
+    // Hand out a lease on entry (its lease count already taken)
+    std::shared_ptr<DTXConnection> MakeLease(const std::shared_ptr<Entry>& entry);
+    static void Release(const std::weak_ptr<State>& weakState, const std::shared_ptr<Entry>& entry);
+
+    // Idle health check: a machTimeInfo round trip on the deviceinfo channel
+    static bool Ping(Entry& entry, int timeoutMs);
+
+    // Detach entries that are closed or idle past the timeout (mutex held)
+    static void CollectExpiredLocked(State& st, Clock::time_point now,
+                                     std::vector<std::shared_ptr<Entry>>& out);
+    // Start the reaper if an idle timeout is configured (mutex held)
+    void StartReaperLocked();
+    static void ReapLoop(std::shared_ptr<State> state);
+
+    Factory m_factory;
+    std::shared_ptr<State> m_state;
+    std::mutex m_acquireMutex;      // one Acquire() at a time: concurrent first users share a handshake
+    std::thread m_reaper;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_INSTRUMENT_POOL_H
@@ -32,27 +32,61 @@
 #define LWIP_NETIF_API              0
 
 // Memory configuration
+//
+// Two profiles: the default keeps the footprint small; building with
+// INSTRUMENTS_LWIP_HOST_PROFILE (CMake option of the same name) scales the
+// TCP windows and buffers so one connection is not window-limited over a
+// CDTunnel / QUIC tunnel (port-forwarded WDA/MJPEG, bulk DTX transfers).
+// lwIP itself must be compiled with the same profile.
 #define MEM_ALIGNMENT               4
-#define MEM_SIZE                    (64 * 1024)
-#define MEMP_NUM_PBUF               32
-#define MEMP_NUM_TCP_PCB            8
 #define MEMP_NUM_TCP_PCB_LISTEN     2
-#define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_UDP_PCB            4
 #define MEMP_NUM_NETBUF             4
 #define MEMP_NUM_NETCONN            0
 
-// Pbuf configuration
-#define PBUF_POOL_SIZE              24
+// Received packets are custom PBUF_REF pbufs wrapping the tunnel's receive
+// buffers (UserspaceNetwork::InjectRxBuffer), not PBUF_POOL copies
+#define LWIP_SUPPORT_CUSTOM_PBUF    1
 #define PBUF_POOL_BUFSIZE           1536
 
 // TCP configuration (tuned for QUIC tunnel, MTU 1280)
 #define TCP_MSS                     1220
+#define TCP_QUEUE_OOSEQ             1
+#define LWIP_TCP_SACK_OUT           1
+
+#ifdef INSTRUMENTS_LWIP_HOST_PROFILE
+
+// Heap for copied sends (UserspaceTcpConnection::Send) and segment headers
+#define MEM_SIZE                    (8 * 1024 * 1024)
+// PBUF_REF entries: TunnelStream writes reference their data (no copy)
+#define MEMP_NUM_PBUF               2048
+#define MEMP_NUM_TCP_PCB            32
+#define MEMP_NUM_TCP_SEG            2048
+#define PBUF_POOL_SIZE              256
+
+// 512 KB receive window (scale factor 16) and send buffer per connection
+#define LWIP_WND_SCALE              1
+#define TCP_RCV_SCALE               4
+#define TCP_WND                     (512 * 1024)
+#define TCP_SND_BUF                 (512 * 1024)
+#define TCP_SND_QUEUELEN            (4 * TCP_SND_BUF / TCP_MSS)
+// The default (TCP_SND_BUF / 2) exceeds lwIP's 16-bit limit
+#define TCP_SNDLOWAT                (32 * TCP_MSS)
+
+#else
+
+#define MEM_SIZE                    (64 * 1024)
+#define MEMP_NUM_PBUF               64
+#define MEMP_NUM_TCP_PCB            8
+#define MEMP_NUM_TCP_SEG            32
+// Received packets no longer come from the pool
+#define PBUF_POOL_SIZE              24
+
 #define TCP_SND_BUF                 (8 * TCP_MSS)
 #define TCP_SND_QUEUELEN            (4 * TCP_SND_BUF / TCP_MSS)
 #define TCP_WND                     (8 * TCP_MSS)
-#define TCP_QUEUE_OOSEQ             1
-#define LWIP_TCP_SACK_OUT           1
+
+#endif // INSTRUMENTS_LWIP_HOST_PROFILE
 
 // Required by this lwIP layout on some toolchains:
 // avoids ip6_reass_helper size assertion in ip6_frag.c.
@@ -70,10 +104,17 @@
 #define CHECKSUM_GEN_TCP            1
 #define CHECKSUM_GEN_UDP            1
 #define CHECKSUM_GEN_ICMP           0
+#define CHECKSUM_CHECK_ICMP         0
+#ifdef INSTRUMENTS_LWIP_HOST_PROFILE
+// The tunnel (TLS / QUIC) already protects every packet end to end
+#define CHECKSUM_CHECK_IP           0
+#define CHECKSUM_CHECK_TCP          0
+#define CHECKSUM_CHECK_UDP          0
+#else
 #define CHECKSUM_CHECK_IP           1
 #define CHECKSUM_CHECK_TCP          1
 #define CHECKSUM_CHECK_UDP          1
-#define CHECKSUM_CHECK_ICMP         0
+#endif
 
 // Disable features we don't need
 #define LWIP_STATS                  0
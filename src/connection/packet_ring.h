@@ -0,0 +1,71 @@
+#ifndef INSTRUMENTS_PACKET_RING_H
+#define INSTRUMENTS_PACKET_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace instruments {
+
+// PacketRing - fixed-capacity single-producer / single-consumer packet queue.
+//
+// Packets are copied into preallocated slots of slotSize bytes, so the
+// tunnel data plane neither allocates nor locks per packet. One thread may
+// Push() while another Front()/Pop()s; Reset() must not race either.
+// Push() fails when the ring is full (the caller drops the packet and lets
+// TCP retransmit it) or the packet does not fit a slot.
+class PacketRing {
+public:
+    // (Re)allocate slots; discards queued packets
+    void Reset(size_t slots, size_t slotSize) {
+        m_slots = slots;
+        m_slotSize = slotSize;
+        m_storage.assign(slots * slotSize, 0);
+        m_lengths.assign(slots, 0);
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side
+    bool Push(const uint8_t* data, size_t len) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (len > m_slotSize || tail - m_head.load(std::memory_order_acquire) >= m_slots) {
+            return false;
+        }
+        const size_t slot = tail % m_slots;
+        std::memcpy(m_storage.data() + slot * m_slotSize, data, len);
+        m_lengths[slot] = len;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: oldest packet (nullptr when empty), valid until Pop()
+    const uint8_t* Front(size_t& len) const {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return nullptr;
+        const size_t slot = head % m_slots;
+        len = m_lengths[slot];
+        return m_storage.data() + slot * m_slotSize;
+    }
+
+    void Pop() {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool Empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<uint8_t> m_storage;
+    std::vector<size_t> m_lengths;
+    size_t m_slots = 0;
+    size_t m_slotSize = 0;
+    std::atomic<size_t> m_head{0};   // next slot to read (consumer)
+    std::atomic<size_t> m_tail{0};   // next slot to write (producer)
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_PACKET_RING_H
@@ -0,0 +1,137 @@
+#include "rsd_cache.h"
+#include "../util/log.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace instruments {
+
+static const char* TAG = "RSDCache";
+
+// One device interface per line:
+//   <udid> <strategy> <boot session|-> <service>=<port> ...
+static const char* kFileHeader = "# instruments RSD service cache v1";
+
+RSDServiceCache& RSDServiceCache::Instance() {
+    static RSDServiceCache instance;
+    return instance;
+}
+
+void RSDServiceCache::SetPath(const std::string& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_path = path;
+    if (!m_path.empty()) LoadLocked();
+}
+
+bool RSDServiceCache::Lookup(const std::string& udid, BringUpStrategy strategy,
+                             std::map<std::string, uint16_t>& outServices) const {
+    if (udid.empty()) return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find({udid, strategy});
+    if (it == m_entries.end()) return false;
+    outServices = it->second.services;
+    return true;
+}
+
+void RSDServiceCache::Store(const std::string& udid, BringUpStrategy strategy,
+                            const std::string& bootSession,
+                            const std::map<std::string, uint16_t>& services) {
+    if (udid.empty() || services.empty()) return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!bootSession.empty()) {
+        // The device rebooted: maps of its other interfaces are stale as well
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            const bool stale = it->first.first == udid && !it->second.bootSession.empty() &&
+                               it->second.bootSession != bootSession;
+            it = stale ? m_entries.erase(it) : std::next(it);
+        }
+    }
+    m_entries[{udid, strategy}] = Entry{bootSession, services};
+    SaveLocked();
+}
+
+void RSDServiceCache::Invalidate(const std::string& udid, BringUpStrategy strategy) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries.erase({udid, strategy}) > 0) SaveLocked();
+}
+
+bool ConnectWithRSDRefresh(const char* service, bool& fromCache,
+                           const std::function<bool()>& connect,
+                           const std::function<Error()>& refresh) {
+    if (connect()) return true;
+    if (!fromCache) return false;
+
+    // The cached map may predate a reboot or a new tunnel
+    INST_LOG_INFO(TAG, "%s did not answer on a cached RSD port, refreshing service map", service);
+    Error err = refresh();
+    if (err != Error::Success) {
+        INST_LOG_ERROR(TAG, "RSD service discovery failed: %s", ErrorToString(err));
+        return false;
+    }
+    return connect();
+}
+
+void RSDServiceCache::LoadLocked() {
+    std::ifstream in(m_path);
+    if (!in) return;
+
+    size_t loaded = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string udid, bootSession, service;
+        int strategy = 0;
+        if (!(fields >> udid >> strategy >> bootSession)) continue;
+
+        Entry entry;
+        entry.bootSession = bootSession == "-" ? std::string() : bootSession;
+        while (fields >> service) {
+            const size_t eq = service.rfind('=');
+            if (eq == std::string::npos || eq == 0) continue;
+            const unsigned long port = std::strtoul(service.c_str() + eq + 1, nullptr, 10);
+            if (port == 0 || port > 65535ul) continue;
+            entry.services[service.substr(0, eq)] = static_cast<uint16_t>(port);
+        }
+        if (entry.services.empty()) continue;
+        // Entries this process discovered itself are newer
+        m_entries.emplace(Key{udid, static_cast<BringUpStrategy>(strategy)}, std::move(entry));
+        loaded++;
+    }
+    INST_LOG_DEBUG(TAG, "Loaded %zu cached RSD service map(s) from %s", loaded, m_path.c_str());
+}
+
+void RSDServiceCache::SaveLocked() const {
+    if (m_path.empty()) return;
+
+    // Write a sibling file and rename it over the cache, so concurrent
+    // readers never see a partial file
+    const std::string tmpPath = m_path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out) {
+            INST_LOG_WARN(TAG, "Cannot write RSD cache %s", tmpPath.c_str());
+            return;
+        }
+        out << kFileHeader << "\n";
+        for (const auto& [key, entry] : m_entries) {
+            out << key.first << ' ' << static_cast<int>(key.second) << ' '
+                << (entry.bootSession.empty() ? "-" : entry.bootSession);
+            for (const auto& [name, port] : entry.services) {
+                out << ' ' << name << '=' << port;
+            }
+            out << "\n";
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, m_path, ec);
+    if (ec) {
+        INST_LOG_WARN(TAG, "Cannot replace RSD cache %s: %s", m_path.c_str(), ec.message().c_str());
+        std::filesystem::remove(tmpPath, ec);
+    }
+}
+
+} // namespace instruments
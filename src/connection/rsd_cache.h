@@ -0,0 +1,68 @@
+#ifndef INSTRUMENTS_RSD_CACHE_H
+#define INSTRUMENTS_RSD_CACHE_H
+
+#include "../../include/instruments/device_connection.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace instruments {
+
+// RSDServiceCache - process-wide RSD service port maps of iOS 17+ devices,
+// optionally persisted to a file (DeviceConnection::SetRSDCachePath()) so a
+// restarted host skips the RSD handshake too.
+//
+// Keyed by UDID and the bring-up strategy that discovered the map (each
+// reaches a different device interface). Entries record the device's boot
+// session; storing a map from a new boot session drops the device's other
+// entries. A cached map is used optimistically: when a service does not
+// answer on a cached port it is refreshed once (ConnectWithRSDRefresh()).
+class RSDServiceCache {
+public:
+    static RSDServiceCache& Instance();
+
+    // Persist entries to path (loading what it already holds); "" keeps
+    // the cache in memory only
+    void SetPath(const std::string& path);
+
+    // Cached service map for udid reached via strategy
+    bool Lookup(const std::string& udid, BringUpStrategy strategy,
+                std::map<std::string, uint16_t>& outServices) const;
+
+    void Store(const std::string& udid, BringUpStrategy strategy,
+               const std::string& bootSession, const std::map<std::string, uint16_t>& services);
+
+    void Invalidate(const std::string& udid, BringUpStrategy strategy);
+
+private:
+    RSDServiceCache() = default;
+
+    struct Entry {
+        std::string bootSession;
+        std::map<std::string, uint16_t> services;
+    };
+    using Key = std::pair<std::string, BringUpStrategy>;
+
+    // Read / rewrite m_path (mutex held)
+    void LoadLocked();
+    void SaveLocked() const;
+
+    std::map<Key, Entry> m_entries;
+    std::string m_path;
+    mutable std::mutex m_mutex;
+};
+
+// Connect to a service through a port map that may be stale: connect runs
+// once, and if it fails while the map came from the cache (fromCache),
+// refresh drops the entry and handshakes again (clearing fromCache) and
+// connect runs once more. Every connect to an RSD-discovered port goes
+// through this (DeviceConnection::ConnectRSDService()).
+bool ConnectWithRSDRefresh(const char* service, bool& fromCache,
+                           const std::function<bool()>& connect,
+                           const std::function<Error()>& refresh);
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_RSD_CACHE_H
@@ -1,17 +1,16 @@
 #include "rsd_provider.h"
 #include "http2_framer.h"
+#include "tunnel_stream.h"
 #include "../util/log.h"
+#include "../util/trace.h"
 #include <chrono>
 #include <cctype>
 #include <cstdlib>
-#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <deque>
 #include <map>
-#include <mutex>
 #include <set>
-#include <thread>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -40,294 +39,27 @@ RSDProvider::RSDProvider() = default;
 RSDProvider::~RSDProvider() = default;
 
 Error RSDProvider::Connect(const std::string& tunnelAddress, uint16_t rsdPort) {
-    INST_LOG_WARN(TAG, "Direct RSD handshake requires UserspaceNetwork. "
-                 "Use Connect(address, port, network) instead.");
+    INST_LOG_WARN(TAG, "Direct RSD handshake requires a tunnel. "
+                 "Use ConnectViaStream() or ConnectDirect() instead.");
     return Error::NotSupported;
 }
 
-Error RSDProvider::Connect(const std::string& tunnelAddress, uint16_t rsdPort,
-                           UserspaceNetwork* network) {
-    if (!network || !network->IsInitialized()) {
-        INST_LOG_ERROR(TAG, "UserspaceNetwork not initialized");
-        return Error::InvalidArgument;
-    }
-
-    INST_LOG_INFO(TAG, "Connecting to RSD at [%s]:%u", tunnelAddress.c_str(), rsdPort);
-
-    // Step 1: Create TCP connection through the tunnel
-    std::shared_ptr<UserspaceTcpConnection> tcpConn;
-    Error err = network->TcpConnect(tunnelAddress, rsdPort, tcpConn);
-    if (err != Error::Success) {
-        INST_LOG_ERROR(TAG, "Failed to create TCP connection to RSD");
-        return err;
-    }
-
-    // Wait for connection to establish (lwIP TCP handshake)
-    std::mutex connMutex;
-    std::condition_variable connCv;
-    bool connected = false;
-    bool connError = false;
-
-    tcpConn->SetErrorCallback([&](Error) {
-        std::lock_guard<std::mutex> lock(connMutex);
-        connError = true;
-        connCv.notify_one();
-    });
-
-    // Poll the network until connected or timeout
-    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
-    while (!tcpConn->IsConnected() && !connError) {
-        if (std::chrono::steady_clock::now() > deadline) {
-            INST_LOG_ERROR(TAG, "TCP connection to RSD timed out");
-            return Error::Timeout;
-        }
-        network->Poll();
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-
-    if (connError || !tcpConn->IsConnected()) {
-        INST_LOG_ERROR(TAG, "TCP connection to RSD failed");
-        return Error::ConnectionFailed;
-    }
-
-    INST_LOG_INFO(TAG, "TCP connected to RSD");
-    m_tcpConn = tcpConn;
-
-    // Step 2: Accumulate received data
-    std::mutex recvMutex;
-    std::vector<uint8_t> recvBuffer;
-    bool recvDone = false;
-
-    tcpConn->SetRecvCallback([&](const uint8_t* data, size_t length) {
-        std::lock_guard<std::mutex> lock(recvMutex);
-        recvBuffer.insert(recvBuffer.end(), data, data + length);
-    });
-
-    tcpConn->SetErrorCallback([&](Error) {
-        std::lock_guard<std::mutex> lock(recvMutex);
-        recvDone = true;
-    });
-
-    // Step 3: Send HTTP/2 connection preface
-    auto preface = Http2Framer::MakeConnectionPreface();
-    err = tcpConn->Send(preface.data(), preface.size());
-    if (err != Error::Success) {
-        INST_LOG_ERROR(TAG, "Failed to send HTTP/2 preface");
-        return err;
-    }
-
-    // Also send a window update for connection-level flow control
-    auto windowUpdate = Http2Framer::MakeWindowUpdateFrame(0, 1048576);
-    tcpConn->Send(windowUpdate.data(), windowUpdate.size());
-
-    INST_LOG_DEBUG(TAG, "Sent HTTP/2 connection preface");
-
-    // Step 4: Wait for server SETTINGS
-    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+Error RSDProvider::DoRSDHandshake(const XPCPipe& pipe) {
+    TraceSpan span("rsd", "RSD handshake");
+    H2ReceiveBuffer recvBuf;
+    H2FrameWriter replies;   // SETTINGS acks of one read
     bool gotServerSettings = false;
-
-    while (!gotServerSettings && !recvDone) {
-        if (std::chrono::steady_clock::now() > deadline) {
-            INST_LOG_ERROR(TAG, "Timeout waiting for server SETTINGS");
-            return Error::Timeout;
-        }
-
-        network->Poll();
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-        // Try to decode frames
-        std::lock_guard<std::mutex> lock(recvMutex);
-        size_t offset = 0;
-        while (offset < recvBuffer.size()) {
-            H2Frame frame;
-            size_t consumed = Http2Framer::DecodeFrame(
-                recvBuffer.data() + offset, recvBuffer.size() - offset, frame);
-            if (consumed == 0) break;
-            offset += consumed;
-
-            if (frame.type == H2FrameType::Settings && !(frame.flags & H2Flags::Ack)) {
-                INST_LOG_DEBUG(TAG, "Received server SETTINGS");
-                // Send SETTINGS ACK
-                auto ack = Http2Framer::MakeSettingsFrame(true);
-                tcpConn->Send(ack.data(), ack.size());
-                gotServerSettings = true;
-            }
-        }
-        if (offset > 0) {
-            recvBuffer.erase(recvBuffer.begin(), recvBuffer.begin() + offset);
-        }
-    }
-
-    if (!gotServerSettings) {
-        INST_LOG_ERROR(TAG, "Failed to receive server SETTINGS");
-        return Error::ProtocolError;
-    }
-
-    // Step 5: Send XPC InitHandshake on stream 1 (client-initiated bidi)
-    XPCMessage initMsg;
-    initMsg.flags = XPCFlags::AlwaysSet | XPCFlags::InitHandshake;
-    initMsg.messageId = 1;
-
-    auto xpcData = initMsg.Encode();
-
-    // Send as HTTP/2 DATA frame on stream 1
-    // First send empty HEADERS to open the stream
-    auto headers = Http2Framer::MakeHeadersFrame(1, {}, false);
-    tcpConn->Send(headers.data(), headers.size());
-
-    auto dataFrame = Http2Framer::MakeDataFrame(1, xpcData.data(), xpcData.size(), false);
-    err = tcpConn->Send(dataFrame.data(), dataFrame.size());
-    if (err != Error::Success) {
-        INST_LOG_ERROR(TAG, "Failed to send XPC InitHandshake");
-        return err;
-    }
-
-    INST_LOG_DEBUG(TAG, "Sent XPC InitHandshake on stream 1");
-
-    // Step 6: Receive the XPC response (service discovery)
-    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
-    bool gotXPCResponse = false;
-
-    while (!gotXPCResponse && !recvDone) {
-        if (std::chrono::steady_clock::now() > deadline) {
-            INST_LOG_ERROR(TAG, "Timeout waiting for XPC response");
-            return Error::Timeout;
-        }
-
-        network->Poll();
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-        // Try to decode frames
-        std::lock_guard<std::mutex> lock(recvMutex);
-        size_t offset = 0;
-        while (offset < recvBuffer.size()) {
-            H2Frame frame;
-            size_t consumed = Http2Framer::DecodeFrame(
-                recvBuffer.data() + offset, recvBuffer.size() - offset, frame);
-            if (consumed == 0) break;
-            offset += consumed;
-
-            if (frame.type == H2FrameType::Data && !frame.payload.empty()) {
-                // Try to decode as XPC message
-                XPCMessage xpcResp;
-                if (XPCMessage::Decode(frame.payload, xpcResp)) {
-                    INST_LOG_INFO(TAG, "Received XPC response (flags=0x%x msgId=%llu)",
-                                 xpcResp.flags, (unsigned long long)xpcResp.messageId);
-
-                    if (xpcResp.body.IsDict()) {
-                        const size_t oldCount = m_services.size();
-                        ParseServiceResponse(xpcResp.body);
-                        if (m_services.size() > oldCount || !m_services.empty()) {
-                            gotXPCResponse = true;
-                        } else {
-                            INST_LOG_DEBUG(TAG, "RSD: dict response did not include services yet");
-                        }
-                    }
-                }
-            } else if (frame.type == H2FrameType::Settings) {
-                if (!(frame.flags & H2Flags::Ack)) {
-                    auto ack = Http2Framer::MakeSettingsFrame(true);
-                    tcpConn->Send(ack.data(), ack.size());
-                }
-            } else if (frame.type == H2FrameType::WindowUpdate) {
-                // Acknowledge window updates silently
-            }
-        }
-        if (offset > 0) {
-            recvBuffer.erase(recvBuffer.begin(), recvBuffer.begin() + offset);
-        }
-    }
-
-    if (!gotXPCResponse) {
-        INST_LOG_ERROR(TAG, "Failed to receive XPC service discovery response");
-        return Error::ProtocolError;
-    }
-
-    INST_LOG_INFO(TAG, "RSD handshake complete: UDID=%s, %zu services discovered",
-                 m_udid.c_str(), m_services.size());
-
-    return Error::Success;
-}
-
-Error RSDProvider::DoRSDHandshake(
-    std::function<bool(const std::vector<uint8_t>&)> sendFn,
-    std::function<bool(std::vector<uint8_t>&)> recvMoreFn)
-{
-    std::vector<uint8_t> recvBuf;
-    std::map<uint32_t, std::vector<uint8_t>> xpcStreamBuffers;
+    std::map<uint32_t, XPCStreamDecoder> xpcStreams;
     std::map<uint32_t, std::deque<XPCMessage>> pendingXpcByStream;
 
-    auto readU32Le = [](const uint8_t* p) -> uint32_t {
-        return static_cast<uint32_t>(p[0])
-             | (static_cast<uint32_t>(p[1]) << 8)
-             | (static_cast<uint32_t>(p[2]) << 16)
-             | (static_cast<uint32_t>(p[3]) << 24);
-    };
-    auto readU64Le = [](const uint8_t* p) -> uint64_t {
-        uint64_t v = 0;
-        for (int i = 0; i < 8; ++i) {
-            v |= (static_cast<uint64_t>(p[i]) << (8 * i));
-        }
-        return v;
-    };
-
     auto appendDataFrameAndExtractXpc = [&](uint32_t streamId,
-                                            const std::vector<uint8_t>& payload) {
-        constexpr uint32_t kWrapperMagic = 0x29b00b92;
-        constexpr uint64_t kMaxXpcFrameLen = 8ULL * 1024ULL * 1024ULL; // sanity cap
-
-        auto& sb = xpcStreamBuffers[streamId];
-        sb.insert(sb.end(), payload.begin(), payload.end());
-
-        size_t offset = 0;
-        while (sb.size() >= offset + 24) {
-            const uint8_t* p = sb.data() + offset;
-            uint32_t magic = readU32Le(p);
-
-            if (magic != kWrapperMagic) {
-                // Resync: find next potential wrapper header.
-                size_t next = offset + 1;
-                while (next + 4 <= sb.size()) {
-                    if (readU32Le(sb.data() + next) == kWrapperMagic) break;
-                    ++next;
-                }
-                INST_LOG_WARN(TAG, "RSD: XPC stream %u lost sync, dropped %zu byte(s)",
-                              streamId, next - offset);
-                offset = next;
-                continue;
-            }
-
-            uint64_t bodyLen = readU64Le(p + 8);
-            uint64_t totalLen64 = 24 + bodyLen;
-            if (totalLen64 > kMaxXpcFrameLen) {
-                INST_LOG_WARN(TAG, "RSD: XPC frame too large on stream %u (%llu), dropping 1 byte",
-                              streamId, static_cast<unsigned long long>(totalLen64));
-                offset += 1;
-                continue;
-            }
-
-            size_t totalLen = static_cast<size_t>(totalLen64);
-            if (sb.size() - offset < totalLen) {
-                // Partial XPC message, wait for more DATA frames.
-                break;
-            }
-
+                                            const uint8_t* payload, size_t payloadSize) {
+        xpcStreams[streamId].Append(payload, payloadSize, [&](const uint8_t* data, size_t length) {
             XPCMessage xpc;
-            if (XPCMessage::Decode(sb.data() + offset, totalLen, xpc)) {
-                pendingXpcByStream[streamId].push_back(std::move(xpc));
-                offset += totalLen;
-                continue;
-            }
-
-            // Decoder rejected this candidate. Advance one byte and try to resync.
-            INST_LOG_WARN(TAG, "RSD: failed to decode XPC message on stream %u, attempting resync",
-                          streamId);
-            offset += 1;
-        }
-
-        if (offset > 0) {
-            sb.erase(sb.begin(), sb.begin() + offset);
-        }
+            if (!XPCMessage::Decode(data, length, xpc)) return false;
+            pendingXpcByStream[streamId].push_back(std::move(xpc));
+            return true;
+        });
     };
 
     auto popNextXpc = [&](uint32_t streamId, XPCMessage& outMsg) -> bool {
@@ -338,43 +70,60 @@ Error RSDProvider::DoRSDHandshake(
         return true;
     };
 
-    // Step 1: Send HTTP/2 connection preface + window update
-    if (!sendFn(Http2Framer::MakeConnectionPreface())) {
+    // Read once (waiting at most until dl) and handle every complete frame.
+    // Returns false once the connection is closed.
+    auto pump = [&](std::chrono::steady_clock::time_point dl) -> bool {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            dl - std::chrono::steady_clock::now()).count();
+        uint8_t* tail = recvBuf.Tail();
+        const int n = pipe.read(tail, recvBuf.TailSize(), remaining > 0 ? static_cast<int>(remaining) : 0);
+        if (n < 0) return false;
+        recvBuf.end += static_cast<size_t>(n);
+
+        // Frames are handled where they lie; replies go out in one send
+        // after the whole read is parsed
+        replies.Clear();
+        while (recvBuf.UnparsedSize() > 0) {
+            H2FrameView frame;
+            size_t consumed = Http2Framer::DecodeFrame(recvBuf.Unparsed(),
+                                                        recvBuf.UnparsedSize(), frame);
+            if (consumed == 0) break;
+
+            if (frame.type == H2FrameType::Settings && !(frame.flags & H2Flags::Ack)) {
+                replies.Settings(true);
+                gotServerSettings = true;
+            } else if (frame.type == H2FrameType::Data && frame.payloadSize > 0) {
+                appendDataFrameAndExtractXpc(frame.streamId, frame.payload, frame.payloadSize);
+            }
+            recvBuf.Consume(consumed);
+        }
+        if (!replies.Empty()) pipe.send(replies.Buffer());
+        return true;
+    };
+
+    // Step 1: Send HTTP/2 connection preface + window update (one write)
+    H2FrameWriter out;
+    out.Preface().WindowUpdate(0, 1048576);
+    if (!pipe.send(out.Buffer())) {
         INST_LOG_ERROR(TAG, "RSD: failed to send HTTP/2 preface");
         return Error::ConnectionFailed;
     }
-    sendFn(Http2Framer::MakeWindowUpdateFrame(0, 1048576));
     INST_LOG_DEBUG(TAG, "RSD: sent HTTP/2 preface");
 
     // Step 2: Wait for server SETTINGS
-    bool gotServerSettings = false;
     auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
-
     while (!gotServerSettings) {
         if (std::chrono::steady_clock::now() > deadline) {
             INST_LOG_ERROR(TAG, "RSD: timeout waiting for server SETTINGS");
             return Error::Timeout;
         }
-        if (!recvMoreFn(recvBuf)) {
+        if (!pump(deadline)) {
             INST_LOG_ERROR(TAG, "RSD: connection closed waiting for SETTINGS");
             return Error::ConnectionFailed;
         }
-        size_t offset = 0;
-        while (offset < recvBuf.size()) {
-            H2Frame frame;
-            size_t consumed = Http2Framer::DecodeFrame(recvBuf.data() + offset,
-                                                        recvBuf.size() - offset, frame);
-            if (consumed == 0) break;
-            offset += consumed;
-            if (frame.type == H2FrameType::Settings && !(frame.flags & H2Flags::Ack)) {
-                sendFn(Http2Framer::MakeSettingsFrame(true));
-                gotServerSettings = true;
-            }
-        }
-        if (offset > 0) recvBuf.erase(recvBuf.begin(), recvBuf.begin() + offset);
     }
 
-    // Step 3: RemoteXPC stream initialization (matches go-ios initializeXpcConnection):
+    // Step 3: RemoteXPC stream initialization (kXPCInitSteps):
     //   stream 1: flags=AlwaysSet, body={}
     //   stream 3: flags=AlwaysSet|InitHandshake, body=nil
     //   stream 1: flags=0x201, body=nil
@@ -385,186 +134,194 @@ Error RSDProvider::DoRSDHandshake(
         msg.flags = flags;
         msg.messageId = msgId;
         msg.body = body ? *body : NSObject::Null();
-        auto wire = msg.Encode();
 
-        if (!openedStreams.count(streamId)) {
-            if (!sendFn(Http2Framer::MakeHeadersFrame(streamId, {}, false))) {
-                return false;
-            }
-            openedStreams.insert(streamId);
+        // HEADERS (first message on the stream) and DATA in one write, the
+        // message encoded straight into the DATA frame
+        out.Clear();
+        if (openedStreams.insert(streamId).second) {
+            out.Headers(streamId, {}, false);
         }
-        return sendFn(Http2Framer::MakeDataFrame(streamId, wire.data(), wire.size(), false));
+        const size_t frame = out.BeginData(streamId);
+        msg.EncodeTo(out.Buffer());
+        out.EndFrame(frame);
+        return pipe.send(out.Buffer());
     };
 
     auto waitForXpcOnStream = [&](uint32_t wantedStream, XPCMessage& outMsg,
                                   std::chrono::steady_clock::time_point dl) -> Error {
-        while (true) {
+        while (!popNextXpc(wantedStream, outMsg)) {
             if (std::chrono::steady_clock::now() > dl) return Error::Timeout;
-
-            {
-                XPCMessage ready;
-                if (popNextXpc(wantedStream, ready)) {
-                    outMsg = std::move(ready);
-                    return Error::Success;
-                }
-            }
-
-            if (!recvMoreFn(recvBuf)) return Error::ProtocolError;
-
-            size_t offset = 0;
-            while (offset < recvBuf.size()) {
-                H2Frame frame;
-                size_t consumed = Http2Framer::DecodeFrame(recvBuf.data() + offset,
-                                                           recvBuf.size() - offset, frame);
-                if (consumed == 0) break;
-                offset += consumed;
-
-                if (frame.type == H2FrameType::Settings && !(frame.flags & H2Flags::Ack)) {
-                    sendFn(Http2Framer::MakeSettingsFrame(true));
-                    continue;
-                }
-                if (frame.type == H2FrameType::Data && !frame.payload.empty()) {
-                    appendDataFrameAndExtractXpc(frame.streamId, frame.payload);
-                    if (frame.streamId == wantedStream) {
-                        XPCMessage ready;
-                        if (popNextXpc(wantedStream, ready)) {
-                            outMsg = std::move(ready);
-                            if (offset > 0) recvBuf.erase(recvBuf.begin(), recvBuf.begin() + offset);
-                            return Error::Success;
-                        }
-                    }
-                }
-            }
-            if (offset > 0) recvBuf.erase(recvBuf.begin(), recvBuf.begin() + offset);
+            if (!pump(dl)) return Error::ProtocolError;
         }
+        return Error::Success;
     };
 
     NSObject emptyDict = NSObject::MakeDict({});
-    if (!sendXpc(1, XPCFlags::AlwaysSet, &emptyDict, 0)) {
-        INST_LOG_ERROR(TAG, "RSD: failed to send XPC init step 1 (stream 1)");
-        return Error::ConnectionFailed;
-    }
-    {
-        XPCMessage ignored;
-        Error e = waitForXpcOnStream(1, ignored, std::chrono::steady_clock::now() + std::chrono::seconds(5));
-        if (e != Error::Success) {
-            INST_LOG_ERROR(TAG, "RSD: failed waiting for XPC init step 1 reply");
-            return e;
-        }
-        INST_LOG_DEBUG(TAG, "RSD: init step 1 reply flags=0x%x msgId=%llu",
-                       ignored.flags, (unsigned long long)ignored.messageId);
-    }
-
-    if (!sendXpc(3, XPCFlags::AlwaysSet | XPCFlags::InitHandshake, nullptr, 0)) {
-        INST_LOG_ERROR(TAG, "RSD: failed to send XPC init step 2 (stream 3)");
-        return Error::ConnectionFailed;
-    }
-    {
-        XPCMessage ignored;
-        Error e = waitForXpcOnStream(3, ignored, std::chrono::steady_clock::now() + std::chrono::seconds(5));
-        if (e != Error::Success) {
-            INST_LOG_ERROR(TAG, "RSD: failed waiting for XPC init step 2 reply");
-            return e;
+    for (size_t i = 0; i < sizeof(kXPCInitSteps) / sizeof(kXPCInitSteps[0]); i++) {
+        const XPCInitStep& step = kXPCInitSteps[i];
+        if (!sendXpc(step.streamId, step.flags, step.emptyDictBody ? &emptyDict : nullptr, 0)) {
+            INST_LOG_ERROR(TAG, "RSD: failed to send XPC init step %zu (stream %u)", i + 1, step.streamId);
+            return Error::ConnectionFailed;
         }
-        INST_LOG_DEBUG(TAG, "RSD: init step 2 reply flags=0x%x msgId=%llu",
-                       ignored.flags, (unsigned long long)ignored.messageId);
-    }
-
-    if (!sendXpc(1, 0x201, nullptr, 0)) {
-        INST_LOG_ERROR(TAG, "RSD: failed to send XPC init step 3 (stream 1)");
-        return Error::ConnectionFailed;
-    }
-    {
         XPCMessage ignored;
-        Error e = waitForXpcOnStream(1, ignored, std::chrono::steady_clock::now() + std::chrono::seconds(5));
+        Error e = waitForXpcOnStream(step.streamId, ignored,
+                                     std::chrono::steady_clock::now() + std::chrono::seconds(5));
         if (e != Error::Success) {
-            INST_LOG_ERROR(TAG, "RSD: failed waiting for XPC init step 3 reply");
+            INST_LOG_ERROR(TAG, "RSD: failed waiting for XPC init step %zu reply", i + 1);
             return e;
         }
-        INST_LOG_DEBUG(TAG, "RSD: init step 3 reply flags=0x%x msgId=%llu",
-                       ignored.flags, (unsigned long long)ignored.messageId);
+        INST_LOG_DEBUG(TAG, "RSD: init step %zu reply flags=0x%x msgId=%llu",
+                       i + 1, ignored.flags, (unsigned long long)ignored.messageId);
     }
 
     INST_LOG_DEBUG(TAG, "RSD: RemoteXPC stream initialization complete");
 
     // Step 4: Receive XPC service discovery response on stream 1
-    bool gotXPCResponse = false;
     deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
-
-    while (!gotXPCResponse) {
-        if (std::chrono::steady_clock::now() > deadline) {
+    for (;;) {
+        XPCMessage xpcResp;
+        Error e = waitForXpcOnStream(1, xpcResp, deadline);
+        if (e == Error::Timeout) {
             INST_LOG_ERROR(TAG, "RSD: timeout waiting for XPC response");
             return Error::Timeout;
         }
+        if (e != Error::Success) {
+            INST_LOG_ERROR(TAG, "RSD: connection closed waiting for XPC response");
+            return e;
+        }
 
-        {
-            XPCMessage xpcResp;
-            while (popNextXpc(1, xpcResp)) {
-                INST_LOG_INFO(TAG, "RSD: received XPC response (flags=0x%x msgId=%llu)",
-                             xpcResp.flags, (unsigned long long)xpcResp.messageId);
-                if (xpcResp.body.IsDict()) {
-                    const size_t oldCount = m_services.size();
-                    ParseServiceResponse(xpcResp.body);
-                    if (m_services.size() > oldCount || !m_services.empty()) {
-                        gotXPCResponse = true;
-                        break;
-                    }
-                    INST_LOG_DEBUG(TAG, "RSD: dict response did not include services yet");
-                } else {
-                    INST_LOG_DEBUG(TAG, "RSD: ignoring XPC response with non-dict body");
-                }
-            }
-            if (gotXPCResponse) break;
+        INST_LOG_INFO(TAG, "RSD: received XPC response (flags=0x%x msgId=%llu)",
+                     xpcResp.flags, (unsigned long long)xpcResp.messageId);
+        if (!xpcResp.body.IsDict()) {
+            INST_LOG_DEBUG(TAG, "RSD: ignoring XPC response with non-dict body");
+            continue;
         }
+        ParseServiceResponse(xpcResp.body);
+        if (!m_services.empty()) break;
+        INST_LOG_DEBUG(TAG, "RSD: dict response did not include services yet");
+    }
 
-        if (!recvMoreFn(recvBuf)) {
-            INST_LOG_ERROR(TAG, "RSD: connection closed waiting for XPC response");
-            return Error::ProtocolError;
+    INST_LOG_INFO(TAG, "RSD handshake complete: UDID=%s, %zu services",
+                 m_udid.c_str(), m_services.size());
+    return Error::Success;
+}
+
+// Blocking send of all bytes on an OS socket
+static bool SocketSendAll(rsd_socket_t sock, const std::vector<uint8_t>& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+#ifdef _WIN32
+        int n = ::send(sock, reinterpret_cast<const char*>(data.data() + sent),
+                       static_cast<int>(data.size() - sent), 0);
+#else
+        ssize_t n = ::send(sock, data.data() + sent, data.size() - sent, 0);
+#endif
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// recv() straight into the handshake buffer. The socket's receive timeout
+// (SO_RCVTIMEO) bounds the wait, so handshake deadlines can fire.
+static int SocketRead(rsd_socket_t sock, uint8_t* buffer, size_t capacity) {
+#ifdef _WIN32
+    int n = ::recv(sock, reinterpret_cast<char*>(buffer), static_cast<int>(capacity), 0);
+    if (n < 0) {
+        int werr = WSAGetLastError();
+        if (werr == WSAETIMEDOUT || werr == WSAEWOULDBLOCK) {
+            return 0; // no data yet, keep waiting until handshake deadline
         }
-        size_t offset = 0;
-        while (offset < recvBuf.size()) {
-            H2Frame frame;
-            size_t consumed = Http2Framer::DecodeFrame(recvBuf.data() + offset,
-                                                        recvBuf.size() - offset, frame);
-            if (consumed == 0) break;
-            offset += consumed;
-
-            if (frame.type == H2FrameType::Data && !frame.payload.empty()) {
-                appendDataFrameAndExtractXpc(frame.streamId, frame.payload);
-                if (frame.streamId == 1) {
-                    XPCMessage xpcResp;
-                    while (popNextXpc(1, xpcResp)) {
-                        INST_LOG_INFO(TAG, "RSD: received XPC response (flags=0x%x msgId=%llu)",
-                                     xpcResp.flags, (unsigned long long)xpcResp.messageId);
-                        if (xpcResp.body.IsDict()) {
-                            const size_t oldCount = m_services.size();
-                            ParseServiceResponse(xpcResp.body);
-                            if (m_services.size() > oldCount || !m_services.empty()) {
-                                gotXPCResponse = true;
-                                break;
-                            }
-                            INST_LOG_DEBUG(TAG, "RSD: dict response did not include services yet");
-                        } else {
-                            INST_LOG_DEBUG(TAG, "RSD: ignoring XPC response with non-dict body");
-                        }
-                    }
-                }
-            } else if (frame.type == H2FrameType::Settings && !(frame.flags & H2Flags::Ack)) {
-                sendFn(Http2Framer::MakeSettingsFrame(true));
-            }
-            if (gotXPCResponse) break;
+        return -1;
+    }
+#else
+    ssize_t n = ::recv(sock, buffer, capacity, 0);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT || errno == EINTR) {
+            return 0; // no data yet, keep waiting until handshake deadline
         }
-        if (offset > 0) recvBuf.erase(recvBuf.begin(), recvBuf.begin() + offset);
+        return -1;
+    }
+#endif
+    return n > 0 ? static_cast<int>(n) : -1;
+}
+
+static void SetSocketReceiveTimeout(rsd_socket_t sock) {
+#ifdef _WIN32
+    DWORD tmoMs = 500;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
+               reinterpret_cast<const char*>(&tmoMs), sizeof(tmoMs));
+#else
+    struct timeval tmo = {0, 500000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+#endif
+}
+
+// --- XPCPipe ---
+
+XPCPipe XPCPipe::FromSocket(int socketFd, bool owned) {
+    // The receive timeout keeps reads from blocking forever, so deadlines
+    // and stop flags are seen
+    const auto sock = static_cast<rsd_socket_t>(socketFd);
+    SetSocketReceiveTimeout(sock);
+
+    XPCPipe pipe;
+    pipe.send = [sock](const std::vector<uint8_t>& data) { return SocketSendAll(sock, data); };
+    pipe.read = [sock](uint8_t* buffer, size_t capacity, int) { return SocketRead(sock, buffer, capacity); };
+    if (owned) {
+        pipe.close = [sock]() { RSD_CLOSE_SOCKET(sock); };
+    } else {
+        pipe.close = []() {};
     }
+    return pipe;
+}
 
-    if (!gotXPCResponse) {
-        INST_LOG_ERROR(TAG, "RSD: no XPC service response received");
-        return Error::ProtocolError;
+XPCPipe XPCPipe::FromIDevice(idevice_connection_t conn, bool owned) {
+    XPCPipe pipe;
+    pipe.send = [conn](const std::vector<uint8_t>& data) -> bool {
+        const char* ptr = reinterpret_cast<const char*>(data.data());
+        size_t remaining = data.size();
+        while (remaining > 0) {
+            uint32_t sent = 0;
+            idevice_error_t e = idevice_connection_send(
+                conn, ptr, static_cast<uint32_t>(remaining), &sent);
+            if (e != IDEVICE_E_SUCCESS || sent == 0) return false;
+            ptr += sent;
+            remaining -= sent;
+        }
+        return true;
+    };
+    pipe.read = [conn](uint8_t* buffer, size_t capacity, int timeoutMs) -> int {
+        uint32_t received = 0;
+        idevice_error_t e = idevice_connection_receive_timeout(
+            conn, reinterpret_cast<char*>(buffer), static_cast<uint32_t>(capacity), &received,
+            static_cast<unsigned int>(timeoutMs > 0 ? timeoutMs : 1));
+        if (e == IDEVICE_E_TIMEOUT && received == 0) return 0;
+        if (e != IDEVICE_E_SUCCESS || received == 0) return -1;
+        return static_cast<int>(received);
+    };
+    if (owned) {
+        pipe.close = [conn]() { idevice_disconnect(conn); };
+    } else {
+        pipe.close = []() {};
     }
+    return pipe;
+}
 
-    INST_LOG_INFO(TAG, "RSD handshake complete: UDID=%s, %zu services",
-                 m_udid.c_str(), m_services.size());
-    return Error::Success;
+XPCPipe XPCPipe::FromStream(std::shared_ptr<TunnelStream> stream, bool owned) {
+    XPCPipe pipe;
+    pipe.send = [stream](const std::vector<uint8_t>& data) {
+        return stream->Write(data.data(), data.size()) == Error::Success;
+    };
+    pipe.read = [stream](uint8_t* buffer, size_t capacity, int timeoutMs) {
+        return stream->Read(buffer, capacity, timeoutMs);
+    };
+    if (owned) {
+        pipe.close = [stream]() { stream->Close(); };
+    } else {
+        pipe.close = []() {};
+    }
+    return pipe;
 }
 
 Error RSDProvider::ConnectDirect(const std::string& address, uint16_t rsdPort) {
@@ -606,62 +363,9 @@ Error RSDProvider::ConnectDirect(const std::string& address, uint16_t rsdPort) {
 
     INST_LOG_INFO(TAG, "ConnectDirect: TCP connected to RSD");
 
-    // Prevent indefinite blocking in recv so DoRSDHandshake deadlines can fire.
-#ifdef _WIN32
-    {
-        DWORD tmoMs = 500;
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
-                   reinterpret_cast<const char*>(&tmoMs), sizeof(tmoMs));
-    }
-#else
-    {
-        struct timeval tmo = {0, 500000};
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
-    }
-#endif
-
-    auto sendFn = [&](const std::vector<uint8_t>& data) -> bool {
-        size_t sent = 0;
-        while (sent < data.size()) {
-#ifdef _WIN32
-            int n = ::send(sock, reinterpret_cast<const char*>(data.data() + sent),
-                           static_cast<int>(data.size() - sent), 0);
-#else
-            ssize_t n = ::send(sock, data.data() + sent, data.size() - sent, 0);
-#endif
-            if (n <= 0) return false;
-            sent += static_cast<size_t>(n);
-        }
-        return true;
-    };
-
-    auto recvMoreFn = [&](std::vector<uint8_t>& buf) -> bool {
-        uint8_t tmp[4096];
-#ifdef _WIN32
-        int n = ::recv(sock, reinterpret_cast<char*>(tmp), sizeof(tmp), 0);
-        if (n < 0) {
-            int werr = WSAGetLastError();
-            if (werr == WSAETIMEDOUT || werr == WSAEWOULDBLOCK) {
-                return true; // no data yet, keep waiting until handshake deadline
-            }
-            return false;
-        }
-#else
-        ssize_t n = ::recv(sock, tmp, sizeof(tmp), 0);
-        if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT) {
-                return true; // no data yet, keep waiting until handshake deadline
-            }
-            return false;
-        }
-#endif
-        if (n <= 0) return false;
-        buf.insert(buf.end(), tmp, tmp + n);
-        return true;
-    };
-
-    Error err = DoRSDHandshake(sendFn, recvMoreFn);
-    RSD_CLOSE_SOCKET(sock);
+    XPCPipe pipe = XPCPipe::FromSocket(static_cast<int>(sock), true);
+    Error err = DoRSDHandshake(pipe);
+    pipe.close();
 
     if (err == Error::Success) {
         INST_LOG_INFO(TAG, "ConnectDirect: complete — UDID=%s, %zu services",
@@ -682,32 +386,9 @@ Error RSDProvider::ConnectViaIDevice(idevice_t device, uint16_t rsdPort) {
 
     INST_LOG_INFO(TAG, "ConnectViaIDevice: USB TCP connected to RSD port %u", rsdPort);
 
-    auto sendFn = [&](const std::vector<uint8_t>& data) -> bool {
-        const char* ptr = reinterpret_cast<const char*>(data.data());
-        size_t remaining = data.size();
-        while (remaining > 0) {
-            uint32_t sent = 0;
-            idevice_error_t e = idevice_connection_send(
-                conn, ptr, static_cast<uint32_t>(remaining), &sent);
-            if (e != IDEVICE_E_SUCCESS || sent == 0) return false;
-            ptr += sent;
-            remaining -= sent;
-        }
-        return true;
-    };
-
-    auto recvMoreFn = [&](std::vector<uint8_t>& buf) -> bool {
-        char tmp[4096];
-        uint32_t received = 0;
-        idevice_error_t e = idevice_connection_receive_timeout(
-            conn, tmp, sizeof(tmp), &received, 5000);
-        if (e != IDEVICE_E_SUCCESS || received == 0) return false;
-        buf.insert(buf.end(), tmp, tmp + received);
-        return true;
-    };
-
-    Error err = DoRSDHandshake(sendFn, recvMoreFn);
-    idevice_disconnect(conn);
+    XPCPipe pipe = XPCPipe::FromIDevice(conn, true);
+    Error err = DoRSDHandshake(pipe);
+    pipe.close();
 
     if (err == Error::Success) {
         INST_LOG_INFO(TAG, "ConnectViaIDevice: complete — UDID=%s, %zu services",
@@ -719,63 +400,16 @@ Error RSDProvider::ConnectViaIDevice(idevice_t device, uint16_t rsdPort) {
 Error RSDProvider::ConnectViaFd(int socketFd) {
     INST_LOG_INFO(TAG, "ConnectViaFd: doing RSD handshake on pre-connected socket");
 
-    // Ensure recv() does not block forever, otherwise DoRSDHandshake can hang.
-#ifdef _WIN32
-    {
-        DWORD tmoMs = 500;
-        setsockopt(static_cast<SOCKET>(socketFd), SOL_SOCKET, SO_RCVTIMEO,
-                   reinterpret_cast<const char*>(&tmoMs), sizeof(tmoMs));
-    }
-#else
-    {
-        struct timeval tmo = {0, 500000};
-        setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
-    }
-#endif
-
-    auto sendFn = [socketFd](const std::vector<uint8_t>& data) -> bool {
-        size_t sent = 0;
-        while (sent < data.size()) {
-#ifdef _WIN32
-            int n = ::send(static_cast<SOCKET>(socketFd),
-                           reinterpret_cast<const char*>(data.data() + sent),
-                           static_cast<int>(data.size() - sent), 0);
-#else
-            ssize_t n = ::send(socketFd, data.data() + sent, data.size() - sent, 0);
-#endif
-            if (n <= 0) return false;
-            sent += static_cast<size_t>(n);
-        }
-        return true;
-    };
+    return DoRSDHandshake(XPCPipe::FromSocket(socketFd, false));
+}
 
-    auto recvMoreFn = [socketFd](std::vector<uint8_t>& buf) -> bool {
-        uint8_t tmp[4096];
-#ifdef _WIN32
-        int n = ::recv(static_cast<SOCKET>(socketFd),
-                       reinterpret_cast<char*>(tmp), sizeof(tmp), 0);
-        if (n < 0) {
-            int werr = WSAGetLastError();
-            if (werr == WSAETIMEDOUT || werr == WSAEWOULDBLOCK) {
-                return true; // no data yet, keep waiting until handshake deadline
-            }
-            return false;
-        }
-#else
-        ssize_t n = ::recv(socketFd, tmp, sizeof(tmp), 0);
-        if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT) {
-                return true; // no data yet, keep waiting until handshake deadline
-            }
-            return false;
-        }
-#endif
-        if (n <= 0) return false;
-        buf.insert(buf.end(), tmp, tmp + static_cast<size_t>(n));
-        return true;
-    };
+Error RSDProvider::ConnectViaStream(const std::shared_ptr<TunnelStream>& stream) {
+    if (!stream) return Error::InvalidArgument;
+    INST_LOG_INFO(TAG, "ConnectViaStream: doing RSD handshake on tunnel stream");
 
-    return DoRSDHandshake(sendFn, recvMoreFn);
+    // Reads wait on the stream, which the tunnel's forwarding loop wakes as
+    // data arrives: no polling and no socket pair
+    return DoRSDHandshake(XPCPipe::FromStream(stream, false));
 }
 
 void RSDProvider::ParseServiceResponse(const NSObject& body) {
@@ -826,6 +460,9 @@ void RSDProvider::ParseServiceResponse(const NSObject& body) {
             m_udid = udid->AsString();
             INST_LOG_INFO(TAG, "Device UDID: %s", m_udid.c_str());
         }
+        if (const NSObject* boot = findKeyCI(*props, "BootSessionUUID"); boot && boot->IsString()) {
+            m_bootSessionUUID = boot->AsString();
+        }
     }
 
     if (const NSObject* services = findKeyCI(*root, "Services"); services && services->IsDict()) {
@@ -863,5 +500,5 @@ uint16_t RSDProvider::FindServicePortWithShim(const std::string& serviceName) co
 }
 
 } // namespace instruments
-
-
+
+
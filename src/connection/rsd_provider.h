@@ -3,7 +3,6 @@
 
 #include "../../include/instruments/types.h"
 #include "xpc_message.h"
-#include "userspace_network.h"
 #include <functional>
 #include <map>
 #include <memory>
@@ -13,17 +12,39 @@
 
 namespace instruments {
 
+class TunnelStream;
+
 // RSD Service entry discovered from the device
 struct RSDServiceEntry {
     std::string name;
     uint16_t port = 0;
 };
 
+// XPCPipe - byte transport under a RemoteXPC (HTTP/2) connection: the RSD
+// handshake and long-lived service clients (AppServiceClient) run over one.
+// DeviceConnection::ConnectDevicePort() opens one to any device TCP port.
+struct XPCPipe {
+    // Send all bytes; false on error
+    std::function<bool(const std::vector<uint8_t>&)> send;
+    // Read up to capacity bytes, waiting at most about timeoutMs; returns
+    // the count, 0 if none yet, -1 once the connection is closed
+    std::function<int(uint8_t* buffer, size_t capacity, int timeoutMs)> read;
+    // Release the transport (no-op unless the pipe owns it)
+    std::function<void()> close;
+
+    // OS socket (gets a short SO_RCVTIMEO; reads ignore timeoutMs)
+    static XPCPipe FromSocket(int socketFd, bool owned);
+    // usbmuxd connection (idevice_connect(), no SSL)
+    static XPCPipe FromIDevice(idevice_connection_t conn, bool owned);
+    // In-process tunnel stream (QUICTunnel::CreateTunnelStream())
+    static XPCPipe FromStream(std::shared_ptr<TunnelStream> stream, bool owned);
+};
+
 // RSDProvider - Remote Service Discovery for iOS 17+.
 // Connects to the device's RSD port (58783) via tunnel and discovers available services.
 //
 // RSD Protocol:
-// 1. TCP connect to device:58783 through userspace tunnel (lwIP)
+// 1. TCP connect to device:58783 (usbmuxd, OS socket or tunnel stream)
 // 2. HTTP/2 connection preface + SETTINGS exchange
 // 3. XPC InitHandshake on HTTP/2 streams
 // 4. Receive XPC service discovery response (UDID + service port map)
@@ -33,13 +54,15 @@ public:
     RSDProvider();
     ~RSDProvider();
 
-    // Connect to RSD on a tunneled device using the userspace network (self-managed QUIC)
-    Error Connect(const std::string& tunnelAddress, uint16_t rsdPort,
-                  UserspaceNetwork* network);
-
-    // Legacy overload (returns NotSupported without network)
+    // Legacy overload (returns NotSupported; use ConnectViaStream)
     Error Connect(const std::string& tunnelAddress, uint16_t rsdPort);
 
+    // Connect to RSD over an in-process tunnel stream
+    // (QUICTunnel::CreateTunnelStream(serverAddress, serverRSDPort)). Reads
+    // are woken by the tunnel's forwarding loop; no socket pair. The stream
+    // is not closed by this method.
+    Error ConnectViaStream(const std::shared_ptr<TunnelStream>& stream);
+
     // Connect to RSD using a plain OS TCP socket (for external tunnel tools:
     // pymobiledevice3 remote start-tunnel, go-ios tunnel start, etc.).
     // The external tool creates a real network interface; the device is
@@ -59,6 +82,10 @@ public:
     // Get the UDID from the RSD handshake
     const std::string& GetUDID() const { return m_udid; }
 
+    // Get the device's boot session from the RSD handshake ("" if not reported);
+    // service ports are stable within one boot session
+    const std::string& GetBootSessionUUID() const { return m_bootSessionUUID; }
+
     // Get all discovered services
     const std::map<std::string, RSDServiceEntry>& GetServices() const { return m_services; }
 
@@ -73,15 +100,12 @@ public:
 
 private:
     std::string m_udid;
+    std::string m_bootSessionUUID;
     std::map<std::string, RSDServiceEntry> m_services;
-    std::shared_ptr<UserspaceTcpConnection> m_tcpConn;
-
-    // Shared HTTP/2 + XPC handshake logic used by ConnectDirect and ConnectViaIDevice.
-    // sendFn(data)     → sends bytes, returns false on error
-    // recvMoreFn(buf)  → appends received bytes to buf, returns false on disconnect
-    Error DoRSDHandshake(
-        std::function<bool(const std::vector<uint8_t>&)> sendFn,
-        std::function<bool(std::vector<uint8_t>&)> recvMoreFn);
+
+    // Shared HTTP/2 + XPC handshake logic used by every Connect* transport.
+    // Frames are decoded in place in one receive buffer.
+    Error DoRSDHandshake(const XPCPipe& pipe);
 
     // Parse XPC service discovery response body
     void ParseServiceResponse(const NSObject& body);
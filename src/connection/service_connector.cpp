@@ -1,5 +1,6 @@
 #include "service_connector.h"
 #include "../util/log.h"
+#include "../util/trace.h"
 #include <cstring>
 #include <cstdlib>
 
@@ -51,6 +52,7 @@ Error ServiceConnector::StartService(idevice_t device,
     if (!device || serviceNames.empty() || !outService) {
         return Error::InvalidArgument;
     }
+    TraceSpan span("service", "StartService", serviceNames.front());
 
     // Use provided lockdown client or create a temporary one
     lockdownd_client_t temp_lockdown = nullptr;
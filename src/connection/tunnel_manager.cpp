@@ -4,6 +4,7 @@
 #include "service_connector.h"
 #include "../util/log.h"
 #include <libimobiledevice/libimobiledevice.h>
+#include <algorithm>
 #include <chrono>
 #include <memory>
 
@@ -49,7 +50,10 @@ bool TunnelManager::NeedsTunnel(int majorVersion) {
 }
 
 Error TunnelManager::StartTunnel(const std::string& udid, TunnelInfo& outInfo) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // One bring-up per device; other devices proceed in parallel
+    m_startCv.wait(lock, [this, &udid]() { return m_starting.count(udid) == 0; });
 
     // Return cached tunnel if already active
     auto it = m_tunnels.find(udid);
@@ -58,6 +62,17 @@ Error TunnelManager::StartTunnel(const std::string& udid, TunnelInfo& outInfo) {
         return Error::Success;
     }
 
+    m_starting.insert(udid);
+    lock.unlock();
+    Error err = BringUpTunnel(udid, outInfo);
+    lock.lock();
+    m_starting.erase(udid);
+    if (err == Error::Success) m_tunnels[udid] = outInfo;
+    m_startCv.notify_all();
+    return err;
+}
+
+Error TunnelManager::BringUpTunnel(const std::string& udid, TunnelInfo& outInfo) {
     INST_LOG_INFO(TAG, "StartTunnel: device %s", udid.c_str());
 
     // ── Step 1: Reach the device via USB ────────────────────────────────────
@@ -73,7 +88,16 @@ Error TunnelManager::StartTunnel(const std::string& udid, TunnelInfo& outInfo) {
     }
 
     // ── Step 2: Check iOS version ────────────────────────────────────────────
+    // An empty version means lockdown did not answer (device locked, not
+    // yet trusted, still booting): that is worth retrying, unlike a version
+    // below 17
     std::string version = ServiceConnector::GetIOSVersion(device);
+    if (version.empty()) {
+        idevice_free(device);
+        INST_LOG_WARN(TAG, "StartTunnel: iOS version of %s unknown (locked or not trusted?)",
+                     udid.c_str());
+        return Error::ConnectionFailed;
+    }
     if (!NeedsTunnel(version)) {
         idevice_free(device);
         INST_LOG_INFO(TAG, "StartTunnel: device %s (iOS %s) does not need a tunnel",
@@ -95,7 +119,6 @@ Error TunnelManager::StartTunnel(const std::string& udid, TunnelInfo& outInfo) {
         outInfo.address = "";           // empty = USB direct; use Instruments::Create()
         outInfo.rsdPort = RSDProvider::DefaultPort;
         outInfo.isUsbDirect = true;
-        m_tunnels[udid] = outInfo;
 
         auto activeTunnel = std::make_shared<ActiveTunnel>();
         activeTunnel->info = outInfo;
@@ -129,16 +152,12 @@ Error TunnelManager::StartTunnel(const std::string& udid, TunnelInfo& outInfo) {
 
         if (quicErr == Error::Success) {
             // RSD handshake through the tunnel
-            int rsdFd = quicTunnel->CreateTunnelSocket(
+            auto rsdStream = quicTunnel->CreateTunnelStream(
                 quicTunnel->ServerAddress(), quicTunnel->ServerRSDPort());
-            if (rsdFd >= 0) {
+            if (rsdStream) {
                 RSDProvider rsd2;
-                Error rsdErr2 = rsd2.ConnectViaFd(rsdFd);
-#ifdef _WIN32
-                closesocket(static_cast<SOCKET>(rsdFd));
-#else
-                ::close(rsdFd);
-#endif
+                Error rsdErr2 = rsd2.ConnectViaStream(rsdStream);
+                rsdStream->Close();
                 if (rsdErr2 == Error::Success && !rsd2.GetServices().empty()) {
                     INST_LOG_INFO(TAG, "StartTunnel: USB QUIC tunnel succeeded for %s — %zu services",
                                  udid.c_str(), rsd2.GetServices().size());
@@ -147,7 +166,6 @@ Error TunnelManager::StartTunnel(const std::string& udid, TunnelInfo& outInfo) {
                     outInfo.address = quicTunnel->ServerAddress();
                     outInfo.rsdPort = quicTunnel->ServerRSDPort();
                     outInfo.isUsbDirect = false;
-                    m_tunnels[udid] = outInfo;
 
                     auto activeTunnel = std::make_shared<ActiveTunnel>();
                     activeTunnel->quicTunnel = std::move(quicTunnel);
@@ -204,6 +222,20 @@ void TunnelManager::StopTunnel(const std::string& udid) {
     INST_LOG_INFO(TAG, "Stopped tunnel for %s", udid.c_str());
 }
 
+// usbmuxd delivers device events on its own thread
+struct TunnelManagerEvents {
+    static void Callback(const idevice_event_t* event, void* userData) {
+        // Network devices have no USB path to tunnel over
+        if (!event || !event->udid || event->conn_type != CONNECTION_USBMUXD) return;
+        auto* self = static_cast<TunnelManager*>(userData);
+        if (event->event == IDEVICE_DEVICE_ADD) {
+            self->OnDeviceAdded(event->udid);
+        } else if (event->event == IDEVICE_DEVICE_REMOVE) {
+            self->OnDeviceRemoved(event->udid);
+        }
+    }
+};
+
 Error TunnelManager::StartAutoTunnel() {
     if (m_autoTunnelRunning.exchange(true)) {
         return Error::Success; // Already running
@@ -211,9 +243,18 @@ Error TunnelManager::StartAutoTunnel() {
 
     INST_LOG_INFO(TAG, "Starting auto-tunnel");
 
-    m_autoTunnelThread = std::thread([this]() {
-        AutoTunnelLoop();
-    });
+    for (int i = 0; i < AutoTunnelWorkers; i++) {
+        m_autoWorkers.emplace_back([this]() { AutoTunnelWorker(); });
+    }
+
+    // usbmuxd reports the attached devices first, then hotplug events
+    idevice_subscription_context_t context = nullptr;
+    if (idevice_events_subscribe(&context, &TunnelManagerEvents::Callback, this) != IDEVICE_E_SUCCESS) {
+        INST_LOG_ERROR(TAG, "Auto-tunnel: failed to subscribe to usbmuxd device events");
+        StopAutoTunnel();
+        return Error::ConnectionFailed;
+    }
+    m_eventSubscription = context;
 
     return Error::Success;
 }
@@ -223,47 +264,106 @@ void TunnelManager::StopAutoTunnel() {
 
     INST_LOG_INFO(TAG, "Stopping auto-tunnel");
 
-    if (m_autoTunnelThread.joinable()) {
-        m_autoTunnelThread.join();
+    // No callbacks run once this returns
+    if (m_eventSubscription) {
+        idevice_events_unsubscribe(static_cast<idevice_subscription_context_t>(m_eventSubscription));
+        m_eventSubscription = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_autoMutex);
+        m_autoCv.notify_all();
     }
+    for (auto& worker : m_autoWorkers) {
+        if (worker.joinable()) worker.join();
+    }
+    m_autoWorkers.clear();
+    m_autoJobs.clear();
+    m_autoDevices.clear();
+    m_autoStarted.clear();
 }
 
-void TunnelManager::AutoTunnelLoop() {
-    while (m_autoTunnelRunning.load()) {
-        // Discover connected devices
-        idevice_info_t* devices = nullptr;
-        int count = 0;
-
-        if (idevice_get_device_list_extended(&devices, &count) == IDEVICE_E_SUCCESS && devices) {
-            for (int i = 0; i < count; i++) {
-                std::string udid = devices[i]->udid;
-
-                // Check if tunnel already exists
-                {
-                    std::lock_guard<std::mutex> lock(m_mutex);
-                    if (m_tunnels.count(udid) > 0) continue;
-                }
+void TunnelManager::OnDeviceAdded(const std::string& udid) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_tunnels.count(udid) > 0) return;
+    }
 
-                // Check if device needs tunneling
-                idevice_t device = nullptr;
-                if (idevice_new_with_options(&device, udid.c_str(),
-                    static_cast<idevice_options>(IDEVICE_LOOKUP_USBMUX)) == IDEVICE_E_SUCCESS) {
-
-                    std::string version = ServiceConnector::GetIOSVersion(device);
-                    if (NeedsTunnel(version)) {
-                        TunnelInfo info;
-                        StartTunnel(udid, info);
-                    }
-                    idevice_free(device);
-                }
+    std::lock_guard<std::mutex> lock(m_autoMutex);
+    if (!m_autoDevices.insert(udid).second) return;   // already being handled
+    m_autoJobs.push_back({udid, std::chrono::steady_clock::now(), 0});
+    m_autoCv.notify_one();
+}
+
+void TunnelManager::OnDeviceRemoved(const std::string& udid) {
+    bool started = false;
+    {
+        std::lock_guard<std::mutex> lock(m_autoMutex);
+        m_autoDevices.erase(udid);
+        m_autoJobs.erase(std::remove_if(m_autoJobs.begin(), m_autoJobs.end(),
+            [&udid](const AutoTunnelJob& job) { return job.udid == udid; }), m_autoJobs.end());
+        started = m_autoStarted.erase(udid) > 0;
+    }
+    // The tunnel went away with the device
+    if (started) StopTunnel(udid);
+}
+
+void TunnelManager::AutoTunnelWorker() {
+    // Retry delays: 1 s, 2 s, 4 s, ... up to a minute
+    constexpr auto kInitialBackoff = std::chrono::seconds(1);
+    constexpr auto kMaxBackoff = std::chrono::seconds(60);
+
+    std::unique_lock<std::mutex> lock(m_autoMutex);
+    while (m_autoTunnelRunning.load()) {
+        // Earliest due job
+        auto next = std::min_element(m_autoJobs.begin(), m_autoJobs.end(),
+            [](const AutoTunnelJob& a, const AutoTunnelJob& b) { return a.due < b.due; });
+        if (next == m_autoJobs.end()) {
+            m_autoCv.wait(lock);
+            continue;
+        }
+        if (next->due > std::chrono::steady_clock::now()) {
+            m_autoCv.wait_until(lock, next->due);
+            continue;
+        }
+        AutoTunnelJob job = *next;
+        m_autoJobs.erase(next);
+        lock.unlock();
+
+        TunnelInfo info;
+        Error err = StartTunnel(job.udid, info);
+
+        lock.lock();
+        if (m_autoDevices.count(job.udid) == 0) {
+            // Unplugged during the attempt: its tunnel is already dead
+            if (err == Error::Success) {
+                lock.unlock();
+                StopTunnel(job.udid);
+                lock.lock();
             }
-            idevice_device_list_extended_free(devices);
+            continue;
         }
-
-        // Wait before next scan
-        for (int i = 0; i < 50 && m_autoTunnelRunning.load(); i++) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (err == Error::Success) {
+            m_autoStarted.insert(job.udid);
+            m_autoDevices.erase(job.udid);
+            continue;
         }
+        if (err == Error::NotSupported || err == Error::DeviceNotFound) {
+            // No tunnel needed (iOS 16 and below) or gone from usbmuxd. An
+            // unknown version (locked / untrusted) is ConnectionFailed and
+            // retried below.
+            m_autoDevices.erase(job.udid);
+            continue;
+        }
+
+        auto backoff = kInitialBackoff * (1 << std::min(job.attempts, 6));
+        if (backoff > kMaxBackoff) backoff = kMaxBackoff;
+        job.attempts++;
+        job.due = std::chrono::steady_clock::now() + backoff;
+        INST_LOG_WARN(TAG, "Auto-tunnel: %s failed (%s), retrying in %lld s", job.udid.c_str(),
+                     ErrorToString(err), static_cast<long long>(backoff.count()));
+        m_autoJobs.push_back(std::move(job));
+        m_autoCv.notify_one();
     }
 }
 
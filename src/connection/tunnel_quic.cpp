@@ -1,5 +1,7 @@
 #include "tunnel_quic.h"
 #include "../util/log.h"
+#include "../util/metrics.h"
+#include "../util/trace.h"
 #include <cctype>
 #include <cstring>
 
@@ -8,6 +10,10 @@
 #include <picoquic.h>
 #include <picoquic_utils.h>
 
+extern "C" {
+#include <lwip/pbuf.h>
+}
+
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -15,9 +21,12 @@
 #pragma comment(lib, "ws2_32.lib")
 #endif
 using socket_t = SOCKET;
+using pollfd_t = WSAPOLLFD;
+#define POLL_SOCKETS WSAPoll
 #define SOCKET_INVALID INVALID_SOCKET
 #define CLOSE_SOCKET closesocket
 #define SOCKET_ERROR_CODE WSAGetLastError()
+#define SOCKET_WOULD_BLOCK (WSAGetLastError() == WSAEWOULDBLOCK)
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -25,13 +34,21 @@ using socket_t = SOCKET;
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <cerrno>
 using socket_t = int;
+using pollfd_t = struct pollfd;
+#define POLL_SOCKETS ::poll
 #define SOCKET_INVALID (-1)
 #define CLOSE_SOCKET ::close
 #define SOCKET_ERROR_CODE errno
+#define SOCKET_WOULD_BLOCK (errno == EAGAIN || errno == EWOULDBLOCK)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0   // macOS: bridge sockets set SO_NOSIGPIPE instead
+#endif
 #endif
 
 #include <plist/plist.h>
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <future>
@@ -40,6 +57,74 @@ namespace instruments {
 
 static const char* TAG = "QUICTunnel";
 
+// Longest WaitForEvents() / WaitForIo() sleep; Close() and the wakes end it early
+static constexpr int kMaxWaitMs = 1000;
+// Handshake loops re-check their deadline at least this often
+static constexpr int kHandshakeMaxWaitMs = 100;
+#ifdef __linux__
+// Datagrams per sendmmsg / recvmmsg call in UDP mode
+static constexpr unsigned int kUdpBatchSize = 32;
+#endif
+
+// lwIP output rings. lwIP emits TCP segments of at most TCP_MSS plus the
+// IPv6 and TCP headers (with options), so slots are that large rather than
+// the tunnel MTU; larger non-TCP packets are dropped. The ring holds two
+// full TCP_SND_BUF send windows plus headroom for ACKs and handshakes, so
+// a sender filling its window does not overflow it.
+static constexpr size_t kOutputPacketMax = TCP_MSS + 40 + 60;
+static constexpr size_t kOutputRingSlots = 2 * (TCP_SND_BUF / TCP_MSS + 1) + 64;
+
+// Bytes each bridge / stream may copy per direction per ForwardLoop pass
+// before the others get their turn
+static constexpr size_t kFairShareBytes = 64 * 1024;
+
+static void ResetOutputRing(PacketRing& ring, uint32_t mtu) {
+    const size_t slotSize = std::max<size_t>(std::min<size_t>(mtu, kOutputPacketMax), 1280);
+    ring.Reset(kOutputRingSlots, slotSize);
+}
+
+// lwIP output callback body: a full ring drops the packet, TCP resends it
+static void QueueOutput(PacketRing& ring, const uint8_t* data, size_t len) {
+    MetricsCounters& counters = metrics::Counters();
+    if (!ring.Push(data, len)) {
+        metrics::Add(counters.tunnel.dropsOut);
+        INST_LOG_DEBUG(TAG, "Tunnel output ring full, dropping %zu-byte packet", len);
+        return;
+    }
+    metrics::Add(counters.tunnel.packetsOut);
+    metrics::Add(counters.tunnel.bytesOut, len);
+}
+
+// Create a non-blocking loopback UDP socket connected to itself. Sending a
+// byte to it wakes a WaitForEvents() / WaitForIo() poll.
+static int CreateWakeSocket() {
+    socket_t s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == SOCKET_INVALID) return -1;
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addrLen = sizeof(addr);
+    if (bind(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(s, reinterpret_cast<struct sockaddr*>(&addr), &addrLen) != 0 ||
+        connect(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        CLOSE_SOCKET(s);
+        return -1;
+    }
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    return static_cast<int>(s);
+}
+
+static void DrainWakeSocket(int fd) {
+    char buf[64];
+    while (recv(static_cast<socket_t>(fd), buf, sizeof(buf), 0) > 0) {}
+}
+
 static bool ConnectIDeviceWithTimeout(idevice_t device, uint16_t port,
                                       std::chrono::milliseconds timeout,
                                       idevice_connection_t* outConn,
@@ -72,6 +157,14 @@ static bool ConnectIDeviceWithTimeout(idevice_t device, uint16_t port,
     return (result.first == IDEVICE_E_SUCCESS && result.second != nullptr);
 }
 
+// SO_RCVTIMEO of the CDTunnel stream once the handshake is done: SSL reads
+// return this often while idle so the reader notices Close()
+static constexpr int kCDTunnelReadTimeoutMs = 50;
+
+// SSL errors without data in a row while the socket has bytes waiting: a
+// TLS failure rather than an idle timeout (about 1 s at the read timeout)
+static constexpr int kMaxCDTunnelSslErrors = 20;
+
 static void SetIDeviceRecvTimeoutMs(idevice_connection_t conn, int timeoutMs) {
     if (!conn || timeoutMs < 0) return;
     int sockFd = -1;
@@ -108,10 +201,21 @@ QUICTunnel::QUICTunnel() {
 #endif
     std::memset(&m_fakeLocalAddr, 0, sizeof(m_fakeLocalAddr));
     std::memset(&m_fakeRemoteAddr, 0, sizeof(m_fakeRemoteAddr));
+    m_wakeFd = CreateWakeSocket();
+    m_ioWakeFd = CreateWakeSocket();
+    if (m_wakeFd < 0 || m_ioWakeFd < 0) {
+        INST_LOG_WARN(TAG, "Failed to create wake socket, tunnel loops will poll every 1 ms");
+    }
 }
 
 QUICTunnel::~QUICTunnel() {
     Close();
+    for (int* fd : {&m_wakeFd, &m_ioWakeFd}) {
+        if (*fd >= 0) {
+            CLOSE_SOCKET(static_cast<socket_t>(*fd));
+            *fd = -1;
+        }
+    }
 #ifdef _WIN32
     WSACleanup();
 #endif
@@ -149,27 +253,26 @@ int QUICTunnel::QuicCallback(picoquic_cnx_t* cnx, uint64_t stream_id,
         break;
 
     case picoquic_callback_datagram: {
-        // Incoming datagram = IPv6 packet from device -> inject into lwIP
+        // Incoming datagram = IPv6 packet from device -> queue for lwIP
         if (bytes && length > 0) {
-            ctx->tunnel->m_network.InjectPacket(bytes, length);
+            ctx->tunnel->QueueInbound(bytes, length);
         }
         break;
     }
 
     case picoquic_callback_prepare_datagram: {
         // picoquic asks us to provide a datagram to send
-        std::lock_guard<std::mutex> lock(ctx->tunnel->m_dgMutex);
-        if (!ctx->tunnel->m_outgoingDatagrams.empty()) {
-            auto& dgram = ctx->tunnel->m_outgoingDatagrams.front();
-            if (dgram.size() <= length) {
+        PacketRing& ring = ctx->tunnel->m_outgoingDatagrams;
+        size_t dgramLen = 0;
+        if (const uint8_t* dgram = ring.Front(dgramLen)) {
+            if (dgramLen <= length) {
                 uint8_t* buf = picoquic_provide_datagram_buffer_ex(
-                    bytes, dgram.size(), picoquic_datagram_active_any_path);
+                    bytes, dgramLen, picoquic_datagram_active_any_path);
                 if (buf) {
-                    std::memcpy(buf, dgram.data(), dgram.size());
+                    std::memcpy(buf, dgram, dgramLen);
                 }
             }
-            ctx->tunnel->m_outgoingDatagrams.erase(
-                ctx->tunnel->m_outgoingDatagrams.begin());
+            ring.Pop();
         } else {
             // Nothing to send - mark inactive
             picoquic_provide_datagram_buffer_ex(
@@ -188,11 +291,13 @@ int QUICTunnel::QuicCallback(picoquic_cnx_t* cnx, uint64_t stream_id,
     case picoquic_callback_application_close:
         INST_LOG_WARN(TAG, "QUIC connection closed");
         ctx->tunnel->m_active.store(false);
+        ctx->tunnel->Wake();
         break;
 
     case picoquic_callback_stateless_reset:
         INST_LOG_WARN(TAG, "QUIC stateless reset");
         ctx->tunnel->m_active.store(false);
+        ctx->tunnel->Wake();
         break;
 
     default:
@@ -418,8 +523,8 @@ Error QUICTunnel::Connect(const std::string& address, uint16_t tunnelPort) {
                 reinterpret_cast<struct sockaddr*>(&destAddr),
                 0, 0, currentTime);
         } else {
-            // No data available - sleep briefly to avoid busy loop
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            // No data available - sleep until a packet arrives or picoquic's next timer
+            WaitForIo(QuicWakeTimeoutMs(kHandshakeMaxWaitMs));
         }
 
         // Check for connection failure
@@ -467,20 +572,16 @@ Error QUICTunnel::Connect(const std::string& address, uint16_t tunnelPort) {
     }
 
     // Set output callback: lwIP packets -> QUIC datagrams
+    ResetOutputRing(m_outgoingDatagrams, m_params.mtu);
+    // PacketIoLoop marks picoquic's datagrams ready (picoquic is only
+    // touched on the I/O thread)
     m_network.SetOutputCallback([this](const uint8_t* data, size_t len) {
-        {
-            std::lock_guard<std::mutex> lock(m_dgMutex);
-            m_outgoingDatagrams.emplace_back(data, data + len);
-        }
-        // Signal picoquic that datagrams are ready
-        if (m_cnx) {
-            picoquic_mark_datagram_ready(m_cnx, 1);
-        }
+        QueueOutput(m_outgoingDatagrams, data, len);
+        WakeIo();
     });
 
-    // Start forwarding thread
-    m_active.store(true);
-    m_forwardThread = std::thread([this]() { ForwardLoop(); });
+    // Start the forwarding and packet I/O threads
+    StartLoops();
 
     INST_LOG_INFO(TAG, "QUIC tunnel active: client=%s server=%s rsdPort=%u",
                  m_params.clientAddress.c_str(), m_params.serverAddress.c_str(),
@@ -538,7 +639,10 @@ Error QUICTunnel::ConnectViaCoreDeviceProxy(idevice_t device) {
     // 3. Enable SSL if the service descriptor requires it
     if (needSsl) {
         INST_LOG_INFO(TAG, "ConnectViaCoreDeviceProxy: starting SSL handshake...");
-        ierr = idevice_connection_enable_ssl(m_idevConn);
+        {
+            TraceSpan span("tunnel", "SSL handshake", "CoreDeviceProxy");
+            ierr = idevice_connection_enable_ssl(m_idevConn);
+        }
         if (ierr != IDEVICE_E_SUCCESS) {
             INST_LOG_ERROR(TAG, "ConnectViaCoreDeviceProxy: SSL handshake failed: %d", ierr);
             idevice_disconnect(m_idevConn);
@@ -564,8 +668,9 @@ Error QUICTunnel::ConnectViaCoreDeviceProxy(idevice_t device) {
 
     // After handshake, keep read timeouts short so ForwardLoop can continue
     // draining lwIP output (SYN/data) instead of stalling in SSL_read for seconds.
-    SetIDeviceRecvTimeoutMs(m_idevConn, 50);
-    INST_LOG_DEBUG(TAG, "ConnectViaCoreDeviceProxy: SO_RCVTIMEO=50ms set for runtime forwarding");
+    SetIDeviceRecvTimeoutMs(m_idevConn, kCDTunnelReadTimeoutMs);
+    INST_LOG_DEBUG(TAG, "ConnectViaCoreDeviceProxy: SO_RCVTIMEO=%dms set for runtime forwarding",
+                   kCDTunnelReadTimeoutMs);
 
     // 5. Initialize lwIP network with tunnel parameters
     err = m_network.Init(m_params.clientAddress, m_params.serverAddress, m_params.mtu);
@@ -577,16 +682,21 @@ Error QUICTunnel::ConnectViaCoreDeviceProxy(idevice_t device) {
     }
 
     // 6. Set output callback: lwIP -> CDTunnel output queue (ForwardLoop sends it)
+    ResetOutputRing(m_cdOutputRing, m_params.mtu);
     m_network.SetOutputCallback([this](const uint8_t* data, size_t len) {
-        std::lock_guard<std::mutex> lock(m_cdOutputMutex);
-        m_cdOutputQueue.emplace_back(data, data + len);
+        QueueOutput(m_cdOutputRing, data, len);
+        WakeIo();
     });
 
     m_isCDTunnel = true;
+    m_cdSsl = needSsl;
+    m_streamClosed.store(false);
 
-    // 7. Start forwarding thread
-    m_active.store(true);
-    m_forwardThread = std::thread([this]() { ForwardLoop(); });
+    // 7. Start the forwarding and packet I/O threads (and the SSL stream reader)
+    StartLoops();
+    if (m_cdSsl) {
+        m_cdReaderThread = std::thread([this]() { CDTunnelReadLoop(); });
+    }
 
     INST_LOG_INFO(TAG, "ConnectViaCoreDeviceProxy: CDTunnel active: client=%s server=%s rsd=%u",
                  m_params.clientAddress.c_str(), m_params.serverAddress.c_str(),
@@ -598,6 +708,7 @@ Error QUICTunnel::ConnectViaCoreDeviceProxy(idevice_t device) {
 // ---------- PerformCDTunnelHandshake ----------
 
 Error QUICTunnel::PerformCDTunnelHandshake() {
+    TraceSpan span("tunnel", "CDTunnel handshake");
     INST_LOG_INFO(TAG, "CDTunnel: starting handshake");
 
     // Request: "CDTunnel\0" (9 bytes) + 1-byte JSON length + JSON
@@ -855,6 +966,7 @@ Error QUICTunnel::ConnectViaUSB(idevice_t device) {
     }
 
     m_isUsb = true;
+    m_streamClosed.store(false);
 
     // 3. Set up fake addresses for picoquic (stream transport needs nominal addrs)
     auto* local6 = reinterpret_cast<struct sockaddr_in6*>(&m_fakeLocalAddr);
@@ -971,7 +1083,7 @@ Error QUICTunnel::ConnectViaUSB(idevice_t device) {
                 reinterpret_cast<struct sockaddr*>(&m_fakeLocalAddr),
                 0, 0, currentTime);
         } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            WaitForIo(QuicWakeTimeoutMs(kHandshakeMaxWaitMs));
         }
 
         picoquic_state_enum state = picoquic_get_cnx_state(m_cnx);
@@ -1019,19 +1131,14 @@ Error QUICTunnel::ConnectViaUSB(idevice_t device) {
     }
 
     // Set output callback: lwIP packets -> QUIC datagrams
+    ResetOutputRing(m_outgoingDatagrams, m_params.mtu);
     m_network.SetOutputCallback([this](const uint8_t* data, size_t len) {
-        {
-            std::lock_guard<std::mutex> lock(m_dgMutex);
-            m_outgoingDatagrams.emplace_back(data, data + len);
-        }
-        if (m_cnx) {
-            picoquic_mark_datagram_ready(m_cnx, 1);
-        }
+        QueueOutput(m_outgoingDatagrams, data, len);
+        WakeIo();
     });
 
-    // 8. Start forwarding thread
-    m_active.store(true);
-    m_forwardThread = std::thread([this]() { ForwardLoop(); });
+    // 8. Start the forwarding and packet I/O threads
+    StartLoops();
 
     INST_LOG_INFO(TAG, "ConnectViaUSB: tunnel active: client=%s server=%s rsd=%u",
                  m_params.clientAddress.c_str(), m_params.serverAddress.c_str(),
@@ -1074,14 +1181,8 @@ Error QUICTunnel::SendFramed(const uint8_t* buf, size_t len) {
 }
 
 int QUICTunnel::RecvFramedPartial(uint8_t* outBuf, size_t maxLen) {
-    // Try to receive more data (non-blocking: timeout=0)
-    uint8_t tmp[4096];
-    uint32_t received = 0;
-    idevice_error_t err = idevice_connection_receive_timeout(
-        m_idevConn, reinterpret_cast<char*>(tmp), sizeof(tmp), &received, 0);
-    if (err == IDEVICE_E_SUCCESS && received > 0) {
-        m_streamRecvBuf.insert(m_streamRecvBuf.end(), tmp, tmp + received);
-    }
+    // Take whatever has arrived (non-blocking)
+    ReadStream(m_streamRecvBuf);
 
     if (m_streamRecvBuf.size() < 4) return 0;
 
@@ -1147,8 +1248,11 @@ int QUICTunnel::MakeLoopbackPair(int fds[2]) {
 // ---------- SubmitToLoop / DrainTasks / DrainBridges ----------
 
 void QUICTunnel::SubmitToLoop(std::function<void()> fn) {
-    std::lock_guard<std::mutex> lock(m_taskMutex);
-    m_pendingTasks.push_back(std::move(fn));
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_pendingTasks.push_back(std::move(fn));
+    }
+    Wake();
 }
 
 void QUICTunnel::DrainTasks() {
@@ -1160,23 +1264,486 @@ void QUICTunnel::DrainTasks() {
     for (auto& fn : tasks) fn();
 }
 
-void QUICTunnel::DrainBridges() {
+bool QUICTunnel::DrainBridges() {
+    bool more = false;
     std::lock_guard<std::mutex> lock(m_bridgeMutex);
-    for (auto& bridge : m_bridges) {
-        if (!bridge->connected.load() || !bridge->lwipConn) continue;
-        if (bridge->internalFd < 0) continue;
+    for (auto it = m_bridges.begin(); it != m_bridges.end();) {
+        auto& bridge = *it;
+        if (!bridge->connected.load() || !bridge->lwipConn || bridge->internalFd < 0) {
+            ++it;
+            continue;
+        }
+
+        // Device -> caller: write what lwIP received; a full socket keeps
+        // the rest queued and the TCP window closed
+        bool closed = !FlushBridgeRx(*bridge, more);
+        if (!closed && bridge->rxPending.empty() && bridge->lwipConn->HasFailed()) {
+            // The device closed the connection: the caller reads EOF
+            closed = true;
+        }
 
-        uint8_t buf[4096];
-        for (;;) {
+        // Caller -> device: read only what lwIP can take now, so nothing
+        // read from the socket is dropped and one bridge cannot take the
+        // whole pass
+        size_t budget = closed ? 0 : std::min(bridge->lwipConn->SendSpace(), kFairShareBytes);
+        while (budget > 0) {
+            uint8_t buf[16384];
+            const size_t want = std::min(budget, sizeof(buf));
 #ifdef _WIN32
             int n = ::recv(static_cast<SOCKET>(bridge->internalFd),
-                           reinterpret_cast<char*>(buf), sizeof(buf), 0);
+                           reinterpret_cast<char*>(buf), static_cast<int>(want), 0);
+#else
+            ssize_t n = ::recv(bridge->internalFd, buf, want, MSG_DONTWAIT);
+#endif
+            if (n > 0) {
+                bridge->lwipConn->Send(buf, static_cast<size_t>(n));
+                budget -= static_cast<size_t>(n);
+                if (budget == 0) more = true;   // may have more; next pass
+                continue;
+            }
+            // EOF: the caller closed its end (it would stay readable forever)
+            closed = n == 0 || !SOCKET_WOULD_BLOCK;
+            break;
+        }
+        if (!closed) {
+            ++it;
+            continue;
+        }
+
+        INST_LOG_DEBUG(TAG, "Tunnel socket fd=%d closed", bridge->externalFd);
+        bridge->lwipConn->Close();          // detaches the callbacks that queue rxPending
+        FreeBridgeRx(*bridge);
+        CLOSE_SOCKET(static_cast<socket_t>(bridge->internalFd));
+        bridge->internalFd = -1;
+        bridge->externalFd = -1;            // the caller's socket
+        it = m_bridges.erase(it);
+    }
+    return more;
+}
+
+bool QUICTunnel::FlushBridgeRx(SocketBridge& bridge, bool& more) {
+    size_t written = 0;
+    while (!bridge.rxPending.empty() && written < kFairShareBytes) {
+        struct pbuf* p = bridge.rxPending.front();
+
+        // Skip the pbufs of the chain already written
+        struct pbuf* q = p;
+        size_t offset = bridge.rxOffset;
+        while (q && offset >= q->len) {
+            offset -= q->len;
+            q = q->next;
+        }
+        if (!q) {
+            bridge.rxPending.pop_front();
+            bridge.rxOffset = 0;
+            pbuf_free(p);
+            continue;
+        }
+
+        const uint8_t* data = static_cast<const uint8_t*>(q->payload) + offset;
+        const size_t len = std::min<size_t>(q->len - offset, kFairShareBytes - written);
+#ifdef _WIN32
+        int n = ::send(static_cast<SOCKET>(bridge.internalFd),
+                       reinterpret_cast<const char*>(data), static_cast<int>(len), 0);
 #else
-            ssize_t n = ::recv(bridge->internalFd, buf, sizeof(buf), MSG_DONTWAIT);
+        ssize_t n = ::send(bridge.internalFd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
 #endif
+        if (n <= 0) {
+            if (n < 0 && SOCKET_WOULD_BLOCK) break;   // WaitForEvents() waits for POLLOUT
+            return false;
+        }
+        bridge.rxOffset += static_cast<size_t>(n);
+        written += static_cast<size_t>(n);
+    }
+    if (written > 0) bridge.lwipConn->Recved(written);
+    if (written >= kFairShareBytes && !bridge.rxPending.empty()) more = true;
+    return true;
+}
+
+void QUICTunnel::FreeBridgeRx(SocketBridge& bridge) {
+    for (struct pbuf* p : bridge.rxPending) pbuf_free(p);
+    bridge.rxPending.clear();
+    bridge.rxOffset = 0;
+}
+
+// ---------- Inbound packets ----------
+
+void QUICTunnel::QueueInbound(const uint8_t* data, size_t len) {
+    uint8_t* buffer = UserspaceNetwork::AcquireRxBuffer(len);
+    if (!buffer) {
+        metrics::Add(metrics::Counters().tunnel.dropsIn);
+        INST_LOG_WARN(TAG, "Dropping %zu-byte inbound packet", len);
+        return;
+    }
+    std::memcpy(buffer, data, len);
+    PushInbound(buffer, len);
+}
+
+void QUICTunnel::PushInbound(uint8_t* buffer, size_t len) {
+    MetricsCounters& counters = metrics::Counters();
+    metrics::Add(counters.tunnel.packetsIn);
+    metrics::Add(counters.tunnel.bytesIn, len);
+    {
+        std::lock_guard<std::mutex> lock(m_rxMutex);
+        m_rxPackets.emplace_back(buffer, len);
+    }
+    Wake();
+}
+
+bool QUICTunnel::DrainInbound() {
+    {
+        std::lock_guard<std::mutex> lock(m_rxMutex);
+        m_rxBatch.swap(m_rxPackets);
+    }
+    const bool any = !m_rxBatch.empty();
+    for (const auto& [packet, len] : m_rxBatch) {
+        m_network.InjectRxBuffer(packet, len);
+    }
+    m_rxBatch.clear();
+    return any;
+}
+
+void QUICTunnel::ReleaseInbound() {
+    std::lock_guard<std::mutex> lock(m_rxMutex);
+    for (const auto& entry : m_rxPackets) {
+        UserspaceNetwork::ReleaseRxBuffer(entry.first);
+    }
+    m_rxPackets.clear();
+}
+
+// ---------- Wake / WaitForEvents / WaitForIo / ReadStream ----------
+
+// The pending flag is cleared after each poll, before the loop looks for
+// work, so an event either is seen by that pass or sends a new wake byte
+static void SendWake(int fd, std::atomic<bool>& pending) {
+    if (fd < 0 || pending.exchange(true)) return;
+    const char b = 1;
+    send(static_cast<socket_t>(fd), &b, 1, 0);
+}
+
+static void PollWake(std::vector<pollfd_t>& fds, int wakeFd, std::atomic<bool>& pending,
+                     int timeoutMs) {
+    if (wakeFd < 0) {
+        // Without a wake socket nothing interrupts the poll; keep it short
+        timeoutMs = std::min(timeoutMs, 1);
+    }
+    if (timeoutMs > 0 && !fds.empty()) {
+        POLL_SOCKETS(fds.data(), static_cast<decltype(fds.size())>(fds.size()), timeoutMs);
+    } else if (timeoutMs > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    }
+    pending.store(false);
+    if (wakeFd >= 0) DrainWakeSocket(wakeFd);
+}
+
+void QUICTunnel::Wake() {
+    SendWake(m_wakeFd, m_wakePending);
+}
+
+void QUICTunnel::WakeIo() {
+    SendWake(m_ioWakeFd, m_ioWakePending);
+}
+
+void QUICTunnel::WaitForEvents(int timeoutMs) {
+    std::vector<pollfd_t> fds;
+    auto watch = [&fds](int fd, short events) {
+        pollfd_t p = {};
+        p.fd = static_cast<socket_t>(fd);
+        p.events = events;
+        fds.push_back(p);
+    };
+    if (m_wakeFd >= 0) watch(m_wakeFd, POLLIN);
+    {
+        std::lock_guard<std::mutex> lock(m_bridgeMutex);
+        for (const auto& bridge : m_bridges) {
+            if (!bridge->connected.load() || !bridge->lwipConn || bridge->internalFd < 0) continue;
+            // Readable only matters while lwIP can take more; writable
+            // while received data waits for the caller's socket
+            short events = 0;
+            if (bridge->lwipConn->SendSpace() > 0) events |= POLLIN;
+            if (!bridge->rxPending.empty()) events |= POLLOUT;
+            if (events) watch(bridge->internalFd, events);
+        }
+    }
+    PollWake(fds, m_wakeFd, m_wakePending, timeoutMs);
+}
+
+void QUICTunnel::WaitForIo(int timeoutMs) {
+    std::vector<pollfd_t> fds;
+    auto watch = [&fds](int fd) {
+        pollfd_t p = {};
+        p.fd = static_cast<socket_t>(fd);
+        p.events = POLLIN;
+        fds.push_back(p);
+    };
+    if (m_ioWakeFd >= 0) watch(m_ioWakeFd);
+    if (m_udpSocket >= 0) watch(m_udpSocket);
+    int streamFd = -1;
+    if (m_idevConn && !m_cdSsl && !m_streamClosed.load() &&
+        idevice_connection_get_fd(m_idevConn, &streamFd) == IDEVICE_E_SUCCESS && streamFd >= 0) {
+        watch(streamFd);
+    }
+    PollWake(fds, m_ioWakeFd, m_ioWakePending, timeoutMs);
+}
+
+int QUICTunnel::QuicWakeTimeoutMs(int maxMs) const {
+    const uint64_t now = picoquic_current_time();
+    const uint64_t wake = picoquic_get_next_wake_time(m_quic, now);
+    if (wake <= now) return 0;
+    // Round up: waking before the timer is due would only spin
+    const uint64_t ms = (wake - now + 999) / 1000;
+    return static_cast<int>(std::min<uint64_t>(ms, static_cast<uint64_t>(maxMs)));
+}
+
+void QUICTunnel::SendUdpPackets(socklen_t peerLen) {
+    const uint64_t currentTime = picoquic_current_time();
+#ifdef __linux__
+    m_udpBatchBuf.resize(kUdpBatchSize * PICOQUIC_MAX_PACKET_SIZE);
+    struct mmsghdr msgs[kUdpBatchSize];
+    struct iovec iovs[kUdpBatchSize];
+    struct sockaddr_storage peers[kUdpBatchSize];
+
+    bool hasSomethingToSend = true;
+    while (hasSomethingToSend) {
+        // Fill a batch, then hand it to the kernel in one call
+        unsigned int count = 0;
+        while (count < kUdpBatchSize) {
+            uint8_t* slot = m_udpBatchBuf.data() + count * PICOQUIC_MAX_PACKET_SIZE;
+            struct sockaddr_storage addrFrom = {};
+            int ifIndex = 0;
+            size_t sendLength = 0;
+            picoquic_connection_id_t logCid = {};
+            picoquic_cnx_t* lastCnx = nullptr;
+            peers[count] = {};
+
+            int ret = picoquic_prepare_next_packet(m_quic, currentTime,
+                slot, PICOQUIC_MAX_PACKET_SIZE, &sendLength,
+                &peers[count], &addrFrom, &ifIndex, &logCid, &lastCnx);
+            if (ret != 0 || sendLength == 0) {
+                hasSomethingToSend = false;
+                break;
+            }
+
+            iovs[count].iov_base = slot;
+            iovs[count].iov_len = sendLength;
+            msgs[count] = {};
+            msgs[count].msg_hdr.msg_name = &peers[count];
+            msgs[count].msg_hdr.msg_namelen = peerLen;
+            msgs[count].msg_hdr.msg_iov = &iovs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            count++;
+        }
+
+        unsigned int sent = 0;
+        while (sent < count) {
+            int n = sendmmsg(m_udpSocket, msgs + sent, count - sent, 0);
+            // Full socket buffer: QUIC loss recovery resends what is dropped
             if (n <= 0) break;
-            bridge->lwipConn->Send(buf, static_cast<size_t>(n));
+            sent += static_cast<unsigned int>(n);
+        }
+    }
+#else
+    uint8_t sendBuffer[PICOQUIC_MAX_PACKET_SIZE];
+    for (;;) {
+        struct sockaddr_storage addrTo = {}, addrFrom = {};
+        int ifIndex = 0;
+        size_t sendLength = 0;
+        picoquic_connection_id_t logCid = {};
+        picoquic_cnx_t* lastCnx = nullptr;
+
+        int ret = picoquic_prepare_next_packet(m_quic, currentTime,
+            sendBuffer, sizeof(sendBuffer), &sendLength,
+            &addrTo, &addrFrom, &ifIndex, &logCid, &lastCnx);
+        if (ret != 0 || sendLength == 0) break;
+
+        sendto(static_cast<socket_t>(m_udpSocket),
+               reinterpret_cast<const char*>(sendBuffer),
+               static_cast<int>(sendLength), 0,
+               reinterpret_cast<struct sockaddr*>(&addrTo),
+               static_cast<int>(peerLen));
+    }
+#endif
+}
+
+void QUICTunnel::ReceiveUdpPackets(struct sockaddr_storage& localAddr) {
+#ifdef __linux__
+    m_udpBatchBuf.resize(kUdpBatchSize * PICOQUIC_MAX_PACKET_SIZE);
+    struct mmsghdr msgs[kUdpBatchSize];
+    struct iovec iovs[kUdpBatchSize];
+    struct sockaddr_storage froms[kUdpBatchSize];
+
+    for (;;) {
+        for (unsigned int i = 0; i < kUdpBatchSize; i++) {
+            iovs[i].iov_base = m_udpBatchBuf.data() + i * PICOQUIC_MAX_PACKET_SIZE;
+            iovs[i].iov_len = PICOQUIC_MAX_PACKET_SIZE;
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = &froms[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = recvmmsg(m_udpSocket, msgs, kUdpBatchSize, MSG_DONTWAIT, nullptr);
+        if (n <= 0) break;
+
+        const uint64_t currentTime = picoquic_current_time();
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].msg_len == 0) continue;
+            picoquic_incoming_packet(m_quic, static_cast<uint8_t*>(iovs[i].iov_base),
+                msgs[i].msg_len,
+                reinterpret_cast<struct sockaddr*>(&froms[i]),
+                reinterpret_cast<struct sockaddr*>(&localAddr),
+                0, 0, currentTime);
+        }
+        // A short batch means the socket is drained
+        if (static_cast<unsigned int>(n) < kUdpBatchSize) break;
+    }
+#else
+    uint8_t recvBuffer[PICOQUIC_MAX_PACKET_SIZE];
+    for (;;) {
+        struct sockaddr_storage recvFrom = {};
+        socklen_t fromLen = sizeof(recvFrom);
+#ifdef _WIN32
+        int recvLen = recvfrom(static_cast<socket_t>(m_udpSocket),
+            reinterpret_cast<char*>(recvBuffer), sizeof(recvBuffer), 0,
+            reinterpret_cast<struct sockaddr*>(&recvFrom), &fromLen);
+#else
+        ssize_t recvLen = recvfrom(m_udpSocket,
+            recvBuffer, sizeof(recvBuffer), 0,
+            reinterpret_cast<struct sockaddr*>(&recvFrom), &fromLen);
+#endif
+        if (recvLen <= 0) break;
+
+        picoquic_incoming_packet(m_quic, recvBuffer, static_cast<size_t>(recvLen),
+            reinterpret_cast<struct sockaddr*>(&recvFrom),
+            reinterpret_cast<struct sockaddr*>(&localAddr),
+            0, 0, picoquic_current_time());
+    }
+#endif
+}
+
+void QUICTunnel::ReadStream(std::vector<uint8_t>& buf) {
+    // SSL CDTunnel packets come from CDTunnelReadLoop() instead
+    if (m_cdSsl || !m_idevConn || m_streamClosed.load()) return;
+
+    int fd = -1;
+    if (idevice_connection_get_fd(m_idevConn, &fd) != IDEVICE_E_SUCCESS || fd < 0) return;
+    for (;;) {
+        // Plain connections return whatever is buffered; only read when
+        // the fd says there is something (a zero timeout would block)
+        pollfd_t p = {};
+        p.fd = static_cast<socket_t>(fd);
+        p.events = POLLIN;
+        if (POLL_SOCKETS(&p, 1, 0) <= 0) return;
+
+        uint8_t tmp[4096];
+        uint32_t recvd = 0;
+        idevice_error_t err = idevice_connection_receive_timeout(m_idevConn,
+            reinterpret_cast<char*>(tmp), sizeof(tmp), &recvd, 1);
+        if (recvd > 0) {
+            buf.insert(buf.end(), tmp, tmp + recvd);
+            if (recvd == sizeof(tmp)) continue;
+            return;
+        }
+        if (err != IDEVICE_E_TIMEOUT && err != IDEVICE_E_SUCCESS) {
+            // Readable without data: the device closed the stream
+            INST_LOG_WARN(TAG, "Tunnel stream closed by device (err=%d)", static_cast<int>(err));
+            m_streamClosed.store(true);
+        }
+        return;
+    }
+}
+
+// State of the socket under an SSL stream that returned no data: -1 closed
+// or reset, 1 bytes waiting, 0 idle
+static int CDTunnelSocketState(idevice_connection_t conn) {
+    int fd = -1;
+    if (idevice_connection_get_fd(conn, &fd) != IDEVICE_E_SUCCESS || fd < 0) return -1;
+    pollfd_t p = {};
+    p.fd = static_cast<socket_t>(fd);
+    p.events = POLLIN;
+    const int ready = POLL_SOCKETS(&p, 1, 0);
+    if (ready < 0 || (p.revents & (POLLERR | POLLNVAL))) return -1;
+    if (ready == 0) return 0;
+    char byte;
+    const auto n = ::recv(static_cast<socket_t>(fd), &byte, 1, MSG_PEEK);
+    if (n == 0) return -1;                       // orderly shutdown
+    if (n < 0) return SOCKET_WOULD_BLOCK ? 0 : -1;
+    return 1;
+}
+
+bool QUICTunnel::ReadStreamExact(uint8_t* buf, size_t len) {
+    size_t got = 0;
+    int sslErrors = 0;
+    while (got < len) {
+        if (!m_active.load()) return false;
+        uint32_t recvd = 0;
+        // SSL reads ignore the timeout argument and return every SO_RCVTIMEO
+        // while idle, so Close() is noticed
+        idevice_error_t err = idevice_connection_receive_timeout(m_idevConn,
+            reinterpret_cast<char*>(buf + got), static_cast<uint32_t>(len - got), &recvd,
+            kCDTunnelReadTimeoutMs);
+        got += recvd;
+        if (recvd > 0 || err == IDEVICE_E_SUCCESS || err == IDEVICE_E_TIMEOUT) {
+            sslErrors = 0;
+            continue;
+        }
+        if (err == IDEVICE_E_SSL_ERROR) {
+            // An idle read timeout also surfaces as an SSL error; the socket
+            // tells it apart from a closed or reset stream, and data that
+            // SSL keeps failing on is a broken TLS session
+            const int state = CDTunnelSocketState(m_idevConn);
+            if (state == 0) {
+                sslErrors = 0;
+                continue;
+            }
+            if (state > 0 && ++sslErrors < kMaxCDTunnelSslErrors) continue;
+        }
+        INST_LOG_WARN(TAG, "CDTunnel: stream closed by device (err=%d)", static_cast<int>(err));
+        return false;
+    }
+    return true;
+}
+
+void QUICTunnel::CDTunnelReadLoop() {
+    // SSL reads wait for the full requested length, so read exactly one
+    // IPv6 packet at a time: the 40-byte header, then its payload, into a
+    // receive buffer lwIP will reference directly. Sends happen on
+    // PacketIoLoop meanwhile, as DTXTransport does for SSL.
+    std::vector<uint8_t> discard;
+    while (m_active.load()) {
+        uint8_t header[40];
+        if (!ReadStreamExact(header, sizeof(header))) break;
+        if ((header[0] & 0xF0) != 0x60) {
+            // Not an IPv6 packet — stream is corrupt
+            INST_LOG_ERROR(TAG, "CDTunnel: invalid IPv6 packet (byte0=0x%02x), closing", header[0]);
+            m_active.store(false);
+            Wake();
+            WakeIo();
+            return;
+        }
+        const size_t payloadLen = (static_cast<size_t>(header[4]) << 8) | header[5];
+        const size_t totalLen = sizeof(header) + payloadLen;
+
+        uint8_t* packet = UserspaceNetwork::AcquireRxBuffer(totalLen);
+        if (!packet) {
+            // Larger than a pbuf can describe: skip it, TCP retransmits
+            metrics::Add(metrics::Counters().tunnel.dropsIn);
+            INST_LOG_WARN(TAG, "CDTunnel: dropping %zu-byte packet", totalLen);
+            discard.resize(payloadLen);
+            if (!ReadStreamExact(discard.data(), payloadLen)) break;
+            continue;
         }
+        std::memcpy(packet, header, sizeof(header));
+        if (payloadLen > 0 && !ReadStreamExact(packet + sizeof(header), payloadLen)) {
+            UserspaceNetwork::ReleaseRxBuffer(packet);
+            break;
+        }
+        PushInbound(packet, totalLen);
+    }
+    if (m_active.load()) {
+        m_streamClosed.store(true);
+        WakeIo();
     }
 }
 
@@ -1194,29 +1761,108 @@ int QUICTunnel::CreateTunnelSocket(const std::string& destIPv6, uint16_t port) {
         return -1;
     }
 
-    // Make fds[1] (internal/bridge side) non-blocking
+    if (!AttachBridge(fds[1], fds[0], destIPv6, port)) {
+        CLOSE_SOCKET(static_cast<socket_t>(fds[0]));
+        CLOSE_SOCKET(static_cast<socket_t>(fds[1]));
+        return -1;
+    }
+
+    INST_LOG_INFO(TAG, "CreateTunnelSocket: connected to [%s]:%u -> fd=%d",
+                 destIPv6.c_str(), port, fds[0]);
+    return fds[0];
+}
+
+bool QUICTunnel::BridgeSocket(int socketFd, const std::string& destIPv6, uint16_t port) {
+    if (!m_active.load() || !m_network.IsInitialized()) {
+        INST_LOG_ERROR(TAG, "BridgeSocket: tunnel not active");
+        CLOSE_SOCKET(static_cast<socket_t>(socketFd));
+        return false;
+    }
+
+    if (!AttachBridge(socketFd, -1, destIPv6, port)) {
+        CLOSE_SOCKET(static_cast<socket_t>(socketFd));
+        return false;
+    }
+
+    INST_LOG_INFO(TAG, "BridgeSocket: fd=%d bridged to [%s]:%u", socketFd, destIPv6.c_str(), port);
+    return true;
+}
+
+bool QUICTunnel::AttachBridge(int internalFd, int externalFd, const std::string& destIPv6, uint16_t port) {
+    // The forwarding loop only does non-blocking I/O on internalFd
 #ifdef _WIN32
     u_long mode = 1;
-    ioctlsocket(static_cast<SOCKET>(fds[1]), FIONBIO, &mode);
+    ioctlsocket(static_cast<SOCKET>(internalFd), FIONBIO, &mode);
 #else
-    int flags = fcntl(fds[1], F_GETFL, 0);
-    fcntl(fds[1], F_SETFL, flags | O_NONBLOCK);
+    int flags = fcntl(internalFd, F_GETFL, 0);
+    fcntl(internalFd, F_SETFL, flags | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    // A peer that closed its end must not kill us with SIGPIPE
+    int noSigPipe = 1;
+    setsockopt(internalFd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
 #endif
 
     auto bridge = std::make_shared<SocketBridge>();
-    bridge->externalFd = fds[0];
-    bridge->internalFd = fds[1];
+    bridge->externalFd = externalFd;
+    bridge->internalFd = internalFd;
+
+    return OpenTcpConnection(destIPv6, port,
+        [this, bridge](const std::shared_ptr<UserspaceTcpConnection>& lwipConn) {
+            bridge->lwipConn = lwipConn;
+
+            // DrainBridges() writes the chains to internalFd as the peer
+            // reads, then reopens the window
+            std::weak_ptr<SocketBridge> weakBridge = bridge;
+            lwipConn->SetRecvPbufCallback([weakBridge](struct pbuf* p) {
+                if (auto b = weakBridge.lock()) {
+                    b->rxPending.push_back(p);
+                } else {
+                    pbuf_free(p);
+                }
+            });
+            bridge->connected.store(true);
+
+            std::lock_guard<std::mutex> bLock(m_bridgeMutex);
+            m_bridges.push_back(bridge);
+        });
+}
+
+// ---------- CreateTunnelStream ----------
+
+std::shared_ptr<TunnelStream> QUICTunnel::CreateTunnelStream(const std::string& destIPv6, uint16_t port) {
+    if (!m_active.load() || !m_network.IsInitialized()) {
+        INST_LOG_ERROR(TAG, "CreateTunnelStream: tunnel not active");
+        return nullptr;
+    }
+
+    // Written on the forwarding thread before OpenTcpConnection() returns
+    auto stream = std::make_shared<std::shared_ptr<TunnelStream>>();
+    const bool connected = OpenTcpConnection(destIPv6, port,
+        [this, stream](const std::shared_ptr<UserspaceTcpConnection>& lwipConn) {
+            *stream = std::shared_ptr<TunnelStream>(new TunnelStream(lwipConn, [this]() { Wake(); }));
+            (*stream)->Attach();
+            m_streams.push_back(*stream);
+        });
+    if (!connected) return nullptr;
+
+    INST_LOG_INFO(TAG, "CreateTunnelStream: connected to [%s]:%u", destIPv6.c_str(), port);
+    return *stream;
+}
 
+bool QUICTunnel::OpenTcpConnection(const std::string& destIPv6, uint16_t port,
+        std::function<void(const std::shared_ptr<UserspaceTcpConnection>&)> onConnected) {
     // Shared waiter for connection notification
     struct ConnWaiter {
         std::mutex mutex;
         std::condition_variable cv;
         bool connected = false;
         bool failed = false;
+        bool abandoned = false;     // the caller stopped waiting
     };
     auto waiter = std::make_shared<ConnWaiter>();
 
-    SubmitToLoop([this, destIPv6, port, bridge, waiter]() {
+    SubmitToLoop([this, destIPv6, port, waiter, onConnected = std::move(onConnected)]() {
         std::shared_ptr<UserspaceTcpConnection> lwipConn;
         Error err = m_network.TcpConnect(destIPv6, port, lwipConn);
         if (err != Error::Success) {
@@ -1226,41 +1872,32 @@ int QUICTunnel::CreateTunnelSocket(const std::string& destIPv6, uint16_t port) {
             return;
         }
 
-        bridge->lwipConn = lwipConn;
-
-        lwipConn->SetConnectedCallback([bridge, waiter](bool success) {
-            bridge->connected.store(success);
+        // The network keeps the connection alive; a strong capture here
+        // would be a cycle
+        std::weak_ptr<UserspaceTcpConnection> weakConn = lwipConn;
+        lwipConn->SetConnectedCallback([this, waiter, weakConn, onConnected](bool success) {
             std::lock_guard<std::mutex> lock(waiter->mutex);
-            if (success) waiter->connected = true;
-            else waiter->failed = true;
+            auto conn = weakConn.lock();
+            if (success && conn && !waiter->abandoned) {
+                onConnected(conn);
+                waiter->connected = true;
+            } else {
+                if (success && conn) {
+                    // Connected after the caller gave up; not from inside lwIP's callback
+                    SubmitToLoop([conn]() { conn->Close(); });
+                }
+                waiter->failed = true;
+            }
             waiter->cv.notify_one();
         });
 
-        int internalFd = bridge->internalFd;
-        lwipConn->SetRecvCallback([internalFd](const uint8_t* data, size_t len) {
-            ::send(
-#ifdef _WIN32
-                static_cast<SOCKET>(internalFd),
-                reinterpret_cast<const char*>(data),
-                static_cast<int>(len), 0
-#else
-                internalFd, data, len, 0
-#endif
-            );
-        });
-
-        lwipConn->SetErrorCallback([bridge, waiter](Error) {
+        lwipConn->SetErrorCallback([waiter](Error) {
             std::lock_guard<std::mutex> lock(waiter->mutex);
             if (!waiter->connected) {
                 waiter->failed = true;
                 waiter->cv.notify_one();
             }
         });
-
-        {
-            std::lock_guard<std::mutex> bLock(m_bridgeMutex);
-            m_bridges.push_back(bridge);
-        }
     });
 
     // Wait for connection (ForwardLoop will DrainTasks and trigger ConnectedCallback)
@@ -1268,32 +1905,32 @@ int QUICTunnel::CreateTunnelSocket(const std::string& destIPv6, uint16_t port) {
     bool ok = waiter->cv.wait_for(lock, std::chrono::seconds(10),
         [&waiter]() { return waiter->connected || waiter->failed; });
 
-    if (!ok || !waiter->connected || waiter->failed) {
-        if (!ok) {
-            INST_LOG_ERROR(TAG, "CreateTunnelSocket: connection to [%s]:%u timed out waiting for lwIP connect",
-                          destIPv6.c_str(), port);
-        } else {
-            INST_LOG_ERROR(TAG, "CreateTunnelSocket: connection to [%s]:%u failed (lwIP error callback)",
-                          destIPv6.c_str(), port);
-        }
-#ifdef _WIN32
-        closesocket(static_cast<SOCKET>(fds[0]));
-        closesocket(static_cast<SOCKET>(fds[1]));
-#else
-        ::close(fds[0]);
-        ::close(fds[1]);
-#endif
-        return -1;
+    if (!ok) {
+        waiter->abandoned = true;
+        INST_LOG_ERROR(TAG, "Connection to [%s]:%u timed out waiting for lwIP connect",
+                      destIPv6.c_str(), port);
+        return false;
+    }
+    if (!waiter->connected) {
+        INST_LOG_ERROR(TAG, "Connection to [%s]:%u failed (lwIP error callback)",
+                      destIPv6.c_str(), port);
+        return false;
     }
+    return true;
+}
 
-    INST_LOG_INFO(TAG, "CreateTunnelSocket: connected to [%s]:%u -> fd=%d",
-                 destIPv6.c_str(), port, fds[0]);
-    return fds[0];
+bool QUICTunnel::DrainStreams() {
+    bool more = false;
+    for (auto it = m_streams.begin(); it != m_streams.end();) {
+        it = (*it)->Service(kFairShareBytes, more) ? std::next(it) : m_streams.erase(it);
+    }
+    return more;
 }
 
 // ---------- PerformHandshake ----------
 
 Error QUICTunnel::PerformHandshake() {
+    TraceSpan span("tunnel", "QUIC tunnel handshake");
     auto* cbCtx = static_cast<QUICCallbackContext*>(picoquic_get_callback_context(m_cnx));
     if (!cbCtx) return Error::InternalError;
 
@@ -1366,7 +2003,7 @@ Error QUICTunnel::PerformHandshake() {
                     reinterpret_cast<struct sockaddr*>(&m_fakeLocalAddr),
                     0, 0, currentTime);
             } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                WaitForIo(QuicWakeTimeoutMs(kHandshakeMaxWaitMs));
             }
         } else {
             uint8_t recvBuffer[PICOQUIC_MAX_PACKET_SIZE];
@@ -1390,7 +2027,7 @@ Error QUICTunnel::PerformHandshake() {
                     reinterpret_cast<struct sockaddr*>(&destAddr),
                     0, 0, currentTime);
             } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                WaitForIo(QuicWakeTimeoutMs(kHandshakeMaxWaitMs));
             }
         }
     }
@@ -1485,9 +2122,42 @@ Error QUICTunnel::PerformHandshake() {
 
 // ---------- ForwardLoop ----------
 
+void QUICTunnel::StartLoops() {
+    m_active.store(true);
+    m_forwardThread = std::thread([this]() { ForwardLoop(); });
+    m_ioThread = std::thread([this]() { PacketIoLoop(); });
+}
+
 void QUICTunnel::ForwardLoop() {
     INST_LOG_INFO(TAG, "Forwarding thread started");
 
+    while (m_active.load()) {
+        // Process pending tasks from other threads (lwIP thread safety)
+        DrainTasks();
+
+        // Device -> lwIP: packets PacketIoLoop / the SSL reader received
+        bool busy = DrainInbound();
+
+        // Bridge OS sockets / in-process streams <-> lwIP TCP connections,
+        // a fair share each per pass
+        busy |= DrainBridges();
+        busy |= DrainStreams();
+
+        // Poll lwIP timers
+        m_network.Poll();
+
+        // Sleep until there is work or the next lwIP timer is due
+        const int timeoutMs = busy ? 0 : static_cast<int>(
+            std::min<uint32_t>(static_cast<uint32_t>(kMaxWaitMs), m_network.NextTimerMs()));
+        WaitForEvents(timeoutMs);
+    }
+
+    INST_LOG_INFO(TAG, "Forwarding thread stopped");
+}
+
+void QUICTunnel::PacketIoLoop() {
+    INST_LOG_INFO(TAG, "Packet I/O thread started");
+
     uint8_t sendBuffer[PICOQUIC_MAX_PACKET_SIZE];
     uint8_t recvBuffer[PICOQUIC_MAX_PACKET_SIZE];
 
@@ -1500,91 +2170,73 @@ void QUICTunnel::ForwardLoop() {
     }
 
     while (m_active.load()) {
-        // Process pending tasks from other threads (lwIP thread safety)
-        DrainTasks();
+        int timeoutMs = kMaxWaitMs;
 
         if (m_isCDTunnel) {
             // --- CDTunnel path: raw IPv6 packets over SSL TCP ---
 
-            // Receive: read available bytes into recv buffer (non-blocking)
-            uint8_t tmp[4096];
-            uint32_t recvd = 0;
-            idevice_error_t rerr = idevice_connection_receive_timeout(m_idevConn,
-                reinterpret_cast<char*>(tmp), sizeof(tmp), &recvd, 20);
-            if (recvd > 0) {
-                m_cdRecvBuf.insert(m_cdRecvBuf.end(), tmp, tmp + recvd);
-            } else if (rerr != IDEVICE_E_TIMEOUT && rerr != IDEVICE_E_SUCCESS) {
-                INST_LOG_DEBUG(TAG, "CDTunnel: receive returned err=%d", static_cast<int>(rerr));
-            }
+            // Receive (plain; SSL has its reader thread): take the bytes
+            // that have arrived (non-blocking)
+            ReadStream(m_cdRecvBuf);
 
-            // Extract and inject complete IPv6 packets into lwIP
-            while (m_cdRecvBuf.size() >= 40) {
-                if ((m_cdRecvBuf[0] & 0xF0) != 0x60) {
+            // Extract complete IPv6 packets and queue them for lwIP
+            size_t consumed = 0;
+            while (m_cdRecvBuf.size() - consumed >= 40) {
+                const uint8_t* pkt = m_cdRecvBuf.data() + consumed;
+                if ((pkt[0] & 0xF0) != 0x60) {
                     // Not an IPv6 packet — stream is corrupt
                     INST_LOG_ERROR(TAG, "CDTunnel: invalid IPv6 packet (byte0=0x%02x), closing",
-                                  m_cdRecvBuf[0]);
+                                  pkt[0]);
                     m_active.store(false);
                     break;
                 }
-                uint16_t payloadLen = (static_cast<uint16_t>(m_cdRecvBuf[4]) << 8)
-                                    | static_cast<uint16_t>(m_cdRecvBuf[5]);
+                uint16_t payloadLen = (static_cast<uint16_t>(pkt[4]) << 8)
+                                    | static_cast<uint16_t>(pkt[5]);
                 size_t totalLen = 40u + payloadLen;
-                if (m_cdRecvBuf.size() < totalLen) break;  // incomplete packet
+                if (m_cdRecvBuf.size() - consumed < totalLen) break;  // incomplete packet
 
-                m_network.InjectPacket(m_cdRecvBuf.data(), totalLen);
-                m_cdRecvBuf.erase(m_cdRecvBuf.begin(),
-                                  m_cdRecvBuf.begin() + static_cast<ptrdiff_t>(totalLen));
+                QueueInbound(pkt, totalLen);
+                consumed += totalLen;
             }
+            m_cdRecvBuf.erase(m_cdRecvBuf.begin(),
+                              m_cdRecvBuf.begin() + static_cast<ptrdiff_t>(consumed));
 
-            // Send: drain output queue (lwIP -> device)
-            std::vector<std::vector<uint8_t>> toSend;
-            {
-                std::lock_guard<std::mutex> lock(m_cdOutputMutex);
-                toSend.swap(m_cdOutputQueue);
-            }
-            for (auto& pkt : toSend) {
+            // Send: drain output ring (lwIP -> device)
+            size_t pktLen = 0;
+            while (const uint8_t* pkt = m_cdOutputRing.Front(pktLen)) {
                 uint32_t sentBytes = 0;
                 idevice_connection_send(m_idevConn,
-                    reinterpret_cast<const char*>(pkt.data()),
-                    static_cast<uint32_t>(pkt.size()), &sentBytes);
+                    reinterpret_cast<const char*>(pkt),
+                    static_cast<uint32_t>(pktLen), &sentBytes);
+                m_cdOutputRing.Pop();
             }
 
         } else {
             // --- QUIC path (USB framed stream or UDP) ---
 
-            uint64_t currentTime = picoquic_current_time();
-
-            // Prepare and send outgoing QUIC packets
-            bool hasSomethingToSend = true;
-            while (hasSomethingToSend) {
-                struct sockaddr_storage addrTo = {}, addrFrom = {};
-                int ifIndex = 0;
-                size_t sendLength = 0;
-                picoquic_connection_id_t logCid = {};
-                picoquic_cnx_t* lastCnx = nullptr;
-
-                int ret = picoquic_prepare_next_packet(m_quic, currentTime,
-                    sendBuffer, sizeof(sendBuffer), &sendLength,
-                    &addrTo, &addrFrom, &ifIndex, &logCid, &lastCnx);
+            // lwIP output queued since the last pass
+            if (!m_outgoingDatagrams.Empty()) {
+                picoquic_mark_datagram_ready(m_cnx, 1);
+            }
 
-                if (ret != 0 || sendLength == 0) {
-                    hasSomethingToSend = false;
-                    break;
-                }
+            // Send outgoing / receive incoming QUIC packets
+            if (m_isUsb) {
+                uint64_t currentTime = picoquic_current_time();
+                for (;;) {
+                    struct sockaddr_storage addrTo = {}, addrFrom = {};
+                    int ifIndex = 0;
+                    size_t sendLength = 0;
+                    picoquic_connection_id_t logCid = {};
+                    picoquic_cnx_t* lastCnx = nullptr;
+
+                    int ret = picoquic_prepare_next_packet(m_quic, currentTime,
+                        sendBuffer, sizeof(sendBuffer), &sendLength,
+                        &addrTo, &addrFrom, &ifIndex, &logCid, &lastCnx);
+                    if (ret != 0 || sendLength == 0) break;
 
-                if (m_isUsb) {
                     SendFramed(sendBuffer, sendLength);
-                } else {
-                    sendto(static_cast<socket_t>(m_udpSocket),
-                           reinterpret_cast<const char*>(sendBuffer),
-                           static_cast<int>(sendLength), 0,
-                           reinterpret_cast<struct sockaddr*>(&addrTo),
-                           static_cast<int>(destAddrLen));
                 }
-            }
 
-            // Receive incoming packets
-            if (m_isUsb) {
                 int pktLen = RecvFramedPartial(recvBuffer, sizeof(recvBuffer));
                 while (pktLen > 0) {
                     currentTime = picoquic_current_time();
@@ -1595,38 +2247,8 @@ void QUICTunnel::ForwardLoop() {
                     pktLen = RecvFramedPartial(recvBuffer, sizeof(recvBuffer));
                 }
             } else {
-                // Receive incoming UDP packets (non-blocking)
-                struct sockaddr_storage recvFrom = {};
-                socklen_t fromLen = sizeof(recvFrom);
-
-#ifdef _WIN32
-                int recvLen = recvfrom(static_cast<socket_t>(m_udpSocket),
-                    reinterpret_cast<char*>(recvBuffer), sizeof(recvBuffer), 0,
-                    reinterpret_cast<struct sockaddr*>(&recvFrom), &fromLen);
-                while (recvLen > 0) {
-#else
-                ssize_t recvLen = recvfrom(m_udpSocket,
-                    recvBuffer, sizeof(recvBuffer), 0,
-                    reinterpret_cast<struct sockaddr*>(&recvFrom), &fromLen);
-                while (recvLen > 0) {
-#endif
-                    currentTime = picoquic_current_time();
-                    picoquic_incoming_packet(m_quic, recvBuffer, static_cast<size_t>(recvLen),
-                        reinterpret_cast<struct sockaddr*>(&recvFrom),
-                        reinterpret_cast<struct sockaddr*>(&destAddr),
-                        0, 0, currentTime);
-
-                    fromLen = sizeof(recvFrom);
-#ifdef _WIN32
-                    recvLen = recvfrom(static_cast<socket_t>(m_udpSocket),
-                        reinterpret_cast<char*>(recvBuffer), sizeof(recvBuffer), 0,
-                        reinterpret_cast<struct sockaddr*>(&recvFrom), &fromLen);
-#else
-                    recvLen = recvfrom(m_udpSocket,
-                        recvBuffer, sizeof(recvBuffer), 0,
-                        reinterpret_cast<struct sockaddr*>(&recvFrom), &fromLen);
-#endif
-                }
+                SendUdpPackets(destAddrLen);
+                ReceiveUdpPackets(destAddr);
             }
 
             // Check connection state
@@ -1636,25 +2258,31 @@ void QUICTunnel::ForwardLoop() {
                 m_active.store(false);
                 break;
             }
+            timeoutMs = QuicWakeTimeoutMs(kMaxWaitMs);
         } // end QUIC path
 
-        // Bridge OS sockets <-> lwIP TCP connections (both paths)
-        DrainBridges();
-
-        // Poll lwIP timers (both paths)
-        m_network.Poll();
+        if (m_streamClosed.load()) {
+            INST_LOG_WARN(TAG, "Tunnel stream to the device closed");
+            m_active.store(false);
+            break;
+        }
 
-        // Brief sleep to avoid burning CPU
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        // Sleep until there is I/O, lwIP output or the next picoquic timer
+        WaitForIo(timeoutMs);
     }
 
-    INST_LOG_INFO(TAG, "Forwarding thread stopped");
+    // Stop the forwarding thread too when the device side ended
+    m_active.store(false);
+    Wake();
+    INST_LOG_INFO(TAG, "Packet I/O thread stopped");
 }
 
 // ---------- Close ----------
 
 void QUICTunnel::Close() {
-    if (!m_active.exchange(false)) {
+    // Loops that stopped on their own (stream or QUIC closed) still need
+    // the full teardown below
+    if (!m_active.exchange(false) && !m_forwardThread.joinable()) {
         // Wasn't active, but still clean up if needed
         if (m_quic) {
             auto* cbCtx = static_cast<QUICCallbackContext*>(
@@ -1677,11 +2305,27 @@ void QUICTunnel::Close() {
     }
 
     INST_LOG_INFO(TAG, "Closing QUIC tunnel");
+    Wake();
+    WakeIo();
+
+    // Wait for the loops and the SSL stream reader (it returns within one
+    // SO_RCVTIMEO period)
+    if (m_forwardThread.joinable()) {
+        m_forwardThread.join();
+    }
+    if (m_ioThread.joinable()) {
+        m_ioThread.join();
+    }
+    if (m_cdReaderThread.joinable()) {
+        m_cdReaderThread.join();
+    }
+    ReleaseInbound();
 
-    // Shut down all socket bridges
+    // Shut down all socket bridges (their pending pbufs go before lwIP)
     {
         std::lock_guard<std::mutex> lock(m_bridgeMutex);
         for (auto& bridge : m_bridges) {
+            FreeBridgeRx(*bridge);
             if (bridge->internalFd >= 0) {
                 CLOSE_SOCKET(static_cast<socket_t>(bridge->internalFd));
                 bridge->internalFd = -1;
@@ -1694,10 +2338,11 @@ void QUICTunnel::Close() {
         m_bridges.clear();
     }
 
-    // Wait for forwarding thread
-    if (m_forwardThread.joinable()) {
-        m_forwardThread.join();
+    // Reset in-process streams; their readers and writers see the close
+    for (auto& stream : m_streams) {
+        stream->Abort();
     }
+    m_streams.clear();
 
     // Shutdown userspace network
     m_network.Shutdown();
@@ -1730,12 +2375,17 @@ void QUICTunnel::Close() {
 
     m_isUsb = false;
     m_isCDTunnel = false;
+    m_cdSsl = false;
 }
 
 } // namespace instruments
 
 #else // !INSTRUMENTS_HAS_QUIC
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 namespace instruments {
 
 static const char* TAG = "QUICTunnel";
@@ -1777,6 +2427,30 @@ int QUICTunnel::CreateTunnelSocket(const std::string& destIPv6, uint16_t port) {
     return -1;
 }
 
+bool QUICTunnel::BridgeSocket(int socketFd, const std::string& destIPv6, uint16_t port) {
+    (void)destIPv6;
+    (void)port;
+    INST_LOG_WARN(TAG, "BridgeSocket requires INSTRUMENTS_HAS_QUIC build flag.");
+#ifdef _WIN32
+    closesocket(static_cast<SOCKET>(socketFd));
+#else
+    ::close(socketFd);
+#endif
+    return false;
+}
+
+std::shared_ptr<TunnelStream> QUICTunnel::CreateTunnelStream(const std::string& destIPv6, uint16_t port) {
+    (void)destIPv6;
+    (void)port;
+    INST_LOG_WARN(TAG, "CreateTunnelStream requires INSTRUMENTS_HAS_QUIC build flag.");
+    return nullptr;
+}
+
+bool QUICTunnel::OpenTcpConnection(const std::string&, uint16_t,
+        std::function<void(const std::shared_ptr<UserspaceTcpConnection>&)>) {
+    return false;
+}
+
 void QUICTunnel::Close() {
     if (!m_active.exchange(false)) return;
 
@@ -1801,7 +2475,13 @@ void QUICTunnel::SubmitToLoop(std::function<void()> fn) {
 
 void QUICTunnel::DrainTasks() {}
 
-void QUICTunnel::DrainBridges() {}
+bool QUICTunnel::DrainBridges() { return false; }
+
+bool QUICTunnel::FlushBridgeRx(SocketBridge&, bool&) { return false; }
+
+void QUICTunnel::FreeBridgeRx(SocketBridge&) {}
+
+bool QUICTunnel::DrainStreams() { return false; }
 
 } // namespace instruments
 
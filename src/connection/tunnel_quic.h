@@ -2,13 +2,17 @@
 #define INSTRUMENTS_TUNNEL_QUIC_H
 
 #include "../../include/instruments/types.h"
+#include "packet_ring.h"
+#include "tunnel_stream.h"
 #include "userspace_network.h"
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 // Socket types needed for CreateUdpSocket declaration
@@ -43,9 +47,18 @@ struct TunnelParameters {
 //   USB CDTunnel:   ConnectViaCoreDeviceProxy(device)   - CDTunnel JSON + raw IPv6 TCP (iOS 17.4+, 18+/26+)
 //   USB QUIC:       ConnectViaUSB(device)               - picoquic over framed lockdown stream (iOS 17.x only)
 //
-// After connect, CreateTunnelSocket(destIPv6, port) returns an OS socket fd
-// bridged through the lwIP TCP stack to the device. The fd is a normal connected
-// socket usable by DTXTransport, RSDProvider, etc.
+// Each tunnel runs two threads: the packet I/O thread (PacketIoLoop) moves
+// packets between the device transport and picoquic, and the forwarding
+// thread (ForwardLoop) runs lwIP and copies between its TCP connections and
+// the streams / sockets handed out. They exchange IPv6 packets through the
+// inbound queue and the output rings, so a bulk transfer being copied on
+// one side does not hold up packet I/O for the other connections.
+//
+// After connect, CreateTunnelStream(destIPv6, port) returns an in-process
+// stream on an lwIP TCP connection to the device (DTXTransport reads and
+// writes it directly). CreateTunnelSocket(destIPv6, port) instead returns an
+// OS socket fd bridged to the connection through a loopback socket pair, for
+// users that need a real socket (RSDProvider, port forwarding).
 //
 // Preferred USB path for iOS 17.4+ and all iOS 18+/26+:
 //   ConnectViaCoreDeviceProxy() — uses com.apple.internal.devicecompute.CoreDeviceProxy
@@ -75,6 +88,16 @@ public:
     // Returns -1 on error. Thread-safe.
     int CreateTunnelSocket(const std::string& destIPv6, uint16_t port);
 
+    // Connect to [destIPv6]:port through the tunnel and copy between that
+    // connection and socketFd, a connected OS socket (e.g. a forwarded
+    // client), on the forwarding thread: no socket pair and no relay
+    // thread. Takes ownership of socketFd, also on error. Thread-safe.
+    bool BridgeSocket(int socketFd, const std::string& destIPv6, uint16_t port);
+
+    // Create a TCP connection to [destIPv6]:port through the tunnel as an
+    // in-process stream (no socket pair). Returns nullptr on error. Thread-safe.
+    std::shared_ptr<TunnelStream> CreateTunnelStream(const std::string& destIPv6, uint16_t port);
+
     // Get tunnel parameters (valid after Connect/ConnectViaUSB succeeds)
     const TunnelParameters& GetParameters() const { return m_params; }
 
@@ -94,7 +117,8 @@ public:
 private:
     TunnelParameters m_params;
     std::atomic<bool> m_active{false};
-    std::thread m_forwardThread;
+    std::thread m_forwardThread;   // lwIP, bridges, streams
+    std::thread m_ioThread;        // device transport, picoquic
     UserspaceNetwork m_network;
 
     // USB stream state (always present)
@@ -104,16 +128,15 @@ private:
     std::vector<uint8_t> m_streamRecvBuf;   // partial packet buffer for USB QUIC framing
     std::vector<uint8_t> m_cdRecvBuf;       // partial IPv6 packet buffer for CDTunnel
 
-    // CDTunnel output queue: lwIP -> device send (locked by m_cdOutputMutex)
-    std::mutex m_cdOutputMutex;
-    std::vector<std::vector<uint8_t>> m_cdOutputQueue;
+    // CDTunnel output ring: lwIP (forwarding thread) -> device send (I/O thread)
+    PacketRing m_cdOutputRing;
 
     // Fake sockaddr for USB path (picoquic needs addresses even over stream)
     struct sockaddr_storage m_fakeLocalAddr;
     struct sockaddr_storage m_fakeRemoteAddr;
 
     // Task queue: SubmitToLoop() allows any thread to schedule work on
-    // the ForwardLoop thread (required for lwIP thread safety)
+    // the ForwardLoop thread (required for lwIP thread safety) and wakes it
     std::mutex m_taskMutex;
     std::vector<std::function<void()>> m_pendingTasks;
     void SubmitToLoop(std::function<void()> fn);
@@ -121,23 +144,95 @@ private:
 
     // Socket bridges: OS socket pair <-> lwIP TCP connection
     struct SocketBridge {
-        int externalFd = -1;  // fds[0]: returned to caller
-        int internalFd = -1;  // fds[1]: owned by ForwardLoop
+        int externalFd = -1;  // fds[0]: returned to caller (-1: BridgeSocket())
+        int internalFd = -1;  // fds[1] or the bridged socket: owned by ForwardLoop
         std::shared_ptr<UserspaceTcpConnection> lwipConn;
         std::atomic<bool> connected{false};
+        // Received chains not yet written to internalFd (front written up
+        // to rxOffset); their bytes reopen the TCP window once written
+        std::deque<struct pbuf*> rxPending;
+        size_t rxOffset = 0;
     };
     std::mutex m_bridgeMutex;
     std::vector<std::shared_ptr<SocketBridge>> m_bridges;
-    void DrainBridges();  // called from ForwardLoop
+    // Called from ForwardLoop: copy each bridge in both directions, at most
+    // kFairShareBytes per direction per pass, and drop the bridges that
+    // closed. Returns true when a bridge still has data to copy.
+    bool DrainBridges();
+    // Write rxPending to internalFd; false when the socket failed. Sets
+    // more when the pass budget ran out first.
+    bool FlushBridgeRx(SocketBridge& bridge, bool& more);
+    static void FreeBridgeRx(SocketBridge& bridge);
+    // Make internalFd non-blocking and bridge it to a new connection to
+    // [destIPv6]:port (externalFd: the caller's end of a socket pair, or -1)
+    bool AttachBridge(int internalFd, int externalFd, const std::string& destIPv6, uint16_t port);
+
+    // In-process streams (forwarding thread only, Close() after it stopped)
+    std::vector<std::shared_ptr<TunnelStream>> m_streams;
+    // Called from ForwardLoop; drops streams that closed. Returns true when
+    // a stream still has data lwIP could take.
+    bool DrainStreams();
+
+    // Open an lwIP TCP connection on the forwarding thread and wait until
+    // it is established. onConnected runs there first (install callbacks).
+    bool OpenTcpConnection(const std::string& destIPv6, uint16_t port,
+                           std::function<void(const std::shared_ptr<UserspaceTcpConnection>&)> onConnected);
 
 #ifdef INSTRUMENTS_HAS_QUIC
     picoquic_quic_t* m_quic = nullptr;
     picoquic_cnx_t* m_cnx = nullptr;
     int m_udpSocket = -1;  // UDP mode only; -1 for USB mode
 
-    // Datagram queue for outgoing packets (lwIP -> QUIC)
-    std::mutex m_dgMutex;
-    std::vector<std::vector<uint8_t>> m_outgoingDatagrams;
+    // Datagram ring for outgoing packets (lwIP -> QUIC)
+    PacketRing m_outgoingDatagrams;
+
+    // Inbound packets: device (I/O thread, SSL reader) -> lwIP (forwarding
+    // thread), in pooled receive buffers (UserspaceNetwork::AcquireRxBuffer)
+    std::mutex m_rxMutex;
+    std::vector<std::pair<uint8_t*, size_t>> m_rxPackets;
+    std::vector<std::pair<uint8_t*, size_t>> m_rxBatch;   // forwarding thread
+    void QueueInbound(const uint8_t* data, size_t len);   // copies the packet
+    void PushInbound(uint8_t* buffer, size_t len);        // takes the buffer
+    bool DrainInbound();   // forwarding thread; true when a packet was injected
+    void ReleaseInbound();
+
+    // Event-driven loops. ForwardLoop sleeps in WaitForEvents() until a
+    // bridge is ready, the next lwIP timer is due or Wake() is called
+    // (inbound packets, SubmitToLoop, streams, Close). PacketIoLoop and the
+    // handshake loops sleep in WaitForIo() until the UDP socket or the
+    // device stream is readable, the next picoquic timer is due or WakeIo()
+    // is called (lwIP output, Close). Wakes are coalesced: one wake byte
+    // per sleep, however many events.
+    int m_wakeFd = -1;     // loopback UDP sockets connected to themselves
+    int m_ioWakeFd = -1;
+    std::atomic<bool> m_wakePending{false};
+    std::atomic<bool> m_ioWakePending{false};
+    void Wake();
+    void WakeIo();
+    void WaitForEvents(int timeoutMs);
+    void WaitForIo(int timeoutMs);
+    // Milliseconds until picoquic wants to run again, at most maxMs
+    int QuicWakeTimeoutMs(int maxMs) const;
+
+    // UDP mode: send every packet picoquic has ready / feed every datagram
+    // waiting on m_udpSocket to picoquic. On Linux both go through
+    // sendmmsg / recvmmsg, up to a batch of packets per syscall.
+    void SendUdpPackets(socklen_t peerLen);
+    void ReceiveUdpPackets(struct sockaddr_storage& localAddr);
+    std::vector<uint8_t> m_udpBatchBuf;   // Linux: packet slots for one batch
+
+    // Append the bytes available on m_idevConn to buf without blocking
+    void ReadStream(std::vector<uint8_t>& buf);
+    std::atomic<bool> m_streamClosed{false};   // device closed the stream
+
+    // SSL CDTunnel stream: SSL may hold decrypted bytes its fd does not
+    // show, so a reader thread does blocking reads of whole IPv6 packets
+    // straight into pooled receive buffers and queues them inbound, where
+    // ForwardLoop injects them without copying
+    bool m_cdSsl = false;
+    std::thread m_cdReaderThread;
+    void CDTunnelReadLoop();
+    bool ReadStreamExact(uint8_t* buf, size_t len);
 
     // QUIC callback
     static int QuicCallback(picoquic_cnx_t* cnx, uint64_t stream_id,
@@ -151,9 +246,15 @@ private:
     // Handshake: exchange parameters on stream 0 (QUIC path)
     Error PerformHandshake();
 
-    // Forwarding loop (runs in m_forwardThread)
+    // Start m_forwardThread and m_ioThread (connect functions, last step)
+    void StartLoops();
+
+    // lwIP loop (runs in m_forwardThread)
     void ForwardLoop();
 
+    // Device packet I/O loop (runs in m_ioThread)
+    void PacketIoLoop();
+
     // Create and bind UDP socket (Wi-Fi mode)
     Error CreateUdpSocket(const struct sockaddr* addr, socklen_t addrLen);
 
@@ -0,0 +1,258 @@
+#include "tunnel_stream.h"
+#include "userspace_network.h"
+#include "../util/log.h"
+
+#ifdef INSTRUMENTS_HAS_QUIC
+
+extern "C" {
+#include <lwip/pbuf.h>
+}
+
+#include <algorithm>
+#include <chrono>
+
+namespace instruments {
+
+static const char* TAG = "TunnelStream";
+
+TunnelStream::TunnelStream(std::shared_ptr<UserspaceTcpConnection> conn, std::function<void()> wake)
+    : m_conn(std::move(conn))
+    , m_wake(std::move(wake))
+{
+}
+
+// The tunnel drops a stream only after Service() or Abort() released its
+// pbufs and detached it from lwIP
+TunnelStream::~TunnelStream() = default;
+
+int TunnelStream::Read(uint8_t* buffer, size_t maxLength, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+        [this]() { return !m_rxQueue.empty() || m_eof || m_closing; });
+    if (m_closing) return -1;
+    if (m_rxQueue.empty()) return m_eof ? -1 : 0;
+
+    // Copy straight out of the pbuf chains lwIP received
+    size_t total = 0;
+    while (total < maxLength && !m_rxQueue.empty()) {
+        struct pbuf* p = m_rxQueue.front();
+        const size_t want = std::min<size_t>({maxLength - total, p->tot_len - m_rxOffset, 0xFFFF});
+        const u16_t n = pbuf_copy_partial(p, buffer + total, static_cast<u16_t>(want),
+                                          static_cast<u16_t>(m_rxOffset));
+        total += n;
+        m_rxOffset += n;
+        if (m_rxOffset >= p->tot_len) {
+            m_rxDone.push_back(p);   // freed on the forwarding thread
+            m_rxQueue.pop_front();
+            m_rxOffset = 0;
+        } else if (n == 0) {
+            break;
+        }
+    }
+    m_rxConsumed += total;
+
+    const bool wake = RequestServiceLocked();
+    lock.unlock();
+    if (wake) m_wake();
+    return static_cast<int>(total);
+}
+
+Error TunnelStream::Write(const uint8_t* data, size_t length) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (length > 0) {
+        m_cv.wait(lock, [this]() { return m_closing || m_eof || m_txUnacked < MaxPendingBytes; });
+        if (m_closing || m_eof) return Error::ConnectionFailed;
+
+        const size_t n = std::min({length, ChunkSize, MaxPendingBytes - m_txUnacked});
+        // Small writes join the last chunk while lwIP has none of its bytes
+        // (growing it may move the data)
+        const size_t count = m_txChunks.size();
+        const bool lastUntouched = m_txWriteIndex + 1 < count ||
+                                   (m_txWriteIndex + 1 == count && m_txWriteOffset == 0);
+        if (lastUntouched && m_txChunks.back().size() + n <= ChunkSize) {
+            m_txChunks.back().insert(m_txChunks.back().end(), data, data + n);
+        } else {
+            m_txChunks.emplace_back(data, data + n);
+        }
+        m_txUnacked += n;
+        data += n;
+        length -= n;
+
+        if (RequestServiceLocked()) {
+            lock.unlock();
+            m_wake();
+            lock.lock();
+        }
+    }
+    return Error::Success;
+}
+
+void TunnelStream::Close() {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closing) return;
+        m_closing = true;
+        m_cv.notify_all();
+        wake = RequestServiceLocked();
+    }
+    if (wake) m_wake();
+}
+
+bool TunnelStream::IsOpen() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_closing && !m_eof;
+}
+
+void TunnelStream::Attach() {
+    m_conn->SetRecvPbufCallback([this](struct pbuf* p) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closing) {
+            pbuf_free(p);
+            return;
+        }
+        m_rxQueue.push_back(p);
+        m_cv.notify_all();
+    });
+
+    m_conn->SetSentCallback([this](size_t length) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_txUnacked -= std::min(length, m_txUnacked);
+        while (length > 0 && !m_txChunks.empty()) {
+            const size_t left = m_txChunks.front().size() - m_txAcked;
+            if (length < left) {
+                m_txAcked += length;
+                break;
+            }
+            // lwIP no longer references this chunk
+            length -= left;
+            m_txChunks.pop_front();
+            m_txAcked = 0;
+            if (m_txWriteIndex > 0) m_txWriteIndex--;
+            else m_txWriteOffset = 0;
+        }
+        m_cv.notify_all();
+    });
+
+    m_conn->SetErrorCallback([this](Error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_eof = true;
+        m_cv.notify_all();
+    });
+}
+
+bool TunnelStream::Service(size_t writeBudget, bool& morePending) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_serviceRequested = false;
+
+    for (struct pbuf* p : m_rxDone) pbuf_free(p);
+    m_rxDone.clear();
+
+    const bool attached = m_conn && m_conn->HasPcb();
+    if (attached && m_rxConsumed > 0) m_conn->Recved(m_rxConsumed);
+    m_rxConsumed = 0;
+
+    // Hand pending bytes to lwIP as far as its send buffer and this pass's
+    // budget allow
+    if (attached) {
+        bool wrote = false;
+        while (m_txWriteIndex < m_txChunks.size()) {
+            if (writeBudget == 0) {
+                if (m_conn->SendSpace() > 0) morePending = true;
+                break;
+            }
+            const auto& chunk = m_txChunks[m_txWriteIndex];
+            const size_t left = chunk.size() - m_txWriteOffset;
+            const size_t n = std::min<size_t>({left, m_conn->SendSpace(), writeBudget, 0xFFFF});
+            if (n == 0) break;
+            const bool more = n < left || m_txWriteIndex + 1 < m_txChunks.size();
+            if (!m_conn->WriteNoCopy(chunk.data() + m_txWriteOffset, n, more)) break;
+            wrote = true;
+            writeBudget -= n;
+            m_txWriteOffset += n;
+            if (m_txWriteOffset == chunk.size()) {
+                m_txWriteIndex++;
+                m_txWriteOffset = 0;
+            }
+        }
+        if (wrote) m_conn->Output();
+    }
+
+    if (!m_closing) return true;
+
+    if (attached) {
+        if (!m_txChunks.empty()) {
+            // Deliver what was written before the FIN
+            if (!m_eof) return true;
+            // The remote is gone: reset so lwIP drops its references to the chunks
+            m_conn->Abort();
+        } else {
+            m_conn->Close();
+        }
+    }
+    INST_LOG_DEBUG(TAG, "Tunnel stream closed");
+    ReleasePbufsLocked();
+    m_txChunks.clear();
+    m_txUnacked = 0;
+    m_eof = true;
+    m_serviceRequested = true;   // no wake-ups for a dropped stream
+    m_conn.reset();
+    m_cv.notify_all();
+    return false;
+}
+
+void TunnelStream::Abort() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_conn) {
+        m_conn->Abort();
+        m_conn.reset();
+    }
+    ReleasePbufsLocked();
+    m_txChunks.clear();
+    m_txUnacked = 0;
+    m_eof = true;
+    // The tunnel is going away: Read()/Write()/Close() must not wake it
+    m_serviceRequested = true;
+    m_cv.notify_all();
+}
+
+bool TunnelStream::RequestServiceLocked() {
+    if (m_serviceRequested) return false;
+    m_serviceRequested = true;
+    return true;
+}
+
+void TunnelStream::ReleasePbufsLocked() {
+    for (struct pbuf* p : m_rxQueue) pbuf_free(p);
+    for (struct pbuf* p : m_rxDone) pbuf_free(p);
+    m_rxQueue.clear();
+    m_rxDone.clear();
+    m_rxOffset = 0;
+    m_rxConsumed = 0;
+}
+
+} // namespace instruments
+
+#else // !INSTRUMENTS_HAS_QUIC
+
+namespace instruments {
+
+TunnelStream::TunnelStream(std::shared_ptr<UserspaceTcpConnection> conn, std::function<void()> wake)
+    : m_conn(std::move(conn))
+    , m_wake(std::move(wake))
+{
+}
+TunnelStream::~TunnelStream() = default;
+int TunnelStream::Read(uint8_t*, size_t, int) { return -1; }
+Error TunnelStream::Write(const uint8_t*, size_t) { return Error::NotSupported; }
+void TunnelStream::Close() {}
+bool TunnelStream::IsOpen() const { return false; }
+void TunnelStream::Attach() {}
+bool TunnelStream::Service(size_t, bool&) { return false; }
+void TunnelStream::Abort() {}
+bool TunnelStream::RequestServiceLocked() { return false; }
+void TunnelStream::ReleasePbufsLocked() {}
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_HAS_QUIC
@@ -0,0 +1,104 @@
+#ifndef INSTRUMENTS_TUNNEL_STREAM_H
+#define INSTRUMENTS_TUNNEL_STREAM_H
+
+#include "../../include/instruments/types.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct pbuf;
+
+namespace instruments {
+
+class UserspaceTcpConnection;
+
+// TunnelStream - in-process byte stream over one lwIP TCP connection of a
+// QUICTunnel (QUICTunnel::CreateTunnelStream()). DTXTransport reads and
+// writes it directly instead of going through a loopback socket pair.
+//
+// Received pbuf chains stay queued as lwIP delivered them and are copied
+// once, straight into the reader's buffer; their bytes reopen the TCP
+// window as the reader consumes them. Written bytes are copied once into
+// a pending chunk that lwIP references without copying until the device
+// acknowledges it.
+//
+// lwIP is only touched on the tunnel's forwarding thread (Service());
+// Read(), Write() and Close() may be called from any thread and wake it.
+class TunnelStream {
+public:
+    ~TunnelStream();
+
+    // Non-copyable
+    TunnelStream(const TunnelStream&) = delete;
+    TunnelStream& operator=(const TunnelStream&) = delete;
+
+    // Read up to maxLength bytes, waiting at most timeoutMs for the first.
+    // Returns the bytes read, 0 on timeout, or -1 once the stream is
+    // closed and drained.
+    int Read(uint8_t* buffer, size_t maxLength, int timeoutMs);
+
+    // Queue length bytes for sending. Blocks while MaxPendingBytes are
+    // waiting for acknowledgement.
+    Error Write(const uint8_t* data, size_t length);
+
+    // Stop reading and writing. Bytes already written are still delivered
+    // before the connection closes.
+    void Close();
+
+    bool IsOpen() const;
+
+private:
+    friend class QUICTunnel;
+
+    TunnelStream(std::shared_ptr<UserspaceTcpConnection> conn, std::function<void()> wake);
+
+    // Forwarding thread: install the lwIP callbacks (connection established)
+    void Attach();
+    // Forwarding thread: release consumed pbufs, reopen the window, push
+    // up to writeBudget pending bytes to lwIP (sets morePending when lwIP
+    // could take more of them). Returns false once the stream can be dropped.
+    bool Service(size_t writeBudget, bool& morePending);
+    // Forwarding thread: tunnel is closing, reset the connection
+    void Abort();
+
+    // Ask the forwarding thread to Service() (m_mutex held); true when the
+    // caller must Wake() it after unlocking
+    bool RequestServiceLocked();
+    void ReleasePbufsLocked();
+
+    static constexpr size_t MaxPendingBytes = 1024 * 1024;
+    static constexpr size_t ChunkSize = 64 * 1024;
+
+    std::shared_ptr<UserspaceTcpConnection> m_conn;   // forwarding thread only
+    std::function<void()> m_wake;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;       // data, acknowledgement or close
+    bool m_closing = false;             // Close() called
+    bool m_eof = false;                 // remote closed or connection failed
+    bool m_serviceRequested = false;
+
+    // Receive: chains not fully read (front read up to m_rxOffset), chains
+    // read but not freed yet, and bytes read since the last Recved()
+    std::deque<struct pbuf*> m_rxQueue;
+    size_t m_rxOffset = 0;
+    std::vector<struct pbuf*> m_rxDone;
+    size_t m_rxConsumed = 0;
+
+    // Send: unacknowledged chunks, oldest first. The front chunk's first
+    // m_txAcked bytes are acknowledged; bytes before chunk m_txWriteIndex,
+    // offset m_txWriteOffset are queued in lwIP.
+    std::deque<std::vector<uint8_t>> m_txChunks;
+    size_t m_txAcked = 0;
+    size_t m_txWriteIndex = 0;
+    size_t m_txWriteOffset = 0;
+    size_t m_txUnacked = 0;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_TUNNEL_STREAM_H
@@ -14,12 +14,107 @@ extern "C" {
 #include <lwip/ip6.h>
 }
 
+#include <algorithm>
 #include <cstring>
+#include <new>
 
 namespace instruments {
 
 static const char* TAG = "UserspaceNetwork";
 
+// ---------- Receive buffer pool ----------
+//
+// Each receive buffer is one allocation: an RxBlock header (lwIP's custom
+// pbuf first, so the pbuf lwIP frees is the block address) followed by the
+// packet bytes. Blocks come in power-of-two size classes and are recycled
+// through per-class free lists, so steady-state receive does not allocate.
+
+namespace {
+
+struct RxBlock {
+    struct pbuf_custom custom;
+    size_t capacity;
+    uint8_t sizeClass;
+};
+
+constexpr size_t kRxHeaderSize = (sizeof(RxBlock) + 15) & ~size_t(15);
+constexpr size_t kRxMinCapacity = 2048;        // one MTU-sized packet
+constexpr size_t kRxClasses = 6;               // 2 KB .. 64 KB
+constexpr size_t kRxPooledBytesPerClass = 8 * 1024 * 1024;
+
+struct RxPool {
+    std::mutex mutex;
+    std::vector<RxBlock*> free[kRxClasses];
+};
+
+// Shared by every tunnel and never destroyed: lwIP may free a pbuf during
+// static destruction
+RxPool& GetRxPool() {
+    static RxPool* pool = new RxPool();
+    return *pool;
+}
+
+uint8_t* RxBlockData(RxBlock* block) {
+    return reinterpret_cast<uint8_t*>(block) + kRxHeaderSize;
+}
+
+RxBlock* RxBlockFromData(uint8_t* data) {
+    return reinterpret_cast<RxBlock*>(data - kRxHeaderSize);
+}
+
+void RecycleRxBlock(RxBlock* block) {
+    const size_t maxFree = std::max<size_t>(16, kRxPooledBytesPerClass / block->capacity);
+    {
+        RxPool& pool = GetRxPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        auto& freeList = pool.free[block->sizeClass];
+        if (freeList.size() < maxFree) {
+            freeList.push_back(block);
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
+void FreeRxPbuf(struct pbuf* p) {
+    RecycleRxBlock(reinterpret_cast<RxBlock*>(reinterpret_cast<struct pbuf_custom*>(p)));
+}
+
+} // namespace
+
+uint8_t* UserspaceNetwork::AcquireRxBuffer(size_t capacity) {
+    if (capacity > 0xFFFF) return nullptr;   // pbuf lengths are 16-bit
+    uint8_t sizeClass = 0;
+    size_t classCapacity = kRxMinCapacity;
+    while (classCapacity < capacity) {
+        classCapacity <<= 1;
+        sizeClass++;
+    }
+
+    {
+        RxPool& pool = GetRxPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        auto& freeList = pool.free[sizeClass];
+        if (!freeList.empty()) {
+            RxBlock* block = freeList.back();
+            freeList.pop_back();
+            return RxBlockData(block);
+        }
+    }
+
+    void* mem = ::operator new(kRxHeaderSize + classCapacity, std::nothrow);
+    if (!mem) return nullptr;
+    RxBlock* block = static_cast<RxBlock*>(mem);
+    std::memset(block, 0, sizeof(RxBlock));
+    block->capacity = classCapacity;
+    block->sizeClass = sizeClass;
+    return RxBlockData(block);
+}
+
+void UserspaceNetwork::ReleaseRxBuffer(uint8_t* buffer) {
+    if (buffer) RecycleRxBlock(RxBlockFromData(buffer));
+}
+
 // ---------- UserspaceTcpConnection ----------
 
 UserspaceTcpConnection::~UserspaceTcpConnection() {
@@ -63,6 +158,50 @@ Error UserspaceTcpConnection::Send(const uint8_t* data, size_t length) {
     return Error::Success;
 }
 
+void UserspaceTcpConnection::Recved(size_t length) {
+    if (!m_pcb) return;
+    while (length > 0) {
+        const u16_t n = static_cast<u16_t>(std::min<size_t>(length, 0xFFFF));
+        tcp_recved(m_pcb, n);
+        length -= n;
+    }
+}
+
+size_t UserspaceTcpConnection::SendSpace() const {
+    if (!m_connected.load() || !m_pcb) return 0;
+    // Each segment takes up to two queue entries (header and data pbuf);
+    // promising more would make tcp_write() fail with ERR_MEM
+    const size_t queued = tcp_sndqueuelen(m_pcb);
+    if (queued + 2 > TCP_SND_QUEUELEN) return 0;
+    return std::min<size_t>(tcp_sndbuf(m_pcb), (TCP_SND_QUEUELEN - queued) / 2 * TCP_MSS);
+}
+
+bool UserspaceTcpConnection::WriteNoCopy(const uint8_t* data, size_t length, bool more) {
+    if (!m_connected.load() || !m_pcb) return false;
+    const u8_t flags = more ? TCP_WRITE_FLAG_MORE : 0;
+    err_t err = tcp_write(m_pcb, data, static_cast<u16_t>(length), flags);
+    if (err != ERR_OK && err != ERR_MEM) {
+        INST_LOG_ERROR(TAG, "tcp_write failed: %d", err);
+    }
+    return err == ERR_OK;
+}
+
+void UserspaceTcpConnection::Output() {
+    if (m_pcb) tcp_output(m_pcb);
+}
+
+void UserspaceTcpConnection::Abort() {
+    if (m_pcb) {
+        tcp_arg(m_pcb, nullptr);
+        tcp_recv(m_pcb, nullptr);
+        tcp_sent(m_pcb, nullptr);
+        tcp_err(m_pcb, nullptr);
+        tcp_abort(m_pcb);
+        m_pcb = nullptr;
+    }
+    m_connected.store(false);
+}
+
 void UserspaceTcpConnection::Close() {
     if (m_pcb) {
         tcp_arg(m_pcb, nullptr);
@@ -116,6 +255,12 @@ err_t UserspaceTcpConnection::OnRecv(void* arg, tcp_pcb* tpcb, struct pbuf* p, e
         return err;
     }
 
+    // Zero-copy consumer: it frees the chain and reopens the window itself
+    if (conn->m_recvPbufCb) {
+        conn->m_recvPbufCb(p);
+        return ERR_OK;
+    }
+
     // Deliver data to application
     if (conn->m_recvCb) {
         // Walk the pbuf chain
@@ -132,10 +277,10 @@ err_t UserspaceTcpConnection::OnRecv(void* arg, tcp_pcb* tpcb, struct pbuf* p, e
 }
 
 err_t UserspaceTcpConnection::OnSent(void* arg, tcp_pcb* tpcb, u16_t len) {
-    // Data acknowledged by remote - could notify application if needed
-    (void)arg;
+    // Data acknowledged by remote
+    auto* conn = static_cast<UserspaceTcpConnection*>(arg);
     (void)tpcb;
-    (void)len;
+    if (conn && conn->m_sentCb) conn->m_sentCb(len);
     return ERR_OK;
 }
 
@@ -221,15 +366,35 @@ Error UserspaceNetwork::Init(const std::string& localIPv6,
 void UserspaceNetwork::InjectPacket(const uint8_t* data, size_t len) {
     if (!m_initialized.load() || !m_netif) return;
 
-    // Allocate a pbuf and copy the incoming packet data
-    struct pbuf* p = pbuf_alloc(PBUF_RAW, static_cast<uint16_t>(len), PBUF_POOL);
-    if (!p) {
+    // One contiguous copy into a pooled buffer (a PBUF_POOL chain would
+    // split anything larger than PBUF_POOL_BUFSIZE)
+    uint8_t* buffer = AcquireRxBuffer(len);
+    if (!buffer) {
         INST_LOG_WARN(TAG, "Failed to allocate pbuf for incoming packet (%zu bytes)", len);
         return;
     }
+    std::memcpy(buffer, data, len);
+    InjectRxBuffer(buffer, len);
+}
+
+void UserspaceNetwork::InjectRxBuffer(uint8_t* buffer, size_t len) {
+    if (!m_initialized.load() || !m_netif) {
+        ReleaseRxBuffer(buffer);
+        return;
+    }
 
-    // Copy data into pbuf chain
-    pbuf_take(p, data, static_cast<uint16_t>(len));
+    // Wrap the buffer without copying; FreeRxPbuf() recycles it once lwIP
+    // (or a TunnelStream reader) is done with the packet
+    RxBlock* block = RxBlockFromData(buffer);
+    block->custom.custom_free_function = FreeRxPbuf;
+    struct pbuf* p = pbuf_alloced_custom(PBUF_RAW, static_cast<u16_t>(len), PBUF_REF,
+                                         &block->custom, buffer,
+                                         static_cast<u16_t>(std::min<size_t>(block->capacity, 0xFFFF)));
+    if (!p) {
+        INST_LOG_WARN(TAG, "Incoming packet larger than its buffer (%zu bytes)", len);
+        ReleaseRxBuffer(buffer);
+        return;
+    }
 
     // Feed into lwIP via the network interface input function
     if (m_netif->input(p, m_netif) != ERR_OK) {
@@ -298,6 +463,11 @@ void UserspaceNetwork::Poll() {
     sys_check_timeouts();
 }
 
+uint32_t UserspaceNetwork::NextTimerMs() const {
+    if (!m_initialized.load()) return UINT32_MAX;
+    return sys_timeouts_sleeptime();
+}
+
 void UserspaceNetwork::Shutdown() {
     if (!m_initialized.exchange(false)) return;
 
@@ -372,7 +542,12 @@ UserspaceTcpConnection::~UserspaceTcpConnection() {}
 Error UserspaceTcpConnection::Send(const uint8_t*, size_t) { return Error::NotSupported; }
 void UserspaceTcpConnection::SetConnectedCallback(ConnectedCallback) {}
 void UserspaceTcpConnection::SetErrorCallback(ErrorCallback) {}
+void UserspaceTcpConnection::Recved(size_t) {}
+size_t UserspaceTcpConnection::SendSpace() const { return 0; }
+bool UserspaceTcpConnection::WriteNoCopy(const uint8_t*, size_t, bool) { return false; }
+void UserspaceTcpConnection::Output() {}
 void UserspaceTcpConnection::Close() {}
+void UserspaceTcpConnection::Abort() {}
 
 UserspaceNetwork::UserspaceNetwork() = default;
 UserspaceNetwork::~UserspaceNetwork() = default;
@@ -381,11 +556,15 @@ Error UserspaceNetwork::Init(const std::string&, const std::string&, uint32_t) {
     return Error::NotSupported;
 }
 void UserspaceNetwork::InjectPacket(const uint8_t*, size_t) {}
+uint8_t* UserspaceNetwork::AcquireRxBuffer(size_t) { return nullptr; }
+void UserspaceNetwork::ReleaseRxBuffer(uint8_t*) {}
+void UserspaceNetwork::InjectRxBuffer(uint8_t*, size_t) {}
 Error UserspaceNetwork::TcpConnect(const std::string&, uint16_t,
                                     std::shared_ptr<UserspaceTcpConnection>&) {
     return Error::NotSupported;
 }
 void UserspaceNetwork::Poll() {}
+uint32_t UserspaceNetwork::NextTimerMs() const { return UINT32_MAX; }
 void UserspaceNetwork::Shutdown() {}
 
 } // namespace instruments
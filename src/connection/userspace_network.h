@@ -40,9 +40,35 @@ public:
     using ErrorCallback = std::function<void(Error err)>;
     void SetErrorCallback(ErrorCallback cb);
 
+    // Zero-copy receive (replaces the RecvCallback): the callback takes
+    // ownership of each received pbuf chain; the caller frees it and
+    // returns its bytes to the TCP window with Recved() once consumed
+    using RecvPbufCallback = std::function<void(struct pbuf* p)>;
+    void SetRecvPbufCallback(RecvPbufCallback cb) { m_recvPbufCb = std::move(cb); }
+    void Recved(size_t length);
+
+    // Set callback for bytes acknowledged by the remote
+    using SentCallback = std::function<void(size_t length)>;
+    void SetSentCallback(SentCallback cb) { m_sentCb = std::move(cb); }
+
+    // Bytes WriteNoCopy() can take right now
+    size_t SendSpace() const;
+
+    // Queue data without copying it: lwIP references it until the remote
+    // acknowledges it (SentCallback). Returns false when lwIP has no room.
+    // Call Output() after the last write of a batch.
+    bool WriteNoCopy(const uint8_t* data, size_t length, bool more);
+    void Output();
+
     // Close this connection
     void Close();
 
+    // Reset the connection (RST); lwIP drops queued data right away
+    void Abort();
+
+    // lwIP still owns a pcb (false after a connection error)
+    bool HasPcb() const { return m_pcb != nullptr; }
+
     bool IsConnected() const { return m_connected.load(); }
     bool HasFailed() const { return m_failed.load(); }
 
@@ -54,6 +80,8 @@ private:
     std::atomic<bool> m_connected{false};
     std::atomic<bool> m_failed{false};
     RecvCallback m_recvCb;
+    RecvPbufCallback m_recvPbufCb;
+    SentCallback m_sentCb;
     ConnectedCallback m_connectedCb;
     ErrorCallback m_errorCb;
 
@@ -93,6 +121,17 @@ public:
     // Feed an incoming IPv6 packet (received from QUIC datagram) into lwIP
     void InjectPacket(const uint8_t* data, size_t len);
 
+    // Zero-copy receive buffers. AcquireRxBuffer() returns room for one
+    // IPv6 packet of up to capacity bytes (at most 65535); InjectRxBuffer()
+    // hands its first len bytes to lwIP as a custom PBUF_REF pbuf and the
+    // buffer goes back to a process-wide pool when lwIP frees it. A buffer
+    // that is not injected is returned with ReleaseRxBuffer().
+    // Acquire/Release are thread-safe; InjectRxBuffer() runs on the
+    // forwarding thread and always takes the buffer.
+    static uint8_t* AcquireRxBuffer(size_t capacity);
+    static void ReleaseRxBuffer(uint8_t* buffer);
+    void InjectRxBuffer(uint8_t* buffer, size_t len);
+
     // Set callback for outgoing packets (lwIP → QUIC datagram)
     using OutputCallback = std::function<void(const uint8_t* data, size_t len)>;
     void SetOutputCallback(OutputCallback cb) { m_outputCb = std::move(cb); }
@@ -105,6 +144,9 @@ public:
     // Poll the lwIP stack - must be called periodically from the forwarding thread
     void Poll();
 
+    // Milliseconds until the next lwIP timer is due (UINT32_MAX if none)
+    uint32_t NextTimerMs() const;
+
     // Shutdown the network stack
     void Shutdown();
 
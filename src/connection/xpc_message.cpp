@@ -2,9 +2,12 @@
 #include "../util/log.h"
 
 #include <algorithm>
+#include <cctype>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -17,21 +20,6 @@ constexpr uint32_t kWrapperMagic = 0x29b00b92;
 constexpr uint32_t kObjectMagic = 0x42133742;
 constexpr uint32_t kBodyVersion = 0x00000005;
 
-enum class XpcType : uint32_t {
-    Null       = 0x00001000,
-    Bool       = 0x00002000,
-    Int64      = 0x00003000,
-    UInt64     = 0x00004000,
-    Double     = 0x00005000,
-    Date       = 0x00007000,
-    Data       = 0x00008000,
-    String     = 0x00009000,
-    Uuid       = 0x0000a000,
-    Array      = 0x0000e000,
-    Dictionary = 0x0000f000,
-    FileTransfer = 0x0001a000,
-};
-
 static size_t Pad4(size_t n) {
     return (4 - (n % 4)) % 4;
 }
@@ -49,6 +37,26 @@ static void WriteU64(std::vector<uint8_t>& out, uint64_t v) {
     }
 }
 
+// Fill in a length written as a placeholder once what follows is known
+static void PatchU32(std::vector<uint8_t>& out, size_t pos, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[pos + i] = static_cast<uint8_t>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+static void PatchU64(std::vector<uint8_t>& out, size_t pos, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out[pos + i] = static_cast<uint8_t>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+static uint32_t PeekU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0])
+         | (static_cast<uint32_t>(p[1]) << 8)
+         | (static_cast<uint32_t>(p[2]) << 16)
+         | (static_cast<uint32_t>(p[3]) << 24);
+}
+
 static bool ReadU32(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
     if (static_cast<size_t>(end - p) < 4) return false;
     v = static_cast<uint32_t>(p[0])
@@ -72,7 +80,7 @@ static bool ReadU64(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
 static bool EncodeObject(const NSObject& obj, std::vector<uint8_t>& out);
 
 static bool EncodeStringPayload(const std::string& s, std::vector<uint8_t>& out) {
-    WriteU32(out, static_cast<uint32_t>(XpcType::String));
+    WriteU32(out, static_cast<uint32_t>(XPCType::String));
     const uint32_t len = static_cast<uint32_t>(s.size() + 1);
     WriteU32(out, len);
     out.insert(out.end(), s.begin(), s.end());
@@ -82,63 +90,67 @@ static bool EncodeStringPayload(const std::string& s, std::vector<uint8_t>& out)
 }
 
 static bool EncodeDataPayload(const std::vector<uint8_t>& d, std::vector<uint8_t>& out) {
-    WriteU32(out, static_cast<uint32_t>(XpcType::Data));
+    WriteU32(out, static_cast<uint32_t>(XPCType::Data));
     WriteU32(out, static_cast<uint32_t>(d.size()));
     out.insert(out.end(), d.begin(), d.end());
     out.insert(out.end(), Pad4(d.size()), 0);
     return true;
 }
 
+// Containers are written in place: the payload length goes in as a
+// placeholder and is patched once the entries are out
 static bool EncodeArrayPayload(const NSObject::ArrayType& arr, std::vector<uint8_t>& out) {
-    std::vector<uint8_t> payload;
+    WriteU32(out, static_cast<uint32_t>(XPCType::Array));
+    const size_t lengthPos = out.size();
+    WriteU32(out, 0);
+    WriteU32(out, static_cast<uint32_t>(arr.size()));
+    const size_t payloadStart = out.size();
     for (const auto& item : arr) {
-        if (!EncodeObject(item, payload)) return false;
+        if (!EncodeObject(item, out)) return false;
     }
-    WriteU32(out, static_cast<uint32_t>(XpcType::Array));
-    WriteU32(out, static_cast<uint32_t>(payload.size()));
-    WriteU32(out, static_cast<uint32_t>(arr.size()));
-    out.insert(out.end(), payload.begin(), payload.end());
+    PatchU32(out, lengthPos, static_cast<uint32_t>(out.size() - payloadStart));
     return true;
 }
 
 static bool EncodeDictPayload(const NSObject::DictType& dict, std::vector<uint8_t>& out) {
-    std::vector<uint8_t> payload;
-    WriteU32(payload, static_cast<uint32_t>(dict.size()));
+    WriteU32(out, static_cast<uint32_t>(XPCType::Dictionary));
+    const size_t lengthPos = out.size();
+    WriteU32(out, 0);
+    const size_t payloadStart = out.size();
+    WriteU32(out, static_cast<uint32_t>(dict.size()));
     for (const auto& kv : dict) {
         const std::string& key = kv.first;
-        payload.insert(payload.end(), key.begin(), key.end());
-        payload.push_back(0);
-        payload.insert(payload.end(), Pad4(key.size() + 1), 0);
-        if (!EncodeObject(kv.second, payload)) return false;
+        out.insert(out.end(), key.begin(), key.end());
+        out.push_back(0);
+        out.insert(out.end(), Pad4(key.size() + 1), 0);
+        if (!EncodeObject(kv.second, out)) return false;
     }
-    WriteU32(out, static_cast<uint32_t>(XpcType::Dictionary));
-    WriteU32(out, static_cast<uint32_t>(payload.size()));
-    out.insert(out.end(), payload.begin(), payload.end());
+    PatchU32(out, lengthPos, static_cast<uint32_t>(out.size() - payloadStart));
     return true;
 }
 
 static bool EncodeObject(const NSObject& obj, std::vector<uint8_t>& out) {
     switch (obj.GetType()) {
         case NSObject::Type::Null:
-            WriteU32(out, static_cast<uint32_t>(XpcType::Null));
+            WriteU32(out, static_cast<uint32_t>(XPCType::Null));
             return true;
         case NSObject::Type::Bool:
-            WriteU32(out, static_cast<uint32_t>(XpcType::Bool));
+            WriteU32(out, static_cast<uint32_t>(XPCType::Bool));
             out.push_back(obj.AsBool() ? 1 : 0);
             out.push_back(0); out.push_back(0); out.push_back(0);
             return true;
         case NSObject::Type::Int32:
         case NSObject::Type::Int64:
-            WriteU32(out, static_cast<uint32_t>(XpcType::Int64));
+            WriteU32(out, static_cast<uint32_t>(XPCType::Int64));
             WriteU64(out, static_cast<uint64_t>(obj.AsInt64()));
             return true;
         case NSObject::Type::UInt64:
-            WriteU32(out, static_cast<uint32_t>(XpcType::UInt64));
+            WriteU32(out, static_cast<uint32_t>(XPCType::UInt64));
             WriteU64(out, obj.AsUInt64());
             return true;
         case NSObject::Type::Float32:
         case NSObject::Type::Float64: {
-            WriteU32(out, static_cast<uint32_t>(XpcType::Double));
+            WriteU32(out, static_cast<uint32_t>(XPCType::Double));
             uint64_t bits = 0;
             double d = obj.AsDouble();
             std::memcpy(&bits, &d, sizeof(bits));
@@ -158,198 +170,292 @@ static bool EncodeObject(const NSObject& obj, std::vector<uint8_t>& out) {
     return false;
 }
 
-static bool DecodeObject(const uint8_t*& p, const uint8_t* end, NSObject& out);
+static std::string FormatUuid(const uint8_t* b16) {
+    char s[37] = {0};
+    std::snprintf(
+        s, sizeof(s),
+        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+        b16[0], b16[1], b16[2], b16[3], b16[4], b16[5], b16[6], b16[7],
+        b16[8], b16[9], b16[10], b16[11], b16[12], b16[13], b16[14], b16[15]);
+    return std::string(s);
+}
 
-static bool DecodeString(const uint8_t*& p, const uint8_t* end, NSObject& out) {
+// Length-prefixed, 4-byte padded bytes (strings and data): extent after the tag
+static bool SkipSized(const uint8_t* p, const uint8_t* end, size_t& extent) {
     uint32_t len = 0;
     if (!ReadU32(p, end, len)) return false;
-    if (static_cast<size_t>(end - p) < len) return false;
-    std::string s(reinterpret_cast<const char*>(p), reinterpret_cast<const char*>(p + len));
-    while (!s.empty() && s.back() == '\0') s.pop_back();
-    p += len;
-    size_t pad = Pad4(len);
-    if (static_cast<size_t>(end - p) < pad) return false;
-    p += pad;
-    out = NSObject(std::move(s));
+    const size_t padded = static_cast<size_t>(len) + Pad4(len);
+    if (static_cast<size_t>(end - p) < padded) return false;
+    extent = 4 + padded;
     return true;
 }
+} // namespace
 
-static bool DecodeData(const uint8_t*& p, const uint8_t* end, NSObject& out) {
-    uint32_t len = 0;
-    if (!ReadU32(p, end, len)) return false;
-    if (static_cast<size_t>(end - p) < len) return false;
-    std::vector<uint8_t> data(p, p + len);
-    p += len;
-    size_t pad = Pad4(len);
-    if (static_cast<size_t>(end - p) < pad) return false;
-    p += pad;
-    out = NSObject(std::move(data));
+// --- XPCValue ---
+
+bool XPCValue::Parse(const uint8_t*& p, const uint8_t* end, XPCValue& out) {
+    out = XPCValue{};
+    uint32_t typeU32 = 0;
+    if (!ReadU32(p, end, typeU32)) return false;
+
+    const XPCType type = static_cast<XPCType>(typeU32);
+    const size_t available = static_cast<size_t>(end - p);
+    size_t extent = 0;
+    switch (type) {
+        case XPCType::Null:
+            break;
+        case XPCType::Bool:
+            extent = 4;
+            break;
+        case XPCType::Int64:
+        case XPCType::UInt64:
+        case XPCType::Double:
+        case XPCType::Date:
+            extent = 8;
+            break;
+        case XPCType::Uuid:
+            extent = 16;
+            break;
+        case XPCType::String:
+        case XPCType::Data:
+            if (!SkipSized(p, end, extent)) return false;
+            break;
+        case XPCType::Array: {
+            // payload length, entry count, entries
+            if (available < 8) return false;
+            const uint32_t payloadLen = PeekU32(p);
+            if (available - 8 < payloadLen) return false;
+            extent = 8 + static_cast<size_t>(payloadLen);
+            break;
+        }
+        case XPCType::Dictionary: {
+            // payload length, then entry count + entries inside the payload
+            if (available < 4) return false;
+            const uint32_t payloadLen = PeekU32(p);
+            if (available - 4 < payloadLen || payloadLen < 4) return false;
+            extent = 4 + static_cast<size_t>(payloadLen);
+            break;
+        }
+        case XPCType::FileTransfer: {
+            // message id, then the wrapped object
+            if (available < 8) return false;
+            const uint8_t* nested = p + 8;
+            XPCValue inner;
+            if (!Parse(nested, end, inner)) return false;
+            extent = static_cast<size_t>(nested - p);
+            break;
+        }
+        default:
+            INST_LOG_DEBUG(TAG, "Unsupported XPC object type: 0x%08x", typeU32);
+            return false;
+    }
+    if (available < extent) return false;
+
+    out.m_type = type;
+    out.m_data = p;
+    out.m_length = extent;
+    p += extent;
     return true;
 }
 
-static bool DecodeArray(const uint8_t*& p, const uint8_t* end, NSObject& out) {
-    uint32_t payloadLen = 0;
-    uint32_t numEntries = 0;
-    if (!ReadU32(p, end, payloadLen)) return false;
-    if (!ReadU32(p, end, numEntries)) return false;
-    if (static_cast<size_t>(end - p) < payloadLen) return false;
-    const uint8_t* payloadEnd = p + payloadLen;
-
-    NSObject::ArrayType arr;
-    arr.reserve(numEntries);
-    for (uint32_t i = 0; i < numEntries; i++) {
-        NSObject item = NSObject::Null();
-        if (!DecodeObject(p, payloadEnd, item)) return false;
-        arr.push_back(std::move(item));
+bool XPCValue::AsBool() const {
+    return m_type == XPCType::Bool && m_data[0] != 0;
+}
+
+int64_t XPCValue::AsInt64() const {
+    return static_cast<int64_t>(AsUInt64());
+}
+
+uint64_t XPCValue::AsUInt64() const {
+    if (m_type != XPCType::Int64 && m_type != XPCType::UInt64 && m_type != XPCType::Date) {
+        return 0;
     }
-    p = payloadEnd;
-    out = NSObject(std::move(arr));
-    return true;
+    const uint8_t* p = m_data;
+    uint64_t v = 0;
+    ReadU64(p, m_data + m_length, v);
+    return v;
+}
+
+double XPCValue::AsDouble() const {
+    if (m_type != XPCType::Double) return static_cast<double>(AsInt64());
+    const uint8_t* p = m_data;
+    uint64_t bits = 0;
+    ReadU64(p, m_data + m_length, bits);
+    double d = 0.0;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+std::string_view XPCValue::AsString() const {
+    if (m_type != XPCType::String) return {};
+    size_t len = PeekU32(m_data);
+    const char* chars = reinterpret_cast<const char*>(m_data + 4);
+    while (len > 0 && chars[len - 1] == '\0') len--;
+    return std::string_view(chars, len);
+}
+
+const uint8_t* XPCValue::DataBytes() const {
+    return m_type == XPCType::Data ? m_data + 4 : nullptr;
 }
 
-static bool DecodeDictionary(const uint8_t*& p, const uint8_t* end, NSObject& out) {
-    uint32_t payloadLen = 0;
-    uint32_t numEntries = 0;
-    if (!ReadU32(p, end, payloadLen)) return false;
-    if (static_cast<size_t>(end - p) < payloadLen) return false;
-    const uint8_t* payloadEnd = p + payloadLen;
-    if (!ReadU32(p, payloadEnd, numEntries)) return false;
-
-    NSObject::DictType dict;
-    for (uint32_t i = 0; i < numEntries; i++) {
-        const uint8_t* keyStart = p;
-        while (p < payloadEnd && *p != 0) p++;
-        if (p >= payloadEnd) return false;
-        std::string key(reinterpret_cast<const char*>(keyStart), reinterpret_cast<const char*>(p));
-        p++; // skip null
-        size_t keyRawLen = key.size() + 1;
-        size_t pad = Pad4(keyRawLen);
-        if (static_cast<size_t>(payloadEnd - p) < pad) return false;
-        p += pad;
-
-        NSObject val = NSObject::Null();
-        if (!DecodeObject(p, payloadEnd, val)) return false;
-        dict[key] = std::move(val);
+size_t XPCValue::DataLength() const {
+    return m_type == XPCType::Data ? PeekU32(m_data) : 0;
+}
+
+size_t XPCValue::Count() const {
+    // Both containers keep the entry count right after the payload length
+    if (m_type != XPCType::Array && m_type != XPCType::Dictionary) return 0;
+    return m_length >= 8 ? PeekU32(m_data + 4) : 0;
+}
+
+XPCEntries XPCValue::Items() const {
+    if ((m_type != XPCType::Array && m_type != XPCType::Dictionary) || m_length < 8) {
+        return {};
     }
-    p = payloadEnd;
-    out = NSObject(std::move(dict));
-    return true;
+    return XPCEntries(m_data + 8, m_data + m_length, PeekU32(m_data + 4),
+                      m_type == XPCType::Dictionary);
 }
 
-static std::string FormatUuid(const uint8_t* b16) {
-    char s[37] = {0};
-    std::snprintf(
-        s, sizeof(s),
-        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-        b16[0], b16[1], b16[2], b16[3], b16[4], b16[5], b16[6], b16[7],
-        b16[8], b16[9], b16[10], b16[11], b16[12], b16[13], b16[14], b16[15]);
-    return std::string(s);
+XPCValue XPCValue::Find(std::string_view key) const {
+    if (m_type != XPCType::Dictionary) return {};
+    for (const auto& entry : Items()) {
+        if (entry.key == key) return entry.value;
+    }
+    return {};
 }
 
-static bool DecodeObject(const uint8_t*& p, const uint8_t* end, NSObject& out) {
-    uint32_t typeU32 = 0;
-    if (!ReadU32(p, end, typeU32)) return false;
-    XpcType type = static_cast<XpcType>(typeU32);
+NSObject XPCValue::ToObject() const {
+    NSObject out = NSObject::Null();
+    ToObject(out);
+    return out;
+}
 
-    switch (type) {
-        case XpcType::Null:
+bool XPCValue::ToObject(NSObject& out) const {
+    switch (m_type) {
+        case XPCType::Null:
             out = NSObject::Null();
             return true;
-        case XpcType::Bool: {
-            if (static_cast<size_t>(end - p) < 4) return false;
-            bool b = (p[0] != 0);
-            p += 4;
-            out = NSObject(b);
+        case XPCType::Bool:
+            out = NSObject(AsBool());
             return true;
-        }
-        case XpcType::Int64: {
-            uint64_t u = 0;
-            if (!ReadU64(p, end, u)) return false;
-            out = NSObject(static_cast<int64_t>(u));
+        case XPCType::Int64:
+        case XPCType::Date:
+            out = NSObject(AsInt64());
             return true;
-        }
-        case XpcType::UInt64: {
-            uint64_t u = 0;
-            if (!ReadU64(p, end, u)) return false;
-            out = NSObject(u);
+        case XPCType::UInt64:
+            out = NSObject(AsUInt64());
             return true;
-        }
-        case XpcType::Double: {
-            uint64_t bits = 0;
-            if (!ReadU64(p, end, bits)) return false;
-            double d = 0.0;
-            std::memcpy(&d, &bits, sizeof(d));
-            out = NSObject(d);
+        case XPCType::Double:
+            out = NSObject(AsDouble());
             return true;
-        }
-        case XpcType::Date: {
-            uint64_t u = 0;
-            if (!ReadU64(p, end, u)) return false;
-            out = NSObject(static_cast<int64_t>(u));
+        case XPCType::String:
+            out = NSObject(std::string(AsString()));
             return true;
-        }
-        case XpcType::String:
-            return DecodeString(p, end, out);
-        case XpcType::Data:
-            return DecodeData(p, end, out);
-        case XpcType::Uuid: {
-            if (static_cast<size_t>(end - p) < 16) return false;
-            const std::string uuidText = FormatUuid(p);
-            p += 16;
-            out = NSObject(uuidText);
+        case XPCType::Data:
+            out = NSObject(std::vector<uint8_t>(DataBytes(), DataBytes() + DataLength()));
+            return true;
+        case XPCType::Uuid:
+            out = NSObject(FormatUuid(m_data));
             return true;
+        case XPCType::Array: {
+            NSObject::ArrayType arr;
+            arr.reserve(Count());
+            bool ok = true;
+            for (const auto& entry : Items()) {
+                arr.push_back(NSObject::Null());
+                ok = entry.value.ToObject(arr.back()) && ok;
+            }
+            ok = ok && arr.size() == Count();
+            out = NSObject(std::move(arr));
+            return ok;
+        }
+        case XPCType::Dictionary: {
+            NSObject::DictType dict;
+            bool ok = true;
+            size_t entries = 0;
+            for (const auto& entry : Items()) {
+                NSObject value = NSObject::Null();
+                ok = entry.value.ToObject(value) && ok;
+                dict[std::string(entry.key)] = std::move(value);
+                entries++;
+            }
+            ok = ok && entries == Count();
+            out = NSObject(std::move(dict));
+            return ok;
         }
-        case XpcType::Array:
-            return DecodeArray(p, end, out);
-        case XpcType::Dictionary:
-            return DecodeDictionary(p, end, out);
-        case XpcType::FileTransfer: {
+        case XPCType::FileTransfer: {
+            const uint8_t* p = m_data;
             uint64_t msgId = 0;
-            if (!ReadU64(p, end, msgId)) return false;
-            NSObject nested = NSObject::Null();
-            if (!DecodeObject(p, end, nested)) return false;
+            ReadU64(p, m_data + m_length, msgId);
+            XPCValue nested;
+            Parse(p, m_data + m_length, nested);
             NSObject::DictType ft;
             ft["MsgId"] = NSObject(msgId);
-            ft["Value"] = std::move(nested);
+            ft["Value"] = NSObject::Null();
+            const bool ok = nested.ToObject(ft["Value"]);
             out = NSObject(std::move(ft));
-            return true;
+            return ok;
         }
         default:
-            INST_LOG_DEBUG(TAG, "Unsupported XPC object type: 0x%08x", typeU32);
+            out = NSObject::Null();
             return false;
     }
 }
-} // namespace
-
-std::vector<uint8_t> XPCMessage::Encode() const {
-    std::vector<uint8_t> out;
-    out.reserve(64);
-
-    WriteU32(out, kWrapperMagic);
-    WriteU32(out, flags);
 
-    std::vector<uint8_t> bodyPayload;
-    if (!body.IsNull()) {
-        if (!EncodeObject(body, bodyPayload)) {
-            INST_LOG_WARN(TAG, "Failed to encode XPC body object");
-            bodyPayload.clear();
+void XPCEntries::Iterator::Advance() {
+    if (m_remaining == 0) return;
+    if (--m_remaining == 0) return;
+
+    m_entry = XPCEntry{};
+    if (m_keyed) {
+        // NUL-terminated key padded to 4 bytes
+        const uint8_t* keyStart = m_next;
+        const uint8_t* keyEnd = static_cast<const uint8_t*>(
+            std::memchr(keyStart, 0, static_cast<size_t>(m_end - keyStart)));
+        const size_t keyRawLen = keyEnd ? static_cast<size_t>(keyEnd - keyStart) + 1 : 0;
+        if (!keyEnd || static_cast<size_t>(m_end - keyStart) < keyRawLen + Pad4(keyRawLen)) {
+            m_remaining = 0;
+            return;
         }
+        m_entry.key = std::string_view(reinterpret_cast<const char*>(keyStart), keyRawLen - 1);
+        m_next = keyStart + keyRawLen + Pad4(keyRawLen);
     }
+    if (!XPCValue::Parse(m_next, m_end, m_entry.value)) {
+        INST_LOG_DEBUG(TAG, "Malformed XPC %s entry, stopping", m_keyed ? "dictionary" : "array");
+        m_remaining = 0;
+    }
+}
 
-    uint64_t bodyLen = bodyPayload.empty() ? 0 : static_cast<uint64_t>(8 + bodyPayload.size());
-    WriteU64(out, bodyLen);
+// --- XPCMessage ---
+
+void XPCMessage::EncodeTo(std::vector<uint8_t>& out) const {
+    WriteU32(out, kWrapperMagic);
+    WriteU32(out, flags);
+    const size_t bodyLenPos = out.size();
+    WriteU64(out, 0);
     WriteU64(out, messageId);
 
-    if (!bodyPayload.empty()) {
-        WriteU32(out, kObjectMagic);
-        WriteU32(out, kBodyVersion);
-        out.insert(out.end(), bodyPayload.begin(), bodyPayload.end());
+    if (body.IsNull()) return;
+
+    const size_t bodyStart = out.size();
+    WriteU32(out, kObjectMagic);
+    WriteU32(out, kBodyVersion);
+    if (!EncodeObject(body, out)) {
+        INST_LOG_WARN(TAG, "Failed to encode XPC body object");
+        out.resize(bodyStart);
+        return;
     }
+    PatchU64(out, bodyLenPos, static_cast<uint64_t>(out.size() - bodyStart));
+}
 
+std::vector<uint8_t> XPCMessage::Encode() const {
+    std::vector<uint8_t> out;
+    out.reserve(64);
+    EncodeTo(out);
     return out;
 }
 
-bool XPCMessage::Decode(const uint8_t* data, size_t length, XPCMessage& outMsg) {
+bool XPCMessage::Decode(const uint8_t* data, size_t length, XPCMessageView& outMsg) {
     if (!data || length < 24) {
         INST_LOG_WARN(TAG, "XPC message too small: %zu bytes", length);
         return false;
@@ -370,7 +476,7 @@ bool XPCMessage::Decode(const uint8_t* data, size_t length, XPCMessage& outMsg)
     if (!ReadU64(p, end, bodyLen)) return false;
     if (!ReadU64(p, end, outMsg.messageId)) return false;
 
-    outMsg.body = NSObject::Null();
+    outMsg.body = XPCValue::Null();
     if (bodyLen == 0) return true;
 
     if (static_cast<uint64_t>(end - p) < bodyLen || bodyLen < 8) {
@@ -388,21 +494,25 @@ bool XPCMessage::Decode(const uint8_t* data, size_t length, XPCMessage& outMsg)
         return false;
     }
 
-    NSObject bodyObj = NSObject::Null();
-    if (!DecodeObject(p, bodyEnd, bodyObj)) {
-        uint32_t maybeType = 0;
-        if (static_cast<size_t>(bodyEnd - p) >= 4) {
-            const uint8_t* t = p;
-            maybeType = static_cast<uint32_t>(t[0])
-                      | (static_cast<uint32_t>(t[1]) << 8)
-                      | (static_cast<uint32_t>(t[2]) << 16)
-                      | (static_cast<uint32_t>(t[3]) << 24);
-        }
+    const uint8_t* object = p;
+    if (!XPCValue::Parse(object, bodyEnd, outMsg.body)) {
         INST_LOG_WARN(TAG, "Failed to decode XPC body object (nextType=0x%08x, remaining=%zu)",
-                      maybeType, static_cast<size_t>(bodyEnd - p));
+                      static_cast<size_t>(bodyEnd - p) >= 4 ? PeekU32(p) : 0u,
+                      static_cast<size_t>(bodyEnd - p));
+        return false;
+    }
+    return true;
+}
+
+bool XPCMessage::Decode(const uint8_t* data, size_t length, XPCMessage& outMsg) {
+    XPCMessageView view;
+    if (!Decode(data, length, view)) return false;
+    outMsg.flags = view.flags;
+    outMsg.messageId = view.messageId;
+    if (!view.body.ToObject(outMsg.body)) {
+        INST_LOG_WARN(TAG, "Malformed entries in XPC body object");
         return false;
     }
-    outMsg.body = std::move(bodyObj);
     return true;
 }
 
@@ -410,11 +520,113 @@ bool XPCMessage::Decode(const std::vector<uint8_t>& data, XPCMessage& outMsg) {
     return Decode(data.data(), data.size(), outMsg);
 }
 
+// --- XPCStreamDecoder ---
+
+void XPCStreamDecoder::Append(const uint8_t* payload, size_t length, const MessageFn& onMessage) {
+    if (m_buffer.empty()) {
+        const size_t used = Extract(payload, length, onMessage);
+        m_buffer.assign(payload + used, payload + length);
+        return;
+    }
+
+    m_buffer.insert(m_buffer.end(), payload, payload + length);
+    const size_t used = Extract(m_buffer.data(), m_buffer.size(), onMessage);
+    if (used > 0) {
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + used);
+    }
+}
+
+// Hand out every complete message in [data, data + size); returns the
+// bytes used up (the rest is a partial message)
+size_t XPCStreamDecoder::Extract(const uint8_t* data, size_t size, const MessageFn& onMessage) {
+    constexpr uint64_t kMaxXpcFrameLen = 8ULL * 1024ULL * 1024ULL; // sanity cap
+
+    size_t offset = 0;
+    while (size >= offset + 24) {
+        const uint8_t* p = data + offset;
+
+        if (PeekU32(p) != kWrapperMagic) {
+            // Resync: find next potential wrapper header.
+            size_t next = offset + 1;
+            while (next + 4 <= size) {
+                if (PeekU32(data + next) == kWrapperMagic) break;
+                ++next;
+            }
+            INST_LOG_WARN(TAG, "XPC stream lost sync, dropped %zu byte(s)", next - offset);
+            offset = next;
+            continue;
+        }
+
+        const uint8_t* lengthField = p + 8;
+        uint64_t bodyLen = 0;
+        ReadU64(lengthField, p + 16, bodyLen);
+        const uint64_t totalLen64 = 24 + bodyLen;
+        if (totalLen64 > kMaxXpcFrameLen) {
+            INST_LOG_WARN(TAG, "XPC message too large (%llu), dropping 1 byte",
+                          static_cast<unsigned long long>(totalLen64));
+            offset += 1;
+            continue;
+        }
+
+        const size_t totalLen = static_cast<size_t>(totalLen64);
+        if (size - offset < totalLen) {
+            // Partial XPC message, wait for more DATA frames.
+            break;
+        }
+
+        if (onMessage(p, totalLen)) {
+            offset += totalLen;
+            continue;
+        }
+
+        // Decoder rejected this candidate. Advance one byte and try to resync.
+        INST_LOG_WARN(TAG, "Failed to decode XPC message, attempting resync");
+        offset += 1;
+    }
+    return offset;
+}
+
+// --- CoreDevice requests ---
+
+// Random (version 4) UUID string for CoreDevice invocation identifiers
+static std::string RandomUuid() {
+    static std::mutex mutex;
+    static std::mt19937_64 rng{std::random_device{}()};
+    uint8_t bytes[16];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint64_t hi = rng();
+        const uint64_t lo = rng();
+        for (int i = 0; i < 8; i++) {
+            bytes[i] = static_cast<uint8_t>(hi >> (8 * i));
+            bytes[8 + i] = static_cast<uint8_t>(lo >> (8 * i));
+        }
+    }
+    bytes[6] = static_cast<uint8_t>((bytes[6] & 0x0F) | 0x40);
+    bytes[8] = static_cast<uint8_t>((bytes[8] & 0x3F) | 0x80);
+    std::string uuid = FormatUuid(bytes);
+    for (char& c : uuid) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return uuid;
+}
+
 NSObject XPCServiceRequest::ToBody() const {
     NSObject::DictType body;
     body["CoreDevice.featureIdentifier"] = NSObject(featureIdentifier);
     body["CoreDevice.action"] = NSObject::MakeDict({});
     body["CoreDevice.input"] = payload;
+    body["CoreDevice.invocationIdentifier"] = NSObject(RandomUuid());
+    body["CoreDevice.deviceIdentifier"] = NSObject(RandomUuid());
+    body["CoreDevice.CoreDeviceDDIProtocolVersion"] = NSObject(static_cast<int64_t>(0));
+
+    // Version of the CoreDevice framework the request claims to come from
+    NSObject::DictType version;
+    version["components"] = NSObject(NSObject::ArrayType{
+        NSObject(static_cast<uint64_t>(348)), NSObject(static_cast<uint64_t>(1)),
+        NSObject(static_cast<uint64_t>(0)), NSObject(static_cast<uint64_t>(0)),
+        NSObject(static_cast<uint64_t>(0))});
+    version["originalComponentsCount"] = NSObject(static_cast<int64_t>(2));
+    version["stringValue"] = NSObject("348.1");
+    body["CoreDevice.coreDeviceVersion"] = NSObject(std::move(version));
     return NSObject(std::move(body));
 }
 
@@ -3,7 +3,9 @@
 
 #include "../nskeyedarchiver/nsobject.h"
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace instruments {
@@ -13,11 +15,146 @@ namespace XPCFlags {
     constexpr uint32_t AlwaysSet = 0x00000001;
     constexpr uint32_t Data = 0x00000100;
     constexpr uint32_t Ping = 0x00010000;
+    constexpr uint32_t WantingReply = Ping;     // request that expects a reply
     constexpr uint32_t Pong = 0x00020000;
     constexpr uint32_t FileOpen = 0x00100000;
     constexpr uint32_t InitHandshake = 0x00400000;
 }
 
+// RemoteXPC stream initialization every connection performs before its
+// first request (matches go-ios initializeXpcConnection); each step waits
+// for a reply on its stream
+struct XPCInitStep {
+    uint32_t streamId;
+    uint32_t flags;
+    bool emptyDictBody;     // {} instead of no body
+};
+inline constexpr XPCInitStep kXPCInitSteps[] = {
+    {1, XPCFlags::AlwaysSet, true},
+    {3, XPCFlags::AlwaysSet | XPCFlags::InitHandshake, false},
+    {1, 0x201, false},
+};
+
+// XPC object type tags as they appear on the wire
+enum class XPCType : uint32_t {
+    Invalid      = 0,            // XPCValue only: malformed or absent
+    Null         = 0x00001000,
+    Bool         = 0x00002000,
+    Int64        = 0x00003000,
+    UInt64       = 0x00004000,
+    Double       = 0x00005000,
+    Date         = 0x00007000,
+    Data         = 0x00008000,
+    String       = 0x00009000,
+    Uuid         = 0x0000a000,
+    Array        = 0x0000e000,
+    Dictionary   = 0x0000f000,
+    FileTransfer = 0x0001a000,
+};
+
+class XPCEntries;
+
+// One XPC object read in place. Scalars are read on access; arrays and
+// dictionaries are walked with Items() without building anything, so a
+// caller pulls out the fields it wants and skips the rest. Points into the
+// message bytes, which must outlive it.
+class XPCValue {
+public:
+    XPCValue() = default;
+    static XPCValue Null() { XPCValue v; v.m_type = XPCType::Null; return v; }
+
+    // Read the object at [p, end) and advance p past it
+    static bool Parse(const uint8_t*& p, const uint8_t* end, XPCValue& out);
+
+    XPCType Type() const { return m_type; }
+    bool IsValid() const { return m_type != XPCType::Invalid; }
+    bool IsNull() const { return m_type == XPCType::Null; }
+    bool IsDict() const { return m_type == XPCType::Dictionary; }
+    bool IsArray() const { return m_type == XPCType::Array; }
+    bool IsString() const { return m_type == XPCType::String; }
+
+    // Scalars (0 / false / empty for other types). Int64/UInt64/Date read
+    // as integers of either sign; String drops the trailing NUL.
+    bool AsBool() const;
+    int64_t AsInt64() const;
+    uint64_t AsUInt64() const;
+    double AsDouble() const;
+    std::string_view AsString() const;
+    const uint8_t* DataBytes() const;
+    size_t DataLength() const;
+
+    // Entries of an array or dictionary (none otherwise)
+    size_t Count() const;
+    XPCEntries Items() const;
+
+    // Dictionary lookup by walking the entries (invalid if absent)
+    XPCValue Find(std::string_view key) const;
+    XPCValue operator[](std::string_view key) const { return Find(key); }
+
+    // Build the NSObject tree for this value (and everything under it).
+    // The bool form fails on malformed nested entries instead of keeping
+    // what came before them.
+    NSObject ToObject() const;
+    bool ToObject(NSObject& out) const;
+
+private:
+    XPCType m_type = XPCType::Invalid;
+    const uint8_t* m_data = nullptr;   // bytes after the type tag
+    size_t m_length = 0;
+};
+
+struct XPCEntry {
+    std::string_view key;   // empty for array items
+    XPCValue value;
+};
+
+// Dictionary entries (or array items) in wire order, parsed while
+// iterating. Iteration stops early at malformed bytes.
+class XPCEntries {
+public:
+    class Iterator {
+    public:
+        const XPCEntry& operator*() const { return m_entry; }
+        const XPCEntry* operator->() const { return &m_entry; }
+        Iterator& operator++() { Advance(); return *this; }
+        bool operator==(const Iterator& other) const { return m_remaining == other.m_remaining; }
+        bool operator!=(const Iterator& other) const { return m_remaining != other.m_remaining; }
+
+    private:
+        friend class XPCEntries;
+        Iterator(const uint8_t* p, const uint8_t* end, uint32_t count, bool keyed)
+            : m_next(p), m_end(end), m_remaining(count + 1), m_keyed(keyed) { Advance(); }
+        void Advance();
+
+        const uint8_t* m_next;
+        const uint8_t* m_end;
+        uint32_t m_remaining;   // entries left including m_entry; 0 once past the end
+        bool m_keyed;
+        XPCEntry m_entry;
+    };
+
+    XPCEntries() = default;
+    XPCEntries(const uint8_t* first, const uint8_t* end, uint32_t count, bool keyed)
+        : m_first(first), m_end(end), m_count(count), m_keyed(keyed) {}
+
+    Iterator begin() const { return Iterator(m_first, m_end, m_count, m_keyed); }
+    Iterator end() const { return Iterator(m_end, m_end, 0, m_keyed); }
+    bool empty() const { return m_count == 0; }
+
+private:
+    const uint8_t* m_first = nullptr;
+    const uint8_t* m_end = nullptr;
+    uint32_t m_count = 0;
+    bool m_keyed = false;
+};
+
+// XPC message header with its body read in place (see XPCValue)
+struct XPCMessageView {
+    uint32_t flags = 0;
+    uint64_t messageId = 0;
+    XPCValue body;          // Null if the message has no body
+};
+
 // XPC Message - used for iOS 17+ communication over HTTP/2.
 // This is the wire format for CoreDevice/RSD protocol.
 struct XPCMessage {
@@ -28,9 +165,37 @@ struct XPCMessage {
     // Encode to binary
     std::vector<uint8_t> Encode() const;
 
+    // Append the encoded message to out (for reused or frame buffers);
+    // nested lengths are patched in place, no intermediate copies
+    void EncodeTo(std::vector<uint8_t>& out) const;
+
     // Decode from binary
     static bool Decode(const uint8_t* data, size_t length, XPCMessage& outMsg);
     static bool Decode(const std::vector<uint8_t>& data, XPCMessage& outMsg);
+
+    // Decode only the header; the body stays in data as an XPCValue
+    static bool Decode(const uint8_t* data, size_t length, XPCMessageView& outMsg);
+};
+
+// Reassembles the XPC messages of one HTTP/2 stream from its DATA
+// payloads. Messages within one payload are handed out straight from it;
+// only a partial message is copied to wait for the next payload. Lost sync
+// (bad magic, oversized or rejected message) skips to the next wrapper.
+class XPCStreamDecoder {
+public:
+    // Called per complete message (bytes valid during the call); return
+    // false to reject it and resync
+    using MessageFn = std::function<bool(const uint8_t* data, size_t length)>;
+
+    void Append(const uint8_t* payload, size_t length, const MessageFn& onMessage);
+
+    // Bytes of a partial message waiting for more payload
+    size_t Buffered() const { return m_buffer.size(); }
+
+private:
+    size_t Extract(const uint8_t* data, size_t size, const MessageFn& onMessage);
+
+    std::vector<uint8_t> m_buffer;
 };
 
 // XPC-based service request for iOS 17+ AppService
@@ -0,0 +1,77 @@
+#include "dtx_budget.h"
+#include "../../include/instruments/dtx_message.h"
+
+namespace instruments {
+
+DTXQueueBudget::DTXQueueBudget(size_t maxMessages, size_t maxBytes)
+    : m_maxMessages(maxMessages)
+    , m_maxBytes(maxBytes)
+{
+}
+
+size_t DTXQueueBudget::Footprint(const DTXMessage& message) {
+    return sizeof(DTXMessage) + message.RawPayload().capacity() + message.RawAuxiliary().capacity();
+}
+
+bool DTXQueueBudget::OverLocked() const {
+    return (m_maxMessages > 0 && m_messages >= m_maxMessages) ||
+           (m_maxBytes > 0 && m_bytes >= m_maxBytes);
+}
+
+void DTXQueueBudget::Add(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_messages++;
+    m_bytes += bytes;
+}
+
+void DTXQueueBudget::Release(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_messages--;
+    m_bytes -= bytes;
+    if (OverLocked()) return;
+    m_roomCv.notify_all();
+    if (m_paused) {
+        m_paused = false;
+        if (m_resume) m_resume();
+    }
+}
+
+bool DTXQueueBudget::WaitForRoom() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_roomCv.wait(lock, [this]() { return m_shutdown || !OverLocked(); });
+    return !m_shutdown;
+}
+
+bool DTXQueueBudget::PauseIfOver(const std::function<void()>& pause) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_shutdown || !OverLocked()) return false;
+    if (!m_paused) {
+        m_paused = true;
+        pause();
+    }
+    return true;
+}
+
+void DTXQueueBudget::SetResumeHandler(std::function<void()> resume) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_resume = std::move(resume);
+}
+
+void DTXQueueBudget::Shutdown() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+    m_resume = nullptr;
+    m_roomCv.notify_all();
+}
+
+size_t DTXQueueBudget::Messages() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_messages;
+}
+
+size_t DTXQueueBudget::Bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+} // namespace instruments
@@ -0,0 +1,64 @@
+#ifndef INSTRUMENTS_DTX_BUDGET_H
+#define INSTRUMENTS_DTX_BUDGET_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace instruments {
+
+class DTXMessage;
+
+// DTXQueueBudget - messages and bytes waiting in one connection's handler
+// queues, held against DTXMemoryBudget::maxQueuedMessages/maxQueuedBytes.
+// Queues Add() what they take and Release() it once handled or dropped;
+// the receive path stops reading from the transport while the budget is
+// exceeded, so the device is throttled by TCP flow control rather than
+// the host buffering without bound.
+//
+// The limit is soft by up to one receive buffer: frames already read are
+// still dispatched before reading pauses.
+class DTXQueueBudget {
+public:
+    DTXQueueBudget(size_t maxMessages, size_t maxBytes);
+
+    // Memory a queued message holds (payload, auxiliary, bookkeeping)
+    static size_t Footprint(const DTXMessage& message);
+
+    void Add(size_t bytes);
+    void Release(size_t bytes);
+
+    // Dedicated receive thread: wait while over budget. False once Shutdown().
+    bool WaitForRoom();
+
+    // Reactor: if over budget, run pause and remember to run resume once
+    // releases bring it back under. Both handlers run under the budget's
+    // lock, so a resume cannot overtake its pause. True if paused.
+    bool PauseIfOver(const std::function<void()>& pause);
+    void SetResumeHandler(std::function<void()> resume);
+
+    // Wake waiters and drop the resume handler (the connection is closing)
+    void Shutdown();
+
+    size_t Messages() const;
+    size_t Bytes() const;
+
+private:
+    bool OverLocked() const;
+
+    const size_t m_maxMessages;     // 0 = unlimited
+    const size_t m_maxBytes;        // 0 = unlimited
+    mutable std::mutex m_mutex;
+    std::condition_variable m_roomCv;
+    size_t m_messages = 0;
+    size_t m_bytes = 0;
+    bool m_paused = false;
+    bool m_shutdown = false;
+    std::function<void()> m_resume;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_DTX_BUDGET_H
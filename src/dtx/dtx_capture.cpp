@@ -0,0 +1,283 @@
+#include "dtx_capture.h"
+#include "../util/log.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+namespace instruments {
+
+static const char* TAG = "DTXCapture";
+
+static constexpr char kMagic[8] = {'D', 'T', 'X', 'C', 'A', 'P', '0', '1'};
+static constexpr size_t kRecordHeaderLength = 16;
+
+static void PutLE(uint8_t* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+static uint64_t GetLE(const uint8_t* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return value;
+}
+
+// --- DTXCapture ---
+
+// Parse the file header at the start of bytes; returns its length, 0 if
+// bytes do not start with a complete capture header
+static size_t ParseInfo(const std::vector<uint8_t>& bytes, DTXCaptureInfo& out) {
+    if (bytes.size() < sizeof(kMagic) + 4 ||
+        std::memcmp(bytes.data(), kMagic, sizeof(kMagic)) != 0) {
+        return 0;
+    }
+    size_t pos = sizeof(kMagic);
+    out.protocol = static_cast<IOSProtocol>(GetLE(bytes.data() + pos, 4));
+    pos += 4;
+    for (std::string* value : {&out.iosVersion, &out.service}) {
+        if (bytes.size() - pos < 2) return 0;
+        const size_t length = static_cast<size_t>(GetLE(bytes.data() + pos, 2));
+        pos += 2;
+        if (bytes.size() - pos < length) return 0;
+        value->assign(reinterpret_cast<const char*>(bytes.data() + pos), length);
+        pos += length;
+    }
+    return pos;
+}
+
+// Read up to maxLength bytes of path (all of it by default)
+static bool ReadFile(const std::string& path, std::vector<uint8_t>& out,
+                     size_t maxLength = SIZE_MAX) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        INST_LOG_ERROR(TAG, "Cannot open %s", path.c_str());
+        return false;
+    }
+    uint8_t chunk[64 * 1024];
+    size_t n = 0;
+    while (out.size() < maxLength &&
+           (n = std::fread(chunk, 1, std::min(sizeof(chunk), maxLength - out.size()), file)) > 0) {
+        out.insert(out.end(), chunk, chunk + n);
+    }
+    std::fclose(file);
+    return true;
+}
+
+bool DTXCapture::ReadInfo(const std::string& path, DTXCaptureInfo& out) {
+    // Magic, protocol and two strings of at most 64 KiB
+    std::vector<uint8_t> bytes;
+    if (!ReadFile(path, bytes, sizeof(kMagic) + 4 + 2 * (2 + 0xFFFF))) return false;
+    return ParseInfo(bytes, out) > 0;
+}
+
+bool DTXCapture::Load(const std::string& path, DTXCapture& out) {
+    out = DTXCapture{};
+    std::vector<uint8_t> bytes;
+    if (!ReadFile(path, bytes)) return false;
+
+    size_t pos = ParseInfo(bytes, out.info);
+    if (pos == 0) {
+        INST_LOG_ERROR(TAG, "%s is not a DTX capture", path.c_str());
+        return false;
+    }
+
+    while (bytes.size() - pos >= kRecordHeaderLength) {
+        const uint8_t* header = bytes.data() + pos;
+        const size_t length = static_cast<size_t>(GetLE(header + 4, 4));
+        if (bytes.size() - pos - kRecordHeaderLength < length) break;
+
+        DTXCaptureRecord record;
+        record.direction = header[0] == static_cast<uint8_t>(DTXCaptureDirection::Sent)
+            ? DTXCaptureDirection::Sent : DTXCaptureDirection::Received;
+        record.timestampUs = GetLE(header + 8, 8);
+        record.data.assign(header + kRecordHeaderLength, header + kRecordHeaderLength + length);
+        out.records.push_back(std::move(record));
+        pos += kRecordHeaderLength + length;
+    }
+    if (pos != bytes.size()) {
+        INST_LOG_WARN(TAG, "%s: dropped %zu bytes of a truncated record", path.c_str(),
+                      bytes.size() - pos);
+    }
+    return true;
+}
+
+// --- DTXCaptureWriter ---
+
+std::shared_ptr<DTXCaptureWriter> DTXCaptureWriter::Open(const std::string& path,
+                                                         const DTXCaptureInfo& info) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        INST_LOG_ERROR(TAG, "Cannot create %s", path.c_str());
+        return nullptr;
+    }
+
+    std::vector<uint8_t> header(kMagic, kMagic + sizeof(kMagic));
+    auto put = [&](uint64_t value, size_t bytes) {
+        const size_t at = header.size();
+        header.resize(at + bytes);
+        PutLE(header.data() + at, value, bytes);
+    };
+    auto putString = [&](const std::string& value) {
+        const size_t length = std::min<size_t>(value.size(), 0xFFFF);
+        put(length, 2);
+        header.insert(header.end(), value.begin(), value.begin() + length);
+    };
+    put(static_cast<uint32_t>(info.protocol), 4);
+    putString(info.iosVersion);
+    putString(info.service);
+    std::fwrite(header.data(), 1, header.size(), file);
+
+    INST_LOG_INFO(TAG, "Recording %s to %s", info.service.c_str(), path.c_str());
+    return std::shared_ptr<DTXCaptureWriter>(new DTXCaptureWriter(file));
+}
+
+DTXCaptureWriter::DTXCaptureWriter(FILE* file)
+    : m_file(file)
+    , m_start(std::chrono::steady_clock::now())
+{
+}
+
+DTXCaptureWriter::~DTXCaptureWriter() {
+    Close();
+}
+
+void DTXCaptureWriter::WriteRecordHeaderLocked(DTXCaptureDirection direction, size_t length) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_start).count();
+    uint8_t header[kRecordHeaderLength] = {};
+    header[0] = static_cast<uint8_t>(direction);
+    PutLE(header + 4, length, 4);
+    PutLE(header + 8, static_cast<uint64_t>(elapsed), 8);
+    std::fwrite(header, 1, sizeof(header), m_file);
+}
+
+void DTXCaptureWriter::Record(DTXCaptureDirection direction, const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file) return;
+    WriteRecordHeaderLocked(direction, length);
+    std::fwrite(data, 1, length, m_file);
+}
+
+void DTXCaptureWriter::Record(DTXCaptureDirection direction, const DTXWireSegments& wire) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file) return;
+    WriteRecordHeaderLocked(direction, wire.TotalLength());
+    for (size_t i = 0; i < wire.count; i++) {
+        std::fwrite(wire.segments[i].data, 1, wire.segments[i].length, m_file);
+    }
+}
+
+void DTXCaptureWriter::Close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file) return;
+    std::fclose(m_file);
+    m_file = nullptr;
+}
+
+// --- DTXReplay ---
+
+DTXReplay::DTXReplay(std::shared_ptr<const DTXCapture> capture, DTXReplayOptions options)
+    : m_capture(std::move(capture))
+    , m_options(options)
+{
+    for (const auto& record : m_capture->records) {
+        if (record.direction == DTXCaptureDirection::Sent) {
+            m_sentTimestamps.push_back(record.timestampUs);
+        }
+    }
+}
+
+size_t DTXReplay::NextReceivedLocked() {
+    const auto& records = m_capture->records;
+    while (m_next < records.size() && records[m_next].direction == DTXCaptureDirection::Sent) {
+        m_sentExpected++;
+        m_next++;
+    }
+    return m_next;
+}
+
+DTXReplay::Clock::time_point DTXReplay::DueLocked(size_t record) {
+    if (m_options.followClient && m_stats.framesSent < m_sentExpected) {
+        return Clock::time_point::max();
+    }
+    const uint64_t timestampUs = m_capture->records[record].timestampUs;
+    if (m_options.speed <= 0 || timestampUs <= m_anchorUs) return m_anchorWall;
+    const double delayUs = static_cast<double>(timestampUs - m_anchorUs) / m_options.speed;
+    return m_anchorWall + std::chrono::microseconds(static_cast<int64_t>(delayUs));
+}
+
+int DTXReplay::Read(uint8_t* buffer, size_t maxLength, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_started) {
+        m_started = true;
+        m_anchorWall = Clock::now();
+    }
+    const auto& records = m_capture->records;
+    const auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    // Wait for the next received frame to come due
+    auto now = Clock::now();
+    for (;;) {
+        if (m_closed) return -1;
+        const size_t record = NextReceivedLocked();
+        if (record == records.size()) return -1;
+        const auto due = DueLocked(record);
+        now = Clock::now();
+        if (due <= now) break;
+        if (now >= deadline) return 0;
+        m_cv.wait_until(lock, std::min(due, deadline));
+    }
+
+    // Hand out every frame that is due, as a socket would
+    maxLength = std::min<size_t>(maxLength, INT_MAX);
+    size_t copied = 0;
+    while (copied < maxLength) {
+        const size_t record = NextReceivedLocked();
+        if (record == records.size() || DueLocked(record) > now) break;
+        const auto& data = records[record].data;
+        const size_t n = std::min(maxLength - copied, data.size() - m_offset);
+        std::memcpy(buffer + copied, data.data() + m_offset, n);
+        copied += n;
+        m_offset += n;
+        if (m_offset == data.size()) {
+            m_next++;
+            m_offset = 0;
+            m_stats.framesDelivered++;
+        }
+    }
+    m_stats.bytesDelivered += copied;
+    return static_cast<int>(copied);
+}
+
+void DTXReplay::Write(size_t length) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_started) {
+            m_started = true;
+            m_anchorWall = Clock::now();
+        }
+        m_stats.framesSent++;
+        m_stats.bytesSent += length;
+        // Frames recorded after this send are timed from it
+        if (m_options.followClient && m_stats.framesSent <= m_sentTimestamps.size()) {
+            m_anchorWall = Clock::now();
+            m_anchorUs = m_sentTimestamps[m_stats.framesSent - 1];
+        }
+    }
+    m_cv.notify_all();
+}
+
+void DTXReplay::Close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_cv.notify_all();
+}
+
+DTXReplayStats DTXReplay::Stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+} // namespace instruments
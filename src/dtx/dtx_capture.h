@@ -0,0 +1,159 @@
+#ifndef INSTRUMENTS_DTX_CAPTURE_H
+#define INSTRUMENTS_DTX_CAPTURE_H
+
+#include "../../include/instruments/dtx_message.h"
+#include "../../include/instruments/types.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace instruments {
+
+// Capture file (.dtxcap) of one DTX connection, all integers little-endian:
+//
+//   "DTXCAP01"
+//   u32 protocol (IOSProtocol), u16 + bytes iOS version, u16 + bytes service
+//   records until end of file:
+//     u8 direction, u8[3] reserved, u32 length, u64 microseconds since start,
+//     then the bytes
+//
+// A received record is one DTX frame as the transport took it off the
+// wire; a sent record is one Send()/SendMessage() call.
+
+enum class DTXCaptureDirection : uint8_t {
+    Received = 0,
+    Sent = 1,
+};
+
+struct DTXCaptureInfo {
+    IOSProtocol protocol = IOSProtocol::Modern;
+    std::string iosVersion;
+    std::string service;
+};
+
+struct DTXCaptureRecord {
+    DTXCaptureDirection direction = DTXCaptureDirection::Received;
+    uint64_t timestampUs = 0;
+    std::vector<uint8_t> data;
+};
+
+// A capture file read into memory
+struct DTXCapture {
+    DTXCaptureInfo info;
+    std::vector<DTXCaptureRecord> records;
+
+    // Read path; false if it is not a capture. A record cut short at the
+    // end (recording process killed) is dropped.
+    static bool Load(const std::string& path, DTXCapture& out);
+
+    // Read only the file header
+    static bool ReadInfo(const std::string& path, DTXCaptureInfo& out);
+};
+
+// DTXCaptureWriter - appends the frames of one connection to a capture
+// file. Thread-safe: the receive path and senders record concurrently.
+class DTXCaptureWriter {
+public:
+    // nullptr if path cannot be created
+    static std::shared_ptr<DTXCaptureWriter> Open(const std::string& path,
+                                                  const DTXCaptureInfo& info);
+    ~DTXCaptureWriter();
+
+    // Non-copyable
+    DTXCaptureWriter(const DTXCaptureWriter&) = delete;
+    DTXCaptureWriter& operator=(const DTXCaptureWriter&) = delete;
+
+    void Record(DTXCaptureDirection direction, const uint8_t* data, size_t length);
+    void Record(DTXCaptureDirection direction, const DTXWireSegments& wire);
+
+    // Flush and close; later records are ignored
+    void Close();
+
+private:
+    explicit DTXCaptureWriter(FILE* file);
+
+    void WriteRecordHeaderLocked(DTXCaptureDirection direction, size_t length);
+
+    std::mutex m_mutex;
+    FILE* m_file = nullptr;
+    const std::chrono::steady_clock::time_point m_start;
+};
+
+struct DTXReplayOptions {
+    // 1 = original timing, 2 = twice as fast, 0 = as fast as possible
+    double speed = 1.0;
+    // Hold each received frame until the client has sent as many frames as
+    // preceded it in the capture, so replies never overtake their requests.
+    // Off for passive replay: every received frame plays on its own timing.
+    bool followClient = true;
+};
+
+struct DTXReplayStats {
+    uint64_t framesDelivered = 0;
+    uint64_t bytesDelivered = 0;
+    uint64_t framesSent = 0;        // client frames taken (and discarded)
+    uint64_t bytesSent = 0;
+};
+
+// DTXReplay - plays the received side of a capture back into a DTXTransport
+// in place of a device. Received frames come out of Read() at their
+// recorded offsets, measured from the client's send they followed (or from
+// the first read), scaled by speed; the client's sends are counted and
+// dropped. Read() reports the end once every received frame is delivered,
+// which the connection sees as the device closing it.
+class DTXReplay {
+public:
+    DTXReplay(std::shared_ptr<const DTXCapture> capture, DTXReplayOptions options = {});
+
+    // Non-copyable
+    DTXReplay(const DTXReplay&) = delete;
+    DTXReplay& operator=(const DTXReplay&) = delete;
+
+    // Copy up to maxLength bytes of due frames, waiting at most timeoutMs
+    // for the first. Returns the bytes read, 0 on timeout, -1 at the end
+    // of the capture or after Close().
+    int Read(uint8_t* buffer, size_t maxLength, int timeoutMs);
+
+    // One frame sent by the client
+    void Write(size_t length);
+
+    void Close();
+
+    const DTXCaptureInfo& Info() const { return m_capture->info; }
+    DTXReplayStats Stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Next received record at or after m_next, skipping sent ones
+    // (m_mutex held); the record count when there is none left
+    size_t NextReceivedLocked();
+    // Clock::time_point::max() while held back for the client
+    Clock::time_point DueLocked(size_t record);
+
+    std::shared_ptr<const DTXCapture> m_capture;
+    const DTXReplayOptions m_options;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_closed = false;
+    bool m_started = false;
+    size_t m_next = 0;                  // record being delivered
+    size_t m_offset = 0;                // bytes of m_next already delivered
+    uint64_t m_sentExpected = 0;        // sent records before m_next
+    // Timing anchor: the wall clock of the last client send (or the first
+    // read) and its recorded timestamp
+    Clock::time_point m_anchorWall;
+    uint64_t m_anchorUs = 0;
+    std::vector<uint64_t> m_sentTimestamps;  // recorded time of each sent record
+    DTXReplayStats m_stats;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_DTX_CAPTURE_H
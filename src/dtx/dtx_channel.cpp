@@ -1,8 +1,13 @@
 #include "../../include/instruments/dtx_channel.h"
 #include "../../include/instruments/dtx_connection.h"
+#include "dtx_dispatch_queue.h"
 #include "../util/log.h"
+#include "../util/metrics.h"
+#include "../util/trace.h"
+#include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <vector>
 
 namespace instruments {
 
@@ -12,6 +17,8 @@ DTXChannel::DTXChannel(DTXConnection* connection, const std::string& identifier,
     : m_connection(connection)
     , m_identifier(identifier)
     , m_channelCode(channelCode)
+    , m_handlerTime(&metrics::Handler(identifier))
+    , m_traceDevice(TraceDeviceScope::Current())
 {
 }
 
@@ -30,25 +37,20 @@ std::shared_ptr<DTXMessage> DTXChannel::SendMessageSync(
         INST_LOG_WARN(TAG, "Channel %s is cancelled", m_identifier.c_str());
         return nullptr;
     }
+    timeoutMs = m_connection->RequestTimeoutMs(timeoutMs);
 
     uint32_t msgId = NextIdentifier();
     message->SetIdentifier(msgId);
     message->SetChannelCode(m_channelCode);
     message->SetExpectsReply(true);
 
-    // Create waiter before sending
-    auto waiter = std::make_shared<ResponseWaiter>();
-    {
-        std::lock_guard<std::mutex> lock(m_waitersMutex);
-        m_waiters[msgId] = waiter;
-    }
-
-    INST_LOG_INFO(TAG, "[%s] SendSync id=%u: %s",
+    INST_LOG_TRACE(TAG, "[%s] SendSync id=%u: %s",
                   m_identifier.c_str(), msgId, message->Dump().c_str());
-    if (m_identifier == "_global_" && message->Selector() == "_requestChannelWithCode:identifier:") {
+    if (INST_LOG_ENABLED(Debug) && m_channelCode == 0 &&
+        message->SelectorView() == "_requestChannelWithCode:identifier:") {
         const auto& aux = message->RawAuxiliary();
         const auto& payload = message->RawPayload();
-        INST_LOG_INFO(TAG, "[%s] RequestChannel sizes: aux=%zu, payload=%zu",
+        INST_LOG_DEBUG(TAG, "[%s] RequestChannel sizes: aux=%zu, payload=%zu",
                       m_identifier.c_str(), aux.size(), payload.size());
         if (aux.size() >= 16) {
             std::string hexDump;
@@ -59,7 +61,7 @@ std::shared_ptr<DTXMessage> DTXChannel::SendMessageSync(
                 hexDump += buf;
                 if ((i + 1) % 16 == 0) hexDump += "\n";
             }
-            INST_LOG_INFO(TAG, "[%s] RequestChannel aux head:\n%s", m_identifier.c_str(), hexDump.c_str());
+            INST_LOG_DEBUG(TAG, "[%s] RequestChannel aux head:\n%s", m_identifier.c_str(), hexDump.c_str());
         }
 
         // Dump full encoded message for byte-level comparison with reference fixtures
@@ -72,7 +74,7 @@ std::shared_ptr<DTXMessage> DTXChannel::SendMessageSync(
                 out.write(reinterpret_cast<const char*>(frames[0].data()),
                           static_cast<std::streamsize>(frames[0].size()));
                 out.close();
-                INST_LOG_INFO(TAG, "[%s] RequestChannel dump written: %s (%zu bytes)",
+                INST_LOG_DEBUG(TAG, "[%s] RequestChannel dump written: %s (%zu bytes)",
                               m_identifier.c_str(), dumpPath, frames[0].size());
             } else {
                 INST_LOG_WARN(TAG, "[%s] Failed to write RequestChannel dump: %s",
@@ -82,45 +84,36 @@ std::shared_ptr<DTXMessage> DTXChannel::SendMessageSync(
 #endif
     }
 
-    // Send the message
-    Error err = m_connection->SendMessage(message);
-    if (err != Error::Success) {
-        std::lock_guard<std::mutex> lock(m_waitersMutex);
-        m_waiters.erase(msgId);
-        INST_LOG_ERROR(TAG, "Failed to send message: %s", ErrorToString(err));
-        return nullptr;
-    }
-    INST_LOG_INFO(TAG, "[%s] Message sent, waiting for response (timeout=%dms)...",
+    // The reply is registered before sending, so an immediate response is not missed
+    auto promise = std::make_shared<std::promise<std::shared_ptr<DTXMessage>>>();
+    auto reply = promise->get_future();
+    SendRequest(message, [promise](std::shared_ptr<DTXMessage> response) {
+        promise->set_value(std::move(response));
+    }, timeoutMs);
+    INST_LOG_TRACE(TAG, "[%s] Message sent, waiting for response (timeout=%dms)...",
                   m_identifier.c_str(), timeoutMs);
 
     // Wait for response
-    {
-        std::unique_lock<std::mutex> lock(waiter->mutex);
-        bool gotResponse = waiter->cv.wait_for(lock,
-            std::chrono::milliseconds(timeoutMs),
-            [&]{ return waiter->ready || m_cancelled.load(); });
-
-        if (!gotResponse || m_cancelled.load()) {
-            std::lock_guard<std::mutex> wlock(m_waitersMutex);
-            m_waiters.erase(msgId);
-            if (m_cancelled.load()) {
-                INST_LOG_ERROR(TAG, "Channel cancelled while waiting for response to id=%u", msgId);
-            } else {
-                INST_LOG_ERROR(TAG, "Timeout waiting for response to id=%u on %s (waited %dms)",
-                             msgId, m_identifier.c_str(), timeoutMs);
-            }
-            return nullptr;
+    if (reply.wait_for(std::chrono::milliseconds(timeoutMs)) != std::future_status::ready) {
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            m_pendingReplies.erase(msgId);
         }
+        INST_LOG_ERROR(TAG, "Timeout waiting for response to id=%u on %s (waited %dms)",
+                     msgId, m_identifier.c_str(), timeoutMs);
+        return nullptr;
     }
 
-    // Clean up waiter
-    {
-        std::lock_guard<std::mutex> lock(m_waitersMutex);
-        m_waiters.erase(msgId);
+    auto response = reply.get();
+    if (!response) {
+        if (m_cancelled.load()) {
+            INST_LOG_ERROR(TAG, "Channel cancelled while waiting for response to id=%u", msgId);
+        }
+        return nullptr;
     }
 
-    INST_LOG_INFO(TAG, "[%s] Got response for id=%u", m_identifier.c_str(), msgId);
-    return waiter->response;
+    INST_LOG_TRACE(TAG, "[%s] Got response for id=%u", m_identifier.c_str(), msgId);
+    return response;
 }
 
 void DTXChannel::SendMessageAsync(std::shared_ptr<DTXMessage> message) {
@@ -134,12 +127,115 @@ void DTXChannel::SendMessageAsync(std::shared_ptr<DTXMessage> message) {
     message->SetChannelCode(m_channelCode);
     message->SetExpectsReply(false);
 
-    INST_LOG_INFO(TAG, "[%s] SendAsync id=%u, selector=%s",
+    INST_LOG_TRACE(TAG, "[%s] SendAsync id=%u, selector=%s",
                   m_identifier.c_str(), msgId, message->Selector().c_str());
 
     m_connection->SendMessage(message);
 }
 
+void DTXChannel::SendMessageAsync(std::shared_ptr<DTXMessage> message, ReplyHandler onReply,
+                                  int timeoutMs) {
+    if (m_cancelled.load()) {
+        INST_LOG_WARN(TAG, "[%s] SendAsync called on cancelled channel", m_identifier.c_str());
+        if (onReply) onReply(nullptr);
+        return;
+    }
+
+    uint32_t msgId = NextIdentifier();
+    message->SetIdentifier(msgId);
+    message->SetChannelCode(m_channelCode);
+    message->SetExpectsReply(true);
+
+    INST_LOG_TRACE(TAG, "[%s] SendAsync id=%u (reply), selector=%s",
+                  m_identifier.c_str(), msgId, message->Selector().c_str());
+
+    SendRequest(std::move(message), std::move(onReply), timeoutMs);
+}
+
+std::future<std::shared_ptr<DTXMessage>> DTXChannel::SendMessageFuture(
+    std::shared_ptr<DTXMessage> message, int timeoutMs) {
+    auto promise = std::make_shared<std::promise<std::shared_ptr<DTXMessage>>>();
+    auto reply = promise->get_future();
+    SendMessageAsync(std::move(message), [promise](std::shared_ptr<DTXMessage> response) {
+        promise->set_value(std::move(response));
+    }, timeoutMs);
+    return reply;
+}
+
+DTXCall DTXChannel::Call(std::shared_ptr<DTXMessage> message, int timeoutMs) {
+    return DTXCall(shared_from_this(), std::move(message), timeoutMs);
+}
+
+void DTXChannel::SendRequest(std::shared_ptr<DTXMessage> message, ReplyHandler onReply,
+                             int timeoutMs) {
+    ExpirePendingReplies();
+
+    timeoutMs = m_connection->RequestTimeoutMs(timeoutMs);
+    const uint32_t msgId = message->Identifier();
+    MetricsHistogram* rtt = &metrics::Rtt(message->SelectorView());
+    const auto now = Clock::now();
+    const auto deadline = now + std::chrono::milliseconds(timeoutMs);
+    {
+        std::unique_lock<std::mutex> lock(m_pendingMutex);
+        if (m_cancelled.load()) {
+            // Cancel() already completed the pending set
+            lock.unlock();
+            if (onReply) onReply(nullptr);
+            return;
+        }
+        m_pendingReplies[msgId] = {std::move(onReply), deadline, now, rtt,
+                                   trace::Enabled() ? std::string(message->SelectorView()) : std::string()};
+        const Clock::rep ticks = deadline.time_since_epoch().count();
+        if (ticks < m_nextExpiry.load(std::memory_order_relaxed)) {
+            m_nextExpiry.store(ticks, std::memory_order_relaxed);
+        }
+    }
+
+    Error err = m_connection->SendMessage(message);
+    if (err != Error::Success) {
+        INST_LOG_ERROR(TAG, "Failed to send message: %s", ErrorToString(err));
+        ReplyHandler handler;
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            auto it = m_pendingReplies.find(msgId);
+            if (it == m_pendingReplies.end()) return;
+            handler = std::move(it->second.handler);
+            m_pendingReplies.erase(it);
+        }
+        if (handler) handler(nullptr);
+    }
+}
+
+void DTXChannel::ExpirePendingReplies() {
+    const auto now = Clock::now();
+    if (now.time_since_epoch().count() < m_nextExpiry.load(std::memory_order_relaxed)) return;
+
+    std::vector<ReplyHandler> expired;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        Clock::time_point next = Clock::time_point::max();
+        for (auto it = m_pendingReplies.begin(); it != m_pendingReplies.end();) {
+            if (it->second.deadline <= now) {
+                INST_LOG_WARN(TAG, "[%s] No reply to id=%u before timeout",
+                             m_identifier.c_str(), it->first);
+                if (!it->second.traceName.empty()) {
+                    trace::Async("dtx", it->second.traceName, it->second.sent, now,
+                                 m_identifier + " (timed out)", m_traceDevice);
+                }
+                expired.push_back(std::move(it->second.handler));
+                it = m_pendingReplies.erase(it);
+            } else {
+                next = std::min(next, it->second.deadline);
+                ++it;
+            }
+        }
+        m_nextExpiry.store(next.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    for (auto& handler : expired) {
+        if (handler) handler(nullptr);
+    }
+}
+
 void DTXChannel::SetMessageHandler(MessageHandler handler) {
     std::lock_guard<std::mutex> lock(m_handlerMutex);
     m_messageHandler = std::move(handler);
@@ -150,19 +246,63 @@ void DTXChannel::SetMethodHandler(const std::string& methodName, MessageHandler
     m_methodHandlers[methodName] = std::move(handler);
 }
 
+void DTXChannel::SetDispatchQueue(size_t capacity, DTXOverflowPolicy policy) {
+    std::shared_ptr<DTXDispatchQueue> queue;
+    if (capacity > 0) {
+        // The worker holds the channel while a handler runs, so a handler
+        // may drop the last reference to it
+        std::weak_ptr<DTXChannel> weak = weak_from_this();
+        queue = std::make_shared<DTXDispatchQueue>(m_identifier, capacity, policy,
+            [weak](std::shared_ptr<DTXMessage> message) {
+                if (auto self = weak.lock()) self->DeliverMessage(std::move(message));
+            }, m_connection ? m_connection->m_queueBudget : nullptr);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_handlerMutex);
+        m_dispatchQueue.swap(queue);
+    }
+    // Previous queue (if any) is stopped outside the lock
+    if (queue) queue->Stop();
+}
+
 void DTXChannel::Cancel() {
     if (m_cancelled.exchange(true)) return;
 
     INST_LOG_DEBUG(TAG, "Cancelling channel %s (code=%d)", m_identifier.c_str(), m_channelCode);
 
-    // Wake up all waiters
+    // Stop the handler worker (queued messages are discarded)
+    std::shared_ptr<DTXDispatchQueue> queue;
     {
-        std::lock_guard<std::mutex> lock(m_waitersMutex);
-        for (auto& [id, waiter] : m_waiters) {
-            std::lock_guard<std::mutex> wlock(waiter->mutex);
-            waiter->ready = true;
-            waiter->cv.notify_all();
-        }
+        std::lock_guard<std::mutex> lock(m_handlerMutex);
+        queue.swap(m_dispatchQueue);
+    }
+    if (queue) queue->Stop();
+
+    // Complete all pending requests (wakes synchronous callers)
+    std::map<uint32_t, PendingReply> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        pending.swap(m_pendingReplies);
+    }
+    for (auto& [id, entry] : pending) {
+        if (entry.handler) entry.handler(nullptr);
+    }
+}
+
+void DTXChannel::FailPendingReplies() {
+    std::map<uint32_t, PendingReply> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        pending.swap(m_pendingReplies);
+        m_nextExpiry.store(Clock::time_point::max().time_since_epoch().count(),
+                           std::memory_order_relaxed);
+    }
+    if (!pending.empty()) {
+        INST_LOG_WARN(TAG, "[%s] Connection closed, failing %zu pending request(s)",
+                     m_identifier.c_str(), pending.size());
+    }
+    for (auto& [id, entry] : pending) {
+        if (entry.handler) entry.handler(nullptr);
     }
 }
 
@@ -180,28 +320,63 @@ void DTXChannel::DispatchMessage(std::shared_ptr<DTXMessage> message) {
 
     uint32_t convIdx = message->ConversationIndex();
 
-    // Check if this is a response to a pending synchronous call.
+    // Check if this is a response to a pending request.
     // Response messages have ConversationIndex > 0 and are keyed by message Identifier (go-ios behavior).
     if (convIdx > 0) {
-        std::lock_guard<std::mutex> lock(m_waitersMutex);
-        auto it = m_waiters.find(message->Identifier());
-        if (it != m_waiters.end()) {
-            auto& waiter = it->second;
-            std::lock_guard<std::mutex> wlock(waiter->mutex);
-            waiter->response = message;
-            waiter->ready = true;
-            waiter->cv.notify_all();
+        ReplyHandler handler;
+        bool matched = false;
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            auto it = m_pendingReplies.find(message->Identifier());
+            if (it != m_pendingReplies.end()) {
+                it->second.rtt->RecordSince(it->second.sent);
+                m_connection->RecordRtt(Clock::now() - it->second.sent);
+                if (!it->second.traceName.empty()) {
+                    trace::Async("dtx", it->second.traceName, it->second.sent, Clock::now(),
+                                 m_identifier, m_traceDevice);
+                }
+                handler = std::move(it->second.handler);
+                m_pendingReplies.erase(it);
+                matched = true;
+            }
+        }
+        if (matched) {
+            if (handler) handler(std::move(message));
             return;
         }
     }
+    ExpirePendingReplies();
+
+    std::shared_ptr<DTXDispatchQueue> queue;
+    {
+        std::lock_guard<std::mutex> lock(m_handlerMutex);
+        queue = m_dispatchQueue;
+    }
+    if (queue) {
+        queue->Push(std::move(message));
+    } else {
+        DeliverMessage(std::move(message));
+    }
+}
+
+void DTXChannel::RunHandler(const MessageHandler& handler, const std::shared_ptr<DTXMessage>& message) {
+    if (!metrics::SampleTiming()) {
+        handler(message);
+        return;
+    }
+    const auto start = Clock::now();
+    handler(message);
+    m_handlerTime->RecordSince(start);
+}
 
+void DTXChannel::DeliverMessage(std::shared_ptr<DTXMessage> message) {
     // Check for method-specific handlers
-    std::string selector = message->Selector();
+    std::string_view selector = message->SelectorView();
     if (!selector.empty()) {
         std::lock_guard<std::mutex> lock(m_methodHandlerMutex);
         auto it = m_methodHandlers.find(selector);
         if (it != m_methodHandlers.end()) {
-            it->second(message);
+            RunHandler(it->second, message);
             return;
         }
     }
@@ -214,11 +389,35 @@ void DTXChannel::DispatchMessage(std::shared_ptr<DTXMessage> message) {
     }
 
     if (handler) {
-        handler(message);
+        RunHandler(handler, message);
     } else {
         INST_LOG_TRACE(TAG, "[%s] Unhandled message: %s",
                       m_identifier.c_str(), message->Dump().c_str());
     }
 }
 
+DTXCall::DTXCall(std::shared_ptr<DTXChannel> channel, std::shared_ptr<DTXMessage> message,
+                 int timeoutMs)
+    : m_channel(std::move(channel))
+    , m_message(std::move(message))
+    , m_timeoutMs(timeoutMs)
+    , m_state(std::make_shared<State>())
+{
+}
+
+bool DTXCall::await_suspend(std::coroutine_handle<> handle) {
+    // The reply may arrive on another thread before this returns; only the
+    // side that comes second (reply or suspend) decides who resumes
+    auto state = m_state;
+    state->handle = handle;
+    m_channel->SendMessageAsync(std::move(m_message), [state](std::shared_ptr<DTXMessage> reply) {
+        state->reply = std::move(reply);
+        if (state->done.exchange(true, std::memory_order_acq_rel)) {
+            state->handle.resume();
+        }
+    }, m_timeoutMs);
+    // Already completed: stay running instead of suspending
+    return !state->done.exchange(true, std::memory_order_acq_rel);
+}
+
 } // namespace instruments
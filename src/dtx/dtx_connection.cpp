@@ -1,8 +1,16 @@
 #include "../../include/instruments/dtx_connection.h"
+#include "../../include/instruments/dtx_reactor.h"
 #include "dtx_transport.h"
+#include "dtx_budget.h"
+#include "dtx_dispatch_queue.h"
 #include "dtx_fragment.h"
+#include "dtx_message_pool.h"
 #include "../nskeyedarchiver/nsobject.h"
 #include "../util/log.h"
+#include "../util/metrics.h"
+#include "../util/trace.h"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <libimobiledevice/libimobiledevice.h>
 #include <thread>
@@ -16,9 +24,14 @@ namespace instruments {
 
 static const char* TAG = "DTXConnection";
 
+// Connection whose channel dispatch is running on this thread
+static thread_local const DTXConnection* t_dispatchConnection = nullptr;
+
 DTXConnection::DTXConnection(std::unique_ptr<DTXTransport> transport)
     : m_transport(std::move(transport))
     , m_fragmentDecoder(std::make_unique<DTXFragmentDecoder>())
+    , m_messagePool(DTXMessagePool::Create())
+    , m_traceDevice(TraceDeviceScope::Current())
 {
 }
 
@@ -62,6 +75,42 @@ std::unique_ptr<DTXConnection> DTXConnection::CreateFromFd(int socketFd) {
     return std::unique_ptr<DTXConnection>(new DTXConnection(std::move(transport)));
 }
 
+std::unique_ptr<DTXConnection> DTXConnection::CreateFromStream(std::shared_ptr<TunnelStream> stream) {
+    INST_LOG_INFO(TAG, "CreateFromStream: creating DTX connection on a tunnel stream");
+    auto transport = std::make_unique<DTXTransport>(std::move(stream));
+    if (!transport->IsConnected()) {
+        INST_LOG_ERROR(TAG, "CreateFromStream: stream not open");
+        return nullptr;
+    }
+    return std::unique_ptr<DTXConnection>(new DTXConnection(std::move(transport)));
+}
+
+std::unique_ptr<DTXConnection> DTXConnection::CreateFromReplay(std::shared_ptr<DTXReplay> replay) {
+    if (!replay) return nullptr;
+    auto transport = std::make_unique<DTXTransport>(std::move(replay));
+    return std::unique_ptr<DTXConnection>(new DTXConnection(std::move(transport)));
+}
+
+void DTXConnection::SetCapture(std::shared_ptr<DTXCaptureWriter> capture) {
+    m_transport->SetCapture(std::move(capture));
+}
+
+void DTXConnection::SetMemoryBudget(const DTXMemoryBudget& budget) {
+    m_transport->SetMaxFrameBytes(budget.maxMessageBytes);
+    m_fragmentDecoder->SetLimits(budget.maxFragmentBytes, budget.maxFragmentedMessages,
+                                 budget.maxMessageBytes);
+    if (budget.maxQueuedMessages > 0 || budget.maxQueuedBytes > 0) {
+        m_queueBudget = std::make_shared<DTXQueueBudget>(budget.maxQueuedMessages,
+                                                         budget.maxQueuedBytes);
+    } else {
+        m_queueBudget.reset();
+    }
+}
+
+TransportCounters DTXConnection::GetTransportStats() const {
+    return m_transport->Counters();
+}
+
 Error DTXConnection::Connect() {
     INST_LOG_INFO(TAG, "=== DTXConnection::Connect() ENTRY - BUILD TIMESTAMP: " __DATE__ " " __TIME__ " ===");
 
@@ -70,22 +119,42 @@ Error DTXConnection::Connect() {
         return Error::Success;
     }
 
+    TraceDeviceScope traceScope(m_traceDevice);
+
     // Create the global channel (channel code 0)
     INST_LOG_INFO(TAG, "Creating global channel");
     {
         std::lock_guard<std::mutex> lock(m_channelsMutex);
-        auto globalCh = std::make_shared<DTXChannel>(this, "_global_", 0);
-        m_channels[0] = globalCh;
+        SetChannelLocked(0, std::make_shared<DTXChannel>(this, "_global_", 0));
+    }
+
+    // Reset the handshake flag before the receive path runs: the device's
+    // capabilities may arrive before ours are sent (replayed captures)
+    {
+        std::lock_guard<std::mutex> lock(m_handshakeMutex);
+        m_handshakeReceived.store(false);
     }
 
     m_connected.store(true);
     INST_LOG_INFO(TAG, "Connection flag set to true");
 
-    // Start receive loop
-    INST_LOG_INFO(TAG, "Starting receive thread");
-    m_receiveThread = std::thread([this]() {
-        ReceiveLoop();
-    });
+    // Start receive loop, on the shared reactor if one was provided and the
+    // transport can be polled, otherwise on a dedicated thread
+    const int pollFd = m_reactor ? m_transport->PollableFd() : -1;
+    if (m_queueBudget && pollFd >= 0) {
+        // Reading paused by the queue budget resumes once handlers catch up
+        m_queueBudget->SetResumeHandler([this]() { m_reactor->Resume(this); });
+    }
+    if (pollFd >= 0 && m_reactor->Register(this, pollFd)) {
+        INST_LOG_INFO(TAG, "Receiving on shared reactor (fd=%d)", pollFd);
+        m_onReactor = true;
+    } else {
+        if (m_queueBudget) m_queueBudget->SetResumeHandler(nullptr);
+        INST_LOG_INFO(TAG, "Starting receive thread");
+        m_receiveThread = std::thread([this]() {
+            ReceiveLoop();
+        });
+    }
 
     // Perform DTX handshake: send client capabilities and wait for device response
     // Based on pymobiledevice3: send _notifyOfPublishedCapabilities, then recv_plist()
@@ -102,13 +171,65 @@ Error DTXConnection::Connect() {
     return Error::Success;
 }
 
+std::shared_ptr<DTXChannel> DTXConnection::Lookup(const ChannelTable* table, int32_t code) {
+    if (!table) return nullptr;
+    auto it = std::lower_bound(table->channels.begin(), table->channels.end(), code,
+        [](const auto& entry, int32_t c) { return entry.first < c; });
+    if (it == table->channels.end() || it->first != code) return nullptr;
+    return it->second;
+}
+
+std::shared_ptr<DTXChannel> DTXConnection::FindChannel(int32_t code) {
+    // Announce the snapshot before reading it, then make sure it is still
+    // current: a writer that published after our load sees the hazard or
+    // we see its table
+    const ChannelTable* table = m_channelTable.load();
+    for (;;) {
+        m_readHazard.store(table);
+        const ChannelTable* current = m_channelTable.load();
+        if (current == table) break;
+        table = current;
+    }
+    auto channel = Lookup(table, code);
+    m_readHazard.store(nullptr);
+    return channel;
+}
+
+void DTXConnection::SetChannelLocked(int32_t code, std::shared_ptr<DTXChannel> channel) {
+    const ChannelTable* current = m_channelTable.load(std::memory_order_relaxed);
+    auto next = std::make_unique<ChannelTable>();
+    if (current) next->channels = current->channels;
+    auto& channels = next->channels;
+    auto it = std::lower_bound(channels.begin(), channels.end(), code,
+        [](const auto& entry, int32_t c) { return entry.first < c; });
+    if (it != channels.end() && it->first == code) {
+        if (channel) {
+            it->second = std::move(channel);
+        } else {
+            channels.erase(it);
+        }
+    } else if (channel) {
+        channels.insert(it, {code, std::move(channel)});
+    }
+    m_channelTable.store(next.get());
+
+    // Free retired snapshots the receive path is not reading
+    const ChannelTable* hazard = m_readHazard.load();
+    std::erase_if(m_channelTables, [&](const std::unique_ptr<const ChannelTable>& table) {
+        return table.get() != hazard;
+    });
+    m_channelTables.push_back(std::move(next));
+}
+
 std::shared_ptr<DTXChannel> DTXConnection::GlobalChannel() {
+    // Under the lock: writers free snapshots while holding it
     std::lock_guard<std::mutex> lock(m_channelsMutex);
-    auto it = m_channels.find(0);
-    return (it != m_channels.end()) ? it->second : nullptr;
+    return Lookup(m_channelTable.load(std::memory_order_relaxed), 0);
 }
 
 std::shared_ptr<DTXChannel> DTXConnection::MakeChannelWithIdentifier(const std::string& identifier) {
+    TraceDeviceScope traceScope(m_traceDevice);
+    TraceSpan span("dtx", "MakeChannelWithIdentifier", identifier);
     if (!m_connected.load()) {
         INST_LOG_ERROR(TAG, "Not connected");
         return nullptr;
@@ -120,7 +241,7 @@ std::shared_ptr<DTXChannel> DTXConnection::MakeChannelWithIdentifier(const std::
     auto channel = std::make_shared<DTXChannel>(this, identifier, code);
     {
         std::lock_guard<std::mutex> lock(m_channelsMutex);
-        m_channels[code] = channel;
+        SetChannelLocked(code, channel);
     }
 
     // Request the channel from the device via the global channel
@@ -134,14 +255,16 @@ std::shared_ptr<DTXChannel> DTXConnection::MakeChannelWithIdentifier(const std::
     requestMsg->AppendAuxiliary(NSObject(static_cast<int32_t>(code)));
     requestMsg->AppendAuxiliary(NSObject(identifier));
 
-    auto response = globalCh->SendMessageSync(requestMsg);
+    // The device starts the service behind the channel before it answers:
+    // wait the policy's full request timeout, never the adaptive RTT one
+    auto response = globalCh->SendMessageSync(requestMsg, m_timeoutPolicy.requestTimeoutMs);
     if (!response) {
         INST_LOG_ERROR(TAG, "Failed to request channel: %s", identifier.c_str());
         INST_LOG_ERROR(TAG, "Connection status: %d, Transport: %s",
                       m_connected.load() ? 1 : 0,
                       m_transport ? "valid" : "null");
         std::lock_guard<std::mutex> lock(m_channelsMutex);
-        m_channels.erase(code);
+        SetChannelLocked(code, nullptr);
         return nullptr;
     }
 
@@ -152,16 +275,42 @@ std::shared_ptr<DTXChannel> DTXConnection::MakeChannelWithIdentifier(const std::
 void DTXConnection::Disconnect() {
     bool wasConnected = m_connected.exchange(false);
 
+    // Release a receive path waiting for queue room; no more resumes
+    if (m_queueBudget) {
+        m_queueBudget->Shutdown();
+    }
+
+    // Leave the reactor before closing the transport so its descriptor is
+    // not polled after close (no-op if the reactor already dropped us)
+    if (m_onReactor) {
+        m_reactor->Unregister(this);
+        m_onReactor = false;
+    }
+
     if (wasConnected) {
         INST_LOG_INFO(TAG, "Disconnecting");
 
-        // Cancel all channels
+        // Cancel all channels. Cancel() completes pending requests, which may
+        // resume coroutines, so it runs outside m_channelsMutex.
+        std::vector<std::shared_ptr<DTXChannel>> channels;
         {
             std::lock_guard<std::mutex> lock(m_channelsMutex);
-            for (auto& [code, channel] : m_channels) {
-                channel->Cancel();
+            if (const ChannelTable* table = m_channelTable.load(std::memory_order_relaxed)) {
+                for (const auto& [code, channel] : table->channels) {
+                    channels.push_back(channel);
+                }
             }
         }
+        for (auto& channel : channels) {
+            channel->Cancel();
+        }
+
+        std::shared_ptr<DTXDispatchQueue> globalQueue;
+        {
+            std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
+            globalQueue.swap(m_globalQueue);
+        }
+        if (globalQueue) globalQueue->Stop();
 
         // Close transport to unblock receive thread
         if (m_transport) {
@@ -177,10 +326,12 @@ void DTXConnection::Disconnect() {
     }
 
     if (wasConnected) {
-        // Clear channels
+        // Clear channels; the receive path has stopped, so retired
+        // snapshots can be freed
         {
             std::lock_guard<std::mutex> lock(m_channelsMutex);
-            m_channels.clear();
+            m_channelTable.store(nullptr, std::memory_order_release);
+            m_channelTables.clear();
         }
 
         if (m_fragmentDecoder) {
@@ -189,6 +340,98 @@ void DTXConnection::Disconnect() {
     }
 }
 
+void DTXConnection::SetCloseHandler(std::function<void()> handler) {
+    {
+        std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
+        if (!m_remoteClosed) {
+            m_closeHandler = std::move(handler);
+            return;
+        }
+    }
+    if (handler) handler();
+}
+
+void DTXConnection::NotifyClosed() {
+    // Nothing will answer: wake a pending handshake and fail pending requests
+    {
+        std::lock_guard<std::mutex> lock(m_handshakeMutex);
+        m_handshakeCV.notify_all();
+    }
+    std::vector<std::shared_ptr<DTXChannel>> channels;
+    {
+        std::lock_guard<std::mutex> lock(m_channelsMutex);
+        if (const ChannelTable* table = m_channelTable.load(std::memory_order_relaxed)) {
+            for (const auto& [code, channel] : table->channels) {
+                channels.push_back(channel);
+            }
+        }
+    }
+    for (auto& channel : channels) {
+        channel->FailPendingReplies();
+    }
+
+    std::function<void()> handler;
+    {
+        std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
+        m_remoteClosed = true;
+        handler.swap(m_closeHandler);
+    }
+    if (handler) handler();
+}
+
+int DTXConnection::RequestTimeoutMs(int timeoutMs) const {
+    if (timeoutMs >= 0) return timeoutMs;
+    const DTXTimeoutPolicy& policy = m_timeoutPolicy;
+    const int64_t srttUs = m_srttUs.load(std::memory_order_relaxed);
+    if (!policy.adaptive || srttUs == 0) return policy.requestTimeoutMs;
+    const double adaptiveMs = static_cast<double>(srttUs) * policy.rttMultiplier / 1000.0;
+    return static_cast<int>(std::clamp(adaptiveMs, static_cast<double>(policy.minTimeoutMs),
+                                       static_cast<double>(policy.requestTimeoutMs)));
+}
+
+void DTXConnection::RecordRtt(std::chrono::steady_clock::duration rtt) {
+    const int64_t sampleUs = std::max<int64_t>(
+        1, std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+    // Replies are dispatched on one thread; a lost update under a race is harmless
+    const int64_t srttUs = m_srttUs.load(std::memory_order_relaxed);
+    m_srttUs.store(srttUs == 0 ? sampleUs : srttUs + (sampleUs - srttUs) / 8,
+                   std::memory_order_relaxed);
+}
+
+void DTXConnection::CloseChannel(const std::shared_ptr<DTXChannel>& channel) {
+    if (!channel) return;
+    channel->Cancel();
+
+    const int32_t code = channel->ChannelCode();
+    bool removed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_channelsMutex);
+        if (code != 0 && Lookup(m_channelTable.load(std::memory_order_relaxed), code) == channel) {
+            SetChannelLocked(code, nullptr);
+            removed = true;
+        }
+    }
+
+    // Let the device release its service instance (no reply expected)
+    if (removed && m_connected.load()) {
+        if (auto globalCh = GlobalChannel()) {
+            auto cancelMsg = DTXMessage::CreateWithSelector("_channelCanceled:");
+            cancelMsg->AppendAuxiliary(NSObject(code));
+            globalCh->SendMessageAsync(cancelMsg);
+        }
+    }
+
+    // A dispatch that started before Cancel() may still be in a handler;
+    // the channel is cancelled, so no new one starts
+    if (t_dispatchConnection != this) {
+        std::unique_lock<std::mutex> lock(m_dispatchMutex);
+        m_dispatchCV.wait(lock, [&] {
+            return m_dispatchChannel.load() != channel.get();
+        });
+    }
+    INST_LOG_INFO(TAG, "Channel closed: %s (code=%d)", channel->Identifier().c_str(), code);
+}
+
 void DTXConnection::SetGlobalMessageHandler(DTXChannel::MessageHandler handler) {
     std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
     m_globalHandler = std::move(handler);
@@ -207,19 +450,38 @@ void DTXConnection::AddGlobalMessageHandler(DTXChannel::MessageHandler handler)
     };
 }
 
+void DTXConnection::SetGlobalDispatchQueue(size_t capacity, DTXOverflowPolicy policy) {
+    std::shared_ptr<DTXDispatchQueue> queue;
+    if (capacity > 0) {
+        queue = std::make_shared<DTXDispatchQueue>("global", capacity, policy,
+            [this](std::shared_ptr<DTXMessage> message) { DeliverGlobalMessage(std::move(message)); },
+            m_queueBudget);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
+        m_globalQueue.swap(queue);
+    }
+    if (queue) queue->Stop();
+}
+
 Error DTXConnection::SendMessage(std::shared_ptr<DTXMessage> message) {
     if (!m_connected.load() || !m_transport) {
         return Error::ConnectionFailed;
     }
+    const size_t threshold = m_compressionThreshold.load(std::memory_order_relaxed);
+    if (threshold > 0 && m_peerCompression.load(std::memory_order_relaxed) &&
+        message->MessageType() != DTXMessageType::Ack) {
+        message->Compress(threshold);
+    }
     return m_transport->SendMessage(message);
 }
 
 void DTXConnection::SendAck(uint32_t identifier, uint32_t channelCode, uint32_t conversationIndex) {
-    INST_LOG_INFO(TAG, "Creating ACK message for id=%u, ch=%u", identifier, channelCode);
+    INST_LOG_TRACE(TAG, "Creating ACK message for id=%u, ch=%u", identifier, channelCode);
     auto ack = DTXMessage::CreateAck(identifier, channelCode, conversationIndex);
     Error err = SendMessage(ack);
     if (err == Error::Success) {
-        INST_LOG_INFO(TAG, "ACK sent successfully");
+        INST_LOG_TRACE(TAG, "ACK sent successfully");
     } else {
         INST_LOG_ERROR(TAG, "Failed to send ACK: error %d", static_cast<int>(err));
     }
@@ -231,21 +493,27 @@ void DTXConnection::ReceiveLoop() {
     auto lastWaitLog = std::chrono::steady_clock::now() - std::chrono::seconds(10);
 
     while (m_connected.load()) {
-        auto now = std::chrono::steady_clock::now();
-        if (now - lastWaitLog > std::chrono::seconds(2)) {
-            INST_LOG_INFO(TAG, "Waiting for data from transport...");
-            lastWaitLog = now;
+        // Over the queue budget: leave the data in the socket until handlers catch up
+        if (m_queueBudget && !m_queueBudget->WaitForRoom()) break;
+        if (INST_LOG_ENABLED(Trace)) {
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastWaitLog > std::chrono::seconds(2)) {
+                INST_LOG_TRACE(TAG, "Waiting for data from transport...");
+                lastWaitLog = now;
+            }
         }
-        auto rawData = m_transport->Receive();
-        if (rawData.empty()) {
-            if (m_transport) {
+        DTXFrame frame;
+        if (!m_transport->ReceiveFrame(frame)) {
+            // The transport blocks on readiness itself (poll/select on sockets,
+            // the idevice receive timeout otherwise), so no sleep is needed here.
+            // It only comes back without a frame when the stream is unusable or
+            // a frame failed to parse; keep going only in the latter case.
+            if (m_transport && m_transport->IsConnected()) {
                 const int lastErr = m_transport->LastReadError();
                 const uint32_t lastBytes = m_transport->LastReadBytes();
                 const bool sslNoData = (lastErr == IDEVICE_E_SSL_ERROR && lastBytes == 0);
                 const bool successNoData = (lastErr == IDEVICE_E_SUCCESS && lastBytes == 0);
                 if (m_transport->WasLastReadTimeout() || sslNoData || successNoData) {
-                    // No data yet, keep waiting (avoid tight loop)
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
                     continue;
                 }
             }
@@ -255,52 +523,102 @@ void DTXConnection::ReceiveLoop() {
                               m_transport ? m_transport->LastReadError() : -1,
                               m_transport ? m_transport->LastReadBytes() : 0);
                 m_connected.store(false);
+                NotifyClosed();
             }
             break;
         }
-        INST_LOG_INFO(TAG, "Received %zu bytes from transport", rawData.size());
+        INST_LOG_TRACE(TAG, "Received %zu bytes from transport", frame.size);
+        HandleFrame(frame);
+    }
+
+    INST_LOG_DEBUG(TAG, "Receive loop ended");
+}
+
+bool DTXConnection::OnReadable() {
+    if (!m_connected.load()) return false;
 
-        // Parse header
-        DTXMessageHeader header;
-        if (!DTXMessage::ParseHeader(rawData.data(), rawData.size(), header)) {
-            INST_LOG_ERROR(TAG, "Failed to parse received message header");
-            continue;
+    if (m_transport->ReadAvailable() < 0) {
+        if (m_connected.load()) {
+            INST_LOG_INFO(TAG, "*** Connection closed by remote err=%d ***",
+                          m_transport->LastReadError());
+            m_connected.store(false);
+            NotifyClosed();
         }
+        return false;
+    }
 
-        const uint8_t* payloadData = rawData.data() + DTXProtocol::HeaderLength;
-        size_t payloadSize = rawData.size() - DTXProtocol::HeaderLength;
+    DispatchBuffered();
+    return m_connected.load();
+}
 
-        // Handle fragmented messages
-        if (header.fragmentCount > 1) {
-            std::vector<uint8_t> fragPayload(payloadData, payloadData + payloadSize);
-            bool complete = m_fragmentDecoder->AddFragment(
-                header.identifier, header.fragmentIndex,
-                header.fragmentCount, fragPayload);
+bool DTXConnection::OnResumed() {
+    if (!m_connected.load()) return false;
+    DispatchBuffered();
+    return m_connected.load();
+}
 
-            if (!complete) continue;
+void DTXConnection::DispatchBuffered() {
+    auto pause = [this]() { m_reactor->Pause(this); };
+    DTXFrame frame;
+    while (m_connected.load()) {
+        if (m_queueBudget && m_queueBudget->PauseIfOver(pause)) return;
+        if (!m_transport->NextBufferedFrame(frame)) break;
+        HandleFrame(frame);
+    }
 
-            // Assemble the complete message
-            auto assembled = m_fragmentDecoder->GetAssembledData(header.identifier);
-            m_fragmentDecoder->Remove(header.identifier);
+    // The transport refused a frame over the message limit
+    if (m_connected.load() && !m_transport->IsConnected()) {
+        INST_LOG_ERROR(TAG, "*** Closing connection: receive stream unusable ***");
+        m_connected.store(false);
+        NotifyClosed();
+    }
+}
 
-            auto message = DTXMessage::Decode(header, assembled.data(), assembled.size());
-            if (message) {
-                DispatchMessage(message);
-            }
-            continue;
-        }
+void DTXConnection::HandleFrame(const DTXFrame& frame) {
+    // The transport already parsed the header; the body is a view into
+    // its receive buffer, valid until the next read
+    const DTXMessageHeader& header = frame.header;
+    const uint8_t* payloadData = frame.Body();
+    size_t payloadSize = frame.BodyLength();
+
+    MetricsCounters& counters = metrics::Counters();
+    auto decode = [&](const uint8_t* data, size_t length) {
+        if (!metrics::SampleTiming()) return DTXMessage::Decode(header, data, length, m_messagePool);
+        const auto start = MetricsHistogram::Clock::now();
+        auto message = DTXMessage::Decode(header, data, length, m_messagePool);
+        counters.decode.RecordSince(start);
+        return message;
+    };
+
+    // Handle fragmented messages
+    if (header.fragmentCount > 1) {
+        metrics::Add(counters.receive.fragments);
+        bool complete = m_fragmentDecoder->AddFragment(
+            header.identifier, header.fragmentIndex,
+            header.fragmentCount, header.messageLength, payloadData, payloadSize);
+
+        if (!complete) return;
+        metrics::Add(counters.receive.reassembled);
 
-        // Non-fragmented message
-        auto message = DTXMessage::Decode(header, payloadData, payloadSize);
+        // Assemble the complete message
+        auto assembled = m_fragmentDecoder->TakeAssembledData(header.identifier);
+
+        auto message = decode(assembled.data(), assembled.size());
         if (message) {
             DispatchMessage(message);
         }
+        return;
     }
 
-    INST_LOG_DEBUG(TAG, "Receive loop ended");
+    // Non-fragmented message
+    auto message = decode(payloadData, payloadSize);
+    if (message) {
+        DispatchMessage(message);
+    }
 }
 
 Error DTXConnection::PerformHandshake() {
+    TraceSpan span("dtx", "DTX handshake");
     INST_LOG_INFO(TAG, ">>> PerformHandshake() ENTRY <<<");
 
     auto globalCh = GlobalChannel();
@@ -309,13 +627,6 @@ Error DTXConnection::PerformHandshake() {
         return Error::ConnectionFailed;
     }
 
-    // Reset handshake flag
-    {
-        std::lock_guard<std::mutex> lock(m_handshakeMutex);
-        m_handshakeReceived.store(false);
-        INST_LOG_INFO(TAG, "Handshake flag reset to false");
-    }
-
     // Build client capabilities
     // Use DTXBlockCompression=2 to match go-ios / sonic-gidevice behavior
     // Use uint64 to match go-ios NSNumber unsigned encoding
@@ -335,9 +646,9 @@ Error DTXConnection::PerformHandshake() {
     INST_LOG_INFO(TAG, "Sending client capabilities");
 
     // Debug: log the raw auxiliary data
-    auto auxData = msg->RawAuxiliary();
-    INST_LOG_INFO(TAG, "Auxiliary data size: %zu bytes", auxData.size());
-    if (auxData.size() > 0 && auxData.size() <= 500) {
+    const auto& auxData = msg->RawAuxiliary();
+    INST_LOG_DEBUG(TAG, "Auxiliary data size: %zu bytes", auxData.size());
+    if (INST_LOG_ENABLED(Trace) && auxData.size() > 0 && auxData.size() <= 500) {
         std::string hexDump;
         for (size_t i = 0; i < auxData.size(); i++) {
             char buf[4];
@@ -345,85 +656,92 @@ Error DTXConnection::PerformHandshake() {
             hexDump += buf;
             if ((i + 1) % 16 == 0) hexDump += "\n";
         }
-        INST_LOG_INFO(TAG, "Auxiliary hex dump:\n%s", hexDump.c_str());
+        INST_LOG_TRACE(TAG, "Auxiliary hex dump:\n%s", hexDump.c_str());
     }
 
+    const auto sent = std::chrono::steady_clock::now();
     globalCh->SendMessageAsync(msg);
 
-    // Wait for device's capabilities message
+    // Wait for device's capabilities message (or the device closing on us)
     INST_LOG_INFO(TAG, "Waiting for device capabilities (flag=%d)...", m_handshakeReceived.load() ? 1 : 0);
     std::unique_lock<std::mutex> lock(m_handshakeMutex);
     INST_LOG_INFO(TAG, "Lock acquired, flag=%d", m_handshakeReceived.load() ? 1 : 0);
 
-    bool received = m_handshakeCV.wait_for(lock, std::chrono::seconds(5),
+    bool received = m_handshakeCV.wait_for(lock,
+        std::chrono::milliseconds(m_timeoutPolicy.handshakeTimeoutMs),
         [this]() {
             bool flag = m_handshakeReceived.load();
             INST_LOG_DEBUG(TAG, "CV predicate: flag=%d", flag ? 1 : 0);
-            return flag;
+            return flag || !m_connected.load();
         });
 
     INST_LOG_INFO(TAG, "Wait done: received=%d, flag=%d", received ? 1 : 0, m_handshakeReceived.load() ? 1 : 0);
 
-    if (!received) {
-        INST_LOG_ERROR(TAG, "Handshake timeout");
+    if (!m_handshakeReceived.load()) {
+        if (received) {
+            INST_LOG_ERROR(TAG, "Connection closed during handshake");
+            return Error::ConnectionFailed;
+        }
+        INST_LOG_ERROR(TAG, "Handshake timeout (%dms)", m_timeoutPolicy.handshakeTimeoutMs);
         return Error::Timeout;
     }
+    RecordRtt(std::chrono::steady_clock::now() - sent);
 
     INST_LOG_INFO(TAG, "Handshake complete");
     return Error::Success;
 }
 
 void DTXConnection::DispatchMessage(std::shared_ptr<DTXMessage> message) {
-    INST_LOG_INFO(TAG, "*** RECEIVED MESSAGE: ch=%d, id=%u, conv=%u, type=%u, selector=%s, ExpectsReply=%d ***",
+    INST_LOG_TRACE(TAG, "*** RECEIVED MESSAGE: ch=%d, id=%u, conv=%u, type=%u, selector=%s, ExpectsReply=%d ***",
                   static_cast<int32_t>(message->ChannelCode()),
                   message->Identifier(),
                   message->ConversationIndex(),
                   static_cast<uint32_t>(message->MessageType()),
-                  message->Selector().c_str(),
+                  std::string(message->SelectorView()).c_str(),
                   message->ExpectsReply() ? 1 : 0);
 
     // Update channel's identifier counter to avoid ID collisions
     // Per pymobiledevice3: if device sends message with id >= our counter, update our counter
     // This prevents us from reusing identifiers that the device has used
-    if (message->ConversationIndex() == 0) {
-        int32_t channelCode = static_cast<int32_t>(message->ChannelCode());
-        std::shared_ptr<DTXChannel> channel;
-        {
-            std::lock_guard<std::mutex> lock(m_channelsMutex);
-            auto it = m_channels.find(channelCode);
-            if (it != m_channels.end()) {
-                channel = it->second;
-            }
-        }
-        if (channel) {
-            channel->SyncIdentifier(message->Identifier());
-        }
+    // Messages the device initiates on one of our channels carry the
+    // negated channel code (-1 for channel 1, ...)
+    const int32_t channelCode = static_cast<int32_t>(message->ChannelCode());
+    const bool deviceInitiated = channelCode < 0 && channelCode != INT32_MIN;
+    std::shared_ptr<DTXChannel> channel = FindChannel(deviceInitiated ? -channelCode : channelCode);
+    if (message->ConversationIndex() == 0 && channel && !deviceInitiated) {
+        channel->SyncIdentifier(message->Identifier());
     }
 
-    // Check if this is the device's capabilities message (handshake)
-    std::string selector = message->Selector();
-    bool isHandshake = (selector == "_notifyOfPublishedCapabilities:" &&
-                        message->ChannelCode() == 0 &&
-                        message->ConversationIndex() == 0);
+    // Check if this is the device's capabilities message (handshake).
+    // Cheap header checks first so the selector is only decoded on the
+    // global channel.
+    bool isHandshake = (message->ChannelCode() == 0 &&
+                        message->ConversationIndex() == 0 &&
+                        message->SelectorView() == "_notifyOfPublishedCapabilities:");
 
-    INST_LOG_INFO(TAG, "isHandshake check: selector='%s', ch=%d, conv=%d -> %s",
-                  selector.c_str(),
+    INST_LOG_TRACE(TAG, "isHandshake check: ch=%d, conv=%d -> %s",
                   static_cast<int32_t>(message->ChannelCode()),
                   message->ConversationIndex(),
                   isHandshake ? "TRUE" : "FALSE");
 
     if (isHandshake) {
         INST_LOG_INFO(TAG, "Received device capabilities (handshake)");
-        // Log the device's capabilities for debugging
-        auto auxObjects = message->AuxiliaryObjects();
+        const auto& auxObjects = message->AuxiliaryObjects();
         if (!auxObjects.empty() && auxObjects[0].IsDict()) {
-            INST_LOG_INFO(TAG, "Device capabilities dict has %zu entries", auxObjects[0].AsDict().size());
-            for (const auto& [key, value] : auxObjects[0].AsDict()) {
-                INST_LOG_INFO(TAG, "  %s = %s", key.c_str(),
-                    value.IsInt() ? std::to_string(value.ToNumber()).c_str() : "...");
+            const auto& deviceCaps = auxObjects[0].AsDict();
+            auto it = deviceCaps.find("com.apple.private.DTXBlockCompression");
+            m_peerCompression.store(it != deviceCaps.end() && it->second.ToNumber() > 0);
+        }
+        // Log the device's capabilities for debugging
+        if (INST_LOG_ENABLED(Debug)) {
+            if (!auxObjects.empty() && auxObjects[0].IsDict()) {
+                INST_LOG_DEBUG(TAG, "Device capabilities dict has %zu entries", auxObjects[0].AsDict().size());
+                for (const auto& [key, value] : auxObjects[0].AsDict()) {
+                    INST_LOG_DEBUG(TAG, "  %s = %s", key.c_str(),
+                        value.IsInt() ? std::to_string(value.ToNumber()).c_str() : "...");
+                }
             }
         }
-        INST_LOG_INFO(TAG, "Finished logging capabilities, about to check ACK logic");
     }
 
     // Send ACK only if the message explicitly expects a reply
@@ -432,61 +750,80 @@ void DTXConnection::DispatchMessage(std::shared_ptr<DTXMessage> message) {
     if (message->MessageType() != DTXMessageType::Ack &&
         message->ConversationIndex() == 0 &&
         message->ExpectsReply()) {
-        INST_LOG_INFO(TAG, "Sending ACK for message id=%u",
+        INST_LOG_TRACE(TAG, "Sending ACK for message id=%u",
                       message->Identifier());
         SendAck(message->Identifier(), message->ChannelCode(), message->ConversationIndex());
     } else {
-        INST_LOG_INFO(TAG, "NOT sending ACK (ExpectsReply=%d, MsgType=%u, ConvIdx=%u)",
+        INST_LOG_TRACE(TAG, "NOT sending ACK (ExpectsReply=%d, MsgType=%u, ConvIdx=%u)",
                       message->ExpectsReply() ? 1 : 0,
                       static_cast<uint32_t>(message->MessageType()),
                       message->ConversationIndex());
     }
 
     // Now handle handshake - signal CV and return early (after ACK check)
-    INST_LOG_INFO(TAG, "About to check isHandshake again: %s", isHandshake ? "TRUE" : "FALSE");
     if (isHandshake) {
-        INST_LOG_INFO(TAG, "Signaling handshake CV");
+        INST_LOG_DEBUG(TAG, "Signaling handshake CV");
         std::lock_guard<std::mutex> lock(m_handshakeMutex);
         m_handshakeReceived.store(true);
-        INST_LOG_INFO(TAG, "Flag set to true, about to notify");
         m_handshakeCV.notify_one();
-        INST_LOG_INFO(TAG, "CV notified, returning from DispatchMessage");
         // Return early - don't dispatch handshake message to channel
         return;
     }
 
-    int32_t channelCode = static_cast<int32_t>(message->ChannelCode());
-
     INST_LOG_TRACE(TAG, "Dispatch: ch=%d, id=%u, conv=%u, type=%u",
                   channelCode, message->Identifier(),
                   message->ConversationIndex(),
                   static_cast<uint32_t>(message->MessageType()));
 
-    // Find the channel
-    std::shared_ptr<DTXChannel> channel;
-    {
-        std::lock_guard<std::mutex> lock(m_channelsMutex);
-        auto it = m_channels.find(channelCode);
-        if (it != m_channels.end()) {
-            channel = it->second;
-        }
-    }
-
     if (channel) {
+        // Published for CloseChannel(); seq_cst pairs with the cancelled
+        // flag that DTXChannel::DispatchMessage() checks
+        m_dispatchChannel.store(channel.get());
+        const DTXConnection* outer = t_dispatchConnection;
+        t_dispatchConnection = this;
         channel->DispatchMessage(message);
+        t_dispatchConnection = outer;
+        {
+            // Under the mutex so a CloseChannel() between its check and
+            // its wait cannot miss the notification
+            std::lock_guard<std::mutex> lock(m_dispatchMutex);
+            m_dispatchChannel.store(nullptr);
+        }
+        m_dispatchCV.notify_all();
     } else {
         // No channel found - use global handler
-        DTXChannel::MessageHandler handler;
+        std::shared_ptr<DTXDispatchQueue> queue;
         {
             std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
-            handler = m_globalHandler;
+            queue = m_globalQueue;
         }
-        if (handler) {
-            handler(message);
+        if (queue) {
+            queue->Push(std::move(message));
         } else {
-            INST_LOG_DEBUG(TAG, "No handler for channel code %d", channelCode);
+            DeliverGlobalMessage(std::move(message));
         }
     }
 }
 
+void DTXConnection::DeliverGlobalMessage(std::shared_ptr<DTXMessage> message) {
+    DTXChannel::MessageHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(m_globalHandlerMutex);
+        handler = m_globalHandler;
+    }
+    if (handler) {
+        if (!metrics::SampleTiming()) {
+            handler(message);
+            return;
+        }
+        static MetricsHistogram& handlerTime = metrics::Handler("_global_");
+        const auto start = MetricsHistogram::Clock::now();
+        handler(message);
+        handlerTime.RecordSince(start);
+    } else {
+        INST_LOG_DEBUG(TAG, "No handler for channel code %d",
+                      static_cast<int32_t>(message->ChannelCode()));
+    }
+}
+
 } // namespace instruments
@@ -0,0 +1,128 @@
+#include "dtx_dispatch_queue.h"
+#include "dtx_budget.h"
+#include "../util/log.h"
+#include "../util/metrics.h"
+
+namespace instruments {
+
+static const char* TAG = "DTXDispatchQueue";
+
+DTXDispatchQueue::DTXDispatchQueue(std::string name, size_t capacity,
+                                   DTXOverflowPolicy policy, Handler deliver,
+                                   std::shared_ptr<DTXQueueBudget> budget)
+    : m_state(std::make_shared<State>())
+{
+    m_state->name = std::move(name);
+    m_state->capacity = capacity > 0 ? capacity : 1;
+    m_state->policy = policy;
+    m_state->deliver = std::move(deliver);
+    m_state->budget = std::move(budget);
+    m_worker = std::thread(&DTXDispatchQueue::Run, m_state);
+
+    std::weak_ptr<State> weak = m_state;
+    m_metricsId = metrics::RegisterQueue([weak]() {
+        DispatchQueueStats stats;
+        if (auto state = weak.lock()) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            stats.name = state->name;
+            stats.depth = state->queue.size();
+            stats.capacity = state->capacity;
+            stats.dropped = state->dropped;
+        }
+        return stats;
+    });
+}
+
+DTXDispatchQueue::~DTXDispatchQueue() {
+    Stop();
+}
+
+void DTXDispatchQueue::Push(std::shared_ptr<DTXMessage> message) {
+    State& st = *m_state;
+    std::unique_lock<std::mutex> lock(st.mutex);
+    if (st.stopping) return;
+    if (st.budget) st.budget->Add(DTXQueueBudget::Footprint(*message));
+
+    if (st.queue.size() >= st.capacity) {
+        switch (st.policy) {
+            case DTXOverflowPolicy::DropOldest:
+                if (st.budget) st.budget->Release(DTXQueueBudget::Footprint(*st.queue.front()));
+                st.queue.pop_front();
+                st.dropped++;
+                break;
+            case DTXOverflowPolicy::Coalesce:
+                // Newest wins: the latest queued message is superseded
+                if (st.budget) st.budget->Release(DTXQueueBudget::Footprint(*st.queue.back()));
+                st.queue.back() = std::move(message);
+                st.dropped++;
+                break;
+            case DTXOverflowPolicy::Block:
+                st.spaceCv.wait(lock, [&st] { return st.stopping || st.queue.size() < st.capacity; });
+                if (st.stopping) {
+                    if (st.budget) st.budget->Release(DTXQueueBudget::Footprint(*message));
+                    return;
+                }
+                break;
+        }
+        if (st.policy != DTXOverflowPolicy::Block &&
+            (st.dropped == 1 || (st.dropped & 1023) == 0)) {
+            INST_LOG_WARN(TAG, "[%s] Handler queue full, %zu messages dropped so far",
+                         st.name.c_str(), st.dropped);
+        }
+        if (!message) return;   // coalesced into the tail
+    }
+
+    st.queue.push_back(std::move(message));
+    lock.unlock();
+    st.cv.notify_one();
+}
+
+void DTXDispatchQueue::Stop() {
+    if (const uint64_t id = m_metricsId.exchange(0)) metrics::UnregisterQueue(id);
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->stopping = true;
+        if (m_state->budget) {
+            for (const auto& message : m_state->queue) {
+                m_state->budget->Release(DTXQueueBudget::Footprint(*message));
+            }
+        }
+        m_state->queue.clear();
+    }
+    m_state->cv.notify_all();
+    m_state->spaceCv.notify_all();
+
+    if (m_worker.joinable()) {
+        if (m_worker.get_id() == std::this_thread::get_id()) {
+            // Stopped from inside a handler: the worker exits once it returns
+            m_worker.detach();
+        } else {
+            m_worker.join();
+        }
+    }
+}
+
+size_t DTXDispatchQueue::Dropped() const {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->dropped;
+}
+
+void DTXDispatchQueue::Run(std::shared_ptr<State> state) {
+    for (;;) {
+        std::shared_ptr<DTXMessage> message;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->cv.wait(lock, [&state] { return state->stopping || !state->queue.empty(); });
+            if (state->stopping) return;
+            message = std::move(state->queue.front());
+            state->queue.pop_front();
+        }
+        state->spaceCv.notify_one();
+        // Counted until handled, so the budget covers the message in the handler too
+        const size_t footprint = state->budget ? DTXQueueBudget::Footprint(*message) : 0;
+        state->deliver(std::move(message));
+        if (state->budget) state->budget->Release(footprint);
+    }
+}
+
+} // namespace instruments
@@ -0,0 +1,71 @@
+#ifndef INSTRUMENTS_DTX_DISPATCH_QUEUE_H
+#define INSTRUMENTS_DTX_DISPATCH_QUEUE_H
+
+#include "../../include/instruments/dtx_channel.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace instruments {
+
+class DTXQueueBudget;
+
+// DTXDispatchQueue - bounded message queue drained by its own worker
+// thread. Channels (and the connection's global handler) use it to run
+// handlers off the receive thread, so a slow consumer only delays its own
+// messages. What happens when the queue is full is set by DTXOverflowPolicy.
+// Queued messages are also counted against the connection's budget, if any.
+class DTXDispatchQueue {
+public:
+    using Handler = std::function<void(std::shared_ptr<DTXMessage>)>;
+
+    DTXDispatchQueue(std::string name, size_t capacity, DTXOverflowPolicy policy, Handler deliver,
+                     std::shared_ptr<DTXQueueBudget> budget = nullptr);
+    ~DTXDispatchQueue();
+
+    // Non-copyable
+    DTXDispatchQueue(const DTXDispatchQueue&) = delete;
+    DTXDispatchQueue& operator=(const DTXDispatchQueue&) = delete;
+
+    // Queue a message for the worker (may block under DTXOverflowPolicy::Block)
+    void Push(std::shared_ptr<DTXMessage> message);
+
+    // Stop the worker; queued messages are discarded. Safe to call from a handler.
+    void Stop();
+
+    // Messages discarded by the overflow policy so far
+    size_t Dropped() const;
+
+private:
+    // Shared with the worker so it can outlive the queue when Stop() is
+    // called from a handler (the worker is then detached)
+    struct State {
+        std::string name;
+        size_t capacity;
+        DTXOverflowPolicy policy;
+        Handler deliver;
+        std::shared_ptr<DTXQueueBudget> budget;   // optional
+
+        std::mutex mutex;
+        std::condition_variable cv;       // worker: queue not empty / stopping
+        std::condition_variable spaceCv;  // Block policy: room available / stopping
+        std::deque<std::shared_ptr<DTXMessage>> queue;
+        size_t dropped = 0;
+        bool stopping = false;
+    };
+
+    static void Run(std::shared_ptr<State> state);
+
+    std::shared_ptr<State> m_state;
+    std::thread m_worker;
+    std::atomic<uint64_t> m_metricsId{0};   // depth probe (0 once stopped)
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_DTX_DISPATCH_QUEUE_H
@@ -5,59 +5,117 @@ namespace instruments {
 
 static const char* TAG = "DTXFragment";
 
+void DTXFragmentDecoder::SetLimits(size_t maxPendingBytes, size_t maxPendingMessages,
+                                   size_t maxMessageBytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_maxPendingBytes = maxPendingBytes > 0 ? maxPendingBytes : SIZE_MAX;
+    m_maxPendingMessages = maxPendingMessages;
+    m_maxMessageBytes = maxMessageBytes;
+}
+
+void DTXFragmentDecoder::DropLocked(std::map<uint32_t, FragmentState>::iterator it) {
+    m_pendingBytes -= it->second.data.capacity();
+    m_pending.erase(it);
+}
+
 bool DTXFragmentDecoder::AddFragment(uint32_t identifier, uint16_t fragmentIndex,
-                                     uint16_t fragmentCount,
-                                     const std::vector<uint8_t>& data) {
+                                     uint16_t fragmentCount, uint32_t messageLength,
+                                     const uint8_t* data, size_t length) {
     std::lock_guard<std::mutex> lock(m_mutex);
 
-    auto& state = m_pending[identifier];
+    auto it = m_pending.find(identifier);
 
     if (fragmentIndex == 0) {
         // First fragment - initialize state
+        if (it != m_pending.end()) DropLocked(it);
+        INST_LOG_TRACE(TAG, "Fragment start: id=%u, count=%u, total=%u",
+                       identifier, fragmentCount, messageLength);
+        if (fragmentCount == 1) {
+            return true; // Single-fragment message is immediately complete
+        }
+        if (m_maxMessageBytes > 0 && messageLength > m_maxMessageBytes) {
+            INST_LOG_WARN(TAG, "Dropping fragmented message id=%u: %u bytes exceeds message cap",
+                          identifier, messageLength);
+            return false;
+        }
+        if (messageLength > m_maxPendingBytes - m_pendingBytes) {
+            INST_LOG_WARN(TAG, "Dropping fragmented message id=%u: %u bytes exceeds pending cap",
+                          identifier, messageLength);
+            return false;
+        }
+        if (m_maxPendingMessages > 0 && m_pending.size() >= m_maxPendingMessages) {
+            INST_LOG_WARN(TAG, "Dropping fragmented message id=%u: %zu messages already pending",
+                          identifier, m_pending.size());
+            return false;
+        }
+
+        // Fragment 0 has no payload data (just the header); reserve the total
+        auto& state = m_pending[identifier];
         state.expectedCount = fragmentCount;
-        state.receivedCount = 1;
-        // Fragment 0 has no payload data (just the header)
-        INST_LOG_TRACE(TAG, "Fragment start: id=%u, count=%u", identifier, fragmentCount);
-        return fragmentCount == 1; // Single-fragment message is immediately complete
+        state.data.reserve(messageLength);
+        m_pendingBytes += state.data.capacity();
+        return false;
     }
 
-    // Subsequent fragments carry payload data
-    state.fragments[fragmentIndex] = data;
-    state.totalSize += data.size();
-    state.receivedCount++;
+    if (it == m_pending.end()) {
+        INST_LOG_DEBUG(TAG, "Fragment %u for unknown id=%u dropped", fragmentIndex, identifier);
+        return false;
+    }
+
+    // Subsequent fragments carry payload data, in order
+    auto& state = it->second;
+    if (fragmentIndex != state.nextIndex) {
+        INST_LOG_WARN(TAG, "Fragment %u for id=%u out of order (expected %u), dropping message",
+                      fragmentIndex, identifier, state.nextIndex);
+        DropLocked(it);
+        return false;
+    }
+
+    // The announced total is normally exact; tolerate growth within the cap
+    const size_t needed = state.data.size() + length;
+    if (needed > state.data.capacity()) {
+        const size_t growth = needed - state.data.capacity();
+        if (growth > m_maxPendingBytes - m_pendingBytes ||
+            (m_maxMessageBytes > 0 && needed > m_maxMessageBytes)) {
+            INST_LOG_WARN(TAG, "Dropping fragmented message id=%u: exceeds pending cap", identifier);
+            DropLocked(it);
+            return false;
+        }
+        m_pendingBytes -= state.data.capacity();
+        state.data.reserve(needed);
+        m_pendingBytes += state.data.capacity();
+    }
+    state.data.insert(state.data.end(), data, data + length);
+    state.nextIndex++;
 
     INST_LOG_TRACE(TAG, "Fragment %u/%u for id=%u, size=%zu",
-                  fragmentIndex, state.expectedCount, identifier, data.size());
+                  fragmentIndex, state.expectedCount, identifier, length);
 
-    return state.receivedCount >= state.expectedCount;
+    return state.nextIndex >= state.expectedCount;
 }
 
-std::vector<uint8_t> DTXFragmentDecoder::GetAssembledData(uint32_t identifier) {
+std::vector<uint8_t> DTXFragmentDecoder::TakeAssembledData(uint32_t identifier) {
     std::lock_guard<std::mutex> lock(m_mutex);
 
     auto it = m_pending.find(identifier);
     if (it == m_pending.end()) return {};
 
-    auto& state = it->second;
-    std::vector<uint8_t> result;
-    result.reserve(state.totalSize);
-
-    // Assemble fragments in order (1, 2, 3, ...)
-    for (auto& [idx, fragment] : state.fragments) {
-        result.insert(result.end(), fragment.begin(), fragment.end());
-    }
-
+    std::vector<uint8_t> result = std::move(it->second.data);
+    m_pendingBytes -= result.capacity();
+    m_pending.erase(it);
     return result;
 }
 
 void DTXFragmentDecoder::Remove(uint32_t identifier) {
     std::lock_guard<std::mutex> lock(m_mutex);
-    m_pending.erase(identifier);
+    auto it = m_pending.find(identifier);
+    if (it != m_pending.end()) DropLocked(it);
 }
 
 void DTXFragmentDecoder::Clear() {
     std::lock_guard<std::mutex> lock(m_mutex);
     m_pending.clear();
+    m_pendingBytes = 0;
 }
 
 } // namespace instruments
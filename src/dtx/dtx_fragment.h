@@ -1,6 +1,7 @@
 #ifndef INSTRUMENTS_DTX_FRAGMENT_H
 #define INSTRUMENTS_DTX_FRAGMENT_H
 
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <mutex>
@@ -16,19 +17,33 @@ namespace instruments {
 // - Fragment 1..N: contain the actual payload data
 // - The first fragment's header contains fragmentCount and total message length
 // - Subsequent fragments are concatenated in order
+//
+// Fragment 0 reserves one buffer of the announced length; each later
+// fragment is copied once, straight into place. Pending data is capped per
+// decoder (SetLimits) so a misbehaving device cannot grow it without bound.
 
 class DTXFragmentDecoder {
 public:
+    // Default upper bound on bytes buffered across all pending messages
+    static constexpr size_t kMaxPendingBytes = 64 * 1024 * 1024;
+
+    // Bytes buffered across pending messages, messages pending at once and
+    // the announced length of one message (0 = unlimited). Messages over a
+    // limit are dropped.
+    void SetLimits(size_t maxPendingBytes, size_t maxPendingMessages, size_t maxMessageBytes);
+
     // Add a fragment. Returns true when the message is complete.
     // identifier: message identifier
     // fragmentIndex: 0-based fragment index
     // fragmentCount: total number of fragments
-    // data: fragment payload data (empty for fragment 0)
-    bool AddFragment(uint32_t identifier, uint16_t fragmentIndex,
-                     uint16_t fragmentCount, const std::vector<uint8_t>& data);
+    // messageLength: header messageLength (the total for fragment 0)
+    // data/length: fragment payload data (empty for fragment 0)
+    bool AddFragment(uint32_t identifier, uint16_t fragmentIndex, uint16_t fragmentCount,
+                     uint32_t messageLength, const uint8_t* data, size_t length);
 
-    // Get the assembled message data (only valid after AddFragment returns true)
-    std::vector<uint8_t> GetAssembledData(uint32_t identifier);
+    // Move the assembled message data out and forget the message
+    // (only valid after AddFragment returns true)
+    std::vector<uint8_t> TakeAssembledData(uint32_t identifier);
 
     // Remove assembled data for an identifier
     void Remove(uint32_t identifier);
@@ -39,13 +54,18 @@ public:
 private:
     struct FragmentState {
         uint16_t expectedCount = 0;
-        uint16_t receivedCount = 0;
-        size_t totalSize = 0;
-        std::map<uint16_t, std::vector<uint8_t>> fragments;
+        uint16_t nextIndex = 1;
+        std::vector<uint8_t> data;      // reserved to the announced length
     };
 
+    void DropLocked(std::map<uint32_t, FragmentState>::iterator it);
+
     std::mutex m_mutex;
     std::map<uint32_t, FragmentState> m_pending;
+    size_t m_pendingBytes = 0;          // reserved bytes across m_pending
+    size_t m_maxPendingBytes = kMaxPendingBytes;
+    size_t m_maxPendingMessages = 0;
+    size_t m_maxMessageBytes = 0;
 };
 
 } // namespace instruments
@@ -1,9 +1,12 @@
 #include "../../include/instruments/dtx_message.h"
+#include "dtx_message_pool.h"
 #include "dtx_primitive_dict.h"
+#include "../nskeyedarchiver/bplist_reader.h"
 #include "../nskeyedarchiver/nskeyedarchiver.h"
 #include "../nskeyedarchiver/nskeyedunarchiver.h"
 #include "../util/lz4.h"
 #include "../util/log.h"
+#include "../util/metrics.h"
 #include <atomic>
 #include <cstring>
 #include <fstream>
@@ -34,10 +37,35 @@ static void DumpLZ4Payload(const uint8_t* data, size_t len) {
     INST_LOG_INFO(TAG, "Wrote LZ4 raw payload dump: %s (%zu bytes)", filename, len);
 }
 
-static std::vector<uint8_t> TryDecodeBV4Container(const uint8_t* data, size_t len) {
-    std::vector<uint8_t> out;
+// Decompressed LZ4 payloads are copied into the message right away, so each
+// receive thread decodes into one reused buffer
+static std::vector<uint8_t>& LZ4Scratch() {
+    static thread_local std::vector<uint8_t> scratch;
+    return scratch;
+}
+
+// Large one-off payloads do not pin their buffer
+static void TrimLZ4Scratch() {
+    constexpr size_t kMaxKeptScratch = 16u * 1024u * 1024u;
+    auto& scratch = LZ4Scratch();
+    if (scratch.capacity() > kMaxKeptScratch) {
+        std::vector<uint8_t>().swap(scratch);
+    }
+}
+
+// Grow (never shrink) out to at least size bytes; the contents are scratch
+static uint8_t* ReserveOutput(std::vector<uint8_t>& out, size_t size) {
+    if (out.size() < size) out.resize(size);
+    return out.data();
+}
+
+// Decode the "bv4" chunk container used by instruments sysmontap into out
+// (grown as needed). Sets outSize; false when data is not a bv4 container.
+static bool TryDecodeBV4Container(const uint8_t* data, size_t len,
+                                  std::vector<uint8_t>& out, size_t& outSize) {
+    outSize = 0;
     if (data == nullptr || len < 8) {
-        return out;
+        return false;
     }
 
     auto readBE32Local = [](const uint8_t* p) -> uint32_t {
@@ -55,8 +83,6 @@ static std::vector<uint8_t> TryDecodeBV4Container(const uint8_t* data, size_t le
     };
 
     std::vector<ChunkRef> sequence;
-    std::vector<uint8_t> compressedAgg;
-    std::vector<uint32_t> compU;
     size_t pos = 0;
 
     // First chunk: [u32 uncompressed][u32 compressed][compressed bytes]
@@ -64,11 +90,9 @@ static std::vector<uint8_t> TryDecodeBV4Container(const uint8_t* data, size_t le
     uint32_t c0 = ReadLE32(data + pos + 4);
     pos += 8;
     if (c0 == 0 || pos + c0 > len) {
-        return out;
+        return false;
     }
     sequence.push_back({true, u0, data + pos, c0});
-    compU.push_back(u0);
-    compressedAgg.insert(compressedAgg.end(), data + pos, data + pos + c0);
     pos += c0;
 
     while (pos + 4 <= len) {
@@ -78,28 +102,26 @@ static std::vector<uint8_t> TryDecodeBV4Container(const uint8_t* data, size_t le
         }
         if (tag == 0x62763431) { // "bv41" compressed chunk
             if (pos + 12 > len) {
-                return {};
+                return false;
             }
             uint32_t u = ReadLE32(data + pos + 4);
             uint32_t c = ReadLE32(data + pos + 8);
             pos += 12;
             if (c == 0 || pos + c > len) {
-                return {};
+                return false;
             }
             sequence.push_back({true, u, data + pos, c});
-            compU.push_back(u);
-            compressedAgg.insert(compressedAgg.end(), data + pos, data + pos + c);
             pos += c;
             continue;
         }
         if (tag == 0x6276342D) { // "bv4-" uncompressed chunk
             if (pos + 8 > len) {
-                return {};
+                return false;
             }
             uint32_t u = ReadLE32(data + pos + 4);
             pos += 8;
             if (u == 0 || pos + u > len) {
-                return {};
+                return false;
             }
             sequence.push_back({false, u, data + pos, u});
             pos += u;
@@ -108,60 +130,74 @@ static std::vector<uint8_t> TryDecodeBV4Container(const uint8_t* data, size_t le
         // Unknown tag
         break;
     }
-    if (sequence.empty()) {
-        return {};
-    }
 
-    // First try: decompress each chunk individually with a streaming dictionary.
-    size_t totalOut = 0;
+    // One output buffer sized from the chunk headers
+    uint64_t totalU64 = 0;
     for (const auto& ch : sequence) {
-        totalOut += ch.compressed ? ch.u : ch.c;
+        totalU64 += ch.u;
+    }
+    if (totalU64 == 0 || totalU64 > (128u * 1024u * 1024u)) {
+        return false;
     }
-    out.reserve(totalOut);
+    const size_t totalOut = static_cast<size_t>(totalU64);
+    uint8_t* dst = ReserveOutput(out, totalOut);
 
+    // First try: decompress each chunk in place, the output before it (up
+    // to 64KB) serving as the streaming dictionary
     bool ok = true;
+    size_t outPos = 0;
     for (const auto& ch : sequence) {
-        if (ch.compressed) {
-            const uint8_t* dict = nullptr;
-            size_t dictSize = 0;
-            if (!out.empty()) {
-                dictSize = out.size() > 65536 ? 65536 : out.size();
-                dict = out.data() + (out.size() - dictSize);
-            }
-            auto dec = LZ4::DecompressWithDict(ch.data, ch.c, ch.u, dict, dictSize);
-            if (dec.empty()) {
-                dec = LZ4::DecompressFrame(ch.data, ch.c, ch.u);
-            }
-            if (dec.empty()) {
+        const size_t room = totalOut - outPos;
+        if (!ch.compressed) {
+            if (ch.c > room) {
                 ok = false;
                 break;
             }
-            out.insert(out.end(), dec.begin(), dec.end());
-        } else {
-            out.insert(out.end(), ch.data, ch.data + ch.c);
+            std::memcpy(dst + outPos, ch.data, ch.c);
+            outPos += ch.c;
+            continue;
         }
+        const size_t dictSize = outPos > 65536 ? 65536 : outPos;
+        const size_t cap = ch.u < room ? ch.u : room;
+        size_t n = 0;
+        if (!LZ4::DecompressWithDict(ch.data, ch.c, dst + outPos, cap, n,
+                                     dst + outPos - dictSize, dictSize) &&
+            !LZ4::DecompressFrame(ch.data, ch.c, dst + outPos, cap, n)) {
+            ok = false;
+            break;
+        }
+        if (n == 0) {
+            ok = false;
+            break;
+        }
+        outPos += n;
     }
-    if (ok && !out.empty()) {
-        return out;
+    if (ok && outPos > 0) {
+        outSize = outPos;
+        return true;
     }
 
     // Fallback: aggregate all compressed chunks into one stream and decompress once.
-    if (compressedAgg.empty()) {
-        return {};
+    std::vector<uint8_t> compressedAgg;
+    size_t totalCompU = 0;
+    for (const auto& ch : sequence) {
+        if (!ch.compressed) continue;
+        compressedAgg.insert(compressedAgg.end(), ch.data, ch.data + ch.c);
+        totalCompU += ch.u;
+    }
+    if (compressedAgg.empty() || totalCompU == 0) {
+        return false;
     }
-    uint64_t totalU64 = 0;
-    for (auto u : compU) totalU64 += u;
-    size_t totalU = static_cast<size_t>(totalU64);
 
-    auto decAll = LZ4::Decompress(compressedAgg.data(), compressedAgg.size(), totalU);
+    auto decAll = LZ4::Decompress(compressedAgg.data(), compressedAgg.size(), totalCompU);
     if (decAll.empty()) {
-        decAll = LZ4::DecompressFrame(compressedAgg.data(), compressedAgg.size(), totalU);
+        decAll = LZ4::DecompressFrame(compressedAgg.data(), compressedAgg.size(), totalCompU);
     }
     if (decAll.empty()) {
-        return {};
+        return false;
     }
 
-    out.clear();
+    outPos = 0;
     size_t decPos = 0;
     for (const auto& ch : sequence) {
         if (ch.compressed) {
@@ -170,17 +206,17 @@ static std::vector<uint8_t> TryDecodeBV4Container(const uint8_t* data, size_t le
                 take = decAll.size() > decPos ? (decAll.size() - decPos) : 0;
             }
             if (take == 0) break;
-            out.insert(out.end(), decAll.begin() + decPos, decAll.begin() + decPos + take);
+            std::memcpy(dst + outPos, decAll.data() + decPos, take);
+            outPos += take;
             decPos += take;
         } else {
-            out.insert(out.end(), ch.data, ch.data + ch.c);
+            std::memcpy(dst + outPos, ch.data, ch.c);
+            outPos += ch.c;
         }
     }
 
-    if (out.empty()) {
-        return {};
-    }
-    return out;
+    outSize = outPos;
+    return outSize > 0;
 }
 
 // Little-endian read/write helpers
@@ -216,6 +252,13 @@ static uint32_t ReadLE32(const uint8_t* p) {
 
 DTXMessage::DTXMessage() = default;
 
+DTXMessage::~DTXMessage() {
+    if (m_pool) {
+        m_pool->ReturnBuffer(std::move(m_payload));
+        m_pool->ReturnBuffer(std::move(m_auxiliary));
+    }
+}
+
 std::shared_ptr<DTXMessage> DTXMessage::Create() {
     return std::make_shared<DTXMessage>();
 }
@@ -225,8 +268,22 @@ std::shared_ptr<DTXMessage> DTXMessage::CreateWithSelector(const std::string& se
     msg->SetMessageType(DTXMessageType::MethodInvocation);
     msg->SetExpectsReply(true);
 
-    // Payload is the selector string, NSKeyedArchiver-encoded
-    msg->SetPayload(NSObject(selector));
+    // Payload is the selector string, NSKeyedArchiver-encoded; the archive
+    // is cached per selector, and the selector needs no decoding later
+    NSKeyedArchiver::ArchiveSelector(selector, msg->m_payload);
+    msg->m_selector = selector;
+    msg->m_selectorDecoded = true;
+    return msg;
+}
+
+std::shared_ptr<DTXMessage> DTXMessage::CreateWithArchivedSelector(std::string_view selector,
+                                                                const std::vector<uint8_t>& archived) {
+    auto msg = std::make_shared<DTXMessage>();
+    msg->SetMessageType(DTXMessageType::MethodInvocation);
+    msg->SetExpectsReply(true);
+    msg->m_payload.assign(archived.begin(), archived.end());
+    msg->m_selector = selector;
+    msg->m_selectorDecoded = true;
     return msg;
 }
 
@@ -241,35 +298,135 @@ std::shared_ptr<DTXMessage> DTXMessage::CreateAck(uint32_t identifier, uint32_t
     return msg;
 }
 
+// Pull the root NSString out of an NSKeyedArchiver bplist without building
+// an NSObject tree: $top.root is a UID indexing $objects, which for a
+// selector payload is a string. Returns false for anything else so the
+// caller can fall back to the full unarchiver.
+static bool ExtractArchivedString(const uint8_t* data, size_t len, std::string& out) {
+    BPlistReader r;
+    BPlistReader::Object top, topDict, root, objects, str;
+    uint64_t topRef, rootRef, objectsRef;
+    if (!r.Open(data, len) || !r.Get(r.TopRef(), top) ||
+        !r.DictLookup(top, "$top", topRef) || !r.Get(topRef, topDict) ||
+        !r.DictLookup(topDict, "root", rootRef) || !r.Get(rootRef, root) ||
+        root.kind != BPlistReader::Kind::UID ||
+        !r.DictLookup(top, "$objects", objectsRef) || !r.Get(objectsRef, objects) ||
+        objects.kind != BPlistReader::Kind::Array) {
+        return false;
+    }
+    const uint64_t uid = r.UIDValue(root);
+    if (uid >= objects.count || !r.Get(r.RefAt(objects, uid), str)) return false;
+    return r.StringValue(str, out);
+}
+
+// Binary ("bplist") or XML plist. Raw payloads (screenshots, activity
+// trace records) are neither and never go through the unarchiver.
+static bool LooksLikePlist(const uint8_t* data, size_t len) {
+    if (len >= 6 && std::memcmp(data, "bplist", 6) == 0) return true;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n') continue;
+        return data[i] == '<';
+    }
+    return false;
+}
+
 void DTXMessage::SetPayload(const NSObject& obj) {
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
     m_payload = NSKeyedArchiver::Archive(obj);
+    m_compressed.clear();
+    m_payloadObject.reset();
+    m_selector.clear();
+    m_payloadDecoded = false;
+    m_selectorDecoded = false;
+}
+
+std::shared_ptr<NSObject> DTXMessage::DecodePayloadLocked() const {
+    if (!m_payloadDecoded) {
+        m_payloadDecoded = true;
+        if (!m_payload.empty()) {
+            auto obj = std::make_shared<NSObject>(
+                NSKeyedUnarchiver::Unarchive(m_payload));
+            if (!obj->IsNull()) m_payloadObject = std::move(obj);
+        }
+    }
+    return m_payloadObject;
 }
 
 std::shared_ptr<NSObject> DTXMessage::PayloadObject() const {
-    if (m_payload.empty()) return nullptr;
-    auto obj = std::make_shared<NSObject>(
-        NSKeyedUnarchiver::Unarchive(m_payload));
-    if (obj->IsNull()) return nullptr;
-    return obj;
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
+    return DecodePayloadLocked();
 }
 
-std::string DTXMessage::Selector() const {
-    auto obj = PayloadObject();
-    if (obj && obj->IsString()) {
-        return obj->AsString();
+std::string_view DTXMessage::SelectorView() const {
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
+    if (!m_selectorDecoded) {
+        m_selectorDecoded = true;
+        if (!m_payload.empty() && LooksLikePlist(m_payload.data(), m_payload.size()) &&
+            !ExtractArchivedString(m_payload.data(), m_payload.size(), m_selector)) {
+            auto obj = DecodePayloadLocked();
+            if (obj && obj->IsString()) {
+                m_selector = obj->AsString();
+            }
+        }
     }
-    return "";
+    return m_selector;
 }
 
 void DTXMessage::AppendAuxiliary(const NSObject& value) {
-    m_auxItems.push_back(value);
-    // Re-encode all auxiliary items
-    m_auxiliary = DTXPrimitiveDict::Encode(m_auxItems);
+    DTXPrimitiveDict::EncodeEntry(value, m_auxiliary);
+    AuxiliaryChanged();
+}
+
+void DTXMessage::AppendAuxiliaryInt32(int32_t value) {
+    DTXPrimitiveDict::EncodeUInt32Entry(static_cast<uint32_t>(value), m_auxiliary);
+    AuxiliaryChanged();
+}
+
+void DTXMessage::AppendAuxiliaryInt64(int64_t value) {
+    DTXPrimitiveDict::EncodeInt64Entry(static_cast<uint64_t>(value), m_auxiliary);
+    AuxiliaryChanged();
+}
+
+void DTXMessage::AppendAuxiliaryUInt64(uint64_t value) {
+    DTXPrimitiveDict::EncodeInt64Entry(value, m_auxiliary);
+    AuxiliaryChanged();
 }
 
-std::vector<NSObject> DTXMessage::AuxiliaryObjects() const {
-    if (m_auxiliary.empty()) return {};
-    return DTXPrimitiveDict::Decode(m_auxiliary);
+void DTXMessage::AppendAuxiliaryBool(bool value) {
+    const size_t lengthPos = DTXPrimitiveDict::BeginArchivedEntry(m_auxiliary);
+    NSKeyedArchiver::AppendArchivedBool(value, m_auxiliary);
+    DTXPrimitiveDict::EndArchivedEntry(lengthPos, m_auxiliary);
+    AuxiliaryChanged();
+}
+
+void DTXMessage::AppendAuxiliaryReal(double value) {
+    const size_t lengthPos = DTXPrimitiveDict::BeginArchivedEntry(m_auxiliary);
+    NSKeyedArchiver::AppendArchivedReal(value, m_auxiliary);
+    DTXPrimitiveDict::EndArchivedEntry(lengthPos, m_auxiliary);
+    AuxiliaryChanged();
+}
+
+void DTXMessage::AppendAuxiliaryString(std::string_view value) {
+    const size_t lengthPos = DTXPrimitiveDict::BeginArchivedEntry(m_auxiliary);
+    NSKeyedArchiver::AppendArchivedString(value, m_auxiliary);
+    DTXPrimitiveDict::EndArchivedEntry(lengthPos, m_auxiliary);
+    AuxiliaryChanged();
+}
+
+void DTXMessage::AuxiliaryChanged() {
+    m_compressed.clear();
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
+    m_auxObjects.clear();
+    m_auxDecoded = false;
+}
+
+const std::vector<NSObject>& DTXMessage::AuxiliaryObjects() const {
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
+    if (!m_auxDecoded) {
+        m_auxDecoded = true;
+        m_auxObjects = DTXPrimitiveDict::DecodeEntries(m_auxiliary.data(), m_auxiliary.size());
+    }
+    return m_auxObjects;
 }
 
 bool DTXMessage::ParseHeader(const uint8_t* data, size_t length, DTXMessageHeader& outHeader) {
@@ -302,7 +459,7 @@ bool DTXMessage::ParseHeader(const uint8_t* data, size_t length, DTXMessageHeade
     return true;
 }
 
-std::vector<std::vector<uint8_t>> DTXMessage::Encode() const {
+void DTXMessage::EncodeSegments(DTXWireSegments& out) const {
     size_t auxLen = m_auxiliary.size();
     size_t payloadLen = m_payload.size();
     size_t auxLenWithHeader = auxLen > 0 ? auxLen + DTXProtocol::PayloadHeaderLength : 0;
@@ -311,52 +468,119 @@ std::vector<std::vector<uint8_t>> DTXMessage::Encode() const {
     bool hasPayload = (totalPayloadLen > 0 ||
                        MessageType() == DTXMessageType::Ack);
 
-    std::vector<uint8_t> payloadSection;
-    if (hasPayload) {
+    // Headers go into the scratch area; aux and payload are referenced in place
+    uint8_t* p = out.headers + DTXProtocol::HeaderLength;
+    size_t messageLength = 0;
+    if (!m_compressed.empty()) {
+        // Compressed: one payload header in front of the compressed body
+        WriteLE32(p, static_cast<uint32_t>(DTXMessageType::LZ4Compressed));
+        WriteLE32(p + 4, 0);
+        WriteLE32(p + 8, static_cast<uint32_t>(m_compressed.size()));
+        WriteLE32(p + 12, 0);
+        p += DTXProtocol::PayloadHeaderLength;
+        messageLength = DTXProtocol::PayloadHeaderLength + m_compressed.size();
+    } else if (hasPayload) {
         // Payload header (16 bytes) + auxiliary + payload
-        payloadSection.resize(DTXProtocol::PayloadHeaderLength);
-        INST_LOG_INFO(TAG, "Encoding message: messageType=0x%04X (raw), expectsReply=%d, auxLen=%zu, totalLen=%zu",
+        INST_LOG_TRACE(TAG, "Encoding message: messageType=0x%04X (raw), expectsReply=%d, auxLen=%zu, totalLen=%zu",
                      m_payloadHeader.messageType,
                      m_header.expectsReply,
                      auxLenWithHeader,
                      totalPayloadLen);
-        WriteLE32(payloadSection.data(), m_payloadHeader.messageType);
-        WriteLE32(payloadSection.data() + 4, static_cast<uint32_t>(auxLenWithHeader));
-        WriteLE32(payloadSection.data() + 8, static_cast<uint32_t>(totalPayloadLen));
-        WriteLE32(payloadSection.data() + 12, m_payloadHeader.flags);
+        WriteLE32(p, m_payloadHeader.messageType);
+        WriteLE32(p + 4, static_cast<uint32_t>(auxLenWithHeader));
+        WriteLE32(p + 8, static_cast<uint32_t>(totalPayloadLen));
+        WriteLE32(p + 12, m_payloadHeader.flags);
+        p += DTXProtocol::PayloadHeaderLength;
 
         if (auxLen > 0) {
             // 16-byte auxiliary header: magic (0x1F0) + aux size
             const uint64_t magic = 0x1F0;
             const uint64_t auxSize = static_cast<uint64_t>(auxLen);
-            uint8_t auxHeader[DTXProtocol::PayloadHeaderLength];
             for (int i = 0; i < 8; i++) {
-                auxHeader[i] = static_cast<uint8_t>((magic >> (i * 8)) & 0xFF);
+                p[i] = static_cast<uint8_t>((magic >> (i * 8)) & 0xFF);
             }
             for (int i = 0; i < 8; i++) {
-                auxHeader[8 + i] = static_cast<uint8_t>((auxSize >> (i * 8)) & 0xFF);
+                p[8 + i] = static_cast<uint8_t>((auxSize >> (i * 8)) & 0xFF);
             }
-            payloadSection.insert(payloadSection.end(), auxHeader, auxHeader + DTXProtocol::PayloadHeaderLength);
-            payloadSection.insert(payloadSection.end(), m_auxiliary.begin(), m_auxiliary.end());
+            p += DTXProtocol::PayloadHeaderLength;
         }
-        payloadSection.insert(payloadSection.end(), m_payload.begin(), m_payload.end());
+        messageLength = DTXProtocol::PayloadHeaderLength + totalPayloadLen;
     }
     // ACK messages: no payload section (messageLength = 0)
 
-    // Build complete message: header + optional payload section
-    std::vector<uint8_t> message(DTXProtocol::HeaderLength);
     // Magic is written big-endian (matches go-ios fixtures)
-    WriteBE32(message.data(), DTXProtocol::Magic);
-    WriteLE32(message.data() + 4, DTXProtocol::HeaderLength);
-    WriteLE16(message.data() + 8, 0);  // fragmentIndex
-    WriteLE16(message.data() + 10, 1); // fragmentCount
-    WriteLE32(message.data() + 12, static_cast<uint32_t>(payloadSection.size()));
-    WriteLE32(message.data() + 16, m_header.identifier);
-    WriteLE32(message.data() + 20, m_header.conversationIndex);
-    WriteLE32(message.data() + 24, m_header.channelCode);
-    WriteLE32(message.data() + 28, m_header.expectsReply);
-
-    message.insert(message.end(), payloadSection.begin(), payloadSection.end());
+    WriteBE32(out.headers, DTXProtocol::Magic);
+    WriteLE32(out.headers + 4, DTXProtocol::HeaderLength);
+    WriteLE16(out.headers + 8, 0);  // fragmentIndex
+    WriteLE16(out.headers + 10, 1); // fragmentCount
+    WriteLE32(out.headers + 12, static_cast<uint32_t>(messageLength));
+    WriteLE32(out.headers + 16, m_header.identifier);
+    WriteLE32(out.headers + 20, m_header.conversationIndex);
+    WriteLE32(out.headers + 24, m_header.channelCode);
+    WriteLE32(out.headers + 28, m_header.expectsReply);
+
+    out.count = 0;
+    out.segments[out.count++] = {out.headers, static_cast<size_t>(p - out.headers)};
+    if (!m_compressed.empty()) {
+        out.segments[out.count++] = {m_compressed.data(), m_compressed.size()};
+        return;
+    }
+    if (hasPayload && auxLen > 0) {
+        out.segments[out.count++] = {m_auxiliary.data(), auxLen};
+    }
+    if (hasPayload && payloadLen > 0) {
+        out.segments[out.count++] = {m_payload.data(), payloadLen};
+    }
+}
+
+bool DTXMessage::Compress(size_t threshold) {
+    if (!m_compressed.empty()) return true;
+    if (m_payload.empty() && m_auxiliary.empty()) return false;
+
+    // The uncompressed payload section is what Decode() expects back
+    DTXWireSegments wire;
+    EncodeSegments(wire);
+    const size_t sectionLen = wire.TotalLength() - DTXProtocol::HeaderLength;
+    if (sectionLen < threshold || sectionLen > 0xFFFFFFFFu) return false;
+
+    std::vector<uint8_t>& section = LZ4Scratch();
+    struct ScratchTrim { ~ScratchTrim() { TrimLZ4Scratch(); } } trimScratch;
+    uint8_t* dst = ReserveOutput(section, sectionLen);
+    std::memcpy(dst, wire.segments[0].data + DTXProtocol::HeaderLength,
+                wire.segments[0].length - DTXProtocol::HeaderLength);
+    dst += wire.segments[0].length - DTXProtocol::HeaderLength;
+    for (size_t i = 1; i < wire.count; i++) {
+        std::memcpy(dst, wire.segments[i].data, wire.segments[i].length);
+        dst += wire.segments[i].length;
+    }
+
+    // [u32 original type][u32 uncompressed size][LZ4 block]
+    std::vector<uint8_t> compressed(8 + LZ4::CompressBound(sectionLen));
+    size_t compressedLen = 0;
+    if (!LZ4::Compress(section.data(), sectionLen, compressed.data() + 8,
+                       compressed.size() - 8, compressedLen) ||
+        8 + compressedLen >= sectionLen) {
+        return false;
+    }
+    WriteLE32(compressed.data(), m_payloadHeader.messageType);
+    WriteLE32(compressed.data() + 4, static_cast<uint32_t>(sectionLen));
+    compressed.resize(8 + compressedLen);
+    m_compressed = std::move(compressed);
+
+    INST_LOG_TRACE(TAG, "Compressed message: %zu -> %zu bytes", sectionLen, m_compressed.size());
+    return true;
+}
+
+std::vector<std::vector<uint8_t>> DTXMessage::Encode() const {
+    DTXWireSegments wire;
+    EncodeSegments(wire);
+
+    std::vector<uint8_t> message;
+    message.reserve(wire.TotalLength());
+    for (size_t i = 0; i < wire.count; i++) {
+        const auto& seg = wire.segments[i];
+        message.insert(message.end(), seg.data, seg.data + seg.length);
+    }
 
     // For now, return as a single fragment
     // TODO: Fragment if message exceeds transport buffer size
@@ -364,8 +588,9 @@ std::vector<std::vector<uint8_t>> DTXMessage::Encode() const {
 }
 
 std::shared_ptr<DTXMessage> DTXMessage::Decode(const DTXMessageHeader& header,
-                                                const uint8_t* data, size_t length) {
-    auto msg = std::make_shared<DTXMessage>();
+                                                const uint8_t* data, size_t length,
+                                                const std::shared_ptr<DTXMessagePool>& pool) {
+    auto msg = pool ? pool->NewMessage() : std::make_shared<DTXMessage>();
     msg->m_header = header;
 
     if (length == 0) {
@@ -373,6 +598,12 @@ std::shared_ptr<DTXMessage> DTXMessage::Decode(const DTXMessageHeader& header,
         return msg;
     }
 
+    if (pool) {
+        // Recycled storage: the assign() calls below reuse its capacity
+        pool->TakeBuffer(msg->m_payload);
+        pool->TakeBuffer(msg->m_auxiliary);
+    }
+
     auto parsePayloadSection = [&](const uint8_t* buf, size_t len) -> bool {
         if (len < DTXProtocol::PayloadHeaderLength) {
             return false;
@@ -555,20 +786,27 @@ std::shared_ptr<DTXMessage> DTXMessage::Decode(const DTXMessageHeader& header,
             maxOut = 64u * 1024u * 1024u;
         }
 
-        auto decompressed = LZ4::Decompress(payloadStart + 8, remaining - 8, maxOut);
-        if (decompressed.empty()) {
+        const uint8_t* const compressed = payloadStart + 8;
+        const size_t compressedLen = remaining - 8;
+        std::vector<uint8_t>& scratch = LZ4Scratch();
+        struct ScratchTrim { ~ScratchTrim() { TrimLZ4Scratch(); } } trimScratch;
+        size_t decompressedLen = 0;
+        bool decoded = LZ4::Decompress(compressed, compressedLen,
+                                       ReserveOutput(scratch, maxOut), maxOut, decompressedLen) &&
+                       decompressedLen > 0;
+        if (!decoded) {
             // Try LZ4 frame format
-            decompressed = LZ4::DecompressFrame(payloadStart + 8, remaining - 8, maxOut);
+            decoded = LZ4::DecompressFrame(compressed, compressedLen,
+                                           scratch.data(), maxOut, decompressedLen) &&
+                      decompressedLen > 0;
         }
         bool usedBv4 = false;
-        if (decompressed.empty()) {
+        if (!decoded) {
             // Try custom "bv4" container used by instruments sysmontap
-            decompressed = TryDecodeBV4Container(payloadStart + 8, remaining - 8);
-            if (!decompressed.empty()) {
-                usedBv4 = true;
-            }
+            decoded = TryDecodeBV4Container(compressed, compressedLen, scratch, decompressedLen);
+            usedBv4 = decoded;
         }
-        if (decompressed.empty()) {
+        if (!decoded) {
             // Dump first bytes to identify frame/block format
             char hex[3 * 17] = {0};
             const size_t dumpLen = remaining - 8 < 16 ? (remaining - 8) : 16;
@@ -587,29 +825,35 @@ std::shared_ptr<DTXMessage> DTXMessage::Decode(const DTXMessageHeader& header,
             return msg;
         }
 
+        MetricsCounters& counters = metrics::Counters();
+        metrics::Add(counters.receive.lz4Messages);
+        metrics::Add(counters.receive.lz4BytesIn, compressedLen);
+        metrics::Add(counters.receive.lz4BytesOut, decompressedLen);
+
+        const uint8_t* const decompressed = scratch.data();
         msg->m_payloadHeader.messageType = origType;
         if (usedBv4) {
-            INST_LOG_INFO(TAG, "Decoded bv4 container: %zu bytes", decompressed.size());
+            INST_LOG_TRACE(TAG, "Decoded bv4 container: %zu bytes", decompressedLen);
         }
 
         // If decompressed data includes a payload header, parse it.
-        if (parsePayloadSection(decompressed.data(), decompressed.size())) {
+        if (parsePayloadSection(decompressed, decompressedLen)) {
             return msg;
         }
 
-        if (tryBplistFallback(decompressed.data(), decompressed.size(), origType,
+        if (tryBplistFallback(decompressed, decompressedLen, origType,
                               usedBv4 ? "bv4" : "lz4-decompressed")) {
             return msg;
         }
 
         // Fallback: treat decompressed data as aux+payload (no payload header)
         size_t auxLen = msg->m_payloadHeader.auxiliaryLength;
-        if (auxLen > 0 && auxLen <= decompressed.size()) {
-            msg->m_auxiliary.assign(decompressed.begin(), decompressed.begin() + auxLen);
+        if (auxLen > 0 && auxLen <= decompressedLen) {
+            msg->m_auxiliary.assign(decompressed, decompressed + auxLen);
         }
-        size_t payloadDataLen = decompressed.size() > auxLen ? decompressed.size() - auxLen : 0;
+        size_t payloadDataLen = decompressedLen > auxLen ? decompressedLen - auxLen : 0;
         if (payloadDataLen > 0) {
-            msg->m_payload.assign(decompressed.begin() + auxLen, decompressed.end());
+            msg->m_payload.assign(decompressed + auxLen, decompressed + decompressedLen);
         }
 
         return msg;
@@ -630,14 +874,14 @@ std::string DTXMessage::Dump() const {
     ss << ", type=" << m_payloadHeader.messageType;
     ss << ", reply=" << (ExpectsReply() ? "yes" : "no");
 
-    auto sel = Selector();
+    auto sel = SelectorView();
     if (!sel.empty()) {
         ss << ", selector=\"" << sel << "\"";
     }
 
-    auto auxObjs = AuxiliaryObjects();
-    if (!auxObjs.empty()) {
-        ss << ", aux=[" << auxObjs.size() << " items]";
+    const size_t auxCount = Auxiliary().size();
+    if (auxCount > 0) {
+        ss << ", aux=[" << auxCount << " items]";
     }
 
     auto payload = PayloadObject();
@@ -0,0 +1,68 @@
+#include "dtx_message_pool.h"
+#include "../../include/instruments/dtx_message.h"
+#include <new>
+
+namespace instruments {
+
+// Free-list bounds: enough for a burst of in-flight messages per connection
+static constexpr size_t kMaxPooledBuffers = 32;
+static constexpr size_t kMaxPooledBufferBytes = 1024 * 1024;
+static constexpr size_t kMaxPooledBlocks = 32;
+
+std::shared_ptr<DTXMessagePool> DTXMessagePool::Create() {
+    return std::shared_ptr<DTXMessagePool>(new DTXMessagePool());
+}
+
+DTXMessagePool::~DTXMessagePool() {
+    for (void* block : m_blocks) {
+        ::operator delete(block);
+    }
+}
+
+std::shared_ptr<DTXMessage> DTXMessagePool::NewMessage() {
+    auto msg = std::allocate_shared<DTXMessage>(DTXPoolAllocator<DTXMessage>(shared_from_this()));
+    msg->m_pool = shared_from_this();
+    return msg;
+}
+
+void DTXMessagePool::TakeBuffer(std::vector<uint8_t>& buf) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_buffers.empty()) return;
+    buf.swap(m_buffers.back());
+    m_buffers.pop_back();
+    buf.clear();
+}
+
+void DTXMessagePool::ReturnBuffer(std::vector<uint8_t>&& buf) {
+    if (buf.capacity() == 0 || buf.capacity() > kMaxPooledBufferBytes) return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_buffers.size() < kMaxPooledBuffers) {
+        m_buffers.push_back(std::move(buf));
+    }
+}
+
+void* DTXMessagePool::AllocateBlock(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_blockSize == 0) m_blockSize = size;
+        if (size == m_blockSize && !m_blocks.empty()) {
+            void* block = m_blocks.back();
+            m_blocks.pop_back();
+            return block;
+        }
+    }
+    return ::operator new(size);
+}
+
+void DTXMessagePool::FreeBlock(void* block, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (size == m_blockSize && m_blocks.size() < kMaxPooledBlocks) {
+            m_blocks.push_back(block);
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
+} // namespace instruments
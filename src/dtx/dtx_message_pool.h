@@ -0,0 +1,71 @@
+#ifndef INSTRUMENTS_DTX_MESSAGE_POOL_H
+#define INSTRUMENTS_DTX_MESSAGE_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace instruments {
+
+class DTXMessage;
+
+// DTXMessagePool - per-connection recycler for received-message memory.
+//
+// DTXMessage blocks (object plus shared_ptr control block) and the payload /
+// auxiliary byte buffers are kept on bounded free lists and reused for the
+// next message, so a connection's steady-state receive path stays off the
+// global heap. Each pool has its own lock: streaming many devices on one
+// host contends per connection, not process-wide.
+//
+// Messages (and their allocator) hold a reference to the pool, so it stays
+// alive until the last message from the connection is released.
+class DTXMessagePool : public std::enable_shared_from_this<DTXMessagePool> {
+public:
+    static std::shared_ptr<DTXMessagePool> Create();
+    ~DTXMessagePool();
+
+    // New empty message whose memory comes from (and returns to) this pool
+    std::shared_ptr<DTXMessage> NewMessage();
+
+    // Replace buf with a recycled buffer (empty, capacity kept)
+    void TakeBuffer(std::vector<uint8_t>& buf);
+    // Hand a buffer's storage back; oversized buffers are freed instead
+    void ReturnBuffer(std::vector<uint8_t>&& buf);
+
+    void* AllocateBlock(size_t size);
+    void FreeBlock(void* block, size_t size);
+
+private:
+    DTXMessagePool() = default;
+
+    std::mutex m_mutex;
+    std::vector<std::vector<uint8_t>> m_buffers;
+    std::vector<void*> m_blocks;
+    size_t m_blockSize = 0;     // size of pooled blocks (set by the first allocation)
+};
+
+// Allocator for std::allocate_shared over a DTXMessagePool
+template <typename T>
+struct DTXPoolAllocator {
+    using value_type = T;
+
+    explicit DTXPoolAllocator(std::shared_ptr<DTXMessagePool> p) : pool(std::move(p)) {}
+    template <typename U>
+    DTXPoolAllocator(const DTXPoolAllocator<U>& other) : pool(other.pool) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(pool->AllocateBlock(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { pool->FreeBlock(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const DTXPoolAllocator<U>& other) const { return pool == other.pool; }
+    template <typename U>
+    bool operator!=(const DTXPoolAllocator<U>& other) const { return pool != other.pool; }
+
+    std::shared_ptr<DTXMessagePool> pool;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_DTX_MESSAGE_POOL_H
@@ -40,124 +40,169 @@ static uint64_t ReadLE64(const uint8_t* p) {
     return val;
 }
 
-std::vector<uint8_t> DTXPrimitiveDict::EncodeEntry(const NSObject& item) {
-    std::vector<uint8_t> entry;
-
-    // Write the "_empty_dictionary" marker (0x0A) before each entry to match pymobiledevice3/go-ios format
-    WriteLE32(entry, 0x0A);
-
+void DTXPrimitiveDict::EncodeEntry(const NSObject& item, std::vector<uint8_t>& out) {
     switch (item.GetType()) {
         case NSObject::Type::Null: {
-            WriteLE32(entry, PrimitiveDictType::Null);
+            // Write the "_empty_dictionary" marker (0x0A) before each entry to match pymobiledevice3/go-ios format
+            WriteLE32(out, 0x0A);
+            WriteLE32(out, PrimitiveDictType::Null);
             break;
         }
         case NSObject::Type::Int32: {
-            WriteLE32(entry, PrimitiveDictType::UInt32);
-            WriteLE32(entry, static_cast<uint32_t>(item.AsInt32()));
+            EncodeUInt32Entry(static_cast<uint32_t>(item.AsInt32()), out);
             break;
         }
         case NSObject::Type::UInt64: {
             // UInt64 encoded as int64 type (0x06) in primitive dict
-            WriteLE32(entry, PrimitiveDictType::Int64);
-            WriteLE64(entry, item.AsUInt64());
+            EncodeInt64Entry(item.AsUInt64(), out);
             break;
         }
         case NSObject::Type::Int64: {
-            WriteLE32(entry, PrimitiveDictType::Int64);
-            WriteLE64(entry, static_cast<uint64_t>(item.AsInt64()));
+            EncodeInt64Entry(static_cast<uint64_t>(item.AsInt64()), out);
             break;
         }
         default: {
             // Everything else gets NSKeyedArchiver-encoded as a byte array
-            std::vector<uint8_t> archived = NSKeyedArchiver::Archive(item);
-            WriteLE32(entry, PrimitiveDictType::ByteArray);
-            WriteLE32(entry, static_cast<uint32_t>(archived.size()));
-            entry.insert(entry.end(), archived.begin(), archived.end());
+            const size_t lengthPos = BeginArchivedEntry(out);
+            NSKeyedArchiver::AppendArchive(item, out);
+            EndArchivedEntry(lengthPos, out);
             break;
         }
     }
+}
+
+void DTXPrimitiveDict::EncodeUInt32Entry(uint32_t value, std::vector<uint8_t>& out) {
+    WriteLE32(out, 0x0A);
+    WriteLE32(out, PrimitiveDictType::UInt32);
+    WriteLE32(out, value);
+}
+
+void DTXPrimitiveDict::EncodeInt64Entry(uint64_t value, std::vector<uint8_t>& out) {
+    WriteLE32(out, 0x0A);
+    WriteLE32(out, PrimitiveDictType::Int64);
+    WriteLE64(out, value);
+}
+
+size_t DTXPrimitiveDict::BeginArchivedEntry(std::vector<uint8_t>& out) {
+    WriteLE32(out, 0x0A);
+    WriteLE32(out, PrimitiveDictType::ByteArray);
+    const size_t lengthPos = out.size();
+    WriteLE32(out, 0);
+    return lengthPos;
+}
 
-    return entry;
+void DTXPrimitiveDict::EndArchivedEntry(size_t lengthPos, std::vector<uint8_t>& out) {
+    const uint32_t archivedLen = static_cast<uint32_t>(out.size() - lengthPos - 4);
+    for (int i = 0; i < 4; i++) {
+        out[lengthPos + i] = static_cast<uint8_t>((archivedLen >> (i * 8)) & 0xFF);
+    }
 }
 
 std::vector<uint8_t> DTXPrimitiveDict::Encode(const std::vector<NSObject>& items) {
     // Encode entries only. The 16-byte auxiliary header is added at the message layer.
     std::vector<uint8_t> entries;
     for (const auto& item : items) {
-        auto entry = EncodeEntry(item);
-        entries.insert(entries.end(), entry.begin(), entry.end());
+        EncodeEntry(item, entries);
     }
     return entries;
 }
 
-std::vector<NSObject> DTXPrimitiveDict::DecodeEntries(const uint8_t* data, size_t length) {
-    std::vector<NSObject> result;
-    size_t offset = 0;
-
-    while (offset + 8 <= length) {
-        // Read the "_empty_dictionary" marker (4 bytes) that pymobiledevice3 uses
-        uint32_t marker = ReadLE32(data + offset);
-        uint32_t type = ReadLE32(data + offset + 4);
-        offset += 8;
-
-        INST_LOG_DEBUG(TAG, "Decode entry: marker=0x%x, type=0x%x", marker, type);
-
-        switch (type) {
-            case PrimitiveDictType::Null:
-                result.push_back(NSObject::Null());
-                break;
-
-            case PrimitiveDictType::UInt32: {
-                if (offset + 4 > length) {
-                    INST_LOG_WARN(TAG, "Truncated uint32 entry at offset %zu", offset);
-                    return result;
-                }
-                result.push_back(NSObject(static_cast<int32_t>(ReadLE32(data + offset))));
-                offset += 4;
-                break;
-            }
+void DTXAuxView::Iterator::Advance() {
+    m_offset = m_next;
+    if (m_offset + 8 > m_length) {
+        m_offset = m_length;
+        return;
+    }
 
-            case PrimitiveDictType::Int64: {
-                if (offset + 8 > length) {
-                    INST_LOG_WARN(TAG, "Truncated int64 entry at offset %zu", offset);
-                    return result;
-                }
-                // Type 6 is uint64 per pymobiledevice3 Int64ul
-                result.push_back(NSObject(static_cast<uint64_t>(ReadLE64(data + offset))));
-                offset += 8;
-                break;
-            }
+    // Each entry starts with the "_empty_dictionary" marker pymobiledevice3 uses
+    const uint32_t type = ReadLE32(m_data + m_offset + 4);
+    size_t pos = m_offset + 8;
+    m_entry = DTXAuxEntry{};
+    m_entry.type = type;
 
-            case PrimitiveDictType::String:
-            case PrimitiveDictType::ByteArray: {
-                if (offset + 4 > length) {
-                    INST_LOG_WARN(TAG, "Truncated length entry at offset %zu", offset);
-                    return result;
-                }
-                uint32_t entryLen = ReadLE32(data + offset);
-                offset += 4;
-                if (offset + entryLen > length) {
-                    INST_LOG_WARN(TAG, "Truncated data entry at offset %zu, len=%u",
-                                 offset, entryLen);
-                    return result;
-                }
-                if (entryLen > 0) {
-                    NSObject obj = NSKeyedUnarchiver::Unarchive(data + offset, entryLen);
-                    result.push_back(std::move(obj));
-                } else {
-                    result.push_back(NSObject::Null());
-                }
-                offset += entryLen;
-                break;
+    size_t valueLen = 0;
+    switch (type) {
+        case PrimitiveDictType::Null:
+            break;
+        case PrimitiveDictType::UInt32:
+            valueLen = 4;
+            break;
+        case PrimitiveDictType::Int64:
+            valueLen = 8;
+            break;
+        case PrimitiveDictType::String:
+        case PrimitiveDictType::ByteArray:
+            if (pos + 4 > m_length) {
+                INST_LOG_WARN(TAG, "Truncated length entry at offset %zu", pos);
+                m_offset = m_length;
+                return;
             }
+            valueLen = ReadLE32(m_data + pos);
+            pos += 4;
+            break;
+        default:
+            // Unknown layout: report the entry (decodes as null) and stop
+            INST_LOG_WARN(TAG, "Unknown primitive dict type: 0x%x", type);
+            m_next = m_length;
+            return;
+    }
+
+    if (valueLen > m_length - pos) {
+        INST_LOG_WARN(TAG, "Truncated entry at offset %zu, type=0x%x, len=%zu", pos, type, valueLen);
+        m_offset = m_length;
+        return;
+    }
+    m_entry.data = m_data + pos;
+    m_entry.length = valueLen;
+    m_next = pos + valueLen;
+}
 
-            default:
-                INST_LOG_WARN(TAG, "Unknown primitive dict type: 0x%x", type);
-                result.push_back(NSObject::Null());
-                return result;
+size_t DTXAuxView::size() const {
+    size_t count = 0;
+    for (auto it = begin(), e = end(); it != e; ++it) count++;
+    return count;
+}
+
+bool DTXAuxView::At(size_t index, DTXAuxEntry& out) const {
+    for (auto it = begin(), e = end(); it != e; ++it) {
+        if (index-- == 0) {
+            out = *it;
+            return true;
         }
     }
+    return false;
+}
+
+uint32_t DTXAuxEntry::AsUInt32() const {
+    return (IsUInt32() || IsInt64()) ? ReadLE32(data) : 0;
+}
+
+uint64_t DTXAuxEntry::AsUInt64() const {
+    if (IsInt64()) return ReadLE64(data);
+    return IsUInt32() ? ReadLE32(data) : 0;
+}
+
+NSObject DTXAuxEntry::Object() const {
+    switch (type) {
+        case PrimitiveDictType::UInt32:
+            return NSObject(static_cast<int32_t>(ReadLE32(data)));
+        case PrimitiveDictType::Int64:
+            // Type 6 is uint64 per pymobiledevice3 Int64ul
+            return NSObject(static_cast<uint64_t>(ReadLE64(data)));
+        case PrimitiveDictType::String:
+        case PrimitiveDictType::ByteArray:
+            if (length > 0) return NSKeyedUnarchiver::Unarchive(data, length);
+            return NSObject::Null();
+        default:
+            return NSObject::Null();
+    }
+}
 
+std::vector<NSObject> DTXPrimitiveDict::DecodeEntries(const uint8_t* data, size_t length) {
+    std::vector<NSObject> result;
+    for (const DTXAuxEntry& entry : DTXAuxView(data, length)) {
+        result.push_back(entry.Object());
+    }
     return result;
 }
 
@@ -1,6 +1,7 @@
 #ifndef INSTRUMENTS_DTX_PRIMITIVE_DICT_H
 #define INSTRUMENTS_DTX_PRIMITIVE_DICT_H
 
+#include "../../include/instruments/dtx_message.h"
 #include "../nskeyedarchiver/nsobject.h"
 #include <cstdint>
 #include <vector>
@@ -32,16 +33,27 @@ namespace PrimitiveDictType {
 class DTXPrimitiveDict {
 public:
     // Encode a list of NSObject values into auxiliary binary format
-    // (includes the 16-byte auxiliary header)
+    // (entries only; the 16-byte auxiliary header is added by DTXMessage)
     static std::vector<uint8_t> Encode(const std::vector<NSObject>& items);
 
-    // Decode auxiliary binary data into a list of NSObject values.
-    // Input should include the 16-byte auxiliary header.
+    // Decode auxiliary binary data into a list of NSObject values
+    // (entries only, as stored in DTXMessage). Use DTXAuxView to read
+    // entries without decoding all of them.
     static std::vector<NSObject> Decode(const uint8_t* data, size_t length);
     static std::vector<NSObject> Decode(const std::vector<uint8_t>& data);
 
-    // Encode a single NSObject into a primitive dictionary entry (without header)
-    static std::vector<uint8_t> EncodeEntry(const NSObject& item);
+    // Append one primitive dictionary entry to out; objects are archived
+    // straight into out
+    static void EncodeEntry(const NSObject& item, std::vector<uint8_t>& out);
+
+    // Typed entries for callers that do not hold an NSObject. An archived
+    // entry is written between Begin/EndArchivedEntry: Begin returns the
+    // position of the length field, End patches it once the archive has
+    // been appended to out.
+    static void EncodeUInt32Entry(uint32_t value, std::vector<uint8_t>& out);
+    static void EncodeInt64Entry(uint64_t value, std::vector<uint8_t>& out);
+    static size_t BeginArchivedEntry(std::vector<uint8_t>& out);
+    static void EndArchivedEntry(size_t lengthPos, std::vector<uint8_t>& out);
 
     // Decode entries only (no 16-byte header)
     static std::vector<NSObject> DecodeEntries(const uint8_t* data, size_t length);
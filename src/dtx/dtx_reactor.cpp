@@ -0,0 +1,271 @@
+#include "../../include/instruments/dtx_reactor.h"
+#include "../../include/instruments/dtx_connection.h"
+#include "../util/log.h"
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using socket_t = SOCKET;
+using pollfd_t = WSAPOLLFD;
+#define POLL_SOCKETS WSAPoll
+#define CLOSE_SOCKET closesocket
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+using socket_t = int;
+using pollfd_t = struct pollfd;
+#define POLL_SOCKETS ::poll
+#define CLOSE_SOCKET ::close
+#endif
+
+namespace instruments {
+
+static const char* TAG = "DTXReactor";
+
+// Create a non-blocking loopback UDP socket connected to itself. Sending a
+// byte to it wakes the worker's poll() when the connection set changes.
+static int CreateWakeSocket() {
+    socket_t s = socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef _WIN32
+    if (s == INVALID_SOCKET) return -1;
+#else
+    if (s < 0) return -1;
+#endif
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addrLen = sizeof(addr);
+    if (bind(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(s, reinterpret_cast<struct sockaddr*>(&addr), &addrLen) != 0 ||
+        connect(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        CLOSE_SOCKET(s);
+        return -1;
+    }
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    return static_cast<int>(s);
+}
+
+static void DrainWakeSocket(int fd) {
+    char buf[64];
+    while (recv(static_cast<socket_t>(fd), buf, sizeof(buf), 0) > 0) {}
+}
+
+std::shared_ptr<DTXReactor> DTXReactor::Create(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+    }
+
+    std::shared_ptr<DTXReactor> reactor(new DTXReactor());
+    reactor->m_running.store(true);
+    for (size_t i = 0; i < threadCount; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->wakeFd = CreateWakeSocket();
+        if (worker->wakeFd < 0) {
+            INST_LOG_ERROR(TAG, "Failed to create wake socket");
+            return nullptr;
+        }
+        reactor->m_workers.push_back(std::move(worker));
+    }
+    for (auto& worker : reactor->m_workers) {
+        Worker* w = worker.get();
+        w->thread = std::thread([r = reactor.get(), w]() { r->Run(*w); });
+    }
+
+    INST_LOG_INFO(TAG, "Started %zu I/O thread(s)", threadCount);
+    return reactor;
+}
+
+DTXReactor::~DTXReactor() {
+    m_running.store(false);
+    for (auto& worker : m_workers) {
+        Wake(*worker);
+    }
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+        if (worker->wakeFd >= 0) {
+            CLOSE_SOCKET(static_cast<socket_t>(worker->wakeFd));
+        }
+    }
+}
+
+size_t DTXReactor::ConnectionCount() const {
+    size_t total = 0;
+    for (auto& worker : m_workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        total += worker->connections.size();
+    }
+    return total;
+}
+
+bool DTXReactor::Register(DTXConnection* conn, int fd) {
+    if (!conn || fd < 0 || !m_running.load() || m_workers.empty()) return false;
+
+    // Least-loaded thread
+    Worker* target = nullptr;
+    size_t lowest = SIZE_MAX;
+    for (auto& worker : m_workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (worker->connections.size() < lowest) {
+            lowest = worker->connections.size();
+            target = worker.get();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(target->mutex);
+        target->connections[conn] = fd;
+        target->dirty = true;
+    }
+    Wake(*target);
+    INST_LOG_DEBUG(TAG, "Registered connection fd=%d", fd);
+    return true;
+}
+
+void DTXReactor::Unregister(DTXConnection* conn) {
+    for (auto& worker : m_workers) {
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        if (worker->connections.erase(conn) == 0) continue;
+        worker->paused.erase(conn);
+        worker->resumed.erase(std::remove(worker->resumed.begin(), worker->resumed.end(), conn),
+                              worker->resumed.end());
+        worker->dirty = true;
+
+        // Wait for an in-flight dispatch to finish, unless we are that dispatch
+        if (std::this_thread::get_id() != worker->thread.get_id()) {
+            worker->idleCv.wait(lock, [&]() { return worker->dispatching != conn; });
+        }
+        lock.unlock();
+        Wake(*worker);
+        return;
+    }
+}
+
+void DTXReactor::Pause(DTXConnection* conn) {
+    for (auto& worker : m_workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (worker->connections.count(conn) == 0) continue;
+        if (worker->paused.insert(conn).second) {
+            worker->dirty = true;
+            INST_LOG_DEBUG(TAG, "Paused connection fd=%d (queue budget)", worker->connections[conn]);
+        }
+        return;
+    }
+}
+
+void DTXReactor::Resume(DTXConnection* conn) {
+    for (auto& worker : m_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            if (worker->connections.count(conn) == 0) continue;
+            if (worker->paused.erase(conn) == 0) return;
+            worker->resumed.push_back(conn);
+            worker->dirty = true;
+        }
+        Wake(*worker);
+        return;
+    }
+}
+
+void DTXReactor::Dispatch(Worker& worker, DTXConnection* conn, bool resumed) {
+    // Skip connections unregistered since they were picked
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.connections.find(conn) == worker.connections.end()) return;
+        worker.dispatching = conn;
+    }
+
+    bool keep = resumed ? conn->OnResumed() : conn->OnReadable();
+
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.dispatching = nullptr;
+        if (!keep && worker.connections.erase(conn) > 0) {
+            worker.paused.erase(conn);
+            worker.dirty = true;
+        }
+    }
+    worker.idleCv.notify_all();
+}
+
+void DTXReactor::Wake(Worker& worker) {
+    if (worker.wakeFd < 0) return;
+    char b = 0;
+    send(static_cast<socket_t>(worker.wakeFd), &b, 1, 0);
+}
+
+void DTXReactor::Run(Worker& worker) {
+    std::vector<pollfd_t> fds;
+    std::vector<DTXConnection*> conns;  // parallel to fds[1..]
+    std::vector<DTXConnection*> resumed;
+
+    while (m_running.load()) {
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            resumed.swap(worker.resumed);
+        }
+        for (DTXConnection* conn : resumed) {
+            Dispatch(worker, conn, true);
+        }
+        resumed.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.dirty) {
+                fds.clear();
+                conns.clear();
+                pollfd_t wake = {};
+                wake.fd = static_cast<socket_t>(worker.wakeFd);
+                wake.events = POLLIN;
+                fds.push_back(wake);
+                for (auto& [conn, fd] : worker.connections) {
+                    pollfd_t p = {};
+                    // Negative descriptors are ignored by poll()
+                    p.fd = worker.paused.count(conn) ? static_cast<socket_t>(-1)
+                                                     : static_cast<socket_t>(fd);
+                    p.events = POLLIN;
+                    fds.push_back(p);
+                    conns.push_back(conn);
+                }
+                worker.dirty = false;
+            }
+        }
+
+        int ready = POLL_SOCKETS(fds.data(), static_cast<unsigned long>(fds.size()), -1);
+        if (ready < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif
+            INST_LOG_ERROR(TAG, "poll failed");
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        if (fds[0].revents != 0) {
+            DrainWakeSocket(worker.wakeFd);
+        }
+
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (fds[i].revents == 0) continue;
+            Dispatch(worker, conns[i - 1], false);
+        }
+    }
+
+    INST_LOG_DEBUG(TAG, "I/O thread ended");
+}
+
+} // namespace instruments
@@ -1,5 +1,9 @@
 #include "dtx_transport.h"
+#include "dtx_capture.h"
+#include "../connection/tunnel_stream.h"
 #include "../util/log.h"
+#include "../util/metrics.h"
+#include "../util/trace.h"
 #include <cstring>
 #include <cstdio>
 
@@ -12,14 +16,18 @@
 using socket_t = SOCKET;
 #define SOCKET_INVALID INVALID_SOCKET
 #define CLOSE_SOCKET closesocket
+#define SHUTDOWN_BOTH SD_BOTH
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <cerrno>
 using socket_t = int;
 #define SOCKET_INVALID (-1)
 #define CLOSE_SOCKET ::close
+#define SHUTDOWN_BOTH SHUT_RDWR
 #endif
 
 // Undefine Windows API macros that collide with method names
@@ -31,13 +39,88 @@ namespace instruments {
 
 static const char* TAG = "DTXTransport";
 
+// Upper bound for one readiness wait. Data wakes the wait immediately; the
+// bound only limits how long a reader takes to notice m_connected=false.
+static constexpr int kReadinessTimeoutMs = 1000;
+
+// Wait until a socket is readable.
+// Returns >0 when readable (or hung up), 0 on timeout, <0 on error.
+static int WaitReadable(socket_t sock, int timeoutMs) {
+#ifdef _WIN32
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(sock, &readfds);
+    struct timeval tv = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    return select(0, &readfds, nullptr, nullptr, &tv);
+#else
+    struct pollfd pfd = {sock, POLLIN, 0};
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeoutMs);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+#endif
+}
+
+// Write every segment with vectored sends (writev-style), resuming after
+// partial writes. Returns false on error or disconnect.
+static bool SendSegments(socket_t sock, const DTXWireSegments& wire) {
+    size_t first = 0;   // first segment not fully written
+    size_t offset = 0;  // bytes of segments[first] already written
+    while (first < wire.count) {
+        size_t sent = 0;
+#ifdef _WIN32
+        WSABUF bufs[DTXWireSegments::MaxSegments];
+        DWORD n = 0;
+        for (size_t i = first; i < wire.count; i++, n++) {
+            const size_t skip = (i == first) ? offset : 0;
+            bufs[n].buf = reinterpret_cast<CHAR*>(const_cast<uint8_t*>(wire.segments[i].data + skip));
+            bufs[n].len = static_cast<ULONG>(wire.segments[i].length - skip);
+        }
+        DWORD sentBytes = 0;
+        if (WSASend(sock, bufs, n, &sentBytes, 0, nullptr, nullptr) != 0 || sentBytes == 0) {
+            return false;
+        }
+        sent = sentBytes;
+#else
+        struct iovec iov[DTXWireSegments::MaxSegments];
+        size_t n = 0;
+        for (size_t i = first; i < wire.count; i++, n++) {
+            const size_t skip = (i == first) ? offset : 0;
+            iov[n].iov_base = const_cast<uint8_t*>(wire.segments[i].data + skip);
+            iov[n].iov_len = wire.segments[i].length - skip;
+        }
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t ret = ::sendmsg(sock, &msg, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+        sent = static_cast<size_t>(ret);
+#endif
+        while (sent > 0) {
+            const size_t rest = wire.segments[first].length - offset;
+            if (sent < rest) {
+                offset += sent;
+                break;
+            }
+            sent -= rest;
+            first++;
+            offset = 0;
+        }
+    }
+    return true;
+}
+
 DTXTransport::DTXTransport(idevice_connection_t connection, bool sslHandshakeOnly)
     : m_connection(connection)
     , m_ownsConnection(false)
     , m_connected(connection != nullptr)
+    , m_sslActive(!sslHandshakeOnly)  // caller may have enabled SSL already
 {
     if (sslHandshakeOnly && m_connection) {
         // Enable SSL for handshake, then disable
+        TraceSpan span("service", "SSL handshake");
         idevice_connection_enable_ssl(m_connection);
         idevice_connection_disable_ssl(m_connection);
         INST_LOG_DEBUG(TAG, "SSL handshake-only completed");
@@ -65,11 +148,15 @@ DTXTransport::DTXTransport(idevice_t device, lockdownd_service_descriptor_t serv
     m_connected = true;
 
     if (sslHandshakeOnly || service->ssl_enabled) {
-        idevice_connection_enable_ssl(m_connection);
+        {
+            TraceSpan span("service", "SSL handshake");
+            idevice_connection_enable_ssl(m_connection);
+        }
         if (sslHandshakeOnly) {
             idevice_connection_disable_ssl(m_connection);
             INST_LOG_INFO(TAG, "SSL mode: handshake-only (auth then plaintext)");
         } else {
+            m_sslActive = true;
             INST_LOG_INFO(TAG, "SSL mode: full encryption");
         }
     } else {
@@ -81,17 +168,28 @@ DTXTransport::DTXTransport(int socketFd)
     : m_socketFd(socketFd)
     , m_connected(socketFd >= 0)
 {
+    // Reads wait for readiness with poll()/select() instead of SO_RCVTIMEO
+    // wake-ups; Close() shuts the socket down to release a blocked reader.
     INST_LOG_DEBUG(TAG, "Created transport from raw socket fd=%d", socketFd);
-    if (m_socketFd >= 0) {
-#ifdef _WIN32
-        DWORD tmoMs = 500;
-        setsockopt(static_cast<socket_t>(m_socketFd), SOL_SOCKET, SO_RCVTIMEO,
-                   reinterpret_cast<const char*>(&tmoMs), sizeof(tmoMs));
-#else
-        struct timeval tmo = {0, 500000};
-        setsockopt(m_socketFd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
-#endif
-    }
+}
+
+DTXTransport::DTXTransport(std::shared_ptr<TunnelStream> stream)
+    : m_connected(stream && stream->IsOpen())
+    , m_stream(std::move(stream))
+{
+    INST_LOG_DEBUG(TAG, "Created transport on an in-process tunnel stream");
+}
+
+DTXTransport::DTXTransport(std::shared_ptr<DTXReplay> replay)
+    : m_connected(replay != nullptr)
+    , m_replay(std::move(replay))
+{
+    INST_LOG_DEBUG(TAG, "Created transport replaying a capture");
+}
+
+void DTXTransport::SetCapture(std::shared_ptr<DTXCaptureWriter> capture) {
+    std::scoped_lock<std::mutex, std::mutex> lock(m_recvMutex, m_sendMutex);
+    m_capture = std::move(capture);
 }
 
 std::unique_ptr<DTXTransport> DTXTransport::ConnectTCP(const std::string& address, uint16_t port) {
@@ -147,12 +245,23 @@ DTXTransport::~DTXTransport() {
 void DTXTransport::Close() {
     m_connected = false;
     // Socket mode: close without taking m_recvMutex to avoid deadlock when the
-    // receive thread is blocked in recv() while holding m_recvMutex.
+    // receive thread is blocked waiting for data while holding m_recvMutex.
+    // shutdown() wakes that wait immediately (close() alone does not).
     if (m_socketFd >= 0) {
+        ::shutdown(static_cast<socket_t>(m_socketFd), SHUTDOWN_BOTH);
         CLOSE_SOCKET(static_cast<socket_t>(m_socketFd));
         m_socketFd = -1;
         return;
     }
+    // Stream mode: Close() wakes a reader blocked in Read()
+    if (m_stream) {
+        m_stream->Close();
+        return;
+    }
+    if (m_replay) {
+        m_replay->Close();
+        return;
+    }
 
     // idevice/SSL mode: synchronize against in-flight ReadExact()/Receive()
     // to avoid use-after-free races inside idevice_connection_receive_timeout().
@@ -163,57 +272,89 @@ void DTXTransport::Close() {
     m_connection = nullptr;
 }
 
-bool DTXTransport::ReadExact(uint8_t* buffer, size_t length) {
+size_t DTXTransport::ReadAtLeast(uint8_t* buffer, size_t minLength, size_t maxLength) {
     // Socket mode (iOS 17+ external tunnel)
     if (m_socketFd >= 0) {
+        const socket_t sock = static_cast<socket_t>(m_socketFd);
         size_t totalRead = 0;
-        while (totalRead < length) {
-            if (!m_connected) return false;
+        while (totalRead < minLength) {
+            if (!m_connected) return 0;
+            int ready = WaitReadable(sock, kReadinessTimeoutMs);
+            if (ready == 0) continue;
+            if (ready < 0) {
+                if (!m_connected) return 0;
+                INST_LOG_DEBUG(TAG, "Socket wait failed, disconnecting");
+                m_connected = false;
+                return 0;
+            }
 #ifdef _WIN32
-            int recvLen = recv(static_cast<socket_t>(m_socketFd),
+            int recvLen = recv(sock,
                 reinterpret_cast<char*>(buffer + totalRead),
-                static_cast<int>(length - totalRead), 0);
+                static_cast<int>(maxLength - totalRead), 0);
 #else
-            ssize_t recvLen = recv(m_socketFd,
+            ssize_t recvLen = recv(sock,
                 buffer + totalRead,
-                length - totalRead, 0);
+                maxLength - totalRead, 0);
 #endif
             if (recvLen <= 0) {
-                if (!m_connected) return false;
+                if (!m_connected) return 0;
 #ifdef _WIN32
                 int werr = WSAGetLastError();
                 if (recvLen < 0 && (werr == WSAETIMEDOUT || werr == WSAEWOULDBLOCK)) {
                     continue;
                 }
 #else
-                if (recvLen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT)) {
+                if (recvLen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
                     continue;
                 }
 #endif
                 INST_LOG_DEBUG(TAG, "Socket recv returned %d, disconnecting", static_cast<int>(recvLen));
                 m_connected = false;
-                return false;
+                return 0;
             }
             totalRead += static_cast<size_t>(recvLen);
         }
-        return true;
+        return totalRead;
+    }
+
+    // Stream mode (iOS 17+ userspace tunnel) and replay
+    if (m_stream || m_replay) {
+        size_t totalRead = 0;
+        while (totalRead < minLength) {
+            if (!m_connected) return 0;
+            int n = m_stream
+                ? m_stream->Read(buffer + totalRead, maxLength - totalRead, kReadinessTimeoutMs)
+                : m_replay->Read(buffer + totalRead, maxLength - totalRead, kReadinessTimeoutMs);
+            if (n == 0) continue;
+            if (n < 0) {
+                INST_LOG_DEBUG(TAG, "Stream closed, disconnecting");
+                m_connected = false;
+                return 0;
+            }
+            totalRead += static_cast<size_t>(n);
+        }
+        return totalRead;
     }
 
-    if (!m_connection || !m_connected) return false;
+    if (!m_connection || !m_connected) return 0;
 
     size_t totalRead = 0;
     m_lastReadTimeout = false;
     m_lastReadError = 0;
     m_lastReadBytes = 0;
-    while (totalRead < length) {
+    while (totalRead < minLength) {
         if (!m_connected) {
-            return false;
+            return 0;
         }
+        // Plain connections return whatever is available, so ask for the whole
+        // free space. SSL reads wait for the full length, so only ask for what
+        // the current frame still needs.
+        const size_t request = m_sslActive ? (minLength - totalRead) : (maxLength - totalRead);
         uint32_t bytesRead = 0;
         idevice_error_t err = idevice_connection_receive_timeout(
             m_connection,
             reinterpret_cast<char*>(buffer + totalRead),
-            static_cast<uint32_t>(length - totalRead),
+            static_cast<uint32_t>(request),
             &bytesRead,
             1000 // 1 second timeout to allow fast shutdown
         );
@@ -231,43 +372,84 @@ bool DTXTransport::ReadExact(uint8_t* buffer, size_t length) {
             m_lastReadError = static_cast<int>(err);
             m_lastReadBytes = bytesRead;
             if (err == IDEVICE_E_TIMEOUT) {
-                INST_LOG_WARN(TAG, "Read timeout after %zu/%zu bytes", totalRead, length);
+                INST_LOG_WARN(TAG, "Read timeout after %zu/%zu bytes", totalRead, minLength);
                 m_lastReadTimeout = true;
                 continue;
             }
             if (err == IDEVICE_E_SSL_ERROR && bytesRead == 0) {
                 // Treat SSL read with no data as a non-fatal timeout-like condition
                 INST_LOG_DEBUG(TAG, "SSL read returned no data (err=%d) after %zu/%zu bytes",
-                               err, totalRead, length);
+                               err, totalRead, minLength);
                 m_lastReadTimeout = true;
                 continue;
             }
             if (err == IDEVICE_E_SUCCESS && bytesRead == 0) {
-                // Treat as no data available (some platforms report 0 bytes without error)
-                INST_LOG_DEBUG(TAG, "Read returned 0 bytes with success after %zu/%zu bytes", totalRead, length);
+                // Treat as no data available (some platforms report 0 bytes without error).
+                // Block on the underlying fd rather than spinning; SSL connections
+                // may hold decrypted bytes the fd cannot see, so only plain ones wait.
+                INST_LOG_DEBUG(TAG, "Read returned 0 bytes with success after %zu/%zu bytes", totalRead, minLength);
                 m_lastReadTimeout = true;
+                int fd = -1;
+                if (!m_sslActive &&
+                    idevice_connection_get_fd(m_connection, &fd) == IDEVICE_E_SUCCESS && fd >= 0) {
+                    WaitReadable(static_cast<socket_t>(fd), kReadinessTimeoutMs);
+                }
                 continue;
             }
             INST_LOG_DEBUG(TAG, "Read failed: error=%d, read=%u", err, bytesRead);
             m_lastReadTimeout = false;
             m_connected = false;
-            return false;
+            return 0;
         }
     }
 
     m_lastReadTimeout = false;
     m_lastReadError = 0;
     m_lastReadBytes = 0;
+    return totalRead;
+}
+
+bool DTXTransport::FillBuffer(size_t count) {
+    size_t buffered = m_rxEnd - m_rxStart;
+    if (buffered >= count) return true;
+
+    // Not enough room behind the unread bytes: move them to the front,
+    // growing the buffer only when a single frame does not fit
+    if (m_rxStart + count > m_rxBuffer.size()) {
+        if (buffered > 0 && m_rxStart > 0) {
+            std::memmove(m_rxBuffer.data(), m_rxBuffer.data() + m_rxStart, buffered);
+        }
+        m_rxStart = 0;
+        m_rxEnd = buffered;
+        if (count > m_rxBuffer.size()) {
+            m_rxBuffer.resize(count > ReceiveChunkSize ? count : ReceiveChunkSize);
+        }
+    }
+
+    size_t n = ReadAtLeast(m_rxBuffer.data() + m_rxEnd, count - buffered,
+                           m_rxBuffer.size() - m_rxEnd);
+    if (n == 0) return false;
+    m_rxEnd += n;
     return true;
 }
 
-std::vector<uint8_t> DTXTransport::Receive() {
-    std::lock_guard<std::mutex> lock(m_recvMutex);
+void DTXTransport::ShrinkBufferIfIdle() {
+    if (m_rxBuffer.size() > MaxRetainedBufferSize &&
+        m_rxEnd - m_rxStart <= ReceiveChunkSize) {
+        size_t buffered = m_rxEnd - m_rxStart;
+        std::memmove(m_rxBuffer.data(), m_rxBuffer.data() + m_rxStart, buffered);
+        m_rxStart = 0;
+        m_rxEnd = buffered;
+        m_rxBuffer.resize(ReceiveChunkSize);
+        m_rxBuffer.shrink_to_fit();
+    }
+}
 
-    // Read the 32-byte header, resyncing if needed
-    uint8_t headerBuf[DTXProtocol::HeaderLength];
-    if (!ReadExact(headerBuf, DTXProtocol::HeaderLength)) {
-        return {};
+bool DTXTransport::TakeBufferedFrame(DTXFrame& outFrame, size_t& outNeeded, bool& outFailed) {
+    outFailed = false;
+    if (m_rxEnd - m_rxStart < DTXProtocol::HeaderLength) {
+        outNeeded = DTXProtocol::HeaderLength;
+        return false;
     }
 
     auto isMagic = [](const uint8_t* p) {
@@ -276,63 +458,185 @@ std::vector<uint8_t> DTXTransport::Receive() {
                (p[0] == 0x1F && p[1] == 0x3D && p[2] == 0x5B && p[3] == 0x79);
     };
 
-    if (!isMagic(headerBuf)) {
-        // Attempt to resync by sliding window until magic is found
-        const size_t maxScan = 1024 * 1024; // 1MB
-        size_t scanned = 0;
-        while (scanned < maxScan) {
-            // shift left by 1 byte
-            std::memmove(headerBuf, headerBuf + 1, DTXProtocol::HeaderLength - 1);
-            if (!ReadExact(headerBuf + DTXProtocol::HeaderLength - 1, 1)) {
-                return {};
-            }
-            scanned++;
-            if (isMagic(headerBuf)) {
-                INST_LOG_WARN(TAG, "Resynced DTX stream after %zu bytes", scanned);
-                break;
-            }
+    // Resync by sliding one byte at a time until magic is found
+    const size_t maxScan = 1024 * 1024; // 1MB
+    while (!isMagic(m_rxBuffer.data() + m_rxStart)) {
+        m_rxStart++;
+        if (++m_resyncScanned >= maxScan) {
+            INST_LOG_ERROR(TAG, "Failed to resync DTX stream (scanned %zu bytes)", m_resyncScanned);
+            m_resyncScanned = 0;
+            outFailed = true;
+            return false;
         }
-        if (scanned >= maxScan && !isMagic(headerBuf)) {
-            INST_LOG_ERROR(TAG, "Failed to resync DTX stream (scanned %zu bytes)", scanned);
-            return {};
+        if (m_rxEnd - m_rxStart < DTXProtocol::HeaderLength) {
+            outNeeded = DTXProtocol::HeaderLength;
+            return false;
         }
     }
+    if (m_resyncScanned > 0) {
+        INST_LOG_WARN(TAG, "Resynced DTX stream after %zu bytes", m_resyncScanned);
+        m_resyncScanned = 0;
+    }
 
     DTXMessageHeader header;
-    if (!DTXMessage::ParseHeader(headerBuf, DTXProtocol::HeaderLength, header)) {
+    if (!DTXMessage::ParseHeader(m_rxBuffer.data() + m_rxStart, DTXProtocol::HeaderLength, header)) {
         INST_LOG_ERROR(TAG, "Failed to parse DTX header");
-        return {};
+        outFailed = true;
+        return false;
     }
 
     // If this is the first fragment, it is header-only (no payload data)
-    if (header.fragmentCount > 1 && header.fragmentIndex == 0) {
-        std::vector<uint8_t> result(DTXProtocol::HeaderLength);
-        std::memcpy(result.data(), headerBuf, DTXProtocol::HeaderLength);
-        return result;
-    }
-
-    // Allocate buffer for header + message data
-    size_t totalSize = DTXProtocol::HeaderLength + header.messageLength;
-    std::vector<uint8_t> result(totalSize);
-    std::memcpy(result.data(), headerBuf, DTXProtocol::HeaderLength);
-
-    // Read the remaining message data
-    if (header.messageLength > 0) {
-        if (!ReadExact(result.data() + DTXProtocol::HeaderLength, header.messageLength)) {
-            INST_LOG_ERROR(TAG, "Failed to read message body (%u bytes)", header.messageLength);
-            return {};
+    size_t frameSize = DTXProtocol::HeaderLength;
+    if (!(header.fragmentCount > 1 && header.fragmentIndex == 0)) {
+        if (m_maxFrameBytes > 0 && header.messageLength > m_maxFrameBytes) {
+            INST_LOG_ERROR(TAG, "Frame id=%u announces %u bytes, over the %zu byte limit",
+                          header.identifier, header.messageLength, m_maxFrameBytes);
+            m_connected = false;
+            outFailed = true;
+            return false;
         }
+        frameSize += header.messageLength;
+    }
+    if (m_rxEnd - m_rxStart < frameSize) {
+        outNeeded = frameSize;
+        return false;
+    }
+
+    outFrame.header = header;
+    outFrame.data = m_rxBuffer.data() + m_rxStart;
+    outFrame.size = frameSize;
+    CountReceived(frameSize);
+    if (m_capture) {
+        m_capture->Record(DTXCaptureDirection::Received, outFrame.data, outFrame.size);
+    }
+
+    m_rxStart += frameSize;
+    if (m_rxStart == m_rxEnd) {
+        m_rxStart = m_rxEnd = 0;
     }
 
     INST_LOG_TRACE(TAG, "Received message: id=%u, ch=%u, len=%u, frag=%u/%u",
                   header.identifier, header.channelCode, header.messageLength,
                   header.fragmentIndex, header.fragmentCount);
+    return true;
+}
+
+bool DTXTransport::ReceiveFrame(DTXFrame& outFrame) {
+    std::lock_guard<std::mutex> lock(m_recvMutex);
+    ShrinkBufferIfIdle();
+
+    for (;;) {
+        size_t needed = 0;
+        bool failed = false;
+        if (TakeBufferedFrame(outFrame, needed, failed)) {
+            return true;
+        }
+        if (failed) {
+            return false;
+        }
+        if (!FillBuffer(needed)) {
+            if (needed > DTXProtocol::HeaderLength) {
+                INST_LOG_ERROR(TAG, "Failed to read message body (%zu bytes)",
+                              needed - DTXProtocol::HeaderLength);
+            }
+            return false;
+        }
+    }
+}
 
-    return result;
+bool DTXTransport::NextBufferedFrame(DTXFrame& outFrame) {
+    std::lock_guard<std::mutex> lock(m_recvMutex);
+    size_t needed = 0;
+    bool failed = false;
+    return TakeBufferedFrame(outFrame, needed, failed);
+}
+
+int DTXTransport::ReadAvailable() {
+    std::lock_guard<std::mutex> lock(m_recvMutex);
+    if (!m_connected) return -1;
+    ShrinkBufferIfIdle();
+
+    // Make room behind the unread bytes, doubling the buffer while a single
+    // frame does not fit
+    if (m_rxEnd == m_rxBuffer.size()) {
+        size_t buffered = m_rxEnd - m_rxStart;
+        if (m_rxStart > 0) {
+            std::memmove(m_rxBuffer.data(), m_rxBuffer.data() + m_rxStart, buffered);
+            m_rxStart = 0;
+            m_rxEnd = buffered;
+        }
+        if (m_rxEnd == m_rxBuffer.size()) {
+            m_rxBuffer.resize(m_rxBuffer.empty() ? ReceiveChunkSize : m_rxBuffer.size() * 2);
+        }
+    }
+    uint8_t* dst = m_rxBuffer.data() + m_rxEnd;
+    const size_t room = m_rxBuffer.size() - m_rxEnd;
+
+    const int fd = m_socketFd;
+    if (fd >= 0) {
+#ifdef _WIN32
+        int n = recv(static_cast<socket_t>(fd), reinterpret_cast<char*>(dst),
+                     static_cast<int>(room), 0);
+        if (n < 0 && WSAGetLastError() == WSAEWOULDBLOCK) return 0;
+#else
+        ssize_t n = recv(fd, dst, room, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+#endif
+        if (n <= 0) {
+            INST_LOG_DEBUG(TAG, "Socket recv returned %d, disconnecting", static_cast<int>(n));
+            m_connected = false;
+            return -1;
+        }
+        m_rxEnd += static_cast<size_t>(n);
+        return static_cast<int>(n);
+    }
+
+    if (m_stream || m_replay) {
+        int n = m_stream ? m_stream->Read(dst, room, 0) : m_replay->Read(dst, room, 0);
+        if (n < 0) {
+            m_connected = false;
+            return -1;
+        }
+        m_rxEnd += static_cast<size_t>(n);
+        return n;
+    }
+
+    if (!m_connection) return -1;
+    uint32_t bytesRead = 0;
+    idevice_error_t err = idevice_connection_receive_timeout(
+        m_connection, reinterpret_cast<char*>(dst), static_cast<uint32_t>(room), &bytesRead, 1);
+    m_rxEnd += bytesRead;
+    if (bytesRead > 0) return static_cast<int>(bytesRead);
+    if (err == IDEVICE_E_TIMEOUT || err == IDEVICE_E_SUCCESS) return 0;
+    INST_LOG_DEBUG(TAG, "Read failed: error=%d", err);
+    m_lastReadError = static_cast<int>(err);
+    m_connected = false;
+    return -1;
+}
+
+int DTXTransport::PollableFd() const {
+    if (m_socketFd >= 0) return m_socketFd;
+    if (m_connection && !m_sslActive) {
+        int fd = -1;
+        if (idevice_connection_get_fd(m_connection, &fd) == IDEVICE_E_SUCCESS) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+std::vector<uint8_t> DTXTransport::Receive() {
+    DTXFrame frame;
+    if (!ReceiveFrame(frame)) {
+        return {};
+    }
+    return std::vector<uint8_t>(frame.data, frame.data + frame.size);
 }
 
 Error DTXTransport::Send(const uint8_t* data, size_t length) {
     std::lock_guard<std::mutex> lock(m_sendMutex);
+    CountSent(length);
+    if (m_capture) m_capture->Record(DTXCaptureDirection::Sent, data, length);
 
     // Socket mode (iOS 17+ external tunnel)
     if (m_socketFd >= 0) {
@@ -358,6 +662,23 @@ Error DTXTransport::Send(const uint8_t* data, size_t length) {
         return Error::Success;
     }
 
+    if (m_stream) {
+        if (!m_connected) return Error::ConnectionFailed;
+        Error err = m_stream->Write(data, length);
+        if (err != Error::Success) m_connected = false;
+        return err;
+    }
+
+    if (m_replay) {
+        if (!m_connected) return Error::ConnectionFailed;
+        m_replay->Write(length);
+        return Error::Success;
+    }
+
+    return SendConnectionLocked(data, length);
+}
+
+Error DTXTransport::SendConnectionLocked(const uint8_t* data, size_t length) {
     if (!m_connection || !m_connected) {
         return Error::ConnectionFailed;
     }
@@ -384,19 +705,86 @@ Error DTXTransport::Send(const uint8_t* data, size_t length) {
     return Error::Success;
 }
 
+void DTXTransport::CountReceived(size_t length) {
+    MetricsCounters& counters = metrics::Counters();
+    metrics::Add(m_bytesIn, length);
+    metrics::Add(m_framesIn);
+    metrics::Add(counters.receive.bytes, length);
+    metrics::Add(counters.receive.frames);
+}
+
+void DTXTransport::CountSent(size_t length) {
+    MetricsCounters& counters = metrics::Counters();
+    metrics::Add(m_bytesOut, length);
+    metrics::Add(m_framesOut);
+    metrics::Add(counters.send.bytes, length);
+    metrics::Add(counters.send.frames);
+}
+
+TransportCounters DTXTransport::Counters() const {
+    TransportCounters counters;
+    counters.bytesIn = m_bytesIn.load(std::memory_order_relaxed);
+    counters.bytesOut = m_bytesOut.load(std::memory_order_relaxed);
+    counters.framesIn = m_framesIn.load(std::memory_order_relaxed);
+    counters.framesOut = m_framesOut.load(std::memory_order_relaxed);
+    return counters;
+}
+
 Error DTXTransport::Send(const std::vector<uint8_t>& data) {
     return Send(data.data(), data.size());
 }
 
 Error DTXTransport::SendMessage(const std::shared_ptr<DTXMessage>& message) {
-    auto fragments = message->Encode();
-    for (const auto& fragment : fragments) {
-        Error err = Send(fragment);
-        if (err != Error::Success) {
-            return err;
+    DTXWireSegments wire;
+    message->EncodeSegments(wire);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (!m_connected) return Error::ConnectionFailed;
+    CountSent(wire.TotalLength());
+    if (m_capture) m_capture->Record(DTXCaptureDirection::Sent, wire);
+
+    if (m_replay) {
+        m_replay->Write(wire.TotalLength());
+        return Error::Success;
+    }
+
+    // Plain sockets (raw TCP, or an idevice connection without SSL): one
+    // vectored send straight from the message buffers
+    const int fd = PollableFd();
+    if (fd >= 0) {
+        if (!SendSegments(static_cast<socket_t>(fd), wire)) {
+            INST_LOG_ERROR(TAG, "Socket send failed");
+            m_connected = false;
+            return Error::ConnectionFailed;
         }
+        return Error::Success;
     }
-    return Error::Success;
+
+    // Stream mode: the stream copies each segment into its send queue
+    if (m_stream) {
+        for (size_t i = 0; i < wire.count; i++) {
+            if (m_stream->Write(wire.segments[i].data, wire.segments[i].length) != Error::Success) {
+                INST_LOG_ERROR(TAG, "Tunnel stream send failed");
+                m_connected = false;
+                return Error::ConnectionFailed;
+            }
+        }
+        return Error::Success;
+    }
+
+    // SSL encrypts through libimobiledevice: coalesce into the reusable send
+    // buffer and hand it over in one call
+    m_txBuffer.clear();
+    m_txBuffer.reserve(wire.TotalLength());
+    for (size_t i = 0; i < wire.count; i++) {
+        const auto& seg = wire.segments[i];
+        m_txBuffer.insert(m_txBuffer.end(), seg.data, seg.data + seg.length);
+    }
+    Error err = SendConnectionLocked(m_txBuffer.data(), m_txBuffer.size());
+    if (m_txBuffer.capacity() > MaxRetainedBufferSize) {
+        std::vector<uint8_t>().swap(m_txBuffer);
+    }
+    return err;
 }
 
 } // namespace instruments
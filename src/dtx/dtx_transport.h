@@ -2,9 +2,11 @@
 #define INSTRUMENTS_DTX_TRANSPORT_H
 
 #include "../../include/instruments/dtx_message.h"
+#include "../../include/instruments/metrics.h"
 #include "../../include/instruments/types.h"
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -19,14 +21,35 @@
 
 namespace instruments {
 
+class TunnelStream;
+class DTXCaptureWriter;
+class DTXReplay;
+
+// View of one received DTX frame. `data` points into the transport's receive
+// buffer and stays valid until the next ReceiveFrame()/Receive() call.
+struct DTXFrame {
+    DTXMessageHeader header;
+    const uint8_t* data = nullptr;  // start of the 32-byte header
+    size_t size = 0;                // header + body bytes
+
+    const uint8_t* Body() const { return data + DTXProtocol::HeaderLength; }
+    size_t BodyLength() const { return size - DTXProtocol::HeaderLength; }
+};
+
 // DTXTransport - low-level transport for sending and receiving raw DTX
-// message frames over an idevice_connection_t or a raw TCP socket.
+// message frames over an idevice_connection_t, a raw TCP socket, an
+// in-process QUICTunnel stream or a replayed capture.
 //
 // Handles:
-// - Reading complete DTX messages (header + payload)
-// - Writing DTX messages to the connection
+// - Reading complete DTX messages (header + payload) through a reusable
+//   receive buffer filled in large chunks, so header and body usually
+//   arrive in a single read and no per-frame allocation is needed
+// - Writing DTX messages to the connection as scatter-gather segments
 // - SSL handshake-only mode for certain services (idevice mode only)
 // - Raw TCP socket mode for iOS 17+ external tunnel connections (no SSL)
+// - Stream mode for iOS 17+ userspace tunnel connections (no socket pair)
+// - Replay mode: a recorded connection (DTXReplay) in place of a device
+// - Recording every frame in both directions to a capture (SetCapture())
 class DTXTransport {
 public:
     // Create transport from an existing idevice connection.
@@ -45,6 +68,14 @@ public:
     // On Windows, pass (int)socket where socket is a SOCKET handle.
     explicit DTXTransport(int socketFd);
 
+    // Create transport on an in-process tunnel stream
+    // (QUICTunnel::CreateTunnelStream()). Closes the stream on destruction.
+    explicit DTXTransport(std::shared_ptr<TunnelStream> stream);
+
+    // Create transport playing back a capture (see DTXReplay). Sent frames
+    // are counted by the replay and dropped.
+    explicit DTXTransport(std::shared_ptr<DTXReplay> replay);
+
     // Connect via TCP to address:port and create a transport.
     // For iOS 17+ external tunnel connections (no SSL).
     // address: IPv4 or IPv6 address string
@@ -57,6 +88,24 @@ public:
     DTXTransport(const DTXTransport&) = delete;
     DTXTransport& operator=(const DTXTransport&) = delete;
 
+    // Read one complete DTX frame (blocking) without copying it.
+    // Returns false on error or disconnect. The frame view is invalidated by
+    // the next receive call.
+    bool ReceiveFrame(DTXFrame& outFrame);
+
+    // Non-blocking receive path used by DTXReactor: after the descriptor
+    // reported readiness, read whatever is available into the receive buffer.
+    // Returns bytes read (0 = nothing yet), or -1 when the stream has closed.
+    int ReadAvailable();
+
+    // Take the next complete frame already in the receive buffer, if any.
+    // The view is invalidated by the next read.
+    bool NextBufferedFrame(DTXFrame& outFrame);
+
+    // Descriptor that can be polled for readability, or -1 if this transport
+    // cannot be driven by readiness (full SSL buffers data the fd cannot see)
+    int PollableFd() const;
+
     // Read one complete DTX message (blocking).
     // Returns the 32-byte header + all data after it.
     // Returns empty vector on error or disconnect.
@@ -66,9 +115,21 @@ public:
     Error Send(const uint8_t* data, size_t length);
     Error Send(const std::vector<uint8_t>& data);
 
-    // Send a DTX message (handles fragmentation)
+    // Send a DTX message. Headers, auxiliary and payload go out in one
+    // vectored write (one coalesced send over SSL), without copying.
     Error SendMessage(const std::shared_ptr<DTXMessage>& message);
 
+    // Record every frame received and sent from now on. Set before the
+    // first frame is exchanged (nullptr stops recording).
+    void SetCapture(std::shared_ptr<DTXCaptureWriter> capture);
+
+    // Refuse frames announcing more than bytes after the header: the stream
+    // is treated as broken instead of buffering them (0 = unlimited)
+    void SetMaxFrameBytes(size_t bytes) { m_maxFrameBytes = bytes; }
+
+    // Bytes and frames through this transport (also added to Metrics)
+    TransportCounters Counters() const;
+
     // Check if transport is still connected
     bool IsConnected() const { return m_connected; }
     bool WasLastReadTimeout() const { return m_lastReadTimeout; }
@@ -79,8 +140,32 @@ public:
     void Close();
 
 private:
-    // Read exactly n bytes from the connection
-    bool ReadExact(uint8_t* buffer, size_t length);
+    // Read at least minLength and at most maxLength bytes from the connection.
+    // Returns the number of bytes read, or 0 on error/disconnect.
+    size_t ReadAtLeast(uint8_t* buffer, size_t minLength, size_t maxLength);
+
+    // Make sure at least `count` unread bytes are in the receive buffer
+    bool FillBuffer(size_t count);
+
+    // Take one complete frame from the receive buffer without reading.
+    // On false, outNeeded is the number of buffered bytes required to make
+    // progress, or outFailed is set when the stream cannot be parsed.
+    bool TakeBufferedFrame(DTXFrame& outFrame, size_t& outNeeded, bool& outFailed);
+
+    // Send over the idevice connection (m_sendMutex held)
+    Error SendConnectionLocked(const uint8_t* data, size_t length);
+
+    // Count one frame in this transport's and the process-wide counters
+    void CountReceived(size_t length);
+    void CountSent(size_t length);
+
+    // Release an oversized receive buffer once a large frame is consumed
+    void ShrinkBufferIfIdle();
+
+    // Initial receive buffer size and the size above which it is shrunk
+    // back once a large frame has been consumed
+    static constexpr size_t ReceiveChunkSize = 64 * 1024;
+    static constexpr size_t MaxRetainedBufferSize = 4 * 1024 * 1024;
 
     idevice_connection_t m_connection = nullptr;
     bool m_ownsConnection = false;
@@ -88,11 +173,36 @@ private:
     bool m_lastReadTimeout = false;
     int m_lastReadError = 0;
     uint32_t m_lastReadBytes = 0;
+    // Full SSL reads block until the requested length arrives, so SSL
+    // connections never read past the current frame
+    bool m_sslActive = false;
     std::mutex m_sendMutex;
+    std::vector<uint8_t> m_txBuffer;    // SSL send coalescing (m_sendMutex)
     std::mutex m_recvMutex;
 
     // Raw TCP socket mode (iOS 17+ external tunnel, value -1 = not in use)
     int m_socketFd = -1;
+
+    // Stream mode (iOS 17+ userspace tunnel, nullptr = not in use)
+    std::shared_ptr<TunnelStream> m_stream;
+
+    // Replay mode (recorded connection, nullptr = not in use)
+    std::shared_ptr<DTXReplay> m_replay;
+
+    // Recording (nullptr = off)
+    std::shared_ptr<DTXCaptureWriter> m_capture;
+
+    std::atomic<uint64_t> m_bytesIn{0};
+    std::atomic<uint64_t> m_bytesOut{0};
+    std::atomic<uint64_t> m_framesIn{0};
+    std::atomic<uint64_t> m_framesOut{0};
+
+    // Receive buffer: unread bytes are [m_rxStart, m_rxEnd)
+    std::vector<uint8_t> m_rxBuffer;
+    size_t m_rxStart = 0;
+    size_t m_rxEnd = 0;
+    size_t m_resyncScanned = 0;
+    size_t m_maxFrameBytes = 0;         // 0 = unlimited
 };
 
 } // namespace instruments
@@ -11,6 +11,8 @@ Instruments::Instruments(std::shared_ptr<DeviceConnection> connection)
 Instruments::~Instruments() {
     // Stop all running services
     if (m_fps) m_fps->Stop();
+    if (m_screenshot) m_screenshot->Close();
+    if (m_logStream) m_logStream->Stop();
     if (m_performance) m_performance->Stop();
     if (m_xctest) m_xctest->Stop();
     if (m_wda) m_wda->Stop();
@@ -63,6 +65,20 @@ FPSService& Instruments::FPS() {
     return *m_fps;
 }
 
+ScreenshotService& Instruments::Screenshot() {
+    if (!m_screenshot) {
+        m_screenshot = std::make_unique<ScreenshotService>(m_connection);
+    }
+    return *m_screenshot;
+}
+
+LogStreamService& Instruments::LogStream() {
+    if (!m_logStream) {
+        m_logStream = std::make_unique<LogStreamService>(m_connection);
+    }
+    return *m_logStream;
+}
+
 XCTestService& Instruments::XCTest() {
     if (!m_xctest) {
         m_xctest = std::make_unique<XCTestService>(m_connection);
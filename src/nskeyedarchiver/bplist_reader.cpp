@@ -0,0 +1,216 @@
+#include "bplist_reader.h"
+#include <cstring>
+
+namespace instruments {
+
+static constexpr size_t kTrailerSize = 32;
+
+bool BPlistReader::Open(const uint8_t* data, size_t length) {
+    m_data = nullptr;
+    if (!data || length < 8 + kTrailerSize || std::memcmp(data, "bplist00", 8) != 0) {
+        return false;
+    }
+
+    const size_t end = length - kTrailerSize;
+    const uint8_t* trailer = data + end;
+    const size_t offsetSize = trailer[6];
+    const size_t refSize = trailer[7];
+    const uint64_t numObjects = ReadBE(trailer + 8, 8);
+    const uint64_t topObject = ReadBE(trailer + 16, 8);
+    const uint64_t tableOffset = ReadBE(trailer + 24, 8);
+
+    if (offsetSize < 1 || offsetSize > 8 || refSize < 1 || refSize > 8) return false;
+    if (topObject >= numObjects || tableOffset < 8 || tableOffset > end ||
+        numObjects > (end - tableOffset) / offsetSize) {
+        return false;
+    }
+
+    m_data = data;
+    m_end = end;
+    m_offsetSize = offsetSize;
+    m_refSize = refSize;
+    m_numObjects = numObjects;
+    m_topObject = topObject;
+    m_tableOffset = tableOffset;
+    return true;
+}
+
+bool BPlistReader::Get(uint64_t ref, Object& out) const {
+    out = Object{};
+    if (!m_data || ref >= m_numObjects) return false;
+
+    const size_t off = static_cast<size_t>(
+        ReadBE(m_data + m_tableOffset + ref * m_offsetSize, m_offsetSize));
+    if (off < 8 || off >= m_end) return false;
+
+    const uint8_t marker = m_data[off];
+    const uint8_t type = marker >> 4;
+    const uint8_t info = marker & 0x0F;
+    size_t body = off + 1;
+    const size_t avail = m_end - body;
+
+    // Variable-length objects store counts >= 15 as a following int object
+    auto readCount = [&](uint64_t& count) {
+        count = info;
+        if (info != 0x0F) return true;
+        if (body >= m_end || (m_data[body] >> 4) != 0x1) return false;
+        const size_t n = size_t{1} << (m_data[body] & 0x0F);
+        if (n > 8 || body + 1 + n > m_end) return false;
+        count = ReadBE(m_data + body + 1, n);
+        body += 1 + n;
+        return true;
+    };
+
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    switch (type) {
+        case 0x0:
+            if (info == 0x0) { out.kind = Kind::Null; }
+            else if (info == 0x8 || info == 0x9) { out.kind = Kind::Bool; out.boolValue = (info == 0x9); }
+            else return false;
+            out.body = m_data + body;
+            return true;
+        case 0x1:
+            if (info > 4) return false;
+            out.kind = Kind::Int;
+            count = bytes = uint64_t{1} << info;
+            break;
+        case 0x2:
+            if (info != 2 && info != 3) return false;
+            out.kind = Kind::Real;
+            count = bytes = uint64_t{1} << info;
+            break;
+        case 0x3:
+            if (info != 3) return false;
+            out.kind = Kind::Date;
+            count = bytes = 8;
+            break;
+        case 0x4:
+            if (!readCount(count)) return false;
+            out.kind = Kind::Data;
+            bytes = count;
+            break;
+        case 0x5:
+            if (!readCount(count)) return false;
+            out.kind = Kind::AsciiString;
+            bytes = count;
+            break;
+        case 0x6:
+            if (!readCount(count)) return false;
+            out.kind = Kind::Utf16String;
+            if (count > (m_end - body) / 2) return false;
+            bytes = count * 2;
+            break;
+        case 0x8:
+            out.kind = Kind::UID;
+            count = bytes = static_cast<uint64_t>(info) + 1;
+            break;
+        case 0xA:
+        case 0xC:
+        case 0xD:
+            if (!readCount(count)) return false;
+            out.kind = (type == 0xA) ? Kind::Array : (type == 0xC) ? Kind::Set : Kind::Dict;
+            {
+                const uint64_t refs = (type == 0xD) ? 2 : 1;
+                if (count > (m_end - body) / (refs * m_refSize)) return false;
+                bytes = count * refs * m_refSize;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    if (bytes > avail || body + bytes > m_end) return false;
+    out.count = count;
+    out.body = m_data + body;
+    return true;
+}
+
+int64_t BPlistReader::IntValue(const Object& obj) const {
+    // 1/2/4-byte ints are unsigned, 8-byte is signed, 16-byte carries an
+    // unsigned value in its low 8 bytes
+    if (obj.count == 16) return static_cast<int64_t>(ReadBE(obj.body + 8, 8));
+    return static_cast<int64_t>(ReadBE(obj.body, static_cast<size_t>(obj.count)));
+}
+
+uint64_t BPlistReader::UIntValue(const Object& obj) const {
+    if (obj.count == 16) return ReadBE(obj.body + 8, 8);
+    return ReadBE(obj.body, static_cast<size_t>(obj.count));
+}
+
+double BPlistReader::RealValue(const Object& obj) const {
+    if (obj.count == 4) {
+        uint32_t bits = static_cast<uint32_t>(ReadBE(obj.body, 4));
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return static_cast<double>(f);
+    }
+    uint64_t bits = ReadBE(obj.body, 8);
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+bool BPlistReader::StringValue(const Object& obj, std::string& out) const {
+    if (obj.kind == Kind::AsciiString) {
+        out.assign(reinterpret_cast<const char*>(obj.body), static_cast<size_t>(obj.count));
+        return true;
+    }
+    if (obj.kind != Kind::Utf16String) return false;
+
+    // UTF-16BE -> UTF-8
+    out.clear();
+    out.reserve(static_cast<size_t>(obj.count));
+    for (uint64_t i = 0; i < obj.count; i++) {
+        uint32_t cp = static_cast<uint32_t>(ReadBE(obj.body + i * 2, 2));
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < obj.count) {
+            uint32_t lo = static_cast<uint32_t>(ReadBE(obj.body + (i + 1) * 2, 2));
+            if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                i++;
+            }
+        }
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    return true;
+}
+
+bool BPlistReader::StringEquals(const Object& obj, std::string_view key) const {
+    if (obj.kind == Kind::AsciiString) {
+        return obj.count == key.size() &&
+               std::memcmp(obj.body, key.data(), key.size()) == 0;
+    }
+    if (obj.kind == Kind::Utf16String) {
+        std::string s;
+        return StringValue(obj, s) && s == key;
+    }
+    return false;
+}
+
+bool BPlistReader::DictLookup(const Object& dict, std::string_view key, uint64_t& outRef) const {
+    if (dict.kind != Kind::Dict) return false;
+    for (uint64_t i = 0; i < dict.count; i++) {
+        Object k;
+        if (Get(RefAt(dict, i), k) && StringEquals(k, key)) {
+            outRef = RefAt(dict, dict.count + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace instruments
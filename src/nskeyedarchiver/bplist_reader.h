@@ -0,0 +1,105 @@
+#ifndef INSTRUMENTS_BPLIST_READER_H
+#define INSTRUMENTS_BPLIST_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace instruments {
+
+// BPlistReader - in-place reader for "bplist00" binary property lists.
+// Objects are addressed by their index in the offset table ("ref") and read
+// straight out of the caller's buffer; no node tree is built. The buffer
+// must outlive the reader and every Object/string_view taken from it.
+//
+// Usage:
+//   BPlistReader r;
+//   if (!r.Open(data, len)) return;
+//   BPlistReader::Object top;
+//   if (r.Get(r.TopRef(), top) && top.kind == BPlistReader::Kind::Dict) {
+//       uint64_t ref;
+//       if (r.DictLookup(top, "$objects", ref)) ...
+//   }
+class BPlistReader {
+public:
+    enum class Kind {
+        Invalid,
+        Null,
+        Bool,
+        Int,
+        Real,
+        Date,
+        Data,
+        AsciiString,
+        Utf16String,
+        UID,
+        Array,
+        Set,
+        Dict,
+    };
+
+    // A decoded object marker. `count` is the element count for containers,
+    // the byte length for data/ASCII, the UTF-16 unit count for Utf16String
+    // and the byte width for Int/Real/UID.
+    struct Object {
+        Kind kind = Kind::Invalid;
+        uint64_t count = 0;
+        const uint8_t* body = nullptr;
+        bool boolValue = false;
+    };
+
+    // Validate the header and trailer. Returns false if data is not bplist00.
+    bool Open(const uint8_t* data, size_t length);
+
+    uint64_t TopRef() const { return m_topObject; }
+    uint64_t ObjectCount() const { return m_numObjects; }
+
+    // Read the object marker for ref. Bounds-checks the whole object body.
+    bool Get(uint64_t ref, Object& out) const;
+
+    // Child refs: element i of an Array/Set; for a Dict, keys are [0, count)
+    // and the matching values are [count, 2 * count).
+    uint64_t RefAt(const Object& container, uint64_t i) const {
+        return ReadBE(container.body + i * m_refSize, m_refSize);
+    }
+
+    // Scalar accessors (callers check kind first)
+    int64_t IntValue(const Object& obj) const;
+    // True for 16-byte integers, which carry values above INT64_MAX
+    bool IsUnsignedInt(const Object& obj) const { return obj.kind == Kind::Int && obj.count == 16; }
+    uint64_t UIntValue(const Object& obj) const;
+    double RealValue(const Object& obj) const;
+    uint64_t UIDValue(const Object& obj) const { return ReadBE(obj.body, static_cast<size_t>(obj.count)); }
+    std::string_view AsciiValue(const Object& obj) const {
+        return std::string_view(reinterpret_cast<const char*>(obj.body), static_cast<size_t>(obj.count));
+    }
+
+    // ASCII or UTF-16 string as UTF-8; false for non-strings
+    bool StringValue(const Object& obj, std::string& out) const;
+
+    // Compare a string object with key without allocating (ASCII and UTF-16)
+    bool StringEquals(const Object& obj, std::string_view key) const;
+
+    // Find key in a Dict; outRef is the value's ref
+    bool DictLookup(const Object& dict, std::string_view key, uint64_t& outRef) const;
+
+    static uint64_t ReadBE(const uint8_t* p, size_t n) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; i++) v = (v << 8) | p[i];
+        return v;
+    }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_end = 0;           // start of the trailer
+    size_t m_offsetSize = 0;
+    size_t m_refSize = 0;
+    uint64_t m_numObjects = 0;
+    uint64_t m_topObject = 0;
+    uint64_t m_tableOffset = 0;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_BPLIST_READER_H
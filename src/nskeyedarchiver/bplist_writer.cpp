@@ -0,0 +1,207 @@
+#include "bplist_writer.h"
+#include <cstring>
+
+namespace instruments {
+
+static constexpr size_t kTrailerSize = 32;
+
+static void AppendBE(std::vector<uint8_t>& out, uint64_t value, size_t n) {
+    for (size_t i = n; i-- > 0;) {
+        out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+// Smallest of 1/2/4/8 bytes that holds value
+static size_t WidthFor(uint64_t value) {
+    if (value <= 0xFF) return 1;
+    if (value <= 0xFFFF) return 2;
+    if (value <= 0xFFFFFFFFu) return 4;
+    return 8;
+}
+
+static size_t Log2Width(size_t width) {
+    return width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3;
+}
+
+// Non-negative integer object (marker 0x1n, 2^n bytes big-endian)
+static void AppendIntObject(std::vector<uint8_t>& out, uint64_t value) {
+    const size_t width = WidthFor(value);
+    out.push_back(static_cast<uint8_t>(0x10 | Log2Width(width)));
+    AppendBE(out, value, width);
+}
+
+// Marker with an element count; counts >= 15 follow as an int object
+static void AppendMarker(std::vector<uint8_t>& out, uint8_t type, uint64_t count) {
+    if (count < 15) {
+        out.push_back(static_cast<uint8_t>((type << 4) | count));
+        return;
+    }
+    out.push_back(static_cast<uint8_t>((type << 4) | 0x0F));
+    AppendIntObject(out, count);
+}
+
+void BPlistWriter::Reset() {
+    m_objects.clear();
+    m_scalars.clear();
+    m_refs.clear();
+}
+
+uint64_t BPlistWriter::AddScalar(size_t start) {
+    m_objects.push_back({0, start, m_scalars.size() - start});
+    return m_objects.size() - 1;
+}
+
+uint64_t BPlistWriter::AddBool(bool value) {
+    const size_t start = m_scalars.size();
+    m_scalars.push_back(value ? 0x09 : 0x08);
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddInt(int64_t value) {
+    if (value >= 0) return AddUInt(static_cast<uint64_t>(value));
+    // Negative integers are always 8 bytes
+    const size_t start = m_scalars.size();
+    m_scalars.push_back(0x13);
+    AppendBE(m_scalars, static_cast<uint64_t>(value), 8);
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddUInt(uint64_t value) {
+    const size_t start = m_scalars.size();
+    if (value > static_cast<uint64_t>(INT64_MAX)) {
+        // 8-byte integers are signed; larger values take 16 bytes
+        m_scalars.push_back(0x14);
+        AppendBE(m_scalars, 0, 8);
+        AppendBE(m_scalars, value, 8);
+    } else {
+        AppendIntObject(m_scalars, value);
+    }
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddReal(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const size_t start = m_scalars.size();
+    m_scalars.push_back(0x23);
+    AppendBE(m_scalars, bits, 8);
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddString(std::string_view utf8) {
+    const size_t start = m_scalars.size();
+    bool ascii = true;
+    for (unsigned char c : utf8) {
+        if (c >= 0x80) {
+            ascii = false;
+            break;
+        }
+    }
+    if (ascii) {
+        AppendMarker(m_scalars, 0x5, utf8.size());
+        m_scalars.insert(m_scalars.end(), utf8.begin(), utf8.end());
+        return AddScalar(start);
+    }
+
+    // UTF-8 -> UTF-16BE; malformed sequences become U+FFFD
+    std::vector<uint16_t> units;
+    units.reserve(utf8.size());
+    const auto* p = reinterpret_cast<const unsigned char*>(utf8.data());
+    const auto* const end = p + utf8.size();
+    while (p < end) {
+        uint32_t cp = *p++;
+        int extra = 0;
+        if (cp >= 0xF0 && cp < 0xF8) { cp &= 0x07; extra = 3; }
+        else if (cp >= 0xE0) { cp &= 0x0F; extra = 2; }
+        else if (cp >= 0xC0) { cp &= 0x1F; extra = 1; }
+        else if (cp >= 0x80) { cp = 0xFFFD; }
+        for (; extra > 0; extra--) {
+            if (p >= end || (*p & 0xC0) != 0x80) {
+                cp = 0xFFFD;
+                break;
+            }
+            cp = (cp << 6) | (*p++ & 0x3F);
+        }
+        if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) cp = 0xFFFD;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            units.push_back(static_cast<uint16_t>(0xD800 | (cp >> 10)));
+            units.push_back(static_cast<uint16_t>(0xDC00 | (cp & 0x3FF)));
+        } else {
+            units.push_back(static_cast<uint16_t>(cp));
+        }
+    }
+    AppendMarker(m_scalars, 0x6, units.size());
+    for (uint16_t u : units) AppendBE(m_scalars, u, 2);
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddData(const uint8_t* data, size_t length) {
+    const size_t start = m_scalars.size();
+    AppendMarker(m_scalars, 0x4, length);
+    if (length > 0) m_scalars.insert(m_scalars.end(), data, data + length);
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddUID(uint64_t uid) {
+    const size_t width = WidthFor(uid);
+    const size_t start = m_scalars.size();
+    m_scalars.push_back(static_cast<uint8_t>(0x80 | (width - 1)));
+    AppendBE(m_scalars, uid, width);
+    return AddScalar(start);
+}
+
+uint64_t BPlistWriter::AddArray(const uint64_t* refs, size_t count) {
+    const size_t start = m_refs.size();
+    m_refs.insert(m_refs.end(), refs, refs + count);
+    m_objects.push_back({0xA, start, count});
+    return m_objects.size() - 1;
+}
+
+uint64_t BPlistWriter::AddDict(const uint64_t* keyRefs, const uint64_t* valueRefs, size_t count) {
+    const size_t start = m_refs.size();
+    m_refs.insert(m_refs.end(), keyRefs, keyRefs + count);
+    m_refs.insert(m_refs.end(), valueRefs, valueRefs + count);
+    m_objects.push_back({0xD, start, count});
+    return m_objects.size() - 1;
+}
+
+void BPlistWriter::Finish(uint64_t topRef, std::vector<uint8_t>& out) {
+    const size_t refSize = WidthFor(m_objects.empty() ? 0 : m_objects.size() - 1);
+
+    // Offsets are relative to the start of this plist, not of out
+    const size_t base = out.size();
+    out.reserve(base + 8 + m_scalars.size() + m_refs.size() * refSize +
+                m_objects.size() * 12 + kTrailerSize);
+    out.insert(out.end(), {'b', 'p', 'l', 'i', 's', 't', '0', '0'});
+
+    m_offsets.clear();
+    for (const Entry& e : m_objects) {
+        m_offsets.push_back(out.size() - base);
+        if (e.type == 0) {
+            out.insert(out.end(), m_scalars.begin() + e.start,
+                       m_scalars.begin() + e.start + e.length);
+            continue;
+        }
+        AppendMarker(out, e.type, e.length);
+        const size_t refCount = e.type == 0xD ? e.length * 2 : e.length;
+        for (size_t i = 0; i < refCount; i++) {
+            AppendBE(out, m_refs[e.start + i], refSize);
+        }
+    }
+
+    const uint64_t tableOffset = out.size() - base;
+    const size_t offsetSize = WidthFor(m_offsets.empty() ? 0 : m_offsets.back());
+    for (uint64_t off : m_offsets) AppendBE(out, off, offsetSize);
+
+    // Trailer: 5 unused bytes, sort version, offset/ref widths, object
+    // count, top object, offset table position
+    out.insert(out.end(), 6, 0);
+    out.push_back(static_cast<uint8_t>(offsetSize));
+    out.push_back(static_cast<uint8_t>(refSize));
+    AppendBE(out, m_objects.size(), 8);
+    AppendBE(out, topRef, 8);
+    AppendBE(out, tableOffset, 8);
+}
+
+} // namespace instruments
@@ -0,0 +1,69 @@
+#ifndef INSTRUMENTS_BPLIST_WRITER_H
+#define INSTRUMENTS_BPLIST_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace instruments {
+
+// BPlistWriter - builds a "bplist00" binary property list without a node
+// tree (the counterpart of BPlistReader). Objects are added bottom-up; each
+// Add* returns the object's ref (its index in the offset table), which
+// containers added later refer to. Scalars are encoded as they are added;
+// container refs are written by Finish(), once the ref width is known.
+//
+// Usage:
+//   BPlistWriter w;
+//   uint64_t key = w.AddString("root"), value = w.AddInt(1);
+//   uint64_t top = w.AddDict(&key, &value, 1);
+//   std::vector<uint8_t> out;
+//   w.Finish(top, out);
+class BPlistWriter {
+public:
+    // Drop all objects; keeps the capacity for the next plist
+    void Reset();
+
+    uint64_t AddBool(bool value);
+    uint64_t AddInt(int64_t value);
+    // Values above INT64_MAX are written as 16-byte integers
+    uint64_t AddUInt(uint64_t value);
+    uint64_t AddReal(double value);
+    // UTF-8 in; ASCII is stored as is, anything else as UTF-16BE
+    uint64_t AddString(std::string_view utf8);
+    uint64_t AddData(const uint8_t* data, size_t length);
+    uint64_t AddUID(uint64_t uid);
+    uint64_t AddArray(const uint64_t* refs, size_t count);
+    uint64_t AddDict(const uint64_t* keyRefs, const uint64_t* valueRefs, size_t count);
+
+    size_t ObjectCount() const { return m_objects.size(); }
+
+    // Memory kept for reuse across Reset()
+    size_t RetainedBytes() const {
+        return m_objects.capacity() * sizeof(Entry) + m_scalars.capacity() +
+               m_refs.capacity() * sizeof(uint64_t) + m_offsets.capacity() * sizeof(uint64_t);
+    }
+
+    // Append the serialized plist whose root is topRef to out
+    void Finish(uint64_t topRef, std::vector<uint8_t>& out);
+
+private:
+    struct Entry {
+        uint8_t type;       // high marker nibble; 0xA / 0xD are containers
+        size_t start;       // into m_scalars, or m_refs for containers
+        size_t length;      // encoded bytes, or element count for containers
+    };
+
+    // Register the scalar encoded at m_scalars[start, end)
+    uint64_t AddScalar(size_t start);
+
+    std::vector<Entry> m_objects;
+    std::vector<uint8_t> m_scalars;   // encoded scalar objects, back to back
+    std::vector<uint64_t> m_refs;     // container children (dicts: keys, then values)
+    std::vector<uint64_t> m_offsets;  // Finish() scratch
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_BPLIST_WRITER_H
@@ -1,292 +1,307 @@
 #include "nskeyedarchiver.h"
-#include <plist/plist.h>
-#include <cassert>
+#include "bplist_writer.h"
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
 
 namespace instruments {
 
-// Helper class to build the $objects array and track UIDs
-class ArchiverContext {
+namespace {
+
+// Archives larger than this do not keep their scratch memory for reuse
+constexpr size_t kMaxRetainedArchiveBytes = 4u * 1024u * 1024u;
+
+// Writes one keyed archive straight to bplist00: each $objects entry is
+// added to the writer as it is encoded (children before their container),
+// and $objects lists them by writer ref. Strings and classes are archived
+// once per archive and shared by UID; the keys of the archive's own
+// dictionaries ("NS.keys", "$class", ...) and UID objects are written once.
+// One instance per thread is reused, so repeated archiving keeps its
+// buffers and hash tables.
+class NativeArchiver {
 public:
-    ArchiverContext() {
-        m_objects = plist_new_array();
-        // Index 0 is always "$null"
-        plist_array_append_item(m_objects, plist_new_string("$null"));
+    void Archive(const NSObject& root, const std::string& className,
+                 const std::vector<std::string>& hierarchy, std::vector<uint8_t>& out) {
+        Reset();
+        Finish(Encode(root, className, hierarchy), out);
+    }
+
+    // Archive of one scalar: add writes it to the writer and returns its ref
+    template <typename AddFn>
+    void ArchiveScalar(AddFn add, std::vector<uint8_t>& out) {
+        Reset();
+        Finish(AddObject(add(m_writer)), out);
     }
 
-    ~ArchiverContext() {
-        if (m_objects) {
-            plist_free(m_objects);
-            m_objects = nullptr;
+private:
+    enum Key { NSKeys, NSObjects, Class, ClassName, Classes, KeyCount };
+
+    // Write the archive envelope around the root object and serialize
+    void Finish(uint64_t rootUid, std::vector<uint8_t>& out) {
+        const uint64_t rootKey = m_writer.AddString("root");
+        const uint64_t rootVal = UIDRef(rootUid);
+        const uint64_t top = m_writer.AddDict(&rootKey, &rootVal, 1);
+        const uint64_t objects = m_writer.AddArray(m_objects.data(), m_objects.size());
+
+        const uint64_t keys[] = {
+            m_writer.AddString("$archiver"), m_writer.AddString("$version"),
+            m_writer.AddString("$top"), m_writer.AddString("$objects"),
+        };
+        const uint64_t values[] = {
+            m_writer.AddString("NSKeyedArchiver"), m_writer.AddUInt(100000), top, objects,
+        };
+        m_writer.Finish(m_writer.AddDict(keys, values, 4), out);
+
+        if (m_writer.RetainedBytes() > kMaxRetainedArchiveBytes) {
+            m_writer = BPlistWriter();
+            m_objects = {};
+            m_uidRefs = {};
+            m_strings = {};
         }
     }
 
-    // Add an object to the $objects array, return its UID
-    uint64_t AddObject(plist_t obj) {
-        uint64_t uid = plist_array_get_size(m_objects);
-        plist_array_append_item(m_objects, obj);
-        return uid;
+    void Reset() {
+        m_writer.Reset();
+        m_objects.clear();
+        m_uidRefs.clear();
+        m_strings.clear();
+        m_classes.clear();
+        for (auto& ref : m_keyRefs) ref = kNone;
+        m_objects.push_back(m_writer.AddString("$null"));
     }
 
-    // Encode an NSObject, returning its UID in the $objects array
-    uint64_t Encode(const NSObject& obj) {
+    uint64_t AddObject(uint64_t ref) {
+        m_objects.push_back(ref);
+        return m_objects.size() - 1;
+    }
+
+    // Writer ref of a UID object (one per distinct UID)
+    uint64_t UIDRef(uint64_t uid) {
+        if (uid >= m_uidRefs.size()) m_uidRefs.resize(uid + 1, kNone);
+        if (m_uidRefs[uid] == kNone) m_uidRefs[uid] = m_writer.AddUID(uid);
+        return m_uidRefs[uid];
+    }
+
+    uint64_t KeyRef(Key key) {
+        static constexpr const char* kNames[KeyCount] = {
+            "NS.keys", "NS.objects", "$class", "$classname", "$classes",
+        };
+        if (m_keyRefs[key] == kNone) m_keyRefs[key] = m_writer.AddString(kNames[key]);
+        return m_keyRefs[key];
+    }
+
+    // The string views point into the archived NSObject, which outlives
+    // the archive call
+    uint64_t EncodeString(std::string_view value) {
+        auto [it, inserted] = m_strings.try_emplace(value, 0);
+        if (inserted) it->second = AddObject(m_writer.AddString(value));
+        return it->second;
+    }
+
+    uint64_t Encode(const NSObject& obj, const std::string& classOverride = {},
+                    const std::vector<std::string>& hierarchyOverride = {}) {
         switch (obj.GetType()) {
             case NSObject::Type::Null:
                 return 0; // "$null" is always at index 0
-
             case NSObject::Type::Bool:
-                return AddObject(plist_new_bool(obj.AsBool()));
-
+                return AddObject(m_writer.AddBool(obj.AsBool()));
             case NSObject::Type::Int32:
             case NSObject::Type::Int64:
-                return AddObject(plist_new_int(obj.AsInt64()));
-
+                return AddObject(m_writer.AddInt(obj.AsInt64()));
             case NSObject::Type::UInt64:
-                return AddObject(plist_new_uint(obj.AsUInt64()));
-
+                return AddObject(m_writer.AddUInt(obj.AsUInt64()));
             case NSObject::Type::Float32:
-                return AddObject(plist_new_real(obj.AsFloat()));
-
+                return AddObject(m_writer.AddReal(obj.AsFloat()));
             case NSObject::Type::Float64:
-                return AddObject(plist_new_real(obj.AsDouble()));
-
+                return AddObject(m_writer.AddReal(obj.AsDouble()));
             case NSObject::Type::String:
-                return AddObject(plist_new_string(obj.AsString().c_str()));
-
-            case NSObject::Type::Data:
-                return AddObject(plist_new_data(
-                    reinterpret_cast<const char*>(obj.AsData().data()),
-                    obj.AsData().size()));
-
+                return EncodeString(obj.AsString());
+            case NSObject::Type::Data: {
+                const auto& data = obj.AsData();
+                return AddObject(m_writer.AddData(data.data(), data.size()));
+            }
             case NSObject::Type::Array:
-                return EncodeArray(obj);
-
+                return EncodeCollection(obj, classOverride, hierarchyOverride, "NSArray");
             case NSObject::Type::Set:
-                return EncodeSet(obj);
-
+                return EncodeCollection(obj, classOverride, hierarchyOverride, "NSSet");
             case NSObject::Type::Dictionary:
-                return EncodeDict(obj);
+                return EncodeDict(obj, classOverride, hierarchyOverride);
         }
         return 0;
     }
 
-    // Encode with explicit class info
-    uint64_t EncodeWithClass(const NSObject& obj,
-                             const std::string& className,
-                             const std::vector<std::string>& hierarchy) {
-        NSObject copy = obj;
-        copy.SetClassName(className);
-        copy.SetClassHierarchy(hierarchy);
-        return Encode(copy);
-    }
-
-    plist_t GetObjects() { return m_objects; }
+    // $class entry for the object's class, or the override, or the default
+    uint64_t EncodeClass(const NSObject& obj, const std::string& classOverride,
+                         const std::vector<std::string>& hierarchyOverride,
+                         const char* defaultClass) {
+        const std::string& name = classOverride.empty() ? obj.ClassName() : classOverride;
+        const std::vector<std::string>& hierarchy =
+            classOverride.empty() ? obj.ClassHierarchy() : hierarchyOverride;
 
-private:
-    plist_t m_objects;
-
-    // Create a $class entry and return its UID
-    uint64_t AddClass(const std::string& className,
-                      const std::vector<std::string>& hierarchy) {
-        plist_t classDict = plist_new_dict();
-
-        // $classname
-        plist_dict_set_item(classDict, "$classname",
-                           plist_new_string(className.c_str()));
-
-        // $classes array
-        plist_t classes = plist_new_array();
+        std::string key = name.empty() ? defaultClass : name;
         for (const auto& cls : hierarchy) {
-            plist_array_append_item(classes, plist_new_string(cls.c_str()));
+            key.push_back('\0');
+            key += cls;
         }
-        plist_dict_set_item(classDict, "$classes", classes);
+        auto it = m_classes.find(key);
+        if (it != m_classes.end()) return it->second;
 
-        return AddObject(classDict);
+        std::vector<uint64_t>& classes = m_scratchRefs;
+        classes.clear();
+        if (hierarchy.empty()) {
+            classes.push_back(m_writer.AddString(defaultClass));
+            classes.push_back(m_writer.AddString("NSObject"));
+        } else {
+            for (const auto& cls : hierarchy) classes.push_back(m_writer.AddString(cls));
+        }
+        const uint64_t keys[] = {KeyRef(ClassName), KeyRef(Classes)};
+        const uint64_t values[] = {
+            m_writer.AddString(name.empty() ? std::string_view(defaultClass) : std::string_view(name)),
+            m_writer.AddArray(classes.data(), classes.size()),
+        };
+        const uint64_t uid = AddObject(m_writer.AddDict(keys, values, 2));
+        m_classes.emplace(std::move(key), uid);
+        return uid;
     }
 
-    uint64_t EncodeArray(const NSObject& obj) {
+    uint64_t EncodeCollection(const NSObject& obj, const std::string& classOverride,
+                              const std::vector<std::string>& hierarchyOverride,
+                              const char* defaultClass) {
         const auto& items = obj.AsArray();
+        std::vector<uint64_t> refs;
+        refs.reserve(items.size());
+        for (const auto& item : items) refs.push_back(Encode(item));
+        for (auto& ref : refs) ref = UIDRef(ref);
+
+        const uint64_t classUid = EncodeClass(obj, classOverride, hierarchyOverride, defaultClass);
+        const uint64_t keys[] = {KeyRef(NSObjects), KeyRef(Class)};
+        const uint64_t values[] = {m_writer.AddArray(refs.data(), refs.size()), UIDRef(classUid)};
+        return AddObject(m_writer.AddDict(keys, values, 2));
+    }
 
-        // Encode all items first to get their UIDs
-        std::vector<uint64_t> itemUids;
-        for (const auto& item : items) {
-            itemUids.push_back(Encode(item));
-        }
-
-        // Create the array container dict
-        plist_t arrayDict = plist_new_dict();
-
-        // NS.objects - array of UIDs
-        plist_t nsObjects = plist_new_array();
-        for (uint64_t uid : itemUids) {
-            plist_array_append_item(nsObjects, plist_new_uid(uid));
-        }
-        plist_dict_set_item(arrayDict, "NS.objects", nsObjects);
-
-        // Determine class
-        std::string className = obj.ClassName().empty() ? "NSArray" : obj.ClassName();
-        std::vector<std::string> hierarchy = obj.ClassHierarchy();
-        if (hierarchy.empty()) {
-            hierarchy = {"NSArray", "NSObject"};
+    uint64_t EncodeDict(const NSObject& obj, const std::string& classOverride,
+                        const std::vector<std::string>& hierarchyOverride) {
+        const auto& dict = obj.AsDict();
+        std::vector<uint64_t> refs;   // key UIDs, then value UIDs
+        refs.resize(dict.size() * 2);
+        size_t i = 0;
+        for (const auto& [key, val] : dict) {
+            refs[i] = EncodeString(key);
+            refs[dict.size() + i] = Encode(val);
+            i++;
         }
-
-        // Add class reference
-        uint64_t classUid = AddClass(className, hierarchy);
-        plist_dict_set_item(arrayDict, "$class", plist_new_uid(classUid));
-
-        return AddObject(arrayDict);
+        for (auto& ref : refs) ref = UIDRef(ref);
+
+        const uint64_t classUid = EncodeClass(obj, classOverride, hierarchyOverride, "NSDictionary");
+        const uint64_t keys[] = {KeyRef(NSKeys), KeyRef(NSObjects), KeyRef(Class)};
+        const uint64_t values[] = {
+            m_writer.AddArray(refs.data(), dict.size()),
+            m_writer.AddArray(refs.data() + dict.size(), dict.size()),
+            UIDRef(classUid),
+        };
+        return AddObject(m_writer.AddDict(keys, values, 3));
     }
 
-    uint64_t EncodeSet(const NSObject& obj) {
-        const auto& items = obj.AsArray();
+    static constexpr uint64_t kNone = ~uint64_t{0};
 
-        std::vector<uint64_t> itemUids;
-        for (const auto& item : items) {
-            itemUids.push_back(Encode(item));
-        }
+    BPlistWriter m_writer;
+    std::vector<uint64_t> m_objects;     // UID -> writer ref
+    std::vector<uint64_t> m_uidRefs;     // UID -> writer ref of its UID object
+    std::unordered_map<std::string_view, uint64_t> m_strings;   // value -> UID
+    std::unordered_map<std::string, uint64_t> m_classes;        // name + hierarchy -> UID
+    uint64_t m_keyRefs[KeyCount] = {};
+    std::vector<uint64_t> m_scratchRefs;
+};
 
-        plist_t setDict = plist_new_dict();
+NativeArchiver& ThreadArchiver() {
+    static thread_local NativeArchiver archiver;
+    return archiver;
+}
 
-        plist_t nsObjects = plist_new_array();
-        for (uint64_t uid : itemUids) {
-            plist_array_append_item(nsObjects, plist_new_uid(uid));
-        }
-        plist_dict_set_item(setDict, "NS.objects", nsObjects);
+} // namespace
 
-        std::string className = obj.ClassName().empty() ? "NSSet" : obj.ClassName();
-        std::vector<std::string> hierarchy = obj.ClassHierarchy();
-        if (hierarchy.empty()) {
-            hierarchy = {"NSSet", "NSObject"};
-        }
+std::vector<uint8_t> NSKeyedArchiver::Archive(const NSObject& root) {
+    std::vector<uint8_t> out;
+    AppendArchive(root, out);
+    return out;
+}
 
-        uint64_t classUid = AddClass(className, hierarchy);
-        plist_dict_set_item(setDict, "$class", plist_new_uid(classUid));
+std::vector<uint8_t> NSKeyedArchiver::Archive(const NSObject& root,
+                                              const std::string& className,
+                                              const std::vector<std::string>& classHierarchy) {
+    std::vector<uint8_t> out;
+    ThreadArchiver().Archive(root, className, classHierarchy, out);
+    return out;
+}
 
-        return AddObject(setDict);
-    }
+void NSKeyedArchiver::AppendArchive(const NSObject& root, std::vector<uint8_t>& out) {
+    // Strings and primitives have no class wrapper; containers default to
+    // their NS class (Encode() fills in the hierarchy)
+    ThreadArchiver().Archive(root, {}, {}, out);
+}
 
-    uint64_t EncodeDict(const NSObject& obj) {
-        const auto& dict = obj.AsDict();
+void NSKeyedArchiver::AppendArchivedBool(bool value, std::vector<uint8_t>& out) {
+    ThreadArchiver().ArchiveScalar([value](BPlistWriter& w) { return w.AddBool(value); }, out);
+}
 
-        // Encode keys and values
-        std::vector<uint64_t> keyUids, valUids;
-        for (const auto& [key, val] : dict) {
-            keyUids.push_back(Encode(NSObject(key)));
-            valUids.push_back(Encode(val));
-        }
+void NSKeyedArchiver::AppendArchivedInt(int64_t value, std::vector<uint8_t>& out) {
+    ThreadArchiver().ArchiveScalar([value](BPlistWriter& w) { return w.AddInt(value); }, out);
+}
 
-        plist_t dictNode = plist_new_dict();
+void NSKeyedArchiver::AppendArchivedUInt(uint64_t value, std::vector<uint8_t>& out) {
+    ThreadArchiver().ArchiveScalar([value](BPlistWriter& w) { return w.AddUInt(value); }, out);
+}
 
-        // NS.keys
-        plist_t nsKeys = plist_new_array();
-        for (uint64_t uid : keyUids) {
-            plist_array_append_item(nsKeys, plist_new_uid(uid));
-        }
-        plist_dict_set_item(dictNode, "NS.keys", nsKeys);
+void NSKeyedArchiver::AppendArchivedReal(double value, std::vector<uint8_t>& out) {
+    ThreadArchiver().ArchiveScalar([value](BPlistWriter& w) { return w.AddReal(value); }, out);
+}
 
-        // NS.objects
-        plist_t nsObjects = plist_new_array();
-        for (uint64_t uid : valUids) {
-            plist_array_append_item(nsObjects, plist_new_uid(uid));
-        }
-        plist_dict_set_item(dictNode, "NS.objects", nsObjects);
+void NSKeyedArchiver::AppendArchivedString(std::string_view value, std::vector<uint8_t>& out) {
+    ThreadArchiver().ArchiveScalar([value](BPlistWriter& w) { return w.AddString(value); }, out);
+}
 
-        std::string className = obj.ClassName().empty() ? "NSDictionary" : obj.ClassName();
-        std::vector<std::string> hierarchy = obj.ClassHierarchy();
-        if (hierarchy.empty()) {
-            hierarchy = {"NSDictionary", "NSObject"};
-        }
+namespace {
 
-        uint64_t classUid = AddClass(className, hierarchy);
-        plist_dict_set_item(dictNode, "$class", plist_new_uid(classUid));
+struct SelectorHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
 
-        return AddObject(dictNode);
-    }
+// Selectors are a small fixed vocabulary; the bound only guards against
+// callers that build selector strings dynamically
+constexpr size_t kMaxCachedSelectors = 4096;
+
+struct SelectorCache {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, std::vector<uint8_t>, SelectorHash, std::equal_to<>> entries;
 };
 
-std::vector<uint8_t> NSKeyedArchiver::Archive(const NSObject& root) {
-    std::string className = root.ClassName();
-    std::vector<std::string> hierarchy = root.ClassHierarchy();
+SelectorCache& GetSelectorCache() {
+    static SelectorCache cache;
+    return cache;
+}
 
-    if (!className.empty()) {
-        return Archive(root, className, hierarchy);
-    }
+} // namespace
 
-    // Infer class from type
-    switch (root.GetType()) {
-        case NSObject::Type::Dictionary:
-            return Archive(root, "NSDictionary", {"NSDictionary", "NSObject"});
-        case NSObject::Type::Array:
-            return Archive(root, "NSArray", {"NSArray", "NSObject"});
-        case NSObject::Type::Set:
-            return Archive(root, "NSSet", {"NSSet", "NSObject"});
-        case NSObject::Type::String:
-            return Archive(root, "NSString", {"NSString", "NSObject"});
-        case NSObject::Type::Data:
-            return Archive(root, "NSData", {"NSData", "NSObject"});
-        default:
-            break;
+void NSKeyedArchiver::ArchiveSelector(std::string_view selector, std::vector<uint8_t>& out) {
+    auto& cache = GetSelectorCache();
+    {
+        std::shared_lock<std::shared_mutex> lock(cache.mutex);
+        auto it = cache.entries.find(selector);
+        if (it != cache.entries.end()) {
+            out.assign(it->second.begin(), it->second.end());
+            return;
+        }
     }
 
-    // For primitives, encode directly without class wrapper
-    ArchiverContext ctx;
-    uint64_t rootUid = ctx.Encode(root);
-
-    // Build the archive plist
-    plist_t archive = plist_new_dict();
-    plist_dict_set_item(archive, "$archiver",
-                       plist_new_string("NSKeyedArchiver"));
-    plist_dict_set_item(archive, "$version",
-                       plist_new_uint(100000));
-
-    plist_t top = plist_new_dict();
-    plist_dict_set_item(top, "root", plist_new_uid(rootUid));
-    plist_dict_set_item(archive, "$top", top);
-    plist_dict_set_item(archive, "$objects", plist_copy(ctx.GetObjects()));
-
-    // Serialize to binary plist
-    char* binData = nullptr;
-    uint32_t binLen = 0;
-    plist_to_bin(archive, &binData, &binLen);
-    plist_free(archive);
-
-    std::vector<uint8_t> result;
-    if (binData && binLen > 0) {
-        result.assign(reinterpret_cast<uint8_t*>(binData),
-                     reinterpret_cast<uint8_t*>(binData) + binLen);
-        plist_mem_free(binData);
-    }
-    return result;
-}
+    std::vector<uint8_t> archived = Archive(NSObject(std::string(selector)));
+    out.assign(archived.begin(), archived.end());
 
-std::vector<uint8_t> NSKeyedArchiver::Archive(const NSObject& root,
-                                              const std::string& className,
-                                              const std::vector<std::string>& classHierarchy) {
-    ArchiverContext ctx;
-    uint64_t rootUid = ctx.EncodeWithClass(root, className, classHierarchy);
-
-    plist_t archive = plist_new_dict();
-    plist_dict_set_item(archive, "$archiver",
-                       plist_new_string("NSKeyedArchiver"));
-    plist_dict_set_item(archive, "$version",
-                       plist_new_uint(100000));
-
-    plist_t top = plist_new_dict();
-    plist_dict_set_item(top, "root", plist_new_uid(rootUid));
-    plist_dict_set_item(archive, "$top", top);
-    plist_dict_set_item(archive, "$objects", plist_copy(ctx.GetObjects()));
-
-    char* binData = nullptr;
-    uint32_t binLen = 0;
-    plist_to_bin(archive, &binData, &binLen);
-    plist_free(archive);
-
-    std::vector<uint8_t> result;
-    if (binData && binLen > 0) {
-        result.assign(reinterpret_cast<uint8_t*>(binData),
-                     reinterpret_cast<uint8_t*>(binData) + binLen);
-        plist_mem_free(binData);
+    std::unique_lock<std::shared_mutex> lock(cache.mutex);
+    if (cache.entries.size() < kMaxCachedSelectors) {
+        cache.entries.emplace(std::string(selector), std::move(archived));
     }
-    return result;
 }
 
 } // namespace instruments
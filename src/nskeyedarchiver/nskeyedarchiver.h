@@ -3,6 +3,7 @@
 
 #include "nsobject.h"
 #include <cstdint>
+#include <string_view>
 #include <vector>
 
 namespace instruments {
@@ -18,6 +19,9 @@ namespace instruments {
 //   "$top": { "root": UID(1) },
 //   "$objects": [ "$null", ... ]
 // }
+//
+// The NSObject is walked once and written straight to bplist00
+// (BPlistWriter); equal strings and classes share one $objects entry.
 class NSKeyedArchiver {
 public:
     // Archive a single value to binary plist
@@ -28,6 +32,24 @@ public:
     static std::vector<uint8_t> Archive(const NSObject& root,
                                         const std::string& className,
                                         const std::vector<std::string>& classHierarchy);
+
+    // Append the archive of root to out, reusing out's capacity (e.g. a
+    // message buffer) instead of returning a new vector
+    static void AppendArchive(const NSObject& root, std::vector<uint8_t>& out);
+
+    // Append the archive of a lone scalar without building an NSObject;
+    // same bytes as AppendArchive(NSObject(value)) (Float32 archives as a
+    // real, so floats go through AppendArchivedReal)
+    static void AppendArchivedBool(bool value, std::vector<uint8_t>& out);
+    static void AppendArchivedInt(int64_t value, std::vector<uint8_t>& out);
+    static void AppendArchivedUInt(uint64_t value, std::vector<uint8_t>& out);
+    static void AppendArchivedReal(double value, std::vector<uint8_t>& out);
+    static void AppendArchivedString(std::string_view value, std::vector<uint8_t>& out);
+
+    // Archived NSString for a selector, copied into out from a process-wide
+    // cache (thread-safe; archived on first use). Same bytes as
+    // Archive(NSObject(selector)).
+    static void ArchiveSelector(std::string_view selector, std::vector<uint8_t>& out);
 };
 
 } // namespace instruments
@@ -1,455 +1,519 @@
 #include "nskeyedunarchiver.h"
+#include "bplist_reader.h"
 #include "../util/log.h"
 #include <plist/plist.h>
+#include <string>
+#include <vector>
 
 namespace instruments {
 
 static const char* TAG = "NSKeyedUnarchiver";
 
-// Helper to resolve a UID reference in the $objects array
-static plist_t ResolveUID(plist_t objects, plist_t uidNode) {
-    if (!uidNode || plist_get_node_type(uidNode) != PLIST_UID) return nullptr;
-    uint64_t uid = 0;
-    plist_get_uid_val(uidNode, &uid);
-    return plist_array_get_item(objects, static_cast<uint32_t>(uid));
-}
-
-// Forward declaration
-static NSObject DecodeObject(plist_t objects, plist_t node);
+using Kind = BPlistReader::Kind;
 
-// Decode a plist node that might be a UID reference
-static NSObject DecodeValue(plist_t objects, plist_t node) {
-    if (!node) return NSObject::Null();
+// Bounds recursion on deeply nested (or malformed) archives
+static constexpr int kMaxDepth = 256;
 
-    if (plist_get_node_type(node) == PLIST_UID) {
-        plist_t resolved = ResolveUID(objects, node);
-        return DecodeObject(objects, resolved);
+// Refs currently being decoded. A ref that is re-entered is a reference
+// cycle (malformed archive) and decodes as null instead of recursing.
+class ActiveRef {
+public:
+    ActiveRef(std::vector<bool>& active, uint64_t ref)
+        : m_active(active), m_ref(static_cast<size_t>(ref)), m_entered(!active[m_ref]) {
+        if (m_entered) m_active[m_ref] = true;
+    }
+    ~ActiveRef() {
+        if (m_entered) m_active[m_ref] = false;
+    }
+    bool Entered() const { return m_entered; }
+
+private:
+    std::vector<bool>& m_active;
+    size_t m_ref;
+    bool m_entered;
+};
+
+// Builds the NSObject tree for Unarchive() from visitor events
+class NSObjectBuilder : public NSKeyedVisitor {
+public:
+    void Null() override { Add(NSObject::Null()); }
+    void Bool(bool value) override { Add(NSObject(value)); }
+    void Int(int64_t value) override { Add(NSObject(value)); }
+    void UInt(uint64_t value) override { Add(NSObject(value)); }
+    void Real(double value) override { Add(NSObject(value)); }
+    void String(std::string_view value) override { Add(NSObject(std::string(value))); }
+    void Data(const uint8_t* data, size_t length) override {
+        Add(NSObject(std::vector<uint8_t>(data, data + length)));
     }
 
-    return DecodeObject(objects, node);
-}
+    bool BeginArray(size_t count, bool isSet) override {
+        NSObject::ArrayType items;
+        items.reserve(count);
+        m_stack.push_back(isSet ? NSObject::Set(std::move(items)) : NSObject(std::move(items)));
+        m_keys.emplace_back();
+        return true;
+    }
+    void EndArray() override { Pop(); }
+    bool BeginDict(size_t count) override {
+        NSObject::DictType dict;
+        dict.reserve(count);
+        m_stack.push_back(NSObject(std::move(dict)));
+        m_keys.emplace_back();
+        return true;
+    }
+    void Key(std::string_view key) override { m_keys.back().assign(key); }
+    void EndDict() override { Pop(); }
 
-// Get class name from a $class UID reference
-static std::string GetClassName(plist_t objects, plist_t containerDict) {
-    plist_t classUid = plist_dict_get_item(containerDict, "$class");
-    if (!classUid) return "";
+    NSObject& Result() { return m_result; }
 
-    plist_t classDict = ResolveUID(objects, classUid);
-    if (!classDict) return "";
+private:
+    void Add(NSObject value) {
+        if (m_stack.empty()) {
+            m_result = std::move(value);
+        } else if (m_stack.back().IsDict()) {
+            m_stack.back().AsDict().AppendUnsorted(std::move(m_keys.back()), std::move(value));
+        } else {
+            m_stack.back().AsArray().push_back(std::move(value));
+        }
+    }
 
-    plist_t classNameNode = plist_dict_get_item(classDict, "$classname");
-    if (!classNameNode) return "";
+    void Pop() {
+        NSObject done = std::move(m_stack.back());
+        if (done.IsDict()) done.AsDict().Sort();
+        m_stack.pop_back();
+        m_keys.pop_back();
+        Add(std::move(done));
+    }
 
-    char* name = nullptr;
-    plist_get_string_val(classNameNode, &name);
-    std::string result = name ? name : "";
-    plist_mem_free(name);
-    return result;
+    std::vector<NSObject> m_stack;
+    std::vector<std::string> m_keys;  // pending key per open container
+    NSObject m_result;
+};
+
+// String object as a String() or Key() event, without copying ASCII data
+template <typename Fn>
+static bool WithString(const BPlistReader& r, const BPlistReader::Object& obj, Fn&& fn) {
+    if (obj.kind == Kind::AsciiString) {
+        fn(r.AsciiValue(obj));
+        return true;
+    }
+    std::string s;
+    if (!r.StringValue(obj, s)) return false;
+    fn(std::string_view(s));
+    return true;
 }
 
-// Decode an NSArray/NSMutableArray from keyed archiver format
-static NSObject DecodeNSArray(plist_t objects, plist_t node) {
-    plist_t nsObjects = plist_dict_get_item(node, "NS.objects");
-    if (!nsObjects) return NSObject(NSObject::ArrayType{});
-
-    NSObject::ArrayType items;
-    uint32_t count = plist_array_get_size(nsObjects);
-    for (uint32_t i = 0; i < count; i++) {
-        plist_t item = plist_array_get_item(nsObjects, i);
-        items.push_back(DecodeValue(objects, item));
+// Emit a raw bplist object (not a keyed archiver container)
+static void EmitPrimitive(const BPlistReader& r, uint64_t ref, int depth,
+                          std::vector<bool>& active, NSKeyedVisitor& v) {
+    BPlistReader::Object obj;
+    if (depth > kMaxDepth || !r.Get(ref, obj)) { v.Null(); return; }
+    ActiveRef guard(active, ref);
+    if (!guard.Entered()) { v.Null(); return; }
+
+    switch (obj.kind) {
+        case Kind::Bool:
+            v.Bool(obj.boolValue);
+            return;
+        case Kind::Int:
+            if (r.IsUnsignedInt(obj) && r.UIntValue(obj) > static_cast<uint64_t>(INT64_MAX)) {
+                v.UInt(r.UIntValue(obj));
+            } else {
+                v.Int(r.IntValue(obj));
+            }
+            return;
+        case Kind::Real:
+            v.Real(r.RealValue(obj));
+            return;
+        case Kind::AsciiString:
+        case Kind::Utf16String:
+            WithString(r, obj, [&](std::string_view s) { v.String(s); });
+            return;
+        case Kind::Data:
+            v.Data(obj.body, static_cast<size_t>(obj.count));
+            return;
+        case Kind::Array:
+        case Kind::Set:
+            if (!v.BeginArray(static_cast<size_t>(obj.count), false)) return;
+            for (uint64_t i = 0; i < obj.count; i++) {
+                EmitPrimitive(r, r.RefAt(obj, i), depth + 1, active, v);
+            }
+            v.EndArray();
+            return;
+        case Kind::Dict:
+            if (!v.BeginDict(static_cast<size_t>(obj.count))) return;
+            for (uint64_t i = 0; i < obj.count; i++) {
+                BPlistReader::Object key;
+                if (!r.Get(r.RefAt(obj, i), key) ||
+                    !WithString(r, key, [&](std::string_view k) { v.Key(k); })) continue;
+                EmitPrimitive(r, r.RefAt(obj, obj.count + i), depth + 1, active, v);
+            }
+            v.EndDict();
+            return;
+        default:
+            v.Null();
+            return;
     }
-    return NSObject(std::move(items));
 }
 
-// Decode an NSSet/NSMutableSet
-static NSObject DecodeNSSet(plist_t objects, plist_t node) {
-    plist_t nsObjects = plist_dict_get_item(node, "NS.objects");
-    if (!nsObjects) return NSObject::Set({});
-
-    NSObject::ArrayType items;
-    uint32_t count = plist_array_get_size(nsObjects);
-    for (uint32_t i = 0; i < count; i++) {
-        plist_t item = plist_array_get_item(nsObjects, i);
-        items.push_back(DecodeValue(objects, item));
+// Walks a keyed archive: UIDs index the $objects array, container objects
+// are dicts whose $class UID names an NSArray/NSDictionary/... class.
+// Every Emit* call produces exactly one value on the visitor.
+class ArchiveWalker {
+public:
+    ArchiveWalker(const BPlistReader& reader, const BPlistReader::Object& objects,
+                  NSKeyedVisitor& visitor)
+        : m_reader(reader), m_objects(objects), m_visitor(visitor),
+          m_ownActive(static_cast<size_t>(reader.ObjectCount()), false), m_active(m_ownActive) {}
+
+    // Emit a value that might be a UID reference
+    void EmitValue(uint64_t ref, int depth) {
+        BPlistReader::Object obj;
+        if (depth > kMaxDepth || !m_reader.Get(ref, obj)) { m_visitor.Null(); return; }
+        if (obj.kind == Kind::UID) {
+            uint64_t resolved;
+            if (!ResolveUID(obj, resolved)) { m_visitor.Null(); return; }
+            EmitObject(resolved, depth + 1);
+            return;
+        }
+        EmitObject(ref, depth + 1);
     }
-    return NSObject::Set(std::move(items));
-}
 
-// Decode an NSDictionary/NSMutableDictionary
-static NSObject DecodeNSDictionary(plist_t objects, plist_t node) {
-    plist_t nsKeys = plist_dict_get_item(node, "NS.keys");
-    plist_t nsValues = plist_dict_get_item(node, "NS.objects");
-    if (!nsKeys || !nsValues) return NSObject(NSObject::DictType{});
+private:
+    // Walker for a sub-value with its own visitor, sharing the cycle guard
+    ArchiveWalker(const ArchiveWalker& parent, NSKeyedVisitor& visitor)
+        : m_reader(parent.m_reader), m_objects(parent.m_objects), m_visitor(visitor),
+          m_active(parent.m_active) {}
+
+    bool ResolveUID(const BPlistReader::Object& uidObj, uint64_t& outRef) const {
+        uint64_t uid = m_reader.UIDValue(uidObj);
+        if (uid >= m_objects.count) return false;
+        outRef = m_reader.RefAt(m_objects, uid);
+        return true;
+    }
 
-    uint32_t keyCount = plist_array_get_size(nsKeys);
-    uint32_t valCount = plist_array_get_size(nsValues);
-    uint32_t count = keyCount < valCount ? keyCount : valCount;
+    // Get class name from a $class UID reference
+    std::string GetClassName(const BPlistReader::Object& container) const {
+        uint64_t classRef, classDictRef, nameRef;
+        BPlistReader::Object classUid, classDict, name;
+        if (!m_reader.DictLookup(container, "$class", classRef) || !m_reader.Get(classRef, classUid) ||
+            classUid.kind != Kind::UID || !ResolveUID(classUid, classDictRef) ||
+            !m_reader.Get(classDictRef, classDict) ||
+            !m_reader.DictLookup(classDict, "$classname", nameRef) || !m_reader.Get(nameRef, name)) {
+            return "";
+        }
+        std::string result;
+        m_reader.StringValue(name, result);
+        return result;
+    }
 
-    NSObject::DictType dict;
-    for (uint32_t i = 0; i < count; i++) {
-        plist_t keyNode = plist_array_get_item(nsKeys, i);
-        plist_t valNode = plist_array_get_item(nsValues, i);
+    // NS.objects of an array/set container
+    void EmitItems(const BPlistReader::Object& node, int depth, bool isSet) {
+        uint64_t ref;
+        BPlistReader::Object list;
+        if (!m_reader.DictLookup(node, "NS.objects", ref) || !m_reader.Get(ref, list) ||
+            list.kind != Kind::Array) {
+            if (m_visitor.BeginArray(0, isSet)) m_visitor.EndArray();
+            return;
+        }
+        if (!m_visitor.BeginArray(static_cast<size_t>(list.count), isSet)) return;
+        for (uint64_t i = 0; i < list.count; i++) {
+            EmitValue(m_reader.RefAt(list, i), depth + 1);
+        }
+        m_visitor.EndArray();
+    }
 
-        NSObject key = DecodeValue(objects, keyNode);
-        NSObject val = DecodeValue(objects, valNode);
+    void EmitNSDictionary(const BPlistReader::Object& node, int depth) {
+        uint64_t keysRef, valuesRef;
+        BPlistReader::Object keys, values;
+        if (!m_reader.DictLookup(node, "NS.keys", keysRef) ||
+            !m_reader.DictLookup(node, "NS.objects", valuesRef) ||
+            !m_reader.Get(keysRef, keys) || !m_reader.Get(valuesRef, values) ||
+            keys.kind != Kind::Array || values.kind != Kind::Array) {
+            if (m_visitor.BeginDict(0)) m_visitor.EndDict();
+            return;
+        }
 
-        // Dictionary keys should be strings
-        std::string keyStr;
-        if (key.IsString()) {
-            keyStr = key.AsString();
-        } else {
-            keyStr = key.ToJson();
+        uint64_t count = keys.count < values.count ? keys.count : values.count;
+        if (!m_visitor.BeginDict(static_cast<size_t>(count))) return;
+        for (uint64_t i = 0; i < count; i++) {
+            EmitKey(m_reader.RefAt(keys, i), depth + 1);
+            EmitValue(m_reader.RefAt(values, i), depth + 1);
         }
-        dict[keyStr] = std::move(val);
+        m_visitor.EndDict();
     }
-    return NSObject(std::move(dict));
-}
 
-// Decode NSMutableData / NSData
-static NSObject DecodeNSData(plist_t objects, plist_t node) {
-    plist_t nsData = plist_dict_get_item(node, "NS.data");
-    if (!nsData) return NSObject(std::vector<uint8_t>{});
-
-    if (plist_get_node_type(nsData) == PLIST_UID) {
-        plist_t resolved = ResolveUID(objects, nsData);
-        if (resolved && plist_get_node_type(resolved) == PLIST_DATA) {
-            char* data = nullptr;
-            uint64_t len = 0;
-            plist_get_data_val(resolved, &data, &len);
-            std::vector<uint8_t> result;
-            if (data && len > 0) {
-                result.assign(reinterpret_cast<uint8_t*>(data),
-                             reinterpret_cast<uint8_t*>(data) + len);
-                plist_mem_free(data);
-            }
-            return NSObject(std::move(result));
+    // Dictionary keys should be strings; anything else is keyed by its JSON
+    void EmitKey(uint64_t ref, int depth) {
+        BPlistReader::Object obj;
+        if (m_reader.Get(ref, obj) && obj.kind == Kind::UID) {
+            uint64_t resolved;
+            if (!ResolveUID(obj, resolved) || !m_reader.Get(resolved, obj)) obj = {};
+        }
+        if (!m_reader.StringEquals(obj, "$null") &&
+            WithString(m_reader, obj, [&](std::string_view k) { m_visitor.Key(k); })) {
+            return;
         }
+        NSObjectBuilder builder;
+        ArchiveWalker keyWalker(*this, builder);
+        keyWalker.EmitValue(ref, depth);
+        const NSObject& key = builder.Result();
+        m_visitor.Key(key.IsString() ? key.AsString() : key.ToJson());
     }
 
-    if (plist_get_node_type(nsData) == PLIST_DATA) {
-        char* data = nullptr;
-        uint64_t len = 0;
-        plist_get_data_val(nsData, &data, &len);
-        std::vector<uint8_t> result;
-        if (data && len > 0) {
-            result.assign(reinterpret_cast<uint8_t*>(data),
-                         reinterpret_cast<uint8_t*>(data) + len);
-            plist_mem_free(data);
+    // NS.data / NS.string: the value, or a UID to it
+    bool ScalarField(const BPlistReader::Object& node, std::string_view key,
+                     BPlistReader::Object& out) const {
+        uint64_t ref;
+        if (!m_reader.DictLookup(node, key, ref) || !m_reader.Get(ref, out)) return false;
+        if (out.kind == Kind::UID) {
+            uint64_t resolved;
+            if (!ResolveUID(out, resolved) || !m_reader.Get(resolved, out)) return false;
         }
-        return NSObject(std::move(result));
+        return true;
     }
 
-    return NSObject(std::vector<uint8_t>{});
-}
+    void EmitNSData(const BPlistReader::Object& node) {
+        BPlistReader::Object data;
+        if (!ScalarField(node, "NS.data", data) || data.kind != Kind::Data) {
+            m_visitor.Data(nullptr, 0);
+            return;
+        }
+        m_visitor.Data(data.body, static_cast<size_t>(data.count));
+    }
 
-// Decode NSMutableString / NSString
-static NSObject DecodeNSString(plist_t objects, plist_t node) {
-    plist_t nsString = plist_dict_get_item(node, "NS.string");
-    if (!nsString) return NSObject(std::string(""));
-
-    if (plist_get_node_type(nsString) == PLIST_UID) {
-        plist_t resolved = ResolveUID(objects, nsString);
-        if (resolved && plist_get_node_type(resolved) == PLIST_STRING) {
-            char* str = nullptr;
-            plist_get_string_val(resolved, &str);
-            std::string result = str ? str : "";
-            plist_mem_free(str);
-            return NSObject(std::move(result));
+    void EmitNSString(const BPlistReader::Object& node) {
+        BPlistReader::Object str;
+        if (!ScalarField(node, "NS.string", str) ||
+            !WithString(m_reader, str, [&](std::string_view s) { m_visitor.String(s); })) {
+            m_visitor.String("");
         }
     }
 
-    if (plist_get_node_type(nsString) == PLIST_STRING) {
-        char* str = nullptr;
-        plist_get_string_val(nsString, &str);
-        std::string result = str ? str : "";
-        plist_mem_free(str);
-        return NSObject(std::move(result));
+    // Emit the value under key (UID or inline); false (nothing emitted) when absent
+    bool EmitField(const BPlistReader::Object& node, std::string_view key, int depth) {
+        uint64_t ref;
+        if (!m_reader.DictLookup(node, key, ref)) return false;
+        EmitValue(ref, depth + 1);
+        return true;
     }
 
-    return NSObject(std::string(""));
-}
+    // Nested (non-keyed) bplist carried as data, e.g. DTTapMessagePlist
+    bool EmitNestedPlist(const BPlistReader::Object& node, std::string_view key) {
+        BPlistReader::Object data;
+        BPlistReader inner;
+        if (!ScalarField(node, key, data) || data.kind != Kind::Data || data.count == 0 ||
+            !inner.Open(data.body, static_cast<size_t>(data.count))) {
+            return false;
+        }
+        std::vector<bool> innerActive(static_cast<size_t>(inner.ObjectCount()), false);
+        EmitPrimitive(inner, inner.TopRef(), 0, innerActive, m_visitor);
+        return true;
+    }
+
+    // Main emit function - handles both keyed-archiver containers and plain objects
+    void EmitObject(uint64_t ref, int depth) {
+        BPlistReader::Object node;
+        if (depth > kMaxDepth || !m_reader.Get(ref, node)) { m_visitor.Null(); return; }
+
+        // A plain string "$null" is null
+        if (node.kind == Kind::AsciiString || node.kind == Kind::Utf16String) {
+            if (m_reader.StringEquals(node, "$null")) {
+                m_visitor.Null();
+            } else {
+                WithString(m_reader, node, [&](std::string_view s) { m_visitor.String(s); });
+            }
+            return;
+        }
 
-// Decode a raw plist node (not a keyed archiver container)
-static NSObject DecodePrimitive(plist_t node) {
-    if (!node) return NSObject::Null();
+        // If it's not a dict, decode as primitive
+        if (node.kind != Kind::Dict) {
+            EmitPrimitive(m_reader, ref, depth, m_active, m_visitor);
+            return;
+        }
 
-    switch (plist_get_node_type(node)) {
-        case PLIST_BOOLEAN: {
-            uint8_t val = 0;
-            plist_get_bool_val(node, &val);
-            return NSObject(static_cast<bool>(val));
+        // It's a dict - check if it has a $class key (keyed archiver container)
+        std::string className = GetClassName(node);
+        if (className.empty()) {
+            // Plain dictionary (not a keyed archiver object)
+            EmitPrimitive(m_reader, ref, depth, m_active, m_visitor);
+            return;
         }
-        case PLIST_INT: {
-            // Note: PLIST_UINT is #defined as PLIST_INT in newer libplist.
-            // Use plist_get_uint_val to handle both signed and unsigned correctly.
-            uint64_t uval = 0;
-            plist_get_uint_val(node, &uval);
-            // If the high bit is set, treat as unsigned; otherwise as signed
-            if (uval > static_cast<uint64_t>(INT64_MAX)) {
-                return NSObject(uval);
-            }
-            return NSObject(static_cast<int64_t>(uval));
+
+        ActiveRef guard(m_active, ref);
+        if (!guard.Entered()) { m_visitor.Null(); return; }
+
+        // Dispatch by class name
+        if (className == "NSArray" || className == "NSMutableArray") {
+            EmitItems(node, depth, false);
+            return;
         }
-        case PLIST_REAL: {
-            double val = 0.0;
-            plist_get_real_val(node, &val);
-            return NSObject(val);
+        if (className == "NSSet" || className == "NSMutableSet") {
+            EmitItems(node, depth, true);
+            return;
         }
-        case PLIST_STRING: {
-            char* str = nullptr;
-            plist_get_string_val(node, &str);
-            std::string result = str ? str : "";
-            plist_mem_free(str);
-            return NSObject(std::move(result));
+        if (className == "NSDictionary" || className == "NSMutableDictionary") {
+            EmitNSDictionary(node, depth);
+            return;
         }
-        case PLIST_DATA: {
-            char* data = nullptr;
-            uint64_t len = 0;
-            plist_get_data_val(node, &data, &len);
-            std::vector<uint8_t> result;
-            if (data && len > 0) {
-                result.assign(reinterpret_cast<uint8_t*>(data),
-                             reinterpret_cast<uint8_t*>(data) + len);
-                plist_mem_free(data);
-            }
-            return NSObject(std::move(result));
+        if (className == "NSData" || className == "NSMutableData") {
+            EmitNSData(node);
+            return;
         }
-        case PLIST_ARRAY: {
-            NSObject::ArrayType items;
-            uint32_t count = plist_array_get_size(node);
-            for (uint32_t i = 0; i < count; i++) {
-                items.push_back(DecodePrimitive(plist_array_get_item(node, i)));
+        if (className == "NSString" || className == "NSMutableString") {
+            EmitNSString(node);
+            return;
+        }
+        if (className == "NSValue" || className == "NSNumber") {
+            // NSNumber is often stored with NS.intval, NS.dblval, etc.
+            if (!EmitField(node, "NS.intval", depth) && !EmitField(node, "NS.dblval", depth)) {
+                m_visitor.Null();
             }
-            return NSObject(std::move(items));
+            return;
+        }
+        if (className == "NSDate") {
+            if (!EmitField(node, "NS.time", depth)) m_visitor.Real(0.0);
+            return;
+        }
+        if (className == "NSUUID") {
+            if (!EmitField(node, "NS.uuidbytes", depth)) m_visitor.Data(nullptr, 0);
+            return;
         }
-        case PLIST_DICT: {
-            NSObject::DictType dict;
-            plist_dict_iter iter = nullptr;
-            plist_dict_new_iter(node, &iter);
-            if (iter) {
-                char* key = nullptr;
-                plist_t val = nullptr;
-                while (true) {
-                    plist_dict_next_item(node, iter, &key, &val);
-                    if (!key) break;
-                    dict[key] = DecodePrimitive(val);
-                    plist_mem_free(key);
-                    key = nullptr;
-                }
-                free(iter);
+        if (className == "NSError" || className == "NSException") {
+            // Decode as dictionary with relevant fields
+            static constexpr std::pair<std::string_view, std::string_view> kFields[] = {
+                {"NSCode", "code"}, {"NSDomain", "domain"}, {"NSUserInfo", "userInfo"},
+            };
+            if (!m_visitor.BeginDict(1 + std::size(kFields))) return;
+            m_visitor.Key("$class");
+            m_visitor.String(className);
+            for (const auto& [field, name] : kFields) {
+                uint64_t fieldRef;
+                if (!m_reader.DictLookup(node, field, fieldRef)) continue;
+                m_visitor.Key(name);
+                EmitValue(fieldRef, depth + 1);
             }
-            return NSObject(std::move(dict));
+            m_visitor.EndDict();
+            return;
+        }
+        if (className == "NSURL") {
+            if (!EmitField(node, "NS.relative", depth)) m_visitor.String("");
+            return;
+        }
+        if (className == "DTTapMessage" || className == "DTSysmonTapMessage") {
+            // DTTapMessage contains plistBytes: a nested (non-keyed) bplist
+            if (!EmitNestedPlist(node, "DTTapMessagePlist")) m_visitor.Null();
+            return;
+        }
+        if (className == "XCTCapabilities") {
+            // Decode as dict with capabilitiesDictionary
+            if (EmitField(node, "capabilities-dictionary", depth)) return;
+            // Fallthrough to generic decode
         }
-        default:
-            return NSObject::Null();
-    }
-}
 
-// Main decode function - handles both keyed-archiver containers and plain plist nodes
-static NSObject DecodeObject(plist_t objects, plist_t node) {
-    if (!node) return NSObject::Null();
-
-    plist_type type = plist_get_node_type(node);
-
-    // If it's a plain string "$null", return null
-    if (type == PLIST_STRING) {
-        char* str = nullptr;
-        plist_get_string_val(node, &str);
-        if (str) {
-            std::string s(str);
-            plist_mem_free(str);
-            if (s == "$null") return NSObject::Null();
-            return NSObject(std::move(s));
+        // Unknown class - decode all keys as a dictionary
+        INST_LOG_DEBUG(TAG, "Unknown class: %s, decoding as dict", className.c_str());
+        if (!m_visitor.BeginDict(static_cast<size_t>(node.count))) return;
+        m_visitor.Key("$class");
+        m_visitor.String(className);
+        for (uint64_t i = 0; i < node.count; i++) {
+            BPlistReader::Object key;
+            if (!m_reader.Get(m_reader.RefAt(node, i), key) ||
+                m_reader.StringEquals(key, "$class")) continue; // skip $class
+            if (!WithString(m_reader, key, [&](std::string_view k) { m_visitor.Key(k); })) continue;
+            EmitValue(m_reader.RefAt(node, node.count + i), depth + 1);
         }
-        return NSObject::Null();
+        m_visitor.EndDict();
     }
 
-    // If it's not a dict, decode as primitive
-    if (type != PLIST_DICT) {
-        return DecodePrimitive(node);
-    }
+    const BPlistReader& m_reader;
+    BPlistReader::Object m_objects;
+    NSKeyedVisitor& m_visitor;
+    std::vector<bool> m_ownActive;
+    std::vector<bool>& m_active;
+};
 
-    // It's a dict - check if it has a $class key (keyed archiver container)
-    std::string className = GetClassName(objects, node);
-    if (className.empty()) {
-        // Plain dictionary (not a keyed archiver object)
-        return DecodePrimitive(node);
-    }
+static void VisitBinary(const BPlistReader& r, NSKeyedVisitor& visitor) {
+    BPlistReader::Object root;
+    if (!r.Get(r.TopRef(), root)) { visitor.Null(); return; }
 
-    // Dispatch by class name
-    if (className == "NSArray" || className == "NSMutableArray") {
-        return DecodeNSArray(objects, node);
-    }
-    if (className == "NSSet" || className == "NSMutableSet") {
-        return DecodeNSSet(objects, node);
-    }
-    if (className == "NSDictionary" || className == "NSMutableDictionary") {
-        return DecodeNSDictionary(objects, node);
-    }
-    if (className == "NSData" || className == "NSMutableData") {
-        return DecodeNSData(objects, node);
-    }
-    if (className == "NSString" || className == "NSMutableString") {
-        return DecodeNSString(objects, node);
-    }
-    if (className == "NSValue" || className == "NSNumber") {
-        // NSNumber is often stored with NS.intval, NS.dblval, etc.
-        plist_t intVal = plist_dict_get_item(node, "NS.intval");
-        if (intVal) return DecodeValue(objects, intVal);
-        plist_t dblVal = plist_dict_get_item(node, "NS.dblval");
-        if (dblVal) return DecodeValue(objects, dblVal);
-        return NSObject::Null();
-    }
-    if (className == "NSDate") {
-        plist_t timeVal = plist_dict_get_item(node, "NS.time");
-        if (timeVal) return DecodeValue(objects, timeVal);
-        return NSObject(0.0);
-    }
-    if (className == "NSUUID") {
-        plist_t uuidBytes = plist_dict_get_item(node, "NS.uuidbytes");
-        if (uuidBytes) return DecodeValue(objects, uuidBytes);
-        return NSObject(std::vector<uint8_t>{});
+    // Check if this is a keyed archiver plist
+    uint64_t ref;
+    if (root.kind != Kind::Dict || !r.DictLookup(root, "$archiver", ref)) {
+        // Not a keyed archiver - decode as plain plist
+        std::vector<bool> active(static_cast<size_t>(r.ObjectCount()), false);
+        EmitPrimitive(r, r.TopRef(), 0, active, visitor);
+        return;
     }
-    if (className == "NSError" || className == "NSException") {
-        // Decode as dictionary with relevant fields
-        NSObject::DictType result;
-        result["$class"] = NSObject(className);
-
-        plist_t domain = plist_dict_get_item(node, "NSDomain");
-        if (domain) result["domain"] = DecodeValue(objects, domain);
 
-        plist_t code = plist_dict_get_item(node, "NSCode");
-        if (code) result["code"] = DecodeValue(objects, code);
+    uint64_t objectsRef, topRef;
+    BPlistReader::Object objects, top;
+    if (!r.DictLookup(root, "$objects", objectsRef) || !r.DictLookup(root, "$top", topRef) ||
+        !r.Get(objectsRef, objects) || !r.Get(topRef, top) ||
+        objects.kind != Kind::Array || top.kind != Kind::Dict) {
+        INST_LOG_ERROR(TAG, "Invalid keyed archiver format: missing $objects or $top");
+        visitor.Null();
+        return;
+    }
 
-        plist_t userInfo = plist_dict_get_item(node, "NSUserInfo");
-        if (userInfo) result["userInfo"] = DecodeValue(objects, userInfo);
+    ArchiveWalker walker(r, objects, visitor);
 
-        return NSObject(std::move(result));
-    }
-    if (className == "NSURL") {
-        plist_t relative = plist_dict_get_item(node, "NS.relative");
-        if (relative) return DecodeValue(objects, relative);
-        return NSObject(std::string(""));
-    }
-    if (className == "DTTapMessage" || className == "DTSysmonTapMessage") {
-        // DTTapMessage contains plistBytes
-        plist_t plistBytes = plist_dict_get_item(node, "DTTapMessagePlist");
-        if (plistBytes) {
-            NSObject data = DecodeValue(objects, plistBytes);
-            if (data.IsData() && !data.AsData().empty()) {
-                // Parse the inner plist
-                plist_t inner = nullptr;
-                plist_from_bin(reinterpret_cast<const char*>(data.AsData().data()),
-                              data.AsData().size(), &inner);
-                if (inner) {
-                    NSObject result = DecodePrimitive(inner);
-                    plist_free(inner);
-                    return result;
-                }
-            }
-        }
-        return NSObject::Null();
-    }
-    if (className == "XCTCapabilities") {
-        // Decode as dict with capabilitiesDictionary
-        plist_t capsDict = plist_dict_get_item(node, "capabilities-dictionary");
-        if (capsDict) return DecodeValue(objects, capsDict);
-        // Fallthrough to generic decode
+    // Get the root UID from $top
+    // $top can have "root" or "$0", "$1", etc.
+    uint64_t rootRef;
+    if (r.DictLookup(top, "root", rootRef) || r.DictLookup(top, "$0", rootRef)) {
+        walker.EmitValue(rootRef, 0);
+        return;
     }
 
-    // Unknown class - decode all keys as a dictionary
-    INST_LOG_DEBUG(TAG, "Unknown class: %s, decoding as dict", className.c_str());
-    NSObject::DictType result;
-    result["$class"] = NSObject(className);
-
-    plist_dict_iter iter = nullptr;
-    plist_dict_new_iter(node, &iter);
-    if (iter) {
-        char* key = nullptr;
-        plist_t val = nullptr;
-        while (true) {
-            plist_dict_next_item(node, iter, &key, &val);
-            if (!key) break;
-            std::string keyStr(key);
-            plist_mem_free(key);
-            key = nullptr;
-            if (keyStr == "$class") continue; // skip $class
-            result[keyStr] = DecodeValue(objects, val);
-        }
-        free(iter);
+    // Multiple top-level objects (a single one is unwrapped)
+    if (top.count == 1) {
+        walker.EmitValue(r.RefAt(top, 1), 0);
+        return;
+    }
+    if (!visitor.BeginArray(static_cast<size_t>(top.count), false)) return;
+    for (uint64_t i = 0; i < top.count; i++) {
+        walker.EmitValue(r.RefAt(top, top.count + i), 0);
     }
-    return NSObject(std::move(result));
+    visitor.EndArray();
 }
 
-NSObject NSKeyedUnarchiver::Unarchive(const uint8_t* data, size_t length) {
-    if (!data || length == 0) return NSObject::Null();
+bool NSKeyedUnarchiver::Visit(const uint8_t* data, size_t length, NSKeyedVisitor& visitor) {
+    if (!data || length == 0) return false;
 
-    // Parse binary plist
-    plist_t root = nullptr;
-    plist_from_bin(reinterpret_cast<const char*>(data), static_cast<uint32_t>(length), &root);
-    if (!root) {
-        // Try XML format
-        plist_from_xml(reinterpret_cast<const char*>(data), static_cast<uint32_t>(length), &root);
+    // Binary plists are read in place
+    BPlistReader reader;
+    if (reader.Open(data, length)) {
+        VisitBinary(reader, visitor);
+        return true;
     }
+
+    // Try XML format: convert through libplist, then take the binary path
+    plist_t root = nullptr;
+    plist_from_xml(reinterpret_cast<const char*>(data), static_cast<uint32_t>(length), &root);
     if (!root) {
         INST_LOG_ERROR(TAG, "Failed to parse plist data (%zu bytes)", length);
-        return NSObject::Null();
-    }
-
-    // Check if this is a keyed archiver plist
-    plist_t archiver = plist_dict_get_item(root, "$archiver");
-    if (!archiver) {
-        // Not a keyed archiver - decode as plain plist
-        NSObject result = DecodePrimitive(root);
-        plist_free(root);
-        return result;
-    }
-
-    plist_t objects = plist_dict_get_item(root, "$objects");
-    plist_t top = plist_dict_get_item(root, "$top");
-    if (!objects || !top) {
-        INST_LOG_ERROR(TAG, "Invalid keyed archiver format: missing $objects or $top");
-        plist_free(root);
-        return NSObject::Null();
-    }
-
-    // Get the root UID from $top
-    // $top can have "root" or "$0", "$1", etc.
-    plist_t rootUid = plist_dict_get_item(top, "root");
-    if (!rootUid) {
-        // Try $0
-        rootUid = plist_dict_get_item(top, "$0");
+        return false;
     }
+    char* bin = nullptr;
+    uint32_t binLen = 0;
+    plist_to_bin(root, &bin, &binLen);
+    plist_free(root);
 
-    NSObject result;
-    if (rootUid) {
-        result = DecodeValue(objects, rootUid);
+    bool ok = bin && reader.Open(reinterpret_cast<const uint8_t*>(bin), binLen);
+    if (ok) {
+        VisitBinary(reader, visitor);
     } else {
-        // Multiple top-level objects
-        NSObject::ArrayType items;
-        plist_dict_iter iter = nullptr;
-        plist_dict_new_iter(top, &iter);
-        if (iter) {
-            char* key = nullptr;
-            plist_t val = nullptr;
-            while (true) {
-                plist_dict_next_item(top, iter, &key, &val);
-                if (!key) break;
-                items.push_back(DecodeValue(objects, val));
-                plist_mem_free(key);
-                key = nullptr;
-            }
-            free(iter);
-        }
-        if (items.size() == 1) {
-            result = std::move(items[0]);
-        } else {
-            result = NSObject(std::move(items));
-        }
+        INST_LOG_ERROR(TAG, "Failed to convert XML plist (%zu bytes)", length);
     }
+    plist_mem_free(bin);
+    return ok;
+}
 
-    plist_free(root);
-    return result;
+NSObject NSKeyedUnarchiver::Unarchive(const uint8_t* data, size_t length) {
+    NSObjectBuilder builder;
+    if (!Visit(data, length, builder)) return NSObject::Null();
+    return std::move(builder.Result());
 }
 
 NSObject NSKeyedUnarchiver::Unarchive(const std::vector<uint8_t>& data) {
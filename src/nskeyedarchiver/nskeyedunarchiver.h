@@ -2,11 +2,38 @@
 #define INSTRUMENTS_NSKEYEDUNARCHIVER_H
 
 #include "nsobject.h"
+#include <cstddef>
 #include <cstdint>
+#include <string_view>
 #include <vector>
 
 namespace instruments {
 
+// NSKeyedVisitor - SAX-style events from NSKeyedUnarchiver::Visit(), in the
+// same shape Unarchive() would build as an NSObject tree. Every value is
+// exactly one scalar call or one Begin/End pair; dictionary values are
+// preceded by Key(). String views are only valid for the duration of the call.
+class NSKeyedVisitor {
+public:
+    virtual ~NSKeyedVisitor() = default;
+
+    virtual void Null() {}
+    virtual void Bool(bool value) {}
+    virtual void Int(int64_t value) {}
+    virtual void UInt(uint64_t value) {}
+    virtual void Real(double value) {}
+    virtual void String(std::string_view value) {}
+    virtual void Data(const uint8_t* data, size_t length) {}
+
+    // Return false to skip a container: no children and no matching End call.
+    // count is the number of elements/entries (a hint for synthesized dicts).
+    virtual bool BeginArray(size_t count, bool isSet) { return true; }
+    virtual void EndArray() {}
+    virtual bool BeginDict(size_t count) { return true; }
+    virtual void Key(std::string_view key) {}
+    virtual void EndDict() {}
+};
+
 // NSKeyedUnarchiver - Decodes Apple's NSKeyedArchiver binary plist format
 // back into NSObject values.
 class NSKeyedUnarchiver {
@@ -14,6 +41,10 @@ public:
     // Unarchive from binary plist data
     static NSObject Unarchive(const std::vector<uint8_t>& data);
     static NSObject Unarchive(const uint8_t* data, size_t length);
+
+    // Stream the decoded value to a visitor without building a tree.
+    // Returns false if data is not a plist.
+    static bool Visit(const uint8_t* data, size_t length, NSKeyedVisitor& visitor);
 };
 
 } // namespace instruments
@@ -41,43 +41,44 @@ std::string NSObject::ToJson(int indent) const {
             break;
 
         case Type::Bool:
-            ss << (m_bool ? "true" : "false");
+            ss << (AsBool() ? "true" : "false");
             break;
 
         case Type::Int32:
         case Type::Int64:
-            ss << m_int64;
+            ss << AsInt64();
             break;
 
         case Type::UInt64:
-            ss << m_uint64;
+            ss << AsUInt64();
             break;
 
         case Type::Float32:
         case Type::Float64:
-            ss << m_float64;
+            ss << AsDouble();
             break;
 
         case Type::String:
-            ss << "\"" << EscapeJson(m_string) << "\"";
+            ss << "\"" << EscapeJson(AsString()) << "\"";
             break;
 
         case Type::Data: {
-            ss << "\"<data:" << m_data.size() << " bytes>\"";
+            ss << "\"<data:" << AsData().size() << " bytes>\"";
             break;
         }
 
         case Type::Array:
         case Type::Set: {
-            if (m_array.empty()) {
+            const auto& array = AsArray();
+            if (array.empty()) {
                 ss << "[]";
                 break;
             }
             ss << "[\n";
-            for (size_t i = 0; i < m_array.size(); i++) {
+            for (size_t i = 0; i < array.size(); i++) {
                 AppendIndent(ss, indent + 1);
-                ss << m_array[i].ToJson(indent + 1);
-                if (i + 1 < m_array.size()) ss << ",";
+                ss << array[i].ToJson(indent + 1);
+                if (i + 1 < array.size()) ss << ",";
                 ss << "\n";
             }
             AppendIndent(ss, indent);
@@ -86,16 +87,17 @@ std::string NSObject::ToJson(int indent) const {
         }
 
         case Type::Dictionary: {
-            if (m_dict.empty()) {
+            const auto& dict = AsDict();
+            if (dict.empty()) {
                 ss << "{}";
                 break;
             }
             ss << "{\n";
             size_t count = 0;
-            for (const auto& [key, val] : m_dict) {
+            for (const auto& [key, val] : dict) {
                 AppendIndent(ss, indent + 1);
                 ss << "\"" << EscapeJson(key) << "\": " << val.ToJson(indent + 1);
-                if (++count < m_dict.size()) ss << ",";
+                if (++count < dict.size()) ss << ",";
                 ss << "\n";
             }
             AppendIndent(ss, indent);
@@ -107,4 +109,28 @@ std::string NSObject::ToJson(int indent) const {
     return ss.str();
 }
 
+void NSObject::SetClassName(const std::string& name) {
+    auto info = std::make_shared<ClassInfo>();
+    info->name = name;
+    if (m_classInfo) info->hierarchy = m_classInfo->hierarchy;
+    m_classInfo = std::move(info);
+}
+
+void NSObject::SetClassHierarchy(const std::vector<std::string>& hierarchy) {
+    auto info = std::make_shared<ClassInfo>();
+    if (m_classInfo) info->name = m_classInfo->name;
+    info->hierarchy = hierarchy;
+    m_classInfo = std::move(info);
+}
+
+const std::string& NSObject::ClassName() const {
+    static const std::string empty;
+    return m_classInfo ? m_classInfo->name : empty;
+}
+
+const std::vector<std::string>& NSObject::ClassHierarchy() const {
+    static const std::vector<std::string> empty;
+    return m_classInfo ? m_classInfo->hierarchy : empty;
+}
+
 } // namespace instruments
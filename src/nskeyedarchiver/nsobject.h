@@ -1,17 +1,128 @@
 #ifndef INSTRUMENTS_NSOBJECT_H
 #define INSTRUMENTS_NSOBJECT_H
 
+#include <algorithm>
 #include <cstdint>
-#include <map>
+#include <initializer_list>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace instruments {
 
+// FlatDict - std::map-style dictionary stored as one vector of key/value
+// pairs sorted by key. Decoded plists are built once and read many times,
+// so lookups are binary searches over contiguous memory; iteration order
+// is the same as std::map.
+template <typename V>
+class FlatDict {
+public:
+    using key_type = std::string;
+    using mapped_type = V;
+    using value_type = std::pair<std::string, V>;
+    using container_type = std::vector<value_type>;
+    using iterator = typename container_type::iterator;
+    using const_iterator = typename container_type::const_iterator;
+    using size_type = size_t;
+
+    FlatDict() = default;
+    FlatDict(std::initializer_list<value_type> init) {
+        m_items.reserve(init.size());
+        for (const auto& kv : init) insert(kv);
+    }
+
+    iterator begin() { return m_items.begin(); }
+    iterator end() { return m_items.end(); }
+    const_iterator begin() const { return m_items.begin(); }
+    const_iterator end() const { return m_items.end(); }
+
+    size_t size() const { return m_items.size(); }
+    bool empty() const { return m_items.empty(); }
+    void clear() { m_items.clear(); }
+    void reserve(size_t n) { m_items.reserve(n); }
+
+    iterator find(std::string_view key) {
+        auto it = LowerBound(key);
+        return (it != m_items.end() && it->first == key) ? it : m_items.end();
+    }
+    const_iterator find(std::string_view key) const {
+        auto it = LowerBound(key);
+        return (it != m_items.end() && it->first == key) ? it : m_items.end();
+    }
+    size_t count(std::string_view key) const { return find(key) != end() ? 1 : 0; }
+
+    V& operator[](std::string_view key) {
+        auto it = LowerBound(key);
+        if (it == m_items.end() || it->first != key) {
+            it = m_items.emplace(it, std::string(key), V());
+        }
+        return it->second;
+    }
+
+    // Inserts if key is absent (std::map semantics: an existing value is kept)
+    std::pair<iterator, bool> insert(value_type kv) {
+        auto it = LowerBound(kv.first);
+        if (it != m_items.end() && it->first == kv.first) return {it, false};
+        return {m_items.insert(it, std::move(kv)), true};
+    }
+    std::pair<iterator, bool> emplace(std::string key, V value) {
+        return insert(value_type(std::move(key), std::move(value)));
+    }
+
+    size_t erase(std::string_view key) {
+        auto it = find(key);
+        if (it == m_items.end()) return 0;
+        m_items.erase(it);
+        return 1;
+    }
+    iterator erase(const_iterator pos) { return m_items.erase(pos); }
+
+    // Bulk build: append in any order, then Sort() once before any lookup.
+    // Sort() keeps the last value for duplicate keys, like repeated operator[].
+    void AppendUnsorted(std::string key, V value) {
+        m_items.emplace_back(std::move(key), std::move(value));
+    }
+    void Sort() {
+        auto byKey = [](const value_type& a, const value_type& b) { return a.first < b.first; };
+        if (std::is_sorted(m_items.begin(), m_items.end(), byKey) &&
+            std::adjacent_find(m_items.begin(), m_items.end(),
+                               [](const value_type& a, const value_type& b) { return a.first == b.first; })
+                == m_items.end()) {
+            return;
+        }
+        std::stable_sort(m_items.begin(), m_items.end(), byKey);
+        auto out = m_items.begin();
+        for (auto it = m_items.begin(); it != m_items.end(); ++it) {
+            auto next = it + 1;
+            if (next != m_items.end() && next->first == it->first) continue;
+            if (out != it) *out = std::move(*it);
+            ++out;
+        }
+        m_items.erase(out, m_items.end());
+    }
+
+private:
+    iterator LowerBound(std::string_view key) {
+        return std::lower_bound(m_items.begin(), m_items.end(), key,
+                                [](const value_type& kv, std::string_view k) { return kv.first < k; });
+    }
+    const_iterator LowerBound(std::string_view key) const {
+        return std::lower_bound(m_items.begin(), m_items.end(), key,
+                                [](const value_type& kv, std::string_view k) { return kv.first < k; });
+    }
+
+    container_type m_items;
+};
+
 // NSObject - variant value type representing plist-compatible values.
 // Used for NSKeyedArchiver encoding/decoding and DTX message payloads.
+//
+// Values live in a single tagged union; NSKeyedArchiver class metadata is
+// kept out of line and shared between copies, so scalars stay small and
+// copying a decoded tree never duplicates class names.
 class NSObject {
 public:
     enum class Type {
@@ -30,32 +141,31 @@ public:
     };
 
     using ArrayType = std::vector<NSObject>;
-    using DictType = std::map<std::string, NSObject>;
+    using DictType = FlatDict<NSObject>;
 
     // Constructors
-    NSObject() : m_type(Type::Null) {}
-    explicit NSObject(bool v) : m_type(Type::Bool), m_bool(v) {}
-    explicit NSObject(int32_t v) : m_type(Type::Int32), m_int64(v) {}
-    explicit NSObject(int64_t v) : m_type(Type::Int64), m_int64(v) {}
-    explicit NSObject(uint64_t v) : m_type(Type::UInt64), m_uint64(v) {}
-    explicit NSObject(float v) : m_type(Type::Float32), m_float64(v) {}
-    explicit NSObject(double v) : m_type(Type::Float64), m_float64(v) {}
-    explicit NSObject(const std::string& v) : m_type(Type::String), m_string(v) {}
-    explicit NSObject(std::string&& v) : m_type(Type::String), m_string(std::move(v)) {}
-    explicit NSObject(const char* v) : m_type(Type::String), m_string(v ? v : "") {}
-    explicit NSObject(const std::vector<uint8_t>& v) : m_type(Type::Data), m_data(v) {}
-    explicit NSObject(std::vector<uint8_t>&& v) : m_type(Type::Data), m_data(std::move(v)) {}
-    explicit NSObject(const ArrayType& v) : m_type(Type::Array), m_array(v) {}
-    explicit NSObject(ArrayType&& v) : m_type(Type::Array), m_array(std::move(v)) {}
-    explicit NSObject(const DictType& v) : m_type(Type::Dictionary), m_dict(v) {}
-    explicit NSObject(DictType&& v) : m_type(Type::Dictionary), m_dict(std::move(v)) {}
+    NSObject() = default;
+    explicit NSObject(bool v) : m_type(Type::Bool), m_value(v) {}
+    explicit NSObject(int32_t v) : m_type(Type::Int32), m_value(static_cast<int64_t>(v)) {}
+    explicit NSObject(int64_t v) : m_type(Type::Int64), m_value(v) {}
+    explicit NSObject(uint64_t v) : m_type(Type::UInt64), m_value(v) {}
+    explicit NSObject(float v) : m_type(Type::Float32), m_value(static_cast<double>(v)) {}
+    explicit NSObject(double v) : m_type(Type::Float64), m_value(v) {}
+    explicit NSObject(const std::string& v) : m_type(Type::String), m_value(v) {}
+    explicit NSObject(std::string&& v) : m_type(Type::String), m_value(std::move(v)) {}
+    explicit NSObject(const char* v) : m_type(Type::String), m_value(std::string(v ? v : "")) {}
+    explicit NSObject(const std::vector<uint8_t>& v) : m_type(Type::Data), m_value(v) {}
+    explicit NSObject(std::vector<uint8_t>&& v) : m_type(Type::Data), m_value(std::move(v)) {}
+    explicit NSObject(const ArrayType& v) : m_type(Type::Array), m_value(v) {}
+    explicit NSObject(ArrayType&& v) : m_type(Type::Array), m_value(std::move(v)) {}
+    explicit NSObject(const DictType& v) : m_type(Type::Dictionary), m_value(v) {}
+    explicit NSObject(DictType&& v) : m_type(Type::Dictionary), m_value(std::move(v)) {}
 
     // Named constructors for disambiguation
     static NSObject Null() { return NSObject(); }
     static NSObject Set(ArrayType items) {
-        NSObject obj;
+        NSObject obj(std::move(items));
         obj.m_type = Type::Set;
-        obj.m_array = std::move(items);
         return obj;
     }
     static NSObject MakeDict(DictType dict) {
@@ -74,62 +184,68 @@ public:
     bool IsArray() const { return m_type == Type::Array || m_type == Type::Set; }
     bool IsDict() const { return m_type == Type::Dictionary; }
 
-    // Value accessors
-    bool AsBool() const { return m_bool; }
-    int32_t AsInt32() const { return static_cast<int32_t>(m_int64); }
-    int64_t AsInt64() const { return m_int64; }
-    uint64_t AsUInt64() const { return m_uint64; }
-    float AsFloat() const { return static_cast<float>(m_float64); }
-    double AsDouble() const { return m_float64; }
-    const std::string& AsString() const { return m_string; }
-    const std::vector<uint8_t>& AsData() const { return m_data; }
-    const ArrayType& AsArray() const { return m_array; }
-    ArrayType& AsArray() { return m_array; }
-    const DictType& AsDict() const { return m_dict; }
-    DictType& AsDict() { return m_dict; }
+    // Value accessors (a mismatched type yields a zero/empty value)
+    bool AsBool() const { return Get<bool>(); }
+    int32_t AsInt32() const { return static_cast<int32_t>(Get<int64_t>()); }
+    int64_t AsInt64() const { return Get<int64_t>(); }
+    uint64_t AsUInt64() const { return Get<uint64_t>(); }
+    float AsFloat() const { return static_cast<float>(Get<double>()); }
+    double AsDouble() const { return Get<double>(); }
+    const std::string& AsString() const { return GetRef<std::string>(); }
+    const std::vector<uint8_t>& AsData() const { return GetRef<std::vector<uint8_t>>(); }
+    const ArrayType& AsArray() const { return GetRef<ArrayType>(); }
+    const DictType& AsDict() const { return GetRef<DictType>(); }
+
+    // Mutable container access; a non-container becomes an empty one
+    ArrayType& AsArray() {
+        if (!IsArray()) Reset(Type::Array, ArrayType{});
+        return std::get<ArrayType>(m_value);
+    }
+    DictType& AsDict() {
+        if (!IsDict()) Reset(Type::Dictionary, DictType{});
+        return std::get<DictType>(m_value);
+    }
 
     // Numeric conversion (best-effort)
     double ToNumber() const {
         switch (m_type) {
-            case Type::Bool:    return m_bool ? 1.0 : 0.0;
+            case Type::Bool:    return Get<bool>() ? 1.0 : 0.0;
             case Type::Int32:
-            case Type::Int64:   return static_cast<double>(m_int64);
-            case Type::UInt64:  return static_cast<double>(m_uint64);
+            case Type::Int64:   return static_cast<double>(Get<int64_t>());
+            case Type::UInt64:  return static_cast<double>(Get<uint64_t>());
             case Type::Float32:
-            case Type::Float64: return m_float64;
+            case Type::Float64: return Get<double>();
             default: return 0.0;
         }
     }
 
     // Dictionary helpers
-    bool HasKey(const std::string& key) const {
-        return m_type == Type::Dictionary && m_dict.count(key) > 0;
+    bool HasKey(std::string_view key) const {
+        return IsDict() && AsDict().count(key) > 0;
     }
 
-    const NSObject& operator[](const std::string& key) const {
-        static NSObject null;
-        if (m_type != Type::Dictionary) return null;
-        auto it = m_dict.find(key);
-        return it != m_dict.end() ? it->second : null;
+    const NSObject& operator[](std::string_view key) const {
+        static const NSObject null;
+        if (!IsDict()) return null;
+        const auto& dict = AsDict();
+        auto it = dict.find(key);
+        return it != dict.end() ? it->second : null;
     }
 
-    NSObject& operator[](const std::string& key) {
-        if (m_type != Type::Dictionary) {
-            m_type = Type::Dictionary;
-        }
-        return m_dict[key];
+    NSObject& operator[](std::string_view key) {
+        return AsDict()[key];
     }
 
     // Array helpers
     size_t Size() const {
-        if (IsArray()) return m_array.size();
-        if (IsDict()) return m_dict.size();
+        if (IsArray()) return AsArray().size();
+        if (IsDict()) return AsDict().size();
         return 0;
     }
 
     void Append(NSObject value) {
-        if (m_type == Type::Array || m_type == Type::Set) {
-            m_array.push_back(std::move(value));
+        if (IsArray()) {
+            std::get<ArrayType>(m_value).push_back(std::move(value));
         }
     }
 
@@ -137,25 +253,44 @@ public:
     std::string ToJson(int indent = 0) const;
 
     // Class metadata for NSKeyedArchiver
-    void SetClassName(const std::string& name) { m_className = name; }
-    void SetClassHierarchy(const std::vector<std::string>& hierarchy) { m_classHierarchy = hierarchy; }
-    const std::string& ClassName() const { return m_className; }
-    const std::vector<std::string>& ClassHierarchy() const { return m_classHierarchy; }
+    void SetClassName(const std::string& name);
+    void SetClassHierarchy(const std::vector<std::string>& hierarchy);
+    const std::string& ClassName() const;
+    const std::vector<std::string>& ClassHierarchy() const;
 
 private:
+    struct ClassInfo {
+        std::string name;
+        std::vector<std::string> hierarchy;
+    };
+
+    using Storage = std::variant<std::monostate, bool, int64_t, uint64_t, double, std::string,
+                                 std::vector<uint8_t>, ArrayType, DictType>;
+
+    template <typename T>
+    T Get() const {
+        const T* v = std::get_if<T>(&m_value);
+        return v ? *v : T{};
+    }
+
+    template <typename T>
+    const T& GetRef() const {
+        static const T empty{};
+        const T* v = std::get_if<T>(&m_value);
+        return v ? *v : empty;
+    }
+
+    template <typename T>
+    void Reset(Type type, T value) {
+        m_type = type;
+        m_value = std::move(value);
+    }
+
     Type m_type = Type::Null;
-    bool m_bool = false;
-    int64_t m_int64 = 0;
-    uint64_t m_uint64 = 0;
-    double m_float64 = 0.0;
-    std::string m_string;
-    std::vector<uint8_t> m_data;
-    ArrayType m_array;
-    DictType m_dict;
-
-    // NSKeyedArchiver class metadata
-    std::string m_className;
-    std::vector<std::string> m_classHierarchy;
+    Storage m_value;
+
+    // NSKeyedArchiver class metadata (shared, copy-on-write)
+    std::shared_ptr<const ClassInfo> m_classInfo;
 };
 
 } // namespace instruments
@@ -1,6 +1,9 @@
 #include "../../include/instruments/fps_service.h"
-#include "../nskeyedarchiver/nsobject.h"
+#include "../../include/instruments/dtx_method.h"
 #include "../util/log.h"
+#include <algorithm>
+#include <chrono>
+#include <future>
 
 namespace instruments {
 
@@ -8,6 +11,13 @@ static const char* TAG = "FPSService";
 static constexpr int kProbeTimeoutMs = 3000;
 static constexpr int kStartTimeoutMs = 10000;
 
+// graphics.opengl methods
+using AvailableStatistics = DTXMethod<"availableStatistics">;
+using DriverNames = DTXMethod<"driverNames">;
+using SetSamplingRate = DTXMethod<"setSamplingRate:", float>;
+using StartSampling = DTXMethod<"startSamplingAtTimeInterval:", double>;
+using StopSampling = DTXMethod<"stopSampling">;
+
 FPSService::FPSService(std::shared_ptr<DeviceConnection> connection)
     : m_connection(std::move(connection))
 {
@@ -17,15 +27,35 @@ FPSService::~FPSService() {
     Stop();
 }
 
+// setSamplingRate: takes the interval in tenths of a second
+static float SamplingRate(uint32_t intervalMs) {
+    return static_cast<float>(intervalMs) / 100.0f;
+}
+
 Error FPSService::Start(uint32_t sampleIntervalMs,
                          FPSCallback callback,
                          ErrorCallback errorCb) {
+    FPSConfig config;
+    config.sampleIntervalMs = sampleIntervalMs;
+    return Start(config, std::move(callback), std::move(errorCb));
+}
+
+Error FPSService::Start(const FPSConfig& config,
+                         FPSCallback callback,
+                         ErrorCallback errorCb) {
     if (m_running.load()) {
         Stop();
     }
 
-    // Create persistent DTX connection
-    m_dtxConnection = m_connection->CreateInstrumentConnection();
+    m_config = config;
+    m_callback = std::move(callback);
+    m_window = FPSData{};
+    m_window.samples = 0;
+    m_boosted = false;
+    m_intervalMs.store(config.sampleIntervalMs);
+
+    // Open channels on the device's shared instruments connection
+    m_dtxConnection = m_connection->SharedInstrumentConnection();
     if (!m_dtxConnection) {
         if (errorCb) errorCb(Error::ConnectionFailed, "Failed to create instrument connection");
         return Error::ConnectionFailed;
@@ -35,87 +65,69 @@ Error FPSService::Start(uint32_t sampleIntervalMs,
     m_channel = m_dtxConnection->MakeChannelWithIdentifier(ChannelId::GraphicsOpenGL);
     if (!m_channel) {
         if (errorCb) errorCb(Error::ServiceStartFailed, "Failed to create graphics channel");
-        m_dtxConnection->Disconnect();
         m_dtxConnection.reset();
         return Error::ServiceStartFailed;
     }
 
-    // Query available statistics (optional, for logging)
-    auto statsMsg = DTXMessage::CreateWithSelector("availableStatistics");
-    m_channel->SendMessageSync(statsMsg, kProbeTimeoutMs);
+    // Probe, configure and start in about one round trip: the requests are
+    // pipelined and their replies collected after start has been sent
+    const auto sent = std::chrono::steady_clock::now();
 
-    // Query driver names (optional, for logging)
-    auto driversMsg = DTXMessage::CreateWithSelector("driverNames");
-    m_channel->SendMessageSync(driversMsg, kProbeTimeoutMs);
+    // Query available statistics and driver names (optional, for logging)
+    m_channel->SendMessageAsync(AvailableStatistics::Make(), nullptr, kProbeTimeoutMs);
+    m_channel->SendMessageAsync(DriverNames::Make(), nullptr, kProbeTimeoutMs);
 
     // Set sampling rate
-    float rate = static_cast<float>(sampleIntervalMs) / 100.0f;
-    auto rateMsg = DTXMessage::CreateWithSelector("setSamplingRate:");
-    rateMsg->AppendAuxiliary(NSObject(rate));
-    auto rateResp = m_channel->SendMessageSync(rateMsg, kProbeTimeoutMs);
-    if (!rateResp) {
-        INST_LOG_WARN(TAG, "setSamplingRate timed out, continuing with device defaults");
-    }
+    auto rateReply = m_channel->SendMessageFuture(
+        SetSamplingRate::Make(SamplingRate(config.sampleIntervalMs)), kProbeTimeoutMs);
 
-    auto parseFpsMessage = [this, callback, errorCb](std::shared_ptr<DTXMessage> msg) {
+    auto parseFpsMessage = [this](std::shared_ptr<DTXMessage> msg) {
         if (!m_running.load()) return;
 
-        auto payload = msg->PayloadObject();
-        if (!payload) return;
-
+        // Samples are read straight from the archive; the statistics dict
+        // carries dozens of counters and only these are kept
         FPSData fpsData;
-
-        if (payload->IsDict()) {
-            // Parse CoreAnimationFramesPerSecond from the response
-            if (payload->HasKey("CoreAnimationFramesPerSecond")) {
-                fpsData.fps = payload->IsDict()
-                    ? (*payload)["CoreAnimationFramesPerSecond"].ToNumber()
-                    : 0.0;
-            }
-            if (payload->HasKey("DeviceUtilization")) {
-                fpsData.gpuUtilization = (*payload)["DeviceUtilization"].ToNumber();
-            }
+        fpsData.timestampUs = HostMonotonicUs();
+        const size_t found = DTXDecodeFields<FPSData>(*msg, fpsData, {
+            {"CoreAnimationFramesPerSecond", [](FPSData& d, double v) { d.fps = v; }},
+            {"DeviceUtilization", [](FPSData& d, double v) { d.gpuUtilization = v; }},
             // Alternative key names
-            if (payload->HasKey("fps")) {
-                fpsData.fps = (*payload)["fps"].ToNumber();
-            }
-            if (payload->HasKey("GpuUtilization")) {
-                fpsData.gpuUtilization = (*payload)["GpuUtilization"].ToNumber();
-            }
-        } else if (payload->IsFloat() || payload->IsInt()) {
+            {"fps", [](FPSData& d, double v) { d.fps = v; }},
+            {"GpuUtilization", [](FPSData& d, double v) { d.gpuUtilization = v; }},
+            {"XRVideoCardRunTimeStamp", [](FPSData& d, double v) { d.deviceTime = static_cast<uint64_t>(v); }},
             // Some iOS versions return just the FPS value
-            fpsData.fps = payload->ToNumber();
-        }
+            {"", [](FPSData& d, double v) { d.fps = v; }},
+        });
+        if (found == 0) return;
 
-        if (callback) callback(fpsData);
+        OnSample(fpsData);
     };
 
-    // Set message handler for streaming FPS data (channel messages)
+    // Set message handler for streaming FPS data. This also receives the
+    // updates sent on the negated channel code (-1 when this was the
+    // connection's first channel).
     m_channel->SetMessageHandler(parseFpsMessage);
 
-    // Some FPS updates arrive on the default (-1 / 0xFFFFFFFF) channel.
-    // Attach a global handler for those messages.
-    if (m_dtxConnection) {
-        m_dtxConnection->AddGlobalMessageHandler([parseFpsMessage](std::shared_ptr<DTXMessage> msg) {
-            if (!msg) return;
-            if (static_cast<int32_t>(msg->ChannelCode()) == -1) {
-                parseFpsMessage(msg);
-            }
-        });
-    }
+    // Start sampling (the device handles channel messages in order, so
+    // this still follows setSamplingRate:)
+    auto startReply = m_channel->SendMessageFuture(StartSampling::Make(0.0), kStartTimeoutMs);
 
-    // Start sampling
-    auto startMsg = DTXMessage::CreateWithSelector("startSamplingAtTimeInterval:");
-    startMsg->AppendAuxiliary(NSObject(0.0));
-    auto response = m_channel->SendMessageSync(startMsg, kStartTimeoutMs);
-    if (!response) {
+    auto waitReply = [](std::future<std::shared_ptr<DTXMessage>>& reply,
+                        std::chrono::steady_clock::time_point deadline) -> std::shared_ptr<DTXMessage> {
+        return reply.wait_until(deadline) == std::future_status::ready ? reply.get() : nullptr;
+    };
+    if (!waitReply(rateReply, sent + std::chrono::milliseconds(kProbeTimeoutMs))) {
+        INST_LOG_WARN(TAG, "setSamplingRate timed out, continuing with device defaults");
+    }
+    if (!waitReply(startReply, sent + std::chrono::milliseconds(kStartTimeoutMs))) {
         // Some iOS versions start streaming without returning a sync response.
         // Keep the session alive and rely on incoming stream messages.
         INST_LOG_WARN(TAG, "startSampling timed out, continuing and waiting for stream data");
     }
 
     m_running.store(true);
-    INST_LOG_INFO(TAG, "FPS monitoring started (interval=%ums)", sampleIntervalMs);
+    INST_LOG_INFO(TAG, "FPS monitoring started (interval=%ums, window=%ums%s)",
+                  config.sampleIntervalMs, config.windowMs, config.adaptive ? ", adaptive" : "");
 
     return Error::Success;
 }
@@ -127,16 +139,79 @@ void FPSService::Stop() {
     INST_LOG_INFO(TAG, "Stopping FPS monitoring");
 
     if (m_channel) {
-        auto stopMsg = DTXMessage::CreateWithSelector("stopSampling");
-        m_channel->SendMessageSync(stopMsg, 2000);
-        m_channel->Cancel();
+        m_channel->SendMessageSync(StopSampling::Make(), 2000);
+        m_dtxConnection->CloseChannel(m_channel);
         m_channel.reset();
     }
 
-    if (m_dtxConnection) {
-        m_dtxConnection->Disconnect();
-        m_dtxConnection.reset();
+    // The handler cannot run any more
+    FlushWindow();
+
+    // Other services may still use the connection; it closes with the last one
+    m_dtxConnection.reset();
+}
+
+void FPSService::OnSample(FPSData sample) {
+    sample.fpsMin = sample.fps;
+    sample.fpsMax = sample.fps;
+    sample.samples = 1;
+
+    if (m_config.adaptive) Adapt(sample);
+
+    if (m_config.windowMs == 0) {
+        if (m_callback) m_callback(sample);
+        return;
+    }
+
+    // Running sums; divided by the count when the window is delivered
+    FPSData& w = m_window;
+    if (w.samples == 0) {
+        w = sample;
+        m_windowStartUs = sample.timestampUs;
+    } else {
+        w.fps += sample.fps;
+        w.gpuUtilization += sample.gpuUtilization;
+        w.fpsMin = std::min(w.fpsMin, sample.fps);
+        w.fpsMax = std::max(w.fpsMax, sample.fps);
+        w.timestampUs = sample.timestampUs;
+        w.deviceTime = sample.deviceTime;
+        w.samples++;
     }
+    if (sample.timestampUs - m_windowStartUs >= uint64_t{m_config.windowMs} * 1000) {
+        FlushWindow();
+    }
+}
+
+void FPSService::FlushWindow() {
+    if (m_window.samples == 0) return;
+    FPSData out = m_window;
+    out.fps /= out.samples;
+    out.gpuUtilization /= out.samples;
+    m_window.samples = 0;
+    if (m_callback) m_callback(out);
+}
+
+void FPSService::Adapt(const FPSData& sample) {
+    const bool drop = sample.fps > 0.0 && sample.fps < m_config.adaptiveBelowFps;
+    if (drop) m_lastDropUs = sample.timestampUs;
+
+    if (!m_boosted && drop) {
+        m_boosted = true;
+        INST_LOG_INFO(TAG, "FPS %.1f below %.1f, sampling every %ums",
+                      sample.fps, m_config.adaptiveBelowFps, m_config.adaptiveIntervalMs);
+        SetSamplingInterval(m_config.adaptiveIntervalMs);
+    } else if (m_boosted && !drop &&
+               sample.timestampUs - m_lastDropUs >= uint64_t{m_config.adaptiveHoldMs} * 1000) {
+        m_boosted = false;
+        INST_LOG_INFO(TAG, "FPS recovered, sampling every %ums", m_config.sampleIntervalMs);
+        SetSamplingInterval(m_config.sampleIntervalMs);
+    }
+}
+
+void FPSService::SetSamplingInterval(uint32_t intervalMs) {
+    if (!m_channel || m_intervalMs.exchange(intervalMs) == intervalMs) return;
+    // On the receive thread: never wait for the reply
+    m_channel->SendMessageAsync(SetSamplingRate::Make(SamplingRate(intervalMs)), nullptr, kProbeTimeoutMs);
 }
 
 } // namespace instruments
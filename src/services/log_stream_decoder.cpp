@@ -0,0 +1,129 @@
+#include "log_stream_decoder.h"
+#include <cstring>
+
+namespace instruments {
+
+namespace {
+
+constexpr size_t kRecordHeaderSize = 24;   // after the length field
+constexpr size_t kFieldHeaderSize = 4;
+
+enum RecordKind : uint8_t {
+    kKindLog = 0,
+    kKindSignpost = 1,
+    kKindProcessName = 2,
+};
+
+enum FieldTag : uint8_t {
+    kTagProcess = 1,
+    kTagSubsystem = 2,
+    kTagCategory = 3,
+    kTagMessage = 4,
+};
+
+inline uint16_t Read16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;   // the tap and every supported host are little-endian
+}
+
+inline uint64_t Read64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+} // namespace
+
+bool LogStreamDecoder::Decode(const uint8_t* data, size_t length, std::vector<LogRecordView>& out) {
+    out.clear();
+    size_t pos = 0;
+    while (pos < length) {
+        if (length - pos < 4) {
+            m_malformed++;
+            ResolveProcessNames(out);
+            return false;
+        }
+        const size_t recordLen = Read32(data + pos);
+        pos += 4;
+        if (recordLen > length - pos || recordLen < kRecordHeaderSize) {
+            m_malformed++;
+            ResolveProcessNames(out);
+            return false;
+        }
+        const uint8_t* rec = data + pos;
+        const uint8_t* end = rec + recordLen;
+        pos += recordLen;
+
+        const uint8_t kind = rec[0];
+        if (kind != kKindLog && kind != kKindSignpost && kind != kKindProcessName) continue;
+
+        LogRecordView view;
+        view.signpost = kind == kKindSignpost;
+        view.type = static_cast<OSLogType>(rec[1]);
+        const uint16_t fieldCount = Read16(rec + 2);
+        view.machTime = Read64(rec + 4);
+        view.pid = static_cast<int64_t>(Read32(rec + 12));
+        view.tid = Read64(rec + 16);
+
+        const uint8_t* field = rec + kRecordHeaderSize;
+        bool truncated = false;
+        for (uint16_t i = 0; i < fieldCount; i++) {
+            if (static_cast<size_t>(end - field) < kFieldHeaderSize) {
+                truncated = true;
+                break;
+            }
+            const uint8_t tag = field[0];
+            const size_t size = Read16(field + 2);
+            field += kFieldHeaderSize;
+            if (static_cast<size_t>(end - field) < size) {
+                truncated = true;
+                break;
+            }
+            // Strings may carry their C terminator
+            size_t textLen = size;
+            while (textLen > 0 && field[textLen - 1] == 0) textLen--;
+            const std::string_view text(reinterpret_cast<const char*>(field), textLen);
+            switch (tag) {
+                case kTagProcess:   view.process = text; break;
+                case kTagSubsystem: view.subsystem = text; break;
+                case kTagCategory:  view.category = text; break;
+                case kTagMessage:   view.message = text; break;
+                default: break;
+            }
+            field += size;
+        }
+        if (truncated) {
+            m_malformed++;
+            continue;
+        }
+
+        if (kind == kKindProcessName) {
+            if (!view.process.empty()) {
+                std::string& name = m_processNames[view.pid];
+                if (name != view.process) name.assign(view.process);
+            }
+            continue;
+        }
+        out.push_back(view);
+    }
+    ResolveProcessNames(out);
+    return true;
+}
+
+// After the whole payload, so no later name record in it can reassign a
+// string a view points into
+void LogStreamDecoder::ResolveProcessNames(std::vector<LogRecordView>& records) const {
+    if (m_processNames.empty()) return;
+    for (auto& record : records) {
+        if (!record.process.empty()) continue;
+        auto it = m_processNames.find(record.pid);
+        if (it != m_processNames.end()) record.process = it->second;
+    }
+}
+
+} // namespace instruments
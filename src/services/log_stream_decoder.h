@@ -0,0 +1,91 @@
+#ifndef INSTRUMENTS_LOG_STREAM_DECODER_H
+#define INSTRUMENTS_LOG_STREAM_DECODER_H
+
+#include "../../include/instruments/types.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace instruments {
+
+// One log record as decoded, viewing the message payload (and, for the
+// process name, the decoder's pid table)
+struct LogRecordView {
+    bool signpost = false;
+    OSLogType type = OSLogType::Default;
+    uint64_t machTime = 0;
+    int64_t pid = 0;
+    uint64_t tid = 0;
+    std::string_view process;
+    std::string_view subsystem;
+    std::string_view category;
+    std::string_view message;
+};
+
+// LogStreamDecoder - EXPERIMENTAL, UNVERIFIED. Decodes a packed record
+// layout assumed for activitytracetap data messages. The layout below was
+// not derived from or checked against captured device traffic and is not
+// known to match the tap's real wire format; LogStreamService uses this
+// decoder only when LogStreamConfig::experimentalDecoder is set. Replace
+// it once .dtxcap captures of the channel have been examined.
+//
+// Assumed payload: a run of packed little-endian records, not an archive:
+//
+//   u32 length      bytes after this field
+//   u8  kind        0 = os_log, 1 = os_signpost, 2 = pid -> process name
+//   u8  type        OSLogType
+//   u16 fieldCount
+//   u64 machTime    mach continuous ticks
+//   u32 pid
+//   u64 tid
+//   fieldCount x { u8 tag, u8 flags, u16 size, size bytes }
+//
+// Field tags: 1 process, 2 subsystem, 3 category, 4 message (formatted
+// text). Unknown kinds and tags are skipped by their length, so newer
+// devices adding fields still decode. Name records (enabled by
+// trackPidToExecNameMapping) fill a pid table used when a log record
+// carries no process field.
+//
+// Decode() does not allocate once the output vector has grown; it runs on
+// the receive thread and is not thread-safe.
+class LogStreamDecoder {
+public:
+    // Timebase sent in the tap config (machTimebaseNumer / Denom)
+    void SetTimebase(uint32_t numer, uint32_t denom) {
+        m_numer = numer;
+        m_denom = denom ? denom : 1;
+    }
+
+    uint64_t ToNanoseconds(uint64_t machTime) const {
+        return machTime / m_denom * m_numer + machTime % m_denom * m_numer / m_denom;
+    }
+
+    // Replace out with the log and signpost records of one payload. Views
+    // are valid while the payload lives and until the next Decode().
+    // Returns false if the payload ended inside a record (the complete
+    // records before it are still returned).
+    bool Decode(const uint8_t* data, size_t length, std::vector<LogRecordView>& out);
+
+    // Records cut short or otherwise malformed so far
+    uint64_t Malformed() const { return m_malformed; }
+
+    void Reset() {
+        m_processNames.clear();
+        m_malformed = 0;
+    }
+
+private:
+    void ResolveProcessNames(std::vector<LogRecordView>& records) const;
+
+    uint32_t m_numer = 1;
+    uint32_t m_denom = 1;
+    std::unordered_map<int64_t, std::string> m_processNames;
+    uint64_t m_malformed = 0;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_LOG_STREAM_DECODER_H
@@ -0,0 +1,259 @@
+#include "../../include/instruments/log_stream_service.h"
+#include "../nskeyedarchiver/nsobject.h"
+#include "../util/log.h"
+#include "log_stream_decoder.h"
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+namespace instruments {
+
+static const char* TAG = "LogStreamService";
+
+// Timebase sent with the config; the tap reports mach ticks in it
+// (24 MHz: 125/3 ns per tick)
+static constexpr uint32_t kTimebaseNumer = 125;
+static constexpr uint32_t kTimebaseDenom = 3;
+
+static const char* kAllMessageTypes =
+    "(messageType == info OR messageType == debug OR messageType == default"
+    " OR messageType == error OR messageType == fault)";
+
+namespace {
+
+// LogRing - fixed ring of LogEntry slots between the receive thread and
+// the consumer. Entries are filled in place and swapped out in batches, so
+// their strings keep their capacity and steady-state streaming does not
+// allocate. A full ring overwrites its oldest entry.
+class LogRing {
+public:
+    void Reset(size_t capacity) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots.assign(capacity ? capacity : 1, LogEntry{});
+        m_head = 0;
+        m_tail = 0;
+        m_dropped = 0;
+        m_stopping = false;
+    }
+
+    void Push(const std::vector<LogRecordView>& records, const LogStreamDecoder& decoder,
+              uint64_t timestampUs) {
+        if (records.empty()) return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const size_t capacity = m_slots.size();
+            for (const auto& record : records) {
+                if (m_tail - m_head == capacity) {
+                    m_head++;
+                    m_dropped++;
+                }
+                LogEntry& entry = m_slots[m_tail++ % capacity];
+                entry.timestampUs = timestampUs;
+                entry.deviceTimeNs = decoder.ToNanoseconds(record.machTime);
+                entry.pid = record.pid;
+                entry.tid = record.tid;
+                entry.type = record.type;
+                entry.signpost = record.signpost;
+                entry.process.assign(record.process);
+                entry.subsystem.assign(record.subsystem);
+                entry.category.assign(record.category);
+                entry.message.assign(record.message);
+            }
+        }
+        m_cv.notify_one();
+    }
+
+    // Wait for entries and swap them into batch[0, n). Returns 0 once stopping.
+    size_t PopBatch(std::vector<LogEntry>& batch) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_stopping || m_tail != m_head; });
+        if (m_stopping) return 0;
+        const size_t n = m_tail - m_head;
+        if (batch.size() < n) batch.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            std::swap(batch[i], m_slots[m_head++ % m_slots.size()]);
+        }
+        return n;
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+    }
+
+    uint64_t Dropped() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_tail - m_head;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<LogEntry> m_slots;
+    uint64_t m_head = 0;
+    uint64_t m_tail = 0;
+    uint64_t m_dropped = 0;
+    bool m_stopping = false;
+};
+
+} // namespace
+
+// Shared with the channel handler, which may run once more after Stop()
+struct LogStreamService::State {
+    LogStreamDecoder decoder;               // receive thread only
+    std::vector<LogRecordView> records;     // receive thread only
+    LogRing ring;
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<uint64_t> malformed{0};
+    std::atomic<uint64_t> undecoded{0};
+};
+
+LogStreamService::LogStreamService(std::shared_ptr<DeviceConnection> connection)
+    : m_connection(std::move(connection))
+    , m_state(std::make_shared<State>())
+{
+}
+
+LogStreamService::~LogStreamService() {
+    Stop();
+}
+
+Error LogStreamService::Start(const LogStreamConfig& config,
+                              LogEntryCallback callback,
+                              ErrorCallback errorCb) {
+    if (m_running.load()) {
+        Stop();
+    }
+
+    m_dtxConnection = m_connection->SharedInstrumentConnection();
+    if (!m_dtxConnection) {
+        if (errorCb) errorCb(Error::ConnectionFailed, "Failed to create instrument connection");
+        return Error::ConnectionFailed;
+    }
+
+    m_channel = m_dtxConnection->MakeChannelWithIdentifier(ChannelId::ActivityTraceTap);
+    if (!m_channel) {
+        if (errorCb) errorCb(Error::ServiceStartFailed, "Failed to create activitytracetap channel");
+        m_dtxConnection.reset();
+        return Error::ServiceStartFailed;
+    }
+
+    auto state = std::make_shared<State>();
+    state->decoder.SetTimebase(kTimebaseNumer, kTimebaseDenom);
+    state->ring.Reset(config.bufferEntries);
+    m_state = state;
+
+    // Data messages carry binary records in the raw payload; the payload is
+    // never unarchived and the auxiliary section never touched. The first
+    // message after start (and status updates) is a keyed archive instead.
+    // Without the experimental decoder they are only counted.
+    const bool decode = config.experimentalDecoder;
+    if (!decode) {
+        INST_LOG_INFO(TAG, "activitytracetap data is not decoded (no verified decoder; "
+                           "see LogStreamConfig::experimentalDecoder)");
+    }
+    m_channel->SetMessageHandler([state, decode](std::shared_ptr<DTXMessage> msg) {
+        const std::vector<uint8_t>& payload = msg->RawPayload();
+        if (payload.size() < 8 || std::memcmp(payload.data(), "bplist", 6) == 0) return;
+        if (!decode) {
+            state->undecoded.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        const uint64_t malformedBefore = state->decoder.Malformed();
+        state->decoder.Decode(payload.data(), payload.size(), state->records);
+        const uint64_t malformed = state->decoder.Malformed() - malformedBefore;
+        if (malformed > 0) {
+            state->malformed.fetch_add(malformed, std::memory_order_relaxed);
+            INST_LOG_DEBUG(TAG, "Skipped %llu malformed log records",
+                           static_cast<unsigned long long>(malformed));
+        }
+        state->received.fetch_add(state->records.size(), std::memory_order_relaxed);
+        state->ring.Push(state->records, state->decoder, HostMonotonicUs());
+    });
+
+    m_running.store(true);
+    m_consumer = std::thread([state, callback]() {
+        std::vector<LogEntry> batch;
+        size_t n;
+        while ((n = state->ring.PopBatch(batch)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                if (callback) callback(batch[i]);
+            }
+            state->delivered.fetch_add(n, std::memory_order_relaxed);
+        }
+    });
+
+    // Filtering is pushed to the device through the predicate
+    std::string predicate = kAllMessageTypes;
+    if (!config.predicate.empty()) {
+        predicate += " AND (" + config.predicate + ")";
+    }
+
+    NSObject::DictType tapConfig;
+    tapConfig["bm"] = NSObject(static_cast<int64_t>(0));
+    tapConfig["combineDataScope"] = NSObject(static_cast<int64_t>(0));
+    tapConfig["machTimebaseNumer"] = NSObject(static_cast<int64_t>(kTimebaseNumer));
+    tapConfig["machTimebaseDenom"] = NSObject(static_cast<int64_t>(kTimebaseDenom));
+    tapConfig["onlySignposts"] = NSObject(static_cast<int64_t>(0));
+    tapConfig["pidToInjectCombineDYLIB"] = NSObject("-1");
+    tapConfig["predicate"] = NSObject(predicate);
+    tapConfig["signpostsAndLogs"] = NSObject(static_cast<int64_t>(config.signposts ? 1 : 0));
+    tapConfig["trackPidToExecNameMapping"] = NSObject(true);
+    tapConfig["enableHTTPArchiveLogging"] = NSObject(false);
+    tapConfig["targetPID"] = NSObject(static_cast<int64_t>(config.pid >= 0 ? config.pid : -3));
+    tapConfig["trackExpiredPIDs"] = NSObject(static_cast<int64_t>(1));
+    tapConfig["ur"] = NSObject(static_cast<int64_t>(500));
+
+    // The tap does not answer setConfig:/start
+    auto configMsg = DTXMessage::CreateWithSelector("setConfig:");
+    configMsg->AppendAuxiliary(NSObject(std::move(tapConfig)));
+    m_channel->SendMessageAsync(configMsg);
+    m_channel->SendMessageAsync(DTXMessage::CreateWithSelector("start"));
+
+    INST_LOG_INFO(TAG, "Log streaming started (pid=%lld, buffer=%zu%s)",
+                  static_cast<long long>(config.pid), config.bufferEntries,
+                  decode ? ", experimental decoder" : "");
+    return Error::Success;
+}
+
+void LogStreamService::Stop() {
+    m_running.store(false);
+    if (!m_channel && !m_dtxConnection && !m_consumer.joinable()) return;
+
+    INST_LOG_INFO(TAG, "Stopping log streaming");
+
+    if (m_channel) {
+        m_channel->SendMessageAsync(DTXMessage::CreateWithSelector("clear"));
+        m_dtxConnection->CloseChannel(m_channel);
+        m_channel.reset();
+    }
+
+    m_state->ring.Stop();
+    if (m_consumer.joinable()) m_consumer.join();
+
+    // Other services may still use the connection; it closes with the last one
+    m_dtxConnection.reset();
+}
+
+LogStreamStats LogStreamService::Stats() const {
+    LogStreamStats stats;
+    stats.received = m_state->received.load(std::memory_order_relaxed);
+    stats.delivered = m_state->delivered.load(std::memory_order_relaxed);
+    stats.malformed = m_state->malformed.load(std::memory_order_relaxed);
+    stats.undecoded = m_state->undecoded.load(std::memory_order_relaxed);
+    stats.dropped = m_state->ring.Dropped();
+    stats.buffered = m_state->ring.Size();
+    return stats;
+}
+
+} // namespace instruments
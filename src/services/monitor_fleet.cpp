@@ -0,0 +1,345 @@
+#include "../../include/instruments/monitor_fleet.h"
+#include "../util/log.h"
+#include <algorithm>
+#include <chrono>
+
+namespace instruments {
+
+static const char* TAG = "MonitorFleet";
+
+static uint64_t NowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+struct MonitorFleet::Device {
+    size_t index = 0;
+    std::string udid;
+    std::shared_ptr<DeviceConnection> connection;
+
+    // Held while bringing the device up or down
+    std::mutex opMutex;
+    std::unique_ptr<PerformanceService> perf;
+    std::unique_ptr<FPSService> fps;
+    bool removed = false;
+
+    std::atomic<FleetDeviceState> state{FleetDeviceState::Pending};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> lastSampleUs{0};
+    std::atomic<uint64_t> runningSinceUs{0};
+
+    mutable std::mutex errorMutex;
+    std::string lastError;
+};
+
+MonitorFleet::MonitorFleet(FleetConfig config, FleetSink sink)
+    : m_config(std::move(config))
+    , m_sink(std::move(sink))
+{
+}
+
+MonitorFleet::~MonitorFleet() {
+    Stop();
+}
+
+size_t MonitorFleet::AddDevice(const std::string& udid) {
+    auto device = std::make_shared<Device>();
+    device->udid = udid;
+    return Add(std::move(device));
+}
+
+size_t MonitorFleet::AddDevice(std::shared_ptr<DeviceConnection> connection) {
+    auto device = std::make_shared<Device>();
+    device->udid = connection ? connection->GetDeviceInfo().udid : std::string();
+    device->connection = std::move(connection);
+    return Add(std::move(device));
+}
+
+size_t MonitorFleet::Add(std::shared_ptr<Device> device) {
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(m_devicesMutex);
+        index = m_devices.size();
+        device->index = index;
+        m_devices.push_back(std::move(device));
+    }
+    if (m_running.load()) Enqueue(index);
+    return index;
+}
+
+std::shared_ptr<MonitorFleet::Device> MonitorFleet::Get(size_t device) const {
+    std::lock_guard<std::mutex> lock(m_devicesMutex);
+    return device < m_devices.size() ? m_devices[device] : nullptr;
+}
+
+size_t MonitorFleet::DeviceCount() const {
+    std::lock_guard<std::mutex> lock(m_devicesMutex);
+    return m_devices.size();
+}
+
+void MonitorFleet::Enqueue(size_t device) {
+    {
+        std::lock_guard<std::mutex> lock(m_setupMutex);
+        m_setupQueue.push_back(device);
+    }
+    m_setupCv.notify_one();
+}
+
+Error MonitorFleet::Start() {
+    if (m_running.exchange(true)) return Error::Success;
+    if (!m_sink) {
+        m_running.store(false);
+        return Error::InvalidArgument;
+    }
+
+    m_reactor = DTXReactor::Create(m_config.ioThreads);
+    m_deliveryStopping = false;
+    m_deliveryThread = std::thread([this]() { DeliveryLoop(); });
+    const size_t setupThreads = m_config.setupThreads ? m_config.setupThreads : 1;
+    for (size_t i = 0; i < setupThreads; i++) {
+        m_setupThreads.emplace_back([this]() { SetupLoop(); });
+    }
+
+    const size_t count = DeviceCount();
+    for (size_t i = 0; i < count; i++) Enqueue(i);
+    INST_LOG_INFO(TAG, "Fleet started: %zu devices, %zu I/O threads, %zu setup threads",
+                  count, m_reactor->ThreadCount(), setupThreads);
+    return Error::Success;
+}
+
+void MonitorFleet::Stop() {
+    if (!m_running.exchange(false)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_setupMutex);
+        m_setupQueue.clear();
+    }
+    m_setupCv.notify_all();
+    for (auto& thread : m_setupThreads) thread.join();
+    m_setupThreads.clear();
+
+    std::vector<std::shared_ptr<Device>> devices;
+    {
+        std::lock_guard<std::mutex> lock(m_devicesMutex);
+        devices = m_devices;
+    }
+    for (auto& device : devices) {
+        std::lock_guard<std::mutex> lock(device->opMutex);
+        StopDevice(*device);
+    }
+
+    // Delivers what is still pending, then exits
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        m_deliveryStopping = true;
+    }
+    m_pendingCv.notify_all();
+    if (m_deliveryThread.joinable()) m_deliveryThread.join();
+    m_reactor.reset();
+    INST_LOG_INFO(TAG, "Fleet stopped");
+}
+
+void MonitorFleet::RemoveDevice(size_t index) {
+    auto device = Get(index);
+    if (!device) return;
+    std::lock_guard<std::mutex> lock(device->opMutex);
+    device->removed = true;
+    StopDevice(*device);
+}
+
+void MonitorFleet::RestartDevice(size_t index) {
+    auto device = Get(index);
+    if (!device) return;
+    {
+        std::lock_guard<std::mutex> lock(device->opMutex);
+        if (device->removed) return;
+        StopDevice(*device);
+        device->state.store(FleetDeviceState::Pending);
+    }
+    if (m_running.load()) Enqueue(index);
+}
+
+void MonitorFleet::SetupLoop() {
+    for (;;) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(m_setupMutex);
+            m_setupCv.wait(lock, [this]() { return !m_running.load() || !m_setupQueue.empty(); });
+            if (!m_running.load()) return;
+            index = m_setupQueue.front();
+            m_setupQueue.pop_front();
+        }
+        auto device = Get(index);
+        if (!device) continue;
+        std::lock_guard<std::mutex> lock(device->opMutex);
+        if (device->removed || !m_running.load()) continue;
+        if (device->state.load() == FleetDeviceState::Running) continue;
+        SetupDevice(*device);
+    }
+}
+
+void MonitorFleet::SetupDevice(Device& device) {
+    device.state.store(FleetDeviceState::Connecting);
+
+    if (!device.connection) {
+        device.connection = DeviceConnection::FromUDID(device.udid);
+        if (!device.connection) {
+            Fail(device, "Device not found or not reachable");
+            return;
+        }
+    }
+    // Connections created from here on register with the shared reactor
+    device.connection->SetReactor(m_reactor);
+    device.connection->SetMemoryBudget(m_config.memoryBudget);
+    device.connection->SetTimeoutPolicy(m_config.timeoutPolicy);
+
+    auto onError = [this, &device](Error, const std::string& message) { Fail(device, message); };
+
+    if (m_config.performance) {
+        device.perf = std::make_unique<PerformanceService>(device.connection);
+        Error err = device.perf->Start(
+            m_config.perf,
+            [this, &device](const SystemMetrics& metrics) {
+                FleetSample sample;
+                sample.kind = FleetSample::Kind::System;
+                sample.system = metrics;
+                Push(device, std::move(sample));
+            },
+            [this, &device](const std::vector<ProcessMetrics>& processes) {
+                FleetSample sample;
+                sample.kind = FleetSample::Kind::Processes;
+                sample.processes = processes;
+                Push(device, std::move(sample));
+            },
+            onError);
+        if (err != Error::Success) {
+            Fail(device, "Performance monitoring failed to start");
+            StopDevice(device);
+            return;
+        }
+    }
+
+    if (m_config.fps) {
+        device.fps = std::make_unique<FPSService>(device.connection);
+        Error err = device.fps->Start(
+            m_config.fpsConfig,
+            [this, &device](const FPSData& data) {
+                FleetSample sample;
+                sample.kind = FleetSample::Kind::FPS;
+                sample.fps = data;
+                Push(device, std::move(sample));
+            },
+            onError);
+        if (err != Error::Success) {
+            Fail(device, "FPS monitoring failed to start");
+            StopDevice(device);
+            return;
+        }
+    }
+
+    device.runningSinceUs.store(NowUs());
+    device.state.store(FleetDeviceState::Running);
+    INST_LOG_INFO(TAG, "Device %zu (%s) running", device.index, device.udid.c_str());
+}
+
+// Called with device.opMutex held. Stopping a service waits for its
+// in-flight handler, so no callback touches the device afterwards.
+void MonitorFleet::StopDevice(Device& device) {
+    if (device.perf) {
+        device.perf->Stop();
+        device.perf.reset();
+    }
+    if (device.fps) {
+        device.fps->Stop();
+        device.fps.reset();
+    }
+    if (device.state.load() != FleetDeviceState::Failed) {
+        device.state.store(FleetDeviceState::Stopped);
+    }
+}
+
+void MonitorFleet::Fail(Device& device, const std::string& message) {
+    device.errors.fetch_add(1);
+    device.state.store(FleetDeviceState::Failed);
+    {
+        std::lock_guard<std::mutex> lock(device.errorMutex);
+        device.lastError = message;
+    }
+    INST_LOG_WARN(TAG, "Device %zu (%s): %s", device.index, device.udid.c_str(), message.c_str());
+}
+
+void MonitorFleet::Push(Device& device, FleetSample&& sample) {
+    sample.device = device.index;
+    sample.hostTimeUs = NowUs();
+    device.lastSampleUs.store(sample.hostTimeUs);
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        if (m_pending.size() >= m_config.maxPendingSamples) {
+            device.dropped.fetch_add(1);
+            return;
+        }
+        m_pending.push_back(std::move(sample));
+    }
+    device.samples.fetch_add(1);
+}
+
+void MonitorFleet::DeliveryLoop() {
+    const auto interval = std::chrono::milliseconds(m_config.batchIntervalMs);
+    std::vector<FleetSample> batch;
+    for (;;) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(m_pendingMutex);
+            m_pendingCv.wait_for(lock, interval, [this]() { return m_deliveryStopping; });
+            stopping = m_deliveryStopping;
+            batch.swap(m_pending);
+        }
+        if (!batch.empty()) m_sink(batch);
+        batch.clear();
+        if (stopping) return;
+    }
+}
+
+FleetDeviceHealth MonitorFleet::HealthOf(const Device& device, uint64_t nowUs) const {
+    FleetDeviceHealth health;
+    health.udid = device.udid;
+    health.state = device.state.load();
+    health.samples = device.samples.load();
+    health.dropped = device.dropped.load();
+    health.errors = device.errors.load();
+    health.lastSampleUs = device.lastSampleUs.load();
+    {
+        std::lock_guard<std::mutex> lock(device.errorMutex);
+        health.lastError = device.lastError;
+    }
+    if (health.state == FleetDeviceState::Running && m_config.stallTimeoutMs > 0) {
+        // Measured from the last sample, or from startup for a silent device
+        const uint64_t last = std::max(health.lastSampleUs, device.runningSinceUs.load());
+        if (nowUs > last + uint64_t{m_config.stallTimeoutMs} * 1000) {
+            health.state = FleetDeviceState::Stalled;
+        }
+    }
+    return health;
+}
+
+FleetDeviceHealth MonitorFleet::Health(size_t index) const {
+    auto device = Get(index);
+    return device ? HealthOf(*device, NowUs()) : FleetDeviceHealth{};
+}
+
+std::vector<FleetDeviceHealth> MonitorFleet::Health() const {
+    std::vector<std::shared_ptr<Device>> devices;
+    {
+        std::lock_guard<std::mutex> lock(m_devicesMutex);
+        devices = m_devices;
+    }
+    const uint64_t now = NowUs();
+    std::vector<FleetDeviceHealth> out;
+    out.reserve(devices.size());
+    for (const auto& device : devices) out.push_back(HealthOf(*device, now));
+    return out;
+}
+
+} // namespace instruments
@@ -0,0 +1,535 @@
+#include "../../include/instruments/perf_log.h"
+#include "../util/log.h"
+#include "../util/lz4.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace instruments {
+
+static const char* TAG = "PerfLog";
+
+// File: "INSPERF1" + u32 version + u32 reserved, then blocks.
+// Block: u32 magic, u32 storedSize, u32 rawSize, u32 sampleCount, u32 flags,
+// then storedSize bytes (LZ4 block of rawSize bytes when kBlockLZ4 is set).
+// Raw block: varint name count, names (varint length + bytes), one varint
+// byte length per column, then the columns back to back.
+static constexpr char kFileMagic[8] = {'I', 'N', 'S', 'P', 'E', 'R', 'F', '1'};
+static constexpr uint32_t kFileVersion = 1;
+static constexpr size_t kFileHeaderSize = 16;
+static constexpr uint32_t kBlockMagic = 0x4B4C4250;   // "PBLK"
+static constexpr size_t kBlockHeaderSize = 20;
+static constexpr uint32_t kBlockLZ4 = 1;
+static constexpr uint32_t kSampleHasSystem = 1;
+
+namespace {
+
+enum Column {
+    // One entry per sample
+    SampleTime, SampleRows, SampleFlags,
+    // One entry per sample with system metrics
+    SysCpuTotal, SysCpuUser, SysCpuSystem, SysCpuCount, SysEnabledCPUs,
+    SysMemUsed, SysMemFree, SysDiskRead, SysDiskWritten,
+    SysNetBytesIn, SysNetBytesOut, SysNetPacketsIn, SysNetPacketsOut,
+    // One entry per process row
+    ProcPid, ProcName, ProcCpu, ProcMemResident, ProcMemAnon, ProcMemVirtual,
+    ProcDiskRead, ProcDiskWritten, ProcThreads,
+    ColumnCount
+};
+
+constexpr int kSystemColumns = SysNetPacketsOut - SysCpuTotal + 1;
+constexpr int kProcessCounters = ProcThreads - ProcCpu + 1;
+
+// Loads are kept to hundredths of a percent
+int64_t Quantize(double load) { return static_cast<int64_t>(std::llround(load * 100.0)); }
+double Dequantize(int64_t value) { return static_cast<double>(value) / 100.0; }
+
+void PutVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Counters are unsigned but may go backwards (device reboot, pid reuse);
+// the wrapped difference zigzags to a small varint either way
+void PutDelta(std::vector<uint8_t>& out, uint64_t value, uint64_t& previous) {
+    const int64_t delta = static_cast<int64_t>(value - previous);
+    previous = value;
+    PutVarint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+}
+
+void PutU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+uint32_t GetU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+struct Cursor {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    uint64_t Varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) break;
+            const uint8_t byte = *p++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        ok = false;
+        return 0;
+    }
+
+    uint64_t Delta(uint64_t& previous) {
+        const uint64_t zz = Varint();
+        previous += (zz >> 1) ^ (~(zz & 1) + 1);
+        return previous;
+    }
+};
+
+// Previous row of one pid
+struct ProcessCounters {
+    uint64_t values[kProcessCounters] = {};
+};
+
+uint64_t NowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+} // namespace
+
+// Encoder state for the block being built; reset for every block so each
+// one decodes on its own
+struct PerfLogWriter::Block {
+    std::vector<uint8_t> columns[ColumnCount];
+    std::unordered_map<std::string, uint32_t> nameIds;
+    std::vector<const std::string*> names;     // keys of nameIds, by id
+    std::unordered_map<int64_t, ProcessCounters> procs;
+    uint64_t time = 0;
+    uint64_t system[kSystemColumns] = {};
+    uint64_t pid = 0;
+    uint32_t sampleCount = 0;
+
+    std::vector<uint8_t> raw;           // serialization scratch
+    std::vector<uint8_t> compressed;
+
+    void Reset() {
+        for (auto& column : columns) column.clear();
+        nameIds.clear();
+        names.clear();
+        procs.clear();
+        time = 0;
+        std::memset(system, 0, sizeof(system));
+        pid = 0;
+        sampleCount = 0;
+    }
+};
+
+PerfLogWriter::PerfLogWriter() = default;
+
+PerfLogWriter::~PerfLogWriter() {
+    Close();
+}
+
+Error PerfLogWriter::Open(const std::string& path, const PerfLogOptions& options) {
+    if (path.empty() || options.samplesPerBlock == 0) return Error::InvalidArgument;
+    Close();
+
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file) {
+        INST_LOG_ERROR(TAG, "Cannot create %s", path.c_str());
+        return Error::InternalError;
+    }
+    // Writes are already batched into m_out
+    std::setvbuf(m_file, nullptr, _IONBF, 0);
+
+    m_options = options;
+    m_block = std::make_unique<Block>();
+    m_out.clear();
+    m_out.reserve(options.writeBufferBytes);
+    m_out.insert(m_out.end(), kFileMagic, kFileMagic + sizeof(kFileMagic));
+    PutU32(m_out, kFileVersion);
+    PutU32(m_out, 0);
+    m_samplesWritten.store(0);
+    m_samplesDropped.store(0);
+    m_closing = false;
+
+    m_thread = std::thread([this]() { WriterLoop(); });
+    INST_LOG_INFO(TAG, "Recording samples to %s", path.c_str());
+    return Error::Success;
+}
+
+void PerfLogWriter::Append(PerfLogSample sample) {
+    if (sample.timestampUs == 0) sample.timestampUs = NowUs();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file || m_closing) return;
+        if (m_queue.size() >= m_options.maxQueuedSamples) {
+            m_samplesDropped.fetch_add(1);
+            return;
+        }
+        m_queue.push_back(std::move(sample));
+    }
+    m_cv.notify_one();
+}
+
+void PerfLogWriter::Close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file) return;
+        m_closing = true;
+    }
+    m_cv.notify_one();
+    if (m_thread.joinable()) m_thread.join();
+
+    std::fclose(m_file);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = nullptr;
+    m_block.reset();
+    m_out = {};
+    INST_LOG_INFO(TAG, "Recording closed (%llu samples, %llu dropped)",
+                  static_cast<unsigned long long>(m_samplesWritten.load()),
+                  static_cast<unsigned long long>(m_samplesDropped.load()));
+}
+
+void PerfLogWriter::WriterLoop() {
+    std::deque<PerfLogSample> batch;
+    for (;;) {
+        bool closing;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_closing || !m_queue.empty(); });
+            batch.swap(m_queue);
+            closing = m_closing;
+        }
+
+        for (const auto& sample : batch) {
+            EncodeSample(sample);
+            if (m_block->sampleCount >= m_options.samplesPerBlock) FlushBlock();
+        }
+        m_samplesWritten.fetch_add(batch.size());
+        batch.clear();
+
+        if (closing) {
+            FlushBlock();
+            FlushFile();
+            return;
+        }
+        if (m_out.size() >= m_options.writeBufferBytes) FlushFile();
+    }
+}
+
+void PerfLogWriter::EncodeSample(const PerfLogSample& sample) {
+    Block& b = *m_block;
+    auto* col = b.columns;
+
+    PutDelta(col[SampleTime], sample.timestampUs, b.time);
+    PutVarint(col[SampleRows], sample.processes.size());
+    PutVarint(col[SampleFlags], sample.hasSystem ? kSampleHasSystem : 0);
+
+    if (sample.hasSystem) {
+        const SystemMetrics& s = sample.system;
+        const uint64_t values[kSystemColumns] = {
+            static_cast<uint64_t>(Quantize(s.cpuTotalLoad)),
+            static_cast<uint64_t>(Quantize(s.cpuUserLoad)),
+            static_cast<uint64_t>(Quantize(s.cpuSystemLoad)),
+            s.cpuCount, s.enabledCPUs, s.memUsed, s.memFree,
+            s.diskBytesRead, s.diskBytesWritten,
+            s.netBytesIn, s.netBytesOut, s.netPacketsIn, s.netPacketsOut,
+        };
+        for (int i = 0; i < kSystemColumns; i++) {
+            PutDelta(col[SysCpuTotal + i], values[i], b.system[i]);
+        }
+    }
+
+    for (const auto& p : sample.processes) {
+        PutDelta(col[ProcPid], static_cast<uint64_t>(p.pid), b.pid);
+
+        auto [nameIt, newName] = b.nameIds.try_emplace(p.name, static_cast<uint32_t>(b.names.size()));
+        if (newName) b.names.push_back(&nameIt->first);
+        PutVarint(col[ProcName], nameIt->second);
+
+        uint64_t* previous = b.procs[p.pid].values;
+        const uint64_t values[kProcessCounters] = {
+            static_cast<uint64_t>(Quantize(p.cpuUsage)),
+            p.memResident, p.memAnon, p.memVirtual,
+            p.diskBytesRead, p.diskBytesWritten, p.threads,
+        };
+        for (int i = 0; i < kProcessCounters; i++) {
+            PutDelta(col[ProcCpu + i], values[i], previous[i]);
+        }
+    }
+    b.sampleCount++;
+}
+
+void PerfLogWriter::FlushBlock() {
+    Block& b = *m_block;
+    if (b.sampleCount == 0) return;
+
+    std::vector<uint8_t>& raw = b.raw;
+    raw.clear();
+    PutVarint(raw, b.names.size());
+    for (const std::string* name : b.names) {
+        PutVarint(raw, name->size());
+        raw.insert(raw.end(), name->begin(), name->end());
+    }
+    for (const auto& column : b.columns) PutVarint(raw, column.size());
+    for (const auto& column : b.columns) raw.insert(raw.end(), column.begin(), column.end());
+
+    const uint8_t* stored = raw.data();
+    size_t storedSize = raw.size();
+    uint32_t flags = 0;
+    if (m_options.compress) {
+        b.compressed.resize(LZ4::CompressBound(raw.size()));
+        size_t outSize = 0;
+        if (LZ4::Compress(raw.data(), raw.size(), b.compressed.data(), b.compressed.size(), outSize) &&
+            outSize < raw.size()) {
+            stored = b.compressed.data();
+            storedSize = outSize;
+            flags |= kBlockLZ4;
+        }
+    }
+
+    PutU32(m_out, kBlockMagic);
+    PutU32(m_out, static_cast<uint32_t>(storedSize));
+    PutU32(m_out, static_cast<uint32_t>(raw.size()));
+    PutU32(m_out, b.sampleCount);
+    PutU32(m_out, flags);
+    m_out.insert(m_out.end(), stored, stored + storedSize);
+
+    b.Reset();
+}
+
+void PerfLogWriter::FlushFile() {
+    if (m_out.empty()) return;
+    if (std::fwrite(m_out.data(), 1, m_out.size(), m_file) != m_out.size()) {
+        INST_LOG_ERROR(TAG, "Write failed, %zu bytes lost", m_out.size());
+    }
+    m_out.clear();
+}
+
+// ---------------------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------------------
+
+PerfLogReader::~PerfLogReader() {
+    Close();
+}
+
+Error PerfLogReader::Open(const std::string& path) {
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return Error::InvalidArgument;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) ||
+        static_cast<uint64_t>(fileSize.QuadPart) < kFileHeaderSize) {
+        CloseHandle(file);
+        return Error::ProtocolError;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return Error::InternalError;
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        return Error::InternalError;
+    }
+    m_mapping = mapping;
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return Error::InvalidArgument;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < kFileHeaderSize) {
+        ::close(fd);
+        return Error::ProtocolError;
+    }
+    void* view = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) return Error::InternalError;
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = static_cast<size_t>(st.st_size);
+#endif
+
+    if (std::memcmp(m_data, kFileMagic, sizeof(kFileMagic)) != 0 ||
+        GetU32(m_data + 8) != kFileVersion) {
+        Close();
+        return Error::ProtocolError;
+    }
+
+    // Index the blocks; a truncated tail (writer killed mid-write) is dropped
+    size_t offset = kFileHeaderSize;
+    while (m_size - offset >= kBlockHeaderSize) {
+        const uint8_t* h = m_data + offset;
+        if (GetU32(h) != kBlockMagic) break;
+        BlockRef ref;
+        ref.offset = offset + kBlockHeaderSize;
+        ref.storedSize = GetU32(h + 4);
+        ref.rawSize = GetU32(h + 8);
+        ref.sampleCount = GetU32(h + 12);
+        ref.flags = GetU32(h + 16);
+        if (m_size - ref.offset < ref.storedSize) break;
+        m_blocks.push_back(ref);
+        m_sampleCount += ref.sampleCount;
+        offset = ref.offset + ref.storedSize;
+    }
+    if (offset != m_size) {
+        INST_LOG_WARN(TAG, "%s: ignoring %zu trailing bytes", path.c_str(), m_size - offset);
+    }
+    return Error::Success;
+}
+
+void PerfLogReader::Close() {
+    if (m_data) {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle(static_cast<HANDLE>(m_mapping));
+#else
+        ::munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_blocks.clear();
+    m_sampleCount = 0;
+}
+
+Error PerfLogReader::ReadBlock(size_t index, std::vector<PerfLogSample>& out) const {
+    out.clear();
+    if (index >= m_blocks.size()) return Error::InvalidArgument;
+    const BlockRef& ref = m_blocks[index];
+
+    const uint8_t* raw = m_data + ref.offset;
+    std::vector<uint8_t> decompressed;
+    if (ref.flags & kBlockLZ4) {
+        decompressed.resize(ref.rawSize);
+        size_t outSize = 0;
+        if (!LZ4::Decompress(raw, ref.storedSize, decompressed.data(), decompressed.size(), outSize) ||
+            outSize != ref.rawSize) {
+            return Error::ProtocolError;
+        }
+        raw = decompressed.data();
+    } else if (ref.storedSize != ref.rawSize) {
+        return Error::ProtocolError;
+    }
+
+    Cursor header{raw, raw + ref.rawSize};
+    const uint64_t nameCount = header.Varint();
+    if (nameCount > ref.rawSize) return Error::ProtocolError;
+    std::vector<std::string> names;
+    names.reserve(static_cast<size_t>(nameCount));
+    for (uint64_t i = 0; i < nameCount && header.ok; i++) {
+        const uint64_t length = header.Varint();
+        if (length > static_cast<uint64_t>(header.end - header.p)) return Error::ProtocolError;
+        names.emplace_back(reinterpret_cast<const char*>(header.p), static_cast<size_t>(length));
+        header.p += length;
+    }
+    uint64_t columnSizes[ColumnCount];
+    for (auto& size : columnSizes) size = header.Varint();
+    if (!header.ok) return Error::ProtocolError;
+
+    Cursor col[ColumnCount];
+    const uint8_t* p = header.p;
+    for (int i = 0; i < ColumnCount; i++) {
+        if (columnSizes[i] > static_cast<uint64_t>(header.end - p)) return Error::ProtocolError;
+        col[i] = Cursor{p, p + columnSizes[i]};
+        p += columnSizes[i];
+    }
+
+    uint64_t time = 0;
+    uint64_t system[kSystemColumns] = {};
+    uint64_t pid = 0;
+    std::unordered_map<int64_t, ProcessCounters> procs;
+
+    out.resize(ref.sampleCount);
+    for (auto& sample : out) {
+        sample.timestampUs = col[SampleTime].Delta(time);
+        const uint64_t rows = col[SampleRows].Varint();
+        sample.hasSystem = (col[SampleFlags].Varint() & kSampleHasSystem) != 0;
+        // Every row takes at least one byte of the pid column
+        if (rows > static_cast<uint64_t>(col[ProcPid].end - col[ProcPid].p)) return Error::ProtocolError;
+
+        if (sample.hasSystem) {
+            for (int i = 0; i < kSystemColumns; i++) col[SysCpuTotal + i].Delta(system[i]);
+            SystemMetrics& s = sample.system;
+            s.cpuTotalLoad = Dequantize(static_cast<int64_t>(system[0]));
+            s.cpuUserLoad = Dequantize(static_cast<int64_t>(system[1]));
+            s.cpuSystemLoad = Dequantize(static_cast<int64_t>(system[2]));
+            s.cpuCount = system[3];
+            s.enabledCPUs = system[4];
+            s.memUsed = system[5];
+            s.memFree = system[6];
+            s.diskBytesRead = system[7];
+            s.diskBytesWritten = system[8];
+            s.netBytesIn = system[9];
+            s.netBytesOut = system[10];
+            s.netPacketsIn = system[11];
+            s.netPacketsOut = system[12];
+        }
+
+        sample.processes.resize(static_cast<size_t>(rows));
+        for (auto& proc : sample.processes) {
+            proc.pid = static_cast<int64_t>(col[ProcPid].Delta(pid));
+            const uint64_t nameId = col[ProcName].Varint();
+            if (nameId >= names.size()) return Error::ProtocolError;
+            proc.name = names[static_cast<size_t>(nameId)];
+
+            uint64_t* previous = procs[proc.pid].values;
+            for (int i = 0; i < kProcessCounters; i++) col[ProcCpu + i].Delta(previous[i]);
+            proc.cpuUsage = Dequantize(static_cast<int64_t>(previous[0]));
+            proc.memResident = previous[1];
+            proc.memAnon = previous[2];
+            proc.memVirtual = previous[3];
+            proc.diskBytesRead = previous[4];
+            proc.diskBytesWritten = previous[5];
+            proc.threads = previous[6];
+        }
+    }
+
+    for (const auto& c : col) {
+        if (!c.ok) return Error::ProtocolError;
+    }
+    return Error::Success;
+}
+
+Error PerfLogReader::ForEach(const std::function<bool(const PerfLogSample&)>& callback) const {
+    std::vector<PerfLogSample> samples;
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        Error err = ReadBlock(i, samples);
+        if (err != Error::Success) return err;
+        for (const auto& sample : samples) {
+            if (!callback(sample)) return Error::Success;
+        }
+    }
+    return Error::Success;
+}
+
+} // namespace instruments
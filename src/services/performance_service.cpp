@@ -1,7 +1,11 @@
 #include "../../include/instruments/performance_service.h"
+#include "../../include/instruments/process_service.h"
 #include "../nskeyedarchiver/nsobject.h"
+#include "../nskeyedarchiver/nskeyedunarchiver.h"
 #include "../util/log.h"
-#include <cstdlib>
+#include "process_delta.h"
+#include "sysmontap_decoder.h"
+#include <algorithm>
 
 namespace instruments {
 
@@ -12,16 +16,48 @@ static constexpr int kStartTimeoutMs = 10000;
 
 PerformanceService::PerformanceService(std::shared_ptr<DeviceConnection> connection)
     : m_connection(std::move(connection))
+    , m_layout(std::make_unique<SysmontapLayout>())
 {
 }
 
 PerformanceService::~PerformanceService() {
     Stop();
+    StopRecording();
+}
+
+Error PerformanceService::StartRecording(const std::string& path, const PerfLogOptions& options) {
+    auto recorder = std::make_shared<PerfLogWriter>();
+    Error err = recorder->Open(path, options);
+    if (err != Error::Success) return err;
+
+    std::shared_ptr<PerfLogWriter> previous;
+    {
+        std::lock_guard<std::mutex> lock(m_recorderMutex);
+        previous = std::move(m_recorder);
+        m_recorder = std::move(recorder);
+    }
+    if (previous) previous->Close();
+    return Error::Success;
+}
+
+void PerformanceService::StopRecording() {
+    std::shared_ptr<PerfLogWriter> recorder;
+    {
+        std::lock_guard<std::mutex> lock(m_recorderMutex);
+        recorder = std::move(m_recorder);
+    }
+    // A sample being appended concurrently holds its own reference
+    if (recorder) recorder->Close();
+}
+
+bool PerformanceService::IsRecording() const {
+    std::lock_guard<std::mutex> lock(m_recorderMutex);
+    return m_recorder != nullptr;
 }
 
 Error PerformanceService::GetAttributes(const std::string& selector,
                                          std::vector<std::string>& outAttrs) {
-    auto dtxConn = m_connection->CreateInstrumentConnection();
+    auto dtxConn = m_connection->SharedInstrumentConnection();
     if (!dtxConn) return Error::ConnectionFailed;
 
     auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::DeviceInfo);
@@ -29,7 +65,7 @@ Error PerformanceService::GetAttributes(const std::string& selector,
 
     auto msg = DTXMessage::CreateWithSelector(selector);
     auto response = channel->SendMessageSync(msg, kAttrTimeoutMs);
-    channel->Cancel();
+    dtxConn->CloseChannel(channel);
 
     if (!response) return Error::Timeout;
 
@@ -49,6 +85,25 @@ Error PerformanceService::GetAttributes(const std::string& selector,
     return Error::Success;
 }
 
+void PerformanceService::ResolveBundlePids(const std::vector<std::string>& bundleIds,
+                                            std::vector<int64_t>& pids) {
+    std::vector<ProcessInfo> processes;
+    if (ProcessService(m_connection).GetProcessList(processes) != Error::Success) {
+        INST_LOG_WARN(TAG, "Process list unavailable; bundle id filter matches nothing");
+        return;
+    }
+    for (const auto& bundleId : bundleIds) {
+        bool found = false;
+        for (const auto& proc : processes) {
+            if (proc.bundleId == bundleId) {
+                pids.push_back(proc.pid);
+                found = true;
+            }
+        }
+        if (!found) INST_LOG_WARN(TAG, "%s is not running", bundleId.c_str());
+    }
+}
+
 Error PerformanceService::GetSystemAttributes(std::vector<std::string>& outAttrs) {
     return GetAttributes("sysmonSystemAttributes", outAttrs);
 }
@@ -65,19 +120,19 @@ Error PerformanceService::Start(const PerfConfig& config,
         Stop();
     }
 
-    // Create persistent DTX connection
-    m_dtxConnection = m_connection->CreateInstrumentConnection();
+    // Open channels on the device's shared instruments connection
+    m_dtxConnection = m_connection->SharedInstrumentConnection();
     if (!m_dtxConnection) {
         if (errorCb) errorCb(Error::ConnectionFailed, "Failed to create instrument connection");
         return Error::ConnectionFailed;
     }
 
-    // Auto-populate attributes if empty
+    // Auto-populate attributes if empty. By default only the attributes
+    // the decoder maps are requested; the rest would be sent and dropped.
     PerfConfig actualConfig = config;
     if (actualConfig.systemAttributes.empty()) {
-        GetSystemAttributes(actualConfig.systemAttributes);
+        if (actualConfig.allAttributes) GetSystemAttributes(actualConfig.systemAttributes);
         if (actualConfig.systemAttributes.empty()) {
-            // Default attributes
             actualConfig.systemAttributes = {
                 "cpu_total_load", "cpu_user_load", "cpu_system_load",
                 "physMemSize", "memUsed", "vmExtPageCount",
@@ -87,7 +142,7 @@ Error PerformanceService::Start(const PerfConfig& config,
         }
     }
     if (actualConfig.processAttributes.empty()) {
-        GetProcessAttributes(actualConfig.processAttributes);
+        if (actualConfig.allAttributes) GetProcessAttributes(actualConfig.processAttributes);
         if (actualConfig.processAttributes.empty()) {
             actualConfig.processAttributes = {
                 "pid", "name", "cpuUsage", "physFootprint",
@@ -97,11 +152,25 @@ Error PerformanceService::Start(const PerfConfig& config,
         }
     }
 
+    // Process filter. sysmontap has no per-pid subscription, so rows of
+    // other pids are dropped by the decoder before they are built.
+    m_layout->filterPids = !actualConfig.pids.empty() || !actualConfig.bundleIds.empty();
+    m_layout->pids = actualConfig.pids;
+    if (!actualConfig.bundleIds.empty()) {
+        ResolveBundlePids(actualConfig.bundleIds, m_layout->pids);
+    }
+    std::sort(m_layout->pids.begin(), m_layout->pids.end());
+    if (m_layout->filterPids) {
+        // Packed rows are matched on their pid cell
+        auto& attrs = actualConfig.processAttributes;
+        if (std::find(attrs.begin(), attrs.end(), "pid") == attrs.end()) attrs.insert(attrs.begin(), "pid");
+        INST_LOG_INFO(TAG, "Sysmontap process filter: %zu pids", m_layout->pids.size());
+    }
+
     // Create sysmontap channel
     m_channel = m_dtxConnection->MakeChannelWithIdentifier(ChannelId::Sysmontap);
     if (!m_channel) {
         if (errorCb) errorCb(Error::ServiceStartFailed, "Failed to create sysmontap channel");
-        m_dtxConnection->Disconnect();
         m_dtxConnection.reset();
         return Error::ServiceStartFailed;
     }
@@ -147,8 +216,8 @@ Error PerformanceService::Start(const PerfConfig& config,
                   actualConfig.systemAttributes.size(),
                   actualConfig.processAttributes.size());
 
-    // Store process attribute order for array-format parsing
-    m_processAttributes = actualConfig.processAttributes;
+    // Compile process attribute order for array-format parsing
+    m_layout->rows.Compile(actualConfig.processAttributes);
 
     // Send setConfig:
     auto setConfigMsg = DTXMessage::CreateWithSelector("setConfig:");
@@ -165,28 +234,18 @@ Error PerformanceService::Start(const PerfConfig& config,
         if (!m_running.load()) return;
         if (!msg) return;
 
-        auto payload = msg->PayloadObject();
-        if (payload) {
-            ParseSysmontapMessage(*payload, systemCb, processCb);
-        }
+        ParseSysmontapMessage(*msg, systemCb, processCb);
     };
 
     // Start receiving immediately; some devices stream before we get the start reply.
     m_running.store(true);
 
-    // Set message handler for streaming data
+    // Set message handler for streaming data. Updates the device sends on
+    // the negated channel code (-1 when this was the connection's first
+    // channel) are routed here too, so other services sharing the
+    // connection never see them.
     m_channel->SetMessageHandler(parseSysmonMessage);
 
-    // Some sysmontap updates arrive on the default (-1 / 0xFFFFFFFF) channel.
-    if (m_dtxConnection) {
-        m_dtxConnection->AddGlobalMessageHandler([parseSysmonMessage](std::shared_ptr<DTXMessage> msg) {
-            if (!msg) return;
-            if (static_cast<int32_t>(msg->ChannelCode()) == -1) {
-                parseSysmonMessage(msg);
-            }
-        });
-    }
-
     // Send start
     auto startMsg = DTXMessage::CreateWithSelector("start");
     response = m_channel->SendMessageSync(startMsg, kStartTimeoutMs);
@@ -201,6 +260,26 @@ Error PerformanceService::Start(const PerfConfig& config,
     return Error::Success;
 }
 
+Error PerformanceService::StartDelta(const PerfConfig& config,
+                                      SystemPerfCallback systemCb,
+                                      ProcessDeltaCallback deltaCb,
+                                      ErrorCallback errorCb) {
+    ProcessPerfCallback processCb;
+    if (deltaCb) {
+        // Owned by the callback: a restart begins from an empty snapshot
+        struct DeltaState {
+            ProcessDeltaTracker tracker;
+            ProcessDelta delta;
+        };
+        auto state = std::make_shared<DeltaState>();
+        state->tracker = ProcessDeltaTracker(config.deltaCpuEpsilon);
+        processCb = [state, deltaCb = std::move(deltaCb)](const std::vector<ProcessMetrics>& rows) {
+            if (state->tracker.Update(rows, state->delta)) deltaCb(state->delta);
+        };
+    }
+    return Start(config, std::move(systemCb), std::move(processCb), std::move(errorCb));
+}
+
 void PerformanceService::Stop() {
     m_running.store(false);
     if (!m_channel && !m_dtxConnection) return;
@@ -210,267 +289,134 @@ void PerformanceService::Stop() {
     if (m_channel) {
         auto stopMsg = DTXMessage::CreateWithSelector("stop");
         m_channel->SendMessageSync(stopMsg, 2000);
-        m_channel->Cancel();
+        m_dtxConnection->CloseChannel(m_channel);
         m_channel.reset();
     }
 
-    if (m_dtxConnection) {
-        m_dtxConnection->Disconnect();
-        m_dtxConnection.reset();
-    }
+    // Other services may still use the connection; it closes with the last one
+    m_dtxConnection.reset();
 }
 
-void PerformanceService::ParseSysmontapMessage(const NSObject& data,
-                                                 SystemPerfCallback systemCb,
-                                                 ProcessPerfCallback processCb) {
+// One-time diagnostics for the first few samples, to locate process data
+// on new iOS versions. Only runs when Info logging is compiled in and enabled.
+static int s_payloadsLogged = 0;
+
+static void LogSysmontapPayload(const NSObject& data) {
     const NSObject* dictPayload = nullptr;
     if (data.IsDict()) {
         dictPayload = &data;
-    } else if (data.IsArray() && !data.AsArray().empty()) {
-        const auto& arr = data.AsArray();
-        if (arr[0].IsDict()) {
-            dictPayload = &arr[0];
-        }
-    }
-    if (!dictPayload) {
-        INST_LOG_DEBUG(TAG, "Sysmontap payload not dict/array-dict (type=%d)",
-                       static_cast<int>(data.GetType()));
-        return;
+    } else if (data.IsArray() && !data.AsArray().empty() && data.AsArray()[0].IsDict()) {
+        dictPayload = &data.AsArray()[0];
     }
+    if (!dictPayload) return;
 
-    static int s_logged = 0;
-    if (s_logged < 3) {
-        std::string keys;
-        for (const auto& [k, v] : dictPayload->AsDict()) {
-            if (!keys.empty()) keys.append(",");
-            keys.append(k);
-        }
-        bool hasProcs = dictPayload->HasKey("Processes");
-        bool hasProcsLower = dictPayload->HasKey("processes");
-        bool hasByPid = dictPayload->HasKey("ProcessByPid");
-        bool hasByPidLower = dictPayload->HasKey("processByPid");
-        int procsType = hasProcs ? static_cast<int>((*dictPayload)["Processes"].GetType()) : -1;
-        INST_LOG_INFO(TAG,
-                      "Sysmontap keys=[%s] size=%zu Processes=%d processes=%d ProcessByPid=%d processByPid=%d ProcessesType=%d",
-                      keys.c_str(), dictPayload->AsDict().size(),
-                      hasProcs ? 1 : 0, hasProcsLower ? 1 : 0,
-                      hasByPid ? 1 : 0, hasByPidLower ? 1 : 0, procsType);
-
-        if (dictPayload->HasKey("System")) {
-            const auto& sys = (*dictPayload)["System"];
-            INST_LOG_INFO(TAG, "Sysmontap System type=%d size=%zu",
-                          static_cast<int>(sys.GetType()), sys.Size());
-            if (sys.IsDict()) {
-                std::string skeys;
-                for (const auto& [k, v] : sys.AsDict()) {
-                    if (!skeys.empty()) skeys.append(",");
-                    skeys.append(k);
-                }
-                INST_LOG_INFO(TAG, "Sysmontap System keys=[%s]", skeys.c_str());
+    std::string keys;
+    for (const auto& [k, v] : dictPayload->AsDict()) {
+        if (!keys.empty()) keys.append(",");
+        keys.append(k);
+    }
+    bool hasProcs = dictPayload->HasKey("Processes");
+    bool hasProcsLower = dictPayload->HasKey("processes");
+    bool hasByPid = dictPayload->HasKey("ProcessByPid");
+    bool hasByPidLower = dictPayload->HasKey("processByPid");
+    int procsType = hasProcs ? static_cast<int>((*dictPayload)["Processes"].GetType()) : -1;
+    INST_LOG_INFO(TAG,
+                  "Sysmontap keys=[%s] size=%zu Processes=%d processes=%d ProcessByPid=%d processByPid=%d ProcessesType=%d",
+                  keys.c_str(), dictPayload->AsDict().size(),
+                  hasProcs ? 1 : 0, hasProcsLower ? 1 : 0,
+                  hasByPid ? 1 : 0, hasByPidLower ? 1 : 0, procsType);
+
+    if (dictPayload->HasKey("System")) {
+        const auto& sys = (*dictPayload)["System"];
+        INST_LOG_INFO(TAG, "Sysmontap System type=%d size=%zu",
+                      static_cast<int>(sys.GetType()), sys.Size());
+        if (sys.IsDict()) {
+            std::string skeys;
+            for (const auto& [k, v] : sys.AsDict()) {
+                if (!skeys.empty()) skeys.append(",");
+                skeys.append(k);
             }
+            INST_LOG_INFO(TAG, "Sysmontap System keys=[%s]", skeys.c_str());
         }
-
-        // One-time short JSON preview (first 512 chars) to locate process data.
-        std::string json = dictPayload->ToJson();
-        if (json.size() > 512) json = json.substr(0, 512) + "...";
-        INST_LOG_INFO(TAG, "Sysmontap JSON preview: %s", json.c_str());
-        s_logged++;
     }
 
-    // System metrics
-    if (systemCb && dictPayload->HasKey("SystemCPUUsage")) {
-        SystemMetrics metrics;
-        const auto& cpuUsage = (*dictPayload)["SystemCPUUsage"];
-        if (cpuUsage.IsDict()) {
-            if (cpuUsage.HasKey("CPU_TotalLoad"))
-                metrics.cpuTotalLoad = cpuUsage["CPU_TotalLoad"].ToNumber();
-            if (cpuUsage.HasKey("CPU_UserLoad"))
-                metrics.cpuUserLoad = cpuUsage["CPU_UserLoad"].ToNumber();
-            if (cpuUsage.HasKey("CPU_SystemLoad"))
-                metrics.cpuSystemLoad = cpuUsage["CPU_SystemLoad"].ToNumber();
-        }
-        if (dictPayload->HasKey("CPUCount"))
-            metrics.cpuCount = static_cast<uint64_t>((*dictPayload)["CPUCount"].ToNumber());
-        if (dictPayload->HasKey("EnabledCPUs"))
-            metrics.enabledCPUs = static_cast<uint64_t>((*dictPayload)["EnabledCPUs"].ToNumber());
+    // One-time short JSON preview (first 512 chars) to locate process data.
+    std::string json = dictPayload->ToJson();
+    if (json.size() > 512) json = json.substr(0, 512) + "...";
+    INST_LOG_INFO(TAG, "Sysmontap JSON preview: %s", json.c_str());
+    s_payloadsLogged++;
+}
 
-        systemCb(metrics);
+void PerformanceService::ParseSysmontapMessage(const DTXMessage& msg,
+                                                 SystemPerfCallback systemCb,
+                                                 ProcessPerfCallback processCb) {
+    const uint64_t receivedUs = HostMonotonicUs();
+    if (INST_LOG_ENABLED(Info) && s_payloadsLogged < 3) {
+        auto payload = msg.PayloadObject();
+        if (payload) LogSysmontapPayload(*payload);
     }
 
-    // Process metrics
-    if (processCb) {
-        const NSObject* procsPtr = nullptr;
-        if (dictPayload->HasKey("Processes") && (*dictPayload)["Processes"].IsDict()) {
-            procsPtr = &(*dictPayload)["Processes"];
-        } else if (dictPayload->HasKey("System") && (*dictPayload)["System"].IsDict()) {
-            const auto& sys = (*dictPayload)["System"];
-            if (sys.HasKey("Processes") && sys["Processes"].IsDict())
-                procsPtr = &sys["Processes"];
-            else if (sys.HasKey("processes") && sys["processes"].IsDict())
-                procsPtr = &sys["processes"];
-            else if (sys.HasKey("ProcessByPid") && sys["ProcessByPid"].IsDict())
-                procsPtr = &sys["ProcessByPid"];
-            else if (sys.HasKey("processByPid") && sys["processByPid"].IsDict())
-                procsPtr = &sys["processByPid"];
-        }
+    std::shared_ptr<PerfLogWriter> recorder;
+    {
+        std::lock_guard<std::mutex> lock(m_recorderMutex);
+        recorder = m_recorder;
+    }
 
-        if (procsPtr && procsPtr->IsDict()) {
-            const auto& procs = *procsPtr;
-            std::vector<ProcessMetrics> processMetrics;
-            for (const auto& [pidStr, procData] : procs.AsDict()) {
-                ProcessMetrics pm;
-                pm.pid = std::atoll(pidStr.c_str());
-
-                if (procData.IsArray() && !procData.AsArray().empty()) {
-                    // Array format: values in same order as configured processAttributes
-                    const auto& values = procData.AsArray();
-                    for (size_t i = 0; i < values.size() && i < m_processAttributes.size(); i++) {
-                        const auto& attr = m_processAttributes[i];
-                        const auto& val = values[i];
-                        if (attr == "pid")
-                            pm.pid = static_cast<int64_t>(val.ToNumber());
-                        else if (attr == "name" && val.IsString())
-                            pm.name = val.AsString();
-                        else if (attr == "cpuUsage")
-                            pm.cpuUsage = val.ToNumber();
-                        else if (attr == "physFootprint")
-                            pm.memResident = static_cast<uint64_t>(val.ToNumber());
-                        else if (attr == "memAnon")
-                            pm.memAnon = static_cast<uint64_t>(val.ToNumber());
-                        else if (attr == "memVirtualSize")
-                            pm.memVirtual = static_cast<uint64_t>(val.ToNumber());
-                        else if (attr == "diskBytesRead")
-                            pm.diskBytesRead = static_cast<uint64_t>(val.ToNumber());
-                        else if (attr == "diskBytesWritten")
-                            pm.diskBytesWritten = static_cast<uint64_t>(val.ToNumber());
-                        else if (attr == "threadCount")
-                            pm.threads = static_cast<uint64_t>(val.ToNumber());
-                    }
-                } else if (procData.IsDict()) {
-                    // Dict format (some iOS versions return dict)
-                    if (procData.HasKey("pid"))
-                        pm.pid = static_cast<int64_t>(procData["pid"].ToNumber());
-                    if (procData.HasKey("name") && procData["name"].IsString())
-                        pm.name = procData["name"].AsString();
-                    if (procData.HasKey("cpuUsage"))
-                        pm.cpuUsage = procData["cpuUsage"].ToNumber();
-                    if (procData.HasKey("physFootprint"))
-                        pm.memResident = static_cast<uint64_t>(procData["physFootprint"].ToNumber());
-                    if (procData.HasKey("memAnon"))
-                        pm.memAnon = static_cast<uint64_t>(procData["memAnon"].ToNumber());
-                    if (procData.HasKey("memVirtualSize"))
-                        pm.memVirtual = static_cast<uint64_t>(procData["memVirtualSize"].ToNumber());
-                    if (procData.HasKey("diskBytesRead"))
-                        pm.diskBytesRead = static_cast<uint64_t>(procData["diskBytesRead"].ToNumber());
-                    if (procData.HasKey("diskBytesWritten"))
-                        pm.diskBytesWritten = static_cast<uint64_t>(procData["diskBytesWritten"].ToNumber());
-                    if (procData.HasKey("threadCount"))
-                        pm.threads = static_cast<uint64_t>(procData["threadCount"].ToNumber());
-                } else {
-                    continue;
-                }
-
-                processMetrics.push_back(std::move(pm));
-            }
+    // Stream the payload straight into metrics; no NSObject tree is built
+    const auto& raw = msg.RawPayload();
+    SysmontapDecoder decoder(*m_layout, systemCb || recorder, processCb || recorder);
+    if (!NSKeyedUnarchiver::Visit(raw.data(), raw.size(), decoder)) return;
 
-            if (!processMetrics.empty()) {
-                static bool s_firstProcLogged = false;
-                if (!s_firstProcLogged) {
-                    s_firstProcLogged = true;
-                    INST_LOG_INFO(TAG, "Sysmontap process data detected (dict format), count=%zu, firstPid=%lld",
-                                  processMetrics.size(),
-                                  static_cast<long long>(processMetrics.front().pid));
-                }
-                processCb(processMetrics);
-            }
-        }
+    SysmontapSample sample;
+    decoder.Finish(sample);
+    sample.system.timestampUs = receivedUs;
+    if (!sample.hasPayload) {
+        INST_LOG_DEBUG(TAG, "Sysmontap payload not dict/array-dict");
+        return;
+    }
 
-        // Array-packed format: System is array, with ProcessesAttributes describing layout.
-        if (!procsPtr && dictPayload->HasKey("System") && (*dictPayload)["System"].IsArray()
-            && dictPayload->HasKey("ProcessesAttributes") && (*dictPayload)["ProcessesAttributes"].IsArray()) {
-            const auto& systemArr = (*dictPayload)["System"].AsArray();
-            const auto& procAttrsArr = (*dictPayload)["ProcessesAttributes"].AsArray();
+    // System metrics
+    if (systemCb && sample.hasSystemMetrics) {
+        systemCb(sample.system);
+    }
 
-            std::vector<std::string> procAttrs;
-            procAttrs.reserve(procAttrsArr.size());
-            for (const auto& item : procAttrsArr) {
-                if (item.IsString()) procAttrs.push_back(item.AsString());
-            }
-            if (procAttrs.empty()) {
-                procAttrs = m_processAttributes;
-            }
+    // Process metrics
+    if (processCb) DeliverProcesses(sample, processCb);
+
+    // The recorder takes the rows once the callback is done with them
+    if (recorder && (sample.hasSystemMetrics || !sample.processes.empty())) {
+        PerfLogSample record;
+        record.hasSystem = sample.hasSystemMetrics;
+        record.system = sample.system;
+        record.processes = std::move(sample.processes);
+        recorder->Append(std::move(record));
+    }
+}
 
-            size_t sysAttrCount = 0;
-            if (dictPayload->HasKey("SystemAttributes") && (*dictPayload)["SystemAttributes"].IsArray()) {
-                sysAttrCount = (*dictPayload)["SystemAttributes"].AsArray().size();
-            }
+void PerformanceService::DeliverProcesses(const SysmontapSample& sample,
+                                            const ProcessPerfCallback& processCb) {
+    if (sample.packed) {
+        static int s_sysLayoutLogged = 0;
+        if (s_sysLayoutLogged < 3) {
+            INST_LOG_INFO(TAG,
+                          "Sysmontap layout: systemArr=%zu sysAttrs=%zu procAttrs=%zu sysCount=%zu remain=%zu remain%%proc=%zu",
+                          sample.systemCells, sample.systemAttrCount, sample.procAttrCount,
+                          sample.sysCount, sample.systemCells - sample.sysCount,
+                          (sample.systemCells - sample.sysCount) % sample.procAttrCount);
+            s_sysLayoutLogged++;
+        }
+    }
 
-            if (!procAttrs.empty() && !systemArr.empty()) {
-                const size_t procAttrCount = procAttrs.size();
-                size_t sysCount = sysAttrCount;
-                size_t remain = (systemArr.size() > sysCount) ? (systemArr.size() - sysCount) : 0;
-
-                // If SystemAttributes count doesn't line up, try treating System as pure process rows.
-                if (procAttrCount > 0 && (remain == 0 || (remain % procAttrCount) != 0)) {
-                    sysCount = 0;
-                    remain = systemArr.size();
-                }
-
-                static int s_sysLayoutLogged = 0;
-                if (s_sysLayoutLogged < 3) {
-                    INST_LOG_INFO(TAG,
-                                  "Sysmontap layout: systemArr=%zu sysAttrs=%zu procAttrs=%zu sysCount=%zu remain=%zu remain%%proc=%zu",
-                                  systemArr.size(), sysAttrCount, procAttrCount, sysCount, remain,
-                                  (procAttrCount ? (remain % procAttrCount) : 0));
-                    s_sysLayoutLogged++;
-                }
-
-                if (procAttrCount > 0 && remain >= procAttrCount && (remain % procAttrCount) == 0) {
-                    std::vector<ProcessMetrics> processMetrics;
-                    processMetrics.reserve(remain / procAttrCount);
-
-                    for (size_t offset = sysCount; offset + procAttrCount <= systemArr.size(); offset += procAttrCount) {
-                        ProcessMetrics pm;
-                        for (size_t i = 0; i < procAttrCount; i++) {
-                            const auto& attr = procAttrs[i];
-                            const auto& val = systemArr[offset + i];
-                            if (attr == "pid")
-                                pm.pid = static_cast<int64_t>(val.ToNumber());
-                            else if (attr == "name" && val.IsString())
-                                pm.name = val.AsString();
-                            else if (attr == "cpuUsage")
-                                pm.cpuUsage = val.ToNumber();
-                            else if (attr == "physFootprint")
-                                pm.memResident = static_cast<uint64_t>(val.ToNumber());
-                            else if (attr == "memAnon")
-                                pm.memAnon = static_cast<uint64_t>(val.ToNumber());
-                            else if (attr == "memVirtualSize")
-                                pm.memVirtual = static_cast<uint64_t>(val.ToNumber());
-                            else if (attr == "diskBytesRead")
-                                pm.diskBytesRead = static_cast<uint64_t>(val.ToNumber());
-                            else if (attr == "diskBytesWritten")
-                                pm.diskBytesWritten = static_cast<uint64_t>(val.ToNumber());
-                            else if (attr == "threadCount")
-                                pm.threads = static_cast<uint64_t>(val.ToNumber());
-                        }
-                        if (pm.pid != 0) {
-                            processMetrics.push_back(std::move(pm));
-                        }
-                    }
-
-                    if (!processMetrics.empty()) {
-                        static bool s_firstProcLogged = false;
-                        if (!s_firstProcLogged) {
-                            s_firstProcLogged = true;
-                            INST_LOG_INFO(TAG, "Sysmontap process data detected (array format), count=%zu, firstPid=%lld",
-                                          processMetrics.size(),
-                                          static_cast<long long>(processMetrics.front().pid));
-                        }
-                        processCb(processMetrics);
-                    }
-                }
-            }
+    if (!sample.processes.empty()) {
+        static bool s_firstProcLogged = false;
+        if (!s_firstProcLogged) {
+            s_firstProcLogged = true;
+            INST_LOG_INFO(TAG, "Sysmontap process data detected (%s format), count=%zu, firstPid=%lld",
+                          sample.packed ? "array" : "dict",
+                          sample.processes.size(),
+                          static_cast<long long>(sample.processes.front().pid));
         }
+        processCb(sample.processes);
     }
 }
 
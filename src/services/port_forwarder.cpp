@@ -1,7 +1,10 @@
 #include "../../include/instruments/port_forwarder.h"
+#include "relay_pipe.h"
 #include "../util/log.h"
 #include <libimobiledevice/libimobiledevice.h>
+#include <algorithm>
 #include <cstring>
+#include <future>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -10,9 +13,13 @@
 #pragma comment(lib, "ws2_32.lib")
 #endif
 using socket_t = SOCKET;
+using pollfd_t = WSAPOLLFD;
+#define POLL_SOCKETS WSAPoll
 #define SOCKET_INVALID INVALID_SOCKET
 #define CLOSE_SOCKET closesocket
 #define SOCK_ERR WSAGetLastError()
+#define SOCKET_WOULD_BLOCK (WSAGetLastError() == WSAEWOULDBLOCK)
+#define MSG_NOSIGNAL 0
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -21,16 +28,90 @@ using socket_t = SOCKET;
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 using socket_t = int;
+using pollfd_t = struct pollfd;
+#define POLL_SOCKETS ::poll
 #define SOCKET_INVALID (-1)
 #define CLOSE_SOCKET close
 #define SOCK_ERR errno
+#define SOCKET_WOULD_BLOCK (errno == EAGAIN || errno == EWOULDBLOCK)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0   // macOS: relay sockets set SO_NOSIGPIPE instead
+#endif
 #endif
 
 namespace instruments {
 
 static const char* TAG = "PortForwarder";
 
+static void SetNonBlocking(socket_t s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket(s, FIONBIO, &mode);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static void SetNoSigPipe(socket_t s) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)s;
+#endif
+}
+
+// Create a non-blocking loopback UDP socket connected to itself. Sending a
+// byte to it wakes the event loop's poll.
+static int CreateWakeSocket() {
+    socket_t s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == SOCKET_INVALID) return -1;
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addrLen = sizeof(addr);
+    if (bind(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(s, reinterpret_cast<struct sockaddr*>(&addr), &addrLen) != 0 ||
+        connect(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        CLOSE_SOCKET(s);
+        return -1;
+    }
+    SetNonBlocking(s);
+    return static_cast<int>(s);
+}
+
+struct PortForwarder::Relay {
+    socket_t client = SOCKET_INVALID;
+    socket_t device = SOCKET_INVALID;   // usbmuxd connection's fd, or a tunnel socket
+    idevice_connection_t deviceConn = nullptr;
+    uint16_t hostPort = 0;
+    uint16_t devicePort = 0;
+    RelayPipe toDevice;
+    RelayPipe toHost;
+
+    ~Relay() {
+        if (deviceConn) {
+            idevice_disconnect(deviceConn);   // closes device
+        } else if (device != SOCKET_INVALID) {
+            CLOSE_SOCKET(device);
+        }
+        if (client != SOCKET_INVALID) CLOSE_SOCKET(client);
+    }
+
+    // Move data both ways. False once the relay is finished: either side
+    // failed, or one side closed and its last bytes were delivered.
+    bool Pump() {
+        if (!toDevice.eof && toDevice.HasSpace() && !toDevice.Fill(client)) return false;
+        if (!toHost.eof && toHost.HasSpace() && !toHost.Fill(device)) return false;
+        if (!toDevice.Flush(device) || !toHost.Flush(client)) return false;
+        return !(toDevice.eof && !toDevice.HasData()) && !(toHost.eof && !toHost.HasData());
+    }
+};
+
 PortForwarder::PortForwarder(std::shared_ptr<DeviceConnection> connection)
     : m_connection(std::move(connection))
 {
@@ -49,10 +130,6 @@ PortForwarder::~PortForwarder() {
 
 Error PortForwarder::Forward(uint16_t hostPort, uint16_t devicePort,
                               uint16_t* outActualPort) {
-    auto entry = std::make_unique<ForwardEntry>();
-    entry->hostPort = hostPort;
-    entry->devicePort = devicePort;
-
     // Create listening socket
     socket_t sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock == SOCKET_INVALID) {
@@ -80,179 +157,341 @@ Error PortForwarder::Forward(uint16_t hostPort, uint16_t devicePort,
     socklen_t addrLen = sizeof(boundAddr);
     getsockname(sock, reinterpret_cast<struct sockaddr*>(&boundAddr), &addrLen);
     uint16_t actualPort = ntohs(boundAddr.sin_port);
-    entry->hostPort = actualPort;
 
     if (outActualPort) *outActualPort = actualPort;
 
-    if (listen(sock, 10) != 0) {
+    // WDA clients open many short connections at once
+    if (listen(sock, SOMAXCONN) != 0) {
         INST_LOG_ERROR(TAG, "Failed to listen: %d", SOCK_ERR);
         CLOSE_SOCKET(sock);
         return Error::InternalError;
     }
+    SetNonBlocking(sock);
+
+    ForwardEntry entry;
+    entry.hostPort = actualPort;
+    entry.devicePort = devicePort;
+    entry.listenSocket = static_cast<SocketHandle>(sock);
 
-    entry->listenSocket = static_cast<decltype(entry->listenSocket)>(sock);
-    entry->running.store(true);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    StartLoop();
+    RunOnLoop([this, entry]() { m_listeners.push_back(entry); });
+    m_ports[actualPort] = devicePort;
 
     INST_LOG_INFO(TAG, "Forwarding localhost:%u -> device:%u", actualPort, devicePort);
+    return Error::Success;
+}
 
-    // Start accept loop
-    ForwardEntry* entryPtr = entry.get();
-    entry->acceptThread = std::thread([this, entryPtr]() {
-        AcceptLoop(entryPtr);
+void PortForwarder::StopForward(uint16_t hostPort) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_ports.erase(hostPort) == 0) return;
+
+    RunOnLoop([this, hostPort]() {
+        for (auto it = m_listeners.begin(); it != m_listeners.end();) {
+            if (it->hostPort == hostPort) {
+                CLOSE_SOCKET(static_cast<socket_t>(it->listenSocket));
+                it = m_listeners.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        CloseRelays(hostPort);
     });
+    INST_LOG_INFO(TAG, "Stopped forwarding port %u", hostPort);
+
+    if (m_ports.empty()) StopLoop();
+}
 
+void PortForwarder::StopAll() {
     std::lock_guard<std::mutex> lock(m_mutex);
-    m_entries.push_back(std::move(entry));
+    StopLoop();
+    m_ports.clear();
+    INST_LOG_INFO(TAG, "All port forwarding stopped");
+}
 
-    return Error::Success;
+bool PortForwarder::IsActive() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_ports.empty();
 }
 
-void PortForwarder::AcceptLoop(ForwardEntry* entry) {
-    socket_t listenSock = static_cast<socket_t>(entry->listenSocket);
+std::map<uint16_t, uint16_t> PortForwarder::GetForwardedPorts() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ports;
+}
 
-    while (entry->running.load()) {
-        // Use select with timeout for stoppability
-#ifdef _WIN32
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(listenSock, &readfds);
-        struct timeval tv = {1, 0};
-        int ret = select(0, &readfds, nullptr, nullptr, &tv);
-#else
-        struct pollfd pfd = {listenSock, POLLIN, 0};
-        int ret = poll(&pfd, 1, 1000);
-#endif
-        if (ret <= 0) continue;
+// ---------- Threads ----------
+
+void PortForwarder::StartLoop() {
+    if (m_running.load()) return;
+    if (m_wakeFd < 0) {
+        m_wakeFd = CreateWakeSocket();
+        if (m_wakeFd < 0) {
+            INST_LOG_WARN(TAG, "Failed to create wake socket, event loop will poll every 10 ms");
+        }
+    }
+    m_running.store(true);
+    m_loopThread = std::thread([this]() { EventLoop(); });
+    m_connectThread = std::thread([this]() { ConnectLoop(); });
+}
+
+void PortForwarder::StopLoop() {
+    if (!m_running.exchange(false)) return;
+    Wake();
+    m_connectCv.notify_all();
+    if (m_loopThread.joinable()) m_loopThread.join();
+    if (m_connectThread.joinable()) m_connectThread.join();
+
+    // Both threads are gone: finish late tasks (they may add relays) here
+    DrainTasks();
+    CloseRelays(0);
+    CloseListeners();
+    {
+        std::lock_guard<std::mutex> lock(m_connectMutex);
+        for (const auto& pending : m_connectQueue) {
+            CLOSE_SOCKET(static_cast<socket_t>(pending.clientSocket));
+        }
+        m_connectQueue.clear();
+    }
+    if (m_wakeFd >= 0) {
+        CLOSE_SOCKET(static_cast<socket_t>(m_wakeFd));
+        m_wakeFd = -1;
+    }
+}
 
-        socket_t clientSock = accept(listenSock, nullptr, nullptr);
-        if (clientSock == SOCKET_INVALID) continue;
+void PortForwarder::SubmitToLoop(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_tasks.push_back(std::move(fn));
+    }
+    Wake();
+}
 
-        uint16_t devicePort = entry->devicePort;
+void PortForwarder::RunOnLoop(std::function<void()> fn) {
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> finished = done->get_future();
+    SubmitToLoop([fn = std::move(fn), done]() {
+        fn();
+        done->set_value();
+    });
+    // StopLoop() runs the task itself if the loop exits first
+    finished.wait();
+}
 
-        // Spawn relay thread for this connection
-        std::thread([this, clientSock, devicePort]() {
-            idevice_t device = m_connection->GetDevice();
-            if (!device) {
-                CLOSE_SOCKET(clientSock);
-                return;
-            }
+void PortForwarder::DrainTasks() {
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        tasks.swap(m_tasks);
+    }
+    for (auto& fn : tasks) fn();
+}
 
-            // Connect to device port via usbmuxd
-            idevice_connection_t deviceConn = nullptr;
-            idevice_error_t err = idevice_connect(device, devicePort, &deviceConn);
-            if (err != IDEVICE_E_SUCCESS || !deviceConn) {
-                INST_LOG_ERROR(TAG, "Failed to connect to device port %u: %d", devicePort, err);
-                CLOSE_SOCKET(clientSock);
-                return;
-            }
+void PortForwarder::Wake() {
+    if (m_wakeFd < 0) return;
+    const char b = 1;
+    send(static_cast<socket_t>(m_wakeFd), &b, 1, 0);
+}
 
-            INST_LOG_DEBUG(TAG, "New relay connection to device port %u", devicePort);
-
-            // Bidirectional relay
-            constexpr size_t BUF_SIZE = 16384;
-            auto buf = std::make_unique<char[]>(BUF_SIZE);
-            bool running = true;
-
-            // Device -> Host thread
-            std::thread deviceToHost([&]() {
-                char localBuf[BUF_SIZE];
-                while (running) {
-                    uint32_t bytesRead = 0;
-                    idevice_error_t rerr = idevice_connection_receive_timeout(
-                        deviceConn, localBuf, BUF_SIZE, &bytesRead, 1000);
-                    if (rerr == IDEVICE_E_TIMEOUT) continue;
-                    if (rerr != IDEVICE_E_SUCCESS || bytesRead == 0) {
-                        running = false;
-                        break;
-                    }
-                    size_t sent = 0;
-                    while (sent < bytesRead && running) {
-                        int n = send(clientSock, localBuf + sent,
-                                     static_cast<int>(bytesRead - sent), 0);
-                        if (n <= 0) { running = false; break; }
-                        sent += n;
-                    }
-                }
-            });
-
-            // Host -> Device
-            while (running) {
-#ifdef _WIN32
-                fd_set readfds;
-                FD_ZERO(&readfds);
-                FD_SET(clientSock, &readfds);
-                struct timeval tv = {1, 0};
-                int ret = select(0, &readfds, nullptr, nullptr, &tv);
-#else
-                struct pollfd pfd = {clientSock, POLLIN, 0};
-                int ret = poll(&pfd, 1, 1000);
+// ---------- Event loop ----------
+
+void PortForwarder::EventLoop() {
+    INST_LOG_DEBUG(TAG, "Event loop started");
+#ifdef __linux__
+    // splice() into a socket has no MSG_NOSIGNAL: keep a client that hung
+    // up from raising SIGPIPE (the signal stays pending on this thread)
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
 #endif
-                if (ret <= 0) {
-                    if (ret < 0) running = false;
-                    continue;
-                }
-
-                int n = recv(clientSock, buf.get(), BUF_SIZE, 0);
-                if (n <= 0) { running = false; break; }
-
-                uint32_t bytesSent = 0;
-                idevice_error_t serr = idevice_connection_send(
-                    deviceConn, buf.get(), n, &bytesSent);
-                if (serr != IDEVICE_E_SUCCESS) {
-                    running = false;
-                    break;
-                }
+
+    std::vector<pollfd_t> fds;
+    while (m_running.load()) {
+        DrainTasks();
+
+        // Poll set: wake socket, listeners, then two entries per relay
+        fds.clear();
+        auto watch = [&fds](socket_t s, short events) {
+            pollfd_t p = {};
+            p.fd = s;
+            p.events = events;
+            fds.push_back(p);
+        };
+        if (m_wakeFd >= 0) watch(static_cast<socket_t>(m_wakeFd), POLLIN);
+        const size_t listenBase = fds.size();
+        for (const auto& entry : m_listeners) {
+            watch(static_cast<socket_t>(entry.listenSocket), POLLIN);
+        }
+        const size_t relayBase = fds.size();
+        for (const auto& relay : m_relays) {
+            // Read only into a buffer with room; wait for writable only
+            // while there is something to write
+            short clientEvents = 0, deviceEvents = 0;
+            if (!relay->toDevice.eof && relay->toDevice.HasSpace()) clientEvents |= POLLIN;
+            if (relay->toHost.HasData()) clientEvents |= POLLOUT;
+            if (!relay->toHost.eof && relay->toHost.HasSpace()) deviceEvents |= POLLIN;
+            if (relay->toDevice.HasData()) deviceEvents |= POLLOUT;
+            watch(relay->client, clientEvents);
+            watch(relay->device, deviceEvents);
+        }
+
+        const int ret = POLL_SOCKETS(fds.data(), static_cast<decltype(fds.size())>(fds.size()),
+                                     m_wakeFd >= 0 ? -1 : 10);
+        if (ret < 0) continue;
+
+        if (m_wakeFd >= 0 && fds[0].revents) {
+            char buf[64];
+            while (recv(static_cast<socket_t>(m_wakeFd), buf, sizeof(buf), 0) > 0) {}
+        }
+
+        // Relays first: their indices are only valid for this poll set
+        size_t kept = 0;
+        for (size_t i = 0; i < m_relays.size(); i++) {
+            const bool ready = fds[relayBase + 2 * i].revents || fds[relayBase + 2 * i + 1].revents;
+            if (ready && !m_relays[i]->Pump()) {
+                INST_LOG_DEBUG(TAG, "Relay connection closed for device port %u", m_relays[i]->devicePort);
+                m_relays[i].reset();
+                continue;
             }
+            if (kept != i) m_relays[kept] = std::move(m_relays[i]);
+            kept++;
+        }
+        m_relays.resize(kept);
 
-            deviceToHost.join();
-            idevice_disconnect(deviceConn);
-            CLOSE_SOCKET(clientSock);
-            INST_LOG_DEBUG(TAG, "Relay connection closed for device port %u", devicePort);
-        }).detach();
+        for (size_t i = 0; i < m_listeners.size(); i++) {
+            if (fds[listenBase + i].revents) AcceptClients(m_listeners[i]);
+        }
     }
 
-    CLOSE_SOCKET(listenSock);
+    INST_LOG_DEBUG(TAG, "Event loop stopped");
 }
 
-void PortForwarder::StopForward(uint16_t hostPort) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
-        if ((*it)->hostPort == hostPort) {
-            (*it)->running.store(false);
-            if ((*it)->acceptThread.joinable()) {
-                (*it)->acceptThread.join();
-            }
-            INST_LOG_INFO(TAG, "Stopped forwarding port %u", hostPort);
-            m_entries.erase(it);
-            return;
-        }
+void PortForwarder::AcceptClients(const ForwardEntry& entry) {
+    bool accepted = false;
+    for (;;) {
+        socket_t clientSock = accept(static_cast<socket_t>(entry.listenSocket), nullptr, nullptr);
+        if (clientSock == SOCKET_INVALID) break;
+        SetNonBlocking(clientSock);
+        SetNoSigPipe(clientSock);
+
+        std::lock_guard<std::mutex> lock(m_connectMutex);
+        m_connectQueue.push_back({static_cast<SocketHandle>(clientSock), entry.hostPort, entry.devicePort});
+        accepted = true;
     }
+    if (accepted) m_connectCv.notify_one();
 }
 
-void PortForwarder::StopAll() {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    for (auto& entry : m_entries) {
-        entry->running.store(false);
-        if (entry->acceptThread.joinable()) {
-            entry->acceptThread.join();
+void PortForwarder::CloseRelays(uint16_t hostPort) {
+    m_relays.erase(std::remove_if(m_relays.begin(), m_relays.end(),
+        [hostPort](const std::unique_ptr<Relay>& relay) {
+            return hostPort == 0 || relay->hostPort == hostPort;
+        }), m_relays.end());
+}
+
+void PortForwarder::CloseListeners() {
+    for (const auto& entry : m_listeners) {
+        CLOSE_SOCKET(static_cast<socket_t>(entry.listenSocket));
+    }
+    m_listeners.clear();
+}
+
+// ---------- usbmuxd connects ----------
+
+void PortForwarder::ConnectLoop() {
+    while (m_running.load()) {
+        PendingConnect pending;
+        {
+            std::unique_lock<std::mutex> lock(m_connectMutex);
+            m_connectCv.wait(lock, [this]() { return !m_running.load() || !m_connectQueue.empty(); });
+            if (!m_running.load()) break;
+            pending = m_connectQueue.front();
+            m_connectQueue.pop_front();
         }
+
+        const socket_t clientSock = static_cast<socket_t>(pending.clientSocket);
+        std::unique_ptr<Relay> relay;
+        if (m_connection->HasTunnelRoute()) {
+            relay = ConnectTunnel(pending);
+        } else {
+            relay = ConnectUsbmux(pending);
+        }
+        if (!relay) continue;
+
+        relay->client = clientSock;
+        relay->hostPort = pending.hostPort;
+        relay->devicePort = pending.devicePort;
+        SetNonBlocking(relay->device);
+        SetNoSigPipe(relay->device);
+        // usbmuxd connections are Unix sockets, client ones TCP: both splice
+        relay->toDevice.OpenPipe();
+        relay->toHost.OpenPipe();
+
+        INST_LOG_DEBUG(TAG, "New relay connection to device port %u", pending.devicePort);
+        // Tasks always run (StopLoop() drains the leftovers), so the
+        // relay is owned again on the loop thread
+        Relay* raw = relay.release();
+        SubmitToLoop([this, raw]() {
+            std::unique_ptr<Relay> owned(raw);
+            // The port may have been stopped while connecting
+            const bool listening = std::any_of(m_listeners.begin(), m_listeners.end(),
+                [&owned](const ForwardEntry& entry) { return entry.hostPort == owned->hostPort; });
+            if (listening) m_relays.push_back(std::move(owned));
+        });
     }
-    m_entries.clear();
-    INST_LOG_INFO(TAG, "All port forwarding stopped");
 }
 
-bool PortForwarder::IsActive() const {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return !m_entries.empty();
+std::unique_ptr<PortForwarder::Relay> PortForwarder::ConnectUsbmux(const PendingConnect& pending) {
+    const socket_t clientSock = static_cast<socket_t>(pending.clientSocket);
+    idevice_t device = m_connection->GetDevice();
+    if (!device) {
+        CLOSE_SOCKET(clientSock);
+        return nullptr;
+    }
+
+    // Connect to device port via usbmuxd
+    idevice_connection_t deviceConn = nullptr;
+    idevice_error_t err = idevice_connect(device, pending.devicePort, &deviceConn);
+    int deviceFd = -1;
+    if (err != IDEVICE_E_SUCCESS || !deviceConn ||
+        idevice_connection_get_fd(deviceConn, &deviceFd) != IDEVICE_E_SUCCESS || deviceFd < 0) {
+        INST_LOG_ERROR(TAG, "Failed to connect to device port %u: %d", pending.devicePort, err);
+        if (deviceConn) idevice_disconnect(deviceConn);
+        CLOSE_SOCKET(clientSock);
+        return nullptr;
+    }
+
+    // Forwarded ports are plain usbmuxd connections: the loop moves
+    // bytes on the fd directly, without blocking
+    auto relay = std::make_unique<Relay>();
+    relay->device = static_cast<socket_t>(deviceFd);
+    relay->deviceConn = deviceConn;
+    return relay;
 }
 
-std::map<uint16_t, uint16_t> PortForwarder::GetForwardedPorts() const {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    std::map<uint16_t, uint16_t> result;
-    for (const auto& entry : m_entries) {
-        result[entry->hostPort] = entry->devicePort;
+std::unique_ptr<PortForwarder::Relay> PortForwarder::ConnectTunnel(const PendingConnect& pending) {
+    const socket_t clientSock = static_cast<socket_t>(pending.clientSocket);
+
+    // A userspace tunnel copies the client socket itself, on its own loop
+    Error err = m_connection->BridgeTunnelPort(static_cast<int>(pending.clientSocket), pending.devicePort);
+    if (err == Error::Success) {
+        INST_LOG_DEBUG(TAG, "Device port %u bridged by the tunnel", pending.devicePort);
+        return nullptr;
+    }
+    if (err != Error::NotSupported) {
+        INST_LOG_ERROR(TAG, "Failed to connect to device port %u through the tunnel", pending.devicePort);
+        return nullptr;   // the tunnel closed the client
+    }
+
+    // External tunnel or USB-NCM: an OS socket to the device address
+    const int deviceFd = m_connection->ConnectTunnelPort(pending.devicePort);
+    if (deviceFd < 0) {
+        INST_LOG_ERROR(TAG, "Failed to connect to device port %u through the tunnel", pending.devicePort);
+        CLOSE_SOCKET(clientSock);
+        return nullptr;
     }
-    return result;
+    auto relay = std::make_unique<Relay>();
+    relay->device = static_cast<socket_t>(deviceFd);
+    return relay;
 }
 
 } // namespace instruments
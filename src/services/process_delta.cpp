@@ -0,0 +1,66 @@
+#include "process_delta.h"
+#include <cmath>
+
+namespace instruments {
+
+// Copy everything but the name
+static void CopyCounters(ProcessMetrics& dst, const ProcessMetrics& src) {
+    dst.pid = src.pid;
+    dst.cpuUsage = src.cpuUsage;
+    dst.memResident = src.memResident;
+    dst.memAnon = src.memAnon;
+    dst.memVirtual = src.memVirtual;
+    dst.diskBytesRead = src.diskBytesRead;
+    dst.diskBytesWritten = src.diskBytesWritten;
+    dst.threads = src.threads;
+}
+
+bool ProcessDeltaTracker::Changed(const ProcessMetrics& row, const ProcessMetrics& last) const {
+    return std::fabs(row.cpuUsage - last.cpuUsage) > m_cpuEpsilon ||
+           row.memResident != last.memResident ||
+           row.memAnon != last.memAnon ||
+           row.memVirtual != last.memVirtual ||
+           row.diskBytesRead != last.diskBytesRead ||
+           row.diskBytesWritten != last.diskBytesWritten ||
+           row.threads != last.threads;
+}
+
+bool ProcessDeltaTracker::Update(const std::vector<ProcessMetrics>& rows, ProcessDelta& out) {
+    out.added.clear();
+    out.changed.clear();
+    out.removed.clear();
+    const uint64_t generation = ++m_generation;
+    size_t seen = 0;
+
+    for (const auto& row : rows) {
+        auto [it, inserted] = m_procs.try_emplace(row.pid);
+        Entry& entry = it->second;
+        if (entry.seen != generation) seen++;
+        entry.seen = generation;
+
+        // Rows without a name (attribute not requested) keep the stored one
+        if (inserted || (!row.name.empty() && row.name != entry.last.name)) {
+            entry.last = row;
+            out.added.push_back(row);
+        } else if (Changed(row, entry.last)) {
+            CopyCounters(entry.last, row);
+            out.changed.emplace_back();
+            CopyCounters(out.changed.back(), row);
+        }
+    }
+
+    // Only walk the map when some pid went missing
+    if (m_procs.size() > seen) {
+        for (auto it = m_procs.begin(); it != m_procs.end();) {
+            if (it->second.seen != generation) {
+                out.removed.push_back(it->first);
+                it = m_procs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return !out.Empty();
+}
+
+} // namespace instruments
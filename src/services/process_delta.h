@@ -0,0 +1,41 @@
+#ifndef INSTRUMENTS_PROCESS_DELTA_H
+#define INSTRUMENTS_PROCESS_DELTA_H
+
+#include "../../include/instruments/types.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace instruments {
+
+// ProcessDeltaTracker - turns full sysmontap process lists into
+// ProcessDelta updates. Keeps the last reported row of every pid (its name
+// stored once); cpuUsage moves within cpuEpsilon of the reported value do
+// not count as a change, every other field is compared exactly.
+class ProcessDeltaTracker {
+public:
+    explicit ProcessDeltaTracker(double cpuEpsilon = 0.0) : m_cpuEpsilon(cpuEpsilon) {}
+
+    // Compare rows with the previous sample; out is overwritten (its
+    // vectors keep their capacity). Returns false when nothing changed.
+    bool Update(const std::vector<ProcessMetrics>& rows, ProcessDelta& out);
+
+    size_t Size() const { return m_procs.size(); }
+    void Clear() { m_procs.clear(); }
+
+private:
+    struct Entry {
+        ProcessMetrics last;
+        uint64_t seen = 0;      // generation of the last sample with this pid
+    };
+
+    bool Changed(const ProcessMetrics& row, const ProcessMetrics& last) const;
+
+    double m_cpuEpsilon;
+    uint64_t m_generation = 0;
+    std::unordered_map<int64_t, Entry> m_procs;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_PROCESS_DELTA_H
@@ -1,18 +1,33 @@
 #include "../../include/instruments/process_service.h"
+#include "../../include/instruments/dtx_method.h"
+#include "../connection/appservice_client.h"
 #include "../nskeyedarchiver/nsobject.h"
 #include "../util/log.h"
+#include <chrono>
+#include <future>
 
 namespace instruments {
 
 static const char* TAG = "ProcessService";
 static constexpr int kProcessListTimeoutMs = 15000;
+static constexpr int kLaunchTimeoutMs = 10000;
+// Kill and memory-limit requests: the device acts on the process before it
+// replies, so they get a fixed timeout rather than the adaptive RTT one
+static constexpr int kProcessControlTimeoutMs = 10000;
+
+// processcontrol / mobilenotifications methods with fixed argument types
+using KillPid = DTXMethod<"killPid:", uint64_t>;
+using DisableMemoryLimits = DTXMethod<"requestDisableMemoryLimitsForPid:", int64_t>;
+using SetAppStateNotifications = DTXMethod<"setApplicationStateNotificationsEnabled:", bool>;
 
 ProcessService::ProcessService(std::shared_ptr<DeviceConnection> connection)
     : m_connection(std::move(connection))
 {
 }
 
-ProcessService::~ProcessService() = default;
+ProcessService::~ProcessService() {
+    StopProcessCache();
+}
 
 Error ProcessService::GetProcessList(std::vector<ProcessInfo>& outProcesses) {
     if (!m_connection) return Error::ConnectionFailed;
@@ -30,10 +45,18 @@ Error ProcessService::LaunchApp(const std::string& bundleId,
                                 int64_t& outPid) {
     if (!m_connection) return Error::ConnectionFailed;
 
-    if (m_connection->IsRSD()) {
-        return LaunchAppXPC(bundleId, env, args, killExisting, outPid);
+    Error err = m_connection->IsRSD()
+        ? LaunchAppXPC(bundleId, env, args, killExisting, outPid)
+        : LaunchAppDTX(bundleId, env, args, killExisting, outPid);
+    if (err == Error::Success && outPid > 0 && IsProcessCacheRunning()) {
+        ProcessInfo info;
+        info.pid = outPid;
+        info.bundleId = bundleId;
+        info.isApplication = true;
+        m_cache.Insert(info);
+        RequestCacheRefresh();  // fills in name etc.; drops a pid replaced by killExisting
     }
-    return LaunchAppDTX(bundleId, env, args, killExisting, outPid);
+    return err;
 }
 
 Error ProcessService::LaunchApp(const std::string& bundleId, int64_t& outPid) {
@@ -43,24 +66,56 @@ Error ProcessService::LaunchApp(const std::string& bundleId, int64_t& outPid) {
 Error ProcessService::KillProcess(int64_t pid) {
     if (!m_connection) return Error::ConnectionFailed;
 
-    if (m_connection->IsRSD()) {
-        return KillProcessXPC(pid);
+    Error err = m_connection->IsRSD() ? KillProcessXPC(pid) : KillProcessDTX(pid);
+    if (err == Error::Success && IsProcessCacheRunning()) {
+        m_cache.Erase(pid);
+        RequestCacheRefresh();
+    }
+    return err;
+}
+
+Error ProcessService::RunBatch(const std::vector<ProcessOp>& ops,
+                               std::vector<ProcessOpResult>& results,
+                               int timeoutMs) {
+    results.assign(ops.size(), ProcessOpResult{});
+    if (!m_connection) return Error::ConnectionFailed;
+    if (ops.empty()) return Error::Success;
+
+    // Batches go through DTX on every iOS version: one ProcessControl
+    // channel pipelines the whole batch
+    Error err = RunBatchDTX(ops, results, timeoutMs);
+    if (err != Error::Success) {
+        for (auto& result : results) result.error = err;
+        return err;
     }
-    return KillProcessDTX(pid);
+
+    if (IsProcessCacheRunning()) {
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (results[i].error != Error::Success) continue;
+            if (ops[i].kind == ProcessOp::Kind::Kill) {
+                m_cache.Erase(ops[i].pid);
+            } else if (results[i].pid > 0) {
+                ProcessInfo info;
+                info.pid = results[i].pid;
+                info.bundleId = ops[i].bundleId;
+                info.isApplication = true;
+                m_cache.Insert(info);
+            }
+        }
+        RequestCacheRefresh();
+    }
+    return Error::Success;
 }
 
 Error ProcessService::DisableMemoryLimit(int64_t pid) {
-    auto dtxConn = m_connection->CreateInstrumentConnection();
+    auto dtxConn = m_connection->SharedInstrumentConnection();
     if (!dtxConn) return Error::ConnectionFailed;
 
     auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::ProcessControl);
     if (!channel) return Error::ServiceStartFailed;
 
-    auto msg = DTXMessage::CreateWithSelector("requestDisableMemoryLimitsForPid:");
-    msg->AppendAuxiliary(NSObject(pid));
-
-    auto response = channel->SendMessageSync(msg);
-    channel->Cancel();
+    auto response = channel->SendMessageSync(DisableMemoryLimits::Make(pid), kProcessControlTimeoutMs);
+    dtxConn->CloseChannel(channel);
 
     if (!response) return Error::Timeout;
 
@@ -71,28 +126,193 @@ Error ProcessService::DisableMemoryLimit(int64_t pid) {
     return Error::Success;
 }
 
-// --- DTX implementations ---
+// --- Process cache ---
 
-Error ProcessService::GetProcessListDTX(std::vector<ProcessInfo>& outProcesses) {
-    auto dtxConn = m_connection->CreateInstrumentConnection();
-    if (!dtxConn) return Error::ConnectionFailed;
+void ProcessService::Cache::Insert(const ProcessInfo& info) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = byPid[info.pid];
+    entry.info = info;
+    entry.seen = generation;
+    if (!info.bundleId.empty()) byBundleId[info.bundleId] = info.pid;
+}
 
-    auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::DeviceInfo);
-    if (!channel) return Error::ServiceStartFailed;
+void ProcessService::Cache::Erase(int64_t pid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byPid.find(pid);
+    if (it == byPid.end()) return;
+    auto bundle = byBundleId.find(it->second.info.bundleId);
+    if (bundle != byBundleId.end() && bundle->second == pid) byBundleId.erase(bundle);
+    byPid.erase(it);
+}
 
-    auto msg = DTXMessage::CreateWithSelector("runningProcesses");
-    auto response = channel->SendMessageSync(msg, kProcessListTimeoutMs);
-    channel->Cancel();
+void ProcessService::Cache::Apply(std::vector<ProcessInfo>& processes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t current = ++generation;
+    for (auto& proc : processes) {
+        Entry& entry = byPid[proc.pid];
+        entry.seen = current;
+        if (!proc.bundleId.empty()) {
+            // Later launches of the same app win
+            auto [it, inserted] = byBundleId.try_emplace(proc.bundleId, proc.pid);
+            if (!inserted && it->second != proc.pid) {
+                auto other = byPid.find(it->second);
+                if (other == byPid.end() || other->second.info.startDate <= proc.startDate) {
+                    it->second = proc.pid;
+                }
+            }
+        }
+        entry.info = std::move(proc);
+    }
+    for (auto it = byPid.begin(); it != byPid.end();) {
+        if (it->second.seen != current) {
+            auto bundle = byBundleId.find(it->second.info.bundleId);
+            if (bundle != byBundleId.end() && bundle->second == it->first) byBundleId.erase(bundle);
+            it = byPid.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
 
-    if (!response) return Error::Timeout;
+Error ProcessService::StartProcessCache(uint32_t refreshIntervalMs) {
+    if (!m_connection) return Error::ConnectionFailed;
+    if (IsProcessCacheRunning()) return Error::Success;
+
+    std::vector<ProcessInfo> processes;
+    Error err = GetProcessList(processes);
+    if (err != Error::Success) return err;
+    m_cache.Apply(processes);
+
+    {
+        std::lock_guard<std::mutex> lock(m_cache.mutex);
+        m_cache.running = true;
+        m_cache.refreshNow = false;
+        m_cache.intervalMs = refreshIntervalMs ? refreshIntervalMs : 1;
+    }
+    SubscribeAppStateNotifications();
+    m_cache.thread = std::thread([this]() { CacheLoop(); });
+    INST_LOG_INFO(TAG, "Process cache started (%zu processes, refresh %ums)",
+                  processes.size(), refreshIntervalMs);
+    return Error::Success;
+}
 
-    auto payload = response->PayloadObject();
-    if (!payload || !payload->IsArray()) {
-        INST_LOG_ERROR(TAG, "Unexpected process list format");
-        return Error::ProtocolError;
+void ProcessService::StopProcessCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_cache.mutex);
+        if (!m_cache.running) return;
+        m_cache.running = false;
+    }
+    m_cache.cv.notify_all();
+    if (m_cache.thread.joinable()) m_cache.thread.join();
+
+    if (m_cache.notifications) {
+        m_cache.dtxConnection->CloseChannel(m_cache.notifications);
+        m_cache.notifications.reset();
+    }
+    m_cache.dtxConnection.reset();
+
+    std::lock_guard<std::mutex> lock(m_cache.mutex);
+    m_cache.byPid.clear();
+    m_cache.byBundleId.clear();
+}
+
+bool ProcessService::IsProcessCacheRunning() const {
+    std::lock_guard<std::mutex> lock(m_cache.mutex);
+    return m_cache.running;
+}
+
+void ProcessService::RequestCacheRefresh() {
+    {
+        std::lock_guard<std::mutex> lock(m_cache.mutex);
+        m_cache.refreshNow = true;
+    }
+    m_cache.cv.notify_all();
+}
+
+// App state changes trigger a refresh. Best effort: without the channel
+// the periodic refresh still runs.
+void ProcessService::SubscribeAppStateNotifications() {
+    auto dtxConn = m_connection->SharedInstrumentConnection();
+    if (!dtxConn) return;
+    auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::MobileNotifications);
+    if (!channel) {
+        INST_LOG_DEBUG(TAG, "mobilenotifications unavailable; process cache uses periodic refresh only");
+        return;
     }
+    channel->SetMessageHandler([this](std::shared_ptr<DTXMessage>) { RequestCacheRefresh(); });
+
+    channel->SendMessageAsync(SetAppStateNotifications::Make(true));
+
+    m_cache.dtxConnection = std::move(dtxConn);
+    m_cache.notifications = std::move(channel);
+}
 
-    for (const auto& item : payload->AsArray()) {
+void ProcessService::CacheLoop() {
+    std::unique_lock<std::mutex> lock(m_cache.mutex);
+    while (m_cache.running) {
+        m_cache.cv.wait_for(lock, std::chrono::milliseconds(m_cache.intervalMs),
+                            [this]() { return !m_cache.running || m_cache.refreshNow; });
+        if (!m_cache.running) break;
+        m_cache.refreshNow = false;
+
+        lock.unlock();
+        std::vector<ProcessInfo> processes;
+        if (GetProcessList(processes) == Error::Success) {
+            m_cache.Apply(processes);
+        } else {
+            INST_LOG_WARN(TAG, "Process cache refresh failed; keeping the previous table");
+        }
+        lock.lock();
+    }
+}
+
+bool ProcessService::FindProcess(int64_t pid, ProcessInfo& out) {
+    {
+        std::lock_guard<std::mutex> lock(m_cache.mutex);
+        if (m_cache.running) {
+            auto it = m_cache.byPid.find(pid);
+            if (it == m_cache.byPid.end()) return false;
+            out = it->second.info;
+            return true;
+        }
+    }
+    std::vector<ProcessInfo> processes;
+    if (GetProcessList(processes) != Error::Success) return false;
+    for (auto& proc : processes) {
+        if (proc.pid == pid) {
+            out = std::move(proc);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ProcessService::FindProcessByBundleId(const std::string& bundleId, ProcessInfo& out) {
+    {
+        std::lock_guard<std::mutex> lock(m_cache.mutex);
+        if (m_cache.running) {
+            auto it = m_cache.byBundleId.find(bundleId);
+            if (it == m_cache.byBundleId.end()) return false;
+            out = m_cache.byPid.at(it->second).info;
+            return true;
+        }
+    }
+    std::vector<ProcessInfo> processes;
+    if (GetProcessList(processes) != Error::Success) return false;
+    const ProcessInfo* best = nullptr;
+    for (const auto& proc : processes) {
+        if (proc.bundleId == bundleId && (!best || proc.startDate >= best->startDate)) best = &proc;
+    }
+    if (!best) return false;
+    out = *best;
+    return true;
+}
+
+// --- DTX implementations ---
+
+// runningProcesses reply -> ProcessInfo list
+static void ParseProcessList(const NSObject& payload, std::vector<ProcessInfo>& outProcesses) {
+    for (const auto& item : payload.AsArray()) {
         if (!item.IsDict()) continue;
 
         ProcessInfo proc;
@@ -111,21 +331,36 @@ Error ProcessService::GetProcessListDTX(std::vector<ProcessInfo>& outProcesses)
 
         outProcesses.push_back(std::move(proc));
     }
-
-    INST_LOG_INFO(TAG, "Found %zu processes", outProcesses.size());
-    return Error::Success;
 }
 
-Error ProcessService::LaunchAppDTX(const std::string& bundleId,
-                                    const std::map<std::string, std::string>& env,
-                                    const std::vector<std::string>& args,
-                                    bool killExisting, int64_t& outPid) {
-    auto dtxConn = m_connection->CreateInstrumentConnection();
+Error ProcessService::GetProcessListDTX(std::vector<ProcessInfo>& outProcesses) {
+    auto dtxConn = m_connection->SharedInstrumentConnection();
     if (!dtxConn) return Error::ConnectionFailed;
 
-    auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::ProcessControl);
+    auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::DeviceInfo);
     if (!channel) return Error::ServiceStartFailed;
 
+    auto msg = DTXMessage::CreateWithSelector("runningProcesses");
+    auto response = channel->SendMessageSync(msg, kProcessListTimeoutMs);
+    dtxConn->CloseChannel(channel);
+
+    if (!response) return Error::Timeout;
+
+    auto payload = response->PayloadObject();
+    if (!payload || !payload->IsArray()) {
+        INST_LOG_ERROR(TAG, "Unexpected process list format");
+        return Error::ProtocolError;
+    }
+
+    ParseProcessList(*payload, outProcesses);
+    INST_LOG_INFO(TAG, "Found %zu processes", outProcesses.size());
+    return Error::Success;
+}
+
+static std::shared_ptr<DTXMessage> MakeLaunchMessage(const std::string& bundleId,
+                                                     const std::map<std::string, std::string>& env,
+                                                     const std::vector<std::string>& args,
+                                                     bool killExisting) {
     auto msg = DTXMessage::CreateWithSelector(
         "launchSuspendedProcessWithDevicePath:bundleIdentifier:environment:arguments:options:");
 
@@ -167,15 +402,30 @@ Error ProcessService::LaunchAppDTX(const std::string& bundleId,
     optionsObj.SetClassName("NSMutableDictionary");
     optionsObj.SetClassHierarchy({"NSMutableDictionary", "NSDictionary", "NSObject"});
     msg->AppendAuxiliary(optionsObj);
+    return msg;
+}
 
-    auto response = channel->SendMessageSync(msg, 10000);
-    channel->Cancel();
+static std::shared_ptr<DTXMessage> MakeKillMessage(int64_t pid) {
+    return KillPid::Make(static_cast<uint64_t>(pid));
+}
+
+Error ProcessService::LaunchAppDTX(const std::string& bundleId,
+                                    const std::map<std::string, std::string>& env,
+                                    const std::vector<std::string>& args,
+                                    bool killExisting, int64_t& outPid) {
+    auto dtxConn = m_connection->SharedInstrumentConnection();
+    if (!dtxConn) return Error::ConnectionFailed;
+
+    auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::ProcessControl);
+    if (!channel) return Error::ServiceStartFailed;
+
+    auto msg = MakeLaunchMessage(bundleId, env, args, killExisting);
+    auto response = channel->SendMessageSync(msg, kLaunchTimeoutMs);
+    dtxConn->CloseChannel(channel);
 
     if (!response) return Error::Timeout;
 
-    auto payload = response->PayloadObject();
-    if (payload) {
-        outPid = static_cast<int64_t>(payload->ToNumber());
+    if (DTXDecodeReply(*response, outPid)) {
         INST_LOG_INFO(TAG, "Launched %s with PID %lld",
                      bundleId.c_str(), (long long)outPid);
     }
@@ -184,17 +434,14 @@ Error ProcessService::LaunchAppDTX(const std::string& bundleId,
 }
 
 Error ProcessService::KillProcessDTX(int64_t pid) {
-    auto dtxConn = m_connection->CreateInstrumentConnection();
+    auto dtxConn = m_connection->SharedInstrumentConnection();
     if (!dtxConn) return Error::ConnectionFailed;
 
     auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::ProcessControl);
     if (!channel) return Error::ServiceStartFailed;
 
-    auto msg = DTXMessage::CreateWithSelector("killPid:");
-    msg->AppendAuxiliary(NSObject(static_cast<uint64_t>(pid)));
-
-    auto response = channel->SendMessageSync(msg);
-    channel->Cancel();
+    auto response = channel->SendMessageSync(MakeKillMessage(pid), kProcessControlTimeoutMs);
+    dtxConn->CloseChannel(channel);
 
     INST_LOG_INFO(TAG, "Kill PID %lld: %s", (long long)pid,
                  response ? "success" : "timeout");
@@ -202,14 +449,67 @@ Error ProcessService::KillProcessDTX(int64_t pid) {
     return response ? Error::Success : Error::Timeout;
 }
 
+Error ProcessService::RunBatchDTX(const std::vector<ProcessOp>& ops,
+                                   std::vector<ProcessOpResult>& results,
+                                   int timeoutMs) {
+    auto dtxConn = m_connection->SharedInstrumentConnection();
+    if (!dtxConn) return Error::ConnectionFailed;
+
+    auto channel = dtxConn->MakeChannelWithIdentifier(ChannelId::ProcessControl);
+    if (!channel) return Error::ServiceStartFailed;
+
+    // Send everything, then collect: the device answers in order, so the
+    // batch costs about one round trip plus its execution time
+    std::vector<std::future<std::shared_ptr<DTXMessage>>> replies;
+    replies.reserve(ops.size());
+    for (const auto& op : ops) {
+        auto msg = op.kind == ProcessOp::Kind::Launch
+            ? MakeLaunchMessage(op.bundleId, op.env, op.args, op.killExisting)
+            : MakeKillMessage(op.pid);
+        replies.push_back(channel->SendMessageFuture(msg, timeoutMs));
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    size_t failed = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        ProcessOpResult& result = results[i];
+        std::shared_ptr<DTXMessage> reply;
+        if (replies[i].wait_until(deadline) == std::future_status::ready) reply = replies[i].get();
+        if (!reply) {
+            result.error = Error::Timeout;
+            failed++;
+            continue;
+        }
+        result.error = Error::Success;
+        if (ops[i].kind == ProcessOp::Kind::Launch) {
+            DTXDecodeReply(*reply, result.pid);
+        } else {
+            result.pid = ops[i].pid;
+        }
+    }
+    dtxConn->CloseChannel(channel);
+
+    INST_LOG_INFO(TAG, "Batch of %zu process operations: %zu failed", ops.size(), failed);
+    return Error::Success;
+}
+
 // --- XPC implementations (iOS 17+) ---
 
-Error ProcessService::GetProcessListXPC(std::vector<ProcessInfo>& outProcesses) {
-    // iOS 17+ uses CoreDevice AppService for process listing
-    // Feature: com.apple.coredevice.feature.listprocesses
+// CoreDevice appservice features
+static const char* kLaunchFeature = "com.apple.coredevice.feature.launchapplication";
+static const char* kSignalFeature = "com.apple.coredevice.feature.sendsignaltoprocess";
 
-    // For now, fall back to DTX which also works on iOS 17+
-    // when connected via tunnel
+// Binary plist of an empty dictionary (launch platformSpecificOptions)
+static const uint8_t kEmptyDictPlist[] = {
+    'b', 'p', 'l', 'i', 's', 't', '0', '0', 0xD0, 0x08,
+    0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9,
+};
+
+Error ProcessService::GetProcessListXPC(std::vector<ProcessInfo>& outProcesses) {
+    // The appservice listprocesses reply has only pids and executable
+    // URLs; the cache and FindProcessByBundleId() need bundle ids, which
+    // the DTX listing over the pooled instruments connection carries
     return GetProcessListDTX(outProcesses);
 }
 
@@ -217,19 +517,77 @@ Error ProcessService::LaunchAppXPC(const std::string& bundleId,
                                     const std::map<std::string, std::string>& env,
                                     const std::vector<std::string>& args,
                                     bool killExisting, int64_t& outPid) {
-    // iOS 17+ uses CoreDevice AppService for app launch
-    // Feature: com.apple.coredevice.feature.launchapplication
+    auto appService = m_connection->SharedAppServiceClient();
+    if (!appService) return LaunchAppDTX(bundleId, env, args, killExisting, outPid);
 
-    // For now, fall back to DTX
-    return LaunchAppDTX(bundleId, env, args, killExisting, outPid);
+    NSObject::DictType bundle;
+    bundle["_0"] = NSObject(bundleId);
+    NSObject::DictType specifier;
+    specifier["bundleIdentifier"] = NSObject(std::move(bundle));
+
+    NSObject::DictType envDict;
+    for (const auto& [key, value] : env) envDict[key] = NSObject(value);
+    NSObject::ArrayType argArray;
+    for (const auto& arg : args) argArray.push_back(NSObject(arg));
+    NSObject::DictType user;
+    user["shortName"] = NSObject("mobile");
+
+    NSObject::DictType options;
+    options["arguments"] = NSObject(std::move(argArray));
+    options["environmentVariables"] = NSObject(std::move(envDict));
+    options["standardIOUsesPseudoterminals"] = NSObject(true);
+    options["startStopped"] = NSObject(false);
+    options["terminateExisting"] = NSObject(killExisting);
+    options["user"] = NSObject(std::move(user));
+    options["platformSpecificOptions"] = NSObject(std::vector<uint8_t>(
+        kEmptyDictPlist, kEmptyDictPlist + sizeof(kEmptyDictPlist)));
+
+    NSObject::DictType input;
+    input["applicationSpecifier"] = NSObject(std::move(specifier));
+    input["options"] = NSObject(std::move(options));
+    input["standardIOIdentifiers"] = NSObject::MakeDict({});
+
+    AppServiceReply reply;
+    Error err = appService->Invoke(kLaunchFeature, NSObject(std::move(input)), reply, kLaunchTimeoutMs);
+    if (err == Error::Success) {
+        outPid = reply.output["processToken"]["processIdentifier"].AsInt64();
+        if (outPid > 0) {
+            INST_LOG_INFO(TAG, "Launched %s with PID %lld (appservice)", bundleId.c_str(), (long long)outPid);
+            return Error::Success;
+        }
+        err = Error::ProtocolError;   // launched, maybe, but no pid to return
+    }
+
+    // Dropped, unanswered, refused or no pid: DTX still works. A request
+    // that timed out (or answered without a pid) may have launched the app
+    // all the same, so that retry always kills the existing instance:
+    // relaunching beats leaving two instances behind.
+    const bool mayHaveLaunched = err == Error::Timeout ||
+                                 (err == Error::ProtocolError && !reply.error.IsValid());
+    INST_LOG_WARN(TAG, "LaunchApp %s (appservice) failed: %s %s; retrying over DTX%s",
+                  bundleId.c_str(), ErrorToString(err), reply.ErrorDescription().c_str(),
+                  mayHaveLaunched && !killExisting ? " (killing an instance it may have started)" : "");
+    return LaunchAppDTX(bundleId, env, args, killExisting || mayHaveLaunched, outPid);
 }
 
 Error ProcessService::KillProcessXPC(int64_t pid) {
-    // iOS 17+ uses CoreDevice AppService for killing
-    // Feature: com.apple.coredevice.feature.sendsignaltoprocess
-
-    // For now, fall back to DTX
-    return KillProcessDTX(pid);
+    auto appService = m_connection->SharedAppServiceClient();
+    if (!appService) return KillProcessDTX(pid);
+
+    NSObject::DictType process;
+    process["processIdentifier"] = NSObject(pid);
+    NSObject::DictType input;
+    input["process"] = NSObject(std::move(process));
+    input["signal"] = NSObject(static_cast<int64_t>(9));   // SIGKILL
+
+    AppServiceReply reply;
+    Error err = appService->Invoke(kSignalFeature, NSObject(std::move(input)), reply, kLaunchTimeoutMs);
+    if (err != Error::Success) {
+        INST_LOG_WARN(TAG, "Kill %lld (appservice) failed: %s %s; retrying over DTX", (long long)pid,
+                      ErrorToString(err), reply.ErrorDescription().c_str());
+        return KillProcessDTX(pid);
+    }
+    return Error::Success;
 }
 
 } // namespace instruments
@@ -0,0 +1,152 @@
+#include "relay_pipe.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+using socket_t = SOCKET;
+#define SOCKET_WOULD_BLOCK (WSAGetLastError() == WSAEWOULDBLOCK)
+#define MSG_NOSIGNAL 0
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+using socket_t = int;
+#define SOCKET_WOULD_BLOCK (errno == EAGAIN || errno == EWOULDBLOCK)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0   // macOS: relay sockets set SO_NOSIGPIPE instead
+#endif
+#endif
+
+namespace instruments {
+
+// Relay buffers start small (most WDA requests are tiny) and double while
+// reads fill them, up to kMaxRelayBuffer per direction. A full buffer stops
+// reading from its source until the other side drains it.
+static constexpr size_t kMinRelayBuffer = 16 * 1024;
+static constexpr size_t kMaxRelayBuffer = 256 * 1024;
+
+bool RelayPipe::OpenPipe() {
+#ifdef __linux__
+    if (pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        pipeFds[0] = pipeFds[1] = -1;
+        return false;
+    }
+    // Same ceiling as the buffered path; the default is 64KB
+    fcntl(pipeFds[1], F_SETPIPE_SZ, static_cast<int>(kMaxRelayBuffer));
+    const int size = fcntl(pipeFds[1], F_GETPIPE_SZ);
+    pipeCapacity = size > 0 ? static_cast<size_t>(size) : 65536;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool RelayPipe::Spliced() const {
+#ifdef __linux__
+    return pipeFds[0] >= 0;
+#else
+    return false;
+#endif
+}
+
+bool RelayPipe::HasData() const {
+#ifdef __linux__
+    if (Spliced()) return pipeBytes > 0;
+#endif
+    return begin < end;
+}
+
+bool RelayPipe::HasSpace() const {
+#ifdef __linux__
+    if (Spliced()) return !pipeFull && pipeBytes < pipeCapacity;
+#endif
+    return buf.empty() || end < buf.size() || begin > 0;
+}
+
+bool RelayPipe::Fill(RelaySocket src) {
+    const socket_t s = static_cast<socket_t>(src);
+#ifdef __linux__
+    if (Spliced()) {
+        // A 0-byte splice also returns 0: only ask when there is room, so
+        // 0 always means src closed
+        if (!HasSpace()) return true;
+        const ssize_t n = splice(s, nullptr, pipeFds[1], nullptr, pipeCapacity - pipeBytes,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            pipeBytes += static_cast<size_t>(n);
+            return true;
+        }
+        if (n == 0) {
+            eof = true;
+            return true;
+        }
+        if (errno == EAGAIN) {
+            // Either src has nothing, or the pipe is out of slots although
+            // pipeBytes < pipeCapacity. With bytes queued, stop polling src
+            // until Flush() makes room instead of spinning on its POLLIN.
+            if (pipeBytes > 0) pipeFull = true;
+            return true;
+        }
+        if (errno != EINVAL || pipeBytes > 0) return false;
+        // Socket type without splice support: fall back before any
+        // byte went through the pipe
+        ClosePipe();
+    }
+#endif
+    if (buf.empty()) buf.resize(kMinRelayBuffer);
+    if (end == buf.size() && begin > 0) {
+        std::memmove(buf.data(), buf.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    const size_t space = buf.size() - end;
+    if (space == 0) return true;
+    const int n = recv(s, buf.data() + end, static_cast<int>(space), 0);
+    if (n == 0) {
+        eof = true;
+        return true;
+    }
+    if (n < 0) return SOCKET_WOULD_BLOCK;
+    end += static_cast<size_t>(n);
+    // The read took all the room: a fast source, give it more
+    if (static_cast<size_t>(n) == space && buf.size() < kMaxRelayBuffer) {
+        buf.resize(buf.size() * 2);
+    }
+    return true;
+}
+
+bool RelayPipe::Flush(RelaySocket dst) {
+    const socket_t s = static_cast<socket_t>(dst);
+#ifdef __linux__
+    if (Spliced()) {
+        while (pipeBytes > 0) {
+            const ssize_t n = splice(pipeFds[0], nullptr, s, nullptr, pipeBytes,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n <= 0) return n < 0 && errno == EAGAIN;
+            pipeBytes -= static_cast<size_t>(n);
+            pipeFull = false;
+        }
+        return true;
+    }
+#endif
+    while (begin < end) {
+        const int n = send(s, buf.data() + begin, static_cast<int>(end - begin), MSG_NOSIGNAL);
+        if (n <= 0) return n < 0 && SOCKET_WOULD_BLOCK;
+        begin += static_cast<size_t>(n);
+    }
+    begin = end = 0;
+    return true;
+}
+
+void RelayPipe::ClosePipe() {
+#ifdef __linux__
+    if (pipeFds[0] >= 0) close(pipeFds[0]);
+    if (pipeFds[1] >= 0) close(pipeFds[1]);
+    pipeFds[0] = pipeFds[1] = -1;
+    pipeBytes = 0;
+    pipeFull = false;
+#endif
+}
+
+} // namespace instruments
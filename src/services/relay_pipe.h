@@ -0,0 +1,62 @@
+#ifndef INSTRUMENTS_RELAY_PIPE_H
+#define INSTRUMENTS_RELAY_PIPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace instruments {
+
+#ifdef _WIN32
+using RelaySocket = uintptr_t;
+#else
+using RelaySocket = int;
+#endif
+
+// RelayPipe - one direction of a forwarded connection (PortForwarder): bytes
+// read from src, not yet written to dst. On Linux the bytes go through a
+// kernel pipe with splice() and never enter user space; elsewhere, or when
+// the kernel refuses to splice these sockets, through a user buffer.
+//
+// Sockets are non-blocking and driven by a level-triggered poll: read from
+// src only while HasSpace(), wait for dst writable only while HasData().
+struct RelayPipe {
+    std::vector<char> buf;   // allocated on first buffered read
+    size_t begin = 0;
+    size_t end = 0;
+    bool eof = false;   // src closed
+#ifdef __linux__
+    int pipeFds[2] = {-1, -1};
+    size_t pipeBytes = 0;
+    size_t pipeCapacity = 0;
+    // The pipe refused more bytes below pipeCapacity (its buffer slots are
+    // used up by small segments); no reads until Flush() frees some
+    bool pipeFull = false;
+#endif
+
+    RelayPipe() = default;
+    RelayPipe(const RelayPipe&) = delete;
+    RelayPipe& operator=(const RelayPipe&) = delete;
+    ~RelayPipe() { ClosePipe(); }
+
+    // Linux: switch to the splice path (false keeps the user buffer)
+    bool OpenPipe();
+    bool Spliced() const;
+
+    bool HasData() const;
+    bool HasSpace() const;
+
+    // One read from src (level-triggered poll calls us again). Call only
+    // while HasSpace(). False on error.
+    bool Fill(RelaySocket src);
+
+    // Write what the socket takes. False on error.
+    bool Flush(RelaySocket dst);
+
+private:
+    void ClosePipe();
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_RELAY_PIPE_H
@@ -0,0 +1,156 @@
+#include "../../include/instruments/sample_aggregator.h"
+#include "../util/log.h"
+#include <algorithm>
+
+namespace instruments {
+
+static const char* TAG = "SampleAggregator";
+
+SampleAggregator::SampleAggregator(uint32_t windowMs, SampleWindowCallback callback,
+                                   uint32_t latenessMs, bool deliverEmpty)
+    : m_windowUs(uint64_t{windowMs ? windowMs : 1} * 1000)
+    , m_latenessUs(uint64_t{latenessMs} * 1000)
+    , m_deliverEmpty(deliverEmpty)
+    , m_callback(std::move(callback))
+{
+}
+
+SampleAggregator::~SampleAggregator() {
+    Stop();
+}
+
+void SampleAggregator::Start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) return;
+    m_running = true;
+    m_windows.clear();
+    m_nextWindow = HostMonotonicUs() / m_windowUs;
+    m_thread = std::thread([this]() { Run(); });
+}
+
+void SampleAggregator::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+
+    // Whatever is left, open windows included
+    DeliverUpTo(UINT64_MAX);
+    const uint64_t late = LateSamples();
+    if (late > 0) {
+        INST_LOG_INFO(TAG, "%llu samples arrived after their window closed",
+                      static_cast<unsigned long long>(late));
+    }
+}
+
+// Called with m_mutex held; nullptr if that window was already delivered
+SampleWindow* SampleAggregator::WindowFor(uint64_t timestampUs) {
+    const uint64_t index = timestampUs / m_windowUs;
+    if (!m_running || index < m_nextWindow) {
+        m_lateSamples++;
+        return nullptr;
+    }
+    auto [it, inserted] = m_windows.try_emplace(index);
+    if (inserted) {
+        it->second.startUs = index * m_windowUs;
+        it->second.endUs = it->second.startUs + m_windowUs;
+    }
+    return &it->second;
+}
+
+void SampleAggregator::Add(const FPSData& data) {
+    const uint64_t ts = data.timestampUs ? data.timestampUs : HostMonotonicUs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (SampleWindow* window = WindowFor(ts)) {
+        window->fps.push_back(data);
+        window->fps.back().timestampUs = ts;
+    }
+}
+
+void SampleAggregator::Add(const SystemMetrics& metrics) {
+    const uint64_t ts = metrics.timestampUs ? metrics.timestampUs : HostMonotonicUs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (SampleWindow* window = WindowFor(ts)) {
+        window->system.push_back(metrics);
+        window->system.back().timestampUs = ts;
+    }
+}
+
+void SampleAggregator::Add(const std::vector<ProcessMetrics>& processes, uint64_t timestampUs) {
+    const uint64_t ts = timestampUs ? timestampUs : HostMonotonicUs();
+    // Copy outside the lock
+    ProcessSample sample;
+    sample.timestampUs = ts;
+    sample.processes = processes;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (SampleWindow* window = WindowFor(ts)) {
+        window->processes.push_back(std::move(sample));
+    }
+}
+
+FPSCallback SampleAggregator::FPSSink() {
+    return [this](const FPSData& data) { Add(data); };
+}
+
+SystemPerfCallback SampleAggregator::SystemSink() {
+    return [this](const SystemMetrics& metrics) { Add(metrics); };
+}
+
+ProcessPerfCallback SampleAggregator::ProcessSink() {
+    return [this](const std::vector<ProcessMetrics>& processes) { Add(processes); };
+}
+
+uint64_t SampleAggregator::LateSamples() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lateSamples;
+}
+
+void SampleAggregator::Run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        // Wake when the oldest open window is due
+        const uint64_t dueUs = (m_nextWindow + 1) * m_windowUs + m_latenessUs;
+        const auto due = std::chrono::steady_clock::time_point(std::chrono::microseconds(dueUs));
+        if (m_cv.wait_until(lock, due, [this]() { return !m_running; })) break;
+
+        lock.unlock();
+        const uint64_t now = HostMonotonicUs();
+        DeliverUpTo(now > m_latenessUs ? now - m_latenessUs : 0);
+        lock.lock();
+    }
+}
+
+// Deliver (and forget) every window ending at or before endUs
+void SampleAggregator::DeliverUpTo(uint64_t endUs) {
+    std::vector<SampleWindow> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const uint64_t last = endUs == UINT64_MAX ? UINT64_MAX : endUs / m_windowUs;  // first index kept
+        auto it = m_windows.begin();
+        while (m_nextWindow < last) {
+            if (it != m_windows.end() && it->first == m_nextWindow) {
+                ready.push_back(std::move(it->second));
+                it = m_windows.erase(it);
+            } else if (m_deliverEmpty && (last != UINT64_MAX || it != m_windows.end())) {
+                SampleWindow empty;
+                empty.startUs = m_nextWindow * m_windowUs;
+                empty.endUs = empty.startUs + m_windowUs;
+                ready.push_back(std::move(empty));
+            } else if (it != m_windows.end()) {
+                // Skip the gap up to the next window with samples
+                m_nextWindow = std::min(it->first, last);
+                continue;
+            } else {
+                m_nextWindow = last == UINT64_MAX ? m_nextWindow : last;
+                break;
+            }
+            m_nextWindow++;
+        }
+    }
+    for (auto& window : ready) m_callback(window);
+}
+
+} // namespace instruments
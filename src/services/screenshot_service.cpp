@@ -0,0 +1,359 @@
+#include "../../include/instruments/screenshot_service.h"
+#include "../nskeyedarchiver/bplist_reader.h"
+#include "../util/log.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+
+namespace instruments {
+
+static const char* TAG = "ScreenshotService";
+static constexpr int kRequestTimeoutMs = 5000;
+static constexpr size_t kMaxInFlight = 2;
+
+using Clock = std::chrono::steady_clock;
+
+struct ScreenshotService::State {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+    ScreenshotCallback callback;
+    ErrorCallback errorCb;
+
+    // Requests awaiting a reply, by sequence number. A reply whose entry is
+    // gone was given up on and is ignored.
+    std::map<uint64_t, Clock::time_point> inFlight;
+    uint64_t nextIndex = 0;
+
+    Clock::time_point started = Clock::now();
+    Clock::time_point stopped;
+    uint64_t frames = 0;
+    uint64_t failures = 0;
+    uint64_t bytes = 0;
+    uint64_t latencyTotalUs = 0;
+};
+
+static ScreenshotFrame::Format DetectFormat(const uint8_t* data, size_t size) {
+    static const uint8_t kPng[] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    if (size >= sizeof(kPng) && std::memcmp(data, kPng, sizeof(kPng)) == 0) {
+        return ScreenshotFrame::Format::PNG;
+    }
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        return ScreenshotFrame::Format::JPEG;
+    }
+    return ScreenshotFrame::Format::Unknown;
+}
+
+// Locate the image bytes inside a takeScreenshot reply without unarchiving
+// it: the keyed archive's root is the NSData itself, or a dictionary whose
+// "NS.data" holds it (inline or by UID). A plain bplist whose top object is
+// data, and an unwrapped image, are accepted too.
+static bool FindImageData(const uint8_t* payload, size_t len,
+                          const uint8_t*& outData, size_t& outSize) {
+    BPlistReader r;
+    if (!r.Open(payload, len)) {
+        if (DetectFormat(payload, len) == ScreenshotFrame::Format::Unknown) return false;
+        outData = payload;
+        outSize = len;
+        return true;
+    }
+
+    BPlistReader::Object top, topDict, root, objects, obj;
+    uint64_t topRef, rootRef, objectsRef, dataRef;
+    if (!r.Get(r.TopRef(), top)) return false;
+    if (top.kind == BPlistReader::Kind::Data) {
+        outData = top.body;
+        outSize = static_cast<size_t>(top.count);
+        return true;
+    }
+    if (top.kind != BPlistReader::Kind::Dict ||
+        !r.DictLookup(top, "$top", topRef) || !r.Get(topRef, topDict) ||
+        !r.DictLookup(topDict, "root", rootRef) || !r.Get(rootRef, root) ||
+        root.kind != BPlistReader::Kind::UID ||
+        !r.DictLookup(top, "$objects", objectsRef) || !r.Get(objectsRef, objects) ||
+        objects.kind != BPlistReader::Kind::Array) {
+        return false;
+    }
+
+    auto resolve = [&](uint64_t uid, BPlistReader::Object& out) {
+        return uid < objects.count && r.Get(r.RefAt(objects, uid), out);
+    };
+    if (!resolve(r.UIDValue(root), obj)) return false;
+    if (obj.kind == BPlistReader::Kind::Dict) {
+        if (!r.DictLookup(obj, "NS.data", dataRef) || !r.Get(dataRef, obj)) return false;
+        if (obj.kind == BPlistReader::Kind::UID && !resolve(r.UIDValue(obj), obj)) return false;
+    }
+    if (obj.kind != BPlistReader::Kind::Data) return false;
+    outData = obj.body;
+    outSize = static_cast<size_t>(obj.count);
+    return true;
+}
+
+// Build a frame viewing the reply's payload; false if it holds no image
+static bool MakeFrame(const std::shared_ptr<DTXMessage>& reply, ScreenshotFrame& frame) {
+    const std::vector<uint8_t>& payload = reply->RawPayload();
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    if (payload.empty() || !FindImageData(payload.data(), payload.size(), data, size) || size == 0) {
+        return false;
+    }
+    frame.data = data;
+    frame.size = size;
+    frame.format = DetectFormat(data, size);
+    frame.owner = reply;
+    return true;
+}
+
+static uint64_t MicrosSince(Clock::time_point start, Clock::time_point end) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+}
+
+ScreenshotService::ScreenshotService(std::shared_ptr<DeviceConnection> connection)
+    : m_connection(std::move(connection))
+    , m_state(std::make_shared<State>())
+{
+}
+
+ScreenshotService::~ScreenshotService() {
+    Close();
+}
+
+Error ScreenshotService::EnsureChannelLocked() {
+    if (m_channel && m_dtxConnection && m_dtxConnection->IsConnected() &&
+        !m_channel->IsCancelled()) {
+        return Error::Success;
+    }
+    if (m_channel && m_dtxConnection) {
+        INST_LOG_INFO(TAG, "Screenshot channel lost, reopening");
+        m_dtxConnection->CloseChannel(m_channel);
+    }
+    m_channel.reset();
+    m_dtxConnection = m_connection->SharedInstrumentConnection();
+    if (!m_dtxConnection) return Error::ConnectionFailed;
+
+    m_channel = m_dtxConnection->MakeChannelWithIdentifier(ChannelId::Screenshot);
+    if (!m_channel) {
+        m_dtxConnection.reset();
+        return Error::ServiceStartFailed;
+    }
+    return Error::Success;
+}
+
+Error ScreenshotService::Capture(ScreenshotFrame& outFrame, int timeoutMs) {
+    std::shared_ptr<DTXChannel> channel;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Error err = EnsureChannelLocked();
+        if (err != Error::Success) {
+            INST_LOG_ERROR(TAG, "Failed to open screenshot channel");
+            return err;
+        }
+        channel = m_channel;
+    }
+
+    const auto sent = Clock::now();
+    auto reply = channel->SendMessageSync(DTXMessage::CreateWithSelector("takeScreenshot"), timeoutMs);
+    if (!reply) {
+        INST_LOG_ERROR(TAG, "takeScreenshot timed out");
+        return Error::Timeout;
+    }
+    const auto received = Clock::now();
+
+    ScreenshotFrame frame;
+    if (!MakeFrame(reply, frame)) {
+        INST_LOG_ERROR(TAG, "takeScreenshot reply holds no image data");
+        return Error::ProtocolError;
+    }
+    frame.timestampUs = HostMonotonicUs();
+    frame.latencyUs = MicrosSince(sent, received);
+    outFrame = std::move(frame);
+    return Error::Success;
+}
+
+Error ScreenshotService::Start(double targetFps, ScreenshotCallback callback, ErrorCallback errorCb) {
+    Stop();
+
+    std::shared_ptr<DTXChannel> channel;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Error err = EnsureChannelLocked();
+        if (err != Error::Success) {
+            if (errorCb) errorCb(err, "Failed to open screenshot channel");
+            return err;
+        }
+        channel = m_channel;
+    }
+
+    auto state = std::make_shared<State>();
+    state->running = true;
+    state->callback = std::move(callback);
+    state->errorCb = std::move(errorCb);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state = state;
+    }
+
+    const auto interval = targetFps > 0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps))
+        : Clock::duration::zero();
+
+    // Pace requests at the target rate with up to kMaxInFlight outstanding.
+    // Replies are handled on the receive thread; the state is shared so a
+    // reply arriving after Stop() is harmless.
+    m_worker = std::thread([state, channel, interval]() {
+        auto nextSend = Clock::now();
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (state->running) {
+            // Give up on requests without a reply. Timeouts are otherwise
+            // only noticed when the channel has traffic.
+            const auto now = Clock::now();
+            size_t expired = 0;
+            for (auto it = state->inFlight.begin(); it != state->inFlight.end();) {
+                if (now - it->second < std::chrono::milliseconds(kRequestTimeoutMs)) {
+                    ++it;
+                } else {
+                    it = state->inFlight.erase(it);
+                    expired++;
+                }
+            }
+            if (expired > 0) {
+                state->failures += expired;
+                auto errorCb = state->errorCb;
+                if (errorCb) {
+                    lock.unlock();
+                    errorCb(Error::Timeout, "takeScreenshot timed out");
+                    lock.lock();
+                }
+                continue;
+            }
+
+            if (state->inFlight.size() >= kMaxInFlight) {
+                state->cv.wait_for(lock, std::chrono::milliseconds(100));
+                continue;
+            }
+            if (now < nextSend) {
+                state->cv.wait_until(lock, nextSend);
+                continue;
+            }
+            nextSend = std::max(nextSend + interval, now - interval);
+
+            const uint64_t index = state->nextIndex++;
+            const auto sent = Clock::now();
+            state->inFlight.emplace(index, sent);
+            lock.unlock();
+
+            std::weak_ptr<State> weak = state;
+            channel->SendMessageAsync(DTXMessage::CreateWithSelector("takeScreenshot"),
+                [weak, index, sent](std::shared_ptr<DTXMessage> reply) {
+                    auto state = weak.lock();
+                    if (!state) return;
+                    const auto received = Clock::now();
+                    ScreenshotCallback callback;
+                    ErrorCallback errorCb;
+                    ScreenshotFrame frame;
+                    bool ok = false;
+                    {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        if (state->inFlight.erase(index) == 0) return;
+                        ok = reply && MakeFrame(reply, frame);
+                        if (ok) {
+                            frame.index = index;
+                            frame.timestampUs = HostMonotonicUs();
+                            frame.latencyUs = MicrosSince(sent, received);
+                            state->frames++;
+                            state->bytes += frame.size;
+                            state->latencyTotalUs += frame.latencyUs;
+                        } else {
+                            state->failures++;
+                        }
+                        if (state->running) {
+                            callback = state->callback;
+                            errorCb = state->errorCb;
+                        }
+                    }
+                    state->cv.notify_all();
+                    if (ok && callback) {
+                        callback(frame);
+                    } else if (!ok && errorCb) {
+                        errorCb(reply ? Error::ProtocolError : Error::Timeout,
+                                reply ? "takeScreenshot reply holds no image data"
+                                      : "takeScreenshot timed out");
+                    }
+                },
+                kRequestTimeoutMs);
+
+            lock.lock();
+        }
+    });
+
+    INST_LOG_INFO(TAG, "Screenshot capture started (target %.1f fps)", targetFps);
+    return Error::Success;
+}
+
+void ScreenshotService::Stop() {
+    std::shared_ptr<State> state;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        state = m_state;
+    }
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->running) return;
+        state->running = false;
+        state->stopped = Clock::now();
+    }
+    state->cv.notify_all();
+    if (m_worker.joinable()) m_worker.join();
+
+    // Let the last replies land so the stats count them
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait_for(lock, std::chrono::milliseconds(kRequestTimeoutMs),
+                       [&state]() { return state->inFlight.empty(); });
+    state->inFlight.clear();
+    INST_LOG_INFO(TAG, "Screenshot capture stopped (%llu frames)",
+                  static_cast<unsigned long long>(state->frames));
+}
+
+bool ScreenshotService::IsRunning() const {
+    std::shared_ptr<State> state;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        state = m_state;
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->running;
+}
+
+ScreenshotStats ScreenshotService::Stats() const {
+    std::shared_ptr<State> state;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        state = m_state;
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    ScreenshotStats stats;
+    stats.frames = state->frames;
+    stats.failures = state->failures;
+    stats.bytes = state->bytes;
+    const auto end = state->running || state->stopped == Clock::time_point{}
+        ? Clock::now() : state->stopped;
+    const double elapsed = std::chrono::duration<double>(end - state->started).count();
+    stats.achievedFps = elapsed > 0 ? state->frames / elapsed : 0.0;
+    stats.meanLatencyMs = state->frames
+        ? static_cast<double>(state->latencyTotalUs) / state->frames / 1000.0 : 0.0;
+    return stats;
+}
+
+void ScreenshotService::Close() {
+    Stop();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_channel && m_dtxConnection) m_dtxConnection->CloseChannel(m_channel);
+    m_channel.reset();
+    // Other services may still use the connection; it closes with the last one
+    m_dtxConnection.reset();
+}
+
+} // namespace instruments
@@ -0,0 +1,276 @@
+#include "sysmontap_decoder.h"
+#include "../util/log.h"
+#include <cstdlib>
+
+namespace instruments {
+
+static const char* TAG = "SysmontapDecoder";
+
+static const struct {
+    std::string_view name;
+    ProcessFieldSetter setter;
+} kProcessFields[] = {
+    {"pid", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.pid = static_cast<int64_t>(n); }},
+    {"name", [](ProcessMetrics& pm, double, const std::string_view* text) { if (text) pm.name.assign(*text); }},
+    {"cpuUsage", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.cpuUsage = n; }},
+    {"physFootprint", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.memResident = static_cast<uint64_t>(n); }},
+    {"memAnon", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.memAnon = static_cast<uint64_t>(n); }},
+    {"memVirtualSize", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.memVirtual = static_cast<uint64_t>(n); }},
+    {"diskBytesRead", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.diskBytesRead = static_cast<uint64_t>(n); }},
+    {"diskBytesWritten", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.diskBytesWritten = static_cast<uint64_t>(n); }},
+    {"threadCount", [](ProcessMetrics& pm, double n, const std::string_view*) { pm.threads = static_cast<uint64_t>(n); }},
+};
+
+static void IgnoreField(ProcessMetrics&, double, const std::string_view*) {}
+
+ProcessFieldSetter ResolveProcessAttribute(std::string_view attr) {
+    for (const auto& field : kProcessFields) {
+        if (field.name == attr) return field.setter;
+    }
+    return IgnoreField;
+}
+
+bool ProcessAttributeMap::Compile(const std::vector<std::string>& attrs) {
+    if (attrs == m_attrs && m_setters.size() == attrs.size()) return false;
+
+    m_attrs = attrs;
+    m_setters.clear();
+    m_setters.reserve(attrs.size());
+    m_pidIndex = -1;
+    for (const auto& attr : attrs) {
+        if (attr == "pid" && m_pidIndex < 0) m_pidIndex = static_cast<int>(m_setters.size());
+        m_setters.push_back(ResolveProcessAttribute(attr));
+    }
+    return true;
+}
+
+SysmontapDecoder::SysmontapDecoder(SysmontapLayout& layout,
+                                   bool wantSystem, bool wantProcesses)
+    : m_layout(layout)
+    , m_wantSystem(wantSystem)
+    , m_wantProcesses(wantProcesses)
+{
+}
+
+bool SysmontapDecoder::HigherSourceFound(int slot) const {
+    for (int i = 0; i < slot; i++) {
+        if (m_sourceFound[i]) return true;
+    }
+    return false;
+}
+
+void SysmontapDecoder::Scalar(double number, const std::string_view* text) {
+    if (m_stack.empty()) return;
+    Frame& frame = m_stack.back();
+
+    switch (frame.kind) {
+        case FrameKind::RootArray:
+            frame.index++;
+            break;
+        case FrameKind::Payload:
+            if (!m_wantSystem) break;
+            if (m_key == "SystemCPUUsage")
+                m_sample.hasSystemMetrics = true;
+            else if (m_key == "CPUCount")
+                m_sample.system.cpuCount = static_cast<uint64_t>(number);
+            else if (m_key == "EnabledCPUs")
+                m_sample.system.enabledCPUs = static_cast<uint64_t>(number);
+            else if (m_key == "EndMachAbsTime")
+                m_sample.system.deviceTime = static_cast<uint64_t>(number);
+            break;
+        case FrameKind::CPUUsage:
+            if (m_key == "CPU_TotalLoad")
+                m_sample.system.cpuTotalLoad = number;
+            else if (m_key == "CPU_UserLoad")
+                m_sample.system.cpuUserLoad = number;
+            else if (m_key == "CPU_SystemLoad")
+                m_sample.system.cpuSystemLoad = number;
+            break;
+        case FrameKind::RowArray:
+            if (frame.index < m_layout.rows.Size()) {
+                m_layout.rows.Apply(m_row, frame.index, number, text);
+            }
+            frame.index++;
+            break;
+        case FrameKind::RowDict:
+            ResolveProcessAttribute(m_key)(m_row, number, text);
+            break;
+        case FrameKind::Packed: {
+            PackedCell cell;
+            cell.number = number;
+            if (text) {
+                cell.text = static_cast<int32_t>(m_packedText.size());
+                m_packedText.emplace_back(*text);
+            }
+            m_packedCells.push_back(cell);
+            break;
+        }
+        case FrameKind::ProcAttrs:
+            if (text) m_procAttrs.emplace_back(*text);
+            break;
+        case FrameKind::SystemDict:
+        case FrameKind::Procs:
+            break;
+    }
+}
+
+bool SysmontapDecoder::BeginArray(size_t count, bool isSet) {
+    return BeginContainer(false, count);
+}
+
+bool SysmontapDecoder::BeginDict(size_t count) {
+    return BeginContainer(true, count);
+}
+
+bool SysmontapDecoder::BeginContainer(bool isDict, size_t count) {
+    if (m_stack.empty()) {
+        // Payload is a dict, or an array whose first element is the dict
+        m_sample.hasPayload = isDict;
+        m_stack.push_back({isDict ? FrameKind::Payload : FrameKind::RootArray});
+        return true;
+    }
+
+    const Frame parent = m_stack.back();
+    switch (parent.kind) {
+        case FrameKind::RootArray:
+            if (parent.index == 0 && isDict) {
+                m_sample.hasPayload = true;
+                m_stack.push_back({FrameKind::Payload});
+                return true;
+            }
+            break;
+        case FrameKind::Payload:
+            if (m_key == "SystemCPUUsage") {
+                if (!m_wantSystem) return false;
+                m_sample.hasSystemMetrics = true;
+                if (!isDict) return false;
+                m_stack.push_back({FrameKind::CPUUsage});
+                return true;
+            }
+            if (!m_wantProcesses) break;
+            if (m_key == "Processes" && isDict) {
+                m_sourceFound[0] = true;
+                m_stack.push_back({FrameKind::Procs, 0});
+                return true;
+            }
+            if (m_key == "System") {
+                m_systemIsArray = !isDict;
+                m_stack.push_back({isDict ? FrameKind::SystemDict : FrameKind::Packed});
+                return true;
+            }
+            if (m_key == "ProcessesAttributes" && !isDict) {
+                m_procAttrsIsArray = true;
+                m_stack.push_back({FrameKind::ProcAttrs});
+                return true;
+            }
+            if (m_key == "SystemAttributes" && !isDict) {
+                m_sample.systemAttrCount = count;
+                return false;
+            }
+            break;
+        case FrameKind::SystemDict: {
+            if (!isDict) return false;
+            int slot;
+            if (m_key == "Processes") slot = 1;
+            else if (m_key == "processes") slot = 2;
+            else if (m_key == "ProcessByPid") slot = 3;
+            else if (m_key == "processByPid") slot = 4;
+            else return false;
+            m_sourceFound[slot] = true;
+            if (HigherSourceFound(slot)) return false;
+            m_stack.push_back({FrameKind::Procs, slot});
+            return true;
+        }
+        case FrameKind::Procs:
+            // Empty arrays and non-container values are not rows
+            if (!isDict && count == 0) return false;
+            if (!m_layout.WantsPid(std::atoll(m_key.c_str()))) return false;
+            m_row = ProcessMetrics{};
+            m_row.pid = std::atoll(m_key.c_str());
+            m_stack.push_back({isDict ? FrameKind::RowDict : FrameKind::RowArray, parent.slot});
+            return true;
+        default:
+            break;
+    }
+
+    // Not interesting: counts as a single non-numeric value in its parent
+    Scalar(0.0, nullptr);
+    return false;
+}
+
+void SysmontapDecoder::EndContainer() {
+    const Frame frame = m_stack.back();
+    m_stack.pop_back();
+
+    if (frame.kind == FrameKind::RowArray || frame.kind == FrameKind::RowDict) {
+        m_sourceRows[frame.slot].push_back(std::move(m_row));
+    } else if (!m_stack.empty() && m_stack.back().kind == FrameKind::RootArray) {
+        m_stack.back().index++;
+    }
+}
+
+void SysmontapDecoder::Finish(SysmontapSample& out) {
+    out = std::move(m_sample);
+    if (!m_wantProcesses) return;
+
+    // Dict formats, highest-priority source wins even when empty
+    for (int slot = 0; slot < kSourceCount; slot++) {
+        if (m_sourceFound[slot]) {
+            out.processes = std::move(m_sourceRows[slot]);
+            return;
+        }
+    }
+
+    // Array-packed format: System is array, with ProcessesAttributes describing layout.
+    if (!m_systemIsArray || !m_procAttrsIsArray) return;
+    const ProcessAttributeMap* procAttrs = &m_layout.rows;
+    if (!m_procAttrs.empty()) {
+        // Re-solved only when the device changes the layout
+        if (m_layout.packed.Compile(m_procAttrs)) {
+            INST_LOG_DEBUG(TAG, "ProcessesAttributes layout compiled (%zu attributes)", m_procAttrs.size());
+        }
+        procAttrs = &m_layout.packed;
+    }
+    if (procAttrs->Empty() || m_packedCells.empty()) return;
+
+    const size_t procAttrCount = procAttrs->Size();
+    const size_t cellCount = m_packedCells.size();
+    size_t sysCount = out.systemAttrCount;
+    size_t remain = (cellCount > sysCount) ? (cellCount - sysCount) : 0;
+
+    // If SystemAttributes count doesn't line up, try treating System as pure process rows.
+    if (remain == 0 || (remain % procAttrCount) != 0) {
+        sysCount = 0;
+        remain = cellCount;
+    }
+
+    out.packed = true;
+    out.systemCells = cellCount;
+    out.procAttrCount = procAttrCount;
+    out.sysCount = sysCount;
+    if (remain < procAttrCount || (remain % procAttrCount) != 0) return;
+
+    const int pidIndex = m_layout.filterPids ? procAttrs->PidIndex() : -1;
+    out.processes.reserve(pidIndex >= 0 ? m_layout.pids.size() : remain / procAttrCount);
+    for (size_t offset = sysCount; offset + procAttrCount <= cellCount; offset += procAttrCount) {
+        if (pidIndex >= 0 &&
+            !m_layout.WantsPid(static_cast<int64_t>(m_packedCells[offset + pidIndex].number))) {
+            continue;
+        }
+        ProcessMetrics pm;
+        for (size_t i = 0; i < procAttrCount; i++) {
+            const PackedCell& cell = m_packedCells[offset + i];
+            if (cell.text >= 0) {
+                std::string_view text = m_packedText[cell.text];
+                procAttrs->Apply(pm, i, cell.number, &text);
+            } else {
+                procAttrs->Apply(pm, i, cell.number, nullptr);
+            }
+        }
+        if (pm.pid != 0 && m_layout.WantsPid(pm.pid)) {
+            out.processes.push_back(std::move(pm));
+        }
+    }
+}
+
+} // namespace instruments
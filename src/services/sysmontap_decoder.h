@@ -0,0 +1,167 @@
+#ifndef INSTRUMENTS_SYSMONTAP_DECODER_H
+#define INSTRUMENTS_SYSMONTAP_DECODER_H
+
+#include "../../include/instruments/types.h"
+#include "../nskeyedarchiver/nskeyedunarchiver.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace instruments {
+
+// Stores one attribute value into a process row. text is set for string
+// values; everything else arrives as number (NSObject::ToNumber() semantics).
+using ProcessFieldSetter = void (*)(ProcessMetrics& pm, double number, const std::string_view* text);
+
+// Setter for a sysmontap process attribute name (a no-op for unknown names)
+ProcessFieldSetter ResolveProcessAttribute(std::string_view attr);
+
+// ProcessAttributeMap - an attribute list compiled into a dense
+// index -> setter table, so array rows are stored without name compares.
+class ProcessAttributeMap {
+public:
+    // Compile attrs. A no-op when they match the current list; returns true
+    // if the table was re-solved.
+    bool Compile(const std::vector<std::string>& attrs);
+
+    size_t Size() const { return m_setters.size(); }
+    bool Empty() const { return m_setters.empty(); }
+
+    // Position of "pid" in the list, or -1
+    int PidIndex() const { return m_pidIndex; }
+
+    void Apply(ProcessMetrics& pm, size_t index, double number, const std::string_view* text) const {
+        m_setters[index](pm, number, text);
+    }
+
+private:
+    std::vector<std::string> m_attrs;
+    std::vector<ProcessFieldSetter> m_setters;
+    int m_pidIndex = -1;
+};
+
+// Attribute layouts kept across samples
+struct SysmontapLayout {
+    ProcessAttributeMap rows;       // configured processAttributes (array-format rows)
+    ProcessAttributeMap packed;     // ProcessesAttributes of the last array-packed sample
+
+    // Rows of other pids are skipped before a ProcessMetrics is built
+    bool filterPids = false;
+    std::vector<int64_t> pids;      // sorted
+
+    bool WantsPid(int64_t pid) const {
+        return !filterPids || std::binary_search(pids.begin(), pids.end(), pid);
+    }
+};
+
+// One decoded sysmontap sample
+struct SysmontapSample {
+    bool hasPayload = false;        // payload was a dict (or an array starting with one)
+    bool hasSystemMetrics = false;  // SystemCPUUsage was present
+    SystemMetrics system;
+    std::vector<ProcessMetrics> processes;
+
+    // Array-packed layout (System is a flat array described by ProcessesAttributes)
+    bool packed = false;
+    size_t systemCells = 0;
+    size_t systemAttrCount = 0;
+    size_t procAttrCount = 0;
+    size_t sysCount = 0;            // leading system cells before the process rows
+};
+
+// SysmontapDecoder - NSKeyedVisitor that decodes a sysmontap payload straight
+// into SystemMetrics / ProcessMetrics, without building an NSObject tree.
+//
+// Process rows are taken from, in priority order: a top-level "Processes"
+// dict, then "Processes" / "processes" / "ProcessByPid" / "processByPid"
+// inside a "System" dict. Each row is an array in processAttributes order or
+// a dict keyed by attribute name. Without any of those, an array "System"
+// is read as process rows packed according to "ProcessesAttributes" (or the
+// configured attributes when that is empty). With a pid filter in the
+// layout, dict rows of other pids are never opened and packed rows are
+// dropped on their pid cell.
+//
+// Usage:
+//   SysmontapDecoder decoder(m_layout);
+//   if (NSKeyedUnarchiver::Visit(data, len, decoder)) {
+//       SysmontapSample sample;
+//       decoder.Finish(sample);
+//   }
+class SysmontapDecoder : public NSKeyedVisitor {
+public:
+    explicit SysmontapDecoder(SysmontapLayout& layout,
+                              bool wantSystem = true, bool wantProcesses = true);
+
+    // Resolve the collected values into a sample (call once after Visit)
+    void Finish(SysmontapSample& out);
+
+    void Null() override { Scalar(0.0, nullptr); }
+    void Bool(bool value) override { Scalar(value ? 1.0 : 0.0, nullptr); }
+    void Int(int64_t value) override { Scalar(static_cast<double>(value), nullptr); }
+    void UInt(uint64_t value) override { Scalar(static_cast<double>(value), nullptr); }
+    void Real(double value) override { Scalar(value, nullptr); }
+    void String(std::string_view value) override { Scalar(0.0, &value); }
+    void Data(const uint8_t* data, size_t length) override { Scalar(0.0, nullptr); }
+
+    bool BeginArray(size_t count, bool isSet) override;
+    void EndArray() override { EndContainer(); }
+    bool BeginDict(size_t count) override;
+    void Key(std::string_view key) override { m_key.assign(key); }
+    void EndDict() override { EndContainer(); }
+
+private:
+    enum class FrameKind {
+        RootArray,      // payload wrapped in an array; element 0 is the dict
+        Payload,
+        CPUUsage,       // SystemCPUUsage
+        SystemDict,
+        Procs,          // pid -> row
+        RowArray,       // row in processAttributes order
+        RowDict,        // row keyed by attribute name
+        Packed,         // array-packed System
+        ProcAttrs,      // ProcessesAttributes
+    };
+
+    struct Frame {
+        FrameKind kind;
+        int slot = 0;       // Procs: source priority
+        size_t index = 0;   // array element index
+    };
+
+    struct PackedCell {
+        double number = 0.0;
+        int32_t text = -1;  // index into m_packedText
+    };
+
+    static constexpr int kSourceCount = 5;
+
+    // A number (ToNumber() semantics) or a string value; containers count as 0
+    void Scalar(double number, const std::string_view* text);
+    bool BeginContainer(bool isDict, size_t count);
+    void EndContainer();
+    bool HigherSourceFound(int slot) const;
+
+    SysmontapLayout& m_layout;
+    bool m_wantSystem;
+    bool m_wantProcesses;
+
+    std::vector<Frame> m_stack;  // accepted containers; skipped ones are never opened
+    std::string m_key;
+
+    SysmontapSample m_sample;
+    ProcessMetrics m_row;
+    bool m_sourceFound[kSourceCount] = {};
+    std::vector<ProcessMetrics> m_sourceRows[kSourceCount];
+
+    bool m_systemIsArray = false;
+    bool m_procAttrsIsArray = false;
+    std::vector<PackedCell> m_packedCells;
+    std::vector<std::string> m_packedText;
+    std::vector<std::string> m_procAttrs;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_SYSMONTAP_DECODER_H
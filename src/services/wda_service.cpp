@@ -1,10 +1,124 @@
 #include "../../include/instruments/wda_service.h"
+#include "../connection/rsd_provider.h"
 #include "../util/log.h"
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <string_view>
 
 namespace instruments {
 
 static const char* TAG = "WDAService";
 
+// MJPEG reader: receive buffer growth step, the largest part accepted and
+// the pause between connection attempts
+static constexpr size_t kMJPEGReadChunk = 64 * 1024;
+static constexpr size_t kMJPEGMaxPart = 16 * 1024 * 1024;
+static constexpr int kMJPEGRetryMs = 500;
+
+// Multipart state of one MJPEG connection
+struct MJPEGSplitter {
+    bool gotResponse = false;   // HTTP response header consumed
+    bool inBody = false;        // part headers consumed, JPEG bytes next
+    size_t bodyLength = 0;      // Content-Length of the part, 0 if absent
+    std::string delimiter;      // "--boundary", for parts without a length
+};
+
+static bool EqualsNoCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) !=
+            std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Value of a header in a CRLF-separated block ("" if absent)
+static std::string_view HeaderValue(std::string_view headers, std::string_view name) {
+    size_t lineStart = 0;
+    while (lineStart < headers.size()) {
+        size_t lineEnd = headers.find("\r\n", lineStart);
+        if (lineEnd == std::string_view::npos) lineEnd = headers.size();
+        const std::string_view line = headers.substr(lineStart, lineEnd - lineStart);
+        const size_t colon = line.find(':');
+        if (colon != std::string_view::npos && EqualsNoCase(line.substr(0, colon), name)) {
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+            return value;
+        }
+        lineStart = lineEnd + 2;
+    }
+    return {};
+}
+
+// Hand every complete JPEG in data to onFrame, in place, and return the
+// bytes consumed (the rest waits for more data); SIZE_MAX on a part too
+// large to be a frame
+template <typename OnFrame>
+static size_t SplitMJPEG(MJPEGSplitter& st, const uint8_t* data, size_t size, OnFrame&& onFrame) {
+    const std::string_view in(reinterpret_cast<const char*>(data), size);
+    size_t pos = 0;
+    for (;;) {
+        if (!st.inBody) {
+            // CRLFs trailing the last part, then a header block
+            while (pos < size && (in[pos] == '\r' || in[pos] == '\n')) pos++;
+            const size_t headerEnd = in.find("\r\n\r\n", pos);
+            if (headerEnd == std::string_view::npos) break;
+            const std::string_view headers = in.substr(pos, headerEnd - pos);
+            pos = headerEnd + 4;
+
+            if (!st.gotResponse && headers.substr(0, 5) == "HTTP/") {
+                st.gotResponse = true;
+                // WDA sends "boundary=--BoundaryString" and delimits parts
+                // with "--BoundaryString"
+                const std::string_view type = HeaderValue(headers, "Content-Type");
+                const size_t b = type.find("boundary=");
+                if (b != std::string_view::npos) {
+                    std::string_view boundary = type.substr(b + 9);
+                    boundary = boundary.substr(0, boundary.find_first_of("; "));
+                    while (!boundary.empty() && (boundary.front() == '-' || boundary.front() == '"')) {
+                        boundary.remove_prefix(1);
+                    }
+                    while (!boundary.empty() && boundary.back() == '"') boundary.remove_suffix(1);
+                    st.delimiter = "--" + std::string(boundary);
+                }
+                continue;
+            }
+            st.gotResponse = true;
+            const std::string_view length = HeaderValue(headers, "Content-Length");
+            st.bodyLength = length.empty() ? 0 : std::strtoull(std::string(length).c_str(), nullptr, 10);
+            if (st.bodyLength > kMJPEGMaxPart) return SIZE_MAX;
+            st.inBody = true;
+        }
+
+        size_t bodyEnd = 0;
+        size_t next = 0;
+        if (st.bodyLength > 0) {
+            if (size - pos < st.bodyLength) break;
+            bodyEnd = next = pos + st.bodyLength;
+        } else {
+            // No length: the JPEG runs up to the next delimiter
+            const size_t d = in.find(st.delimiter.empty() ? std::string_view("\r\n--")
+                                                          : std::string_view(st.delimiter), pos);
+            if (d == std::string_view::npos) {
+                if (size - pos > kMJPEGMaxPart) return SIZE_MAX;
+                break;
+            }
+            bodyEnd = next = d;
+            while (bodyEnd > pos && (in[bodyEnd - 1] == '\r' || in[bodyEnd - 1] == '\n' ||
+                                     in[bodyEnd - 1] == '-')) {
+                bodyEnd--;
+            }
+        }
+        if (bodyEnd > pos) onFrame(data + pos, bodyEnd - pos);
+        pos = next;
+        st.inBody = false;
+    }
+    return pos;
+}
+
 WDAService::WDAService(std::shared_ptr<DeviceConnection> connection)
     : m_connection(std::move(connection))
 {
@@ -23,6 +137,7 @@ Error WDAService::Start(const WDAConfig& config,
 
     m_stopping.store(false);
     m_running.store(true);
+    m_deviceMjpegPort = config.deviceMjpegPort;
 
     // Step 1: Start port forwarding
     m_portForwarder = std::make_unique<PortForwarder>(m_connection);
@@ -42,18 +157,20 @@ Error WDAService::Start(const WDAConfig& config,
                  m_actualWdaPort, config.deviceWdaPort);
 
     // Forward MJPEG port
-    err = m_portForwarder->Forward(config.mjpegPort, config.deviceMjpegPort,
-                                    &m_actualMjpegPort);
-    if (err != Error::Success) {
-        INST_LOG_ERROR(TAG, "Failed to forward MJPEG port %u -> %u",
-                      config.mjpegPort, config.deviceMjpegPort);
-        if (errorCb) errorCb(err, "Failed to forward MJPEG port");
-        m_portForwarder->StopAll();
-        m_running.store(false);
-        return err;
+    if (config.forwardMjpeg) {
+        err = m_portForwarder->Forward(config.mjpegPort, config.deviceMjpegPort,
+                                        &m_actualMjpegPort);
+        if (err != Error::Success) {
+            INST_LOG_ERROR(TAG, "Failed to forward MJPEG port %u -> %u",
+                          config.mjpegPort, config.deviceMjpegPort);
+            if (errorCb) errorCb(err, "Failed to forward MJPEG port");
+            m_portForwarder->StopAll();
+            m_running.store(false);
+            return err;
+        }
+        INST_LOG_INFO(TAG, "MJPEG port forwarded: localhost:%u -> device:%u",
+                     m_actualMjpegPort, config.deviceMjpegPort);
     }
-    INST_LOG_INFO(TAG, "MJPEG port forwarded: localhost:%u -> device:%u",
-                 m_actualMjpegPort, config.deviceMjpegPort);
 
     // Step 2: Launch WDA as XCTest in a background thread
     m_xctest = std::make_unique<XCTestService>(m_connection);
@@ -103,6 +220,7 @@ Error WDAService::Start(const WDAConfig& config,
 }
 
 void WDAService::Stop() {
+    StopMJPEGStream();
     if (!m_running.load() && !m_wdaThread.joinable() && !m_portForwarder) return;
 
     INST_LOG_INFO(TAG, "Stopping WDA...");
@@ -132,4 +250,125 @@ void WDAService::Stop() {
     INST_LOG_INFO(TAG, "WDA stopped");
 }
 
+Error WDAService::StartMJPEGStream(MJPEGFrameCallback frameCb, bool latestOnly) {
+    if (!m_connection) return Error::ConnectionFailed;
+    if (!frameCb) return Error::InvalidArgument;
+    StopMJPEGStream();
+
+    m_frameCb = std::move(frameCb);
+    m_latestOnly = latestOnly;
+    m_mjpegStopping.store(false);
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_frameReady = false;
+        m_frameSequence = 0;
+        m_framesDropped = 0;
+    }
+    m_mjpegReader = std::thread([this]() { MJPEGReadLoop(); });
+    if (m_latestOnly) m_mjpegDelivery = std::thread([this]() { MJPEGDeliverLoop(); });
+    return Error::Success;
+}
+
+void WDAService::StopMJPEGStream() {
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_mjpegStopping.store(true);
+    }
+    m_frameCv.notify_all();
+    if (m_mjpegReader.joinable()) m_mjpegReader.join();
+    if (m_mjpegDelivery.joinable()) m_mjpegDelivery.join();
+    m_frameCb = nullptr;
+}
+
+void WDAService::MJPEGReadLoop() {
+    static const char kRequest[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    const std::vector<uint8_t> request(kRequest, kRequest + sizeof(kRequest) - 1);
+
+    std::vector<uint8_t> buffer(4 * kMJPEGReadChunk);
+    while (!m_mjpegStopping.load()) {
+        // WDA opens the port only once its runner is up: keep trying
+        XPCPipe pipe;
+        if (m_connection->ConnectDevicePort(m_deviceMjpegPort, pipe)) {
+            if (pipe.send(request)) {
+                INST_LOG_INFO(TAG, "MJPEG stream connected (device port %u)", m_deviceMjpegPort);
+                MJPEGSplitter splitter;
+                size_t start = 0, end = 0;
+                while (!m_mjpegStopping.load()) {
+                    // Read into the free tail; move the partial frame to the
+                    // front only when the tail runs short
+                    if (buffer.size() - end < kMJPEGReadChunk) {
+                        std::memmove(buffer.data(), buffer.data() + start, end - start);
+                        end -= start;
+                        start = 0;
+                        if (buffer.size() - end < kMJPEGReadChunk) buffer.resize(end + kMJPEGReadChunk);
+                    }
+                    const int n = pipe.read(buffer.data() + end, buffer.size() - end, kMJPEGRetryMs);
+                    if (n < 0) break;
+                    if (n == 0) continue;
+                    end += static_cast<size_t>(n);
+
+                    const size_t consumed = SplitMJPEG(splitter, buffer.data() + start, end - start,
+                        [this](const uint8_t* data, size_t size) { DeliverMJPEGFrame(data, size); });
+                    if (consumed == SIZE_MAX) {
+                        INST_LOG_ERROR(TAG, "MJPEG part over %zu bytes, reconnecting", kMJPEGMaxPart);
+                        break;
+                    }
+                    start += consumed;
+                    if (start == end) start = end = 0;
+                }
+                INST_LOG_INFO(TAG, "MJPEG stream closed");
+            }
+            pipe.close();
+        }
+
+        std::unique_lock<std::mutex> lock(m_frameMutex);
+        m_frameCv.wait_for(lock, std::chrono::milliseconds(kMJPEGRetryMs),
+                           [this]() { return m_mjpegStopping.load(); });
+    }
+}
+
+void WDAService::DeliverMJPEGFrame(const uint8_t* data, size_t size) {
+    if (!m_latestOnly) {
+        MJPEGFrame frame;
+        frame.data = data;
+        frame.size = size;
+        frame.sequence = ++m_frameSequence;
+        frame.timestampUs = HostMonotonicUs();
+        m_frameCb(frame);
+        return;
+    }
+
+    // Replace the frame still waiting, if any; the delivery thread swaps
+    // buffers, so this copy reuses capacity once frames settle in size
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        if (m_frameReady) m_framesDropped++;
+        m_latestFrame.assign(data, data + size);
+        m_frameSequence++;
+        m_frameTimestampUs = HostMonotonicUs();
+        m_frameReady = true;
+    }
+    m_frameCv.notify_all();
+}
+
+void WDAService::MJPEGDeliverLoop() {
+    std::vector<uint8_t> jpeg;
+    for (;;) {
+        MJPEGFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(m_frameMutex);
+            m_frameCv.wait(lock, [this]() { return m_frameReady || m_mjpegStopping.load(); });
+            if (m_mjpegStopping.load()) return;
+            jpeg.swap(m_latestFrame);
+            m_frameReady = false;
+            frame.sequence = m_frameSequence;
+            frame.dropped = m_framesDropped;
+            frame.timestampUs = m_frameTimestampUs;
+        }
+        frame.data = jpeg.data();
+        frame.size = jpeg.size();
+        m_frameCb(frame);
+    }
+}
+
 } // namespace instruments
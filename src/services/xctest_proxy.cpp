@@ -20,7 +20,7 @@ void XCTestProxy::DispatchMessage(std::shared_ptr<DTXMessage> message) {
     if (!message) return;
 
     std::string selector = message->Selector();
-    auto auxObjects = message->AuxiliaryObjects();
+    const auto& auxObjects = message->AuxiliaryObjects();
 
     INST_LOG_DEBUG(TAG, "Dispatch: %s (aux=%zu)", selector.c_str(), auxObjects.size());
 
@@ -185,4 +185,18 @@ bool XCTestProxy::WaitForCompletion(int timeoutMs) {
                                   [this]{ return m_finished.load(); });
 }
 
+bool XCTestProxy::WaitForCompletion() {
+    std::unique_lock<std::mutex> lock(m_finishedMutex);
+    m_finishedCv.wait(lock, [this]{ return m_finished.load() || m_cancelled; });
+    return m_finished.load();
+}
+
+void XCTestProxy::Cancel() {
+    {
+        std::lock_guard<std::mutex> lock(m_finishedMutex);
+        m_cancelled = true;
+    }
+    m_finishedCv.notify_all();
+}
+
 } // namespace instruments
@@ -4,7 +4,9 @@
 #include "../../include/instruments/dtx_channel.h"
 #include "../../include/instruments/types.h"
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -33,6 +35,13 @@ public:
     // Wait for test completion (with timeout)
     bool WaitForCompletion(int timeoutMs);
 
+    // Wait until the test plan finishes or Cancel() is called; returns
+    // IsFinished()
+    bool WaitForCompletion();
+
+    // Wake waiters without finishing (stop requested, connection lost)
+    void Cancel();
+
     // Get all collected test results
     const std::vector<TestResult>& Results() const { return m_results; }
 
@@ -61,6 +70,7 @@ private:
     std::string m_currentMethod;
 
     std::atomic<bool> m_finished{false};
+    bool m_cancelled = false;   // m_finishedMutex
     std::mutex m_finishedMutex;
     std::condition_variable m_finishedCv;
 };
@@ -0,0 +1,227 @@
+#include "../../include/instruments/xctest_scheduler.h"
+#include "../../include/instruments/xctest_session.h"
+#include "../util/log.h"
+#include <algorithm>
+#include <set>
+#include <thread>
+
+namespace instruments {
+
+static const char* TAG = "XCTestScheduler";
+
+// Units per device when testsPerUnit is 0: enough to even out uneven
+// devices, few enough that the per-batch runner launch stays small
+static constexpr size_t kUnitsPerDevice = 4;
+
+XCTestScheduler::XCTestScheduler(std::vector<std::shared_ptr<DeviceConnection>> devices,
+                                 XCTestShardConfig config)
+    : m_devices(std::move(devices))
+    , m_config(std::move(config))
+{
+}
+
+XCTestScheduler::~XCTestScheduler() {
+    Stop();
+}
+
+// "Class/method" of a result, as tests name it. Swift methods may report
+// with a trailing "()".
+static std::string TestId(const TestResult& result) {
+    std::string method = result.methodName;
+    if (method.size() > 2 && method.compare(method.size() - 2, 2, "()") == 0) {
+        method.resize(method.size() - 2);
+    }
+    return result.className + "/" + method;
+}
+
+Error XCTestScheduler::Run(const std::vector<std::string>& tests,
+                            XCTestShardCallback resultCb,
+                            LogCallback logCb) {
+    if (m_devices.empty()) return Error::InvalidArgument;
+
+    m_stopping.store(false);
+    m_resultCb = std::move(resultCb);
+    m_logCb = std::move(logCb);
+
+    const size_t deviceCount = m_devices.size();
+    size_t perUnit = m_config.testsPerUnit;
+    if (perUnit == 0) {
+        const size_t units = deviceCount * kUnitsPerDevice;
+        perUnit = std::max<size_t>(1, (tests.size() + units - 1) / units);
+    }
+
+    size_t unitCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queues.assign(deviceCount, {});
+        m_reports.assign(deviceCount, {});
+        m_sessions.assign(deviceCount, nullptr);
+        m_abandoned.clear();
+        for (size_t i = 0; i < deviceCount; i++) {
+            if (m_devices[i]) m_reports[i].udid = m_devices[i]->GetDeviceInfo().udid;
+        }
+        for (size_t i = 0; i < tests.size(); i += perUnit) {
+            Unit unit;
+            const size_t end = std::min(tests.size(), i + perUnit);
+            unit.tests.assign(tests.begin() + i, tests.begin() + end);
+            m_queues[unitCount++ % deviceCount].push_back(std::move(unit));
+        }
+    }
+    INST_LOG_INFO(TAG, "Running %zu tests as %zu units on %zu devices",
+                  tests.size(), unitCount, deviceCount);
+
+    std::vector<std::thread> workers;
+    workers.reserve(deviceCount);
+    for (size_t i = 0; i < deviceCount; i++) {
+        workers.emplace_back([this, i]() { Worker(i); });
+    }
+    for (auto& worker : workers) worker.join();
+
+    // Work left behind when every device dropped out
+    size_t completed = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& queue : m_queues) {
+            for (auto& unit : queue) {
+                m_abandoned.insert(m_abandoned.end(), unit.tests.begin(), unit.tests.end());
+            }
+            queue.clear();
+        }
+        for (const auto& report : m_reports) completed += report.units;
+        if (!m_abandoned.empty()) {
+            INST_LOG_WARN(TAG, "%zu tests not run", m_abandoned.size());
+        }
+    }
+
+    if (m_stopping.load()) return Error::Cancelled;
+    if (completed == 0 && unitCount > 0) return Error::ConnectionFailed;
+    return Error::Success;
+}
+
+std::shared_ptr<XCTestSession> XCTestScheduler::CreateSession(size_t device) {
+    if (!m_devices[device]) return nullptr;
+    return std::make_shared<XCTestSession>(m_devices[device]);
+}
+
+void XCTestScheduler::Worker(size_t device) {
+    auto session = CreateSession(device);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sessions[device] = session;
+    }
+
+    auto open = [&]() {
+        if (!session) return Error::DeviceNotFound;
+        Error err = session->Open(m_config.test, m_logCb);
+        // Stop() may have run before Open() reset the session
+        if (m_stopping.load()) session->Cancel();
+        return err;
+    };
+
+    Error err = open();
+    bool reopened = false;
+    Unit unit;
+    while (err == Error::Success && Take(device, unit)) {
+        unit.attempts++;
+        size_t received = 0;
+        std::set<std::string> reported;
+        err = session->Run(unit.tests, [this, device, &received, &reported](const TestResult& result) {
+            received++;
+            reported.insert(TestId(result));
+            std::lock_guard<std::mutex> lock(m_resultMutex);
+            if (m_resultCb) m_resultCb(device, result);
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_reports[device].tests += received;
+            if (err == Error::Success) m_reports[device].units++;
+        }
+        if (err == Error::Success) continue;
+
+        // The batch never ran to the end: give back what did not report
+        // (Stop() leaves it queued, so it ends up in Abandoned())
+        Unit rest;
+        rest.attempts = unit.attempts;
+        for (auto& test : unit.tests) {
+            if (reported.count(test) == 0) rest.tests.push_back(std::move(test));
+        }
+        if (!rest.tests.empty()) Requeue(device, std::move(rest));
+        if (err == Error::Cancelled) break;
+
+        // Try once more with a fresh session
+        INST_LOG_WARN(TAG, "Device %zu: batch failed (%s) after %zu results", device,
+                      ErrorToString(err), received);
+        if (reopened) break;
+        reopened = true;
+        err = open();
+    }
+    if (session) session->Close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (err != Error::Success && err != Error::Cancelled) {
+        m_reports[device].error = err;
+        INST_LOG_WARN(TAG, "Device %zu (%s) dropped out: %s", device,
+                      m_reports[device].udid.c_str(), ErrorToString(err));
+    }
+    m_sessions[device].reset();
+}
+
+// Own queue from the front, else steal from the back of the longest one
+bool XCTestScheduler::Take(size_t device, Unit& unit) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping.load()) return false;
+
+    auto& own = m_queues[device];
+    if (!own.empty()) {
+        unit = std::move(own.front());
+        own.pop_front();
+        return true;
+    }
+
+    size_t victim = m_queues.size();
+    size_t longest = 0;
+    for (size_t i = 0; i < m_queues.size(); i++) {
+        if (m_queues[i].size() > longest) {
+            longest = m_queues[i].size();
+            victim = i;
+        }
+    }
+    if (victim == m_queues.size()) return false;
+
+    unit = std::move(m_queues[victim].back());
+    m_queues[victim].pop_back();
+    m_reports[device].stolen++;
+    return true;
+}
+
+void XCTestScheduler::Requeue(size_t device, Unit&& unit) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (unit.attempts >= m_config.maxAttempts) {
+        m_abandoned.insert(m_abandoned.end(), unit.tests.begin(), unit.tests.end());
+        return;
+    }
+    // Back of its own queue: another device steals it first if this one
+    // drops out
+    m_queues[device].push_back(std::move(unit));
+}
+
+void XCTestScheduler::Stop() {
+    m_stopping.store(true);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& session : m_sessions) {
+        if (session) session->Cancel();
+    }
+}
+
+std::vector<XCTestShardReport> XCTestScheduler::Report() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_reports;
+}
+
+std::vector<std::string> XCTestScheduler::Abandoned() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_abandoned;
+}
+
+} // namespace instruments
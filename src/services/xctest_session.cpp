@@ -0,0 +1,259 @@
+#include "../../include/instruments/xctest_session.h"
+#include "../../include/instruments/dtx_method.h"
+#include "xctest_proxy.h"
+#include "../connection/service_connector.h"
+#include "../nskeyedarchiver/nsobject.h"
+#include "../util/log.h"
+#include <chrono>
+
+namespace instruments {
+
+static const char* TAG = "XCTestSession";
+
+static constexpr int kSessionTimeoutMs = 10000;
+
+using AuthorizeTestSession = DTXMethod<"_IDE_authorizeTestSessionWithProcessID:", int64_t>;
+using StartExecutingTestPlan = DTXMethod<"_IDE_startExecutingTestPlanWithProtocolVersion:", int64_t>;
+
+// Wait for a pipelined control-session reply (nullptr on failure)
+static std::shared_ptr<DTXMessage> WaitReply(std::future<std::shared_ptr<DTXMessage>>& reply) {
+    if (reply.wait_for(std::chrono::milliseconds(kSessionTimeoutMs)) != std::future_status::ready) {
+        return nullptr;
+    }
+    return reply.get();
+}
+
+XCTestSession::XCTestSession(std::shared_ptr<DeviceConnection> connection)
+    : m_connection(std::move(connection))
+{
+}
+
+XCTestSession::~XCTestSession() {
+    Close();
+}
+
+Error XCTestSession::Open(const XCTestConfig& config,
+                           LogCallback logCb,
+                           ErrorCallback errorCb) {
+    Close();
+    if (!m_connection) return Error::ConnectionFailed;
+
+    m_config = config;
+    m_logCb = std::move(logCb);
+    m_errorCb = std::move(errorCb);
+    m_runs = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelled = false;
+    }
+
+    // Step 1: Create two DTX connections to testmanagerd
+    std::string testManagerService = ServiceConnector::GetTestManagerServiceName(
+        m_connection->GetProtocol());
+
+    m_dtxConnection = m_connection->CreateServiceConnection(testManagerService);
+    if (!m_dtxConnection) {
+        INST_LOG_ERROR(TAG, "Failed to connect to testmanagerd (connection 1)");
+        if (m_errorCb) m_errorCb(Error::ConnectionFailed, "Failed to connect to testmanagerd");
+        return Error::ConnectionFailed;
+    }
+
+    m_dtxConnection2 = m_connection->CreateServiceConnection(testManagerService);
+    if (!m_dtxConnection2) {
+        INST_LOG_ERROR(TAG, "Failed to connect to testmanagerd (connection 2)");
+        if (m_errorCb) m_errorCb(Error::ConnectionFailed, "Failed to connect to testmanagerd (2)");
+        Close();
+        return Error::ConnectionFailed;
+    }
+
+    // Step 2: Create proxy channel on connection 1; callbacks go to the
+    // proxy of the batch in progress
+    m_proxyChannel = m_dtxConnection->MakeChannelWithIdentifier(XCTestProxy::ProxyChannelName);
+    if (!m_proxyChannel) {
+        INST_LOG_ERROR(TAG, "Failed to create proxy channel");
+        if (m_errorCb) m_errorCb(Error::ServiceStartFailed, "Failed to create XCTest proxy channel");
+        Close();
+        return Error::ServiceStartFailed;
+    }
+    m_proxyChannel->SetMessageHandler([this](std::shared_ptr<DTXMessage> msg) {
+        Dispatch(std::move(msg));
+    });
+
+    // A dropped testmanagerd connection ends the batch in progress
+    m_dtxConnection->SetCloseHandler([this]() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_proxy) m_proxy->Cancel();
+    });
+
+    // Step 3: Initiate session with capabilities. The reply is collected by
+    // the first Run() after its runner launch, which does not depend on it.
+    m_daemonChannel = m_dtxConnection->MakeChannelWithIdentifier(
+        "dtxproxy:XCTestManager_IDEInterface:XCTestManager_DaemonConnectionInterface");
+
+    if (m_daemonChannel) {
+        NSObject::DictType capabilities;
+        capabilities["XCTIssue capability"] = NSObject(true);
+        capabilities["skippedTest capability"] = NSObject(true);
+
+        auto initMsg = DTXMessage::CreateWithSelector(
+            "_IDE_initiateControlSessionWithCapabilities:");
+        NSObject capsObj(std::move(capabilities));
+        capsObj.SetClassName("XCTCapabilities");
+        capsObj.SetClassHierarchy({"XCTCapabilities", "NSObject"});
+        initMsg->AppendAuxiliary(capsObj);
+
+        m_initReply = m_daemonChannel->SendMessageFuture(initMsg, kSessionTimeoutMs);
+    }
+
+    m_process = std::make_unique<ProcessService>(m_connection);
+    return Error::Success;
+}
+
+Error XCTestSession::Run(const std::vector<std::string>& testsToRun,
+                          XCTestCallback resultCb,
+                          std::vector<TestResult>* results) {
+    if (results) results->clear();
+    if (!m_dtxConnection || !m_process) return Error::ConnectionFailed;
+
+    auto proxy = std::make_shared<XCTestProxy>(std::move(resultCb), m_logCb, m_errorCb);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancelled) return Error::Cancelled;
+        m_proxy = proxy;
+    }
+    auto retire = [this]() {
+        std::lock_guard<std::mutex> dispatchLock(m_dispatchMutex);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_proxy.reset();
+    };
+
+    if (!m_dtxConnection->IsConnected()) {
+        INST_LOG_ERROR(TAG, "testmanagerd closed the session");
+        retire();
+        return Error::ConnectionFailed;
+    }
+
+    // Step 4: Launch the runner for this batch (replacing the last one)
+    std::map<std::string, std::string> env = m_config.env;
+    env["NSUnbufferedIO"] = "YES";
+    env["DYLD_INSERT_LIBRARIES"] = "";  // Can be customized
+    env["XCTestConfigurationFilePath"] = "";  // Will be set by test runner
+
+    // XCTest reads its test selection from the XCTest user default
+    std::vector<std::string> args = m_config.args;
+    const auto& tests = testsToRun.empty() ? m_config.testsToRun : testsToRun;
+    if (!tests.empty()) {
+        std::string selection;
+        for (const auto& test : tests) {
+            if (!selection.empty()) selection += ',';
+            selection += test;
+        }
+        args.push_back("-XCTest");
+        args.push_back(selection);
+    }
+
+    int64_t pid = 0;
+    Error launchErr = m_process->LaunchApp(m_config.testRunnerBundleId, env, args, true, pid);
+    if (launchErr != Error::Success) {
+        INST_LOG_ERROR(TAG, "Failed to launch test runner: %s", ErrorToString(launchErr));
+        if (m_errorCb) m_errorCb(launchErr, "Failed to launch test runner");
+        retire();
+        return launchErr;
+    }
+
+    m_runnerPid = pid;
+    INST_LOG_INFO(TAG, "Test runner launched with PID %lld (batch %zu, %zu tests)",
+                  (long long)pid, m_runs + 1, tests.size());
+
+    if (m_initReply.valid() && WaitReply(m_initReply)) {
+        INST_LOG_INFO(TAG, "Session initiated");
+    }
+
+    // Steps 5 + 6: Authorize the test process and start the test plan. The
+    // channel keeps their order, so both go out before either reply is
+    // awaited.
+    if (m_daemonChannel) {
+        auto authReply = m_daemonChannel->SendMessageFuture(
+            AuthorizeTestSession::Make(pid), kSessionTimeoutMs);
+        auto startReply = m_daemonChannel->SendMessageFuture(
+            StartExecutingTestPlan::Make(36), kSessionTimeoutMs);
+
+        WaitReply(authReply);
+        WaitReply(startReply);
+    }
+
+    INST_LOG_INFO(TAG, "Waiting for test completion...");
+
+    // Step 7: Wait for completion, Cancel() or connection loss
+    const bool finished = proxy->WaitForCompletion();
+    retire();
+
+    size_t passed = 0, failed = 0;
+    for (const auto& r : proxy->Results()) {
+        if (r.status == TestResult::Status::Passed) passed++;
+        else failed++;
+    }
+    if (results) *results = proxy->Results();
+
+    // Woken without the plan finishing: Cancel(), or the close handler
+    // after testmanagerd dropped the connection
+    if (!finished) {
+        bool cancelled = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            cancelled = m_cancelled;
+        }
+        INST_LOG_WARN(TAG, "Batch %zu %s after %zu passed, %zu failed", m_runs + 1,
+                      cancelled ? "cancelled" : "lost its testmanagerd connection", passed, failed);
+        return cancelled ? Error::Cancelled : Error::ConnectionFailed;
+    }
+
+    m_runs++;
+    INST_LOG_INFO(TAG, "Batch %zu complete: %zu passed, %zu failed", m_runs, passed, failed);
+    return Error::Success;
+}
+
+void XCTestSession::Dispatch(std::shared_ptr<DTXMessage> message) {
+    std::lock_guard<std::mutex> dispatchLock(m_dispatchMutex);
+    std::shared_ptr<XCTestProxy> proxy;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        proxy = m_proxy;
+    }
+    if (proxy) {
+        proxy->DispatchMessage(std::move(message));
+    } else {
+        INST_LOG_DEBUG(TAG, "Callback between batches dropped: %s", message->Selector().c_str());
+    }
+}
+
+void XCTestSession::Cancel() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cancelled = true;
+    if (m_proxy) m_proxy->Cancel();
+}
+
+void XCTestSession::Close() {
+    const bool hasResources = (m_dtxConnection || m_dtxConnection2 || m_runnerPid > 0);
+    if (!hasResources) return;
+
+    INST_LOG_INFO(TAG, "Closing XCTest session after %zu batches", m_runs);
+
+    // Kill test runner if running
+    if (m_runnerPid > 0 && m_process) {
+        m_process->KillProcess(m_runnerPid);
+    }
+    m_runnerPid = 0;
+
+    // Disconnect DTX (cancels the channels and pending replies)
+    if (m_dtxConnection) m_dtxConnection->Disconnect();
+    if (m_dtxConnection2) m_dtxConnection2->Disconnect();
+    m_initReply = {};
+    m_proxyChannel.reset();
+    m_daemonChannel.reset();
+    m_dtxConnection.reset();
+    m_dtxConnection2.reset();
+    m_process.reset();
+}
+
+} // namespace instruments
@@ -35,7 +35,9 @@ public:
             default: break;
         }
 
-        std::array<char, 2048> msg{};
+        // Left uninitialized: vsnprintf always terminates the string, so
+        // zero-filling 2 KB per call is wasted work
+        std::array<char, 2048> msg;
         va_list args;
         va_start(args, fmt);
         std::vsnprintf(msg.data(), msg.size(), fmt, args);
@@ -56,15 +58,42 @@ private:
 
 } // namespace instruments
 
-// Guard argument evaluation so expensive calls (e.g. Dump()) are skipped
-// when the log level is above the threshold. Define INSTRUMENTS_ENABLE_LOGGING
-// to compile in logging calls (disabled by default).
+// Compile-time floor for logging, as a LogLevel value (1=Error .. 5=Trace).
+// Calls above it compile to nothing: their arguments are type-checked but
+// never evaluated. Defaults to Trace, or Debug in NDEBUG builds so per-message
+// Trace logging on the DTX hot paths costs nothing in release.
+#ifndef INSTRUMENTS_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define INSTRUMENTS_LOG_MIN_LEVEL 4
+#else
+#define INSTRUMENTS_LOG_MIN_LEVEL 5
+#endif
+#endif
+
+// True when a call at `level` would be written. Use it to guard work that
+// only feeds a log line (hex dumps, Dump(), selector decoding).
+// Define INSTRUMENTS_ENABLE_LOGGING to compile in logging calls (disabled by default).
+#if defined(INSTRUMENTS_ENABLE_LOGGING)
+#define INST_LOG_ENABLED(level) \
+    (static_cast<int>(::instruments::LogLevel::level) <= INSTRUMENTS_LOG_MIN_LEVEL && \
+     ::instruments::LogLevel::level <= ::instruments::Log::GetLevel())
+#else
+#define INST_LOG_ENABLED(level) false
+#endif
+
+// Arguments are evaluated only when the level passes both the compile-time
+// floor and the runtime level, so expensive calls (e.g. Dump()) are skipped.
 #if defined(INSTRUMENTS_ENABLE_LOGGING)
-#define INST_LOG_ERROR(tag, ...) do { if (::instruments::LogLevel::Error <= ::instruments::Log::GetLevel()) ::instruments::Log::Write(::instruments::LogLevel::Error, tag, __VA_ARGS__); } while(0)
-#define INST_LOG_WARN(tag, ...)  do { if (::instruments::LogLevel::Warn  <= ::instruments::Log::GetLevel()) ::instruments::Log::Write(::instruments::LogLevel::Warn,  tag, __VA_ARGS__); } while(0)
-#define INST_LOG_INFO(tag, ...)  do { if (::instruments::LogLevel::Info  <= ::instruments::Log::GetLevel()) ::instruments::Log::Write(::instruments::LogLevel::Info,  tag, __VA_ARGS__); } while(0)
-#define INST_LOG_DEBUG(tag, ...) do { if (::instruments::LogLevel::Debug <= ::instruments::Log::GetLevel()) ::instruments::Log::Write(::instruments::LogLevel::Debug, tag, __VA_ARGS__); } while(0)
-#define INST_LOG_TRACE(tag, ...) do { if (::instruments::LogLevel::Trace <= ::instruments::Log::GetLevel()) ::instruments::Log::Write(::instruments::LogLevel::Trace, tag, __VA_ARGS__); } while(0)
+#define INST_LOG_AT(level, tag, ...) do { \
+    if constexpr (static_cast<int>(::instruments::LogLevel::level) <= INSTRUMENTS_LOG_MIN_LEVEL) { \
+        if (::instruments::LogLevel::level <= ::instruments::Log::GetLevel()) \
+            ::instruments::Log::Write(::instruments::LogLevel::level, tag, __VA_ARGS__); \
+    } else { (void)(tag); } } while(0)
+#define INST_LOG_ERROR(tag, ...) INST_LOG_AT(Error, tag, __VA_ARGS__)
+#define INST_LOG_WARN(tag, ...)  INST_LOG_AT(Warn,  tag, __VA_ARGS__)
+#define INST_LOG_INFO(tag, ...)  INST_LOG_AT(Info,  tag, __VA_ARGS__)
+#define INST_LOG_DEBUG(tag, ...) INST_LOG_AT(Debug, tag, __VA_ARGS__)
+#define INST_LOG_TRACE(tag, ...) INST_LOG_AT(Trace, tag, __VA_ARGS__)
 #else
 #define INST_LOG_ERROR(tag, ...) do { (void)(tag); } while(0)
 #define INST_LOG_WARN(tag, ...)  do { (void)(tag); } while(0)
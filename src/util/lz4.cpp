@@ -1,31 +1,102 @@
 #include "lz4.h"
 #include <cstring>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define INSTRUMENTS_LZ4_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define INSTRUMENTS_LZ4_NEON 1
+#endif
+
 namespace instruments {
 
-// Minimal LZ4 block decompression (LZ4_decompress_safe equivalent)
+// LZ4 block decompression (LZ4_decompress_safe equivalent)
 // Based on LZ4 block format specification:
 // https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+//
+// Away from the ends of the buffers, literals and matches are copied in
+// 16-byte vector moves, 32 bytes per step, rounding the length up ("wild
+// copy"); a copy may then write up to WildMargin bytes past its end, which
+// the following sequence overwrites. Within WildMargin of either end every
+// byte is bounds-checked and copied exactly.
 
-bool LZ4::Decompress(const uint8_t* src, size_t srcSize,
-                     uint8_t* dst, size_t dstCapacity,
-                     size_t& outSize) {
-    if (!src || !dst || srcSize == 0 || dstCapacity == 0) {
-        outSize = 0;
-        return false;
+namespace {
+
+constexpr size_t WildMargin = 32;
+
+inline void Copy8(uint8_t* dst, const uint8_t* src) {
+    std::memcpy(dst, src, 8);
+}
+
+inline void Copy16(uint8_t* dst, const uint8_t* src) {
+#if defined(INSTRUMENTS_LZ4_SSE2)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+#elif defined(INSTRUMENTS_LZ4_NEON)
+    vst1q_u8(dst, vld1q_u8(src));
+#else
+    std::memcpy(dst, src, 16);
+#endif
+}
+
+// Copy [src, src + (end - dst)) rounded up to 32 bytes. src must be at
+// least 16 bytes behind dst when the ranges overlap.
+inline void WildCopy32(uint8_t* dst, const uint8_t* src, const uint8_t* end) {
+    do {
+        Copy16(dst, src);
+        Copy16(dst + 16, src + 16);
+        dst += 32;
+        src += 32;
+    } while (dst < end);
+}
+
+// Copy a match of length bytes from op - offset; WildMargin bytes of room
+// after op + length
+inline void CopyMatchFast(uint8_t* op, size_t offset, size_t length) {
+    const uint8_t* match = op - offset;
+    uint8_t* const end = op + length;
+    if (offset >= 16) {
+        WildCopy32(op, match, end);
+        return;
+    }
+    if (offset < 8) {
+        // Repeating pattern shorter than a word: write the first 8 bytes
+        // one by one, then copy from a multiple of the period at least 8
+        // bytes back (1 -> 8, 3 -> 9, 7 -> 14, ...)
+        static constexpr uint8_t kPeriodDistance[8] = {0, 8, 8, 9, 8, 10, 12, 14};
+        for (int i = 0; i < 8; i++) op[i] = match[i];
+        op += 8;
+        match = op - kPeriodDistance[offset];
     }
+    while (op < end) {
+        Copy8(op, match);
+        op += 8;
+        match += 8;
+    }
+}
+
+// Shared decoder. Matches may reach back into the prefix (the prefixSize
+// bytes right before dst) and beyond it into dict (an unrelated buffer
+// logically before the prefix).
+bool DecodeBlock(const uint8_t* src, size_t srcSize,
+                 uint8_t* dst, size_t dstCapacity, size_t& outSize,
+                 size_t prefixSize, const uint8_t* dict, size_t dictSize) {
+    outSize = 0;
+    if (!src || !dst || srcSize == 0 || dstCapacity == 0) return false;
 
     const uint8_t* ip = src;
     const uint8_t* const iEnd = src + srcSize;
     uint8_t* op = dst;
     uint8_t* const oEnd = dst + dstCapacity;
+    const uint8_t* const lowLimit = dst - prefixSize;
 
     while (ip < iEnd) {
         // Read token
-        uint8_t token = *ip++;
+        const uint8_t token = *ip++;
 
         // Literal length
-        size_t literalLen = (token >> 4) & 0x0F;
+        size_t literalLen = token >> 4;
         if (literalLen == 15) {
             uint8_t s;
             do {
@@ -37,8 +108,14 @@ bool LZ4::Decompress(const uint8_t* src, size_t srcSize,
 
         // Copy literals
         if (literalLen > 0) {
-            if (ip + literalLen > iEnd || op + literalLen > oEnd) return false;
-            std::memcpy(op, ip, literalLen);
+            if (literalLen > static_cast<size_t>(iEnd - ip) ||
+                literalLen > static_cast<size_t>(oEnd - op)) return false;
+            if (static_cast<size_t>(iEnd - ip) >= literalLen + WildMargin &&
+                static_cast<size_t>(oEnd - op) >= literalLen + WildMargin) {
+                WildCopy32(op, ip, op + literalLen);
+            } else {
+                std::memcpy(op, ip, literalLen);
+            }
             ip += literalLen;
             op += literalLen;
         }
@@ -47,14 +124,11 @@ bool LZ4::Decompress(const uint8_t* src, size_t srcSize,
         if (ip >= iEnd) break;
 
         // Read offset (2 bytes, little-endian)
-        if (ip + 2 > iEnd) return false;
-        size_t offset = ip[0] | (ip[1] << 8);
+        if (iEnd - ip < 2) return false;
+        const size_t offset = ip[0] | (ip[1] << 8);
         ip += 2;
         if (offset == 0) return false;
 
-        uint8_t* match = op - offset;
-        if (match < dst) return false;
-
         // Match length
         size_t matchLen = (token & 0x0F) + 4;  // minmatch = 4
         if (matchLen == 19) { // 15 + 4
@@ -65,11 +139,29 @@ bool LZ4::Decompress(const uint8_t* src, size_t srcSize,
                 matchLen += s;
             } while (s == 255);
         }
+        if (matchLen > static_cast<size_t>(oEnd - op)) return false;
+
+        // Part of the match in the external dictionary
+        const size_t behind = static_cast<size_t>(op - lowLimit);
+        if (offset > behind) {
+            const size_t back = offset - behind;
+            if (back > dictSize) return false;
+            const size_t n = back < matchLen ? back : matchLen;
+            std::memcpy(op, dict + dictSize - back, n);
+            op += n;
+            matchLen -= n;
+            if (matchLen == 0) continue;
+            // The rest continues at the start of the prefix
+        }
 
         // Copy match (may overlap)
-        if (op + matchLen > oEnd) return false;
-        for (size_t i = 0; i < matchLen; i++) {
-            op[i] = match[i];
+        if (static_cast<size_t>(oEnd - op) >= matchLen + WildMargin) {
+            CopyMatchFast(op, offset, matchLen);
+        } else {
+            const uint8_t* match = op - offset;
+            for (size_t i = 0; i < matchLen; i++) {
+                op[i] = match[i];
+            }
         }
         op += matchLen;
     }
@@ -78,117 +170,155 @@ bool LZ4::Decompress(const uint8_t* src, size_t srcSize,
     return true;
 }
 
-bool LZ4::DecompressWithDict(const uint8_t* src, size_t srcSize,
-                             uint8_t* dst, size_t dstCapacity,
-                             size_t& outSize,
-                             const uint8_t* dict, size_t dictSize) {
-    if (!src || !dst || srcSize == 0 || dstCapacity == 0) {
-        outSize = 0;
-        return false;
-    }
+uint32_t ReadLE32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0])
+         | (static_cast<uint32_t>(p[1]) << 8)
+         | (static_cast<uint32_t>(p[2]) << 16)
+         | (static_cast<uint32_t>(p[3]) << 24);
+}
 
-    const uint8_t* ip = src;
-    const uint8_t* const iEnd = src + srcSize;
-    uint8_t* op = dst;
-    uint8_t* const oEnd = dst + dstCapacity;
+// Block format end rules: the last 5 bytes are always literals and the
+// last match starts at least 12 bytes before the end
+constexpr size_t MinMatch = 4;
+constexpr size_t LastLiterals = 5;
+constexpr size_t MatchFindLimit = 12;
+constexpr size_t MaxOffset = 65535;
+constexpr int HashLog = 12;
+
+inline uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
 
-    while (ip < iEnd) {
-        uint8_t token = *ip++;
+inline uint32_t HashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HashLog);
+}
 
-        size_t literalLen = (token >> 4) & 0x0F;
-        if (literalLen == 15) {
-            uint8_t s;
-            do {
-                if (ip >= iEnd) return false;
-                s = *ip++;
-                literalLen += s;
-            } while (s == 255);
-        }
+// Write a length continuation (the part beyond the 4-bit token field)
+inline uint8_t* WriteLengthTail(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
 
-        if (literalLen > 0) {
-            if (ip + literalLen > iEnd || op + literalLen > oEnd) return false;
-            std::memcpy(op, ip, literalLen);
-            ip += literalLen;
-            op += literalLen;
-        }
+// Emit one sequence; matchLen 0 writes the closing literal-only sequence.
+// Returns nullptr when it does not fit before oEnd.
+uint8_t* WriteSequence(uint8_t* op, uint8_t* const oEnd,
+                       const uint8_t* literals, size_t literalLen,
+                       size_t offset, size_t matchLen) {
+    const size_t worst = 1 + literalLen / 255 + 1 + literalLen + 2 +
+                         (matchLen >= MinMatch ? (matchLen - MinMatch) / 255 + 1 : 0);
+    if (worst > static_cast<size_t>(oEnd - op)) return nullptr;
+
+    uint8_t* const token = op++;
+    *token = static_cast<uint8_t>((literalLen >= 15 ? 15 : literalLen) << 4);
+    if (literalLen >= 15) op = WriteLengthTail(op, literalLen - 15);
+    std::memcpy(op, literals, literalLen);
+    op += literalLen;
+    if (matchLen == 0) return op;
+
+    *op++ = static_cast<uint8_t>(offset & 0xFF);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    const size_t code = matchLen - MinMatch;
+    *token |= static_cast<uint8_t>(code >= 15 ? 15 : code);
+    if (code >= 15) op = WriteLengthTail(op, code - 15);
+    return op;
+}
 
-        if (ip >= iEnd) break;
+} // namespace
 
-        if (ip + 2 > iEnd) return false;
-        size_t offset = ip[0] | (ip[1] << 8);
-        ip += 2;
-        if (offset == 0) return false;
+bool LZ4::Compress(const uint8_t* src, size_t srcSize,
+                   uint8_t* dst, size_t dstCapacity,
+                   size_t& outSize) {
+    outSize = 0;
+    if (!src || !dst || srcSize == 0 || dstCapacity == 0) return false;
 
-        size_t produced = static_cast<size_t>(op - dst);
-        size_t available = dictSize + produced;
-        if (offset > available) return false;
+    uint8_t* op = dst;
+    uint8_t* const oEnd = dst + dstCapacity;
+    const uint8_t* anchor = src;
+    const uint8_t* const iEnd = src + srcSize;
 
-        size_t matchLen = (token & 0x0F) + 4;
-        if (matchLen == 19) {
-            uint8_t s;
-            do {
-                if (ip >= iEnd) return false;
-                s = *ip++;
-                matchLen += s;
-            } while (s == 255);
-        }
+    if (srcSize > MatchFindLimit) {
+        // Positions (relative to src) of the last sequence seen per hash;
+        // stale or colliding entries are rejected by the compare below
+        uint32_t table[1u << HashLog] = {};
+        const uint8_t* const mfLimit = iEnd - MatchFindLimit;
+        const uint8_t* const matchLimit = iEnd - LastLiterals;
+        const uint8_t* ip = src + 1;
+        unsigned misses = 0;
+
+        while (ip < mfLimit) {
+            const uint32_t sequence = Read32(ip);
+            const uint32_t h = HashSequence(sequence);
+            const uint8_t* ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+
+            if (ref >= ip || static_cast<size_t>(ip - ref) > MaxOffset || Read32(ref) != sequence) {
+                // Step further ahead the longer nothing matches
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            // Extend backwards into pending literals, then forwards
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t matchLen = MinMatch;
+            while (ip + matchLen < matchLimit && ip[matchLen] == ref[matchLen]) {
+                matchLen++;
+            }
 
-        if (op + matchLen > oEnd) return false;
+            op = WriteSequence(op, oEnd, anchor, static_cast<size_t>(ip - anchor),
+                               static_cast<size_t>(ip - ref), matchLen);
+            if (!op) return false;
+            ip += matchLen;
+            anchor = ip;
 
-        // Copy match with optional dictionary support
-        size_t matchPosCombined = dictSize + produced - offset;
-        for (size_t i = 0; i < matchLen; i++) {
-            size_t srcPos = matchPosCombined + i;
-            if (srcPos < dictSize) {
-                op[i] = dict[srcPos];
-            } else {
-                op[i] = dst[srcPos - dictSize];
+            // Index a position inside the match so runs chain cheaply
+            if (ip < mfLimit) {
+                table[HashSequence(Read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
             }
         }
-        op += matchLen;
     }
 
+    op = WriteSequence(op, oEnd, anchor, static_cast<size_t>(iEnd - anchor), 0, 0);
+    if (!op) return false;
     outSize = static_cast<size_t>(op - dst);
     return true;
 }
 
-std::vector<uint8_t> LZ4::Decompress(const uint8_t* src, size_t srcSize,
-                                     size_t maxDecompressedSize) {
-    std::vector<uint8_t> result(maxDecompressedSize);
-    size_t outSize = 0;
-    if (!Decompress(src, srcSize, result.data(), maxDecompressedSize, outSize)) {
-        return {};
-    }
-    result.resize(outSize);
-    return result;
+bool LZ4::Decompress(const uint8_t* src, size_t srcSize,
+                     uint8_t* dst, size_t dstCapacity,
+                     size_t& outSize) {
+    return DecodeBlock(src, srcSize, dst, dstCapacity, outSize, 0, nullptr, 0);
 }
 
-std::vector<uint8_t> LZ4::DecompressWithDict(const uint8_t* src, size_t srcSize,
-                                             size_t maxDecompressedSize,
-                                             const uint8_t* dict, size_t dictSize) {
-    std::vector<uint8_t> result(maxDecompressedSize);
-    size_t outSize = 0;
-    if (!DecompressWithDict(src, srcSize, result.data(), maxDecompressedSize, outSize, dict, dictSize)) {
-        return {};
+bool LZ4::DecompressWithDict(const uint8_t* src, size_t srcSize,
+                             uint8_t* dst, size_t dstCapacity,
+                             size_t& outSize,
+                             const uint8_t* dict, size_t dictSize) {
+    if (dict && dict + dictSize == dst) {
+        // Dictionary is the output just before dst: plain back-references
+        return DecodeBlock(src, srcSize, dst, dstCapacity, outSize, dictSize, nullptr, 0);
     }
-    result.resize(outSize);
-    return result;
+    return DecodeBlock(src, srcSize, dst, dstCapacity, outSize, 0, dict, dict ? dictSize : 0);
 }
 
-std::vector<uint8_t> LZ4::DecompressFrame(const uint8_t* src, size_t srcSize,
-                                          size_t maxDecompressedSize) {
-    if (!src || srcSize < 7) return {};
+bool LZ4::DecompressFrame(const uint8_t* src, size_t srcSize,
+                          uint8_t* dst, size_t dstCapacity,
+                          size_t& outSize) {
+    outSize = 0;
+    if (!src || !dst || srcSize < 7) return false;
 
-    auto readLE32 = [](const uint8_t* p) -> uint32_t {
-        return static_cast<uint32_t>(p[0])
-             | (static_cast<uint32_t>(p[1]) << 8)
-             | (static_cast<uint32_t>(p[2]) << 16)
-             | (static_cast<uint32_t>(p[3]) << 24);
-    };
-
-    const uint32_t magic = readLE32(src);
+    const uint32_t magic = ReadLE32(src);
     if (magic != 0x184D2204) {
-        return {};
+        return false;
     }
 
     size_t pos = 4;
@@ -197,28 +327,28 @@ std::vector<uint8_t> LZ4::DecompressFrame(const uint8_t* src, size_t srcSize,
 
     const uint8_t version = (flg >> 6) & 0x03;
     if (version != 0x01) {
-        return {};
+        return false;
     }
 
+    const bool hasBlockChecksum = (flg & 0x10) != 0;
     const bool hasContentSize = (flg & 0x08) != 0;
     const bool hasDictId = (flg & 0x01) != 0;
 
     uint64_t contentSize = 0;
     if (hasContentSize) {
-        if (pos + 8 > srcSize) return {};
-        contentSize = 0;
+        if (pos + 8 > srcSize) return false;
         for (int i = 0; i < 8; i++) {
             contentSize |= (static_cast<uint64_t>(src[pos + i]) << (8 * i));
         }
         pos += 8;
     }
     if (hasDictId) {
-        if (pos + 4 > srcSize) return {};
+        if (pos + 4 > srcSize) return false;
         pos += 4;
     }
 
     // Skip header checksum
-    if (pos + 1 > srcSize) return {};
+    if (pos + 1 > srcSize) return false;
     pos += 1;
 
     size_t blockMaxSize = 1 << 16; // default 64KB
@@ -230,42 +360,79 @@ std::vector<uint8_t> LZ4::DecompressFrame(const uint8_t* src, size_t srcSize,
         default: break;
     }
 
-    size_t outputLimit = maxDecompressedSize;
+    size_t outputLimit = dstCapacity;
     if (contentSize > 0 && contentSize < outputLimit) {
         outputLimit = static_cast<size_t>(contentSize);
     }
 
-    std::vector<uint8_t> out;
-    out.reserve(outputLimit > 0 ? outputLimit : 1024);
-
+    // Blocks decode in place, one after the other: linked blocks find the
+    // previous ones right before them
+    size_t outPos = 0;
     while (pos + 4 <= srcSize) {
-        uint32_t blockSize = readLE32(src + pos);
+        uint32_t blockSize = ReadLE32(src + pos);
         pos += 4;
         if (blockSize == 0) break; // end of frame
 
         const bool uncompressed = (blockSize & 0x80000000u) != 0;
         blockSize &= 0x7FFFFFFFu;
 
-        if (pos + blockSize > srcSize) return {};
+        if (blockSize > srcSize - pos) return false;
 
         if (uncompressed) {
-            if (out.size() + blockSize > outputLimit && outputLimit > 0) return {};
-            out.insert(out.end(), src + pos, src + pos + blockSize);
-            pos += blockSize;
-            continue;
-        }
-
-        std::vector<uint8_t> blockOut(blockMaxSize);
-        size_t blockOutSize = 0;
-        if (!Decompress(src + pos, blockSize, blockOut.data(), blockOut.size(), blockOutSize)) {
-            return {};
+            if (blockSize > outputLimit - outPos) return false;
+            std::memcpy(dst + outPos, src + pos, blockSize);
+            outPos += blockSize;
+        } else {
+            const size_t room = outputLimit - outPos;
+            size_t blockOutSize = 0;
+            if (room == 0 ||
+                !DecodeBlock(src + pos, blockSize, dst + outPos,
+                             room < blockMaxSize ? room : blockMaxSize, blockOutSize,
+                             outPos, nullptr, 0)) {
+                return false;
+            }
+            outPos += blockOutSize;
         }
-        if (out.size() + blockOutSize > outputLimit && outputLimit > 0) return {};
-        out.insert(out.end(), blockOut.begin(), blockOut.begin() + blockOutSize);
         pos += blockSize;
+        if (hasBlockChecksum) pos += 4;
+    }
+
+    outSize = outPos;
+    return true;
+}
+
+std::vector<uint8_t> LZ4::Decompress(const uint8_t* src, size_t srcSize,
+                                     size_t maxDecompressedSize) {
+    std::vector<uint8_t> result(maxDecompressedSize);
+    size_t outSize = 0;
+    if (!Decompress(src, srcSize, result.data(), maxDecompressedSize, outSize)) {
+        return {};
     }
+    result.resize(outSize);
+    return result;
+}
 
-    return out;
+std::vector<uint8_t> LZ4::DecompressWithDict(const uint8_t* src, size_t srcSize,
+                                             size_t maxDecompressedSize,
+                                             const uint8_t* dict, size_t dictSize) {
+    std::vector<uint8_t> result(maxDecompressedSize);
+    size_t outSize = 0;
+    if (!DecompressWithDict(src, srcSize, result.data(), maxDecompressedSize, outSize, dict, dictSize)) {
+        return {};
+    }
+    result.resize(outSize);
+    return result;
+}
+
+std::vector<uint8_t> LZ4::DecompressFrame(const uint8_t* src, size_t srcSize,
+                                          size_t maxDecompressedSize) {
+    std::vector<uint8_t> result(maxDecompressedSize);
+    size_t outSize = 0;
+    if (!DecompressFrame(src, srcSize, result.data(), maxDecompressedSize, outSize)) {
+        return {};
+    }
+    result.resize(outSize);
+    return result;
 }
 
 } // namespace instruments
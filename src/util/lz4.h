@@ -7,10 +7,22 @@
 
 namespace instruments {
 
-// Minimal LZ4 block decompression for DTX compressed messages.
-// Only implements LZ4_decompress_safe equivalent.
+// LZ4 decompression for DTX compressed messages (LZ4_decompress_safe
+// equivalent: malformed input fails, never reads or writes out of bounds).
+// Copies use 16-byte SSE2 / NEON moves where available.
+// Compression is the single-pass greedy LZ4 block encoder (LZ4_compress_fast
+// equivalent), used for large outgoing DTX messages.
 class LZ4 {
 public:
+    // Worst-case compressed size of srcSize bytes (incompressible input)
+    static size_t CompressBound(size_t srcSize) { return srcSize + srcSize / 255 + 16; }
+
+    // Compress src into an LZ4 block. Returns false if dst is too small
+    // (CompressBound() bytes always suffice).
+    static bool Compress(const uint8_t* src, size_t srcSize,
+                         uint8_t* dst, size_t dstCapacity,
+                         size_t& outSize);
+
     // Decompress LZ4 block format.
     // Returns decompressed data, or empty vector on failure.
     static std::vector<uint8_t> Decompress(const uint8_t* src, size_t srcSize,
@@ -26,7 +38,9 @@ public:
                                                    size_t maxDecompressedSize,
                                                    const uint8_t* dict, size_t dictSize);
 
-    // Decompress with known output size
+    // Decompress into a caller-supplied buffer. Bytes of dst past outSize
+    // (up to dstCapacity) may be overwritten. A dict that ends where dst
+    // starts (earlier output in the same buffer) avoids a separate pass.
     static bool Decompress(const uint8_t* src, size_t srcSize,
                            uint8_t* dst, size_t dstCapacity,
                            size_t& outSize);
@@ -34,6 +48,9 @@ public:
                                    uint8_t* dst, size_t dstCapacity,
                                    size_t& outSize,
                                    const uint8_t* dict, size_t dictSize);
+    static bool DecompressFrame(const uint8_t* src, size_t srcSize,
+                                uint8_t* dst, size_t dstCapacity,
+                                size_t& outSize);
 };
 
 } // namespace instruments
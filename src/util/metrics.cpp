@@ -0,0 +1,229 @@
+#include "metrics.h"
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace instruments {
+
+// Distinct selectors / channels tracked before they share "(other)"
+static constexpr size_t kMaxNamedHistograms = 512;
+
+uint64_t LatencyHistogram::PercentileUs(double p) const {
+    if (count == 0) return 0;
+    const double clamped = std::clamp(p, 0.0, 100.0);
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(clamped / 100.0 * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BucketCount; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return i + 1 == BucketCount ? maxUs : std::min<uint64_t>(uint64_t{1} << i, maxUs);
+        }
+    }
+    return maxUs;
+}
+
+void MetricsHistogram::Record(uint64_t us) {
+    const size_t bucket = std::min<size_t>(std::bit_width(us), LatencyHistogram::BucketCount - 1);
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_totalUs.fetch_add(us, std::memory_order_relaxed);
+    uint64_t max = m_maxUs.load(std::memory_order_relaxed);
+    while (us > max && !m_maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+}
+
+void MetricsHistogram::Load(LatencyHistogram& out) const {
+    for (size_t i = 0; i < LatencyHistogram::BucketCount; i++) {
+        out.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    }
+    out.count = m_count.load(std::memory_order_relaxed);
+    out.totalUs = m_totalUs.load(std::memory_order_relaxed);
+    out.maxUs = m_maxUs.load(std::memory_order_relaxed);
+}
+
+void MetricsHistogram::Reset() {
+    for (auto& bucket : m_buckets) bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_totalUs.store(0, std::memory_order_relaxed);
+    m_maxUs.store(0, std::memory_order_relaxed);
+}
+
+namespace {
+
+using HistogramMap = std::map<std::string, std::unique_ptr<MetricsHistogram>, std::less<>>;
+
+struct Registry {
+    MetricsCounters counters;
+
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    HistogramMap rtt;
+    HistogramMap handlers;
+    std::map<uint64_t, std::function<DispatchQueueStats()>> queues;
+    uint64_t nextQueueId = 1;
+
+    // Periodic snapshot thread (Metrics::SetSnapshotCallback)
+    std::mutex callbackMutex;
+    std::condition_variable callbackCv;
+    std::thread callbackThread;
+    bool callbackStop = false;
+
+    ~Registry() { StopCallback(); }
+
+    void StopCallback() {
+        {
+            std::lock_guard<std::mutex> lock(callbackMutex);
+            callbackStop = true;
+        }
+        callbackCv.notify_all();
+        if (callbackThread.joinable()) {
+            if (callbackThread.get_id() == std::this_thread::get_id()) {
+                callbackThread.detach();
+            } else {
+                callbackThread.join();
+            }
+        }
+    }
+};
+
+Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+MetricsHistogram& Lookup(HistogramMap& map, std::string_view name) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = map.find(name);
+    if (it == map.end()) {
+        const std::string key = map.size() < kMaxNamedHistograms ? std::string(name) : "(other)";
+        it = map.find(key);
+        if (it == map.end()) it = map.emplace(key, std::make_unique<MetricsHistogram>()).first;
+    }
+    return *it->second;
+}
+
+void LoadMap(const HistogramMap& map, std::map<std::string, LatencyHistogram>& out) {
+    for (const auto& [name, histogram] : map) {
+        LatencyHistogram loaded;
+        histogram->Load(loaded);
+        if (loaded.count > 0) out[name] = loaded;
+    }
+}
+
+uint64_t Load(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+namespace metrics {
+
+MetricsCounters& Counters() {
+    return GetRegistry().counters;
+}
+
+MetricsHistogram& Rtt(std::string_view selector) {
+    return Lookup(GetRegistry().rtt, selector);
+}
+
+MetricsHistogram& Handler(std::string_view channel) {
+    return Lookup(GetRegistry().handlers, channel);
+}
+
+uint64_t RegisterQueue(std::function<DispatchQueueStats()> probe) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    const uint64_t id = registry.nextQueueId++;
+    registry.queues.emplace(id, std::move(probe));
+    return id;
+}
+
+void UnregisterQueue(uint64_t id) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.queues.erase(id);
+}
+
+} // namespace metrics
+
+MetricsSnapshot Metrics::Snapshot() {
+    Registry& registry = GetRegistry();
+    const MetricsCounters& c = registry.counters;
+    MetricsSnapshot snapshot;
+
+    snapshot.dtx.bytesIn = Load(c.receive.bytes);
+    snapshot.dtx.framesIn = Load(c.receive.frames);
+    snapshot.dtx.bytesOut = Load(c.send.bytes);
+    snapshot.dtx.framesOut = Load(c.send.frames);
+    snapshot.fragmentsIn = Load(c.receive.fragments);
+    snapshot.messagesReassembled = Load(c.receive.reassembled);
+    snapshot.lz4Messages = Load(c.receive.lz4Messages);
+    snapshot.lz4BytesIn = Load(c.receive.lz4BytesIn);
+    snapshot.lz4BytesOut = Load(c.receive.lz4BytesOut);
+    c.decode.Load(snapshot.decode);
+
+    snapshot.tunnel.packetsIn = Load(c.tunnel.packetsIn);
+    snapshot.tunnel.packetsOut = Load(c.tunnel.packetsOut);
+    snapshot.tunnel.bytesIn = Load(c.tunnel.bytesIn);
+    snapshot.tunnel.bytesOut = Load(c.tunnel.bytesOut);
+    snapshot.tunnel.dropsIn = Load(c.tunnel.dropsIn);
+    snapshot.tunnel.dropsOut = Load(c.tunnel.dropsOut);
+
+    // Queue probes take their queue's lock: call them outside the registry's
+    std::vector<std::function<DispatchQueueStats()>> probes;
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        snapshot.uptimeMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - registry.start).count());
+        LoadMap(registry.rtt, snapshot.rtt);
+        LoadMap(registry.handlers, snapshot.handlers);
+        for (const auto& [id, probe] : registry.queues) probes.push_back(probe);
+    }
+    for (const auto& probe : probes) snapshot.queues.push_back(probe());
+    return snapshot;
+}
+
+void Metrics::Reset() {
+    Registry& registry = GetRegistry();
+    MetricsCounters& c = registry.counters;
+    for (auto* counter : {&c.receive.bytes, &c.receive.frames, &c.receive.fragments,
+                          &c.receive.reassembled, &c.receive.lz4Messages, &c.receive.lz4BytesIn,
+                          &c.receive.lz4BytesOut, &c.send.bytes, &c.send.frames,
+                          &c.tunnel.packetsIn, &c.tunnel.packetsOut, &c.tunnel.bytesIn,
+                          &c.tunnel.bytesOut, &c.tunnel.dropsIn, &c.tunnel.dropsOut}) {
+        counter->store(0, std::memory_order_relaxed);
+    }
+    c.decode.Reset();
+
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.start = std::chrono::steady_clock::now();
+    for (auto& [name, histogram] : registry.rtt) histogram->Reset();
+    for (auto& [name, histogram] : registry.handlers) histogram->Reset();
+}
+
+void Metrics::SetSnapshotCallback(uint32_t intervalMs, MetricsCallback cb) {
+    Registry& registry = GetRegistry();
+    registry.StopCallback();
+    if (!cb || intervalMs == 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(registry.callbackMutex);
+        registry.callbackStop = false;
+    }
+    registry.callbackThread = std::thread([&registry, intervalMs, cb = std::move(cb)]() {
+        std::unique_lock<std::mutex> lock(registry.callbackMutex);
+        while (!registry.callbackCv.wait_for(lock, std::chrono::milliseconds(intervalMs),
+                                             [&registry]() { return registry.callbackStop; })) {
+            lock.unlock();
+            cb(Snapshot());
+            lock.lock();
+        }
+    });
+}
+
+} // namespace instruments
@@ -0,0 +1,95 @@
+#ifndef INSTRUMENTS_UTIL_METRICS_H
+#define INSTRUMENTS_UTIL_METRICS_H
+
+#include "../../include/instruments/metrics.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace instruments {
+
+// MetricsHistogram - LatencyHistogram recorded with relaxed atomics
+class MetricsHistogram {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void Record(uint64_t us);
+    void RecordSince(Clock::time_point start) {
+        Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start).count()));
+    }
+
+    void Load(LatencyHistogram& out) const;
+    void Reset();
+
+private:
+    std::array<std::atomic<uint64_t>, LatencyHistogram::BucketCount> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_totalUs{0};
+    std::atomic<uint64_t> m_maxUs{0};
+};
+
+// Process-wide counters behind Metrics::Snapshot(). Receive-side, send-side
+// and tunnel counters sit on separate cache lines, so the receive threads
+// and senders do not contend on one line.
+struct MetricsCounters {
+    struct alignas(64) Receive {
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> fragments{0};
+        std::atomic<uint64_t> reassembled{0};
+        std::atomic<uint64_t> lz4Messages{0};
+        std::atomic<uint64_t> lz4BytesIn{0};
+        std::atomic<uint64_t> lz4BytesOut{0};
+    } receive;
+    struct alignas(64) Send {
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> frames{0};
+    } send;
+    struct alignas(64) Tunnel {
+        std::atomic<uint64_t> packetsIn{0};
+        std::atomic<uint64_t> packetsOut{0};
+        std::atomic<uint64_t> bytesIn{0};
+        std::atomic<uint64_t> bytesOut{0};
+        std::atomic<uint64_t> dropsIn{0};
+        std::atomic<uint64_t> dropsOut{0};
+    } tunnel;
+    MetricsHistogram decode;
+};
+
+namespace metrics {
+
+MetricsCounters& Counters();
+
+inline void Add(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+// Per-message timings (decode, handlers) cost two clock reads, about as much
+// as the rest of the counting together, so only one message in
+// TimingSampleInterval per thread is timed
+constexpr uint32_t TimingSampleInterval = 8;
+
+inline bool SampleTiming() {
+    thread_local uint32_t tick = 0;
+    return ++tick % TimingSampleInterval == 0;
+}
+
+// Round-trip histogram of a request selector and run-time histogram of a
+// channel's handlers. Created on first use and never freed, so callers
+// keep the reference; past a few hundred names they share one "(other)".
+MetricsHistogram& Rtt(std::string_view selector);
+MetricsHistogram& Handler(std::string_view channel);
+
+// Handler queues report their depth through a probe while they live
+uint64_t RegisterQueue(std::function<DispatchQueueStats()> probe);
+void UnregisterQueue(uint64_t id);
+
+} // namespace metrics
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_UTIL_METRICS_H
@@ -0,0 +1,244 @@
+#include "trace.h"
+#include "log.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace instruments {
+
+static const char* TAG = "Trace";
+
+namespace {
+
+struct TraceEvent {
+    const char* category;
+    std::string name;
+    std::string detail;
+    std::string device;
+    trace::Clock::time_point start;
+    trace::Clock::time_point end;
+    uint32_t tid;
+    bool async;
+};
+
+struct TraceBuffer {
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    size_t maxEvents = 0;
+    size_t dropped = 0;
+    trace::Clock::time_point origin;
+};
+
+TraceBuffer& Buffer() {
+    static TraceBuffer buffer;
+    return buffer;
+}
+
+thread_local std::string t_device;
+
+uint32_t ThreadId() {
+    static std::atomic<uint32_t> next{1};
+    thread_local const uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+void Record(const char* category, std::string_view name, trace::Clock::time_point start,
+            trace::Clock::time_point end, std::string_view detail, std::string_view device,
+            bool async) {
+    TraceBuffer& buffer = Buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (!trace::Enabled()) return;
+    if (buffer.events.size() >= buffer.maxEvents) {
+        buffer.dropped++;
+        return;
+    }
+    buffer.events.push_back({category, std::string(name), std::string(detail),
+                             std::string(device), start, end, ThreadId(), async});
+}
+
+void AppendEscaped(std::string& out, std::string_view text) {
+    out += '"';
+    for (const char c : text) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+namespace trace {
+
+std::atomic<bool> g_recording{false};
+
+void Complete(const char* category, std::string_view name, Clock::time_point start,
+              Clock::time_point end, std::string_view detail) {
+    Record(category, name, start, end, detail, t_device, false);
+}
+
+void Async(const char* category, std::string_view name, Clock::time_point start,
+           Clock::time_point end, std::string_view detail, std::string_view device) {
+    Record(category, name, start, end, detail, device, true);
+}
+
+} // namespace trace
+
+TraceDeviceScope::TraceDeviceScope(std::string device)
+    : m_previous(std::move(t_device))
+{
+    t_device = std::move(device);
+}
+
+TraceDeviceScope::~TraceDeviceScope() {
+    t_device = std::move(m_previous);
+}
+
+const std::string& TraceDeviceScope::Current() {
+    return t_device;
+}
+
+void Trace::Start(size_t maxEvents) {
+    TraceBuffer& buffer = Buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.clear();
+    buffer.maxEvents = maxEvents;
+    buffer.dropped = 0;
+    buffer.origin = trace::Clock::now();
+    trace::g_recording.store(true);
+}
+
+void Trace::Stop() {
+    TraceBuffer& buffer = Buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    trace::g_recording.store(false);
+    if (buffer.dropped > 0) {
+        INST_LOG_WARN(TAG, "Trace buffer full: %zu events dropped", buffer.dropped);
+    }
+}
+
+bool Trace::IsRecording() {
+    return trace::Enabled();
+}
+
+size_t Trace::EventCount() {
+    TraceBuffer& buffer = Buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    return buffer.events.size();
+}
+
+size_t Trace::DroppedCount() {
+    TraceBuffer& buffer = Buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    return buffer.dropped;
+}
+
+std::string Trace::ToChromeJson() {
+    TraceBuffer& buffer = Buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+    // One process row per device; pid 1 holds spans outside any device
+    std::map<std::string, uint32_t> pids;
+    pids[""] = 1;
+    for (const auto& event : buffer.events) {
+        pids.emplace(event.device, static_cast<uint32_t>(pids.size() + 1));
+    }
+
+    auto micros = [&buffer](trace::Clock::time_point t) -> int64_t {
+        return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(
+            t - buffer.origin).count());
+    };
+
+    std::string out = "{\"traceEvents\":[\n";
+    char number[160];
+    bool first = true;
+    auto begin = [&]() {
+        if (!first) out += ",\n";
+        first = false;
+    };
+
+    for (const auto& [device, pid] : pids) {
+        begin();
+        std::snprintf(number, sizeof(number),
+                      "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%u,\"args\":{\"name\":", pid);
+        out += number;
+        AppendEscaped(out, device.empty() ? "libinstruments" : device);
+        out += "}}";
+    }
+
+    uint64_t asyncId = 0;
+    for (const auto& event : buffer.events) {
+        const uint32_t pid = pids[event.device];
+        const int64_t start = micros(event.start);
+        const int64_t end = std::max(start, micros(event.end));
+        auto common = [&]() {
+            out += "\"name\":";
+            AppendEscaped(out, event.name);
+            out += ",\"cat\":";
+            AppendEscaped(out, event.category);
+        };
+        auto args = [&]() {
+            if (event.detail.empty()) return;
+            out += ",\"args\":{\"detail\":";
+            AppendEscaped(out, event.detail);
+            out += "}";
+        };
+
+        if (!event.async) {
+            begin();
+            out += "{\"ph\":\"X\",";
+            common();
+            std::snprintf(number, sizeof(number), ",\"ts\":%" PRId64 ",\"dur\":%" PRId64
+                          ",\"pid\":%u,\"tid\":%u", start, end - start, pid, event.tid);
+            out += number;
+            args();
+            out += "}";
+            continue;
+        }
+
+        // Nestable async pair sharing an id
+        asyncId++;
+        for (const bool isBegin : {true, false}) {
+            begin();
+            out += isBegin ? "{\"ph\":\"b\"," : "{\"ph\":\"e\",";
+            common();
+            std::snprintf(number, sizeof(number), ",\"id\":\"0x%" PRIx64 "\",\"ts\":%" PRId64
+                          ",\"pid\":%u,\"tid\":%u", asyncId, isBegin ? start : end, pid, event.tid);
+            out += number;
+            if (isBegin) args();
+            out += "}";
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool Trace::WriteChromeJson(const std::string& path) {
+    const std::string json = ToChromeJson();
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        INST_LOG_ERROR(TAG, "Cannot create %s", path.c_str());
+        return false;
+    }
+    const bool ok = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+    std::fclose(file);
+    if (!ok) INST_LOG_ERROR(TAG, "Failed to write %s", path.c_str());
+    return ok;
+}
+
+} // namespace instruments
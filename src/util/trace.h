@@ -0,0 +1,88 @@
+#ifndef INSTRUMENTS_UTIL_TRACE_H
+#define INSTRUMENTS_UTIL_TRACE_H
+
+#include "../../include/instruments/trace.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace instruments {
+
+namespace trace {
+
+using Clock = std::chrono::steady_clock;
+
+extern std::atomic<bool> g_recording;
+
+inline bool Enabled() {
+    return g_recording.load(std::memory_order_relaxed);
+}
+
+// A span on the calling thread
+void Complete(const char* category, std::string_view name, Clock::time_point start,
+              Clock::time_point end, std::string_view detail = {});
+
+// A span not bound to a thread (request/reply pairs, which overlap), filed
+// under device rather than the calling thread's TraceDeviceScope
+void Async(const char* category, std::string_view name, Clock::time_point start,
+           Clock::time_point end, std::string_view detail, std::string_view device);
+
+} // namespace trace
+
+// TraceDeviceScope - files the spans this thread records while it lives
+// under one device in the export
+class TraceDeviceScope {
+public:
+    explicit TraceDeviceScope(std::string device);
+    ~TraceDeviceScope();
+
+    // Non-copyable
+    TraceDeviceScope(const TraceDeviceScope&) = delete;
+    TraceDeviceScope& operator=(const TraceDeviceScope&) = delete;
+
+    // Device of the calling thread ("" outside any scope)
+    static const std::string& Current();
+
+private:
+    std::string m_previous;
+};
+
+// TraceSpan - records its lifetime as a span when tracing is on
+class TraceSpan {
+public:
+    TraceSpan(const char* category, const char* name, std::string_view detail = {})
+        : m_active(trace::Enabled())
+    {
+        if (m_active) {
+            m_category = category;
+            m_name = name;
+            m_detail.assign(detail.data(), detail.size());
+            m_start = trace::Clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (m_active) trace::Complete(m_category, m_name, m_start, trace::Clock::now(), m_detail);
+    }
+
+    // Non-copyable
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // Replace the detail once it is known (e.g. the iOS version)
+    void SetDetail(std::string_view detail) {
+        if (m_active) m_detail.assign(detail.data(), detail.size());
+    }
+
+private:
+    bool m_active;
+    const char* m_category = nullptr;
+    const char* m_name = nullptr;
+    std::string m_detail;
+    trace::Clock::time_point m_start;
+};
+
+} // namespace instruments
+
+#endif // INSTRUMENTS_UTIL_TRACE_H
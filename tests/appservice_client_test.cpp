@@ -0,0 +1,176 @@
+// AppServiceClient reply matching, against an in-memory device that
+// answers the RemoteXPC setup and lets the test send the replies
+
+#include "test.h"
+#include "connection/appservice_client.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <mutex>
+
+using namespace instruments;
+
+namespace {
+
+class FakeDevice {
+public:
+    XPCPipe Pipe() {
+        XPCPipe pipe;
+        pipe.send = [this](const std::vector<uint8_t>& data) { return OnSend(data); };
+        pipe.read = [this](uint8_t* buffer, size_t capacity, int timeoutMs) {
+            return Read(buffer, capacity, timeoutMs);
+        };
+        pipe.close = [this]() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_cv.notify_all();
+        };
+        return pipe;
+    }
+
+    // Reply on the root stream; output.tag lets the test tell replies apart
+    void Reply(uint64_t messageId, const std::string& tag) {
+        NSObject::DictType output;
+        output["tag"] = NSObject(tag);
+        NSObject::DictType body;
+        body["CoreDevice.output"] = NSObject(std::move(output));
+        Push(AppServiceClient::RequestStream, messageId, NSObject(std::move(body)));
+    }
+
+    // Wait until the client sent its count-th request; returns its id
+    uint64_t WaitRequest(size_t count) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait_for(lock, std::chrono::seconds(5), [&]() { return m_requests.size() >= count; });
+        return m_requests.size() >= count ? m_requests[count - 1] : 0;
+    }
+
+private:
+    void Push(uint32_t streamId, uint64_t messageId, const NSObject& body) {
+        XPCMessage msg;
+        msg.flags = XPCFlags::AlwaysSet | XPCFlags::Data;
+        msg.messageId = messageId;
+        msg.body = body;
+        H2FrameWriter out;
+        const size_t frame = out.BeginData(streamId);
+        msg.EncodeTo(out.Buffer());
+        out.EndFrame(frame);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inbound.insert(m_inbound.end(), out.Buffer().begin(), out.Buffer().end());
+        m_cv.notify_all();
+    }
+
+    // Answer the preface with SETTINGS and each setup message on its
+    // stream; record the ids of requests
+    bool OnSend(const std::vector<uint8_t>& data) {
+        size_t offset = 0;
+        if (data.size() >= Http2Framer::ClientMagicLen &&
+            std::memcmp(data.data(), Http2Framer::ClientMagic, Http2Framer::ClientMagicLen) == 0) {
+            offset = Http2Framer::ClientMagicLen;
+            H2FrameWriter settings;
+            settings.Settings(false);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_inbound.insert(m_inbound.end(), settings.Buffer().begin(), settings.Buffer().end());
+            m_cv.notify_all();
+        }
+        while (offset < data.size()) {
+            H2FrameView frame;
+            const size_t consumed = Http2Framer::DecodeFrame(data.data() + offset, data.size() - offset, frame);
+            if (consumed == 0) break;
+            offset += consumed;
+            if (frame.type != H2FrameType::Data) continue;
+
+            XPCMessageView view;
+            if (!XPCMessage::Decode(frame.payload, frame.payloadSize, view)) continue;
+            if (view.flags & XPCFlags::WantingReply) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_requests.push_back(view.messageId);
+                m_cv.notify_all();
+            } else {
+                Push(frame.streamId, 0, NSObject::MakeDict({}));
+            }
+        }
+        return true;
+    }
+
+    int Read(uint8_t* buffer, size_t capacity, int timeoutMs) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                      [this]() { return m_closed || !m_inbound.empty(); });
+        if (m_closed) return -1;
+        const size_t n = std::min(capacity, m_inbound.size());
+        std::copy(m_inbound.begin(), m_inbound.begin() + n, buffer);
+        m_inbound.erase(m_inbound.begin(), m_inbound.begin() + n);
+        return static_cast<int>(n);
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<uint8_t> m_inbound;
+    std::vector<uint64_t> m_requests;
+    bool m_closed = false;
+};
+
+// Invoke on another thread; the reply's output.tag, or the error's name
+std::future<std::string> InvokeAsync(AppServiceClient& client, int timeoutMs) {
+    return std::async(std::launch::async, [&client, timeoutMs]() {
+        AppServiceReply reply;
+        Error err = client.Invoke("com.apple.coredevice.feature.launchapplication",
+                                  NSObject::MakeDict({}), reply, timeoutMs);
+        if (err != Error::Success) return std::string(ErrorToString(err));
+        return std::string(reply.output["tag"].AsString());
+    });
+}
+
+} // namespace
+
+TEST(LateReplyToTimedOutRequestIsDropped) {
+    FakeDevice device;
+    AppServiceClient client(device.Pipe());
+    CHECK(client.Start(2000) == Error::Success);
+
+    // The launch times out; its reply arrives while the next request waits
+    auto launch = InvokeAsync(client, 50);
+    const uint64_t launchId = device.WaitRequest(1);
+    CHECK(launch.get() == ErrorToString(Error::Timeout));
+
+    auto kill = InvokeAsync(client, 2000);
+    const uint64_t killId = device.WaitRequest(2);
+    CHECK(killId != 0 && killId != launchId);
+    device.Reply(launchId, "launch");
+    device.Reply(killId, "kill");
+    CHECK(kill.get() == "kill");
+    client.Close();
+}
+
+TEST(UnknownReplyIdIsNotMatched) {
+    FakeDevice device;
+    AppServiceClient client(device.Pipe());
+    CHECK(client.Start(2000) == Error::Success);
+
+    auto request = InvokeAsync(client, 2000);
+    const uint64_t id = device.WaitRequest(1);
+    device.Reply(id + 1000, "stranger");
+    device.Reply(id, "mine");
+    CHECK(request.get() == "mine");
+    client.Close();
+}
+
+TEST(ReplyWithoutIdGoesToOldestRequest) {
+    FakeDevice device;
+    AppServiceClient client(device.Pipe());
+    CHECK(client.Start(2000) == Error::Success);
+
+    auto first = InvokeAsync(client, 2000);
+    device.WaitRequest(1);
+    auto second = InvokeAsync(client, 2000);
+    device.WaitRequest(2);
+    device.Reply(0, "one");
+    device.Reply(0, "two");
+    CHECK(first.get() == "one");
+    CHECK(second.get() == "two");
+    client.Close();
+}
+
+TEST_MAIN()
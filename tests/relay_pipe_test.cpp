@@ -0,0 +1,187 @@
+// RelayPipe, one direction of a PortForwarder relay, driven the way the
+// event loop drives it: level-triggered poll(), Fill() only while
+// HasSpace(), POLLOUT only while HasData()
+
+#include "test.h"
+#include "services/relay_pipe.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <cstring>
+
+using namespace instruments;
+
+namespace {
+
+constexpr size_t kTotalBytes = 8 * 1024 * 1024;
+
+char PatternByte(size_t i) {
+    return static_cast<char>((i ^ (i >> 8) ^ (i >> 16)) * 131);
+}
+
+void SetNonBlocking(int s) {
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Connected loopback TCP pair with small buffers, so a stalled reader
+// backs the relay up after a few hundred KB
+bool TcpPair(int& a, int& b) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listener < 0 ||
+        bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listener, 1) != 0 ||
+        getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr), &len) != 0) {
+        if (listener >= 0) close(listener);
+        return false;
+    }
+    a = socket(AF_INET, SOCK_STREAM, 0);
+    const int size = 64 * 1024;
+    setsockopt(a, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(a, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (connect(a, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(a);
+        close(listener);
+        return false;
+    }
+    b = accept(listener, nullptr, nullptr);
+    close(listener);
+    setsockopt(b, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(b, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    return b >= 0;
+}
+
+// writer -> src ==relay==> dst -> reader
+struct Connection {
+    int writer = -1, src = -1, dst = -1, reader = -1;
+    size_t written = 0;
+    size_t received = 0;
+    bool corrupt = false;
+
+    bool Open() {
+        if (!TcpPair(writer, src) || !TcpPair(dst, reader)) return false;
+        SetNonBlocking(writer);
+        SetNonBlocking(src);
+        SetNonBlocking(dst);
+        SetNonBlocking(reader);
+        return true;
+    }
+
+    ~Connection() {
+        for (int s : {writer, src, dst, reader}) {
+            if (s >= 0) close(s);
+        }
+    }
+
+    // Send what the writer's socket takes; shut it down after the last byte
+    void Write() {
+        char chunk[16 * 1024];
+        while (written < kTotalBytes) {
+            const size_t n = std::min(sizeof(chunk), kTotalBytes - written);
+            for (size_t i = 0; i < n; i++) chunk[i] = PatternByte(written + i);
+            const ssize_t sent = send(writer, chunk, n, MSG_NOSIGNAL);
+            if (sent <= 0) return;
+            written += static_cast<size_t>(sent);
+        }
+        if (writer >= 0) {
+            shutdown(writer, SHUT_WR);
+        }
+    }
+
+    // Read what arrived and check it against the pattern; true at EOF
+    bool Read() {
+        char chunk[16 * 1024];
+        for (;;) {
+            const ssize_t n = recv(reader, chunk, sizeof(chunk), 0);
+            if (n == 0) return true;
+            if (n < 0) return false;
+            for (ssize_t i = 0; i < n; i++) {
+                if (chunk[i] != PatternByte(received + static_cast<size_t>(i))) corrupt = true;
+            }
+            received += static_cast<size_t>(n);
+        }
+    }
+
+    // One event loop iteration for the relay. Returns poll()'s result, or
+    // -1 when the relay failed.
+    int Pump(RelayPipe& pipe, int timeoutMs) {
+        struct pollfd fds[2] = {};
+        fds[0].fd = src;
+        fds[1].fd = dst;
+        if (!pipe.eof && pipe.HasSpace()) fds[0].events |= POLLIN;
+        if (pipe.HasData()) fds[1].events |= POLLOUT;
+        const int ret = poll(fds, 2, timeoutMs);
+        if (ret <= 0) return ret;
+        if (!pipe.eof && pipe.HasSpace() && !pipe.Fill(src)) return -1;
+        if (!pipe.Flush(dst)) return -1;
+        if (pipe.eof && !pipe.HasData()) shutdown(dst, SHUT_WR);
+        return ret;
+    }
+};
+
+// The reader stalls until the relay backs up: the relay must then sleep in
+// poll (no POLLIN on a source it cannot take from), must not take the
+// backlog for EOF, and must deliver every byte once the reader resumes
+void StalledReaderLosesNoData(bool spliced) {
+    Connection conn;
+    CHECK(conn.Open());
+    RelayPipe pipe;
+    if (spliced) {
+        CHECK(pipe.OpenPipe());
+    }
+
+    bool idle = false;
+    for (int i = 0; i < 20000 && !idle; i++) {
+        conn.Write();
+        const int ret = conn.Pump(pipe, 20);
+        CHECK(ret >= 0);
+        if (ret < 0) return;
+        idle = ret == 0;
+    }
+    CHECK(idle);
+    CHECK(!pipe.eof);
+    CHECK(pipe.HasData());
+    CHECK(conn.written < kTotalBytes);
+
+    // Called with the pipe backed up, a read must not see EOF either
+    CHECK(pipe.Fill(conn.src));
+    CHECK(!pipe.eof);
+
+    bool done = false;
+    for (int i = 0; i < 200000 && !done; i++) {
+        conn.Write();
+        if (conn.Pump(pipe, 1) < 0) break;
+        done = conn.Read();
+    }
+    CHECK(done);
+    CHECK(pipe.eof);
+    CHECK(conn.written == kTotalBytes);
+    CHECK(conn.received == kTotalBytes);
+    CHECK(!conn.corrupt);
+}
+
+} // namespace
+
+TEST(StalledReaderLosesNoDataBuffered) {
+    StalledReaderLosesNoData(false);
+}
+
+#ifdef __linux__
+TEST(StalledReaderLosesNoDataSpliced) {
+    StalledReaderLosesNoData(true);
+}
+#endif
+
+#endif // !_WIN32
+
+TEST_MAIN()
@@ -0,0 +1,108 @@
+// RSDServiceCache and the stale-map retry every RSD service connect uses
+
+#include "test.h"
+#include "connection/rsd_cache.h"
+
+using namespace instruments;
+
+namespace {
+
+constexpr const char* kService = "com.apple.coredevice.appservice";
+
+// A device whose service listens on `port`; the host holds a port map that
+// may come from the cache (as DeviceConnection::DiscoverRSDServices() does)
+struct FakeDevice {
+    std::string udid;
+    uint16_t port = 0;
+    std::string bootSession;
+
+    std::map<std::string, uint16_t> services;
+    bool fromCache = false;
+    int connects = 0;
+    int handshakes = 0;
+
+    void Discover() {
+        fromCache = RSDServiceCache::Instance().Lookup(udid, BringUpStrategy::UsbRSD, services);
+        if (!fromCache) Handshake();
+    }
+
+    void Handshake() {
+        handshakes++;
+        services = {{kService, port}};
+        fromCache = false;
+        RSDServiceCache::Instance().Store(udid, BringUpStrategy::UsbRSD, bootSession, services);
+    }
+
+    bool Connect() {
+        return ConnectWithRSDRefresh(kService, fromCache,
+            [this]() {
+                connects++;
+                auto it = services.find(kService);
+                return it != services.end() && it->second == port;
+            },
+            [this]() {
+                RSDServiceCache::Instance().Invalidate(udid, BringUpStrategy::UsbRSD);
+                Handshake();
+                return Error::Success;
+            });
+    }
+};
+
+} // namespace
+
+TEST(StaleCachedPortIsRefreshedOnce) {
+    FakeDevice device{"stale-udid", 62078, "boot-1"};
+    device.Handshake();
+
+    // The device reboots and the service moves; a new host process still
+    // finds the old map in the cache
+    device.port = 49152;
+    device.bootSession = "boot-2";
+    device.handshakes = 0;
+    device.Discover();
+    CHECK(device.fromCache);
+    CHECK(device.handshakes == 0);
+
+    CHECK(device.Connect());
+    CHECK(device.connects == 2);
+    CHECK(device.handshakes == 1);
+    CHECK(!device.fromCache);
+
+    std::map<std::string, uint16_t> cached;
+    CHECK(RSDServiceCache::Instance().Lookup("stale-udid", BringUpStrategy::UsbRSD, cached));
+    CHECK(cached[kService] == 49152);
+}
+
+TEST(FreshMapFailureDoesNotHandshakeAgain) {
+    FakeDevice device{"fresh-udid", 5000, "boot-1"};
+    device.Discover();
+    CHECK(device.handshakes == 1);
+
+    device.port = 5001;     // service restarted after the handshake
+    CHECK(!device.Connect());
+    CHECK(device.connects == 1);
+    CHECK(device.handshakes == 1);
+}
+
+TEST(RefreshFailureFailsTheConnect) {
+    bool fromCache = true;
+    int connects = 0;
+    const bool ok = ConnectWithRSDRefresh(kService, fromCache,
+        [&]() { connects++; return false; },
+        []() { return Error::ConnectionFailed; });
+    CHECK(!ok);
+    CHECK(connects == 1);
+}
+
+TEST(CachedMapThatWorksIsUsedAsIs) {
+    FakeDevice device{"warm-udid", 6000, "boot-1"};
+    device.Handshake();
+    device.handshakes = 0;
+    device.Discover();
+    CHECK(device.fromCache);
+    CHECK(device.Connect());
+    CHECK(device.connects == 1);
+    CHECK(device.handshakes == 0);
+}
+
+TEST_MAIN()
@@ -0,0 +1,64 @@
+#ifndef INSTRUMENTS_TESTS_TEST_H
+#define INSTRUMENTS_TESTS_TEST_H
+
+// Minimal test harness: each tests/*_test.cpp is one executable (ctest
+// target) whose TEST() cases run in order from TEST_MAIN(). CHECK records
+// a failure and continues; a case fails if any CHECK in it failed.
+
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+namespace instruments_test {
+
+struct Case {
+    const char* name;
+    void (*fn)();
+};
+
+inline std::vector<Case>& Cases() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+inline int& Failures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct Register {
+    Register(const char* name, void (*fn)()) { Cases().push_back({name, fn}); }
+};
+
+inline int RunAll() {
+    int failed = 0;
+    for (const auto& c : Cases()) {
+        const int before = Failures();
+        c.fn();
+        const bool ok = Failures() == before;
+        std::printf("[%s] %s\n", ok ? "PASS" : "FAIL", c.name);
+        if (!ok) failed++;
+    }
+    std::printf("%zu cases, %d failed\n", Cases().size(), failed);
+    return failed == 0 ? 0 : 1;
+}
+
+} // namespace instruments_test
+
+#define TEST(name)                                                              \
+    static void name();                                                         \
+    static instruments_test::Register name##_register(#name, name);             \
+    static void name()
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            std::printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            instruments_test::Failures()++;                                     \
+        }                                                                       \
+    } while (0)
+
+#define TEST_MAIN()                                                             \
+    int main() { return instruments_test::RunAll(); }
+
+#endif // INSTRUMENTS_TESTS_TEST_H
@@ -0,0 +1,184 @@
+// XCTestScheduler's handling of batches cut short, on stand-in sessions
+
+#include "test.h"
+#include "instruments/xctest_scheduler.h"
+#include "instruments/xctest_session.h"
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <map>
+#include <mutex>
+
+using namespace instruments;
+
+namespace {
+
+// How a stand-in device behaves
+struct Script {
+    int dropAfter = -1;                 // first batch loses the connection after this many results
+    bool reopenFails = false;           // Open() fails after the first one
+    std::shared_future<void> openGate;  // Open() waits for it, if valid
+    std::promise<void>* dropped = nullptr;   // set when the connection drops
+};
+
+// Reports every test of a batch as passed, unless its script drops the
+// connection or Cancel() stops it first
+class FakeSession : public XCTestSession {
+public:
+    explicit FakeSession(Script script) : XCTestSession(nullptr), m_script(std::move(script)) {}
+
+    Error Open(const XCTestConfig&, LogCallback, ErrorCallback) override {
+        if (m_script.openGate.valid()) m_script.openGate.wait();
+        if (m_opens++ > 0 && m_script.reopenFails) return Error::ConnectionFailed;
+        return Error::Success;
+    }
+
+    Error Run(const std::vector<std::string>& tests, XCTestCallback resultCb,
+              std::vector<TestResult>*) override {
+        for (size_t i = 0; i < tests.size(); i++) {
+            if (m_cancelled.load()) return Error::Cancelled;
+            if (!m_hasDropped && m_script.dropAfter == static_cast<int>(i)) {
+                m_hasDropped = true;
+                if (m_script.dropped) m_script.dropped->set_value();
+                return Error::ConnectionFailed;
+            }
+            TestResult result;
+            const size_t slash = tests[i].find('/');
+            result.className = tests[i].substr(0, slash);
+            result.methodName = tests[i].substr(slash + 1) + "()";
+            resultCb(result);
+        }
+        return Error::Success;
+    }
+
+    void Cancel() override { m_cancelled.store(true); }
+    void Close() override {}
+
+private:
+    Script m_script;
+    int m_opens = 0;
+    bool m_hasDropped = false;
+    std::atomic<bool> m_cancelled{false};
+};
+
+class FakeScheduler : public XCTestScheduler {
+public:
+    FakeScheduler(std::vector<Script> scripts, XCTestShardConfig config)
+        : XCTestScheduler(std::vector<std::shared_ptr<DeviceConnection>>(scripts.size()), config)
+        , m_scripts(std::move(scripts)) {}
+
+    // Results per "Class/method"
+    std::map<std::string, int> Run(const std::vector<std::string>& tests, Error& err,
+                                   std::function<void()> onResult = nullptr) {
+        std::map<std::string, int> seen;
+        std::mutex mutex;
+        err = XCTestScheduler::Run(tests, [&](size_t, const TestResult& r) {
+            std::string method = r.methodName.substr(0, r.methodName.size() - 2);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                seen[r.className + "/" + method]++;
+            }
+            if (onResult) onResult();
+        });
+        return seen;
+    }
+
+protected:
+    std::shared_ptr<XCTestSession> CreateSession(size_t device) override {
+        return std::make_shared<FakeSession>(m_scripts[device]);
+    }
+
+private:
+    std::vector<Script> m_scripts;
+};
+
+std::vector<std::string> Tests(size_t count) {
+    std::vector<std::string> tests;
+    for (size_t i = 0; i < count; i++) tests.push_back("SuiteTests/test" + std::to_string(i));
+    return tests;
+}
+
+XCTestShardConfig Config(size_t perUnit, int maxAttempts = 2) {
+    XCTestShardConfig config;
+    config.testsPerUnit = perUnit;
+    config.maxAttempts = maxAttempts;
+    return config;
+}
+
+std::vector<std::string> Sorted(std::vector<std::string> v) {
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+} // namespace
+
+TEST(DroppedBatchHandsUnreportedTestsToAnotherDevice) {
+    // Device 1 starts only once device 0 lost its connection one result
+    // into its first unit (and could not reopen)
+    std::promise<void> dropped;
+    Script device0;
+    device0.dropAfter = 1;
+    device0.reopenFails = true;
+    device0.dropped = &dropped;
+    Script device1;
+    device1.openGate = dropped.get_future().share();
+
+    FakeScheduler scheduler({device0, device1}, Config(3));
+    const auto tests = Tests(12);
+    Error err = Error::InternalError;
+    auto seen = scheduler.Run(tests, err);
+
+    CHECK(err == Error::Success);
+    CHECK(seen.size() == tests.size());
+    for (const auto& test : tests) CHECK(seen[test] == 1);
+    CHECK(scheduler.Abandoned().empty());
+
+    auto report = scheduler.Report();
+    CHECK(report[0].error == Error::ConnectionFailed);
+    CHECK(report[0].tests == 1);
+    CHECK(report[0].units == 0);
+    CHECK(report[1].tests == 11);
+}
+
+TEST(DroppedBatchAbandonsUnreportedTestsWhenNoDeviceIsLeft) {
+    Script device;
+    device.dropAfter = 2;
+    device.reopenFails = true;
+    FakeScheduler scheduler({device}, Config(4));
+    Error err = Error::Success;
+    auto seen = scheduler.Run(Tests(4), err);
+
+    CHECK(err == Error::ConnectionFailed);
+    CHECK(seen.size() == 2);
+    CHECK(Sorted(scheduler.Abandoned()) ==
+          (std::vector<std::string>{"SuiteTests/test2", "SuiteTests/test3"}));
+}
+
+TEST(LastAttemptAbandonsOnlyUnreportedTests) {
+    Script device;
+    device.dropAfter = 1;
+    FakeScheduler scheduler({device}, Config(3, 1));
+    Error err = Error::InternalError;
+    auto seen = scheduler.Run(Tests(6), err);
+
+    // The session reopens and runs the second unit
+    CHECK(err == Error::Success);
+    CHECK(seen.size() == 4);
+    CHECK(seen["SuiteTests/test0"] == 1);
+    CHECK(Sorted(scheduler.Abandoned()) ==
+          (std::vector<std::string>{"SuiteTests/test1", "SuiteTests/test2"}));
+    CHECK(scheduler.Report()[0].units == 1);
+}
+
+TEST(StopMidBatchAbandonsUnreportedTests) {
+    FakeScheduler scheduler({Script{}}, Config(2));
+    Error err = Error::Success;
+    auto seen = scheduler.Run(Tests(4), err, [&scheduler]() { scheduler.Stop(); });
+
+    CHECK(err == Error::Cancelled);
+    CHECK(seen.size() == 1);
+    CHECK(Sorted(scheduler.Abandoned()) ==
+          (std::vector<std::string>{"SuiteTests/test1", "SuiteTests/test2", "SuiteTests/test3"}));
+}
+
+TEST_MAIN()
@@ -2,8 +2,11 @@
 #include <cstdio>
 #include <cstring>
 #include <csignal>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace instruments;
@@ -24,6 +27,8 @@ static void PrintUsage(const char* prog) {
         "  process kill       Kill a process by PID\n"
         "  fps                Monitor FPS\n"
         "  perf               Monitor system/process performance\n"
+        "  logs               Stream device logs (--predicate, --pid, --experimental-decoder)\n"
+        "  screenshot         Save a screenshot (--out), or stream at --fps and report the rate\n"
         "  xctest             Run XCTest bundle\n"
         "  wda                Run WebDriverAgent\n"
         "  tunnel list        List active tunnels\n"
@@ -34,6 +39,26 @@ static void PrintUsage(const char* prog) {
         "  --udid <UDID>      Target device UDID (iOS 12-17.x USB)\n"
         "  --address <IPv6>   Tunnel address for iOS 17+/18+/26+ (from go-ios or pymobiledevice3)\n"
         "  --rsd-port <port>  RSD port for tunnel (default: 58783)\n"
+        "\n"
+        "Multi-device options (process list/launch/kill, perf, fps):\n"
+        "  --udids <a,b,c>    Run the command on these devices concurrently in one process\n"
+        "  --all              Run the command on every connected device\n"
+        "\n"
+        "FPS options:\n"
+        "  --interval <ms>    Device sampling interval (default: 1000)\n"
+        "  --window <ms>      Report min/avg/max once per window instead of every sample\n"
+        "  --adaptive         Sample every 100 ms only while FPS drops below 50\n"
+        "\n"
+        "Log options:\n"
+        "  --predicate <expr> NSPredicate evaluated on the device, e.g. 'subsystem == \"com.apple.UIKit\"'\n"
+        "  --experimental-decoder  Decode records with the unverified packed-record decoder\n"
+        "\n"
+        "Screenshot options:\n"
+        "  --out <file>       Image file for a single capture (default: screenshot.png)\n"
+        "  --fps <n>          Stream captures at n fps (0 = as fast as possible)\n"
+        "  --count <n>        Stop streaming after n frames\n"
+        "\n"
+        "  --trace <file>     Write a Chrome trace-event timeline of the run (chrome://tracing, ui.perfetto.dev)\n"
         "  --verbose          Enable debug logging\n"
         "  --quiet            Suppress info logging\n"
         "\n", prog);
@@ -44,6 +69,8 @@ struct CLIArgs {
     std::string command;
     std::string subcommand;
     std::string udid;
+    std::vector<std::string> udids;  // --udids
+    bool allDevices = false;         // --all
     std::string tunnelAddress;  // IPv6/IPv4 address for CreateFromTunnel
     uint16_t rsdPort = 58783;   // RSD port (default 58783)
     std::string bundleId;
@@ -51,10 +78,18 @@ struct CLIArgs {
     std::string xctestConfig;
     int64_t pid = 0;
     uint32_t interval = 1000;
+    uint32_t windowMs = 0;
+    bool adaptive = false;
     uint16_t hostPort = 0;
     uint16_t devicePort = 0;
     uint16_t wdaPort = 8100;
     uint16_t mjpegPort = 9100;
+    std::string predicate;
+    bool experimentalDecoder = false;
+    std::string outFile;
+    double targetFps = -1.0;    // < 0: single capture
+    uint64_t frameCount = 0;    // 0: until Ctrl+C
+    std::string traceFile;
     bool verbose = false;
     bool quiet = false;
 };
@@ -77,6 +112,17 @@ static CLIArgs ParseArgs(int argc, char* argv[]) {
         std::string opt = argv[i];
         if (opt == "--udid" && i + 1 < argc) {
             args.udid = argv[++i];
+        } else if (opt == "--udids" && i + 1 < argc) {
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t comma = list.find(',', start);
+                if (comma == std::string::npos) comma = list.size();
+                if (comma > start) args.udids.push_back(list.substr(start, comma - start));
+                start = comma + 1;
+            }
+        } else if (opt == "--all") {
+            args.allDevices = true;
         } else if (opt == "--address" && i + 1 < argc) {
             args.tunnelAddress = argv[++i];
         } else if (opt == "--rsd-port" && i + 1 < argc) {
@@ -91,6 +137,10 @@ static CLIArgs ParseArgs(int argc, char* argv[]) {
             args.pid = std::atoll(argv[++i]);
         } else if (opt == "--interval" && i + 1 < argc) {
             args.interval = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (opt == "--window" && i + 1 < argc) {
+            args.windowMs = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (opt == "--adaptive") {
+            args.adaptive = true;
         } else if (opt == "--host-port" && i + 1 < argc) {
             args.hostPort = static_cast<uint16_t>(std::atoi(argv[++i]));
         } else if (opt == "--device-port" && i + 1 < argc) {
@@ -99,6 +149,18 @@ static CLIArgs ParseArgs(int argc, char* argv[]) {
             args.wdaPort = static_cast<uint16_t>(std::atoi(argv[++i]));
         } else if (opt == "--mjpeg-port" && i + 1 < argc) {
             args.mjpegPort = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (opt == "--predicate" && i + 1 < argc) {
+            args.predicate = argv[++i];
+        } else if (opt == "--experimental-decoder") {
+            args.experimentalDecoder = true;
+        } else if (opt == "--out" && i + 1 < argc) {
+            args.outFile = argv[++i];
+        } else if (opt == "--fps" && i + 1 < argc) {
+            args.targetFps = std::atof(argv[++i]);
+        } else if (opt == "--count" && i + 1 < argc) {
+            args.frameCount = static_cast<uint64_t>(std::atoll(argv[++i]));
+        } else if (opt == "--trace" && i + 1 < argc) {
+            args.traceFile = argv[++i];
         } else if (opt == "--verbose") {
             args.verbose = true;
         } else if (opt == "--quiet") {
@@ -193,9 +255,18 @@ static int CmdFPS(const CLIArgs& args) {
 
     printf("Monitoring FPS (interval=%ums, Ctrl+C to stop)...\n", args.interval);
 
-    Error err = inst->FPS().Start(args.interval,
+    FPSConfig config;
+    config.sampleIntervalMs = args.interval;
+    config.windowMs = args.windowMs;
+    config.adaptive = args.adaptive;
+    Error err = inst->FPS().Start(config,
         [](const FPSData& data) {
-            printf("FPS: %.0f  GPU: %.1f%%\n", data.fps, data.gpuUtilization);
+            if (data.samples > 1) {
+                printf("FPS: %.0f (min %.0f, max %.0f, %u samples)  GPU: %.1f%%\n",
+                       data.fps, data.fpsMin, data.fpsMax, data.samples, data.gpuUtilization);
+            } else {
+                printf("FPS: %.0f  GPU: %.1f%%\n", data.fps, data.gpuUtilization);
+            }
         },
         [](Error e, const std::string& msg) {
             fprintf(stderr, "Error: %s - %s\n", ErrorToString(e), msg.c_str());
@@ -215,6 +286,129 @@ static int CmdFPS(const CLIArgs& args) {
     return 0;
 }
 
+static const char* OSLogTypeName(OSLogType type) {
+    switch (type) {
+        case OSLogType::Info:  return "Info";
+        case OSLogType::Debug: return "Debug";
+        case OSLogType::Error: return "Error";
+        case OSLogType::Fault: return "Fault";
+        default:               return "Default";
+    }
+}
+
+static int CmdLogs(const CLIArgs& args) {
+    auto inst = ConnectDevice(args);
+    if (!inst) return 1;
+
+    LogStreamConfig config;
+    config.predicate = args.predicate;
+    config.experimentalDecoder = args.experimentalDecoder;
+    if (args.pid != 0) config.pid = args.pid;
+    if (!config.experimentalDecoder) {
+        printf("Note: log records are not decoded yet; pass --experimental-decoder to try\n"
+               "      the unverified decoder\n");
+    }
+
+    printf("Streaming device logs (Ctrl+C to stop)...\n");
+
+    Error err = inst->LogStream().Start(config,
+        [](const LogEntry& e) {
+            printf("%-7s %s[%lld] <%s:%s> %s\n", OSLogTypeName(e.type), e.process.c_str(),
+                   (long long)e.pid, e.subsystem.c_str(), e.category.c_str(), e.message.c_str());
+        },
+        [](Error e, const std::string& msg) {
+            fprintf(stderr, "Error: %s - %s\n", ErrorToString(e), msg.c_str());
+        }
+    );
+    if (err != Error::Success) {
+        fprintf(stderr, "Error: %s\n", ErrorToString(err));
+        return 1;
+    }
+
+    while (g_running.load() && inst->LogStream().IsRunning()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    inst->LogStream().Stop();
+    const LogStreamStats stats = inst->LogStream().Stats();
+    fprintf(stderr, "%llu entries, %llu dropped, %llu malformed, %llu messages undecoded\n",
+            (unsigned long long)stats.received, (unsigned long long)stats.dropped,
+            (unsigned long long)stats.malformed, (unsigned long long)stats.undecoded);
+    return 0;
+}
+
+static int CmdScreenshot(const CLIArgs& args) {
+    auto inst = ConnectDevice(args);
+    if (!inst) return 1;
+
+    if (args.targetFps < 0 && args.frameCount == 0) {
+        ScreenshotFrame frame;
+        Error err = inst->Screenshot().Capture(frame);
+        if (err != Error::Success) {
+            fprintf(stderr, "Error: %s\n", ErrorToString(err));
+            return 1;
+        }
+        std::string path = args.outFile;
+        if (path.empty()) {
+            path = frame.format == ScreenshotFrame::Format::JPEG ? "screenshot.jpg" : "screenshot.png";
+        }
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file || fwrite(frame.data, 1, frame.size, file) != frame.size) {
+            if (file) fclose(file);
+            fprintf(stderr, "Error: cannot write %s\n", path.c_str());
+            return 1;
+        }
+        fclose(file);
+        printf("Saved %s (%zu bytes, %.1f ms)\n", path.c_str(), frame.size, frame.latencyUs / 1000.0);
+        return 0;
+    }
+
+    const double targetFps = args.targetFps < 0 ? 0.0 : args.targetFps;
+    if (targetFps > 0) {
+        printf("Capturing screenshots (target %.1f fps, Ctrl+C to stop)...\n", targetFps);
+    } else {
+        printf("Capturing screenshots as fast as possible (Ctrl+C to stop)...\n");
+    }
+
+    std::atomic<uint64_t> frames{0};
+    Error err = inst->Screenshot().Start(targetFps,
+        [&frames](const ScreenshotFrame&) {
+            frames.fetch_add(1);
+        },
+        [](Error e, const std::string& msg) {
+            fprintf(stderr, "Error: %s - %s\n", ErrorToString(e), msg.c_str());
+        }
+    );
+    if (err != Error::Success) {
+        fprintf(stderr, "Error: %s\n", ErrorToString(err));
+        return 1;
+    }
+
+    // Report the rate over each second
+    auto lastReport = std::chrono::steady_clock::now();
+    uint64_t lastFrames = 0;
+    while (g_running.load() && (args.frameCount == 0 || frames.load() < args.frameCount)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds >= 1.0) {
+            const uint64_t total = frames.load();
+            printf("%.1f fps  (%llu frames)\n", (total - lastFrames) / seconds,
+                   (unsigned long long)total);
+            lastFrames = total;
+            lastReport = now;
+        }
+    }
+
+    inst->Screenshot().Stop();
+    const ScreenshotStats stats = inst->Screenshot().Stats();
+    printf("\n%llu frames, %llu failed, %.1f fps achieved, %.1f ms mean latency, %.1f KB/frame\n",
+           (unsigned long long)stats.frames, (unsigned long long)stats.failures,
+           stats.achievedFps, stats.meanLatencyMs,
+           stats.frames ? stats.bytes / 1024.0 / stats.frames : 0.0);
+    return 0;
+}
+
 static int CmdPerf(const CLIArgs& args) {
     auto inst = ConnectDevice(args);
     if (!inst) return 1;
@@ -416,27 +610,188 @@ static int CmdForward(const CLIArgs& args) {
     return 0;
 }
 
-int main(int argc, char* argv[]) {
-    signal(SIGINT, SignalHandler);
-#ifdef SIGTERM
-    signal(SIGTERM, SignalHandler);
-#endif
+// --- Multi-device mode (--udids / --all) ---
 
-    if (argc < 2) {
-        PrintUsage(argv[0]);
+// Devices set up and torn down at once in multi-device mode
+static constexpr size_t kMultiDeviceThreads = 8;
+
+struct DeviceRun {
+    std::string udid;
+    std::string tag;                    // short UDID for output lines
+    std::shared_ptr<Instruments> inst;
+    double connectMs = 0;               // DeviceConnection (lockdown / tunnel)
+    double commandMs = 0;               // instruments connection + the command
+    std::atomic<uint64_t> samples{0};   // perf / fps streams
+    std::string result;
+    bool ok = false;
+};
+
+static double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<std::string> ResolveUdids(const CLIArgs& args) {
+    std::vector<std::string> udids = args.udids;
+    if (args.allDevices) {
+        char** list = nullptr;
+        int count = 0;
+        if (idevice_get_device_list(&list, &count) == IDEVICE_E_SUCCESS) {
+            for (int i = 0; i < count; i++) udids.push_back(list[i]);
+            idevice_device_list_free(list);
+        }
+    }
+    // A device attached over USB and the network is listed twice
+    std::sort(udids.begin(), udids.end());
+    udids.erase(std::unique(udids.begin(), udids.end()), udids.end());
+    return udids;
+}
+
+// Run fn for every device on up to kMultiDeviceThreads threads
+template <typename Fn>
+static void ForEachDevice(std::vector<std::unique_ptr<DeviceRun>>& runs, Fn fn) {
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    const size_t count = std::min(runs.size(), kMultiDeviceThreads);
+    for (size_t t = 0; t < count; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i; (i = next.fetch_add(1)) < runs.size();) fn(*runs[i]);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+static void RunOnDevice(const CLIArgs& args, const std::shared_ptr<DTXReactor>& reactor, DeviceRun& run) {
+    auto start = std::chrono::steady_clock::now();
+    run.inst = Instruments::Create(run.udid);
+    run.connectMs = MsSince(start);
+    if (!run.inst) {
+        run.result = "device not found or not reachable";
+        return;
+    }
+    // Every device's DTX connections share the reactor's I/O threads
+    run.inst->Connection()->SetReactor(reactor);
+
+    start = std::chrono::steady_clock::now();
+    Error err = Error::Success;
+    char result[128] = {};
+    if (args.command == "process" && args.subcommand == "list") {
+        std::vector<ProcessInfo> procs;
+        err = run.inst->Process().GetProcessList(procs);
+        std::snprintf(result, sizeof(result), "%zu processes", procs.size());
+    } else if (args.command == "process" && args.subcommand == "launch") {
+        int64_t pid = 0;
+        err = run.inst->Process().LaunchApp(args.bundleId, pid);
+        std::snprintf(result, sizeof(result), "launched, PID %lld", (long long)pid);
+    } else if (args.command == "process" && args.subcommand == "kill") {
+        err = run.inst->Process().KillProcess(args.pid);
+        std::snprintf(result, sizeof(result), "killed PID %lld", (long long)args.pid);
+    } else if (args.command == "perf") {
+        PerfConfig config;
+        config.sampleIntervalMs = args.interval;
+        err = run.inst->Performance().Start(config,
+            [&run](const SystemMetrics& m) {
+                run.samples.fetch_add(1, std::memory_order_relaxed);
+                printf("[%s] CPU: %.1f%%  Net I/O: %llu/%llu bytes\n", run.tag.c_str(),
+                       m.cpuTotalLoad, (unsigned long long)m.netBytesIn,
+                       (unsigned long long)m.netBytesOut);
+            },
+            nullptr,
+            [&run](Error e, const std::string& msg) {
+                fprintf(stderr, "[%s] Error: %s - %s\n", run.tag.c_str(), ErrorToString(e), msg.c_str());
+            });
+        std::snprintf(result, sizeof(result), "streaming");
+    } else if (args.command == "fps") {
+        FPSConfig config;
+        config.sampleIntervalMs = args.interval;
+        config.windowMs = args.windowMs;
+        config.adaptive = args.adaptive;
+        err = run.inst->FPS().Start(config,
+            [&run](const FPSData& data) {
+                run.samples.fetch_add(1, std::memory_order_relaxed);
+                printf("[%s] FPS: %.0f  GPU: %.1f%%\n", run.tag.c_str(), data.fps, data.gpuUtilization);
+            },
+            [&run](Error e, const std::string& msg) {
+                fprintf(stderr, "[%s] Error: %s - %s\n", run.tag.c_str(), ErrorToString(e), msg.c_str());
+            });
+        std::snprintf(result, sizeof(result), "streaming");
+    }
+    run.commandMs = MsSince(start);
+
+    run.ok = err == Error::Success;
+    run.result = run.ok ? result : ErrorToString(err);
+}
+
+static int CmdMultiDevice(const CLIArgs& args) {
+    const bool streaming = args.command == "perf" || args.command == "fps";
+    if (args.command == "process" && args.subcommand != "list" &&
+        args.subcommand != "launch" && args.subcommand != "kill") {
+        fprintf(stderr, "Unknown process subcommand: %s\n", args.subcommand.c_str());
+        return 1;
+    }
+    if (args.command == "process" && args.subcommand == "launch" && args.bundleId.empty()) {
+        fprintf(stderr, "Error: --bundle required\n");
+        return 1;
+    }
+    if (args.command == "process" && args.subcommand == "kill" && args.pid == 0) {
+        fprintf(stderr, "Error: --pid required\n");
         return 1;
     }
 
-    CLIArgs args = ParseArgs(argc, argv);
+    std::vector<std::unique_ptr<DeviceRun>> runs;
+    for (const auto& udid : ResolveUdids(args)) {
+        auto run = std::make_unique<DeviceRun>();
+        run->udid = udid;
+        run->tag = udid.substr(0, 8);
+        runs.push_back(std::move(run));
+    }
+    if (runs.empty()) {
+        fprintf(stderr, "Error: no devices\n");
+        return 1;
+    }
 
-    // Configure logging
-    if (args.verbose) {
-        Instruments::SetLogLevel(LogLevel::Debug);
-    } else if (args.quiet) {
-        Instruments::SetLogLevel(LogLevel::Error);
+    auto reactor = DTXReactor::Create();
+    if (!reactor) {
+        fprintf(stderr, "Error: failed to start I/O threads\n");
+        return 1;
+    }
+    printf("Running on %zu device(s), %zu setup threads, %zu I/O threads...\n",
+           runs.size(), std::min(runs.size(), kMultiDeviceThreads), reactor->ThreadCount());
+
+    const auto start = std::chrono::steady_clock::now();
+    ForEachDevice(runs, [&](DeviceRun& run) { RunOnDevice(args, reactor, run); });
+    const double setupMs = MsSince(start);
+
+    if (streaming) {
+        printf("Streaming (Ctrl+C to stop)...\n");
+        while (g_running.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        ForEachDevice(runs, [&](DeviceRun& run) {
+            if (!run.inst) return;
+            if (args.command == "perf") run.inst->Performance().Stop();
+            if (args.command == "fps") run.inst->FPS().Stop();
+        });
     }
 
-    // Dispatch command
+    printf("\n%-26s %10s %10s %9s  %s\n", "UDID", "Connect", "Command", "Samples", "Result");
+    size_t failed = 0;
+    for (const auto& run : runs) {
+        printf("%-26.26s %8.0fms %8.0fms %9llu  %s\n", run->udid.c_str(), run->connectMs,
+               run->commandMs, (unsigned long long)run->samples.load(), run->result.c_str());
+        if (!run->ok) failed++;
+    }
+    printf("\n%zu device(s), %zu failed, set up in %.0fms\n", runs.size(), failed, setupMs);
+
+    // Services stop before the shared reactor goes away
+    runs.clear();
+    return failed > 0 ? 1 : 0;
+}
+
+static int RunCommand(const CLIArgs& args, const char* prog) {
+    const bool multiDevice = !args.udids.empty() || args.allDevices;
+    if (multiDevice && (args.command == "process" || args.command == "perf" || args.command == "fps")) {
+        return CmdMultiDevice(args);
+    }
     if (args.command == "process") {
         if (args.subcommand == "list") return CmdProcessList(args);
         if (args.subcommand == "launch") return CmdProcessLaunch(args);
@@ -446,12 +801,46 @@ int main(int argc, char* argv[]) {
     }
     if (args.command == "fps") return CmdFPS(args);
     if (args.command == "perf") return CmdPerf(args);
+    if (args.command == "logs") return CmdLogs(args);
+    if (args.command == "screenshot") return CmdScreenshot(args);
     if (args.command == "xctest") return CmdXCTest(args);
     if (args.command == "wda") return CmdWDA(args);
     if (args.command == "tunnel") return CmdTunnel(args);
     if (args.command == "forward") return CmdForward(args);
 
     fprintf(stderr, "Unknown command: %s\n", args.command.c_str());
-    PrintUsage(argv[0]);
+    PrintUsage(prog);
     return 1;
 }
+
+int main(int argc, char* argv[]) {
+    signal(SIGINT, SignalHandler);
+#ifdef SIGTERM
+    signal(SIGTERM, SignalHandler);
+#endif
+
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    CLIArgs args = ParseArgs(argc, argv);
+
+    // Configure logging
+    if (args.verbose) {
+        Instruments::SetLogLevel(LogLevel::Debug);
+    } else if (args.quiet) {
+        Instruments::SetLogLevel(LogLevel::Error);
+    }
+
+    if (!args.traceFile.empty()) Trace::Start();
+    const int result = RunCommand(args, argv[0]);
+    if (!args.traceFile.empty()) {
+        Trace::Stop();
+        if (Trace::WriteChromeJson(args.traceFile)) {
+            fprintf(stderr, "Trace written to %s (%zu events)\n",
+                    args.traceFile.c_str(), Trace::EventCount());
+        }
+    }
+    return result;
+}